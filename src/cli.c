@@ -32,6 +32,7 @@
 #include <bzip2_compression.h>
 #include <cmd.h>
 #include <configuration.h>
+#include <dictionary.h>
 #include <gzip_compression.h>
 #include <info.h>
 #include <json.h>
@@ -79,6 +80,7 @@
 #define COMMAND_RELOAD         "reload"
 #define COMMAND_RESET          "reset"
 #define COMMAND_RESTORE        "restore"
+#define COMMAND_RESTORE_WAL    "restore-wal"
 #define COMMAND_RETAIN         "retain"
 #define COMMAND_SHUTDOWN       "shutdown"
 #define COMMAND_STATUS         "status"
@@ -94,6 +96,7 @@
 static void help_backup(void);
 static void help_list_backup(void);
 static void help_restore(void);
+static void help_restore_wal(void);
 static void help_verify(void);
 static void help_archive(void);
 static void help_delete(void);
@@ -116,6 +119,7 @@ static void display_helper(char* command);
 static int backup(SSL* ssl, int socket, char* server, uint8_t compression, uint8_t encryption, char* incremental, int32_t output_format);
 static int list_backup(SSL* ssl, int socket, char* server, char* sort_order, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int restore(SSL* ssl, int socket, char* server, char* backup_id, char* position, char* directory, uint8_t compression, uint8_t encryption, int32_t output_format);
+static int restore_wal(SSL* ssl, int socket, char* server, char* filename, char* destination, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int archive(SSL* ssl, int socket, char* server, char* backup_id, char* position, char* directory, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int delete(SSL* ssl, int socket, char* server, char* backup_id, uint8_t compression, uint8_t encryption, int32_t output_format);
@@ -129,7 +133,7 @@ static int retain(SSL* ssl, int socket, char* server, char* backup_id, bool casc
 static int expunge(SSL* ssl, int socket, char* server, char* backup_id, bool cascade, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int decrypt_data_client(char* from);
 static int encrypt_data_client(char* from);
-static int decompress_data_client(char* from);
+static int decompress_data_client(char* from, char* dictionary);
 static int compress_data_client(char* from, uint8_t compression);
 static int decrypt_data_server(SSL* ssl, int socket, char* path, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int encrypt_data_server(SSL* ssl, int socket, char* path, uint8_t compression, uint8_t encryption, int32_t output_format);
@@ -226,6 +230,7 @@ usage(void)
    printf("  mode                     Switch the mode for a server\n");
    printf("  ping                     Check if pgmoneta is alive\n");
    printf("  restore                  Restore a backup from a server\n");
+   printf("  restore-wal              Restore a WAL file from a server, as a restore_command\n");
    printf("  retain                   Retain a backup from a server\n");
    printf("  shutdown                 Shutdown pgmoneta\n");
    printf("  status [details]         Status of pgmoneta, with optional details\n");
@@ -260,6 +265,14 @@ struct pgmoneta_command command_table[] = {
       .deprecated = false,
       .log_message = "<restore> [%s]",
    },
+   {
+      .command = "restore-wal",
+      .subcommand = "",
+      .accepted_argument_count = {3},
+      .action = MANAGEMENT_RESTORE_WAL,
+      .deprecated = false,
+      .log_message = "<restore-wal> [%s]",
+   },
    {
       .command = "verify",
       .subcommand = "",
@@ -319,7 +332,7 @@ struct pgmoneta_command command_table[] = {
    {
       .command = "decompress",
       .subcommand = "",
-      .accepted_argument_count = {1},
+      .accepted_argument_count = {1, 2},
       .action = MANAGEMENT_DECOMPRESS,
       .deprecated = false,
       .log_message = "<decompress> [%s]"
@@ -867,6 +880,10 @@ execute:
          exit_code = restore(s_ssl, socket, parsed.args[0], parsed.args[1], NULL, parsed.args[2], compression, encryption, output_format);
       }
    }
+   else if (parsed.cmd->action == MANAGEMENT_RESTORE_WAL)
+   {
+      exit_code = restore_wal(s_ssl, socket, parsed.args[0], parsed.args[1], parsed.args[2], compression, encryption, output_format);
+   }
    else if (parsed.cmd->action == MANAGEMENT_VERIFY)
    {
       if (parsed.args[3])
@@ -949,13 +966,14 @@ execute:
    }
    else if (parsed.cmd->action == MANAGEMENT_DECOMPRESS)
    {
-      if (is_server_conn)
+      // the dictionary directory is on this host
+      if (is_server_conn && parsed.args[1] == NULL)
       {
          exit_code = decompress_data_server(s_ssl, socket, parsed.args[0], compression, encryption, output_format);
       }
       else
       {
-         exit_code = decompress_data_client(parsed.args[0]);
+         exit_code = decompress_data_client(parsed.args[0], parsed.args[1]);
       }
    }
    else if (parsed.cmd->action == MANAGEMENT_COMPRESS)
@@ -1062,6 +1080,14 @@ help_restore(void)
    printf("  pgmoneta-cli restore <server> <timestamp|oldest|newest> [[current|name=X|xid=X|lsn=X|time=X|inclusive=X|timeline=X|action=X|primary|replica],*] <directory>\n");
 }
 
+static void
+help_restore_wal(void)
+{
+   printf("Restore a WAL file for a server\n");
+   printf("  pgmoneta-cli restore-wal <server> <file> <path>\n");
+   printf("  Use as restore_command = 'pgmoneta-cli -c pgmoneta.conf restore-wal <server> %%f %%p'\n");
+}
+
 static void
 help_verify(void)
 {
@@ -1115,7 +1141,7 @@ static void
 help_decompress(void)
 {
    printf("Decompress a file using configured method\n");
-   printf("  pgmoneta-cli decompress <file>\n");
+   printf("  pgmoneta-cli decompress <file> [dictionary-directory]\n");
 }
 
 static void
@@ -1199,6 +1225,10 @@ display_helper(char* command)
    {
       help_restore();
    }
+   else if (!strcmp(command, COMMAND_RESTORE_WAL))
+   {
+      help_restore_wal();
+   }
    else if (!strcmp(command, COMMAND_VERIFY))
    {
       help_verify();
@@ -1333,6 +1363,75 @@ error:
    return 1;
 }
 
+static int
+restore_wal(SSL* ssl, int socket, char* server, char* filename, char* destination, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   bool status = false;
+   char* path = NULL;
+   struct json* read = NULL;
+   struct json* outcome = NULL;
+
+   if (pgmoneta_management_request_restore_wal(ssl, socket, server, filename, destination, compression, encryption, output_format))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_management_read_json(ssl, socket, NULL, NULL, &read))
+   {
+      goto error;
+   }
+
+   outcome = (struct json*)pgmoneta_json_get(read, MANAGEMENT_CATEGORY_OUTCOME);
+   status = (bool)pgmoneta_json_get(outcome, MANAGEMENT_ARGUMENT_STATUS);
+
+   // the file follows the response, and is written here so pgmoneta can run on another host;
+   // PostgreSQL passes a path relative to the data directory, which is the working directory
+   if (status)
+   {
+      path = pgmoneta_append(path, destination);
+      path = pgmoneta_append(path, ".pgmoneta");
+
+      if (pgmoneta_management_read_file(ssl, socket, path) || rename(path, destination))
+      {
+         warnx("pgmoneta-cli: Could not write %s", destination);
+         pgmoneta_delete_file(path, NULL);
+         status = false;
+      }
+   }
+
+   if (MANAGEMENT_OUTPUT_FORMAT_RAW != output_format)
+   {
+      translate_json_object(read);
+   }
+
+   if (MANAGEMENT_OUTPUT_FORMAT_TEXT == output_format)
+   {
+      pgmoneta_json_print(read, FORMAT_TEXT);
+   }
+   else
+   {
+      pgmoneta_json_print(read, FORMAT_JSON);
+   }
+
+   // recovery relies on the exit code to know the end of the archive
+   if (!status)
+   {
+      goto error;
+   }
+
+   pgmoneta_json_destroy(read);
+   free(path);
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(read);
+   free(path);
+
+   return 1;
+}
+
 static int
 verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
@@ -1615,7 +1714,7 @@ error:
 }
 
 static int
-decompress_data_client(char* from)
+decompress_data_client(char* from, char* dictionary)
 {
    char* to = NULL;
 
@@ -1625,6 +1724,17 @@ decompress_data_client(char* from)
       goto error;
    }
 
+   if (dictionary != NULL)
+   {
+      if (!pgmoneta_is_directory(dictionary))
+      {
+         pgmoneta_log_error("Decompress: Dictionary directory doesn't exist: %s", dictionary);
+         goto error;
+      }
+
+      pgmoneta_dictionary_directory(dictionary);
+   }
+
    if (pgmoneta_ends_with(from, ".gz"))
    {
       to = pgmoneta_remove_suffix(from, ".gz");
@@ -2384,6 +2494,9 @@ translate_command(int32_t cmd_code)
       case MANAGEMENT_RESTORE:
          command_output = pgmoneta_append(command_output, COMMAND_RESTORE);
          break;
+      case MANAGEMENT_RESTORE_WAL:
+         command_output = pgmoneta_append(command_output, COMMAND_RESTORE_WAL);
+         break;
       case MANAGEMENT_ARCHIVE:
          command_output = pgmoneta_append(command_output, COMMAND_ARCHIVE);
          break;
@@ -2547,6 +2660,15 @@ translate_encryption(int32_t encryption_code)
       case ENCRYPTION_AES_128_CTR:
          encryption_output = pgmoneta_append(encryption_output, "aes-128-ctr");
          break;
+      case ENCRYPTION_AES_256_GCM:
+         encryption_output = pgmoneta_append(encryption_output, "aes-256-gcm");
+         break;
+      case ENCRYPTION_AES_192_GCM:
+         encryption_output = pgmoneta_append(encryption_output, "aes-192-gcm");
+         break;
+      case ENCRYPTION_AES_128_GCM:
+         encryption_output = pgmoneta_append(encryption_output, "aes-128-gcm");
+         break;
       default:
          encryption_output = pgmoneta_append(encryption_output, "none");
          break;
@@ -34,11 +34,49 @@ extern "C" {
 #endif
 
 #include <pgmoneta.h>
+#include <async_io.h>
 #include <json.h>
 #include <message.h>
 #include <tablespace.h>
+#include <utils.h>
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+
+#define TAR_BLOCK_SIZE 512
+
+/** @struct tar_stream
+ * Defines a streaming tar extractor that writes entries to disk
+ * as the archive bytes arrive
+ */
+struct tar_stream
+{
+   char directory[MAX_PATH];       /**< The destination directory */
+   char header[TAR_BLOCK_SIZE];    /**< The header being assembled */
+   size_t header_size;             /**< The number of header bytes received */
+   char type;                      /**< The type of the current entry */
+   char path[MAX_PATH];            /**< The path of the current entry */
+   char link[MAX_PATH];            /**< The link target of the current entry */
+   char next_path[MAX_PATH];       /**< The path override from an extended header */
+   char next_link[MAX_PATH];       /**< The link target override from an extended header */
+   size_t remaining;               /**< The number of content bytes left of the current entry */
+   size_t padding;                 /**< The number of padding bytes left before the next header */
+   struct async_io* io;            /**< The I/O context for the entries */
+   struct async_file* file;        /**< The file of the current entry */
+   char* extended;                 /**< The content of the current extended header */
+   size_t extended_size;           /**< The number of extended header bytes received */
+   bool end;                       /**< Has the end-of-archive marker been seen */
+   uint64_t bytes;                 /**< The number of content bytes written to disk */
+   char page[SPARSE_BLOCK_SIZE];   /**< The partial block of the current entry */
+   size_t page_size;               /**< The number of bytes in the partial block */
+   uint64_t holes;                 /**< The number of zero bytes left as holes */
+   uint64_t size;                  /**< The size of the current entry */
+   time_t mtime;                   /**< The modification time of the current entry */
+   FILE* journal;                  /**< The journal of fully received files, or NULL */
+   char journal_prefix[MAX_PATH];  /**< The manifest path prefix of the entries */
+   char local_prefix[MAX_PATH];    /**< The path prefix of the entries below the backup directory */
+};
 
 /**
  * Create an archive
@@ -71,9 +109,56 @@ pgmoneta_extract_tar_file(char* file_path, char* destination);
 int
 pgmoneta_tar_directory(char* src, char* dst, char* destination);
 
+/**
+ * Create a tar stream extracting into a directory
+ * @param directory The destination directory
+ * @param stream The resulting stream
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_tar_stream_create(char* directory, struct tar_stream** stream);
+
+/**
+ * Record the regular files of a tar stream in a journal once they are
+ * fully written
+ * @param stream The stream
+ * @param journal The journal
+ * @param journal_prefix The manifest path prefix of the entries
+ * @param local_prefix The path prefix of the entries below the backup directory
+ */
+void
+pgmoneta_tar_stream_journal(struct tar_stream* stream, FILE* journal, char* journal_prefix, char* local_prefix);
+
+/**
+ * Feed archive bytes to a tar stream. The data doesn't need to be
+ * aligned to tar blocks, entries are written as they complete
+ * @param stream The stream
+ * @param data The data
+ * @param size The size of the data
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_tar_stream_write(struct tar_stream* stream, void* data, size_t size);
+
+/**
+ * Finish a tar stream
+ * @param stream The stream
+ * @return 0 upon success, 1 if the archive was truncated
+ */
+int
+pgmoneta_tar_stream_finish(struct tar_stream* stream);
+
+/**
+ * Destroy a tar stream
+ * @param stream The stream
+ */
+void
+pgmoneta_tar_stream_destroy(struct tar_stream* stream);
+
 /**
  * Receive backup tar files from the copy stream and write to disk
  * This functionality is for server version < 15
+ * @param server The server
  * @param ssl The SSL structure
  * @param socket The socket
  * @param buffer The stream buffer
@@ -84,11 +169,12 @@ pgmoneta_tar_directory(char* src, char* dst, char* destination);
  * @return 0 upon success, otherwise 1
  */
 int
-pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket);
+pgmoneta_receive_archive_files(int server, SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket);
 
 /**
  * Receive backup tar files from the copy stream and write to disk
  * This functionality is for server version >= 15
+ * @param server The server
  * @param ssl The SSL structure
  * @param socket The socket
  * @param buffer The stream buffer
@@ -99,7 +185,7 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
  * @return 0 upon success, otherwise 1
  */
 int
-pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket);
+pgmoneta_receive_archive_stream(int server, SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket);
 
 #ifdef __cplusplus
 }
@@ -39,6 +39,21 @@ extern "C" {
 
 #include <openssl/ssl.h>
 
+/* The size of the plaintext of a chunk in the AES-GCM format */
+#define AES_GCM_CHUNK_SIZE (1024 * 1024)
+
+/* The size of the authentication tag after each chunk */
+#define AES_GCM_TAG_SIZE 16
+
+/* The size of the header of a file in the AES-GCM format */
+#define AES_GCM_HEADER_SIZE 40
+
+/* Files with more chunks than this are encrypted and decrypted across the workers */
+#define AES_GCM_PARALLEL_CHUNKS 2
+
+/* The size of the iv stored with an object encrypted on its own */
+#define AES_OBJECT_IV_SIZE 16
+
 /**
  * Encrypt a string
  * @param plaintext The string
@@ -138,6 +153,113 @@ pgmoneta_decrypt_directory(char* d, struct workers* workers);
 void
 pgmoneta_decrypt_request(SSL* ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload);
 
+/**
+ * Create a cipher context using the master key. The GCM modes fail,
+ * as they only exist in the chunked AES-GCM format
+ * @param mode The aes mode
+ * @param enc 1 for encrypt, 0 for decrypt
+ * @param ctx The resulting context
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_create_cipher_context(int mode, int enc, EVP_CIPHER_CTX** ctx);
+
+/**
+ * Create a context decrypting a file from a cipher block onwards using the
+ * master key. Padding is disabled, so the caller removes it from the last block.
+ * The GCM modes fail, use pgmoneta_gcm_read for them
+ * @param mode The aes mode
+ * @param block The number of the cipher block to start from
+ * @param previous The cipher block before it for CBC, or NULL for the first block
+ * @param ctx The resulting context
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_create_cipher_context_at(int mode, uint64_t block, unsigned char* previous, EVP_CIPHER_CTX** ctx);
+
+/**
+ * Is the aes mode a counter mode
+ * @param mode The aes mode
+ * @return True if counter mode, otherwise false
+ */
+bool
+pgmoneta_is_counter_mode(int mode);
+
+/**
+ * Is the aes mode a chunked GCM mode
+ * @param mode The aes mode
+ * @return True if GCM mode, otherwise false
+ */
+bool
+pgmoneta_is_gcm_mode(int mode);
+
+/**
+ * Is the file in the chunked AES-GCM format
+ * @param path The path of the file
+ * @return True if AES-GCM, otherwise false
+ */
+bool
+pgmoneta_is_gcm_file(char* path);
+
+/**
+ * Get the size of the plaintext of a file in the AES-GCM format
+ * @param fd The descriptor of the file
+ * @param size [out] The size of the plaintext
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_gcm_plaintext_size(int fd, uint64_t* size);
+
+/**
+ * Read a range of the plaintext of a file in the AES-GCM format.
+ * Every chunk touched by the range is authenticated
+ * @param fd The descriptor of the file
+ * @param offset The offset in the plaintext
+ * @param buffer The buffer
+ * @param size The size of the range
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_gcm_read(int fd, uint64_t offset, void* buffer, size_t size);
+
+/**
+ * Compute the keyed hash of an object, so the hash does not tell the content
+ * to anyone without the master key
+ * @param data The object
+ * @param size The size of the object
+ * @param hash [out] The hash, EVP_MAX_MD_SIZE bytes
+ * @param length [out] The length of the hash
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_object_hash(unsigned char* data, size_t size, unsigned char* hash, unsigned int* length);
+
+/**
+ * Derive the iv of an object from its name, so different objects never share an iv
+ * @param name The name of the object
+ * @param iv [out] The iv, AES_OBJECT_IV_SIZE bytes
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_object_iv(char* name, unsigned char* iv);
+
+/**
+ * Encrypt or decrypt an object with its own iv, using a key derived from the master key.
+ * The GCM modes authenticate the object with a tag
+ * @param mode The aes mode
+ * @param enc 1 for encrypt, 0 for decrypt
+ * @param iv The iv, AES_OBJECT_IV_SIZE bytes
+ * @param tag The tag of the GCM modes, AES_GCM_TAG_SIZE bytes, set when encrypting
+ * @param in The input
+ * @param in_size The size of the input
+ * @param out The output, in_size + EVP_MAX_BLOCK_LENGTH bytes
+ * @param out_size [out] The size of the output
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_crypt_object(int mode, int enc, unsigned char* iv, unsigned char* tag,
+                      unsigned char* in, size_t in_size, unsigned char* out, size_t* out_size);
+
 /**
  *
  * Encrypt a buffer
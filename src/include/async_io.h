@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_ASYNC_IO_H
+#define PGMONETA_ASYNC_IO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#define ASYNC_IO_BUFFER_SIZE (256 * 1024)
+#define ASYNC_IO_DEPTH       8
+
+#define ASYNC_IO_SLOT_FREE      0
+#define ASYNC_IO_SLOT_FILLING   1
+#define ASYNC_IO_SLOT_IN_FLIGHT 2
+
+struct async_file;
+
+/**
+ * The function called when a write has completed
+ * @param file The file
+ * @param result The number of bytes written, or a negative errno
+ * @param data The user data
+ */
+typedef void (*async_io_callback)(struct async_file* file, ssize_t result, void* data);
+
+/** @struct async_io_slot
+ * Defines a write buffer of an asynchronous I/O context
+ */
+struct async_io_slot
+{
+   int index;                   /**< The index of the slot, and of its registered buffer */
+   int state;                   /**< The state of the slot */
+   char* buffer;                /**< The buffer */
+   size_t size;                 /**< The number of bytes in the buffer */
+   off_t offset;                /**< The file offset of the buffer */
+   struct async_file* file;     /**< The file the buffer belongs to */
+};
+
+/** @struct async_io
+ * Defines an asynchronous I/O context shared by the files of one thread
+ */
+struct async_io
+{
+   bool uring;                  /**< Is io_uring used */
+   bool registered;             /**< Are the buffers registered with io_uring */
+   void* ring;                  /**< The io_uring instance */
+   int depth;                   /**< The number of slots */
+   size_t buffer_size;          /**< The size of a slot buffer */
+   struct async_io_slot* slots; /**< The slots */
+   int in_flight;               /**< The number of writes in flight */
+   uint64_t submits;            /**< The number of submit system calls */
+   uint64_t writes;             /**< The number of writes */
+};
+
+/** @struct async_file
+ * Defines a file written through an asynchronous I/O context
+ */
+struct async_file
+{
+   struct async_io* io;           /**< The context */
+   int fd;                        /**< The file descriptor */
+   off_t offset;                  /**< The offset of the next byte appended */
+   struct async_io_slot* current; /**< The slot being filled */
+   int in_flight;                 /**< The number of writes in flight */
+   bool failed;                   /**< Has a write failed */
+   bool hole;                     /**< Does the file end in a skipped range */
+   async_io_callback callback;    /**< The completion callback */
+   void* data;                    /**< The completion callback user data */
+};
+
+/**
+ * Create an asynchronous I/O context. io_uring is used when pgmoneta
+ * is built with liburing and the kernel allows it, otherwise the
+ * buffers are written with pwrite
+ * @param depth The number of writes that can be in flight
+ * @param buffer_size The size of each write buffer
+ * @param io The resulting context
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_async_io_create(int depth, size_t buffer_size, struct async_io** io);
+
+/**
+ * Open a file
+ * @param io The context
+ * @param path The path
+ * @param flags The open flags
+ * @param mode The mode used when the file is created
+ * @param callback The completion callback, or NULL
+ * @param data The completion callback user data
+ * @param file The resulting file
+ * @return 0 upon success, otherwise 1 with errno set from open
+ */
+int
+pgmoneta_async_io_open(struct async_io* io, char* path, int flags, mode_t mode, async_io_callback callback, void* data, struct async_file** file);
+
+/**
+ * Append data to a file. The data is copied, so the caller can reuse
+ * its buffer once the call returns
+ * @param file The file
+ * @param data The data
+ * @param size The size of the data
+ * @return 0 upon success, otherwise 1 if a write has failed
+ */
+int
+pgmoneta_async_io_write(struct async_file* file, void* data, size_t size);
+
+/**
+ * Submit the buffered data of a file without waiting for it
+ * @param file The file
+ * @return 0 upon success, otherwise 1 if a write has failed
+ */
+int
+pgmoneta_async_io_submit(struct async_file* file);
+
+/**
+ * Skip a range of zero bytes, leaving a hole in the file. Writes in
+ * flight are not waited for
+ * @param file The file
+ * @param size The size of the range
+ * @return 0 upon success, otherwise 1 if a write has failed
+ */
+int
+pgmoneta_async_io_skip(struct async_file* file, size_t size);
+
+/**
+ * Wait for all writes of a file and move the append offset
+ * @param file The file
+ * @param offset The new offset
+ * @return 0 upon success, otherwise 1 if a write has failed
+ */
+int
+pgmoneta_async_io_seek(struct async_file* file, off_t offset);
+
+/**
+ * Wait for all writes of a file and flush it to stable storage
+ * @param file The file
+ * @param data_only Only flush the data, like fdatasync
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_async_io_fsync(struct async_file* file, bool data_only);
+
+/**
+ * Wait for all writes of a file and close it
+ * @param file The file
+ * @return 0 upon success, otherwise 1 if a write has failed
+ */
+int
+pgmoneta_async_io_close(struct async_file* file);
+
+/**
+ * Destroy an asynchronous I/O context. All files must be closed
+ * @param io The context
+ */
+void
+pgmoneta_async_io_destroy(struct async_io* io);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -39,8 +39,18 @@ extern "C" {
 
 #include <stdlib.h>
 
+/* The size of a bzip2 block at level 1 */
+#define BZIP2_BLOCK_SIZE 100000
+
+/* Files larger than this many blocks are split into independent streams across the workers */
+#define BZIP2_PARALLEL_BLOCKS 2
+
+/* The size of the header in front of the first block of a bzip2 stream */
+#define BZIP2_HEADER_SIZE 10
+
 /**
- * BZip a data directory
+ * BZip a data directory. Large files are split into one stream per block,
+ * which are compressed in parallel by the workers and written as a multi-stream file
  * @param directory The directory
  * @param workers The optional workers
  * @return 0 upon success, otherwise 1.
@@ -64,7 +74,8 @@ void
 pgmoneta_bzip2_wal(char* directory);
 
 /**
- * BUNZip a directory
+ * BUNZip a directory. The streams of large multi-stream files are
+ * decompressed in parallel by the workers
  * @param directory The directory
  * @param workers The optional workers
  * @return 0 upon success, otherwise 1.
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_CODEC_H
+#define PGMONETA_CODEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* The size of the output buffer of the gzip and bzip2 codecs */
+#define CODEC_BUFFER_SIZE (64 * 1024)
+
+/* The number of codec types, gzip, zstd, lz4 and bzip2, cached per thread */
+#define CODEC_TYPES 4
+
+/**
+ * The function receiving the output of a codec
+ * @param data The user data
+ * @param buffer The buffer
+ * @param size The size of the buffer
+ * @return 0 upon success, otherwise 1
+ */
+typedef int (*codec_output)(void* data, void* buffer, size_t size);
+
+/** @struct codec
+ * Defines a streaming compressor or decompressor for one of the
+ * gzip, zstd, lz4 or bzip2 formats of pgmoneta
+ */
+struct codec
+{
+   int type;                 /**< The compression type, one of the COMPRESSION_CLIENT_* types */
+   bool compress;            /**< Compress or decompress */
+   int level;                /**< The compression level of the current stream */
+   void* context;            /**< The library context */
+   bool active;              /**< The library context holds a stream */
+   bool end;                 /**< The end of the compressed stream was seen */
+   size_t pending;           /**< The zstd decompression hint, or the size of the current lz4 block */
+   char* source;             /**< The path of the stream, used to find dictionaries */
+   char* out;                /**< The output buffer */
+   size_t out_size;          /**< The size of the output buffer */
+   char* in;                 /**< The lz4 block buffer */
+   size_t in_size;           /**< The size of the lz4 block buffer */
+   size_t in_pos;            /**< The number of bytes in the current lz4 block */
+   size_t in_need;           /**< The number of bytes of the current lz4 block or header */
+   int index;                /**< The current lz4 block of the double buffer */
+   codec_output output;      /**< The output function */
+   void* output_data;        /**< The output function user data */
+};
+
+/**
+ * Create a codec
+ * @param type The compression type
+ * @param compress Compress or decompress
+ * @param codec The resulting codec
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_codec_create(int type, bool compress, struct codec** codec);
+
+/**
+ * Get the codec of the calling thread. The codec, its context and its buffers
+ * are reused by every stream of the thread and are destroyed when the thread exits
+ * @param type The compression type
+ * @param compress Compress or decompress
+ * @param codec The codec
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_codec_get(int type, bool compress, struct codec** codec);
+
+/**
+ * Start a stream
+ * @param codec The codec
+ * @param level The compression level, clamped to the range of the codec
+ * @param source The path of the stream, or NULL
+ * @param output The output function
+ * @param output_data The output function user data
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_codec_init(struct codec* codec, int level, char* source, codec_output output, void* output_data);
+
+/**
+ * Add data to the stream. Output is passed to the output function as it becomes available
+ * @param codec The codec
+ * @param data The data
+ * @param size The size of the data
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_codec_update(struct codec* codec, void* data, size_t size);
+
+/**
+ * Pass all output of the data added so far to the output function.
+ * The stream can be continued afterwards
+ * @param codec The codec
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_codec_flush(struct codec* codec);
+
+/**
+ * End the stream. A decompressing codec fails if the compressed stream is incomplete
+ * @param codec The codec
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_codec_finish(struct codec* codec);
+
+/**
+ * Destroy a codec
+ * @param codec The codec
+ */
+void
+pgmoneta_codec_destroy(struct codec* codec);
+
+/**
+ * Compress or decompress a file with the codec of the calling thread
+ * @param type The compression type
+ * @param compress Compress or decompress
+ * @param level The compression level
+ * @param from The source file
+ * @param to The destination file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_codec_file(int type, bool compress, int level, char* from, char* to);
+
+/**
+ * Compress a file with zstd and the current dictionary of a type
+ * @param dictionary The dictionary type
+ * @param level The compression level
+ * @param from The source file
+ * @param to The destination file
+ * @param id [out] The identifier of the dictionary, or 0
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_codec_dictionary_file(int dictionary, int level, char* from, char* to, uint32_t* id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
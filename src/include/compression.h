@@ -31,8 +31,35 @@
 
 #include <pgmoneta.h>
 
+#define COMPRESSION_DECISION_STORE 0
+#define COMPRESSION_DECISION_FAST  1
+#define COMPRESSION_DECISION_HIGH  2
+
+#define COMPRESSION_FAST_LEVEL    1
+#define COMPRESSION_SAMPLE_SIZE   (8 * 8192)
+#define COMPRESSION_STORE_RATIO   0.95
+#define COMPRESSION_HIGH_GAIN     0.02
+
 typedef int (*compression_func)(char*, char*);
 
+/**
+ * Decide how a backup file should be compressed.
+ *
+ * When compression_adaptive is enabled the first blocks of the file are compressed
+ * at the fast level and at the configured level. The file is stored as is when the
+ * fast level saves less than 5%, and the configured level is only used when it saves
+ * at least 2% more than the fast level within compression_budget.
+ *
+ * A stored file keeps its name, so restore and verify see it as an uncompressed file.
+ *
+ * @param path The file
+ * @param compression The compression type
+ * @param level [in, out] The configured level, updated with the level to use
+ * @return The decision
+ */
+int
+pgmoneta_compression_decide(char* path, int compression, int* level);
+
 /**
  * Decompress a file using the appropriate decompression method.
  *
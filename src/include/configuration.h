@@ -53,8 +53,12 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_BASE_DIR               "base_dir"
 #define CONFIGURATION_ARGUMENT_BLOCKING_TIMEOUT       "blocking_timeout"
 #define CONFIGURATION_ARGUMENT_COMPRESSION            "compression"
+#define CONFIGURATION_ARGUMENT_COMPRESSION_ADAPTIVE   "compression_adaptive"
+#define CONFIGURATION_ARGUMENT_COMPRESSION_BUDGET     "compression_budget"
+#define CONFIGURATION_ARGUMENT_COMPRESSION_DICTIONARY "compression_dictionary"
 #define CONFIGURATION_ARGUMENT_COMPRESSION_LEVEL      "compression_level"
 #define CONFIGURATION_ARGUMENT_CREATE_SLOT            "create_slot"
+#define CONFIGURATION_ARGUMENT_DEDUP_CHUNK_SIZE       "dedup_chunk_size"
 #define CONFIGURATION_ARGUMENT_ENCRYPTION             "encryption"
 #define CONFIGURATION_ARGUMENT_EXTRA                   "extra"
 #define CONFIGURATION_ARGUMENT_FOLLOW                  "follow"
@@ -86,6 +90,7 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_NON_BLOCKING           "non_blocking"
 #define CONFIGURATION_ARGUMENT_ONLINE                 "online"
 #define CONFIGURATION_ARGUMENT_PIDFILE                "pidfile"
+#define CONFIGURATION_ARGUMENT_PIPELINE              "pipeline"
 #define CONFIGURATION_ARGUMENT_PORT                    "port"
 #define CONFIGURATION_ARGUMENT_RETENTION              "retention"
 #define CONFIGURATION_ARGUMENT_S3_ACCESS_KEY_ID       "s3_access_key_id"
@@ -107,8 +112,14 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_USER                    "user"
 #define CONFIGURATION_ARGUMENT_USER_CONF_PATH          "users_configuration_path"
 #define CONFIGURATION_ARGUMENT_VERIFICATION            "verification"
+#define CONFIGURATION_ARGUMENT_WAL_FLUSH               "wal_flush"
+#define CONFIGURATION_ARGUMENT_WAL_FLUSH_DELAY         "wal_flush_delay"
+#define CONFIGURATION_ARGUMENT_WAL_FLUSH_SIZE          "wal_flush_size"
+#define CONFIGURATION_ARGUMENT_WAL_PREFETCH            "wal_prefetch"
+#define CONFIGURATION_ARGUMENT_WAL_RECEIVERS           "wal_receivers"
 #define CONFIGURATION_ARGUMENT_WAL_SHIPPING            "wal_shipping"
 #define CONFIGURATION_ARGUMENT_WAL_SLOT                "wal_slot"
+#define CONFIGURATION_ARGUMENT_WAL_SUMMARY             "wal_summary"
 #define CONFIGURATION_ARGUMENT_WORKERS                "workers"
 #define CONFIGURATION_ARGUMENT_WORKSPACE               "workspace"
 
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_DEDUP_H
+#define PGMONETA_DEDUP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <deque.h>
+#include <workers.h>
+
+#include <stdbool.h>
+
+#define DEDUP_MIN_CHUNK_SIZE 8192
+#define DEDUP_MAX_CHUNK_SIZE (1024 * 1024)
+
+#define DEDUP_CHUNKS        "chunks"
+#define DEDUP_INDEX         "index"
+#define DEDUP_REFERENCES    "dedup.refs"
+#define DEDUP_RECIPE_SUFFIX ".recipe"
+#define DEDUP_RECIPE_MAGIC  "pgmoneta-recipe"
+#define DEDUP_RECIPE_VERSION 1
+
+/**
+ * Is the chunk size valid for deduplication
+ * @param chunk_size The chunk size
+ * @return True if valid, otherwise false
+ */
+bool
+pgmoneta_dedup_valid_chunk_size(int chunk_size);
+
+/**
+ * Split the files under a data directory into chunks in the server chunk store,
+ * and replace each file with a recipe listing its chunks
+ * @param server The server
+ * @param directory The directory
+ * @param chunks The chunk names referenced by the recipes, 1 for the chunks new in the store
+ * @param workers The optional workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_dedup_data(int server, char* directory, struct deque* chunks, struct workers* workers);
+
+/**
+ * Split the files under the tablespace directories into chunks in the server chunk store
+ * @param server The server
+ * @param root The root directory of the backup
+ * @param chunks The chunk names referenced by the recipes, 1 for the chunks new in the store
+ * @param workers The optional workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_dedup_tablespaces(int server, char* root, struct deque* chunks, struct workers* workers);
+
+/**
+ * Record the chunk references of a backup, and add them to the chunk store index
+ * @param server The server
+ * @param root The root directory of the backup
+ * @param chunks The chunk names referenced by the recipes
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_dedup_commit(int server, char* root, struct deque* chunks);
+
+/**
+ * Remove the chunks a failed backup added to the chunk store,
+ * unless the chunk store index references them
+ * @param server The server
+ * @param chunks The chunk names of the failed backup
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_dedup_abort(int server, struct deque* chunks);
+
+/**
+ * Release the chunk references of a backup, and remove the chunks
+ * that are no longer referenced by any backup
+ * @param server The server
+ * @param root The root directory of the backup
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_dedup_release(int server, char* root);
+
+/**
+ * Does the backup use the chunk store
+ * @param root The root directory of the backup
+ * @return True if deduplicated, otherwise false
+ */
+bool
+pgmoneta_dedup_is_deduplicated(char* root);
+
+/**
+ * Rebuild the files of the recipes under a directory, and remove the recipes
+ * @param server The server
+ * @param directory The directory
+ * @param workers The optional workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_dedup_expand_directory(int server, char* directory, struct workers* workers);
+
+/**
+ * Rebuild a file from its recipe
+ * @param server The server
+ * @param recipe The recipe
+ * @param to The file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_dedup_expand_file(int server, char* recipe, char* to);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
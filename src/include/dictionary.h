@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_DICTIONARY_H
+#define PGMONETA_DICTIONARY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <zstd.h>
+
+#define DICTIONARY_DIRECTORY "dictionary"
+#define DICTIONARY_SUFFIX    ".dict"
+
+#define DICTIONARY_TYPE_WAL  0
+#define DICTIONARY_TYPE_DATA 1
+
+/* The size of a trained dictionary */
+#define DICTIONARY_SIZE        (112 * 1024)
+/* Data files up to this size are compressed with the data dictionary */
+#define DICTIONARY_SMALL_FILE  (256 * 1024)
+/* The amount of data a dictionary is trained from */
+#define DICTIONARY_SAMPLE_SIZE (16 * 1024 * 1024)
+/* WAL is sampled page by page */
+#define DICTIONARY_SAMPLE_PAGE 8192
+/* A dictionary is retrained once it is older than this */
+#define DICTIONARY_MAX_AGE     (24 * 60 * 60)
+
+/**
+ * Train a new dictionary for a server when there is no current one,
+ * or when the current one is older than DICTIONARY_MAX_AGE.
+ * WAL dictionaries are trained from the uncompressed WAL segments in the directory,
+ * data dictionaries from the small files in the directory tree
+ * @param server The server
+ * @param type The dictionary type
+ * @param directory The directory with the samples
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_dictionary_train(int server, int type, char* directory);
+
+/**
+ * Get the identifier of the current dictionary of a server
+ * @param server The server
+ * @param type The dictionary type
+ * @return The identifier, or 0 if there is no dictionary
+ */
+uint32_t
+pgmoneta_dictionary_current(int server, int type);
+
+/**
+ * Let a compression context use the current dictionary for a file.
+ * The dictionary directory is found from the path of the file, and the
+ * context returns to no dictionary when there is none
+ * @param path The path of the file being compressed
+ * @param type The dictionary type
+ * @param level The compression level
+ * @param cctx The compression context
+ * @param id [out] The identifier of the dictionary, or 0
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_dictionary_compress(char* path, int type, int level, ZSTD_CCtx* cctx, uint32_t* id);
+
+/**
+ * Let a decompression context use the dictionary a frame was compressed with
+ * @param path The path of the file being decompressed
+ * @param id The identifier from the frame header, 0 for none
+ * @param dctx The decompression context
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_dictionary_decompress(char* path, uint32_t id, ZSTD_DCtx* dctx);
+
+/**
+ * Also look for dictionaries of a server when decompressing files
+ * outside of the server directory, like a restore target
+ * @param server The server
+ */
+void
+pgmoneta_dictionary_register(int server);
+
+/**
+ * Also look for dictionaries in a directory when decompressing files
+ * outside of the server directory, like a copy of the WAL on another host
+ * @param directory The dictionary directory
+ */
+void
+pgmoneta_dictionary_directory(char* directory);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
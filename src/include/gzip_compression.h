@@ -39,8 +39,19 @@ extern "C" {
 
 #include <stdlib.h>
 
+/* The size of the chunks of a file deflated in parallel */
+#define GZIP_CHUNK_SIZE (1024 * 1024)
+
+/* Files larger than this many chunks are deflated in parallel */
+#define GZIP_PARALLEL_CHUNKS 2
+
+/* The data in front of a chunk used as the dictionary of the chunk */
+#define GZIP_DICTIONARY_SIZE 32768
+
 /**
- * GZip a data directory
+ * GZip a data directory. Large files are split into chunks which the workers
+ * deflate in parallel, each primed with the end of the previous chunk, and
+ * which are joined into a single gzip member
  * @param directory The directory
  * @param workers The optional workers
  * @return 0 upon success, otherwise 1.
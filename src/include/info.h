@@ -36,6 +36,7 @@ extern "C" {
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <json.h>
+#include <seekable.h>
 
 /* system */
 #include <stdlib.h>
@@ -46,6 +47,7 @@ extern "C" {
 #define INFO_CHKPT_WALPOS              "CHKPT_WALPOS"
 #define INFO_COMMENTS                  "COMMENTS"
 #define INFO_COMPRESSION               "COMPRESSION"
+#define INFO_DICTIONARY                "DICTIONARY"
 #define INFO_ELAPSED                   "ELAPSED"
 #define INFO_BASEBACKUP_ELAPSED        "BASEBACKUP_ELAPSED"
 #define INFO_MANIFEST_ELAPSED          "MANIFEST_ELAPSED"
@@ -93,6 +95,7 @@ extern "C" {
  * @struct rfile
  * An rfile stores the metadata we need to use a file on disk for reconstruction.
  * For full backup file in the chain, only file name and file pointer are initialized.
+ * Seekable compressed files are read in place through a reader instead of being extracted.
  *
  * extracted flag indicates if the file is a copy extracted from the original file
  * num_blocks is the number of blocks present inside an incremental file.
@@ -108,6 +111,7 @@ struct rfile
 {
    char* filepath;                     /**< The path of the backup file  */
    FILE* fp;                           /**< The file descriptor corresponding to the backup file */
+   struct seekable_reader* reader;     /**< The reader of a seekable compressed backup file, or NULL */
    size_t header_length;               /**< The header length */
    uint32_t num_blocks;                /**< The number of blocks present inside an incremental file */
    uint32_t* relative_block_numbers;   /**< relative_block_numbers are the relative BlockNumber of each block in the file */
@@ -153,6 +157,7 @@ struct backup
    uint32_t start_timeline;                                       /**< The starting timeline of the backup */
    uint32_t end_timeline;                                         /**< The ending timeline of the backup */
    int compression;                                               /**< The compression type */
+   uint32_t dictionary;                                           /**< The zstd dictionary of the small files, 0 for none */
    int encryption;                                                /**< The encryption type */
    char comments[MAX_COMMENT];                                    /**< The comments */
    char extra[MAX_EXTRA_PATH];                                    /**< The extra directory */
@@ -276,6 +281,26 @@ pgmoneta_save_info(char* directory, struct backup* backup);
 int
 pgmoneta_rfile_create(int server, char* label, char* relative_dir, char* base_file_name, int encryption, int compression, struct rfile** rfile);
 
+/**
+ * Read data from an rfile
+ * @param rf The rfile
+ * @param offset The offset in the uncompressed file
+ * @param buffer The buffer
+ * @param size The number of bytes to read
+ * @param nread [out] The number of bytes read
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_rfile_read(struct rfile* rf, uint64_t offset, void* buffer, size_t size, size_t* nread);
+
+/**
+ * Get the uncompressed size of an rfile
+ * @param rf The rfile
+ * @return The size
+ */
+uint64_t
+pgmoneta_rfile_size(struct rfile* rf);
+
 /**
  * Destroy the rfile structure
  * @param rfile The rfile to be destroyed
@@ -90,6 +90,7 @@ extern "C" {
 #define MANAGEMENT_UPDATE_USER    26
 #define MANAGEMENT_REMOVE_USER    27
 #define MANAGEMENT_LIST_USERS     28
+#define MANAGEMENT_RESTORE_WAL    29
 
 /**
  * Management categories
@@ -363,6 +364,12 @@ extern "C" {
 #define MANAGEMENT_ERROR_MODE_ERROR          2804
 #define MANAGEMENT_ERROR_MODE_UNKNOWN_ACTION 2805
 
+#define MANAGEMENT_ERROR_RESTORE_WAL_NOSERVER 2900
+#define MANAGEMENT_ERROR_RESTORE_WAL_NOFORK   2901
+#define MANAGEMENT_ERROR_RESTORE_WAL_NOFILE   2902
+#define MANAGEMENT_ERROR_RESTORE_WAL_NETWORK  2903
+#define MANAGEMENT_ERROR_RESTORE_WAL_ERROR    2904
+
 /**
  * Output formats
  */
@@ -457,6 +464,21 @@ pgmoneta_management_request_list_backup(SSL* ssl, int socket, char* server, char
 int
 pgmoneta_management_request_restore(SSL* ssl, int socket, char* server, char* backup_id, char* position, char* directory, uint8_t compression, uint8_t encryption, int32_t output_format);
 
+/**
+ * Create a restore WAL request
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param server The server
+ * @param filename The WAL file name
+ * @param destination The destination path
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol
+ * @param output_format The output format
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_management_request_restore_wal(SSL* ssl, int socket, char* server, char* filename, char* destination, uint8_t compression, uint8_t encryption, int32_t output_format);
+
 /**
  * Create a verify request
  * @param ssl The SSL connection
@@ -802,6 +824,26 @@ pgmoneta_management_read_json(SSL* ssl, int socket, uint8_t* compression, uint8_
 int
 pgmoneta_management_write_json(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, struct json* json);
 
+/**
+ * Write a file to the management stream, following the response
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param path The path of the file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_management_write_file(SSL* ssl, int socket, char* path);
+
+/**
+ * Read a file written by pgmoneta_management_write_file
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param path The path of the file to create
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_management_read_file(SSL* ssl, int socket, char* path);
+
 #ifdef __cplusplus
 }
 #endif
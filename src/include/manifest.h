@@ -44,6 +44,12 @@ extern "C" {
 #define MANIFEST_PATH_INDEX 0
 #define MANIFEST_CHECKSUM_INDEX 1
 
+#define MANIFEST_KEY_VERSION "PostgreSQL-Backup-Manifest-Version"
+#define MANIFEST_KEY_SYS_IDENTIFIER "System-Identifier"
+#define MANIFEST_KEY_FILES "Files"
+#define MANIFEST_KEY_WAL_RANGES "WAL-Ranges"
+#define MANIFEST_KEY_CHECKSUM "Manifest-Checksum"
+
 /** @struct manifest_file
  * Defines a manifest file
  */
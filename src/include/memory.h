@@ -43,10 +43,10 @@ extern "C" {
 struct stream_buffer
 {
    char* buffer;  /**< allocated buffer holding streaming data */
-   size_t size;      /**< allocated buffer size */
-   int start;     /**< offset to the first unconsumed data in buffer */
-   int end;       /**< offset to the first position after available data */
-   int cursor;    /**< next byte to consume */
+   size_t size;   /**< allocated buffer size */
+   size_t start;  /**< offset to the first unconsumed data in buffer */
+   size_t end;    /**< offset to the first position after available data */
+   size_t cursor; /**< next byte to consume */
 } __attribute__ ((aligned (64)));
 
 /**
@@ -109,13 +109,16 @@ void
 pgmoneta_memory_stream_buffer_init(struct stream_buffer** buffer);
 
 /**
- * Enlarge the buffer, doesn't guarantee success
+ * Make room for at least bytes_needed bytes after the available data.
+ * Consumed data is compacted away first, and the buffer is only reallocated
+ * if that isn't enough, in which case only the unconsumed data is copied.
+ * Offsets are rebased, so pointers into the buffer must be refreshed
  * @param buffer The stream buffer
  * @param bytes_needed The number of bytes needed
  * @return 0 upon success, otherwise 1
  */
 int
-pgmoneta_memory_stream_buffer_enlarge(struct stream_buffer* buffer, int bytes_needed);
+pgmoneta_memory_stream_buffer_enlarge(struct stream_buffer* buffer, size_t bytes_needed);
 
 /**
  * Free a stream buffer
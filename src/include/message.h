@@ -499,6 +499,17 @@ pgmoneta_consume_copy_stream(SSL* ssl, int socket, struct stream_buffer* buffer,
 int
 pgmoneta_consume_copy_stream_start(SSL* ssl, int socket, struct stream_buffer* buffer, struct message* message, struct token_bucket* network_bucket);
 
+/**
+ * Start consuming a message that is already complete in the stream buffer,
+ * without reading from the socket. Used with a non-blocking socket, and
+ * must be used with pgmoneta_consume_copy_stream_end
+ * @param buffer The stream buffer
+ * @param message The message buffer
+ * @return 1 upon success, 0 if the message isn't complete yet, otherwise 2
+ */
+int
+pgmoneta_consume_copy_stream_buffered(struct stream_buffer* buffer, struct message* message);
+
 /**
  * Finish consuming the buffer, prepare for the next message to be consumed
  * @param buffer The stream buffer
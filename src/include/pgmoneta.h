@@ -94,6 +94,9 @@ extern "C" {
 #define ENCRYPTION_AES_256_CTR  4
 #define ENCRYPTION_AES_192_CTR  5
 #define ENCRYPTION_AES_128_CTR  6
+#define ENCRYPTION_AES_256_GCM  7
+#define ENCRYPTION_AES_192_GCM  8
+#define ENCRYPTION_AES_128_GCM  9
 
 #define HUGEPAGE_OFF 0
 #define HUGEPAGE_TRY 1
@@ -120,6 +123,18 @@ extern "C" {
 #define UPDATE_PROCESS_TITLE_MINIMAL 2
 #define UPDATE_PROCESS_TITLE_VERBOSE 3
 
+#define WAL_TARGET_SHIPPING 0
+#define WAL_TARGET_SSH      1
+#define WAL_TARGETS         2
+
+#define WAL_FLUSH_GROUP 0
+#define WAL_FLUSH_SYNC  1
+
+#define DEFAULT_WAL_FLUSH_DELAY 200
+#define DEFAULT_WAL_FLUSH_SIZE  (1024 * 1024)
+
+#define DEFAULT_WAL_PREFETCH 8
+
 #define CREATE_SLOT_UNDEFINED 0
 #define CREATE_SLOT_YES       1
 #define CREATE_SLOT_NO        2
@@ -237,6 +252,7 @@ struct server
    size_t segment_size;                     /**< The max size of a relation file segment*/
    size_t relseg_size;                      /**< The max number of blocks in a relation file segment */
    bool wal_streaming;                      /**< Is WAL streaming active */
+   int wal_receiver;                        /**< The WAL receiver of the server, -1 for none */
    bool checksums;                          /**< Are checksums enabled */
    bool summarize_wal;                      /**< Is summarize_wal enabled */
    bool valid;                              /**< Is the server valid */
@@ -247,6 +263,10 @@ struct server
    uint32_t cur_timeline;                   /**< Current timeline the server is on*/
    atomic_llong last_operation_time;        /**< Last operation time of the server */
    atomic_llong last_failed_operation_time; /**< Last failed operation time of the server */
+   atomic_ulong backup_network_stalls;      /**< Times the backup writer waited for the network */
+   atomic_ulong backup_disk_stalls;         /**< Times the backup receiver waited for the disk */
+   atomic_ulong wal_target_lag[WAL_TARGETS];    /**< Bytes of received WAL queued for each WAL target */
+   atomic_ulong wal_target_stalls[WAL_TARGETS]; /**< Times the WAL receiver waited for each WAL target */
    char wal_shipping[MAX_PATH];             /**< The WAL shipping directory */
    int number_of_hot_standbys;              /**< The number of hot standby directories */
    char hot_standby[NUMBER_OF_HOT_STANDBY][MAX_PATH]; /**< The hot standby directories */
@@ -360,6 +380,9 @@ struct main_configuration
 
    int compression_type;                        /**< The compression type */
    int compression_level;                       /**< The compression level */
+   bool compression_adaptive;                   /**< Choose store, fast or high compression per file */
+   int compression_budget;                      /**< The CPU seconds per GB allowed for high compression, 0 for no limit */
+   bool compression_dictionary;                 /**< Compress WAL and small files with trained zstd dictionaries */
 
    int create_slot;                             /**< Create a slot */
 
@@ -419,6 +442,18 @@ struct main_configuration
 
    int verification;                            /**< The sha512 verification interval */
 
+   bool pipeline;                               /**< Compress, encrypt and hash backup files in a single pass */
+
+   int dedup_chunk_size;                        /**< The chunk size of the deduplication store, 0 when disabled */
+
+   bool wal_summary;                            /**< Summarize archived WAL into block reference tables */
+
+   int wal_flush;                               /**< The WAL flush policy */
+   int wal_flush_delay;                         /**< The longest time in milliseconds received WAL stays unflushed */
+   int wal_flush_size;                          /**< The most bytes of received WAL that stay unflushed */
+   int wal_receivers;                           /**< The number of processes receiving WAL, 0 for one per server */
+   int wal_prefetch;                            /**< The number of WAL segments prefetched by restore-wal */
+
 #ifdef DEBUG
    bool link;                                   /**< Do linking */
 #endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_PIPELINE_H
+#define PGMONETA_PIPELINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <deque.h>
+#include <workers.h>
+
+#include <stdbool.h>
+
+/**
+ * Can the backup files be processed by the pipeline for the given settings
+ * @param compression The compression type
+ * @param encryption The encryption mode
+ * @return True if supported, otherwise false
+ */
+bool
+pgmoneta_pipeline_supported(int compression, int encryption);
+
+/**
+ * Compress, encrypt and hash the files under a data directory in a single pass,
+ * also remove the original files
+ * @param root The root directory of the backup
+ * @param directory The directory
+ * @param checksums The SHA512 checksums of the resulting files keyed by their path relative to root
+ * @param workers The optional workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_pipeline_data(char* root, char* directory, struct deque* checksums, struct workers* workers);
+
+/**
+ * Compress, encrypt and hash the files under the tablespace directories in a single pass,
+ * also remove the original files
+ * @param root The root directory of the backup
+ * @param checksums The SHA512 checksums of the resulting files keyed by their path relative to root
+ * @param workers The optional workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_pipeline_tablespaces(char* root, struct deque* checksums, struct workers* workers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -153,6 +153,30 @@ pgmoneta_copy_postgresql_hotstandby(int server,
                                     struct backup* backup,
                                     struct workers* workers);
 
+/**
+ * Stage a WAL file of the archive decrypted and decompressed into a directory.
+ * The file is written under a hidden name and renamed once complete
+ * @param directory The target directory, ending with a slash
+ * @param from The path of the file in the archive
+ * @param name The name of the file in the archive
+ * @return 0 on success, 1 if otherwise
+ */
+int
+pgmoneta_stage_wal_file(char* directory, char* from, char* name);
+
+/**
+ * Serve an archived WAL file for a restore_command, and prefetch
+ * the segments following it
+ * @param ssl The SSL connection
+ * @param client_fd The client
+ * @param server The server
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol
+ * @param payload The payload
+ */
+void
+pgmoneta_restore_wal(SSL* ssl, int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_RESUME_H
+#define PGMONETA_RESUME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define RESUME_JOURNAL "resume.journal"
+
+/**
+ * Can a failed base backup of a server be resumed. This needs the
+ * server to accept an uploaded manifest and to summarize WAL
+ * @param server The server
+ * @return True if resumable, otherwise false
+ */
+bool
+pgmoneta_resume_supported(int server);
+
+/**
+ * Start the journal of a base backup
+ * @param basedir The base directory of the backup
+ * @param timeline The start timeline of the backup
+ * @param startpos The start position of the backup
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_resume_begin(char* basedir, uint32_t timeline, char* startpos);
+
+/**
+ * Remove the journal of a base backup that has completed
+ * @param basedir The base directory of the backup
+ */
+void
+pgmoneta_resume_end(char* basedir);
+
+/**
+ * Open the journal of a base backup for appending
+ * @param basedir The base directory of the backup
+ * @param journal The journal, or NULL if the backup has no journal
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_resume_journal_open(char* basedir, FILE** journal);
+
+/**
+ * Record a fully received file in a journal
+ * @param journal The journal
+ * @param path The path of the file in the manifest
+ * @param local The path of the file relative to the base directory
+ * @param size The size of the file
+ * @param mtime The modification time of the file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_resume_journal_add(FILE* journal, char* path, char* local, uint64_t size, time_t mtime);
+
+/**
+ * Keep a failed base backup as the partial backup of a server
+ * @param server The server
+ * @param basedir The base directory of the failed backup
+ * @return 0 if kept, otherwise 1
+ */
+int
+pgmoneta_resume_keep(int server, char* basedir);
+
+/**
+ * Is there a partial backup of a server to resume from
+ * @param server The server
+ * @return True if there is a partial backup, otherwise false
+ */
+bool
+pgmoneta_resume_available(int server);
+
+/**
+ * Write a backup manifest of the files of the partial backup
+ * @param server The server
+ * @param path The path of the manifest
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_resume_write_manifest(int server, char* path);
+
+/**
+ * Combine an incremental backup taken against the partial backup with
+ * the files of the partial backup, giving a full backup
+ * @param server The server
+ * @param basedir The base directory of the incremental backup
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_resume_splice(int server, char* basedir);
+
+/**
+ * Delete the partial backup of a server
+ * @param server The server
+ */
+void
+pgmoneta_resume_delete(int server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
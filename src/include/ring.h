@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_RING_H
+#define PGMONETA_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define RING_SLOT_SIZE (1024 * 1024)
+#define RING_SLOTS     16
+
+/**
+ * The function that consumes the data of a slot
+ * @param data The user data
+ * @param buffer The buffer
+ * @param size The size of the buffer
+ * @return 0 upon success, otherwise 1
+ */
+typedef int (*ring_sink)(void* data, void* buffer, size_t size);
+
+/** @struct ring_writer
+ * Defines a bounded ring of buffers drained by a writer thread
+ */
+struct ring_writer
+{
+   pthread_t thread;            /**< The writer thread */
+   bool started;                /**< Is the writer thread started */
+   pthread_mutex_t lock;        /**< The lock */
+   pthread_cond_t not_empty;    /**< Signaled when a slot is published */
+   pthread_cond_t not_full;     /**< Signaled when a slot is released */
+   int number_of_slots;         /**< The number of slots */
+   size_t slot_size;            /**< The size of a slot */
+   char** slots;                /**< The slots */
+   size_t* lengths;             /**< The number of bytes in each published slot */
+   int head;                    /**< The slot being filled by the producer */
+   int tail;                    /**< The next slot to be drained by the writer */
+   int count;                   /**< The number of published slots */
+   size_t offset;               /**< The number of bytes in the head slot */
+   bool done;                   /**< No more data will be published */
+   bool failed;                 /**< The sink failed, or the ring was aborted */
+   ring_sink sink;              /**< The sink */
+   void* sink_data;             /**< The sink user data */
+   uint64_t bytes;              /**< The number of bytes written */
+   uint64_t producer_stalls;    /**< The number of times the producer waited for a free slot */
+   double producer_wait;        /**< The time in seconds the producer waited for a free slot */
+   uint64_t consumer_stalls;    /**< The number of times the writer waited for data */
+   double consumer_wait;        /**< The time in seconds the writer waited for data */
+};
+
+/**
+ * Create a ring writer and start its writer thread
+ * @param slot_size The size of a slot
+ * @param number_of_slots The number of slots
+ * @param sink The sink
+ * @param sink_data The sink user data
+ * @param ring The resulting ring writer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_ring_writer_create(size_t slot_size, int number_of_slots, ring_sink sink, void* sink_data, struct ring_writer** ring);
+
+/**
+ * Copy data into the ring, waiting for a free slot when the ring is full
+ * @param ring The ring writer
+ * @param data The data
+ * @param size The size of the data
+ * @return 0 upon success, otherwise 1 if the sink has failed
+ */
+int
+pgmoneta_ring_writer_write(struct ring_writer* ring, void* data, size_t size);
+
+/**
+ * Publish the remaining data, wait for the writer to drain the ring and stop it
+ * @param ring The ring writer
+ * @return 0 upon success, otherwise 1 if the sink has failed
+ */
+int
+pgmoneta_ring_writer_finish(struct ring_writer* ring);
+
+/**
+ * Destroy a ring writer, any data not yet written is discarded
+ * @param ring The ring writer
+ */
+void
+pgmoneta_ring_writer_destroy(struct ring_writer* ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_SEEKABLE_H
+#define PGMONETA_SEEKABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* The amount of data compressed into each independent frame */
+#define SEEKABLE_FRAME_SIZE (128 * 1024)
+
+/* The seek table follows the zstd seekable format */
+#define SEEKABLE_SKIPPABLE_MAGIC 0x184D2A5E
+#define SEEKABLE_MAGIC           0x8F92EAB1
+#define SEEKABLE_FOOTER_SIZE     9
+#define SEEKABLE_ENTRY_SIZE      8
+
+/**
+ * The function receiving the output of a seekable writer
+ * @param data The user data
+ * @param buffer The buffer
+ * @param size The size of the buffer
+ * @return 0 upon success, otherwise 1
+ */
+typedef int (*seekable_output)(void* data, void* buffer, size_t size);
+
+/** @struct seekable_writer
+ * Defines a writer compressing data into independent frames
+ * followed by a seek table
+ */
+struct seekable_writer
+{
+   int compression;             /**< The compression type */
+   int level;                   /**< The compression level */
+   void* context;               /**< The compression context */
+   char* frame;                 /**< The data of the current frame */
+   size_t frame_size;           /**< The size of the data of the current frame */
+   char* out;                   /**< The compressed output buffer */
+   size_t out_capacity;         /**< The capacity of the output buffer */
+   uint32_t* compressed;        /**< The compressed size of each frame */
+   uint32_t* decompressed;      /**< The decompressed size of each frame */
+   uint32_t number_of_frames;   /**< The number of frames */
+   uint32_t capacity;           /**< The capacity of the frame size arrays */
+   seekable_output output;      /**< The output function */
+   void* output_data;           /**< The output function user data */
+};
+
+/** @struct seekable_reader
+ * Defines a reader of arbitrary ranges of a seekable file
+ */
+struct seekable_reader
+{
+   int fd;                         /**< The file descriptor */
+   int compression;                /**< The compression type */
+   int encryption;                 /**< The encryption mode */
+   uint64_t stored_size;           /**< The size of the stored file after decryption */
+   uint64_t size;                  /**< The decompressed size */
+   uint32_t number_of_frames;      /**< The number of frames */
+   uint64_t* compressed_offsets;   /**< The offset of each frame in the stored file */
+   uint64_t* decompressed_offsets; /**< The offset of each frame in the decompressed data */
+   int64_t cached_frame;           /**< The frame in the frame buffer, or -1 */
+   char* frame;                    /**< The decompressed frame buffer */
+   char* input;                    /**< The compressed frame buffer */
+   size_t input_capacity;          /**< The capacity of the compressed frame buffer */
+   void* context;                  /**< The decompression context */
+   char* path;                     /**< The path of the file */
+   uint32_t dictionary;            /**< The dictionary of the decompression context, 0 for none */
+};
+
+/**
+ * Is the compression type stored in the seekable format
+ * @param compression The compression type
+ * @return True if supported, otherwise false
+ */
+bool
+pgmoneta_seekable_supported(int compression);
+
+/**
+ * Create a seekable writer
+ * @param compression The compression type
+ * @param level The compression level
+ * @param output The output function
+ * @param output_data The output function user data
+ * @param writer The resulting writer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_seekable_writer_create(int compression, int level, seekable_output output, void* output_data, struct seekable_writer** writer);
+
+/**
+ * Add data to a seekable writer. Complete frames are passed to the output
+ * @param writer The writer
+ * @param data The data
+ * @param size The size of the data
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_seekable_writer_write(struct seekable_writer* writer, void* data, size_t size);
+
+/**
+ * Write the last frame and the seek table
+ * @param writer The writer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_seekable_writer_finish(struct seekable_writer* writer);
+
+/**
+ * Compress the frames of a zstd writer with the current data dictionary
+ * @param writer The writer
+ * @param path The path of the file being compressed, used to find the dictionary
+ * @param id [out] The identifier of the dictionary, or 0
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_seekable_writer_dictionary(struct seekable_writer* writer, char* path, uint32_t* id);
+
+/**
+ * Destroy a seekable writer
+ * @param writer The writer
+ */
+void
+pgmoneta_seekable_writer_destroy(struct seekable_writer* writer);
+
+/**
+ * Compress a file into the seekable format
+ * @param from The file
+ * @param to The compressed file
+ * @param compression The compression type
+ * @param level The compression level
+ * @param dictionary Use the current data dictionary
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_seekable_compress_file(char* from, char* to, int compression, int level, bool dictionary);
+
+/**
+ * Open a seekable file. Encrypted files are decrypted as they are read
+ * @param path The path
+ * @param compression The compression type
+ * @param encryption The encryption mode
+ * @param reader The resulting reader
+ * @return 0 upon success, otherwise 1 if the file isn't seekable
+ */
+int
+pgmoneta_seekable_open(char* path, int compression, int encryption, struct seekable_reader** reader);
+
+/**
+ * Read a range of the decompressed data of a seekable file
+ * @param reader The reader
+ * @param offset The offset in the decompressed data
+ * @param buffer The buffer
+ * @param size The number of bytes to read
+ * @param nread The number of bytes read, less than size at the end of the data
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_seekable_read(struct seekable_reader* reader, uint64_t offset, void* buffer, size_t size, size_t* nread);
+
+/**
+ * Close a seekable file
+ * @param reader The reader
+ */
+void
+pgmoneta_seekable_close(struct seekable_reader* reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
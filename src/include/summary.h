@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_SUMMARY_H
+#define PGMONETA_SUMMARY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <brt.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SUMMARY_SUFFIX ".summary"
+
+/**
+ * Are the incremental backups of a server built from the summaries of pgmoneta.
+ * This is the case when wal_summary is enabled and the server doesn't summarize WAL
+ * @param server The server
+ * @return True if local, otherwise false
+ */
+bool
+pgmoneta_summary_is_local(int server);
+
+/**
+ * Summarize the complete WAL segments of a server into block reference tables.
+ * One summary is written for each segment that doesn't have one yet
+ * @param server The server
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_summarize_wal(int server);
+
+/**
+ * Is the WAL segment containing an LSN summarized
+ * @param server The server
+ * @param timeline The timeline
+ * @param lsn The LSN
+ * @return True if summarized, otherwise false
+ */
+bool
+pgmoneta_summary_exists(int server, uint32_t timeline, uint64_t lsn);
+
+/**
+ * Combine the summaries of a range of WAL into one block reference table.
+ * The summaries must cover the range without gaps
+ * @param server The server
+ * @param timeline The timeline
+ * @param start_lsn The start LSN
+ * @param end_lsn The end LSN
+ * @param brt [out] The combined block reference table
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_summarize_range(int server, uint32_t timeline, uint64_t start_lsn, uint64_t end_lsn, block_ref_table** brt);
+
+/**
+ * Delete the summaries of WAL segments older than a WAL file
+ * @param server The server
+ * @param wal The WAL file, or NULL to delete all summaries
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_summary_delete_older_than(int server, char* wal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -45,6 +45,8 @@ extern "C" {
 #define LONG_TIME_LENGTH  16 + 1
 #define UTC_TIME_LENGTH   29 + 1
 
+#define SPARSE_BLOCK_SIZE 8192
+
 /** Define Windows 20 palette colors as constants using ANSI codes **/
 #define COLOR_BLACK         "\033[30m"
 #define COLOR_DARK_RED      "\033[31m"
@@ -717,7 +719,17 @@ void
 pgmoneta_list_directory(char* directory);
 
 /**
- * Copy a file
+ * Is the buffer all zero bytes
+ * @param data The data
+ * @param size The size of the data
+ * @return True if all bytes are zero, otherwise false
+ */
+bool
+pgmoneta_is_zero(void* data, size_t size);
+
+/**
+ * Copy a file. Blocks of SPARSE_BLOCK_SIZE zero bytes are left
+ * as holes in the new file
  * @param from The from file
  * @param to The to file
  * @param workers The workers
@@ -838,6 +850,28 @@ pgmoneta_is_symlink_valid(char* path);
 int
 pgmoneta_copy_wal_files(char* from, char* to, char* start, struct workers* workers);
 
+/**
+ * Get the WAL files of an archive needed from a segment on.
+ * The history files of the later timelines come first, then the
+ * segments in WAL order, both with their name on disk
+ * @param directory The WAL directory
+ * @param start The first segment, or NULL for all
+ * @param number_of_files The number of files
+ * @param files The files
+ * @return The result
+ */
+int
+pgmoneta_get_wal_range(char* directory, char* start, int* number_of_files, char*** files);
+
+/**
+ * Strip the encryption and compression suffixes of a WAL file name
+ * @param file The file name
+ * @param name The stripped name
+ * @return The result
+ */
+int
+pgmoneta_strip_wal_extensions(char* file, char** name);
+
 /**
  * Get the number of WAL files
  * @param directory The directory
@@ -983,6 +1017,46 @@ pgmoneta_get_server_backup(int server);
 char*
 pgmoneta_get_server_wal(int server);
 
+/**
+ * Get the WAL summary directory for a server
+ * @param server The server
+ * @return The WAL summary directory
+ */
+char*
+pgmoneta_get_server_summary(int server);
+
+/**
+ * Get the directory of the partial backup of a server
+ * @param server The server
+ * @return The partial backup directory
+ */
+char*
+pgmoneta_get_server_partial(int server);
+
+/**
+ * Get the directory of the compression dictionaries of a server
+ * @param server The server
+ * @return The dictionary directory
+ */
+char*
+pgmoneta_get_server_dictionary(int server);
+
+/**
+ * Get the directory of the preallocated WAL segments of a server
+ * @param server The server
+ * @return The WAL pool directory
+ */
+char*
+pgmoneta_get_server_wal_pool(int server);
+
+/**
+ * Get the directory of the WAL segments prefetched for a restore_command
+ * @param server The server
+ * @return The WAL prefetch directory
+ */
+char*
+pgmoneta_get_server_wal_prefetch(int server);
+
 /**
  * Get the wal shipping directory for a server
  * @param server The server
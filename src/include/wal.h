@@ -39,6 +39,12 @@ extern "C" {
 #include <stdint.h>
 #include <stdlib.h>
 
+/* The number of preallocated segments kept ready for the WAL receiver */
+#define WAL_POOL_SEGMENTS 2
+
+/* The most bytes of received WAL queued for a WAL shipping or SSH target */
+#define WAL_TARGET_QUEUE_SIZE (64 * 1024 * 1024)
+
 /** @struct timeline_history
  * Defines a timeline history
  */
@@ -78,6 +84,65 @@ typedef struct
 void
 pgmoneta_wal(int srv, char** argv);
 
+/**
+ * Receive the WAL of several servers in one process, multiplexing their
+ * replication connections on an event loop. The servers are the ones
+ * assigned to the receiver in shared memory, also after it has started
+ * @param receiver The receiver number
+ * @param argv The argv
+ */
+void
+pgmoneta_wal_receiver(int receiver, char** argv);
+
+/**
+ * Should the WAL streaming of a server be started. The server must be online
+ * and not streaming, and the server it follows, or its follower, must not be streaming
+ * @param srv The server index
+ * @return True if the streaming should be started, otherwise false
+ */
+bool
+pgmoneta_wal_should_stream(int srv);
+
+/**
+ * Assign the servers without a running WAL receiver. New receivers get the
+ * servers round-robin, and once all receivers run a server goes to the one
+ * with the fewest servers, which picks it up on its timer
+ * @param servers The servers to stream
+ * @param number_of_servers The number of servers to stream
+ * @param running Is each receiver running
+ * @param number_of_receivers The number of receivers to run
+ * @param started [out] The receivers to start
+ * @return The number of receivers to start
+ */
+int
+pgmoneta_wal_receivers_assign(int* servers, int number_of_servers, bool* running, int number_of_receivers, int* started);
+
+/**
+ * Trim the zero-filled tail of a complete WAL segment. The segment is
+ * cut after the last page whose header continues the segment, so the
+ * file size marks the used prefix
+ * @param path The path of the WAL segment
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_wal_trim(char* path);
+
+/**
+ * Pad a trimmed WAL segment with zeros back to its segment size
+ * @param path The path of the WAL segment
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_wal_pad(char* path);
+
+/**
+ * Pad a decompressed file back to its segment size if it is named as a WAL segment
+ * @param path The path of the file
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_wal_pad_file(char* path);
+
 /**
  * Find and extract the history info from .history file of given server and timeline
  * @param srv The server index
@@ -480,6 +480,18 @@ struct xl_xact_parsed_abort
 char*
 pgmoneta_wal_xact_desc(char* buf, struct decoded_xlog_record* record);
 
+/**
+ * Get the relations dropped by a commit or abort record.
+ *
+ * The returned array points into the record and is valid as long as the record is.
+ *
+ * @param record The decoded XLOG record of the transaction resource manager.
+ * @param nrels [out] The number of dropped relations, 0 for other record types.
+ * @param xnodes [out] The dropped relation file nodes.
+ */
+void
+pgmoneta_wal_xact_dropped_relations(struct decoded_xlog_record* record, int* nrels, struct rel_file_node** xnodes);
+
 /**
  * Parses a version 14 xl_xact_prepare record.
  *
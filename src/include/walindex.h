@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_WALINDEX_H
+#define PGMONETA_WALINDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define WAL_INDEX_ADD      0
+#define WAL_INDEX_TRUNCATE 1
+
+/** @struct wal_index_entry
+ * Defines a segment of a WAL index. The index file is a header followed by
+ * these records, appended as segments are closed, compressed and removed
+ */
+struct wal_index_entry
+{
+   uint32_t timeline;    /**< The timeline */
+   uint32_t log;         /**< The log id, the middle part of the segment name */
+   uint32_t seg;         /**< The segment, the last part of the segment name */
+   uint8_t type;         /**< The record, WAL_INDEX_ADD or WAL_INDEX_TRUNCATE */
+   uint8_t compression;  /**< The compression of the file */
+   uint8_t encrypted;    /**< Is the file encrypted */
+   uint8_t partial;      /**< Is the segment incomplete */
+   uint64_t size;        /**< The size of the file */
+};
+
+/** @struct wal_index
+ * Defines the segments of a WAL directory ordered by timeline and position
+ */
+struct wal_index
+{
+   char directory[MAX_PATH];         /**< The WAL directory */
+   int segsize;                      /**< The segment size */
+   int number_of_entries;            /**< The number of segments */
+   struct wal_index_entry* entries;  /**< The segments */
+};
+
+/**
+ * Create the index of a WAL directory, unless a valid one exists.
+ * The index is kept next to the directory as <directory>.index
+ * @param directory The WAL directory
+ * @param segsize The segment size
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_wal_index_create(char* directory, int segsize);
+
+/**
+ * Rebuild the index of a WAL directory from the files in it
+ * @param directory The WAL directory
+ * @param segsize The segment size
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_wal_index_rebuild(char* directory, int segsize);
+
+/**
+ * Record a segment file in the index of its directory. Nothing is done if
+ * the directory isn't indexed, or the file isn't a segment
+ * @param path The path of the segment file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_wal_index_add(char* path);
+
+/**
+ * Record that the segments before a segment were removed
+ * @param directory The WAL directory
+ * @param filename The first segment kept, or NULL if all were removed
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_wal_index_truncate(char* directory, char* filename);
+
+/**
+ * Load the index of a WAL directory
+ * @param directory The WAL directory
+ * @param index The resulting index
+ * @return 0 upon success, 1 if the directory has no valid index
+ */
+int
+pgmoneta_wal_index_load(char* directory, struct wal_index** index);
+
+/**
+ * Find the first segment at or after a segment name
+ * @param index The index
+ * @param filename The segment name, suffixes are ignored
+ * @return The position, number_of_entries if there is none
+ */
+int
+pgmoneta_wal_index_search(struct wal_index* index, char* filename);
+
+/**
+ * Find the first segment at or after a position of a timeline
+ * @param index The index
+ * @param timeline The timeline
+ * @param lsn The position
+ * @return The position, number_of_entries if there is none
+ */
+int
+pgmoneta_wal_index_find(struct wal_index* index, uint32_t timeline, uint64_t lsn);
+
+/**
+ * Get the file name of a segment as recorded
+ * @param index The index
+ * @param position The position
+ * @return The file name
+ */
+char*
+pgmoneta_wal_index_name(struct wal_index* index, int position);
+
+/**
+ * Get the file name of a segment as it is on disk. A segment compressed or
+ * encrypted behind the index is found under its other names
+ * @param index The index
+ * @param position The position
+ * @return The file name, or NULL if the segment is gone
+ */
+char*
+pgmoneta_wal_index_file(struct wal_index* index, int position);
+
+/**
+ * Destroy an index
+ * @param index The index
+ */
+void
+pgmoneta_wal_index_destroy(struct wal_index* index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
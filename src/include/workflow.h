@@ -64,6 +64,7 @@ extern "C" {
 #define NODE_COPY_WAL            "copy_wal"             /* Whether to copy WAL */
 #define NODE_BACKUP_BASE         "backup_base"          /* The base directory of the backup */
 #define NODE_BACKUP_DATA         "backup_data"          /* The data directory of the backup */
+#define NODE_CHECKSUMS           "checksums"            /* The SHA512 checksums calculated by the pipeline */
 #define NODE_ERROR_CODE          "error_code"           /* The error code */
 #define NODE_FAILED              "failed"               /* The failed files in a manifest */
 #define NODE_INCREMENTAL_BASE    "incremental_base"     /* The base directory of incremental */
@@ -134,6 +134,28 @@ pgmoneta_create_lz4(bool compress);
 struct workflow*
 pgmoneta_create_bzip2(bool compress);
 
+/**
+ * Create a workflow for compressing, encrypting and hashing in a single pass
+ * @return The workflow
+ */
+struct workflow*
+pgmoneta_create_pipeline(void);
+
+/**
+ * Create a workflow for the deduplication chunk store
+ * @param store true for storing the files as chunks, false for rebuilding them
+ * @return The workflow
+ */
+struct workflow*
+pgmoneta_create_dedup(bool store);
+
+/**
+ * Create a workflow for building incremental backups from WAL summaries
+ * @return The workflow
+ */
+struct workflow*
+pgmoneta_create_summary(void);
+
 /**
  * Create a workflow for symlinking
  * @return The workflow
@@ -57,10 +57,11 @@ pgmoneta_zstandardc_tablespaces(char* root, struct workers* workers);
 
 /**
  * Compress a WAL directory with Zstandard
+ * @param server The server
  * @param directory The directory
  */
 void
-pgmoneta_zstandardc_wal(char* directory);
+pgmoneta_zstandardc_wal(int server, char* directory);
 
 /**
  * ZSTD decompress a single file, also remove the original file
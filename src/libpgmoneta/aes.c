@@ -32,16 +32,106 @@
 #include <management.h>
 #include <security.h>
 #include <utils.h>
+#include <walindex.h>
 #include <workers.h>
 
 /* System */
 #include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <openssl/hmac.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
 
 #define NAME "aes"
 #define ENC_BUF_SIZE (1024 * 1024)
 
+#define AES_GCM_MAGIC      "PGMAESG1"
+#define AES_GCM_SALT_SIZE  16
+#define AES_GCM_NONCE_SIZE 8
+#define AES_GCM_IV_SIZE    12
+#define AES_GCM_KEYS       8
+
+#define OBJECT_HASH_KEY 0
+#define OBJECT_IV_KEY   1
+#define OBJECT_KEYS     (OBJECT_IV_KEY + ENCRYPTION_AES_128_GCM + 1)
+
+/* The modes are numbered from 1, so the cipher keys follow the iv key */
+#define OBJECT_CIPHER_KEY(mode) (OBJECT_IV_KEY + (mode))
+
+/** @struct gcm_key
+ * Defines a key derived from the master key for a salt
+ */
+struct gcm_key
+{
+   bool valid;                              /**< Is the key set */
+   int mode;                                /**< The aes mode */
+   unsigned char salt[AES_GCM_SALT_SIZE];   /**< The salt */
+   unsigned char key[EVP_MAX_KEY_LENGTH];   /**< The key */
+};
+
+/** @struct cipher_key
+ * Defines the key and iv of a mode derived from the master key
+ */
+struct cipher_key
+{
+   bool valid;                              /**< Is the key set */
+   unsigned char key[EVP_MAX_KEY_LENGTH];   /**< The key */
+   unsigned char iv[EVP_MAX_IV_LENGTH];     /**< The iv */
+};
+
+/** @struct gcm_file
+ * Defines a file encrypted or decrypted in the AES-GCM format
+ */
+struct gcm_file
+{
+   pthread_mutex_t lock;                        /**< The lock of the state */
+   char from[MAX_PATH];                         /**< The source file */
+   char to[MAX_PATH];                           /**< The destination file */
+   bool enc;                                    /**< Encrypt or decrypt */
+   int in;                                      /**< The source descriptor */
+   int out;                                     /**< The destination descriptor */
+   int mode;                                    /**< The aes mode */
+   unsigned char header[AES_GCM_HEADER_SIZE];   /**< The header */
+   unsigned char key[EVP_MAX_KEY_LENGTH];       /**< The key */
+   uint32_t chunk_size;                         /**< The size of the plaintext of a chunk */
+   uint64_t size;                               /**< The size of the source */
+   uint64_t number_of_chunks;                   /**< The number of chunks */
+   uint64_t remaining;                          /**< The number of chunks not done */
+   bool failed;                                 /**< Did a chunk fail */
+   struct workers* workers;                     /**< The workers of the chunks */
+};
+
+/** @struct gcm_chunk
+ * Defines the worker input of a chunk
+ */
+struct gcm_chunk
+{
+   struct worker_common common;   /**< The common base */
+   struct gcm_file* file;         /**< The file */
+   uint64_t chunk;                /**< The chunk */
+};
+
+static pthread_mutex_t gcm_lock = PTHREAD_MUTEX_INITIALIZER;
+static char* gcm_master_key = NULL;
+static unsigned char gcm_salt[AES_GCM_SALT_SIZE];
+static bool gcm_salt_ready = false;
+static struct gcm_key gcm_keys[AES_GCM_KEYS];
+static int gcm_next_key = 0;
+static struct cipher_key cipher_keys[ENCRYPTION_AES_128_GCM + 1];
+static struct cipher_key object_keys[OBJECT_KEYS];
+
 static int encrypt_file(char* from, char* to, int enc);
 static int derive_key_iv(char* password, unsigned char* key, unsigned char* iv, int mode);
+static int get_key_iv(int mode, unsigned char* key, unsigned char* iv);
+static int load_master_key(void);
+static int get_object_key(int index, unsigned char* key);
+static const EVP_CIPHER* object_cipher(int mode);
+static int hkdf(char* master_key, unsigned char* salt, size_t salt_length, char* info, unsigned char* key, size_t length);
 static int aes_encrypt(char* plaintext, unsigned char* key, unsigned char* iv, char** ciphertext, int* ciphertext_length, int mode);
 static int aes_decrypt(char* ciphertext, int ciphertext_length, unsigned char* key, unsigned char* iv, char** plaintext, int mode);
 static const EVP_CIPHER* (*get_cipher(int mode))(void);
@@ -52,6 +142,26 @@ static void do_decrypt_file(struct worker_common* wc);
 
 static int encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** res_buffer, size_t* res_size, int enc, int mode);
 
+static int gcm_open(char* from, char* to, bool enc, int mode, struct gcm_file* f);
+static void gcm_close(struct gcm_file* f);
+static int gcm_read_header(int fd, unsigned char* header, int* mode, uint32_t* chunk_size);
+static int gcm_number_of_chunks(struct gcm_file* f);
+static int gcm_get_key(int mode, unsigned char* salt, unsigned char* key);
+static int gcm_derive(char* master_key, int mode, unsigned char* salt, unsigned char* key);
+static int gcm_key_length(int mode);
+static const EVP_CIPHER* gcm_cipher(int mode);
+static int gcm_process(struct gcm_file* f, uint64_t chunk, unsigned char* input, unsigned char* output, uint64_t* offset, size_t* size);
+static int gcm_crypt(struct gcm_file* f, uint64_t chunk, unsigned char* in, size_t in_size, unsigned char* out);
+static int gcm_file(char* from, char* to, bool enc);
+static int gcm_parallel(char* from, char* to, bool enc, struct workers* workers);
+static void do_gcm_chunk(struct worker_common* wc);
+static void gcm_chunk_done(struct gcm_file* f, bool ok);
+static void gcm_file_finish(struct gcm_file* f);
+static int read_fully(int fd, void* buffer, size_t size, uint64_t offset);
+static int write_fully(int fd, void* buffer, size_t size, uint64_t offset);
+static void put_be32(unsigned char* p, uint32_t value);
+static uint32_t get_be32(unsigned char* p);
+
 int
 pgmoneta_encrypt_data(char* d, struct workers* workers)
 {
@@ -101,7 +211,11 @@ pgmoneta_encrypt_data(char* d, struct workers* workers)
             {
                struct worker_input* wi = NULL;
 
-               if (!pgmoneta_create_worker_input(NULL, from, to, 0, workers, &wi))
+               if (workers != NULL && workers->outcome && !gcm_parallel(from, to, true, workers))
+               {
+                  pgmoneta_log_trace("AES: Encrypting %s in parallel", from);
+               }
+               else if (!pgmoneta_create_worker_input(NULL, from, to, 0, workers, &wi))
                {
                   if (workers != NULL)
                   {
@@ -263,6 +377,7 @@ pgmoneta_encrypt_wal(char* d)
             encrypt_file(from, to, 1);
             pgmoneta_delete_file(from, NULL);
             pgmoneta_permission(to, 6, 0, 0);
+            pgmoneta_wal_index_add(to);
          }
          else
          {
@@ -387,7 +502,11 @@ pgmoneta_encrypt_file(char* from, char* to)
       flag = 1;
    }
 
-   encrypt_file(from, to, 1);
+   if (encrypt_file(from, to, 1))
+   {
+      pgmoneta_log_error("pgmoneta_encrypt_file: Could not encrypt %s", from);
+      goto error;
+   }
 
    if (pgmoneta_exists(from))
    {
@@ -403,6 +522,13 @@ pgmoneta_encrypt_file(char* from, char* to)
       free(to);
    }
    return 0;
+
+error:
+   if (flag)
+   {
+      free(to);
+   }
+   return 1;
 }
 
 int
@@ -425,7 +551,13 @@ pgmoneta_decrypt_file(char* from, char* to)
       flag = 1;
    }
 
-   encrypt_file(from, to, 0);
+   // a chunk that fails authentication keeps the encrypted file
+   if (encrypt_file(from, to, 0))
+   {
+      pgmoneta_log_error("pgmoneta_decrypt_file: Could not decrypt %s", from);
+      goto error;
+   }
+
    if (pgmoneta_exists(from))
    {
       pgmoneta_delete_file(from, NULL);
@@ -440,6 +572,13 @@ pgmoneta_decrypt_file(char* from, char* to)
       free(to);
    }
    return 0;
+
+error:
+   if (flag)
+   {
+      free(to);
+   }
+   return 1;
 }
 
 int
@@ -496,7 +635,11 @@ pgmoneta_decrypt_directory(char* d, struct workers* workers)
             to = pgmoneta_append(to, "/");
             to = pgmoneta_append(to, name);
 
-            if (!pgmoneta_create_worker_input(NULL, from, to, 0, workers, &wi))
+            if (workers != NULL && workers->outcome && !gcm_parallel(from, to, false, workers))
+            {
+               pgmoneta_log_trace("AES: Decrypting %s in parallel", from);
+            }
+            else if (!pgmoneta_create_worker_input(NULL, from, to, 0, workers, &wi))
             {
                if (workers != NULL)
                {
@@ -697,409 +840,509 @@ pgmoneta_decrypt(char* ciphertext, int ciphertext_length, char* password, char**
    return aes_decrypt(ciphertext, ciphertext_length, key, iv, plaintext, mode);
 }
 
-// [private]
-static int
-derive_key_iv(char* password, unsigned char* key, unsigned char* iv, int mode)
+int
+pgmoneta_create_cipher_context(int mode, int enc, EVP_CIPHER_CTX** ctx)
 {
-   if (!EVP_BytesToKey(get_cipher(mode)(), EVP_sha1(), NULL,
-                       (unsigned char*) password, strlen(password), 1,
-                       key, iv))
-   {
-      return 1;
-   }
-
-   return 0;
-}
+   unsigned char key[EVP_MAX_KEY_LENGTH];
+   unsigned char iv[EVP_MAX_IV_LENGTH];
+   EVP_CIPHER_CTX* c = NULL;
 
-// [private]
-static int
-aes_encrypt(char* plaintext, unsigned char* key, unsigned char* iv, char** ciphertext, int* ciphertext_length, int mode)
-{
-   EVP_CIPHER_CTX* ctx = NULL;
-   int length;
-   size_t size;
-   unsigned char* ct = NULL;
-   int ct_length;
-   const EVP_CIPHER* (* cipher_fp)(void) = get_cipher(mode);
-   if (!(ctx = EVP_CIPHER_CTX_new()))
-   {
-      goto error;
-   }
+   *ctx = NULL;
 
-   if (EVP_EncryptInit_ex(ctx, cipher_fp(), NULL, key, iv) != 1)
+   // a stream has no place for the tags, so the GCM modes are never downgraded to one
+   if (pgmoneta_is_gcm_mode(mode))
    {
+      pgmoneta_log_error("AES: A cipher context is not available for the GCM modes");
       goto error;
    }
 
-   size = strlen(plaintext) + EVP_CIPHER_block_size(cipher_fp());
-   ct = malloc(size);
-
-   if (ct == NULL)
+   if (get_key_iv(mode, key, iv))
    {
       goto error;
    }
 
-   memset(ct, 0, size);
-
-   if (EVP_EncryptUpdate(ctx,
-                         ct, &length,
-                         (unsigned char*)plaintext, strlen((char*)plaintext)) != 1)
+   if (!(c = EVP_CIPHER_CTX_new()))
    {
+      pgmoneta_log_error("EVP_CIPHER_CTX_new: Failed to get context");
       goto error;
    }
 
-   ct_length = length;
-
-   if (EVP_EncryptFinal_ex(ctx, ct + length, &length) != 1)
+   if (EVP_CipherInit_ex(c, get_cipher(mode)(), NULL, key, iv, enc) == 0)
    {
+      pgmoneta_log_error("EVP_CipherInit_ex: Failed to initialize context");
       goto error;
    }
 
-   ct_length += length;
-
-   EVP_CIPHER_CTX_free(ctx);
-
-   *ciphertext = (char*)ct;
-   *ciphertext_length = ct_length;
+   *ctx = c;
 
    return 0;
 
 error:
-   if (ctx)
+
+   if (c != NULL)
    {
-      EVP_CIPHER_CTX_free(ctx);
+      EVP_CIPHER_CTX_free(c);
    }
 
-   free(ct);
-
    return 1;
 }
 
-// [private]
-static int
-aes_decrypt(char* ciphertext, int ciphertext_length, unsigned char* key, unsigned char* iv, char** plaintext, int mode)
+int
+pgmoneta_create_cipher_context_at(int mode, uint64_t block, unsigned char* previous, EVP_CIPHER_CTX** ctx)
 {
-   EVP_CIPHER_CTX* ctx = NULL;
-   int plaintext_length;
-   int length;
-   size_t size;
-   char* pt = NULL;
-   const EVP_CIPHER* (* cipher_fp)(void) = get_cipher(mode);
+   unsigned char key[EVP_MAX_KEY_LENGTH];
+   unsigned char iv[EVP_MAX_IV_LENGTH];
+   unsigned int carry = 0;
+   EVP_CIPHER_CTX* c = NULL;
 
-   if (!(ctx = EVP_CIPHER_CTX_new()))
+   *ctx = NULL;
+
+   // a stream has no place for the tags, so the GCM modes are never downgraded to one
+   if (pgmoneta_is_gcm_mode(mode))
    {
+      pgmoneta_log_error("AES: A cipher context is not available for the GCM modes");
       goto error;
    }
 
-   if (EVP_DecryptInit_ex(ctx, cipher_fp(), NULL, key, iv) != 1)
+   if (get_key_iv(mode, key, iv))
    {
       goto error;
    }
 
-   size = ciphertext_length + EVP_CIPHER_block_size(cipher_fp());
-   pt = malloc(size);
-
-   if (pt == NULL)
+   if (pgmoneta_is_counter_mode(mode))
    {
-      goto error;
+      // the counter is the iv as a 128 bit big endian number, increased for every block
+      for (int i = 15; i >= 0; i--)
+      {
+         carry += iv[i] + (unsigned int)(block & 0xFF);
+         iv[i] = (unsigned char)(carry & 0xFF);
+         carry >>= 8;
+         block >>= 8;
+      }
+   }
+   else if (block > 0)
+   {
+      if (previous == NULL)
+      {
+         goto error;
+      }
+      // in CBC the previous cipher block is the iv of the next one
+      memcpy(iv, previous, 16);
    }
 
-   memset(pt, 0, size);
-
-   if (EVP_DecryptUpdate(ctx,
-                         (unsigned char*)pt, &length,
-                         (unsigned char*)ciphertext, ciphertext_length) != 1)
+   if (!(c = EVP_CIPHER_CTX_new()))
    {
+      pgmoneta_log_error("EVP_CIPHER_CTX_new: Failed to get context");
       goto error;
    }
 
-   plaintext_length = length;
-
-   if (EVP_DecryptFinal_ex(ctx, (unsigned char*)pt + length, &length) != 1)
+   if (EVP_CipherInit_ex(c, get_cipher(mode)(), NULL, key, iv, 0) == 0)
    {
+      pgmoneta_log_error("EVP_CipherInit_ex: Failed to initialize context");
       goto error;
    }
 
-   plaintext_length += length;
-
-   EVP_CIPHER_CTX_free(ctx);
+   EVP_CIPHER_CTX_set_padding(c, 0);
 
-   pt[plaintext_length] = 0;
-   *plaintext = pt;
+   *ctx = c;
 
    return 0;
 
 error:
-   if (ctx)
+
+   if (c != NULL)
    {
-      EVP_CIPHER_CTX_free(ctx);
+      EVP_CIPHER_CTX_free(c);
    }
 
-   free(pt);
-
    return 1;
 }
 
-static const EVP_CIPHER* (*get_cipher(int mode))(void)
+bool
+pgmoneta_is_counter_mode(int mode)
 {
-   if (mode == ENCRYPTION_AES_256_CBC)
-   {
-      return &EVP_aes_256_cbc;
-   }
-   if (mode == ENCRYPTION_AES_192_CBC)
-   {
-      return &EVP_aes_192_cbc;
-   }
-   if (mode == ENCRYPTION_AES_128_CBC)
-   {
-      return &EVP_aes_128_cbc;
-   }
-   if (mode == ENCRYPTION_AES_256_CTR)
-   {
-      return &EVP_aes_256_ctr;
-   }
-   if (mode == ENCRYPTION_AES_192_CTR)
+   return mode == ENCRYPTION_AES_256_CTR || mode == ENCRYPTION_AES_192_CTR || mode == ENCRYPTION_AES_128_CTR;
+}
+
+bool
+pgmoneta_is_gcm_mode(int mode)
+{
+   return mode == ENCRYPTION_AES_256_GCM || mode == ENCRYPTION_AES_192_GCM || mode == ENCRYPTION_AES_128_GCM;
+}
+
+bool
+pgmoneta_is_gcm_file(char* path)
+{
+   char magic[sizeof(AES_GCM_MAGIC) - 1];
+   int fd;
+   bool gcm = false;
+
+   fd = open(path, O_RDONLY);
+   if (fd == -1)
    {
-      return &EVP_aes_192_ctr;
+      return false;
    }
-   if (mode == ENCRYPTION_AES_128_CTR)
+
+   if (!read_fully(fd, magic, sizeof(magic), 0))
    {
-      return &EVP_aes_128_ctr;
+      gcm = memcmp(magic, AES_GCM_MAGIC, sizeof(magic)) == 0;
    }
-   return &EVP_aes_256_cbc;
+
+   close(fd);
+
+   return gcm;
 }
 
-// enc: 1 for encrypt, 0 for decrypt
-static int
-encrypt_file(char* from, char* to, int enc)
+int
+pgmoneta_gcm_plaintext_size(int fd, uint64_t* size)
 {
-   unsigned char key[EVP_MAX_KEY_LENGTH];
-   unsigned char iv[EVP_MAX_IV_LENGTH];
-   char* master_key = NULL;
-   EVP_CIPHER_CTX* ctx = NULL;
-   struct main_configuration* config;
-   const EVP_CIPHER* (* cipher_fp)(void) = NULL;
-   int cipher_block_size = 0;
-   int inbuf_size = 0;
-   int outbuf_size = 0;
-   FILE* in = NULL;
-   FILE* out = NULL;
-   int inl = 0;
-   int outl = 0;
-   int f_len = 0;
+   struct gcm_file f;
+   struct stat st;
 
-   config = (struct main_configuration*)shmem;
-   cipher_fp = get_cipher(config->encryption);
-   cipher_block_size = EVP_CIPHER_block_size(cipher_fp());
-   inbuf_size = ENC_BUF_SIZE;
-   outbuf_size = inbuf_size + cipher_block_size - 1;
-   unsigned char inbuf[inbuf_size];
-   unsigned char outbuf[outbuf_size];
+   *size = 0;
 
-   if (pgmoneta_get_master_key(&master_key))
-   {
-      pgmoneta_log_error("pgmoneta_get_master_key: Invalid master key");
-      goto error;
-   }
-   memset(&key, 0, sizeof(key));
-   memset(&iv, 0, sizeof(iv));
-   if (derive_key_iv(master_key, key, iv, config->encryption) != 0)
+   memset(&f, 0, sizeof(struct gcm_file));
+
+   if (fstat(fd, &st) != 0 || gcm_read_header(fd, f.header, &f.mode, &f.chunk_size))
    {
-      pgmoneta_log_error("derive_key_iv: Failed to derive key and iv");
-      goto error;
+      return 1;
    }
 
-   if (!(ctx = EVP_CIPHER_CTX_new()))
+   f.size = (uint64_t)st.st_size;
+
+   if (gcm_number_of_chunks(&f))
    {
-      pgmoneta_log_error("EVP_CIPHER_CTX_new: Failed to get context");
-      goto error;
+      return 1;
    }
 
-   in = fopen(from, "rb");
-   if (in == NULL)
+   *size = f.size - AES_GCM_HEADER_SIZE - f.number_of_chunks * AES_GCM_TAG_SIZE;
+
+   return 0;
+}
+
+int
+pgmoneta_gcm_read(int fd, uint64_t offset, void* buffer, size_t size)
+{
+   struct gcm_file f;
+   struct stat st;
+   unsigned char* input = NULL;
+   unsigned char* output = NULL;
+   uint64_t out_offset;
+   size_t out_size;
+   size_t done = 0;
+   size_t n;
+
+   memset(&f, 0, sizeof(struct gcm_file));
+   f.in = fd;
+   f.out = -1;
+
+   if (fstat(fd, &st) != 0 || gcm_read_header(fd, f.header, &f.mode, &f.chunk_size))
    {
-      pgmoneta_log_error("fopen: Could not open %s", from);
       goto error;
    }
 
-   out = fopen(to, "w");
-   if (out == NULL)
+   f.size = (uint64_t)st.st_size;
+
+   if (gcm_number_of_chunks(&f) || gcm_get_key(f.mode, f.header + 16, f.key))
    {
-      pgmoneta_log_error("fopen: Could not open %s", to);
       goto error;
    }
 
-   if (EVP_CipherInit_ex(ctx, cipher_fp(), NULL, key, iv, enc) == 0)
+   input = (unsigned char*)malloc(f.chunk_size + AES_GCM_TAG_SIZE);
+   output = (unsigned char*)malloc(f.chunk_size);
+   if (input == NULL || output == NULL)
    {
-      pgmoneta_log_error("EVP_CipherInit_ex: ailed to initialize context");
       goto error;
    }
 
-   while ((inl = fread(inbuf, sizeof(char), inbuf_size, in)) > 0)
+   while (done < size)
    {
-      if (EVP_CipherUpdate(ctx, outbuf, &outl, inbuf, inl) == 0)
+      uint64_t chunk = (offset + done) / f.chunk_size;
+
+      if (chunk >= f.number_of_chunks || gcm_process(&f, chunk, input, output, &out_offset, &out_size))
       {
-         pgmoneta_log_error("EVP_CipherUpdate: failed to process block");
          goto error;
       }
-      if (fwrite(outbuf, sizeof(char), outl, out) != (size_t)outl)
+
+      if (offset + done >= out_offset + out_size)
       {
-         pgmoneta_log_error("fwrite: failed to write cipher");
          goto error;
       }
-   }
 
-   if (ferror(in))
-   {
-      pgmoneta_log_error("fread: error reading from file: %s", from);
-      goto error;
+      n = MIN(size - done, (size_t)(out_offset + out_size - (offset + done)));
+      memcpy((char*)buffer + done, output + (offset + done - out_offset), n);
+      done += n;
    }
 
-   if (EVP_CipherFinal_ex(ctx, outbuf, &f_len) == 0)
-   {
-      pgmoneta_log_error("EVP_CipherFinal_ex: failed to process final cipher block");
-      goto error;
-   }
+   free(input);
+   free(output);
 
-   if (f_len)
-   {
-      if (fwrite(outbuf, sizeof(char), f_len, out) != (size_t)f_len)
-      {
-         pgmoneta_log_error("fwrite: failed to write final block");
-         goto error;
-      }
-   }
+   return 0;
 
-   if (ctx)
-   {
-      EVP_CIPHER_CTX_free(ctx);
+error:
+
+   free(input);
+   free(output);
+
+   return 1;
+}
+
+// [private]
+static int
+derive_key_iv(char* password, unsigned char* key, unsigned char* iv, int mode)
+{
+   if (!EVP_BytesToKey(get_cipher(mode)(), EVP_sha1(), NULL,
+                       (unsigned char*) password, strlen(password), 1,
+                       key, iv))
+   {
+      return 1;
    }
-   free(master_key);
-   fclose(in);
-   fclose(out);
+
    return 0;
+}
 
-error:
-   if (ctx)
+static int
+get_key_iv(int mode, unsigned char* key, unsigned char* iv)
+{
+   struct cipher_key* k = NULL;
+
+   if (mode < 0 || mode > ENCRYPTION_AES_128_GCM)
    {
-      EVP_CIPHER_CTX_free(ctx);
+      return 1;
    }
 
-   free(master_key);
+   pthread_mutex_lock(&gcm_lock);
 
-   if (in != NULL)
+   k = &cipher_keys[mode];
+
+   if (!k->valid)
    {
-      fclose(in);
+      if (load_master_key())
+      {
+         goto error;
+      }
+
+      memset(k, 0, sizeof(struct cipher_key));
+
+      if (derive_key_iv(gcm_master_key, k->key, k->iv, mode) != 0)
+      {
+         pgmoneta_log_error("derive_key_iv: Failed to derive key and iv");
+         goto error;
+      }
+
+      k->valid = true;
    }
 
-   if (out != NULL)
+   memcpy(key, k->key, EVP_MAX_KEY_LENGTH);
+   memcpy(iv, k->iv, EVP_MAX_IV_LENGTH);
+
+   pthread_mutex_unlock(&gcm_lock);
+
+   return 0;
+
+error:
+
+   pthread_mutex_unlock(&gcm_lock);
+
+   return 1;
+}
+
+// gcm_lock must be held
+static int
+load_master_key(void)
+{
+   // the master key is read once, not for every file
+   if (gcm_master_key == NULL && pgmoneta_get_master_key(&gcm_master_key))
    {
-      fclose(out);
+      pgmoneta_log_error("pgmoneta_get_master_key: Invalid master key");
+      gcm_master_key = NULL;
+      return 1;
    }
 
-   return 1;
+   return 0;
 }
 
-int
-pgmoneta_encrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** enc_buffer, size_t* enc_size, int mode)
+static int
+get_object_key(int index, unsigned char* key)
 {
-   return encrypt_decrypt_buffer(origin_buffer, origin_size, enc_buffer, enc_size, 1, mode);
+   char info[32];
+   struct cipher_key* k = NULL;
+
+   if (index < 0 || index >= OBJECT_KEYS)
+   {
+      return 1;
+   }
+
+   pthread_mutex_lock(&gcm_lock);
+
+   k = &object_keys[index];
+
+   if (!k->valid)
+   {
+      if (load_master_key())
+      {
+         goto error;
+      }
+
+      memset(k, 0, sizeof(struct cipher_key));
+
+      // every purpose, and every mode, has a key of its own
+      snprintf(info, sizeof(info), "pgmoneta object %d", index);
+
+      if (hkdf(gcm_master_key, NULL, 0, info, k->key, 32))
+      {
+         pgmoneta_log_error("AES: Failed to derive key");
+         goto error;
+      }
+
+      k->valid = true;
+   }
+
+   memcpy(key, k->key, EVP_MAX_KEY_LENGTH);
+
+   pthread_mutex_unlock(&gcm_lock);
+
+   return 0;
+
+error:
+
+   pthread_mutex_unlock(&gcm_lock);
+
+   return 1;
 }
 
-int
-pgmoneta_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** dec_buffer, size_t* dec_size, int mode)
+static const EVP_CIPHER*
+object_cipher(int mode)
 {
-   return encrypt_decrypt_buffer(origin_buffer, origin_size, dec_buffer, dec_size, 0, mode);
+   if (pgmoneta_is_gcm_mode(mode))
+   {
+      return gcm_cipher(mode);
+   }
+
+   if (mode == ENCRYPTION_AES_256_CBC || mode == ENCRYPTION_AES_192_CBC || mode == ENCRYPTION_AES_128_CBC ||
+       pgmoneta_is_counter_mode(mode))
+   {
+      return get_cipher(mode)();
+   }
+
+   return NULL;
 }
 
+// [private]
 static int
-encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** res_buffer, size_t* res_size, int enc, int mode)
+aes_encrypt(char* plaintext, unsigned char* key, unsigned char* iv, char** ciphertext, int* ciphertext_length, int mode)
 {
-   unsigned char key[EVP_MAX_KEY_LENGTH];
-   unsigned char iv[EVP_MAX_IV_LENGTH];
-   char* master_key = NULL;
    EVP_CIPHER_CTX* ctx = NULL;
-   const EVP_CIPHER* (*cipher_fp)(void) = NULL;
-   size_t cipher_block_size = 0;
-   size_t outbuf_size = 0;
-   size_t outl = 0;
-   size_t f_len = 0;
-
-   cipher_fp = get_cipher_buffer(mode);
-   if (cipher_fp == NULL)
+   int length;
+   size_t size;
+   unsigned char* ct = NULL;
+   int ct_length;
+   const EVP_CIPHER* (* cipher_fp)(void) = get_cipher(mode);
+   if (!(ctx = EVP_CIPHER_CTX_new()))
    {
-      pgmoneta_log_error("Invalid encryption method specified");
       goto error;
    }
 
-   cipher_block_size = EVP_CIPHER_block_size(cipher_fp());
-
-   if (enc == 1)
+   if (EVP_EncryptInit_ex(ctx, cipher_fp(), NULL, key, iv) != 1)
    {
-      outbuf_size = origin_size + cipher_block_size;
+      goto error;
    }
-   else
+
+   size = strlen(plaintext) + EVP_CIPHER_block_size(cipher_fp());
+   ct = malloc(size);
+
+   if (ct == NULL)
    {
-      outbuf_size = origin_size;
+      goto error;
    }
 
-   *res_buffer = (unsigned char*)malloc(outbuf_size + 1);
-   if (*res_buffer == NULL)
+   memset(ct, 0, size);
+
+   if (EVP_EncryptUpdate(ctx,
+                         ct, &length,
+                         (unsigned char*)plaintext, strlen((char*)plaintext)) != 1)
    {
-      pgmoneta_log_error("pgmoneta_encrypt_decrypt_buffer: Allocation failure");
       goto error;
    }
 
-   if (pgmoneta_get_master_key(&master_key))
+   ct_length = length;
+
+   if (EVP_EncryptFinal_ex(ctx, ct + length, &length) != 1)
    {
-      pgmoneta_log_error("pgmoneta_get_master_key: Invalid master key");
       goto error;
    }
 
-   memset(&key, 0, sizeof(key));
-   memset(&iv, 0, sizeof(iv));
+   ct_length += length;
+
+   EVP_CIPHER_CTX_free(ctx);
+
+   *ciphertext = (char*)ct;
+   *ciphertext_length = ct_length;
 
-   if (derive_key_iv(master_key, key, iv, mode) != 0)
+   return 0;
+
+error:
+   if (ctx)
    {
-      pgmoneta_log_error("derive_key_iv: Failed to derive key and iv");
-      goto error;
+      EVP_CIPHER_CTX_free(ctx);
    }
 
+   free(ct);
+
+   return 1;
+}
+
+// [private]
+static int
+aes_decrypt(char* ciphertext, int ciphertext_length, unsigned char* key, unsigned char* iv, char** plaintext, int mode)
+{
+   EVP_CIPHER_CTX* ctx = NULL;
+   int plaintext_length;
+   int length;
+   size_t size;
+   char* pt = NULL;
+   const EVP_CIPHER* (* cipher_fp)(void) = get_cipher(mode);
+
    if (!(ctx = EVP_CIPHER_CTX_new()))
    {
-      pgmoneta_log_error("EVP_CIPHER_CTX_new: Failed to create context");
       goto error;
    }
 
-   if (EVP_CipherInit_ex(ctx, cipher_fp(), NULL, key, iv, enc) == 0)
+   if (EVP_DecryptInit_ex(ctx, cipher_fp(), NULL, key, iv) != 1)
    {
-      pgmoneta_log_error("EVP_CipherInit_ex: Failed to initialize cipher context");
       goto error;
    }
 
-   if (EVP_CipherUpdate(ctx, *res_buffer, (int*)&outl, origin_buffer, origin_size) == 0)
+   size = ciphertext_length + EVP_CIPHER_block_size(cipher_fp());
+   pt = malloc(size);
+
+   if (pt == NULL)
    {
-      pgmoneta_log_error("EVP_CipherUpdate: Failed to process data");
       goto error;
    }
 
-   *res_size = outl;
+   memset(pt, 0, size);
 
-   if (EVP_CipherFinal_ex(ctx, *res_buffer + outl, (int*)&f_len) == 0)
+   if (EVP_DecryptUpdate(ctx,
+                         (unsigned char*)pt, &length,
+                         (unsigned char*)ciphertext, ciphertext_length) != 1)
    {
-      pgmoneta_log_error("EVP_CipherFinal_ex: Failed to finalize operation");
       goto error;
    }
 
-   *res_size += f_len;
+   plaintext_length = length;
 
-   if (enc == 0)
+   if (EVP_DecryptFinal_ex(ctx, (unsigned char*)pt + length, &length) != 1)
    {
-      (*res_buffer)[*res_size] = '\0';
+      goto error;
    }
 
+   plaintext_length += length;
+
    EVP_CIPHER_CTX_free(ctx);
-   free(master_key);
+
+   pt[plaintext_length] = 0;
+   *plaintext = pt;
 
    return 0;
 
@@ -1109,12 +1352,12 @@ error:
       EVP_CIPHER_CTX_free(ctx);
    }
 
-   free(master_key);
+   free(pt);
 
    return 1;
 }
 
-static const EVP_CIPHER* (*get_cipher_buffer(int mode))(void)
+static const EVP_CIPHER* (*get_cipher(int mode))(void)
 {
    if (mode == ENCRYPTION_AES_256_CBC)
    {
@@ -1128,5 +1371,1020 @@ static const EVP_CIPHER* (*get_cipher_buffer(int mode))(void)
    {
       return &EVP_aes_128_cbc;
    }
+   if (mode == ENCRYPTION_AES_256_CTR)
+   {
+      return &EVP_aes_256_ctr;
+   }
+   if (mode == ENCRYPTION_AES_192_CTR)
+   {
+      return &EVP_aes_192_ctr;
+   }
+   if (mode == ENCRYPTION_AES_128_CTR)
+   {
+      return &EVP_aes_128_ctr;
+   }
    return &EVP_aes_256_cbc;
 }
+
+// enc: 1 for encrypt, 0 for decrypt
+static int
+encrypt_file(char* from, char* to, int enc)
+{
+   EVP_CIPHER_CTX* ctx = NULL;
+   struct main_configuration* config;
+   const EVP_CIPHER* (* cipher_fp)(void) = NULL;
+   int cipher_block_size = 0;
+   int inbuf_size = 0;
+   int outbuf_size = 0;
+   FILE* in = NULL;
+   FILE* out = NULL;
+   int inl = 0;
+   int outl = 0;
+   int f_len = 0;
+
+   config = (struct main_configuration*)shmem;
+
+   // the format of a file to decrypt is told by its header
+   if ((enc && pgmoneta_is_gcm_mode(config->encryption)) || (!enc && pgmoneta_is_gcm_file(from)))
+   {
+      return gcm_file(from, to, enc);
+   }
+
+   cipher_fp = get_cipher(config->encryption);
+   cipher_block_size = EVP_CIPHER_block_size(cipher_fp());
+   inbuf_size = ENC_BUF_SIZE;
+   outbuf_size = inbuf_size + cipher_block_size - 1;
+   unsigned char inbuf[inbuf_size];
+   unsigned char outbuf[outbuf_size];
+
+   if (pgmoneta_create_cipher_context(config->encryption, enc, &ctx))
+   {
+      goto error;
+   }
+
+   in = fopen(from, "rb");
+   if (in == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", from);
+      goto error;
+   }
+
+   out = fopen(to, "w");
+   if (out == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", to);
+      goto error;
+   }
+
+   while ((inl = fread(inbuf, sizeof(char), inbuf_size, in)) > 0)
+   {
+      if (EVP_CipherUpdate(ctx, outbuf, &outl, inbuf, inl) == 0)
+      {
+         pgmoneta_log_error("EVP_CipherUpdate: failed to process block");
+         goto error;
+      }
+      if (fwrite(outbuf, sizeof(char), outl, out) != (size_t)outl)
+      {
+         pgmoneta_log_error("fwrite: failed to write cipher");
+         goto error;
+      }
+   }
+
+   if (ferror(in))
+   {
+      pgmoneta_log_error("fread: error reading from file: %s", from);
+      goto error;
+   }
+
+   if (EVP_CipherFinal_ex(ctx, outbuf, &f_len) == 0)
+   {
+      pgmoneta_log_error("EVP_CipherFinal_ex: failed to process final cipher block");
+      goto error;
+   }
+
+   if (f_len)
+   {
+      if (fwrite(outbuf, sizeof(char), f_len, out) != (size_t)f_len)
+      {
+         pgmoneta_log_error("fwrite: failed to write final block");
+         goto error;
+      }
+   }
+
+   if (ctx)
+   {
+      EVP_CIPHER_CTX_free(ctx);
+   }
+   fclose(in);
+   fclose(out);
+   return 0;
+
+error:
+   if (ctx)
+   {
+      EVP_CIPHER_CTX_free(ctx);
+   }
+
+   if (in != NULL)
+   {
+      fclose(in);
+   }
+
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+
+   return 1;
+}
+
+int
+pgmoneta_object_hash(unsigned char* data, size_t size, unsigned char* hash, unsigned int* length)
+{
+   unsigned char key[EVP_MAX_KEY_LENGTH];
+
+   *length = 0;
+
+   if (get_object_key(OBJECT_HASH_KEY, key))
+   {
+      return 1;
+   }
+
+   if (HMAC(EVP_sha256(), key, 32, data, size, hash, length) == NULL)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+int
+pgmoneta_object_iv(char* name, unsigned char* iv)
+{
+   unsigned char key[EVP_MAX_KEY_LENGTH];
+   unsigned char md[EVP_MAX_MD_SIZE];
+   unsigned int length = 0;
+
+   if (get_object_key(OBJECT_IV_KEY, key))
+   {
+      return 1;
+   }
+
+   if (HMAC(EVP_sha256(), key, 32, (unsigned char*)name, strlen(name), md, &length) == NULL ||
+       length < AES_OBJECT_IV_SIZE)
+   {
+      return 1;
+   }
+
+   memcpy(iv, md, AES_OBJECT_IV_SIZE);
+
+   return 0;
+}
+
+int
+pgmoneta_crypt_object(int mode, int enc, unsigned char* iv, unsigned char* tag,
+                      unsigned char* in, size_t in_size, unsigned char* out, size_t* out_size)
+{
+   unsigned char key[EVP_MAX_KEY_LENGTH];
+   int length = 0;
+   int final_length = 0;
+   bool gcm;
+   const EVP_CIPHER* cipher = NULL;
+   EVP_CIPHER_CTX* ctx = NULL;
+
+   *out_size = 0;
+
+   gcm = pgmoneta_is_gcm_mode(mode);
+   cipher = object_cipher(mode);
+
+   if (cipher == NULL || get_object_key(OBJECT_CIPHER_KEY(mode), key))
+   {
+      goto error;
+   }
+
+   if (!(ctx = EVP_CIPHER_CTX_new()))
+   {
+      goto error;
+   }
+
+   if (EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, enc) != 1)
+   {
+      goto error;
+   }
+
+   if (gcm && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AES_GCM_IV_SIZE, NULL) != 1)
+   {
+      goto error;
+   }
+
+   // the GCM modes use the first 96 bits of the iv as the nonce
+   if (EVP_CipherInit_ex(ctx, NULL, NULL, key, iv, enc) != 1)
+   {
+      goto error;
+   }
+
+   if (in_size > 0 && EVP_CipherUpdate(ctx, out, &length, in, (int)in_size) != 1)
+   {
+      goto error;
+   }
+
+   if (gcm && !enc && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, AES_GCM_TAG_SIZE, tag) != 1)
+   {
+      goto error;
+   }
+
+   if (EVP_CipherFinal_ex(ctx, out + length, &final_length) != 1)
+   {
+      pgmoneta_log_error("AES: Object failed %s", gcm && !enc ? "authentication" : "encryption");
+      goto error;
+   }
+
+   if (gcm && enc && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, AES_GCM_TAG_SIZE, tag) != 1)
+   {
+      goto error;
+   }
+
+   *out_size = (size_t)(length + final_length);
+
+   EVP_CIPHER_CTX_free(ctx);
+
+   return 0;
+
+error:
+
+   if (ctx != NULL)
+   {
+      EVP_CIPHER_CTX_free(ctx);
+   }
+
+   return 1;
+}
+
+int
+pgmoneta_encrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** enc_buffer, size_t* enc_size, int mode)
+{
+   return encrypt_decrypt_buffer(origin_buffer, origin_size, enc_buffer, enc_size, 1, mode);
+}
+
+int
+pgmoneta_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** dec_buffer, size_t* dec_size, int mode)
+{
+   return encrypt_decrypt_buffer(origin_buffer, origin_size, dec_buffer, dec_size, 0, mode);
+}
+
+static int
+encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** res_buffer, size_t* res_size, int enc, int mode)
+{
+   unsigned char key[EVP_MAX_KEY_LENGTH];
+   unsigned char iv[EVP_MAX_IV_LENGTH];
+   EVP_CIPHER_CTX* ctx = NULL;
+   const EVP_CIPHER* (*cipher_fp)(void) = NULL;
+   size_t cipher_block_size = 0;
+   size_t outbuf_size = 0;
+   size_t outl = 0;
+   size_t f_len = 0;
+
+   cipher_fp = get_cipher_buffer(mode);
+   if (cipher_fp == NULL)
+   {
+      pgmoneta_log_error("Invalid encryption method specified");
+      goto error;
+   }
+
+   cipher_block_size = EVP_CIPHER_block_size(cipher_fp());
+
+   if (enc == 1)
+   {
+      outbuf_size = origin_size + cipher_block_size;
+   }
+   else
+   {
+      outbuf_size = origin_size;
+   }
+
+   *res_buffer = (unsigned char*)malloc(outbuf_size + 1);
+   if (*res_buffer == NULL)
+   {
+      pgmoneta_log_error("pgmoneta_encrypt_decrypt_buffer: Allocation failure");
+      goto error;
+   }
+
+   if (get_key_iv(mode, key, iv))
+   {
+      goto error;
+   }
+
+   if (!(ctx = EVP_CIPHER_CTX_new()))
+   {
+      pgmoneta_log_error("EVP_CIPHER_CTX_new: Failed to create context");
+      goto error;
+   }
+
+   if (EVP_CipherInit_ex(ctx, cipher_fp(), NULL, key, iv, enc) == 0)
+   {
+      pgmoneta_log_error("EVP_CipherInit_ex: Failed to initialize cipher context");
+      goto error;
+   }
+
+   if (EVP_CipherUpdate(ctx, *res_buffer, (int*)&outl, origin_buffer, origin_size) == 0)
+   {
+      pgmoneta_log_error("EVP_CipherUpdate: Failed to process data");
+      goto error;
+   }
+
+   *res_size = outl;
+
+   if (EVP_CipherFinal_ex(ctx, *res_buffer + outl, (int*)&f_len) == 0)
+   {
+      pgmoneta_log_error("EVP_CipherFinal_ex: Failed to finalize operation");
+      goto error;
+   }
+
+   *res_size += f_len;
+
+   if (enc == 0)
+   {
+      (*res_buffer)[*res_size] = '\0';
+   }
+
+   EVP_CIPHER_CTX_free(ctx);
+
+   return 0;
+
+error:
+   if (ctx)
+   {
+      EVP_CIPHER_CTX_free(ctx);
+   }
+
+   return 1;
+}
+
+static const EVP_CIPHER* (*get_cipher_buffer(int mode))(void)
+{
+   if (mode == ENCRYPTION_AES_256_CBC)
+   {
+      return &EVP_aes_256_cbc;
+   }
+   if (mode == ENCRYPTION_AES_192_CBC)
+   {
+      return &EVP_aes_192_cbc;
+   }
+   if (mode == ENCRYPTION_AES_128_CBC)
+   {
+      return &EVP_aes_128_cbc;
+   }
+   return &EVP_aes_256_cbc;
+}
+
+static int
+gcm_open(char* from, char* to, bool enc, int mode, struct gcm_file* f)
+{
+   struct stat st;
+   bool created;
+
+   f->in = -1;
+   f->out = -1;
+   f->enc = enc;
+   snprintf(f->from, sizeof(f->from), "%s", from);
+   snprintf(f->to, sizeof(f->to), "%s", to);
+
+   f->in = open(from, O_RDONLY);
+   if (f->in == -1 || fstat(f->in, &st) != 0)
+   {
+      pgmoneta_log_error("AES: Could not open %s", from);
+      goto error;
+   }
+
+   f->size = (uint64_t)st.st_size;
+
+   if (enc)
+   {
+      // the header is: magic, mode, 3 reserved bytes, chunk size, salt and nonce
+      memset(f->header, 0, AES_GCM_HEADER_SIZE);
+      memcpy(f->header, AES_GCM_MAGIC, sizeof(AES_GCM_MAGIC) - 1);
+      f->header[8] = (unsigned char)mode;
+      put_be32(f->header + 12, AES_GCM_CHUNK_SIZE);
+
+      // one salt, and so one derived key, for everything the backup encrypts
+      pthread_mutex_lock(&gcm_lock);
+      if (!gcm_salt_ready)
+      {
+         if (RAND_bytes(gcm_salt, AES_GCM_SALT_SIZE) != 1)
+         {
+            pthread_mutex_unlock(&gcm_lock);
+            goto error;
+         }
+         gcm_salt_ready = true;
+      }
+      memcpy(f->header + 16, gcm_salt, AES_GCM_SALT_SIZE);
+      pthread_mutex_unlock(&gcm_lock);
+
+      if (RAND_bytes(f->header + 16 + AES_GCM_SALT_SIZE, AES_GCM_NONCE_SIZE) != 1)
+      {
+         goto error;
+      }
+
+      f->mode = mode;
+      f->chunk_size = AES_GCM_CHUNK_SIZE;
+   }
+   else if (gcm_read_header(f->in, f->header, &f->mode, &f->chunk_size))
+   {
+      pgmoneta_log_error("AES: Invalid header in %s", from);
+      goto error;
+   }
+
+   if (gcm_number_of_chunks(f) || gcm_get_key(f->mode, f->header + 16, f->key))
+   {
+      goto error;
+   }
+
+   f->out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (f->out == -1)
+   {
+      pgmoneta_log_error("AES: Could not open %s", to);
+      goto error;
+   }
+
+   if (enc && write_fully(f->out, f->header, AES_GCM_HEADER_SIZE, 0))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   created = f->out != -1;
+
+   gcm_close(f);
+
+   if (created)
+   {
+      pgmoneta_delete_file(to, NULL);
+   }
+
+   return 1;
+}
+
+static void
+gcm_close(struct gcm_file* f)
+{
+   if (f->in != -1)
+   {
+      close(f->in);
+      f->in = -1;
+   }
+
+   if (f->out != -1)
+   {
+      if (close(f->out) != 0)
+      {
+         f->failed = true;
+      }
+      f->out = -1;
+   }
+}
+
+static int
+gcm_read_header(int fd, unsigned char* header, int* mode, uint32_t* chunk_size)
+{
+   if (read_fully(fd, header, AES_GCM_HEADER_SIZE, 0))
+   {
+      return 1;
+   }
+
+   if (memcmp(header, AES_GCM_MAGIC, sizeof(AES_GCM_MAGIC) - 1) != 0 || !pgmoneta_is_gcm_mode(header[8]))
+   {
+      return 1;
+   }
+
+   *mode = header[8];
+   *chunk_size = get_be32(header + 12);
+
+   if (*chunk_size == 0 || *chunk_size > 64 * AES_GCM_CHUNK_SIZE)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+gcm_number_of_chunks(struct gcm_file* f)
+{
+   uint64_t stored = (uint64_t)f->chunk_size + AES_GCM_TAG_SIZE;
+   uint64_t body;
+
+   if (f->enc)
+   {
+      // an empty file still has one chunk, so its tag authenticates the header
+      f->number_of_chunks = f->size == 0 ? 1 : (f->size + f->chunk_size - 1) / f->chunk_size;
+   }
+   else
+   {
+      if (f->size < AES_GCM_HEADER_SIZE + AES_GCM_TAG_SIZE)
+      {
+         return 1;
+      }
+
+      body = f->size - AES_GCM_HEADER_SIZE;
+      f->number_of_chunks = (body + stored - 1) / stored;
+
+      if (body - (f->number_of_chunks - 1) * stored < AES_GCM_TAG_SIZE)
+      {
+         return 1;
+      }
+   }
+
+   // the chunk number is 32 bits of the iv
+   if (f->number_of_chunks > UINT32_MAX)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+gcm_get_key(int mode, unsigned char* salt, unsigned char* key)
+{
+   struct gcm_key* k = NULL;
+
+   pthread_mutex_lock(&gcm_lock);
+
+   for (int i = 0; i < AES_GCM_KEYS; i++)
+   {
+      if (gcm_keys[i].valid && gcm_keys[i].mode == mode &&
+          memcmp(gcm_keys[i].salt, salt, AES_GCM_SALT_SIZE) == 0)
+      {
+         memcpy(key, gcm_keys[i].key, EVP_MAX_KEY_LENGTH);
+         pthread_mutex_unlock(&gcm_lock);
+         return 0;
+      }
+   }
+
+   if (load_master_key())
+   {
+      goto error;
+   }
+
+   k = &gcm_keys[gcm_next_key];
+   gcm_next_key = (gcm_next_key + 1) % AES_GCM_KEYS;
+
+   memset(k, 0, sizeof(struct gcm_key));
+
+   if (gcm_derive(gcm_master_key, mode, salt, k->key))
+   {
+      pgmoneta_log_error("AES: Failed to derive key");
+      goto error;
+   }
+
+   k->valid = true;
+   k->mode = mode;
+   memcpy(k->salt, salt, AES_GCM_SALT_SIZE);
+   memcpy(key, k->key, EVP_MAX_KEY_LENGTH);
+
+   pthread_mutex_unlock(&gcm_lock);
+
+   return 0;
+
+error:
+
+   pthread_mutex_unlock(&gcm_lock);
+
+   return 1;
+}
+
+static int
+gcm_derive(char* master_key, int mode, unsigned char* salt, unsigned char* key)
+{
+   char info[32];
+
+   // the mode is part of the info, so the key sizes never share a prefix
+   snprintf(info, sizeof(info), "pgmoneta aes-gcm %d", mode);
+
+   return hkdf(master_key, salt, AES_GCM_SALT_SIZE, info, key, (size_t)gcm_key_length(mode));
+}
+
+static int
+hkdf(char* master_key, unsigned char* salt, size_t salt_length, char* info, unsigned char* key, size_t length)
+{
+   EVP_PKEY_CTX* ctx = NULL;
+
+   ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+   if (ctx == NULL)
+   {
+      goto error;
+   }
+
+   if (EVP_PKEY_derive_init(ctx) <= 0 ||
+       EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) <= 0 ||
+       (salt != NULL && EVP_PKEY_CTX_set1_hkdf_salt(ctx, salt, salt_length) <= 0) ||
+       EVP_PKEY_CTX_set1_hkdf_key(ctx, (unsigned char*)master_key, strlen(master_key)) <= 0 ||
+       EVP_PKEY_CTX_add1_hkdf_info(ctx, (unsigned char*)info, strlen(info)) <= 0 ||
+       EVP_PKEY_derive(ctx, key, &length) <= 0)
+   {
+      goto error;
+   }
+
+   EVP_PKEY_CTX_free(ctx);
+
+   return 0;
+
+error:
+
+   if (ctx != NULL)
+   {
+      EVP_PKEY_CTX_free(ctx);
+   }
+
+   return 1;
+}
+
+static int
+gcm_key_length(int mode)
+{
+   if (mode == ENCRYPTION_AES_192_GCM)
+   {
+      return 24;
+   }
+   if (mode == ENCRYPTION_AES_128_GCM)
+   {
+      return 16;
+   }
+   return 32;
+}
+
+static const EVP_CIPHER*
+gcm_cipher(int mode)
+{
+   if (mode == ENCRYPTION_AES_192_GCM)
+   {
+      return EVP_aes_192_gcm();
+   }
+   if (mode == ENCRYPTION_AES_128_GCM)
+   {
+      return EVP_aes_128_gcm();
+   }
+   return EVP_aes_256_gcm();
+}
+
+static int
+gcm_process(struct gcm_file* f, uint64_t chunk, unsigned char* input, unsigned char* output, uint64_t* offset, size_t* size)
+{
+   uint64_t stored = (uint64_t)f->chunk_size + AES_GCM_TAG_SIZE;
+   uint64_t in_offset;
+   size_t in_size;
+
+   // every chunk has a fixed place in both files, so they can be done in any order
+   if (f->enc)
+   {
+      in_offset = chunk * f->chunk_size;
+      in_size = (size_t)MIN((uint64_t)f->chunk_size, f->size - in_offset);
+      *offset = AES_GCM_HEADER_SIZE + chunk * stored;
+      *size = in_size + AES_GCM_TAG_SIZE;
+   }
+   else
+   {
+      in_offset = AES_GCM_HEADER_SIZE + chunk * stored;
+      in_size = (size_t)MIN(stored, f->size - in_offset);
+      *offset = chunk * f->chunk_size;
+      *size = in_size - AES_GCM_TAG_SIZE;
+   }
+
+   if (read_fully(f->in, input, in_size, in_offset))
+   {
+      return 1;
+   }
+
+   return gcm_crypt(f, chunk, input, in_size, output);
+}
+
+static int
+gcm_crypt(struct gcm_file* f, uint64_t chunk, unsigned char* in, size_t in_size, unsigned char* out)
+{
+   unsigned char iv[AES_GCM_IV_SIZE];
+   unsigned char aad[AES_GCM_HEADER_SIZE + 5];
+   size_t size;
+   int length = 0;
+   EVP_CIPHER_CTX* ctx = NULL;
+
+   if (!f->enc && in_size < AES_GCM_TAG_SIZE)
+   {
+      return 1;
+   }
+
+   size = f->enc ? in_size : in_size - AES_GCM_TAG_SIZE;
+
+   memcpy(iv, f->header + 16 + AES_GCM_SALT_SIZE, AES_GCM_NONCE_SIZE);
+   put_be32(iv + AES_GCM_NONCE_SIZE, (uint32_t)chunk);
+
+   // the header, the chunk number and the last flag are authenticated,
+   // so chunks can not be moved, dropped or cut off at the end
+   memcpy(aad, f->header, AES_GCM_HEADER_SIZE);
+   put_be32(aad + AES_GCM_HEADER_SIZE, (uint32_t)chunk);
+   aad[AES_GCM_HEADER_SIZE + 4] = chunk == f->number_of_chunks - 1 ? 1 : 0;
+
+   if (!(ctx = EVP_CIPHER_CTX_new()))
+   {
+      goto error;
+   }
+
+   if (EVP_CipherInit_ex(ctx, gcm_cipher(f->mode), NULL, NULL, NULL, f->enc) != 1 ||
+       EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AES_GCM_IV_SIZE, NULL) != 1 ||
+       EVP_CipherInit_ex(ctx, NULL, NULL, f->key, iv, f->enc) != 1 ||
+       EVP_CipherUpdate(ctx, NULL, &length, aad, sizeof(aad)) != 1)
+   {
+      goto error;
+   }
+
+   if (size > 0 && EVP_CipherUpdate(ctx, out, &length, in, (int)size) != 1)
+   {
+      goto error;
+   }
+
+   if (!f->enc && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, AES_GCM_TAG_SIZE, in + size) != 1)
+   {
+      goto error;
+   }
+
+   if (EVP_CipherFinal_ex(ctx, out + size, &length) != 1)
+   {
+      pgmoneta_log_error("AES: Chunk %" PRIu64 " of %s failed authentication", chunk, f->from);
+      goto error;
+   }
+
+   if (f->enc && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, AES_GCM_TAG_SIZE, out + size) != 1)
+   {
+      goto error;
+   }
+
+   EVP_CIPHER_CTX_free(ctx);
+
+   return 0;
+
+error:
+
+   if (ctx != NULL)
+   {
+      EVP_CIPHER_CTX_free(ctx);
+   }
+
+   return 1;
+}
+
+static int
+gcm_file(char* from, char* to, bool enc)
+{
+   struct gcm_file f;
+   unsigned char* input = NULL;
+   unsigned char* output = NULL;
+   uint64_t offset;
+   size_t size;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(&f, 0, sizeof(struct gcm_file));
+
+   if (gcm_open(from, to, enc, config->encryption, &f))
+   {
+      return 1;
+   }
+
+   input = (unsigned char*)malloc(f.chunk_size + AES_GCM_TAG_SIZE);
+   output = (unsigned char*)malloc(f.chunk_size + AES_GCM_TAG_SIZE);
+   if (input == NULL || output == NULL)
+   {
+      goto error;
+   }
+
+   for (uint64_t i = 0; i < f.number_of_chunks; i++)
+   {
+      if (gcm_process(&f, i, input, output, &offset, &size) ||
+          write_fully(f.out, output, size, offset))
+      {
+         goto error;
+      }
+   }
+
+   gcm_close(&f);
+
+   if (f.failed)
+   {
+      goto error;
+   }
+
+   free(input);
+   free(output);
+
+   return 0;
+
+error:
+
+   gcm_close(&f);
+   pgmoneta_delete_file(to, NULL);
+
+   free(input);
+   free(output);
+
+   return 1;
+}
+
+static int
+gcm_parallel(char* from, char* to, bool enc, struct workers* workers)
+{
+   struct gcm_file* f = NULL;
+   struct gcm_chunk* c = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (enc ? !pgmoneta_is_gcm_mode(config->encryption) : !pgmoneta_is_gcm_file(from))
+   {
+      return 1;
+   }
+
+   if (pgmoneta_get_file_size(from) <= (size_t)AES_GCM_PARALLEL_CHUNKS * AES_GCM_CHUNK_SIZE)
+   {
+      return 1;
+   }
+
+   f = (struct gcm_file*)malloc(sizeof(struct gcm_file));
+   if (f == NULL)
+   {
+      return 1;
+   }
+
+   memset(f, 0, sizeof(struct gcm_file));
+
+   if (gcm_open(from, to, enc, config->encryption, f))
+   {
+      free(f);
+      return 1;
+   }
+
+   pthread_mutex_init(&f->lock, NULL);
+   f->remaining = f->number_of_chunks;
+   f->workers = workers;
+
+   for (uint64_t i = 0; i < f->number_of_chunks; i++)
+   {
+      c = (struct gcm_chunk*)malloc(sizeof(struct gcm_chunk));
+      if (c != NULL)
+      {
+         memset(c, 0, sizeof(struct gcm_chunk));
+         c->common.workers = workers;
+         c->file = f;
+         c->chunk = i;
+      }
+
+      if (c == NULL || pgmoneta_workers_add(workers, do_gcm_chunk, (struct worker_common*)c))
+      {
+         free(c);
+
+         workers->outcome = false;
+
+         // the chunks that were not queued count as failed, so the last one cleans up
+         pthread_mutex_lock(&f->lock);
+         f->failed = true;
+         f->remaining -= f->number_of_chunks - i - 1;
+         pthread_mutex_unlock(&f->lock);
+
+         gcm_chunk_done(f, false);
+         break;
+      }
+   }
+
+   return 0;
+}
+
+static void
+do_gcm_chunk(struct worker_common* wc)
+{
+   struct gcm_chunk* c = (struct gcm_chunk*)wc;
+   struct gcm_file* f = c->file;
+   unsigned char* input = NULL;
+   unsigned char* output = NULL;
+   uint64_t offset;
+   size_t size;
+   bool ok = false;
+
+   input = (unsigned char*)malloc(f->chunk_size + AES_GCM_TAG_SIZE);
+   output = (unsigned char*)malloc(f->chunk_size + AES_GCM_TAG_SIZE);
+
+   if (input != NULL && output != NULL &&
+       !gcm_process(f, c->chunk, input, output, &offset, &size) &&
+       !write_fully(f->out, output, size, offset))
+   {
+      ok = true;
+   }
+
+   free(input);
+   free(output);
+
+   gcm_chunk_done(f, ok);
+
+   free(c);
+}
+
+static void
+gcm_chunk_done(struct gcm_file* f, bool ok)
+{
+   bool last;
+
+   pthread_mutex_lock(&f->lock);
+
+   if (!ok)
+   {
+      f->failed = true;
+   }
+
+   f->remaining--;
+   last = f->remaining == 0;
+
+   pthread_mutex_unlock(&f->lock);
+
+   if (last)
+   {
+      gcm_file_finish(f);
+   }
+}
+
+static void
+gcm_file_finish(struct gcm_file* f)
+{
+   gcm_close(f);
+
+   if (f->failed)
+   {
+      pgmoneta_log_error("AES: Could not %s %s", f->enc ? "encrypt" : "decrypt", f->from);
+      pgmoneta_delete_file(f->to, NULL);
+
+      if (f->workers != NULL)
+      {
+         f->workers->outcome = false;
+      }
+   }
+   else
+   {
+      pgmoneta_delete_file(f->from, NULL);
+   }
+
+   pthread_mutex_destroy(&f->lock);
+   free(f);
+}
+
+static int
+read_fully(int fd, void* buffer, size_t size, uint64_t offset)
+{
+   size_t done = 0;
+   ssize_t n;
+
+   while (done < size)
+   {
+      n = pread(fd, (char*)buffer + done, size - done, (off_t)(offset + done));
+      if (n <= 0)
+      {
+         return 1;
+      }
+      done += (size_t)n;
+   }
+
+   return 0;
+}
+
+static int
+write_fully(int fd, void* buffer, size_t size, uint64_t offset)
+{
+   size_t done = 0;
+   ssize_t n;
+
+   while (done < size)
+   {
+      n = pwrite(fd, (char*)buffer + done, size - done, (off_t)(offset + done));
+      if (n <= 0)
+      {
+         return 1;
+      }
+      done += (size_t)n;
+   }
+
+   return 0;
+}
+
+static void
+put_be32(unsigned char* p, uint32_t value)
+{
+   p[0] = (unsigned char)(value >> 24);
+   p[1] = (unsigned char)(value >> 16);
+   p[2] = (unsigned char)(value >> 8);
+   p[3] = (unsigned char)value;
+}
+
+static uint32_t
+get_be32(unsigned char* p)
+{
+   return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
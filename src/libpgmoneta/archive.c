@@ -29,6 +29,7 @@
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <achv.h>
+#include <async_io.h>
 #include <gzip_compression.h>
 #include <logging.h>
 #include <lz4_compression.h>
@@ -36,6 +37,8 @@
 #include <manifest.h>
 #include <network.h>
 #include <restore.h>
+#include <resume.h>
+#include <ring.h>
 #include <security.h>
 #include <utils.h>
 #include <workflow.h>
@@ -44,15 +47,34 @@
 #include <archive.h>
 #include <archive_entry.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define NAME "archive"
 
 static bool is_server_side_compression(void);
 
 static void write_tar_file(struct archive* a, char* src, char* dst);
+static int finish_archive(int server, struct ring_writer** ring, struct tar_stream** stream, FILE** file, char* file_path, char* directory);
+static int finish_ring(int server, struct ring_writer** ring);
+static int tar_stream_sink(void* data, void* buffer, size_t size);
+static int file_sink(void* data, void* buffer, size_t size);
+
+static int tar_stream_header(struct tar_stream* stream);
+static int tar_stream_entry_done(struct tar_stream* stream);
+static int tar_stream_open_file(struct tar_stream* stream, mode_t mode);
+static int tar_stream_content(struct tar_stream* stream, char* data, size_t size);
+static int tar_stream_block(struct tar_stream* stream, char* data);
+static void tar_stream_written(struct async_file* file, ssize_t result, void* data);
+static void tar_stream_extended(struct tar_stream* stream);
+static bool tar_valid_path(char* path);
+static bool tar_valid_location(struct tar_stream* stream);
+static uint64_t tar_number(char* field, size_t length);
 
 void
 pgmoneta_archive(SSL* ssl, int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload)
@@ -377,12 +399,179 @@ error:
 }
 
 int
-pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket)
+pgmoneta_tar_stream_create(char* directory, struct tar_stream** stream)
+{
+   struct tar_stream* s = NULL;
+
+   *stream = NULL;
+
+   s = (struct tar_stream*)malloc(sizeof(struct tar_stream));
+   if (s == NULL)
+   {
+      goto error;
+   }
+
+   memset(s, 0, sizeof(struct tar_stream));
+
+   if (pgmoneta_ends_with(directory, "/"))
+   {
+      snprintf(s->directory, sizeof(s->directory), "%s", directory);
+   }
+   else
+   {
+      snprintf(s->directory, sizeof(s->directory), "%s/", directory);
+   }
+
+   if (pgmoneta_async_io_create(ASYNC_IO_DEPTH, ASYNC_IO_BUFFER_SIZE, &s->io))
+   {
+      goto error;
+   }
+
+   *stream = s;
+
+   return 0;
+
+error:
+
+   free(s);
+
+   return 1;
+}
+
+void
+pgmoneta_tar_stream_journal(struct tar_stream* stream, FILE* journal, char* journal_prefix, char* local_prefix)
+{
+   stream->journal = journal;
+   snprintf(stream->journal_prefix, sizeof(stream->journal_prefix), "%s", journal_prefix);
+   snprintf(stream->local_prefix, sizeof(stream->local_prefix), "%s", local_prefix);
+}
+
+int
+pgmoneta_tar_stream_write(struct tar_stream* stream, void* data, size_t size)
+{
+   char* p = (char*)data;
+   size_t n = 0;
+
+   while (size > 0 && !stream->end)
+   {
+      if (stream->remaining > 0)
+      {
+         n = MIN(size, stream->remaining);
+
+         if (stream->file != NULL)
+         {
+            if (tar_stream_content(stream, p, n))
+            {
+               pgmoneta_log_error("Tar stream: Could not write to %s", stream->path);
+               goto error;
+            }
+         }
+         else if (stream->extended != NULL)
+         {
+            memcpy(stream->extended + stream->extended_size, p, n);
+            stream->extended_size += n;
+         }
+
+         stream->remaining -= n;
+
+         if (stream->remaining == 0)
+         {
+            if (tar_stream_entry_done(stream))
+            {
+               goto error;
+            }
+         }
+      }
+      else if (stream->padding > 0)
+      {
+         n = MIN(size, stream->padding);
+         stream->padding -= n;
+      }
+      else
+      {
+         n = MIN(size, TAR_BLOCK_SIZE - stream->header_size);
+         memcpy(stream->header + stream->header_size, p, n);
+         stream->header_size += n;
+
+         if (stream->header_size == TAR_BLOCK_SIZE)
+         {
+            stream->header_size = 0;
+
+            if (tar_stream_header(stream))
+            {
+               goto error;
+            }
+         }
+      }
+
+      p += n;
+      size -= n;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgmoneta_tar_stream_finish(struct tar_stream* stream)
+{
+   bool truncated = false;
+
+   if (stream == NULL)
+   {
+      return 0;
+   }
+
+   truncated = stream->remaining > 0 || stream->header_size > 0;
+
+   if (stream->file != NULL)
+   {
+      if (pgmoneta_async_io_close(stream->file))
+      {
+         truncated = true;
+      }
+      stream->file = NULL;
+   }
+
+   free(stream->extended);
+   stream->extended = NULL;
+
+   if (truncated)
+   {
+      pgmoneta_log_error("Tar stream: Archive truncated at %s", stream->path);
+      return 1;
+   }
+
+   if (stream->holes > 0)
+   {
+      pgmoneta_log_debug("Tar stream: %" PRIu64 " zero bytes left as holes in %s", stream->holes, stream->directory);
+   }
+
+   return 0;
+}
+
+void
+pgmoneta_tar_stream_destroy(struct tar_stream* stream)
+{
+   if (stream != NULL)
+   {
+      pgmoneta_async_io_close(stream->file);
+      pgmoneta_async_io_destroy(stream->io);
+      free(stream->extended);
+      free(stream);
+   }
+}
+
+int
+pgmoneta_receive_archive_files(int server, SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket)
 {
    char directory[MAX_PATH];
    char link_path[MAX_PATH];
-   char null_buffer[2 * 512]; // 2 tar block size of terminator null bytes
-   FILE* file = NULL;
+   struct tar_stream* stream = NULL;
+   struct ring_writer* ring = NULL;
    struct query_response* response = NULL;
    struct message* msg = (struct message*)malloc(sizeof (struct message));
    struct tuple* tup = NULL;
@@ -397,21 +586,17 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
    tup = response->tuples;
    while (tup != NULL)
    {
-      char file_path[MAX_PATH];
       char directory[MAX_PATH];
-      memset(file_path, 0, sizeof(file_path));
       memset(directory, 0, sizeof(directory));
       if (tup->data[1] == NULL)
       {
          // main data directory
          if (pgmoneta_ends_with(basedir, "/"))
          {
-            snprintf(file_path, sizeof(file_path), "%sdata/%s", basedir, "base.tar");
             snprintf(directory, sizeof(directory), "%sdata/", basedir);
          }
          else
          {
-            snprintf(file_path, sizeof(file_path), "%s/data/%s", basedir, "base.tar");
             snprintf(directory, sizeof(directory), "%s/data/", basedir);
          }
       }
@@ -430,20 +615,25 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
          }
          if (pgmoneta_ends_with(basedir, "/"))
          {
-            snprintf(file_path, sizeof(file_path), "%stblspc_%s/%s.tar", basedir, tblspc->name, tblspc->name);
             snprintf(directory, sizeof(directory), "%stblspc_%s/", basedir, tblspc->name);
          }
          else
          {
-            snprintf(file_path, sizeof(file_path), "%s/tblspc_%s/%s.tar", basedir, tblspc->name, tblspc->name);
             snprintf(directory, sizeof(directory), "%s/tblspc_%s/", basedir, tblspc->name);
          }
       }
       pgmoneta_mkdir(directory);
-      file = fopen(file_path, "wb");
-      if (file == NULL)
+
+      // the tar archive is extracted while it is received
+      if (pgmoneta_tar_stream_create(directory, &stream))
       {
-         pgmoneta_log_error("Could not create archive tar file");
+         pgmoneta_log_error("Could not create tar stream for %s", directory);
+         goto error;
+      }
+      // the archive is written by its own thread so disk stalls don't block the socket
+      if (pgmoneta_ring_writer_create(RING_SLOT_SIZE, RING_SLOTS, tar_stream_sink, stream, &ring))
+      {
+         pgmoneta_log_error("Could not create writer for %s", directory);
          goto error;
       }
       // get the copy out response
@@ -454,8 +644,6 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
          {
             pgmoneta_log_copyfail_message(msg);
             pgmoneta_log_error_response_message(msg);
-            fflush(file);
-            fclose(file);
             goto error;
          }
          pgmoneta_consume_copy_stream_end(buffer, msg);
@@ -467,8 +655,6 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
          {
             pgmoneta_log_copyfail_message(msg);
             pgmoneta_log_error_response_message(msg);
-            fflush(file);
-            fclose(file);
             goto error;
          }
 
@@ -490,35 +676,30 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
                }
             }
 
-            // copy data
-            if (fwrite(msg->data, msg->length, 1, file) != 1)
+            // extract data
+            if (pgmoneta_ring_writer_write(ring, msg->data, msg->length))
             {
-               pgmoneta_log_error("could not write to file %s", file_path);
-               fflush(file);
-               fclose(file);
+               pgmoneta_log_error("could not extract archive into %s", directory);
                goto error;
             }
          }
          pgmoneta_consume_copy_stream_end(buffer, msg);
       }
-      //append two blocks of null bytes to the end of the tar file
-      memset(null_buffer, 0, 2 * 512);
-      if (fwrite(null_buffer, 2 * 512, 1, file) != 1)
+
+      if (finish_ring(server, &ring))
       {
-         pgmoneta_log_error("could not write to file %s", file_path);
-         fflush(file);
-         fclose(file);
+         pgmoneta_log_error("could not extract archive into %s", directory);
          goto error;
       }
-      fflush(file);
-      fclose(file);
-
-      // extract the file
-      pgmoneta_extract_tar_file(file_path, directory);
-      remove(file_path);
-      pgmoneta_free_message(msg);
+      if (pgmoneta_tar_stream_finish(stream))
+      {
+         goto error;
+      }
+      pgmoneta_tar_stream_destroy(stream);
+      stream = NULL;
 
-      msg = NULL;
+      // reuse the message for the next tablespace
+      memset(msg, 0, sizeof(struct message));
       tup = tup->next;
    }
 
@@ -577,19 +758,20 @@ error:
    {
       pgmoneta_disconnect(socket);
    }
+   pgmoneta_ring_writer_destroy(ring);
+   pgmoneta_tar_stream_destroy(stream);
    pgmoneta_free_query_response(response);
    pgmoneta_free_message(msg);
    return 1;
 }
 
 int
-pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket)
+pgmoneta_receive_archive_stream(int server, SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket)
 {
    struct query_response* response = NULL;
    struct message* msg = (struct message*)malloc(sizeof (struct message));
    struct tuple* tup = NULL;
    struct tablespace* tblspc = NULL;
-   char null_buffer[2 * 512];
    char file_path[MAX_PATH];
    char directory[MAX_PATH];
    char link_path[MAX_PATH];
@@ -600,15 +782,23 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
    memset(link_path, 0, sizeof(link_path));
    memset(manifest_file_path, 0, sizeof(manifest_file_path));
    memset(tmp_manifest_file_path, 0, sizeof(tmp_manifest_file_path));
-   memset(null_buffer, 0, 2 * 512);
    char type;
    FILE* file = NULL;
+   struct tar_stream* stream = NULL;
+   struct ring_writer* ring = NULL;
+   FILE* journal = NULL;
 
    if (msg == NULL)
    {
       goto error;
    }
 
+   // a backup that can be resumed records every file it has fully received
+   if (pgmoneta_resume_journal_open(basedir, &journal))
+   {
+      goto error;
+   }
+
    memset(msg, 0, sizeof(struct message));
 
    // Receive the second result set
@@ -645,21 +835,9 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
             case 'n':
             {
                // append two blocks of null buffer and extract the tar file
-               if (file != NULL)
+               if (finish_archive(server, &ring, &stream, &file, file_path, directory))
                {
-                  if ((!is_server_side_compression()) && fwrite(null_buffer, 2 * 512, 1, file) != 1)
-                  {
-                     pgmoneta_log_error("could not write to file %s", file_path);
-                     fflush(file);
-                     fclose(file);
-                     file = NULL;
-                     goto error;
-                  }
-                  fflush(file);
-                  fclose(file);
-                  file = NULL;
-                  pgmoneta_extract_tar_file(file_path, directory);
-                  remove(file_path);
+                  goto error;
                }
                // new tablespace or main directory tar file
                char* archive_name = pgmoneta_read_string(msg->data + 1);
@@ -716,32 +894,60 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
                   }
                }
                pgmoneta_mkdir(directory);
-               file = fopen(file_path, "wb");
-               if (file == NULL)
+               if (is_server_side_compression())
                {
-                  pgmoneta_log_error("Could not create archive tar file");
-                  goto error;
+                  // compressed archives are spooled to disk and extracted once complete
+                  file = fopen(file_path, "wb");
+                  if (file == NULL)
+                  {
+                     pgmoneta_log_error("Could not create archive tar file");
+                     goto error;
+                  }
+                  if (pgmoneta_ring_writer_create(RING_SLOT_SIZE, RING_SLOTS, file_sink, file, &ring))
+                  {
+                     pgmoneta_log_error("Could not create writer for %s", file_path);
+                     goto error;
+                  }
+               }
+               else
+               {
+                  if (pgmoneta_tar_stream_create(directory, &stream))
+                  {
+                     pgmoneta_log_error("Could not create tar stream for %s", directory);
+                     goto error;
+                  }
+                  if (journal != NULL)
+                  {
+                     char journal_prefix[MAX_PATH];
+                     char local_prefix[MAX_PATH];
+
+                     if (tup->data[1] == NULL)
+                     {
+                        snprintf(journal_prefix, sizeof(journal_prefix), "%s", "");
+                        snprintf(local_prefix, sizeof(local_prefix), "%s", "data/");
+                     }
+                     else
+                     {
+                        snprintf(journal_prefix, sizeof(journal_prefix), "pg_tblspc/%d/", tblspc->oid);
+                        snprintf(local_prefix, sizeof(local_prefix), "tblspc_%s/", tblspc->name);
+                     }
+                     pgmoneta_tar_stream_journal(stream, journal, journal_prefix, local_prefix);
+                  }
+                  // the archive is written by its own thread so disk stalls don't block the socket
+                  if (pgmoneta_ring_writer_create(RING_SLOT_SIZE, RING_SLOTS, tar_stream_sink, stream, &ring))
+                  {
+                     pgmoneta_log_error("Could not create writer for %s", directory);
+                     goto error;
+                  }
                }
                break;
             }
             case 'm':
             {
                // start of manifest, finish off previous data archive receiving
-               if (file != NULL)
+               if (finish_archive(server, &ring, &stream, &file, file_path, directory))
                {
-                  if ((!is_server_side_compression()) && fwrite(null_buffer, 2 * 512, 1, file) != 1)
-                  {
-                     pgmoneta_log_error("could not write to file %s", file_path);
-                     fflush(file);
-                     fclose(file);
-                     file = NULL;
-                     goto error;
-                  }
-                  fflush(file);
-                  fclose(file);
-                  file = NULL;
-                  pgmoneta_extract_tar_file(file_path, directory);
-                  remove(file_path);
+                  goto error;
                }
                if (pgmoneta_ends_with(basedir, "/"))
                {
@@ -779,7 +985,15 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
                   }
                }
 
-               if (fwrite(msg->data + 1, msg->length - 1, 1, file) != 1)
+               if (ring != NULL)
+               {
+                  if (pgmoneta_ring_writer_write(ring, msg->data + 1, msg->length - 1))
+                  {
+                     pgmoneta_log_error("could not extract archive into %s", directory);
+                     goto error;
+                  }
+               }
+               else if (fwrite(msg->data + 1, msg->length - 1, 1, file) != 1)
                {
                   pgmoneta_log_error("could not write to file %s", file_path);
                   goto error;
@@ -802,6 +1016,11 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
       pgmoneta_consume_copy_stream_end(buffer, msg);
    }
 
+   if (ring != NULL && finish_archive(server, &ring, &stream, &file, file_path, directory))
+   {
+      goto error;
+   }
+
    if (file != NULL)
    {
       if (rename(tmp_manifest_file_path, manifest_file_path) != 0)
@@ -853,6 +1072,10 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
       goto error;
    }
 
+   if (journal != NULL)
+   {
+      fclose(journal);
+   }
    pgmoneta_free_query_response(response);
    pgmoneta_free_message(msg);
    return 0;
@@ -863,16 +1086,100 @@ error:
    {
       pgmoneta_disconnect(socket);
    }
+   pgmoneta_ring_writer_destroy(ring);
    if (file != NULL)
    {
       fflush(file);
       fclose(file);
    }
+   pgmoneta_tar_stream_destroy(stream);
+   if (journal != NULL)
+   {
+      fclose(journal);
+   }
    pgmoneta_free_query_response(response);
    pgmoneta_free_message(msg);
    return 1;
 }
 
+static int
+finish_archive(int server, struct ring_writer** ring, struct tar_stream** stream, FILE** file, char* file_path, char* directory)
+{
+   if (finish_ring(server, ring))
+   {
+      pgmoneta_log_error("could not write archive into %s", directory);
+      pgmoneta_tar_stream_destroy(*stream);
+      *stream = NULL;
+      if (*file != NULL)
+      {
+         fclose(*file);
+         *file = NULL;
+      }
+      return 1;
+   }
+
+   if (*stream != NULL)
+   {
+      if (pgmoneta_tar_stream_finish(*stream))
+      {
+         pgmoneta_log_error("could not extract archive into %s", directory);
+         pgmoneta_tar_stream_destroy(*stream);
+         *stream = NULL;
+         return 1;
+      }
+
+      pgmoneta_tar_stream_destroy(*stream);
+      *stream = NULL;
+   }
+   else if (*file != NULL)
+   {
+      fflush(*file);
+      fclose(*file);
+      *file = NULL;
+
+      pgmoneta_extract_tar_file(file_path, directory);
+      remove(file_path);
+   }
+
+   return 0;
+}
+
+static int
+finish_ring(int server, struct ring_writer** ring)
+{
+   int ret = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (*ring == NULL)
+   {
+      return 0;
+   }
+
+   ret = pgmoneta_ring_writer_finish(*ring);
+
+   atomic_fetch_add(&config->common.servers[server].backup_network_stalls, (*ring)->consumer_stalls);
+   atomic_fetch_add(&config->common.servers[server].backup_disk_stalls, (*ring)->producer_stalls);
+
+   pgmoneta_ring_writer_destroy(*ring);
+   *ring = NULL;
+
+   return ret;
+}
+
+static int
+tar_stream_sink(void* data, void* buffer, size_t size)
+{
+   return pgmoneta_tar_stream_write((struct tar_stream*)data, buffer, size);
+}
+
+static int
+file_sink(void* data, void* buffer, size_t size)
+{
+   return fwrite(buffer, 1, size, (FILE*)data) != size ? 1 : 0;
+}
+
 static void
 write_tar_file(struct archive* a, char* src, char* dst)
 {
@@ -974,3 +1281,438 @@ is_server_side_compression(void)
           config->compression_type == COMPRESSION_SERVER_LZ4 ||
           config->compression_type == COMPRESSION_SERVER_ZSTD;
 }
+
+static int
+tar_stream_header(struct tar_stream* stream)
+{
+   char* h = stream->header;
+   char name[MAX_PATH];
+   char link[MAX_PATH];
+   uint64_t size = 0;
+   unsigned int checksum = 0;
+   mode_t mode = 0;
+   bool zero = true;
+
+   for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+   {
+      if (h[i] != 0)
+      {
+         zero = false;
+         break;
+      }
+   }
+
+   if (zero)
+   {
+      /* End-of-archive marker, anything after it is padding */
+      stream->end = true;
+      return 0;
+   }
+
+   for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+   {
+      checksum += (i >= 148 && i < 156) ? ' ' : (unsigned char)h[i];
+   }
+
+   if (checksum != tar_number(h + 148, 8))
+   {
+      pgmoneta_log_error("Tar stream: Invalid header checksum after %s", stream->path);
+      goto error;
+   }
+
+   memset(name, 0, sizeof(name));
+   memset(link, 0, sizeof(link));
+
+   if (strlen(stream->next_path) > 0)
+   {
+      snprintf(name, sizeof(name), "%s", stream->next_path);
+   }
+   else if (h[345] != 0 && !strncmp(h + 257, "ustar", 5))
+   {
+      snprintf(name, sizeof(name), "%.155s/%.100s", h + 345, h);
+   }
+   else
+   {
+      snprintf(name, sizeof(name), "%.100s", h);
+   }
+
+   if (strlen(stream->next_link) > 0)
+   {
+      snprintf(link, sizeof(link), "%s", stream->next_link);
+   }
+   else
+   {
+      snprintf(link, sizeof(link), "%.100s", h + 157);
+   }
+
+   memset(stream->next_path, 0, sizeof(stream->next_path));
+   memset(stream->next_link, 0, sizeof(stream->next_link));
+
+   stream->type = h[156];
+   size = tar_number(h + 124, 12);
+   mode = (mode_t)tar_number(h + 100, 8) & 07777;
+
+   stream->remaining = size;
+   stream->size = size;
+   stream->mtime = (time_t)tar_number(h + 136, 12);
+   stream->padding = (TAR_BLOCK_SIZE - (size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+
+   switch (stream->type)
+   {
+      case 'x':
+      case 'L':
+      case 'K':
+         if (size >= MAX_PATH * 4)
+         {
+            pgmoneta_log_error("Tar stream: Extended header too large (%lu)", size);
+            goto error;
+         }
+         stream->extended = (char*)malloc(size + 1);
+         if (stream->extended == NULL)
+         {
+            goto error;
+         }
+         memset(stream->extended, 0, size + 1);
+         stream->extended_size = 0;
+         break;
+      case 'g':
+         /* Global extended header, nothing we need from it */
+         break;
+      case '0':
+      case '\0':
+      case '5':
+      case '2':
+         if (!tar_valid_path(name) || strlen(stream->directory) + strlen(name) >= sizeof(stream->path))
+         {
+            pgmoneta_log_error("Tar stream: Invalid entry path %s", name);
+            goto error;
+         }
+
+         memset(stream->path, 0, sizeof(stream->path));
+         memcpy(stream->path, stream->directory, strlen(stream->directory));
+         memcpy(stream->path + strlen(stream->directory), name, strlen(name));
+         snprintf(stream->link, sizeof(stream->link), "%s", link);
+
+         if (!tar_valid_location(stream))
+         {
+            pgmoneta_log_error("Tar stream: Entry %s is below a symlink", name);
+            goto error;
+         }
+
+         if (stream->type == '5')
+         {
+            if (pgmoneta_ends_with(stream->path, "/"))
+            {
+               stream->path[strlen(stream->path) - 1] = '\0';
+            }
+            if (mkdir(stream->path, mode) != 0 && errno != EEXIST && pgmoneta_mkdir(stream->path))
+            {
+               pgmoneta_log_error("Tar stream: Could not create directory %s (%s)", stream->path, strerror(errno));
+               errno = 0;
+               goto error;
+            }
+            errno = 0;
+         }
+         else if (stream->type == '2')
+         {
+            unlink(stream->path);
+            if (symlink(stream->link, stream->path) != 0)
+            {
+               pgmoneta_log_error("Tar stream: Could not create symlink %s (%s)", stream->path, strerror(errno));
+               errno = 0;
+               goto error;
+            }
+         }
+         else if (tar_stream_open_file(stream, mode))
+         {
+            goto error;
+         }
+         break;
+      default:
+         pgmoneta_log_debug("Tar stream: Skipping entry %s of type %c", name, stream->type);
+         break;
+   }
+
+   if (stream->remaining == 0)
+   {
+      return tar_stream_entry_done(stream);
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+tar_stream_entry_done(struct tar_stream* stream)
+{
+   if (stream->file != NULL)
+   {
+      if (stream->page_size > 0)
+      {
+         if (pgmoneta_async_io_write(stream->file, stream->page, stream->page_size))
+         {
+            pgmoneta_log_error("Tar stream: Could not write %s", stream->path);
+            pgmoneta_async_io_close(stream->file);
+            stream->file = NULL;
+            return 1;
+         }
+         stream->page_size = 0;
+      }
+
+      if (pgmoneta_async_io_close(stream->file))
+      {
+         pgmoneta_log_error("Tar stream: Could not write %s", stream->path);
+         stream->file = NULL;
+         return 1;
+      }
+      stream->file = NULL;
+
+      if (stream->journal != NULL)
+      {
+         char path[MAX_PATH * 2];
+         char local[MAX_PATH * 2];
+         char* name = stream->path + strlen(stream->directory);
+
+         snprintf(path, sizeof(path), "%s%s", stream->journal_prefix, name);
+         snprintf(local, sizeof(local), "%s%s", stream->local_prefix, name);
+
+         if (pgmoneta_resume_journal_add(stream->journal, path, local, stream->size, stream->mtime))
+         {
+            pgmoneta_log_warn("Tar stream: Could not record %s in the journal", path);
+            stream->journal = NULL;
+         }
+      }
+   }
+
+   if (stream->extended != NULL)
+   {
+      if (stream->type == 'L')
+      {
+         snprintf(stream->next_path, sizeof(stream->next_path), "%s", stream->extended);
+      }
+      else if (stream->type == 'K')
+      {
+         snprintf(stream->next_link, sizeof(stream->next_link), "%s", stream->extended);
+      }
+      else
+      {
+         tar_stream_extended(stream);
+      }
+
+      free(stream->extended);
+      stream->extended = NULL;
+      stream->extended_size = 0;
+   }
+
+   return 0;
+}
+
+static int
+tar_stream_open_file(struct tar_stream* stream, mode_t mode)
+{
+   int flags = O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW;
+   char* parent = NULL;
+
+   stream->page_size = 0;
+
+   if (pgmoneta_async_io_open(stream->io, stream->path, flags, mode, tar_stream_written, stream, &stream->file) && errno == ENOENT)
+   {
+      errno = 0;
+      parent = pgmoneta_append(parent, stream->path);
+      *strrchr(parent, '/') = '\0';
+      pgmoneta_mkdir(parent);
+      free(parent);
+
+      pgmoneta_async_io_open(stream->io, stream->path, flags, mode, tar_stream_written, stream, &stream->file);
+   }
+
+   if (stream->file == NULL)
+   {
+      pgmoneta_log_error("Tar stream: Could not create %s (%s)", stream->path, strerror(errno));
+      errno = 0;
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+tar_stream_content(struct tar_stream* stream, char* data, size_t size)
+{
+   size_t n = 0;
+
+   /* Entries start on a block boundary, so whole blocks line up with the pages of a relation */
+   while (size > 0)
+   {
+      if (stream->page_size > 0 || size < SPARSE_BLOCK_SIZE)
+      {
+         n = MIN(size, SPARSE_BLOCK_SIZE - stream->page_size);
+         memcpy(stream->page + stream->page_size, data, n);
+         stream->page_size += n;
+
+         if (stream->page_size == SPARSE_BLOCK_SIZE)
+         {
+            stream->page_size = 0;
+
+            if (tar_stream_block(stream, stream->page))
+            {
+               return 1;
+            }
+         }
+      }
+      else
+      {
+         n = SPARSE_BLOCK_SIZE;
+
+         if (tar_stream_block(stream, data))
+         {
+            return 1;
+         }
+      }
+
+      data += n;
+      size -= n;
+   }
+
+   return 0;
+}
+
+static int
+tar_stream_block(struct tar_stream* stream, char* data)
+{
+   if (pgmoneta_is_zero(data, SPARSE_BLOCK_SIZE))
+   {
+      stream->holes += SPARSE_BLOCK_SIZE;
+      return pgmoneta_async_io_skip(stream->file, SPARSE_BLOCK_SIZE);
+   }
+
+   return pgmoneta_async_io_write(stream->file, data, SPARSE_BLOCK_SIZE);
+}
+
+static void
+tar_stream_written(struct async_file* file __attribute__((unused)), ssize_t result, void* data)
+{
+   struct tar_stream* stream = (struct tar_stream*)data;
+
+   if (result > 0)
+   {
+      stream->bytes += result;
+   }
+}
+
+static void
+tar_stream_extended(struct tar_stream* stream)
+{
+   char* p = stream->extended;
+   char* end = stream->extended + stream->extended_size;
+   char* record = NULL;
+   char* value = NULL;
+   unsigned long length = 0;
+
+   /* Records are "<length> <key>=<value>\n" where length covers the whole record */
+   while (p < end)
+   {
+      length = strtoul(p, &record, 10);
+      if (length == 0 || record == p || *record != ' ' || p + length > end)
+      {
+         break;
+      }
+
+      record++;
+      value = memchr(record, '=', p + length - record);
+
+      if (value != NULL)
+      {
+         int vlength = (int)(p + length - 1 - (value + 1));
+
+         if (!strncmp(record, "path=", 5))
+         {
+            snprintf(stream->next_path, sizeof(stream->next_path), "%.*s", vlength, value + 1);
+         }
+         else if (!strncmp(record, "linkpath=", 9))
+         {
+            snprintf(stream->next_link, sizeof(stream->next_link), "%.*s", vlength, value + 1);
+         }
+      }
+
+      p += length;
+   }
+}
+
+static bool
+tar_valid_path(char* path)
+{
+   if (path[0] == '/' || pgmoneta_compare_string(path, "..") ||
+       pgmoneta_starts_with(path, "../") || pgmoneta_contains(path, "/../") ||
+       pgmoneta_ends_with(path, "/.."))
+   {
+      return false;
+   }
+
+   return true;
+}
+
+static bool
+tar_valid_location(struct tar_stream* stream)
+{
+   char path[MAX_PATH];
+   char* p = NULL;
+   struct stat st;
+
+   snprintf(path, sizeof(path), "%s", stream->path);
+
+   // symlink targets are kept as is, so an entry is never written through a symlink of an earlier one
+   p = path + strlen(stream->directory);
+   while ((p = strchr(p, '/')) != NULL)
+   {
+      *p = '\0';
+      if (lstat(path, &st) == 0 && S_ISLNK(st.st_mode))
+      {
+         return false;
+      }
+      *p = '/';
+      p++;
+   }
+
+   if (stream->type == '5' && lstat(path, &st) == 0 && S_ISLNK(st.st_mode))
+   {
+      return false;
+   }
+
+   return true;
+}
+
+static uint64_t
+tar_number(char* field, size_t length)
+{
+   uint64_t value = 0;
+
+   if ((unsigned char)field[0] & 0x80)
+   {
+      /* Base-256 encoding used for values that don't fit in octal */
+      value = (unsigned char)field[0] & 0x3F;
+      for (size_t i = 1; i < length; i++)
+      {
+         value = (value << 8) | (unsigned char)field[i];
+      }
+
+      return value;
+   }
+
+   for (size_t i = 0; i < length; i++)
+   {
+      if (field[i] >= '0' && field[i] <= '7')
+      {
+         value = (value << 3) | (uint64_t)(field[i] - '0');
+      }
+      else if (field[i] != ' ' || value != 0)
+      {
+         break;
+      }
+   }
+
+   return value;
+}
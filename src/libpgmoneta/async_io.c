@@ -0,0 +1,640 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <async_io.h>
+#include <logging.h>
+#include <utils.h>
+
+/* system */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+static struct async_io_slot* async_io_acquire(struct async_io* io);
+static int async_io_submit_slot(struct async_io* io, struct async_io_slot* slot);
+static int async_io_reap(struct async_io* io, bool wait);
+static void async_io_complete(struct async_io* io, struct async_io_slot* slot, ssize_t result);
+static int async_io_drain(struct async_file* file);
+static ssize_t async_io_pwrite(int fd, char* buffer, size_t size, off_t offset);
+
+int
+pgmoneta_async_io_create(int depth, size_t buffer_size, struct async_io** io)
+{
+   struct async_io* a = NULL;
+#ifdef HAVE_LIBURING
+   struct io_uring* ring = NULL;
+   struct iovec* iovecs = NULL;
+   int ret;
+#endif
+
+   *io = NULL;
+
+   if (depth < 1 || buffer_size == 0)
+   {
+      goto error;
+   }
+
+   a = (struct async_io*)malloc(sizeof(struct async_io));
+   if (a == NULL)
+   {
+      goto error;
+   }
+
+   memset(a, 0, sizeof(struct async_io));
+
+   a->depth = depth;
+   a->buffer_size = pgmoneta_get_aligned_size(buffer_size);
+
+   a->slots = (struct async_io_slot*)calloc(depth, sizeof(struct async_io_slot));
+   if (a->slots == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < depth; i++)
+   {
+      a->slots[i].index = i;
+      a->slots[i].state = ASYNC_IO_SLOT_FREE;
+      a->slots[i].buffer = (char*)aligned_alloc(ALIGNMENT_SIZE, a->buffer_size);
+      if (a->slots[i].buffer == NULL)
+      {
+         goto error;
+      }
+   }
+
+#ifdef HAVE_LIBURING
+   ring = (struct io_uring*)malloc(sizeof(struct io_uring));
+   if (ring != NULL)
+   {
+      ret = io_uring_queue_init(depth, ring, 0);
+      if (ret == 0)
+      {
+         a->uring = true;
+         a->ring = ring;
+
+         // fixed buffers save the page pinning on every write, but need enough locked memory
+         iovecs = (struct iovec*)calloc(depth, sizeof(struct iovec));
+         if (iovecs != NULL)
+         {
+            for (int i = 0; i < depth; i++)
+            {
+               iovecs[i].iov_base = a->slots[i].buffer;
+               iovecs[i].iov_len = a->buffer_size;
+            }
+
+            ret = io_uring_register_buffers(ring, iovecs, depth);
+            if (ret == 0)
+            {
+               a->registered = true;
+            }
+            else
+            {
+               pgmoneta_log_debug("Async I/O: Could not register buffers (%s)", strerror(-ret));
+            }
+            free(iovecs);
+         }
+      }
+      else
+      {
+         pgmoneta_log_debug("Async I/O: io_uring not available (%s), using pwrite", strerror(-ret));
+         free(ring);
+      }
+   }
+#endif
+
+   *io = a;
+
+   return 0;
+
+error:
+
+   pgmoneta_async_io_destroy(a);
+
+   return 1;
+}
+
+int
+pgmoneta_async_io_open(struct async_io* io, char* path, int flags, mode_t mode, async_io_callback callback, void* data, struct async_file** file)
+{
+   struct async_file* f = NULL;
+   int fd = -1;
+
+   *file = NULL;
+
+   fd = open(path, flags, mode);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   f = (struct async_file*)malloc(sizeof(struct async_file));
+   if (f == NULL)
+   {
+      close(fd);
+      errno = ENOMEM;
+      goto error;
+   }
+
+   memset(f, 0, sizeof(struct async_file));
+
+   f->io = io;
+   f->fd = fd;
+   f->callback = callback;
+   f->data = data;
+
+   *file = f;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgmoneta_async_io_write(struct async_file* file, void* data, size_t size)
+{
+   char* p = (char*)data;
+   size_t n = 0;
+   struct async_io_slot* slot = NULL;
+
+   if (file->failed)
+   {
+      goto error;
+   }
+
+   while (size > 0)
+   {
+      if (file->current == NULL)
+      {
+         slot = async_io_acquire(file->io);
+         if (slot == NULL)
+         {
+            goto error;
+         }
+
+         slot->state = ASYNC_IO_SLOT_FILLING;
+         slot->file = file;
+         slot->offset = file->offset;
+         slot->size = 0;
+
+         file->current = slot;
+      }
+
+      slot = file->current;
+
+      n = MIN(size, file->io->buffer_size - slot->size);
+      memcpy(slot->buffer + slot->size, p, n);
+
+      slot->size += n;
+      file->offset += n;
+      file->hole = false;
+      p += n;
+      size -= n;
+
+      if (slot->size == file->io->buffer_size)
+      {
+         if (pgmoneta_async_io_submit(file))
+         {
+            goto error;
+         }
+      }
+   }
+
+   return file->failed ? 1 : 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgmoneta_async_io_submit(struct async_file* file)
+{
+   struct async_io_slot* slot = file->current;
+
+   if (slot != NULL)
+   {
+      file->current = NULL;
+
+      if (slot->size == 0)
+      {
+         slot->state = ASYNC_IO_SLOT_FREE;
+         slot->file = NULL;
+      }
+      else if (async_io_submit_slot(file->io, slot))
+      {
+         file->failed = true;
+      }
+   }
+
+   return file->failed ? 1 : 0;
+}
+
+int
+pgmoneta_async_io_skip(struct async_file* file, size_t size)
+{
+   // the buffered data ends where the hole starts, so it goes out first
+   if (pgmoneta_async_io_submit(file))
+   {
+      return 1;
+   }
+
+   if (size > 0)
+   {
+      file->offset += size;
+      file->hole = true;
+   }
+
+   return 0;
+}
+
+int
+pgmoneta_async_io_seek(struct async_file* file, off_t offset)
+{
+   // writes in flight may overlap the new position, so they have to land first
+   if (async_io_drain(file))
+   {
+      return 1;
+   }
+
+   file->offset = offset;
+
+   return 0;
+}
+
+int
+pgmoneta_async_io_fsync(struct async_file* file, bool data_only)
+{
+   int ret;
+
+   if (async_io_drain(file))
+   {
+      return 1;
+   }
+
+#ifdef HAVE_LINUX
+   ret = data_only ? fdatasync(file->fd) : fsync(file->fd);
+#else
+   (void)data_only;
+   ret = fsync(file->fd);
+#endif
+
+   if (ret != 0)
+   {
+      pgmoneta_log_error("Async I/O: Could not sync file (%s)", strerror(errno));
+      errno = 0;
+      return 1;
+   }
+
+   return 0;
+}
+
+int
+pgmoneta_async_io_close(struct async_file* file)
+{
+   bool failed = false;
+
+   if (file == NULL)
+   {
+      return 0;
+   }
+
+   failed = async_io_drain(file) != 0;
+
+   // a hole at the end doesn't extend the file by itself
+   if (!failed && file->hole && ftruncate(file->fd, file->offset) != 0)
+   {
+      pgmoneta_log_error("Async I/O: Could not extend file (%s)", strerror(errno));
+      errno = 0;
+      failed = true;
+   }
+
+   if (close(file->fd) != 0)
+   {
+      pgmoneta_log_error("Async I/O: Could not close file (%s)", strerror(errno));
+      errno = 0;
+      failed = true;
+   }
+
+   free(file);
+
+   return failed ? 1 : 0;
+}
+
+void
+pgmoneta_async_io_destroy(struct async_io* io)
+{
+   if (io == NULL)
+   {
+      return;
+   }
+
+   while (io->in_flight > 0)
+   {
+      if (async_io_reap(io, true))
+      {
+         break;
+      }
+   }
+
+   pgmoneta_log_debug("Async I/O: %" PRIu64 " writes, %" PRIu64 " submits (%s)",
+                      io->writes, io->submits, io->uring ? "io_uring" : "pwrite");
+
+#ifdef HAVE_LIBURING
+   if (io->ring != NULL)
+   {
+      if (io->registered)
+      {
+         io_uring_unregister_buffers((struct io_uring*)io->ring);
+      }
+      io_uring_queue_exit((struct io_uring*)io->ring);
+      free(io->ring);
+   }
+#endif
+
+   if (io->slots != NULL)
+   {
+      for (int i = 0; i < io->depth; i++)
+      {
+         free(io->slots[i].buffer);
+      }
+      free(io->slots);
+   }
+
+   free(io);
+}
+
+static struct async_io_slot*
+async_io_acquire(struct async_io* io)
+{
+   struct async_io_slot* filling = NULL;
+
+   for (;;)
+   {
+      for (int i = 0; i < io->depth; i++)
+      {
+         if (io->slots[i].state == ASYNC_IO_SLOT_FREE)
+         {
+            return &io->slots[i];
+         }
+         else if (io->slots[i].state == ASYNC_IO_SLOT_FILLING && filling == NULL)
+         {
+            filling = &io->slots[i];
+         }
+      }
+
+      if (io->in_flight > 0)
+      {
+         if (async_io_reap(io, true))
+         {
+            return NULL;
+         }
+      }
+      else if (filling != NULL)
+      {
+         // every slot is held by an open file, push one of them out early
+         filling->file->current = NULL;
+         if (async_io_submit_slot(io, filling))
+         {
+            filling->file->failed = true;
+            return NULL;
+         }
+         filling = NULL;
+      }
+      else
+      {
+         return NULL;
+      }
+   }
+}
+
+static int
+async_io_submit_slot(struct async_io* io, struct async_io_slot* slot)
+{
+   struct async_file* file = slot->file;
+#ifdef HAVE_LIBURING
+   struct io_uring* ring = (struct io_uring*)io->ring;
+   struct io_uring_sqe* sqe = NULL;
+   int ret;
+#endif
+
+   slot->state = ASYNC_IO_SLOT_IN_FLIGHT;
+   file->in_flight++;
+   io->in_flight++;
+   io->writes++;
+
+#ifdef HAVE_LIBURING
+   if (io->uring)
+   {
+      // there are never more writes in flight than submission queue entries
+      sqe = io_uring_get_sqe(ring);
+      if (sqe == NULL)
+      {
+         goto error;
+      }
+
+      if (io->registered)
+      {
+         io_uring_prep_write_fixed(sqe, file->fd, slot->buffer, slot->size, slot->offset, slot->index);
+      }
+      else
+      {
+         io_uring_prep_write(sqe, file->fd, slot->buffer, slot->size, slot->offset);
+      }
+      io_uring_sqe_set_data(sqe, slot);
+
+      do
+      {
+         ret = io_uring_submit(ring);
+      }
+      while (ret == -EINTR);
+
+      io->submits++;
+
+      if (ret < 0)
+      {
+         // the entry is still queued, turn it into a no-op so it can't complete later
+         io_uring_prep_nop(sqe);
+         io_uring_sqe_set_data(sqe, NULL);
+         pgmoneta_log_error("Async I/O: Could not submit write (%s)", strerror(-ret));
+         goto error;
+      }
+
+      // pick up whatever has already finished, without blocking
+      return async_io_reap(io, false);
+   }
+#endif
+
+   async_io_complete(io, slot, async_io_pwrite(file->fd, slot->buffer, slot->size, slot->offset));
+
+   return 0;
+
+#ifdef HAVE_LIBURING
+error:
+
+   async_io_complete(io, slot, -EIO);
+
+   return 1;
+#endif
+}
+
+static int
+async_io_reap(struct async_io* io, bool wait)
+{
+#ifdef HAVE_LIBURING
+   struct io_uring* ring = (struct io_uring*)io->ring;
+   struct io_uring_cqe* cqe = NULL;
+   struct async_io_slot* slot = NULL;
+   ssize_t result;
+   int ret;
+
+   if (!io->uring || io->in_flight == 0)
+   {
+      return 0;
+   }
+
+   if (wait)
+   {
+      do
+      {
+         ret = io_uring_wait_cqe(ring, &cqe);
+      }
+      while (ret == -EINTR);
+
+      if (ret < 0)
+      {
+         pgmoneta_log_error("Async I/O: Could not wait for completion (%s)", strerror(-ret));
+         return 1;
+      }
+   }
+
+   while (io_uring_peek_cqe(ring, &cqe) == 0)
+   {
+      slot = (struct async_io_slot*)io_uring_cqe_get_data(cqe);
+      result = cqe->res;
+      io_uring_cqe_seen(ring, cqe);
+
+      if (slot != NULL)
+      {
+         async_io_complete(io, slot, result);
+      }
+   }
+#else
+   (void)io;
+   (void)wait;
+#endif
+
+   return 0;
+}
+
+static void
+async_io_complete(struct async_io* io, struct async_io_slot* slot, ssize_t result)
+{
+   struct async_file* file = slot->file;
+   ssize_t rest;
+
+   if (result >= 0 && (size_t)result < slot->size)
+   {
+      // short write, finish it synchronously
+      rest = async_io_pwrite(file->fd, slot->buffer + result, slot->size - result, slot->offset + result);
+      result = rest < 0 ? rest : result + rest;
+   }
+
+   if (result < 0)
+   {
+      pgmoneta_log_error("Async I/O: Could not write %zu bytes at offset %lld (%s)",
+                         slot->size, (long long)slot->offset, strerror((int)-result));
+      file->failed = true;
+   }
+
+   if (file->callback != NULL)
+   {
+      file->callback(file, result, file->data);
+   }
+
+   file->in_flight--;
+   io->in_flight--;
+
+   slot->state = ASYNC_IO_SLOT_FREE;
+   slot->file = NULL;
+   slot->size = 0;
+}
+
+static int
+async_io_drain(struct async_file* file)
+{
+   pgmoneta_async_io_submit(file);
+
+   while (file->in_flight > 0)
+   {
+      if (async_io_reap(file->io, true))
+      {
+         file->failed = true;
+         break;
+      }
+   }
+
+   return file->failed ? 1 : 0;
+}
+
+static ssize_t
+async_io_pwrite(int fd, char* buffer, size_t size, off_t offset)
+{
+   size_t written = 0;
+   ssize_t n;
+
+   while (written < size)
+   {
+      n = pwrite(fd, buffer + written, size - written, offset + written);
+      if (n < 0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+         n = -errno;
+         errno = 0;
+         return n;
+      }
+      else if (n == 0)
+      {
+         return -EIO;
+      }
+      written += n;
+   }
+
+   return (ssize_t)written;
+}
@@ -29,13 +29,19 @@
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <bzip2_compression.h>
+#include <codec.h>
+#include <compression.h>
 #include <logging.h>
 #include <management.h>
 #include <utils.h>
+#include <wal.h>
+#include <walindex.h>
 
 /* system */
 #include <bzlib.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -45,14 +51,60 @@
 #include <unistd.h>
 
 #define NAME "bzip2"
-#define BUFFER_LENGTH 8192
 
-static int bzip2_compress(char* from, int level, char* to);
-static int bzip2_decompress(char* from, char* to);
-static int bzip2_decompress_file(char* from, char* to);
+/** @struct bzip2_file
+ * Defines a file compressed or decompressed in parallel, one stream per chunk
+ */
+struct bzip2_file
+{
+   pthread_mutex_t lock;    /**< The lock of the output */
+   char from[MAX_PATH];     /**< The source file */
+   char to[MAX_PATH];       /**< The destination file */
+   int level;               /**< The compression level */
+   bool compress;           /**< Compress or decompress */
+   FILE* out;               /**< The destination */
+   int number_of_chunks;    /**< The number of chunks */
+   int remaining;           /**< The number of chunks not done */
+   int next;                /**< The next chunk to write */
+   uint64_t* offsets;       /**< The offset of each chunk in the source, and its size */
+   char** data;             /**< The output of the chunks done but not written */
+   size_t* sizes;           /**< The size of the output of each chunk */
+   bool* done;              /**< Is the chunk done */
+   bool failed;             /**< Did a chunk fail */
+   bool abandoned;          /**< Is the file left to the caller */
+   pthread_cond_t finished; /**< Signaled when the last chunk of an abandoned file is done */
+   struct workers* workers; /**< The workers of the chunks */
+};
+
+/** @struct bzip2_chunk
+ * Defines the worker input of a chunk
+ */
+struct bzip2_chunk
+{
+   struct worker_common common; /**< The common base */
+   struct bzip2_file* file;     /**< The file */
+   int chunk;                   /**< The chunk */
+};
+
+/** @struct bzip2_buffer
+ * Defines a growing output buffer
+ */
+struct bzip2_buffer
+{
+   char* data;       /**< The data */
+   size_t size;      /**< The size of the data */
+   size_t capacity;  /**< The capacity */
+};
 
 static void do_bzip2_compress(struct worker_common* wc);
 static void do_bzip2_decompress(struct worker_common* wc);
+static int bzip2_parallel(char* from, char* to, int level, bool compress, struct workers* workers);
+static int bzip2_streams(char* path, uint64_t** offsets, int* number_of_offsets);
+static bool is_stream_header(unsigned char* p);
+static void do_bzip2_chunk(struct worker_common* wc);
+static void bzip2_chunk_done(struct bzip2_file* f, int chunk, char* data, size_t size, bool ok);
+static void bzip2_file_finish(struct bzip2_file* f);
+static int buffer_output(void* data, void* buffer, size_t size);
 
 int
 pgmoneta_bzip2_data(char* directory, struct workers* workers)
@@ -117,7 +169,11 @@ pgmoneta_bzip2_data(char* directory, struct workers* workers)
             to = pgmoneta_append(to, entry->d_name);
             to = pgmoneta_append(to, ".bz2");
 
-            if (!pgmoneta_create_worker_input(directory, from, to, level, workers, &wi))
+            if (workers != NULL && workers->outcome && !bzip2_parallel(from, to, level, true, workers))
+            {
+               pgmoneta_log_trace("Bzip2: Compressing %s in parallel", from);
+            }
+            else if (!pgmoneta_create_worker_input(directory, from, to, level, workers, &wi))
             {
                if (workers != NULL)
                {
@@ -170,9 +226,10 @@ do_bzip2_compress(struct worker_common* wc)
 {
    struct worker_input* wi = (struct worker_input*)wc;
 
-   if (pgmoneta_exists(wi->from))
+   if (pgmoneta_exists(wi->from) &&
+       pgmoneta_compression_decide(wi->from, COMPRESSION_CLIENT_BZIP2, &wi->level) != COMPRESSION_DECISION_STORE)
    {
-      if (bzip2_compress(wi->from, wi->level, wi->to))
+      if (pgmoneta_codec_file(COMPRESSION_CLIENT_BZIP2, true, wi->level, wi->from, wi->to))
       {
          pgmoneta_log_error("Bzip2: Could not compress %s", wi->from);
       }
@@ -272,11 +329,18 @@ pgmoneta_bzip2_wal(char* directory)
 
          if (pgmoneta_exists(from))
          {
-            if (bzip2_compress(from, level, to))
+            // the zero-filled tail is restored by pgmoneta_wal_pad()
+            if (pgmoneta_is_wal_file(entry->d_name))
+            {
+               pgmoneta_wal_trim(from);
+            }
+
+            if (pgmoneta_codec_file(COMPRESSION_CLIENT_BZIP2, true, level, from, to))
             {
                pgmoneta_log_error("Bzip2: Could not compress %s/%s", directory, entry->d_name);
                break;
             }
+            pgmoneta_wal_index_add(to);
          }
 
          free(from);
@@ -314,7 +378,7 @@ pgmoneta_bunzip2_data(char* directory, struct workers* workers)
       {
          char path[MAX_PATH];
 
-         if (!strcmp(entry->d_name, ".") || strcmp(entry->d_name, ".."))
+         if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
          {
             continue;
          }
@@ -327,7 +391,7 @@ pgmoneta_bunzip2_data(char* directory, struct workers* workers)
       {
          if (pgmoneta_ends_with(entry->d_name, ".bz2"))
          {
-            from = pgmoneta_append(from, entry->d_name);
+            from = pgmoneta_append(from, directory);
             from = pgmoneta_append(from, "/");
             from = pgmoneta_append(from, entry->d_name);
 
@@ -345,7 +409,11 @@ pgmoneta_bunzip2_data(char* directory, struct workers* workers)
             to = pgmoneta_append(to, "/");
             to = pgmoneta_append(to, name);
 
-            if (!pgmoneta_create_worker_input(directory, from, to, 0, workers, &wi))
+            if (workers != NULL && workers->outcome && !bzip2_parallel(from, to, 0, false, workers))
+            {
+               pgmoneta_log_trace("Bzip2: Decompressing %s in parallel", from);
+            }
+            else if (!pgmoneta_create_worker_input(directory, from, to, 0, workers, &wi))
             {
                if (workers != NULL)
                {
@@ -434,7 +502,7 @@ pgmoneta_bunzip2_request(SSL* ssl, int client_fd, uint8_t compression, uint8_t e
       goto error;
    }
 
-   if (bzip2_decompress(from, to))
+   if (pgmoneta_codec_file(COMPRESSION_CLIENT_BZIP2, false, 0, from, to))
    {
       ec = MANAGEMENT_ERROR_BZIP2_ERROR;
       pgmoneta_log_error("BZIP: Error bunzip2 %s", from);
@@ -502,7 +570,7 @@ do_bzip2_decompress(struct worker_common* wc)
 
    if (pgmoneta_exists(wi->from))
    {
-      if (bzip2_decompress(wi->from, wi->to))
+      if (pgmoneta_codec_file(COMPRESSION_CLIENT_BZIP2, false, 0, wi->from, wi->to))
       {
          pgmoneta_log_error("Bzip2: Could not decompress %s", wi->from);
       }
@@ -631,7 +699,7 @@ pgmoneta_bzip2_file(char* from, char* to)
       level = 9;
    }
 
-   if (bzip2_compress(from, level, to))
+   if (pgmoneta_codec_file(COMPRESSION_CLIENT_BZIP2, true, level, from, to))
    {
       goto error;
    }
@@ -653,319 +721,561 @@ error:
    return 1;
 }
 
-static int
-bzip2_compress(char* from, int level, char* to)
+int
+pgmoneta_bunzip2_file(char* from, char* to)
 {
-   FILE* from_ptr = NULL;
-   FILE* to_ptr = NULL;
-
-   char buf[BUFFER_LENGTH] = {0};
-   size_t buf_len = BUFFER_LENGTH;
-   size_t length;
-   int bzip2_err = 1;
-
-   from_ptr = fopen(from, "r");
-   if (!from_ptr)
+   if (pgmoneta_ends_with(from, ".bz2"))
    {
-      goto error;
-   }
+      if (pgmoneta_codec_file(COMPRESSION_CLIENT_BZIP2, false, 0, from, to))
+      {
+         pgmoneta_log_error("Bzip2: Could not decompress %s", from);
+         goto error;
+      }
 
-   to_ptr = fopen(to, "wb+");
-   if (!to_ptr)
+      if (pgmoneta_exists(from))
+      {
+         pgmoneta_delete_file(from, NULL);
+      }
+      else
+      {
+         pgmoneta_log_debug("%s doesn't exists", from);
+      }
+   }
+   else
    {
       goto error;
    }
 
-   bzip2_err = BZ_OK;
+   return 0;
 
-   BZFILE* zip_file = BZ2_bzWriteOpen(&bzip2_err, to_ptr, level, 0, 0);
-   if (bzip2_err != BZ_OK)
+error:
+
+   return 1;
+}
+
+int
+pgmoneta_bzip2_string(char* s, unsigned char** buffer, size_t* buffer_size)
+{
+   size_t source_len;
+   unsigned int dest_len;
+   int bzip2_err;
+
+   source_len = strlen(s);
+   dest_len = source_len + (source_len * 0.01) + 600;
+
+   *buffer = (unsigned char*)malloc(dest_len);
+   if (!*buffer)
    {
-      goto error_zip;
+      pgmoneta_log_error("Bzip2: Allocation failed");
+      return 1;
    }
 
-   while ((length = fread(buf, sizeof(char), buf_len, from_ptr)) > 0)
+   bzip2_err = BZ2_bzBuffToBuffCompress((char*)(*buffer), &dest_len, s, source_len, 9, 0, 0);
+   if (bzip2_err != BZ_OK)
    {
-      BZ2_bzWrite(&bzip2_err, zip_file, buf, strlen(buf));
-      if (bzip2_err != BZ_OK)
-      {
-         goto error_zip;
-      }
-
-      memset(buf, 0, buf_len);
+      pgmoneta_log_error("Bzip2: Compress failed");
+      free(*buffer);
+      return 1;
    }
 
-   BZ2_bzWriteClose(&bzip2_err, zip_file, 0, NULL, NULL);
-
-   fclose(from_ptr);
-   fclose(to_ptr);
-
+   *buffer_size = dest_len;
    return 0;
+}
 
-error_zip:
-   BZ2_bzWriteClose(&bzip2_err, zip_file, 0, NULL, NULL);
+int
+pgmoneta_bunzip2_string(unsigned char* compressed_buffer, size_t compressed_size, char** output_string)
+{
+   int bzip2_err = 0;
+   size_t size = compressed_size * 10 * 2;
+   char* o = NULL;
 
-error:
-   if (from_ptr)
+   *output_string = NULL;
+
+   o = (char*)malloc(size);
+   if (o == NULL)
    {
-      fclose(from_ptr);
+      pgmoneta_log_error("Bzip2: Allocation failed");
+      goto error;
    }
 
-   if (to_ptr)
+   memset(o, 0, size);
+
+   bzip2_err = BZ2_bzBuffToBuffDecompress(o, (unsigned int*)&size, (char*)compressed_buffer, compressed_size, 0, 0);
+
+   if (bzip2_err != BZ_OK)
    {
-      fclose(to_ptr);
+      pgmoneta_log_error("Bzip2: Decompress failed");
+      goto error;
    }
 
+   *output_string = o;
+
+   return 0;
+
+error:
+
+   free(o);
+
    return 1;
 }
 
 static int
-bzip2_decompress(char* from, char* to)
+bzip2_parallel(char* from, char* to, int level, bool compress, struct workers* workers)
 {
-   FILE* from_ptr = NULL;
-   FILE* to_ptr = NULL;
+   struct bzip2_file* f = NULL;
+   struct bzip2_chunk* c = NULL;
+   uint64_t* offsets = NULL;
+   int number_of_offsets = 0;
+   size_t size;
+   size_t chunk_size;
 
-   char buf[BUFFER_LENGTH] = {0};
-   size_t buf_len = BUFFER_LENGTH;
-   int length = 0;
-   int bzip2_err;
-   BZFILE* zip_file = NULL;
+   size = pgmoneta_get_file_size(from);
+
+   if (compress)
+   {
+      // each chunk is one bzip2 block, so the compression ratio stays the same
+      if (size <= (size_t)BZIP2_PARALLEL_BLOCKS * level * BZIP2_BLOCK_SIZE)
+      {
+         goto error;
+      }
+
+      if (pgmoneta_compression_decide(from, COMPRESSION_CLIENT_BZIP2, &level) == COMPRESSION_DECISION_STORE)
+      {
+         return 0;
+      }
+
+      chunk_size = (size_t)level * BZIP2_BLOCK_SIZE;
+      number_of_offsets = (int)((size + chunk_size - 1) / chunk_size) + 1;
+
+      offsets = (uint64_t*)malloc(number_of_offsets * sizeof(uint64_t));
+      if (offsets == NULL)
+      {
+         goto error;
+      }
+
+      for (int i = 0; i < number_of_offsets - 1; i++)
+      {
+         offsets[i] = (uint64_t)i * chunk_size;
+      }
+      offsets[number_of_offsets - 1] = size;
+   }
+   else
+   {
+      if (size <= (size_t)BZIP2_PARALLEL_BLOCKS * 9 * BZIP2_BLOCK_SIZE)
+      {
+         goto error;
+      }
+
+      // only files made of several streams can be split
+      if (bzip2_streams(from, &offsets, &number_of_offsets) || number_of_offsets < 3)
+      {
+         goto error;
+      }
+   }
 
-   from_ptr = fopen(from, "r");
-   if (!from_ptr)
+   f = (struct bzip2_file*)malloc(sizeof(struct bzip2_file));
+   if (f == NULL)
    {
       goto error;
    }
 
-   to_ptr = fopen(to, "wb+");
-   if (!to_ptr)
+   memset(f, 0, sizeof(struct bzip2_file));
+
+   pthread_mutex_init(&f->lock, NULL);
+   pthread_cond_init(&f->finished, NULL);
+   f->workers = workers;
+   snprintf(f->from, sizeof(f->from), "%s", from);
+   snprintf(f->to, sizeof(f->to), "%s", to);
+   f->level = level;
+   f->compress = compress;
+   f->number_of_chunks = number_of_offsets - 1;
+   f->remaining = f->number_of_chunks;
+   f->offsets = offsets;
+   offsets = NULL;
+
+   f->data = (char**)calloc(f->number_of_chunks, sizeof(char*));
+   f->sizes = (size_t*)calloc(f->number_of_chunks, sizeof(size_t));
+   f->done = (bool*)calloc(f->number_of_chunks, sizeof(bool));
+
+   if (f->data == NULL || f->sizes == NULL || f->done == NULL)
    {
       goto error;
    }
 
-   zip_file = BZ2_bzReadOpen(&bzip2_err, from_ptr, 0, 0, NULL, 0);
-   if (bzip2_err != BZ_OK)
+   f->out = fopen(to, "wb");
+   if (f->out == NULL)
    {
-      goto error_unzip;
+      goto error;
    }
 
-   do
+   for (int i = 0; i < f->number_of_chunks; i++)
    {
-      length = BZ2_bzRead(&bzip2_err, zip_file, buf, (int) buf_len);
-      if (bzip2_err != BZ_OK && bzip2_err != BZ_STREAM_END)
+      c = (struct bzip2_chunk*)malloc(sizeof(struct bzip2_chunk));
+      if (c != NULL)
       {
-         goto error_unzip;
+         memset(c, 0, sizeof(struct bzip2_chunk));
+         c->common.workers = workers;
+         c->file = f;
+         c->chunk = i;
       }
 
-      if (length > 0)
+      if (c == NULL || pgmoneta_workers_add(workers, do_bzip2_chunk, (struct worker_common*)c))
       {
-         if (fwrite(buf, 1, length, to_ptr) != (size_t)length)
+         free(c);
+
+         // the chunks already queued are waited for, so the caller can process the file serially
+         pthread_mutex_lock(&f->lock);
+         f->failed = true;
+         f->abandoned = true;
+         f->remaining -= f->number_of_chunks - i;
+         while (f->remaining > 0)
          {
-            goto error_unzip;
+            pthread_cond_wait(&f->finished, &f->lock);
          }
-      }
+         pthread_mutex_unlock(&f->lock);
 
+         goto error;
+      }
    }
-   while (bzip2_err == BZ_STREAM_END && length == BUFFER_LENGTH);
-
-   BZ2_bzReadClose(&bzip2_err, zip_file);
-
-   fclose(from_ptr);
-   fclose(to_ptr);
 
    return 0;
 
-error_unzip:
-   if (zip_file != NULL)
-   {
-      BZ2_bzReadClose(&bzip2_err, zip_file);
-   }
-
 error:
-   if (to_ptr)
-   {
-      fclose(to_ptr);
-   }
 
-   if (from_ptr)
+   if (f != NULL)
    {
-      fclose(from_ptr);
+      if (f->out != NULL)
+      {
+         fclose(f->out);
+         pgmoneta_delete_file(to, NULL);
+      }
+      for (int i = 0; f->data != NULL && i < f->number_of_chunks; i++)
+      {
+         free(f->data[i]);
+      }
+      pthread_mutex_destroy(&f->lock);
+      pthread_cond_destroy(&f->finished);
+      free(f->offsets);
+      free(f->data);
+      free(f->sizes);
+      free(f->done);
+      free(f);
    }
 
+   free(offsets);
+
    return 1;
 }
 
 static int
-bzip2_decompress_file(char* from, char* to)
+bzip2_streams(char* path, uint64_t** offsets, int* number_of_offsets)
 {
-   FILE* from_ptr = NULL;
-   FILE* to_ptr = NULL;
-
-   char buf[BUFFER_LENGTH] = {0};
-   size_t buf_len = BUFFER_LENGTH;
-   int length = 0;
-   int bzip2_err = 1;
-   BZFILE* zip_file = NULL;
-
-   from_ptr = fopen(from, "r");
-   if (!from_ptr)
+   unsigned char buffer[BZIP2_BLOCK_SIZE];
+   FILE* in = NULL;
+   uint64_t* o = NULL;
+   uint64_t* tmp = NULL;
+   int n = 0;
+   int capacity = 0;
+   uint64_t base = 0;
+   size_t length = 0;
+   size_t r;
+   size_t keep;
+
+   *offsets = NULL;
+   *number_of_offsets = 0;
+
+   in = fopen(path, "rb");
+   if (in == NULL)
    {
       goto error;
    }
 
-   to_ptr = fopen(to, "wb+");
-   if (!to_ptr)
+   capacity = 64;
+   o = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+   if (o == NULL)
    {
       goto error;
    }
 
-   zip_file = BZ2_bzReadOpen(&bzip2_err, from_ptr, 0, 0, NULL, 0);
-   if (bzip2_err != BZ_OK)
-   {
-      goto error_unzip;
-   }
+   o[n++] = 0;
 
-   do
+   while ((r = fread(buffer + length, 1, sizeof(buffer) - length, in)) > 0)
    {
-      length = BZ2_bzRead(&bzip2_err, zip_file, buf, (int)buf_len);
-      if (bzip2_err != BZ_OK && bzip2_err != BZ_STREAM_END)
-      {
-         goto error_unzip;
-      }
+      length += r;
 
-      if (length > 0)
+      for (size_t i = 0; i + BZIP2_HEADER_SIZE <= length; i++)
       {
-         if (fwrite(buf, 1, length, to_ptr) != (size_t)length)
+         if (base + i > 0 && is_stream_header(buffer + i))
          {
-            goto error_unzip;
+            // one slot is kept for the size of the file
+            if (n + 1 >= capacity)
+            {
+               capacity *= 2;
+               tmp = (uint64_t*)realloc(o, capacity * sizeof(uint64_t));
+               if (tmp == NULL)
+               {
+                  goto error;
+               }
+               o = tmp;
+            }
+
+            o[n++] = base + i;
          }
       }
 
+      // a header may span two reads
+      keep = length < BZIP2_HEADER_SIZE - 1 ? length : BZIP2_HEADER_SIZE - 1;
+      memmove(buffer, buffer + length - keep, keep);
+      base += length - keep;
+      length = keep;
+   }
+
+   if (ferror(in))
+   {
+      goto error;
    }
-   while (bzip2_err != BZ_STREAM_END);
 
-   BZ2_bzReadClose(&bzip2_err, zip_file);
-   zip_file = NULL;
+   o[n++] = base + length;
 
-   fclose(from_ptr);
-   fclose(to_ptr);
+   fclose(in);
 
-   return 0;
+   *offsets = o;
+   *number_of_offsets = n;
 
-error_unzip:
-   if (zip_file)
-   {
-      BZ2_bzReadClose(&bzip2_err, zip_file);
-   }
+   return 0;
 
 error:
-   if (to_ptr)
-   {
-      fclose(to_ptr);
-   }
 
-   if (from_ptr)
+   if (in != NULL)
    {
-      fclose(from_ptr);
+      fclose(in);
    }
 
+   free(o);
+
    return 1;
 }
 
-int
-pgmoneta_bunzip2_file(char* from, char* to)
+static bool
+is_stream_header(unsigned char* p)
 {
-   if (pgmoneta_ends_with(from, ".bz2"))
+   // "BZh", the block size and the magic of the first block
+   return p[0] == 'B' && p[1] == 'Z' && p[2] == 'h' && p[3] >= '1' && p[3] <= '9' &&
+          p[4] == 0x31 && p[5] == 0x41 && p[6] == 0x59 && p[7] == 0x26 && p[8] == 0x53 && p[9] == 0x59;
+}
+
+static void
+do_bzip2_chunk(struct worker_common* wc)
+{
+   struct bzip2_chunk* c = (struct bzip2_chunk*)wc;
+   struct bzip2_file* f = c->file;
+   struct bzip2_buffer output = {0};
+   struct codec* codec = NULL;
+   char* in = NULL;
+   size_t in_size;
+   unsigned int out_size;
+   ssize_t r;
+   size_t pos = 0;
+   int fd = -1;
+
+   in_size = f->offsets[c->chunk + 1] - f->offsets[c->chunk];
+
+   in = (char*)malloc(in_size);
+   if (in == NULL)
+   {
+      goto error;
+   }
+
+   fd = open(f->from, O_RDONLY);
+   if (fd == -1)
    {
-      if (bzip2_decompress_file(from, to))
+      goto error;
+   }
+
+   while (pos < in_size)
+   {
+      r = pread(fd, in + pos, in_size - pos, f->offsets[c->chunk] + pos);
+      if (r <= 0)
       {
-         pgmoneta_log_error("Bzip2: Could not decompress %s", from);
          goto error;
       }
+      pos += r;
+   }
 
-      if (pgmoneta_exists(from))
+   close(fd);
+   fd = -1;
+
+   if (f->compress)
+   {
+      out_size = (unsigned int)(in_size + in_size / 100 + 600);
+
+      output.data = (char*)malloc(out_size);
+      if (output.data == NULL)
       {
-         pgmoneta_delete_file(from, NULL);
+         goto error;
       }
-      else
+
+      if (BZ2_bzBuffToBuffCompress(output.data, &out_size, in, (unsigned int)in_size, f->level, 0, 0) != BZ_OK)
       {
-         pgmoneta_log_debug("%s doesn't exists", from);
+         goto error;
       }
+
+      output.size = out_size;
    }
    else
    {
-      goto error;
+      if (pgmoneta_codec_get(COMPRESSION_CLIENT_BZIP2, false, &codec) ||
+          pgmoneta_codec_init(codec, 0, f->from, buffer_output, &output) ||
+          pgmoneta_codec_update(codec, in, in_size) ||
+          pgmoneta_codec_finish(codec))
+      {
+         goto error;
+      }
    }
 
-   return 0;
+   free(in);
+
+   bzip2_chunk_done(f, c->chunk, output.data, output.size, true);
+
+   free(c);
+
+   return;
 
 error:
 
-   return 1;
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   free(in);
+
+   bzip2_chunk_done(f, c->chunk, output.data, 0, false);
+
+   free(c);
 }
 
-int
-pgmoneta_bzip2_string(char* s, unsigned char** buffer, size_t* buffer_size)
+static void
+bzip2_chunk_done(struct bzip2_file* f, int chunk, char* data, size_t size, bool ok)
 {
-   size_t source_len;
-   unsigned int dest_len;
-   int bzip2_err;
+   bool last;
+   bool abandoned;
 
-   source_len = strlen(s);
-   dest_len = source_len + (source_len * 0.01) + 600;
+   pthread_mutex_lock(&f->lock);
 
-   *buffer = (unsigned char*)malloc(dest_len);
-   if (!*buffer)
+   if (ok)
    {
-      pgmoneta_log_error("Bzip2: Allocation failed");
-      return 1;
+      f->data[chunk] = data;
+      f->sizes[chunk] = size;
+      f->done[chunk] = true;
+   }
+   else
+   {
+      free(data);
+      f->failed = true;
    }
 
-   bzip2_err = BZ2_bzBuffToBuffCompress((char*)(*buffer), &dest_len, s, source_len, 9, 0, 0);
-   if (bzip2_err != BZ_OK)
+   // chunks are written in order, as soon as the ones before them are written
+   while (!f->failed && f->next < f->number_of_chunks && f->done[f->next])
    {
-      pgmoneta_log_error("Bzip2: Compress failed");
-      free(*buffer);
-      return 1;
+      if (fwrite(f->data[f->next], 1, f->sizes[f->next], f->out) != f->sizes[f->next])
+      {
+         f->failed = true;
+      }
+
+      free(f->data[f->next]);
+      f->data[f->next] = NULL;
+      f->next++;
    }
 
-   *buffer_size = dest_len;
-   return 0;
+   f->remaining--;
+   last = f->remaining == 0;
+   abandoned = f->abandoned;
+
+   if (last && abandoned)
+   {
+      pthread_cond_signal(&f->finished);
+   }
+
+   pthread_mutex_unlock(&f->lock);
+
+   if (last && !abandoned)
+   {
+      bzip2_file_finish(f);
+   }
 }
 
-int
-pgmoneta_bunzip2_string(unsigned char* compressed_buffer, size_t compressed_size, char** output_string)
+static void
+bzip2_file_finish(struct bzip2_file* f)
 {
-   int bzip2_err = 0;
-   size_t size = compressed_size * 10 * 2;
-   char* o = NULL;
-
-   *output_string = NULL;
+   if (fclose(f->out) != 0)
+   {
+      f->failed = true;
+   }
 
-   o = (char*)malloc(size);
-   if (o == NULL)
+   if (f->failed)
    {
-      pgmoneta_log_error("Bzip2: Allocation failed");
-      goto error;
+      // a chunk failed, or a block magic inside the data looked like a stream, so the file is processed as a whole
+      pgmoneta_log_debug("Bzip2: %s %s serially", f->compress ? "Compressing" : "Decompressing", f->from);
+      f->failed = pgmoneta_codec_file(COMPRESSION_CLIENT_BZIP2, f->compress, f->level, f->from, f->to) != 0;
    }
 
-   memset(o, 0, size);
+   if (f->failed)
+   {
+      pgmoneta_log_error("Bzip2: Could not %s %s", f->compress ? "compress" : "decompress", f->from);
+      pgmoneta_delete_file(f->to, NULL);
 
-   bzip2_err = BZ2_bzBuffToBuffDecompress(o, (unsigned int*)&size, (char*)compressed_buffer, compressed_size, 0, 0);
+      if (f->workers != NULL)
+      {
+         f->workers->outcome = false;
+      }
+   }
+   else
+   {
+      pgmoneta_delete_file(f->from, NULL);
+   }
 
-   if (bzip2_err != BZ_OK)
+   for (int i = 0; i < f->number_of_chunks; i++)
    {
-      pgmoneta_log_error("Bzip2: Decompress failed");
-      goto error;
+      free(f->data[i]);
    }
 
-   *output_string = o;
+   pthread_mutex_destroy(&f->lock);
+   pthread_cond_destroy(&f->finished);
+   free(f->offsets);
+   free(f->data);
+   free(f->sizes);
+   free(f->done);
+   free(f);
+}
 
-   return 0;
+static int
+buffer_output(void* data, void* buffer, size_t size)
+{
+   struct bzip2_buffer* b = (struct bzip2_buffer*)data;
+   char* tmp = NULL;
+   size_t capacity;
 
-error:
+   if (b->size + size > b->capacity)
+   {
+      capacity = b->capacity == 0 ? 9 * BZIP2_BLOCK_SIZE : b->capacity;
+      while (capacity < b->size + size)
+      {
+         capacity *= 2;
+      }
 
-   free(o);
+      tmp = (char*)realloc(b->data, capacity);
+      if (tmp == NULL)
+      {
+         return 1;
+      }
 
-   return 1;
+      b->data = tmp;
+      b->capacity = capacity;
+   }
+
+   memcpy(b->data + b->size, buffer, size);
+   b->size += size;
+
+   return 0;
 }
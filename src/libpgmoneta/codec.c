@@ -0,0 +1,1134 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <codec.h>
+#include <dictionary.h>
+#include <logging.h>
+#include <lz4_compression.h>
+#include <utils.h>
+#include <wal.h>
+
+/* system */
+#include <bzlib.h>
+#include <lz4.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <zstd.h>
+
+static pthread_key_t codec_key;
+static pthread_once_t codec_once = PTHREAD_ONCE_INIT;
+
+static int codec_index(int type);
+static int codec_level(int type, int level);
+static void codec_key_create(void);
+static void codec_cache_destroy(void* cache);
+static int emit(struct codec* codec, void* buffer, size_t size);
+static int file_output(void* data, void* buffer, size_t size);
+static int stream_file(int type, bool compress, int level, int dictionary, char* from, char* to, uint32_t* id);
+
+static int gzip_compress(struct codec* codec, void* data, size_t size, int flush);
+static int gzip_decompress(struct codec* codec, void* data, size_t size);
+static int zstd_compress(struct codec* codec, void* data, size_t size, ZSTD_EndDirective mode);
+static int zstd_decompress(struct codec* codec, void* data, size_t size);
+static int lz4_compress(struct codec* codec, void* data, size_t size);
+static int lz4_block(struct codec* codec);
+static int lz4_decompress(struct codec* codec, void* data, size_t size);
+static int bzip2_compress(struct codec* codec, void* data, size_t size, int action);
+static int bzip2_decompress(struct codec* codec, void* data, size_t size);
+
+int
+pgmoneta_codec_create(int type, bool compress, struct codec** codec)
+{
+   struct codec* c = NULL;
+
+   *codec = NULL;
+
+   if (codec_index(type) == -1)
+   {
+      pgmoneta_log_error("Codec: Unsupported compression type %d", type);
+      goto error;
+   }
+
+   c = (struct codec*)malloc(sizeof(struct codec));
+   if (c == NULL)
+   {
+      goto error;
+   }
+
+   memset(c, 0, sizeof(struct codec));
+
+   c->compress = compress;
+
+   switch (codec_index(type))
+   {
+      case 0:
+         c->type = COMPRESSION_CLIENT_GZIP;
+         c->context = malloc(sizeof(z_stream));
+         c->out_size = CODEC_BUFFER_SIZE;
+         break;
+      case 1:
+         c->type = COMPRESSION_CLIENT_ZSTD;
+         c->context = compress ? (void*)ZSTD_createCCtx() : (void*)ZSTD_createDCtx();
+         c->out_size = compress ? ZSTD_CStreamOutSize() : ZSTD_DStreamOutSize();
+         break;
+      case 2:
+         c->type = COMPRESSION_CLIENT_LZ4;
+         if (compress)
+         {
+            c->context = (void*)LZ4_createStream();
+            c->in_size = 2 * BLOCK_BYTES;
+            c->out_size = sizeof(int) + LZ4_COMPRESSBOUND(BLOCK_BYTES);
+         }
+         else
+         {
+            c->context = (void*)LZ4_createStreamDecode();
+            c->in_size = LZ4_COMPRESSBOUND(BLOCK_BYTES);
+            c->out_size = 2 * BLOCK_BYTES;
+         }
+         c->in = (char*)malloc(c->in_size);
+         if (c->in == NULL)
+         {
+            goto error;
+         }
+         break;
+      default:
+         c->type = COMPRESSION_CLIENT_BZIP2;
+         c->context = malloc(sizeof(bz_stream));
+         c->out_size = CODEC_BUFFER_SIZE;
+         break;
+   }
+
+   if (c->context == NULL)
+   {
+      goto error;
+   }
+
+   if (c->type == COMPRESSION_CLIENT_GZIP)
+   {
+      memset(c->context, 0, sizeof(z_stream));
+   }
+   else if (c->type == COMPRESSION_CLIENT_BZIP2)
+   {
+      memset(c->context, 0, sizeof(bz_stream));
+   }
+
+   c->out = (char*)malloc(c->out_size);
+   if (c->out == NULL)
+   {
+      goto error;
+   }
+
+   *codec = c;
+
+   return 0;
+
+error:
+
+   pgmoneta_codec_destroy(c);
+
+   return 1;
+}
+
+int
+pgmoneta_codec_get(int type, bool compress, struct codec** codec)
+{
+   struct codec** codecs = NULL;
+   int index;
+
+   *codec = NULL;
+
+   index = codec_index(type);
+   if (index == -1)
+   {
+      pgmoneta_log_error("Codec: Unsupported compression type %d", type);
+      goto error;
+   }
+
+   pthread_once(&codec_once, codec_key_create);
+
+   codecs = (struct codec**)pthread_getspecific(codec_key);
+   if (codecs == NULL)
+   {
+      codecs = (struct codec**)calloc(CODEC_TYPES * 2, sizeof(struct codec*));
+      if (codecs == NULL)
+      {
+         goto error;
+      }
+
+      if (pthread_setspecific(codec_key, codecs))
+      {
+         free(codecs);
+         goto error;
+      }
+   }
+
+   index = index * 2 + (compress ? 0 : 1);
+
+   if (codecs[index] == NULL && pgmoneta_codec_create(type, compress, &codecs[index]))
+   {
+      goto error;
+   }
+
+   *codec = codecs[index];
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgmoneta_codec_init(struct codec* codec, int level, char* source, codec_output output, void* output_data)
+{
+   z_stream* z = NULL;
+   bz_stream* bz = NULL;
+   int ret;
+
+   codec->level = codec_level(codec->type, level);
+   codec->output = output;
+   codec->output_data = output_data;
+   codec->end = false;
+   codec->pending = 0;
+   codec->in_pos = 0;
+   codec->in_need = codec->compress ? 0 : sizeof(int);
+   codec->index = 0;
+
+   free(codec->source);
+   codec->source = NULL;
+   if (source != NULL)
+   {
+      codec->source = pgmoneta_append(codec->source, source);
+   }
+
+   switch (codec->type)
+   {
+      case COMPRESSION_CLIENT_GZIP:
+         z = (z_stream*)codec->context;
+         if (codec->active)
+         {
+            // the context is kept between streams, only its state is reset
+            if (codec->compress)
+            {
+               ret = deflateReset(z);
+               if (ret == Z_OK)
+               {
+                  ret = deflateParams(z, codec->level, Z_DEFAULT_STRATEGY);
+               }
+            }
+            else
+            {
+               ret = inflateReset(z);
+            }
+         }
+         else
+         {
+            memset(z, 0, sizeof(z_stream));
+            if (codec->compress)
+            {
+               ret = deflateInit2(z, codec->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+            }
+            else
+            {
+               ret = inflateInit2(z, 15 + 32);
+            }
+         }
+         if (ret != Z_OK)
+         {
+            codec->active = false;
+            goto error;
+         }
+         codec->active = true;
+         break;
+      case COMPRESSION_CLIENT_ZSTD:
+         codec->active = false;
+         if (codec->compress)
+         {
+            ZSTD_CCtx_reset((ZSTD_CCtx*)codec->context, ZSTD_reset_session_and_parameters);
+            ZSTD_CCtx_setParameter((ZSTD_CCtx*)codec->context, ZSTD_c_compressionLevel, codec->level);
+            ZSTD_CCtx_setParameter((ZSTD_CCtx*)codec->context, ZSTD_c_checksumFlag, 1);
+         }
+         else
+         {
+            ZSTD_DCtx_reset((ZSTD_DCtx*)codec->context, ZSTD_reset_session_and_parameters);
+         }
+         break;
+      case COMPRESSION_CLIENT_LZ4:
+         codec->active = false;
+         if (codec->compress)
+         {
+            LZ4_resetStream_fast((LZ4_stream_t*)codec->context);
+         }
+         else
+         {
+            LZ4_setStreamDecode((LZ4_streamDecode_t*)codec->context, NULL, 0);
+         }
+         break;
+      default:
+         bz = (bz_stream*)codec->context;
+         // bzip2 has no reset, so the stream is ended and started again
+         if (codec->active)
+         {
+            if (codec->compress)
+            {
+               BZ2_bzCompressEnd(bz);
+            }
+            else
+            {
+               BZ2_bzDecompressEnd(bz);
+            }
+            codec->active = false;
+         }
+         memset(bz, 0, sizeof(bz_stream));
+         if (codec->compress)
+         {
+            ret = BZ2_bzCompressInit(bz, codec->level, 0, 0);
+         }
+         else
+         {
+            ret = BZ2_bzDecompressInit(bz, 0, 0);
+         }
+         if (ret != BZ_OK)
+         {
+            goto error;
+         }
+         codec->active = true;
+         break;
+   }
+
+   return 0;
+
+error:
+
+   pgmoneta_log_error("Codec: Could not start a stream");
+
+   return 1;
+}
+
+int
+pgmoneta_codec_update(struct codec* codec, void* data, size_t size)
+{
+   switch (codec->type)
+   {
+      case COMPRESSION_CLIENT_GZIP:
+         return codec->compress ? gzip_compress(codec, data, size, Z_NO_FLUSH) : gzip_decompress(codec, data, size);
+      case COMPRESSION_CLIENT_ZSTD:
+         return codec->compress ? zstd_compress(codec, data, size, ZSTD_e_continue) : zstd_decompress(codec, data, size);
+      case COMPRESSION_CLIENT_LZ4:
+         return codec->compress ? lz4_compress(codec, data, size) : lz4_decompress(codec, data, size);
+      default:
+         return codec->compress ? bzip2_compress(codec, data, size, BZ_RUN) : bzip2_decompress(codec, data, size);
+   }
+}
+
+int
+pgmoneta_codec_flush(struct codec* codec)
+{
+   // decompressed data is passed on as soon as it is produced
+   if (!codec->compress)
+   {
+      return 0;
+   }
+
+   switch (codec->type)
+   {
+      case COMPRESSION_CLIENT_GZIP:
+         return gzip_compress(codec, NULL, 0, Z_SYNC_FLUSH);
+      case COMPRESSION_CLIENT_ZSTD:
+         return zstd_compress(codec, NULL, 0, ZSTD_e_flush);
+      case COMPRESSION_CLIENT_LZ4:
+         return codec->in_pos > 0 ? lz4_block(codec) : 0;
+      default:
+         return bzip2_compress(codec, NULL, 0, BZ_FLUSH);
+   }
+}
+
+int
+pgmoneta_codec_finish(struct codec* codec)
+{
+   if (codec->compress)
+   {
+      switch (codec->type)
+      {
+         case COMPRESSION_CLIENT_GZIP:
+            return gzip_compress(codec, NULL, 0, Z_FINISH);
+         case COMPRESSION_CLIENT_ZSTD:
+            return zstd_compress(codec, NULL, 0, ZSTD_e_end);
+         case COMPRESSION_CLIENT_LZ4:
+            return codec->in_pos > 0 ? lz4_block(codec) : 0;
+         default:
+            return bzip2_compress(codec, NULL, 0, BZ_FINISH);
+      }
+   }
+
+   switch (codec->type)
+   {
+      case COMPRESSION_CLIENT_ZSTD:
+         if (codec->pending != 0)
+         {
+            goto error;
+         }
+         break;
+      case COMPRESSION_CLIENT_LZ4:
+         if (!codec->end && (codec->pending != 0 || codec->in_pos != 0))
+         {
+            goto error;
+         }
+         break;
+      default:
+         if (!codec->end)
+         {
+            goto error;
+         }
+         break;
+   }
+
+   return 0;
+
+error:
+
+   pgmoneta_log_error("Codec: Incomplete or corrupted stream %s", codec->source != NULL ? codec->source : "");
+
+   return 1;
+}
+
+void
+pgmoneta_codec_destroy(struct codec* codec)
+{
+   if (codec == NULL)
+   {
+      return;
+   }
+
+   if (codec->context != NULL)
+   {
+      switch (codec->type)
+      {
+         case COMPRESSION_CLIENT_GZIP:
+            if (codec->active)
+            {
+               if (codec->compress)
+               {
+                  deflateEnd((z_stream*)codec->context);
+               }
+               else
+               {
+                  inflateEnd((z_stream*)codec->context);
+               }
+            }
+            free(codec->context);
+            break;
+         case COMPRESSION_CLIENT_ZSTD:
+            if (codec->compress)
+            {
+               ZSTD_freeCCtx((ZSTD_CCtx*)codec->context);
+            }
+            else
+            {
+               ZSTD_freeDCtx((ZSTD_DCtx*)codec->context);
+            }
+            break;
+         case COMPRESSION_CLIENT_LZ4:
+            if (codec->compress)
+            {
+               LZ4_freeStream((LZ4_stream_t*)codec->context);
+            }
+            else
+            {
+               LZ4_freeStreamDecode((LZ4_streamDecode_t*)codec->context);
+            }
+            break;
+         default:
+            if (codec->active)
+            {
+               if (codec->compress)
+               {
+                  BZ2_bzCompressEnd((bz_stream*)codec->context);
+               }
+               else
+               {
+                  BZ2_bzDecompressEnd((bz_stream*)codec->context);
+               }
+            }
+            free(codec->context);
+            break;
+      }
+   }
+
+   free(codec->in);
+   free(codec->out);
+   free(codec->source);
+   free(codec);
+}
+
+int
+pgmoneta_codec_file(int type, bool compress, int level, char* from, char* to)
+{
+   if (stream_file(type, compress, level, -1, from, to, NULL))
+   {
+      return 1;
+   }
+
+   // WAL segments are archived without their zero-filled tail, so every decompression pads them
+   if (!compress && pgmoneta_wal_pad_file(to))
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+int
+pgmoneta_codec_dictionary_file(int dictionary, int level, char* from, char* to, uint32_t* id)
+{
+   return stream_file(COMPRESSION_CLIENT_ZSTD, true, level, dictionary, from, to, id);
+}
+
+static int
+codec_index(int type)
+{
+   switch (type)
+   {
+      case COMPRESSION_CLIENT_GZIP:
+      case COMPRESSION_SERVER_GZIP:
+         return 0;
+      case COMPRESSION_CLIENT_ZSTD:
+      case COMPRESSION_SERVER_ZSTD:
+         return 1;
+      case COMPRESSION_CLIENT_LZ4:
+      case COMPRESSION_SERVER_LZ4:
+         return 2;
+      case COMPRESSION_CLIENT_BZIP2:
+         return 3;
+      default:
+         return -1;
+   }
+}
+
+static int
+codec_level(int type, int level)
+{
+   int max;
+
+   switch (type)
+   {
+      case COMPRESSION_CLIENT_ZSTD:
+         max = 19;
+         break;
+      case COMPRESSION_CLIENT_LZ4:
+         // lz4 blocks are always compressed with the default acceleration
+         return 1;
+      default:
+         max = 9;
+         break;
+   }
+
+   if (level < 1)
+   {
+      return 1;
+   }
+   else if (level > max)
+   {
+      return max;
+   }
+
+   return level;
+}
+
+static void
+codec_key_create(void)
+{
+   pthread_key_create(&codec_key, codec_cache_destroy);
+}
+
+static void
+codec_cache_destroy(void* cache)
+{
+   struct codec** codecs = (struct codec**)cache;
+
+   for (int i = 0; i < CODEC_TYPES * 2; i++)
+   {
+      pgmoneta_codec_destroy(codecs[i]);
+   }
+
+   free(codecs);
+}
+
+static int
+stream_file(int type, bool compress, int level, int dictionary, char* from, char* to, uint32_t* id)
+{
+   char buffer[CODEC_BUFFER_SIZE];
+   struct codec* codec = NULL;
+   FILE* in = NULL;
+   FILE* out = NULL;
+   size_t length;
+
+   if (pgmoneta_codec_get(type, compress, &codec))
+   {
+      goto error;
+   }
+
+   in = fopen(from, "rb");
+   if (in == NULL)
+   {
+      goto error;
+   }
+
+   out = fopen(to, "wb");
+   if (out == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_codec_init(codec, level, from, file_output, out))
+   {
+      goto error;
+   }
+
+   if (dictionary != -1 &&
+       pgmoneta_dictionary_compress(from, dictionary, codec->level, (ZSTD_CCtx*)codec->context, id))
+   {
+      goto error;
+   }
+
+   while ((length = fread(&buffer[0], 1, sizeof(buffer), in)) > 0)
+   {
+      if (pgmoneta_codec_update(codec, &buffer[0], length))
+      {
+         goto error;
+      }
+   }
+
+   if (ferror(in))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_codec_finish(codec))
+   {
+      goto error;
+   }
+
+   fclose(in);
+   in = NULL;
+
+   if (fclose(out) != 0)
+   {
+      out = NULL;
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   if (in != NULL)
+   {
+      fclose(in);
+   }
+
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+
+   return 1;
+}
+
+static int
+emit(struct codec* codec, void* buffer, size_t size)
+{
+   if (size == 0)
+   {
+      return 0;
+   }
+
+   return codec->output(codec->output_data, buffer, size);
+}
+
+static int
+file_output(void* data, void* buffer, size_t size)
+{
+   FILE* out = (FILE*)data;
+
+   if (fwrite(buffer, 1, size, out) != size)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+gzip_compress(struct codec* codec, void* data, size_t size, int flush)
+{
+   z_stream* z = (z_stream*)codec->context;
+   int ret;
+
+   z->next_in = (Bytef*)data;
+   z->avail_in = (uInt)size;
+
+   do
+   {
+      z->next_out = (Bytef*)codec->out;
+      z->avail_out = (uInt)codec->out_size;
+
+      ret = deflate(z, flush);
+      if (ret == Z_STREAM_ERROR)
+      {
+         pgmoneta_log_error("Gzip: Compression error");
+         goto error;
+      }
+
+      if (emit(codec, codec->out, codec->out_size - z->avail_out))
+      {
+         goto error;
+      }
+   }
+   while (z->avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+gzip_decompress(struct codec* codec, void* data, size_t size)
+{
+   z_stream* z = (z_stream*)codec->context;
+   int ret;
+
+   z->next_in = (Bytef*)data;
+   z->avail_in = (uInt)size;
+
+   for (;;)
+   {
+      if (codec->end)
+      {
+         if (z->avail_in == 0)
+         {
+            break;
+         }
+
+         // another gzip member follows the one that ended
+         if (inflateReset(z) != Z_OK)
+         {
+            goto error;
+         }
+         codec->end = false;
+      }
+
+      z->next_out = (Bytef*)codec->out;
+      z->avail_out = (uInt)codec->out_size;
+
+      ret = inflate(z, Z_NO_FLUSH);
+      if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+      {
+         pgmoneta_log_error("Gzip: Decompression error: %s", z->msg != NULL ? z->msg : "");
+         goto error;
+      }
+
+      if (emit(codec, codec->out, codec->out_size - z->avail_out))
+      {
+         goto error;
+      }
+
+      if (ret == Z_STREAM_END)
+      {
+         codec->end = true;
+      }
+      else if (z->avail_in == 0 && z->avail_out != 0)
+      {
+         break;
+      }
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+zstd_compress(struct codec* codec, void* data, size_t size, ZSTD_EndDirective mode)
+{
+   ZSTD_inBuffer input = {data, size, 0};
+   size_t remaining;
+   bool finished;
+
+   do
+   {
+      ZSTD_outBuffer output = {codec->out, codec->out_size, 0};
+
+      remaining = ZSTD_compressStream2((ZSTD_CCtx*)codec->context, &output, &input, mode);
+      if (ZSTD_isError(remaining))
+      {
+         pgmoneta_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(remaining));
+         goto error;
+      }
+
+      if (emit(codec, codec->out, output.pos))
+      {
+         goto error;
+      }
+
+      finished = mode == ZSTD_e_continue ? input.pos == input.size : remaining == 0;
+   }
+   while (!finished);
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+zstd_decompress(struct codec* codec, void* data, size_t size)
+{
+   ZSTD_DCtx* dctx = (ZSTD_DCtx*)codec->context;
+   ZSTD_inBuffer input = {data, size, 0};
+   ZSTD_outBuffer output;
+   size_t ret;
+
+   if (size == 0)
+   {
+      return 0;
+   }
+
+   if (!codec->active)
+   {
+      // the frame header tells which dictionary, if any, the stream was compressed with
+      if (pgmoneta_dictionary_decompress(codec->source != NULL ? codec->source : "",
+                                         ZSTD_getDictID_fromFrame(data, size), dctx))
+      {
+         goto error;
+      }
+      codec->active = true;
+   }
+
+   do
+   {
+      output.dst = codec->out;
+      output.size = codec->out_size;
+      output.pos = 0;
+
+      ret = ZSTD_decompressStream(dctx, &output, &input);
+      if (ZSTD_isError(ret))
+      {
+         pgmoneta_log_error("ZSTD: Decompression error: %s", ZSTD_getErrorName(ret));
+         goto error;
+      }
+
+      if (emit(codec, codec->out, output.pos))
+      {
+         goto error;
+      }
+
+      codec->pending = ret;
+   }
+   while (input.pos < input.size || output.pos == output.size);
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+lz4_compress(struct codec* codec, void* data, size_t size)
+{
+   char* p = (char*)data;
+   size_t n;
+
+   while (size > 0)
+   {
+      n = BLOCK_BYTES - codec->in_pos;
+      if (n > size)
+      {
+         n = size;
+      }
+
+      memcpy(codec->in + codec->index * BLOCK_BYTES + codec->in_pos, p, n);
+      codec->in_pos += n;
+      p += n;
+      size -= n;
+
+      if (codec->in_pos == BLOCK_BYTES && lz4_block(codec))
+      {
+         goto error;
+      }
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+lz4_block(struct codec* codec)
+{
+   int compressed;
+
+   // blocks refer to the block before them, so the two halves of the buffer alternate
+   compressed = LZ4_compress_fast_continue((LZ4_stream_t*)codec->context,
+                                           codec->in + codec->index * BLOCK_BYTES,
+                                           codec->out + sizeof(int), (int)codec->in_pos,
+                                           LZ4_COMPRESSBOUND(BLOCK_BYTES), 1);
+   if (compressed <= 0)
+   {
+      pgmoneta_log_error("LZ4: Compression error");
+      goto error;
+   }
+
+   memcpy(codec->out, &compressed, sizeof(int));
+
+   if (emit(codec, codec->out, sizeof(int) + (size_t)compressed))
+   {
+      goto error;
+   }
+
+   codec->index = (codec->index + 1) % 2;
+   codec->in_pos = 0;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+lz4_decompress(struct codec* codec, void* data, size_t size)
+{
+   char* p = (char*)data;
+   char* block = NULL;
+   size_t n;
+   int compressed;
+   int decompressed;
+
+   while (size > 0 && !codec->end)
+   {
+      n = codec->in_need - codec->in_pos;
+      if (n > size)
+      {
+         n = size;
+      }
+
+      memcpy(codec->in + codec->in_pos, p, n);
+      codec->in_pos += n;
+      p += n;
+      size -= n;
+
+      if (codec->in_pos < codec->in_need)
+      {
+         break;
+      }
+
+      codec->in_pos = 0;
+
+      if (codec->pending == 0)
+      {
+         memcpy(&compressed, codec->in, sizeof(int));
+
+         // a zero size ends the blocks, the seek table of seekable files follows it
+         if (compressed == 0)
+         {
+            codec->end = true;
+            break;
+         }
+
+         if (compressed < 0 || (size_t)compressed > codec->in_size)
+         {
+            pgmoneta_log_error("LZ4: Invalid block size %d", compressed);
+            goto error;
+         }
+
+         codec->pending = (size_t)compressed;
+         codec->in_need = (size_t)compressed;
+      }
+      else
+      {
+         block = codec->out + codec->index * BLOCK_BYTES;
+
+         decompressed = LZ4_decompress_safe_continue((LZ4_streamDecode_t*)codec->context, codec->in, block,
+                                                     (int)codec->pending, BLOCK_BYTES);
+         if (decompressed < 0)
+         {
+            pgmoneta_log_error("LZ4: Decompression error");
+            goto error;
+         }
+
+         if (emit(codec, block, (size_t)decompressed))
+         {
+            goto error;
+         }
+
+         codec->index = (codec->index + 1) % 2;
+         codec->pending = 0;
+         codec->in_need = sizeof(int);
+      }
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+bzip2_compress(struct codec* codec, void* data, size_t size, int action)
+{
+   bz_stream* bz = (bz_stream*)codec->context;
+   int ret;
+   bool finished;
+
+   bz->next_in = (char*)data;
+   bz->avail_in = (unsigned int)size;
+
+   do
+   {
+      bz->next_out = codec->out;
+      bz->avail_out = (unsigned int)codec->out_size;
+
+      ret = BZ2_bzCompress(bz, action);
+      if (ret < 0)
+      {
+         pgmoneta_log_error("Bzip2: Compression error %d", ret);
+         goto error;
+      }
+
+      if (emit(codec, codec->out, codec->out_size - bz->avail_out))
+      {
+         goto error;
+      }
+
+      if (action == BZ_RUN)
+      {
+         finished = bz->avail_in == 0;
+      }
+      else if (action == BZ_FLUSH)
+      {
+         finished = ret == BZ_RUN_OK;
+      }
+      else
+      {
+         finished = ret == BZ_STREAM_END;
+      }
+   }
+   while (!finished);
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+bzip2_decompress(struct codec* codec, void* data, size_t size)
+{
+   bz_stream* bz = (bz_stream*)codec->context;
+   char* next_in = NULL;
+   unsigned int avail_in;
+   int ret;
+
+   bz->next_in = (char*)data;
+   bz->avail_in = (unsigned int)size;
+
+   for (;;)
+   {
+      if (codec->end)
+      {
+         if (bz->avail_in == 0)
+         {
+            break;
+         }
+
+         // another bzip2 stream follows the one that ended
+         next_in = bz->next_in;
+         avail_in = bz->avail_in;
+
+         BZ2_bzDecompressEnd(bz);
+         memset(bz, 0, sizeof(bz_stream));
+         codec->active = false;
+
+         if (BZ2_bzDecompressInit(bz, 0, 0) != BZ_OK)
+         {
+            goto error;
+         }
+         codec->active = true;
+         codec->end = false;
+
+         bz->next_in = next_in;
+         bz->avail_in = avail_in;
+      }
+
+      bz->next_out = codec->out;
+      bz->avail_out = (unsigned int)codec->out_size;
+
+      ret = BZ2_bzDecompress(bz);
+      if (ret != BZ_OK && ret != BZ_STREAM_END)
+      {
+         pgmoneta_log_error("Bzip2: Decompression error %d", ret);
+         goto error;
+      }
+
+      if (emit(codec, codec->out, codec->out_size - bz->avail_out))
+      {
+         goto error;
+      }
+
+      if (ret == BZ_STREAM_END)
+      {
+         codec->end = true;
+      }
+      else if (bz->avail_in == 0 && bz->avail_out != 0)
+      {
+         break;
+      }
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
@@ -34,6 +34,20 @@
 #include <utils.h>
 #include <zstandard_compression.h>
 
+/* system */
+#include <bzlib.h>
+#include <lz4.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <zstd.h>
+
+static int compression_sample(int compression, int level, void* in, size_t in_size,
+                              void* out, size_t out_capacity, size_t* out_size, double* cpu);
+static double compression_cpu_time(void);
+
 static int
 pgmoneta_decompression_file_callback(char* path, compression_func* decompress_cb)
 {
@@ -70,7 +84,198 @@ pgmoneta_decompress(char* from, char* to)
       pgmoneta_log_error("pgmoneta_decompress: no decompression callback found for file %s", from);
       goto error;
    }
-   return decompress_cb(from, to);
+   // the decompression also pads WAL segments back to their segment size
+   if (decompress_cb(from, to))
+   {
+      goto error;
+   }
+
+   return 0;
 error:
    return 1;
 }
+
+int
+pgmoneta_compression_decide(char* path, int compression, int* level)
+{
+   int decision = COMPRESSION_DECISION_HIGH;
+   int fast;
+   size_t n = 0;
+   size_t out_capacity = 0;
+   size_t fast_size = 0;
+   size_t high_size = 0;
+   double fast_cpu = 0.0;
+   double high_cpu = 0.0;
+   double cost = 0.0;
+   char* in = NULL;
+   char* out = NULL;
+   FILE* file = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (!config->compression_adaptive)
+   {
+      return COMPRESSION_DECISION_HIGH;
+   }
+
+   in = (char*)malloc(COMPRESSION_SAMPLE_SIZE);
+   // large enough for the worst case of every codec
+   out_capacity = MAX(ZSTD_compressBound(COMPRESSION_SAMPLE_SIZE), compressBound(COMPRESSION_SAMPLE_SIZE));
+   out_capacity = MAX(out_capacity, (size_t)LZ4_COMPRESSBOUND(COMPRESSION_SAMPLE_SIZE));
+   out_capacity = MAX(out_capacity, COMPRESSION_SAMPLE_SIZE + COMPRESSION_SAMPLE_SIZE / 100 + 600);
+   out = (char*)malloc(out_capacity);
+
+   if (in == NULL || out == NULL)
+   {
+      goto done;
+   }
+
+   file = fopen(path, "rb");
+   if (file == NULL)
+   {
+      goto done;
+   }
+
+   n = fread(in, 1, COMPRESSION_SAMPLE_SIZE, file);
+   if (ferror(file))
+   {
+      goto done;
+   }
+
+   if (n == 0)
+   {
+      decision = COMPRESSION_DECISION_STORE;
+      goto done;
+   }
+
+   fast = COMPRESSION_FAST_LEVEL;
+
+   if (compression_sample(compression, fast, in, n, out, out_capacity, &fast_size, &fast_cpu))
+   {
+      goto done;
+   }
+
+   if ((double)fast_size >= (double)n * COMPRESSION_STORE_RATIO)
+   {
+      decision = COMPRESSION_DECISION_STORE;
+      goto done;
+   }
+
+   // lz4 data files don't have levels, and a low configured level is as cheap as it gets
+   if (compression == COMPRESSION_CLIENT_LZ4 || compression == COMPRESSION_SERVER_LZ4 || *level <= fast)
+   {
+      decision = COMPRESSION_DECISION_FAST;
+      goto done;
+   }
+
+   if (compression_sample(compression, *level, in, n, out, out_capacity, &high_size, &high_cpu))
+   {
+      goto done;
+   }
+
+   cost = high_cpu * (1024.0 * 1024.0 * 1024.0) / (double)n;
+
+   if ((config->compression_budget > 0 && cost > (double)config->compression_budget) ||
+       (double)fast_size - (double)high_size < (double)n * COMPRESSION_HIGH_GAIN)
+   {
+      decision = COMPRESSION_DECISION_FAST;
+      *level = fast;
+   }
+
+done:
+
+   pgmoneta_log_trace("Compression: %s %s (level %d, sample %zu, fast %zu, high %zu, %.2f s/GB)", path,
+                      decision == COMPRESSION_DECISION_STORE ? "store" : decision == COMPRESSION_DECISION_FAST ? "fast" : "high",
+                      *level, n, fast_size, high_size, cost);
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   free(in);
+   free(out);
+
+   return decision;
+}
+
+static int
+compression_sample(int compression, int level, void* in, size_t in_size,
+                   void* out, size_t out_capacity, size_t* out_size, double* cpu)
+{
+   double start;
+
+   *out_size = 0;
+   *cpu = 0.0;
+
+   start = compression_cpu_time();
+
+   switch (compression)
+   {
+      case COMPRESSION_CLIENT_ZSTD:
+      case COMPRESSION_SERVER_ZSTD:
+      {
+         size_t ret = ZSTD_compress(out, out_capacity, in, in_size, level);
+
+         if (ZSTD_isError(ret))
+         {
+            return 1;
+         }
+         *out_size = ret;
+         break;
+      }
+      case COMPRESSION_CLIENT_GZIP:
+      case COMPRESSION_SERVER_GZIP:
+      {
+         uLongf length = (uLongf)out_capacity;
+
+         if (compress2(out, &length, in, (uLong)in_size, level) != Z_OK)
+         {
+            return 1;
+         }
+         *out_size = (size_t)length;
+         break;
+      }
+      case COMPRESSION_CLIENT_LZ4:
+      case COMPRESSION_SERVER_LZ4:
+      {
+         int ret = LZ4_compress_default(in, out, (int)in_size, (int)out_capacity);
+
+         if (ret <= 0)
+         {
+            return 1;
+         }
+         *out_size = (size_t)ret;
+         break;
+      }
+      case COMPRESSION_CLIENT_BZIP2:
+      {
+         unsigned int length = (unsigned int)out_capacity;
+
+         if (BZ2_bzBuffToBuffCompress(out, &length, in, (unsigned int)in_size, level, 0, 30) != BZ_OK)
+         {
+            return 1;
+         }
+         *out_size = (size_t)length;
+         break;
+      }
+      default:
+         return 1;
+   }
+
+   *cpu = compression_cpu_time() - start;
+
+   return 0;
+}
+
+static double
+compression_cpu_time(void)
+{
+   struct timespec ts;
+
+   // workers are threads, so only count the time of the calling one
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+   return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
@@ -30,6 +30,7 @@
 #include <pgmoneta.h>
 #include <aes.h>
 #include <configuration.h>
+#include <dedup.h>
 #include <logging.h>
 #include <management.h>
 #include <network.h>
@@ -72,6 +73,7 @@ static int as_storage_engine(char* str);
 static char* as_ciphers(char* str);
 static int as_encryption_mode(char* str);
 static unsigned int as_update_process_title(char* str, unsigned int default_policy);
+static int as_wal_flush(char* str, int* policy);
 static int as_logging_rotation_size(char* str, int* size);
 static int as_seconds(char* str, int* age, int default_age);
 static int as_bytes(char* str, int* bytes, int default_bytes);
@@ -109,6 +111,9 @@ pgmoneta_init_main_configuration(void* shm)
 
    config->compression_type = COMPRESSION_CLIENT_ZSTD;
    config->compression_level = 3;
+   config->compression_adaptive = false;
+   config->compression_budget = 0;
+   config->compression_dictionary = false;
 
    config->encryption = ENCRYPTION_NONE;
 
@@ -148,6 +153,18 @@ pgmoneta_init_main_configuration(void* shm)
 
    config->verification = 0;
 
+   config->pipeline = false;
+
+   config->dedup_chunk_size = 0;
+
+   config->wal_summary = false;
+
+   config->wal_flush = WAL_FLUSH_GROUP;
+   config->wal_flush_delay = DEFAULT_WAL_FLUSH_DELAY;
+   config->wal_flush_size = DEFAULT_WAL_FLUSH_SIZE;
+   config->wal_receivers = 0;
+   config->wal_prefetch = DEFAULT_WAL_PREFETCH;
+
 #ifdef DEBUG
    config->link = true;
 #endif
@@ -238,12 +255,20 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                   srv.active_delete = false;
                   srv.active_retention = false;
                   srv.wal_streaming = false;
+                  srv.wal_receiver = -1;
                   srv.valid = false;
                   srv.cur_timeline = 1;
                   atomic_init(&srv.operation_count, 0);
                   atomic_init(&srv.failed_operation_count, 0);
                   atomic_init(&srv.last_operation_time, 0);
                   atomic_init(&srv.last_failed_operation_time, 0);
+                  atomic_init(&srv.backup_network_stalls, 0);
+                  atomic_init(&srv.backup_disk_stalls, 0);
+                  for (int j = 0; j < WAL_TARGETS; j++)
+                  {
+                     atomic_init(&srv.wal_target_lag[j], 0);
+                     atomic_init(&srv.wal_target_stalls[j], 0);
+                  }
                   memset(srv.wal_shipping, 0, MAX_PATH);
                   srv.workers = -1;
                   srv.backup_max_rate = -1;
@@ -1081,6 +1106,48 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "compression_adaptive"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->compression_adaptive))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "compression_budget"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->compression_budget))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "compression_dictionary"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->compression_dictionary))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "storage_engine"))
                {
                   if (!strcmp(section, "pgmoneta"))
@@ -1464,6 +1531,118 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "pipeline"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->pipeline))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "dedup_chunk_size"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->dedup_chunk_size, 0))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_summary"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->wal_summary))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_flush"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_wal_flush(value, &config->wal_flush))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_flush_delay"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->wal_flush_delay))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_flush_size"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->wal_flush_size, DEFAULT_WAL_FLUSH_SIZE))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_receivers"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->wal_receivers))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_prefetch"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->wal_prefetch))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
 #ifdef DEBUG
                else if (!strcmp(key, "link"))
                {
@@ -1704,6 +1883,69 @@ pgmoneta_validate_main_configuration(void* shm)
       config->workers = 0;
    }
 
+   if (config->compression_budget < 0)
+   {
+      config->compression_budget = 0;
+   }
+
+   if (config->compression_dictionary &&
+       config->compression_type != COMPRESSION_CLIENT_ZSTD && config->compression_type != COMPRESSION_SERVER_ZSTD)
+   {
+      pgmoneta_log_warn("pgmoneta: compression_dictionary is only used with zstd compression");
+   }
+
+   if (config->pipeline && pgmoneta_is_gcm_mode(config->encryption))
+   {
+      pgmoneta_log_warn("pgmoneta: pipeline is not used with the GCM encryption modes");
+   }
+
+   if (config->dedup_chunk_size != 0 && !pgmoneta_dedup_valid_chunk_size(config->dedup_chunk_size))
+   {
+      pgmoneta_log_fatal("pgmoneta: dedup_chunk_size must be a power of two between %d and %d bytes",
+                         DEDUP_MIN_CHUNK_SIZE, DEDUP_MAX_CHUNK_SIZE);
+      return 1;
+   }
+
+   if (config->dedup_chunk_size != 0 &&
+       (config->storage_engine & (STORAGE_ENGINE_SSH | STORAGE_ENGINE_S3 | STORAGE_ENGINE_AZURE)))
+   {
+      pgmoneta_log_warn("pgmoneta: dedup_chunk_size is only supported for local storage");
+   }
+
+   if (config->wal_summary && (config->storage_engine & (STORAGE_ENGINE_SSH | STORAGE_ENGINE_S3 | STORAGE_ENGINE_AZURE)))
+   {
+      pgmoneta_log_warn("pgmoneta: wal_summary only summarizes the local WAL archive");
+   }
+
+   if (config->wal_flush_delay < 0)
+   {
+      pgmoneta_log_fatal("pgmoneta: wal_flush_delay can't be negative");
+      return 1;
+   }
+
+   if (config->wal_flush_size < 0)
+   {
+      pgmoneta_log_fatal("pgmoneta: wal_flush_size can't be negative");
+      return 1;
+   }
+
+   if (config->wal_receivers < 0)
+   {
+      pgmoneta_log_fatal("pgmoneta: wal_receivers can't be negative");
+      return 1;
+   }
+
+   if (config->wal_receivers > 0 && (config->storage_engine & STORAGE_ENGINE_SSH))
+   {
+      pgmoneta_log_warn("pgmoneta: wal_receivers isn't supported with the ssh storage engine, a process is used for each server");
+   }
+
+   if (config->wal_prefetch < 0)
+   {
+      pgmoneta_log_fatal("pgmoneta: wal_prefetch can't be negative");
+      return 1;
+   }
+
    if (strlen(config->metrics_cert_file) > 0)
    {
       if (!pgmoneta_exists(config->metrics_cert_file))
@@ -2538,6 +2780,9 @@ add_configuration_response(struct json* res)
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_MANAGEMENT, (uintptr_t)config->management, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPRESSION, (uintptr_t)config->compression_type, ValueInt32);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPRESSION_LEVEL, (uintptr_t)config->compression_level, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPRESSION_ADAPTIVE, (uintptr_t)config->compression_adaptive, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPRESSION_BUDGET, (uintptr_t)config->compression_budget, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPRESSION_DICTIONARY, (uintptr_t)config->compression_dictionary, ValueBool);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WORKERS, (uintptr_t)config->workers, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_STORAGE_ENGINE, (uintptr_t)config->storage_engine, ValueInt32);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_ENCRYPTION, (uintptr_t)config->encryption, ValueInt32);
@@ -2587,6 +2832,14 @@ add_configuration_response(struct json* res)
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_USER_CONF_PATH, (uintptr_t)config->common.users_path, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_ADMIN_CONF_PATH, (uintptr_t)config->common.admins_path, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_VERIFICATION, (uintptr_t)config->verification, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_PIPELINE, (uintptr_t)config->pipeline, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_DEDUP_CHUNK_SIZE, (uintptr_t)config->dedup_chunk_size, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_SUMMARY, (uintptr_t)config->wal_summary, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_FLUSH, (uintptr_t)(config->wal_flush == WAL_FLUSH_SYNC ? "sync" : "group"), ValueString);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_FLUSH_DELAY, (uintptr_t)config->wal_flush_delay, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_FLUSH_SIZE, (uintptr_t)config->wal_flush_size, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_RECEIVERS, (uintptr_t)config->wal_receivers, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_PREFETCH, (uintptr_t)config->wal_prefetch, ValueInt64);
 
    free(ret);
 }
@@ -3395,6 +3648,30 @@ pgmoneta_conf_set(SSL* ssl, int client_fd, uint8_t compression, uint8_t encrypti
          }
          pgmoneta_json_put(response, key, (uintptr_t)config->compression_level, ValueInt32);
       }
+      else if (!strcmp(key, "compression_adaptive"))
+      {
+         if (as_bool(config_value, &config->compression_adaptive))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->compression_adaptive, ValueBool);
+      }
+      else if (!strcmp(key, "compression_budget"))
+      {
+         if (as_int(config_value, &config->compression_budget))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->compression_budget, ValueInt32);
+      }
+      else if (!strcmp(key, "compression_dictionary"))
+      {
+         if (as_bool(config_value, &config->compression_dictionary))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->compression_dictionary, ValueBool);
+      }
       else if (!strcmp(key, "storage_engine"))
       {
          config->storage_engine = as_storage_engine(config_value);
@@ -3635,6 +3912,101 @@ pgmoneta_conf_set(SSL* ssl, int client_fd, uint8_t compression, uint8_t encrypti
          }
          pgmoneta_json_put(response, key, (uintptr_t)config->verification, ValueInt32);
       }
+      else if (!strcmp(key, "pipeline"))
+      {
+         if (as_bool(config_value, &config->pipeline))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->pipeline, ValueBool);
+      }
+      else if (!strcmp(key, "dedup_chunk_size"))
+      {
+         int chunk_size = 0;
+
+         if (as_bytes(config_value, &chunk_size, 0) ||
+             (chunk_size != 0 && !pgmoneta_dedup_valid_chunk_size(chunk_size)))
+         {
+            unknown = true;
+         }
+         else
+         {
+            config->dedup_chunk_size = chunk_size;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->dedup_chunk_size, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_summary"))
+      {
+         if (as_bool(config_value, &config->wal_summary))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_summary, ValueBool);
+      }
+      else if (!strcmp(key, "wal_flush"))
+      {
+         if (as_wal_flush(config_value, &config->wal_flush))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)(config->wal_flush == WAL_FLUSH_SYNC ? "sync" : "group"), ValueString);
+      }
+      else if (!strcmp(key, "wal_flush_delay"))
+      {
+         int delay = 0;
+
+         if (as_int(config_value, &delay) || delay < 0)
+         {
+            unknown = true;
+         }
+         else
+         {
+            config->wal_flush_delay = delay;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_flush_delay, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_flush_size"))
+      {
+         int size = 0;
+
+         if (as_bytes(config_value, &size, DEFAULT_WAL_FLUSH_SIZE) || size < 0)
+         {
+            unknown = true;
+         }
+         else
+         {
+            config->wal_flush_size = size;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_flush_size, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_receivers"))
+      {
+         int receivers = 0;
+
+         if (as_int(config_value, &receivers) || receivers < 0)
+         {
+            unknown = true;
+         }
+         else
+         {
+            config->wal_receivers = receivers;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_receivers, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_prefetch"))
+      {
+         int prefetch = 0;
+
+         if (as_int(config_value, &prefetch) || prefetch < 0)
+         {
+            unknown = true;
+         }
+         else
+         {
+            config->wal_prefetch = prefetch;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_prefetch, ValueInt64);
+      }
       else
       {
          unknown = true;
@@ -4512,6 +4884,36 @@ as_update_process_title(char* str, unsigned int default_policy)
    return default_policy;
 }
 
+/**
+ * Parse the WAL flush policy
+ * @param str The value
+ * @param policy The resulting policy
+ * @return 0 upon success, otherwise 1
+ */
+static int
+as_wal_flush(char* str, int* policy)
+{
+   if (is_empty_string(str))
+   {
+      return 1;
+   }
+
+   if (!strcasecmp(str, "group"))
+   {
+      *policy = WAL_FLUSH_GROUP;
+   }
+   else if (!strcasecmp(str, "sync"))
+   {
+      *policy = WAL_FLUSH_SYNC;
+   }
+   else
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
 /**
  * Parses a string to see if it contains
  * a valid value for log rotation size.
@@ -4772,6 +5174,21 @@ as_encryption_mode(char* str)
       return ENCRYPTION_AES_128_CTR;
    }
 
+   if (!strcasecmp(str, "aes-256-gcm"))
+   {
+      return ENCRYPTION_AES_256_GCM;
+   }
+
+   if (!strcasecmp(str, "aes-192-gcm"))
+   {
+      return ENCRYPTION_AES_192_GCM;
+   }
+
+   if (!strcasecmp(str, "aes-128-gcm"))
+   {
+      return ENCRYPTION_AES_128_GCM;
+   }
+
    warnx("Unknown encryption mode: %s", str);
 
    return ENCRYPTION_NONE;
@@ -4868,6 +5285,9 @@ transfer_configuration(struct main_configuration* config, struct main_configurat
    config->create_slot = reload->create_slot;
    config->compression_type = reload->compression_type;
    config->compression_level = reload->compression_level;
+   config->compression_adaptive = reload->compression_adaptive;
+   config->compression_budget = reload->compression_budget;
+   config->compression_dictionary = reload->compression_dictionary;
    if (restart_string("workspace", config->workspace, reload->workspace))
    {
       changed = true;
@@ -4891,6 +5311,15 @@ transfer_configuration(struct main_configuration* config, struct main_configurat
       changed = true;
    }
 
+   config->pipeline = reload->pipeline;
+   config->dedup_chunk_size = reload->dedup_chunk_size;
+   config->wal_summary = reload->wal_summary;
+   config->wal_flush = reload->wal_flush;
+   config->wal_flush_delay = reload->wal_flush_delay;
+   config->wal_flush_size = reload->wal_flush_size;
+   config->wal_receivers = reload->wal_receivers;
+   config->wal_prefetch = reload->wal_prefetch;
+
    if (strncmp(config->common.log_path, reload->common.log_path, MISC_LENGTH) ||
        config->common.log_rotation_size != reload->common.log_rotation_size ||
        config->common.log_rotation_age != reload->common.log_rotation_age ||
@@ -5065,6 +5494,7 @@ copy_server(struct server* dst, struct server* src)
    /* dst->backup = src->backup; */
    /* dst->delete = src->delete; */
    /* dst->wal_streaming = src->wal_streaming; */
+   /* dst->wal_receiver = src->wal_receiver; */
    /* dst->valid = src->valid; */
    /* memcpy(&dst->current_wal_filename[0], &src->current_wal_filename[0], MISC_LENGTH); */
    /* memcpy(&dst->current_wal_lsn[0], &src->current_wal_lsn[0], MISC_LENGTH); */
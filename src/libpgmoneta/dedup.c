@@ -0,0 +1,1643 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <aes.h>
+#include <art.h>
+#include <dedup.h>
+#include <deque.h>
+#include <logging.h>
+#include <utils.h>
+#include <workers.h>
+
+/* system */
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zstd.h>
+#include <openssl/evp.h>
+#include <sys/stat.h>
+
+/* A chunk file starts with the compression flag and the encryption mode of the chunk,
+ * followed by the iv of an encrypted chunk and the tag of a GCM chunk */
+#define CHUNK_HEADER_SIZE 2
+#define CHUNK_MAX_HEADER_SIZE (CHUNK_HEADER_SIZE + AES_OBJECT_IV_SIZE + AES_GCM_TAG_SIZE)
+#define CHUNK_NAME_LENGTH 64
+
+/**
+ * The state used to write the chunks of a file into the chunk store
+ */
+struct chunk_writer
+{
+   char* store;                   /**< The chunk store */
+   int chunk_size;                /**< The chunk size */
+   int level;                     /**< The compression level, 0 for none */
+   int encryption;                /**< The encryption mode */
+   ZSTD_CCtx* cctx;               /**< The compression context */
+   unsigned char* buffer;         /**< The chunk */
+   unsigned char* zstd_buffer;    /**< The compressed chunk */
+   unsigned char* cipher_buffer;  /**< The encrypted chunk */
+   size_t zstd_buffer_size;       /**< The size of the compressed chunk buffer */
+};
+
+/**
+ * The state used to read the chunks of a recipe from the chunk store
+ */
+struct chunk_reader
+{
+   char* store;                   /**< The chunk store */
+   int chunk_size;                /**< The chunk size */
+   ZSTD_DCtx* dctx;               /**< The decompression context */
+   unsigned char* buffer;         /**< The chunk */
+   unsigned char* file_buffer;    /**< The chunk file */
+   unsigned char* cipher_buffer;  /**< The decrypted chunk file */
+   size_t file_buffer_size;       /**< The size of the chunk file buffers */
+};
+
+static char* store_path(int server);
+static char* chunk_path(char* store, char* name);
+static int chunk_name(bool keyed, unsigned char* data, size_t size, char* name);
+static size_t chunk_header_size(int encryption);
+static bool is_eligible(char* path, char* name, int chunk_size);
+static int dedup_file(struct chunk_writer* writer, char* from, char* to, struct deque* names);
+static int store_chunk(struct chunk_writer* writer, char* name, size_t size, bool* created);
+static int expand_file(struct chunk_reader* reader, char* recipe, char* to);
+static int read_chunk(struct chunk_reader* reader, char* name, size_t* size);
+static int writer_create(char* store, int chunk_size, struct chunk_writer** writer);
+static void writer_destroy(struct chunk_writer* writer);
+static int reader_create(char* store, int chunk_size, struct chunk_reader** reader);
+static void reader_destroy(struct chunk_reader* reader);
+static int load_counts(char* path, struct art* counts);
+static int save_counts(char* path, struct art* counts);
+static void do_dedup_file(struct worker_common* wc);
+static void do_expand_file(struct worker_common* wc);
+
+bool
+pgmoneta_dedup_valid_chunk_size(int chunk_size)
+{
+   if (chunk_size < DEDUP_MIN_CHUNK_SIZE || chunk_size > DEDUP_MAX_CHUNK_SIZE)
+   {
+      return false;
+   }
+
+   return (chunk_size & (chunk_size - 1)) == 0;
+}
+
+int
+pgmoneta_dedup_data(int server, char* directory, struct deque* chunks, struct workers* workers)
+{
+   char* store = NULL;
+   char* from = NULL;
+   char* to = NULL;
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   store = store_path(server);
+
+   if (!(dir = opendir(directory)))
+   {
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type == DT_DIR)
+      {
+         char path[1024];
+
+         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+         {
+            continue;
+         }
+
+         snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+
+         if (pgmoneta_dedup_data(server, path, chunks, workers))
+         {
+            goto error;
+         }
+      }
+      else if (entry->d_type == DT_REG)
+      {
+         from = pgmoneta_append(from, directory);
+         from = pgmoneta_append(from, "/");
+         from = pgmoneta_append(from, entry->d_name);
+
+         if (is_eligible(from, entry->d_name, config->dedup_chunk_size))
+         {
+            struct worker_input* wi = NULL;
+
+            to = pgmoneta_append(to, from);
+            to = pgmoneta_append(to, DEDUP_RECIPE_SUFFIX);
+
+            if (!pgmoneta_create_worker_input(store, from, to, config->dedup_chunk_size, workers, &wi))
+            {
+               wi->all = chunks;
+
+               if (workers != NULL)
+               {
+                  if (workers->outcome)
+                  {
+                     pgmoneta_workers_add(workers, do_dedup_file, (struct worker_common*)wi);
+                  }
+                  else
+                  {
+                     free(wi);
+                  }
+               }
+               else
+               {
+                  do_dedup_file((struct worker_common*)wi);
+               }
+            }
+         }
+
+         free(from);
+         free(to);
+
+         from = NULL;
+         to = NULL;
+      }
+   }
+
+   closedir(dir);
+   free(store);
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+   free(store);
+
+   return 1;
+}
+
+int
+pgmoneta_dedup_tablespaces(int server, char* root, struct deque* chunks, struct workers* workers)
+{
+   DIR* dir;
+   struct dirent* entry;
+
+   if (!(dir = opendir(root)))
+   {
+      return 1;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type == DT_DIR)
+      {
+         char path[1024];
+
+         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+             strcmp(entry->d_name, "data") == 0 || strcmp(entry->d_name, "extra") == 0)
+         {
+            continue;
+         }
+
+         snprintf(path, sizeof(path), "%s/%s", root, entry->d_name);
+
+         if (pgmoneta_dedup_data(server, path, chunks, workers))
+         {
+            closedir(dir);
+            return 1;
+         }
+      }
+   }
+
+   closedir(dir);
+   return 0;
+}
+
+int
+pgmoneta_dedup_commit(int server, char* root, struct deque* chunks)
+{
+   char* store = NULL;
+   char* index_path = NULL;
+   char* references_path = NULL;
+   struct art* references = NULL;
+   struct art* index = NULL;
+   struct deque_iterator* diter = NULL;
+   struct art_iterator* aiter = NULL;
+
+   store = store_path(server);
+
+   index_path = pgmoneta_append(index_path, store);
+   index_path = pgmoneta_append(index_path, "/");
+   index_path = pgmoneta_append(index_path, DEDUP_INDEX);
+
+   references_path = pgmoneta_append(references_path, root);
+   if (!pgmoneta_ends_with(references_path, "/"))
+   {
+      references_path = pgmoneta_append(references_path, "/");
+   }
+   references_path = pgmoneta_append(references_path, DEDUP_REFERENCES);
+
+   if (pgmoneta_art_create(&references) || pgmoneta_art_create(&index))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_deque_iterator_create(chunks, &diter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_deque_iterator_next(diter))
+   {
+      uint64_t count = (uint64_t)pgmoneta_art_search(references, diter->tag);
+
+      if (pgmoneta_art_insert(references, diter->tag, count + 1, ValueUInt64))
+      {
+         goto error;
+      }
+   }
+
+   pgmoneta_deque_iterator_destroy(diter);
+   diter = NULL;
+
+   /* The references of the backup are written first, so a delete can always release them */
+   if (save_counts(references_path, references))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_mkdir(store) || load_counts(index_path, index))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_iterator_create(references, &aiter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_art_iterator_next(aiter))
+   {
+      uint64_t count = (uint64_t)pgmoneta_art_search(index, aiter->key);
+
+      count += (uint64_t)pgmoneta_value_data(aiter->value);
+
+      if (pgmoneta_art_insert(index, aiter->key, count, ValueUInt64))
+      {
+         goto error;
+      }
+   }
+
+   pgmoneta_art_iterator_destroy(aiter);
+   aiter = NULL;
+
+   if (save_counts(index_path, index))
+   {
+      goto error;
+   }
+
+   pgmoneta_log_debug("Dedup: %" PRIu64 " chunks referenced by %s", references->size, root);
+
+   pgmoneta_art_destroy(references);
+   pgmoneta_art_destroy(index);
+   free(references_path);
+   free(index_path);
+   free(store);
+
+   return 0;
+
+error:
+
+   pgmoneta_deque_iterator_destroy(diter);
+   pgmoneta_art_iterator_destroy(aiter);
+   pgmoneta_art_destroy(references);
+   pgmoneta_art_destroy(index);
+   free(references_path);
+   free(index_path);
+   free(store);
+
+   return 1;
+}
+
+int
+pgmoneta_dedup_abort(int server, struct deque* chunks)
+{
+   int removed = 0;
+   char* store = NULL;
+   char* index_path = NULL;
+   struct art* index = NULL;
+   struct deque_iterator* iter = NULL;
+
+   if (chunks == NULL)
+   {
+      return 0;
+   }
+
+   store = store_path(server);
+
+   index_path = pgmoneta_append(index_path, store);
+   index_path = pgmoneta_append(index_path, "/");
+   index_path = pgmoneta_append(index_path, DEDUP_INDEX);
+
+   if (pgmoneta_art_create(&index) || load_counts(index_path, index))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_deque_iterator_create(chunks, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      char* path = NULL;
+
+      /* Chunks that were in the store before the backup belong to other backups */
+      if (pgmoneta_value_data(iter->value) == 0 || pgmoneta_art_contains_key(index, iter->tag))
+      {
+         continue;
+      }
+
+      path = chunk_path(store, iter->tag);
+
+      if (pgmoneta_exists(path))
+      {
+         if (unlink(path) != 0)
+         {
+            pgmoneta_log_warn("Dedup: Could not remove %s", path);
+         }
+         else
+         {
+            removed++;
+         }
+      }
+
+      free(path);
+   }
+
+   pgmoneta_log_debug("Dedup: Removed %d chunks of a failed backup", removed);
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_art_destroy(index);
+   free(index_path);
+   free(store);
+
+   return 0;
+
+error:
+
+   pgmoneta_log_error("Dedup: Could not remove the chunks of a failed backup");
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_art_destroy(index);
+   free(index_path);
+   free(store);
+
+   return 1;
+}
+
+int
+pgmoneta_dedup_release(int server, char* root)
+{
+   int removed = 0;
+   char* store = NULL;
+   char* index_path = NULL;
+   char* references_path = NULL;
+   struct art* references = NULL;
+   struct art* index = NULL;
+   struct art_iterator* iter = NULL;
+
+   if (!pgmoneta_dedup_is_deduplicated(root))
+   {
+      return 0;
+   }
+
+   store = store_path(server);
+
+   index_path = pgmoneta_append(index_path, store);
+   index_path = pgmoneta_append(index_path, "/");
+   index_path = pgmoneta_append(index_path, DEDUP_INDEX);
+
+   references_path = pgmoneta_append(references_path, root);
+   if (!pgmoneta_ends_with(references_path, "/"))
+   {
+      references_path = pgmoneta_append(references_path, "/");
+   }
+   references_path = pgmoneta_append(references_path, DEDUP_REFERENCES);
+
+   if (pgmoneta_art_create(&references) || pgmoneta_art_create(&index))
+   {
+      goto error;
+   }
+
+   if (load_counts(references_path, references) || load_counts(index_path, index))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_iterator_create(references, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_art_iterator_next(iter))
+   {
+      uint64_t count = (uint64_t)pgmoneta_art_search(index, iter->key);
+      uint64_t released = (uint64_t)pgmoneta_value_data(iter->value);
+
+      if (count <= released)
+      {
+         char* path = chunk_path(store, iter->key);
+
+         if (pgmoneta_exists(path) && unlink(path) != 0)
+         {
+            pgmoneta_log_warn("Dedup: Could not remove %s", path);
+         }
+         free(path);
+
+         pgmoneta_art_delete(index, iter->key);
+         removed++;
+      }
+      else
+      {
+         if (pgmoneta_art_insert(index, iter->key, count - released, ValueUInt64))
+         {
+            goto error;
+         }
+      }
+   }
+
+   pgmoneta_art_iterator_destroy(iter);
+   iter = NULL;
+
+   if (save_counts(index_path, index))
+   {
+      goto error;
+   }
+
+   pgmoneta_log_debug("Dedup: Released %s (%d chunks removed)", root, removed);
+
+   pgmoneta_art_destroy(references);
+   pgmoneta_art_destroy(index);
+   free(references_path);
+   free(index_path);
+   free(store);
+
+   return 0;
+
+error:
+
+   pgmoneta_log_error("Dedup: Could not release the chunks of %s", root);
+
+   pgmoneta_art_iterator_destroy(iter);
+   pgmoneta_art_destroy(references);
+   pgmoneta_art_destroy(index);
+   free(references_path);
+   free(index_path);
+   free(store);
+
+   return 1;
+}
+
+bool
+pgmoneta_dedup_is_deduplicated(char* root)
+{
+   bool exists = false;
+   char* path = NULL;
+
+   path = pgmoneta_append(path, root);
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append(path, "/");
+   }
+   path = pgmoneta_append(path, DEDUP_REFERENCES);
+
+   exists = pgmoneta_exists(path);
+
+   free(path);
+
+   return exists;
+}
+
+int
+pgmoneta_dedup_expand_directory(int server, char* directory, struct workers* workers)
+{
+   char* store = NULL;
+   char* from = NULL;
+   char* to = NULL;
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct stat st;
+
+   store = store_path(server);
+
+   if (!(dir = opendir(directory)))
+   {
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      {
+         continue;
+      }
+
+      from = pgmoneta_append(from, directory);
+      if (!pgmoneta_ends_with(from, "/"))
+      {
+         from = pgmoneta_append(from, "/");
+      }
+      from = pgmoneta_append(from, entry->d_name);
+
+      /* Follow the tablespace links */
+      if (stat(from, &st) != 0)
+      {
+         free(from);
+         from = NULL;
+         continue;
+      }
+
+      if (S_ISDIR(st.st_mode))
+      {
+         if (pgmoneta_dedup_expand_directory(server, from, workers))
+         {
+            goto error;
+         }
+      }
+      else if (S_ISREG(st.st_mode) && pgmoneta_ends_with(entry->d_name, DEDUP_RECIPE_SUFFIX))
+      {
+         struct worker_input* wi = NULL;
+
+         if (pgmoneta_strip_extension(from, &to))
+         {
+            goto error;
+         }
+
+         if (!pgmoneta_create_worker_input(store, from, to, 0, workers, &wi))
+         {
+            if (workers != NULL)
+            {
+               if (workers->outcome)
+               {
+                  pgmoneta_workers_add(workers, do_expand_file, (struct worker_common*)wi);
+               }
+               else
+               {
+                  free(wi);
+               }
+            }
+            else
+            {
+               do_expand_file((struct worker_common*)wi);
+            }
+         }
+      }
+
+      free(from);
+      free(to);
+
+      from = NULL;
+      to = NULL;
+   }
+
+   closedir(dir);
+   free(store);
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+   free(from);
+   free(to);
+   free(store);
+
+   return 1;
+}
+
+int
+pgmoneta_dedup_expand_file(int server, char* recipe, char* to)
+{
+   char* store = NULL;
+   struct chunk_reader* reader = NULL;
+
+   store = store_path(server);
+
+   if (reader_create(store, 0, &reader))
+   {
+      goto error;
+   }
+
+   if (expand_file(reader, recipe, to))
+   {
+      goto error;
+   }
+
+   reader_destroy(reader);
+   free(store);
+
+   return 0;
+
+error:
+
+   reader_destroy(reader);
+   free(store);
+
+   return 1;
+}
+
+static void
+do_dedup_file(struct worker_common* wc)
+{
+   bool failed = false;
+   struct chunk_writer* writer = NULL;
+   struct deque* names = NULL;
+   struct deque_iterator* iter = NULL;
+   struct worker_input* wi = (struct worker_input*)wc;
+
+   if (pgmoneta_deque_create(false, &names))
+   {
+      goto error;
+   }
+
+   if (writer_create(wi->directory, wi->level, &writer))
+   {
+      goto error;
+   }
+
+   failed = dedup_file(writer, wi->from, wi->to, names) != 0;
+
+   /* The chunks written so far are recorded even on failure, so an aborted backup can remove them */
+   if (wi->all != NULL)
+   {
+      if (pgmoneta_deque_iterator_create(names, &iter))
+      {
+         goto error;
+      }
+
+      while (pgmoneta_deque_iterator_next(iter))
+      {
+         pgmoneta_deque_add(wi->all, iter->tag, pgmoneta_value_data(iter->value), ValueInt32);
+      }
+   }
+
+   if (failed)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_exists(wi->from))
+   {
+      pgmoneta_delete_file(wi->from, NULL);
+   }
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_deque_destroy(names);
+   writer_destroy(writer);
+   free(wi);
+
+   return;
+
+error:
+
+   pgmoneta_log_error("Dedup: Could not process %s", wi->from);
+
+   if (pgmoneta_exists(wi->to))
+   {
+      pgmoneta_delete_file(wi->to, NULL);
+   }
+
+   if (wi->common.workers != NULL)
+   {
+      wi->common.workers->outcome = false;
+   }
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_deque_destroy(names);
+   writer_destroy(writer);
+   free(wi);
+}
+
+static void
+do_expand_file(struct worker_common* wc)
+{
+   struct chunk_reader* reader = NULL;
+   struct worker_input* wi = (struct worker_input*)wc;
+
+   if (reader_create(wi->directory, 0, &reader))
+   {
+      goto error;
+   }
+
+   if (expand_file(reader, wi->from, wi->to))
+   {
+      goto error;
+   }
+
+   pgmoneta_delete_file(wi->from, NULL);
+
+   reader_destroy(reader);
+   free(wi);
+
+   return;
+
+error:
+
+   pgmoneta_log_error("Dedup: Could not expand %s", wi->from);
+
+   if (pgmoneta_exists(wi->to))
+   {
+      pgmoneta_delete_file(wi->to, NULL);
+   }
+
+   if (wi->common.workers != NULL)
+   {
+      wi->common.workers->outcome = false;
+   }
+
+   reader_destroy(reader);
+   free(wi);
+}
+
+static int
+dedup_file(struct chunk_writer* writer, char* from, char* to, struct deque* names)
+{
+   bool created = false;
+   size_t bytes = 0;
+   uint64_t size = 0;
+   char name[CHUNK_NAME_LENGTH + 1];
+   FILE* in = NULL;
+   FILE* out = NULL;
+   struct stat st;
+
+   in = fopen(from, "rb");
+   if (in == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", from);
+      goto error;
+   }
+
+   if (fstat(fileno(in), &st) != 0)
+   {
+      goto error;
+   }
+
+   out = fopen(to, "w");
+   if (out == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", to);
+      goto error;
+   }
+
+   fprintf(out, "%s %d\n", DEDUP_RECIPE_MAGIC, DEDUP_RECIPE_VERSION);
+   fprintf(out, "chunk_size %d\n", writer->chunk_size);
+   fprintf(out, "size %" PRIu64 "\n", (uint64_t)st.st_size);
+
+   while ((bytes = fread(writer->buffer, 1, writer->chunk_size, in)) > 0)
+   {
+      if (chunk_name(writer->encryption != ENCRYPTION_NONE, writer->buffer, bytes, &name[0]))
+      {
+         goto error;
+      }
+
+      if (store_chunk(writer, &name[0], bytes, &created))
+      {
+         goto error;
+      }
+
+      fprintf(out, "%s\n", &name[0]);
+      pgmoneta_deque_add(names, &name[0], created ? 1 : 0, ValueInt32);
+
+      size += bytes;
+   }
+
+   if (ferror(in))
+   {
+      pgmoneta_log_error("fread: error reading from file: %s", from);
+      goto error;
+   }
+
+   if (size != (uint64_t)st.st_size)
+   {
+      pgmoneta_log_error("Dedup: %s changed while being processed", from);
+      goto error;
+   }
+
+   fclose(in);
+   in = NULL;
+
+   if (fflush(out) != 0 || ferror(out))
+   {
+      goto error;
+   }
+
+   if (fclose(out) != 0)
+   {
+      out = NULL;
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   if (in != NULL)
+   {
+      fclose(in);
+   }
+
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+
+   return 1;
+}
+
+static int
+store_chunk(struct chunk_writer* writer, char* name, size_t size, bool* created)
+{
+   int fd = -1;
+   size_t length = 0;
+   size_t cipher_length = 0;
+   size_t header_size = 0;
+   size_t offset = 0;
+   ssize_t written = 0;
+   unsigned char header[CHUNK_MAX_HEADER_SIZE];
+   unsigned char* data = NULL;
+   char* path = NULL;
+   char* directory = NULL;
+   char* temporary = NULL;
+
+   *created = false;
+
+   path = chunk_path(writer->store, name);
+
+   /* Already in the store, possibly written by another backup */
+   if (pgmoneta_exists(path))
+   {
+      free(path);
+      return 0;
+   }
+
+   data = writer->buffer;
+   length = size;
+
+   memset(&header[0], 0, sizeof(header));
+   header[0] = 0;
+   header[1] = (unsigned char)writer->encryption;
+   header_size = chunk_header_size(writer->encryption);
+
+   if (writer->cctx != NULL)
+   {
+      size_t compressed = ZSTD_compressCCtx(writer->cctx, writer->zstd_buffer, writer->zstd_buffer_size,
+                                            data, length, writer->level);
+
+      if (ZSTD_isError(compressed))
+      {
+         pgmoneta_log_error("Dedup: %s", ZSTD_getErrorName(compressed));
+         goto error;
+      }
+
+      /* Keep incompressible chunks as they are */
+      if (compressed < length)
+      {
+         header[0] = 1;
+         data = writer->zstd_buffer;
+         length = compressed;
+      }
+   }
+
+   if (writer->encryption != ENCRYPTION_NONE)
+   {
+      /* Every chunk has its own iv, so no two chunks share a keystream */
+      if (pgmoneta_object_iv(name, &header[CHUNK_HEADER_SIZE]) ||
+          pgmoneta_crypt_object(writer->encryption, 1, &header[CHUNK_HEADER_SIZE],
+                                &header[CHUNK_HEADER_SIZE + AES_OBJECT_IV_SIZE],
+                                data, length, writer->cipher_buffer, &cipher_length))
+      {
+         pgmoneta_log_error("Dedup: Encryption failed for chunk %s", name);
+         goto error;
+      }
+
+      data = writer->cipher_buffer;
+      length = cipher_length;
+   }
+
+   directory = pgmoneta_append(directory, writer->store);
+   directory = pgmoneta_append(directory, "/");
+   directory = pgmoneta_append_char(directory, name[0]);
+   directory = pgmoneta_append_char(directory, name[1]);
+
+   if (pgmoneta_mkdir(directory))
+   {
+      pgmoneta_log_error("Dedup: Could not create %s", directory);
+      goto error;
+   }
+
+   temporary = pgmoneta_append(temporary, path);
+   temporary = pgmoneta_append(temporary, ".XXXXXX");
+
+   fd = mkstemp(temporary);
+   if (fd == -1)
+   {
+      pgmoneta_log_error("Dedup: Could not create %s", temporary);
+      goto error;
+   }
+
+   if (write(fd, &header[0], header_size) != (ssize_t)header_size)
+   {
+      goto error;
+   }
+
+   while (offset < length)
+   {
+      written = write(fd, data + offset, length - offset);
+      if (written <= 0)
+      {
+         pgmoneta_log_error("Dedup: Could not write %s", temporary);
+         goto error;
+      }
+      offset += written;
+   }
+
+   close(fd);
+   fd = -1;
+
+   /* Concurrent writers of the same chunk store identical content, so the last rename wins */
+   if (rename(temporary, path) != 0)
+   {
+      pgmoneta_log_error("Dedup: Could not rename %s", temporary);
+      goto error;
+   }
+
+   *created = true;
+
+   free(temporary);
+   free(directory);
+   free(path);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   if (temporary != NULL && pgmoneta_exists(temporary))
+   {
+      unlink(temporary);
+   }
+
+   free(temporary);
+   free(directory);
+   free(path);
+
+   return 1;
+}
+
+static int
+expand_file(struct chunk_reader* reader, char* recipe, char* to)
+{
+   int version = 0;
+   int chunk_size = 0;
+   uint64_t expected = 0;
+   uint64_t size = 0;
+   size_t bytes = 0;
+   char line[MISC_LENGTH];
+   char magic[MISC_LENGTH];
+   FILE* in = NULL;
+   FILE* out = NULL;
+
+   in = fopen(recipe, "r");
+   if (in == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", recipe);
+      goto error;
+   }
+
+   memset(&magic[0], 0, sizeof(magic));
+
+   if (fgets(&line[0], sizeof(line), in) == NULL ||
+       sscanf(&line[0], "%127s %d", &magic[0], &version) != 2 ||
+       strcmp(&magic[0], DEDUP_RECIPE_MAGIC) != 0 ||
+       version != DEDUP_RECIPE_VERSION)
+   {
+      pgmoneta_log_error("Dedup: Invalid recipe %s", recipe);
+      goto error;
+   }
+
+   if (fgets(&line[0], sizeof(line), in) == NULL ||
+       sscanf(&line[0], "chunk_size %d", &chunk_size) != 1 ||
+       !pgmoneta_dedup_valid_chunk_size(chunk_size))
+   {
+      pgmoneta_log_error("Dedup: Invalid chunk size in %s", recipe);
+      goto error;
+   }
+
+   if (fgets(&line[0], sizeof(line), in) == NULL ||
+       sscanf(&line[0], "size %" SCNu64, &expected) != 1)
+   {
+      pgmoneta_log_error("Dedup: Invalid size in %s", recipe);
+      goto error;
+   }
+
+   /* Recipes written with a different chunk size need a larger buffer */
+   if (chunk_size > reader->chunk_size)
+   {
+      unsigned char* buffer = realloc(reader->buffer, chunk_size);
+
+      if (buffer == NULL)
+      {
+         goto error;
+      }
+
+      reader->buffer = buffer;
+      reader->chunk_size = chunk_size;
+   }
+
+   out = fopen(to, "wb");
+   if (out == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", to);
+      goto error;
+   }
+
+   while (fgets(&line[0], sizeof(line), in) != NULL)
+   {
+      line[strcspn(&line[0], "\r\n")] = '\0';
+
+      if (strlen(&line[0]) == 0)
+      {
+         continue;
+      }
+
+      if (read_chunk(reader, &line[0], &bytes))
+      {
+         goto error;
+      }
+
+      if (fwrite(reader->buffer, 1, bytes, out) != bytes)
+      {
+         pgmoneta_log_error("fwrite: Could not write %s", to);
+         goto error;
+      }
+
+      size += bytes;
+   }
+
+   if (size != expected)
+   {
+      pgmoneta_log_error("Dedup: %s has %" PRIu64 " bytes, expected %" PRIu64, to, size, expected);
+      goto error;
+   }
+
+   fclose(in);
+   in = NULL;
+
+   if (fflush(out) != 0 || ferror(out))
+   {
+      goto error;
+   }
+
+   if (fclose(out) != 0)
+   {
+      out = NULL;
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   if (in != NULL)
+   {
+      fclose(in);
+   }
+
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+
+   return 1;
+}
+
+static int
+read_chunk(struct chunk_reader* reader, char* name, size_t* size)
+{
+   int fd = -1;
+   int encryption = ENCRYPTION_NONE;
+   size_t length = 0;
+   size_t header_size = 0;
+   size_t offset = 0;
+   ssize_t r = 0;
+   unsigned char* data = NULL;
+   char* path = NULL;
+   char verify[CHUNK_NAME_LENGTH + 1];
+   struct stat st;
+
+   *size = 0;
+
+   path = chunk_path(reader->store, name);
+
+   fd = open(path, O_RDONLY);
+   if (fd == -1 || fstat(fd, &st) != 0 || st.st_size < CHUNK_HEADER_SIZE)
+   {
+      pgmoneta_log_error("Dedup: Could not open chunk %s", path);
+      goto error;
+   }
+
+   length = (size_t)st.st_size;
+
+   if (length > reader->file_buffer_size)
+   {
+      unsigned char* file_buffer = realloc(reader->file_buffer, length);
+      unsigned char* cipher_buffer = NULL;
+
+      if (file_buffer == NULL)
+      {
+         goto error;
+      }
+      reader->file_buffer = file_buffer;
+
+      cipher_buffer = realloc(reader->cipher_buffer, length + EVP_MAX_BLOCK_LENGTH);
+      if (cipher_buffer == NULL)
+      {
+         goto error;
+      }
+      reader->cipher_buffer = cipher_buffer;
+
+      reader->file_buffer_size = length;
+   }
+
+   while (offset < length)
+   {
+      r = read(fd, reader->file_buffer + offset, length - offset);
+      if (r <= 0)
+      {
+         pgmoneta_log_error("Dedup: Could not read chunk %s", path);
+         goto error;
+      }
+      offset += r;
+   }
+
+   close(fd);
+   fd = -1;
+
+   encryption = reader->file_buffer[1];
+   header_size = chunk_header_size(encryption);
+
+   if (length < header_size)
+   {
+      pgmoneta_log_error("Dedup: Chunk %s is truncated", path);
+      goto error;
+   }
+
+   data = reader->file_buffer + header_size;
+   length -= header_size;
+
+   if (encryption != ENCRYPTION_NONE)
+   {
+      if (pgmoneta_crypt_object(encryption, 0, reader->file_buffer + CHUNK_HEADER_SIZE,
+                                reader->file_buffer + CHUNK_HEADER_SIZE + AES_OBJECT_IV_SIZE,
+                                data, length, reader->cipher_buffer, &length))
+      {
+         pgmoneta_log_error("Dedup: Decryption failed for chunk %s", path);
+         goto error;
+      }
+
+      data = reader->cipher_buffer;
+   }
+
+   if (reader->file_buffer[0] == 1)
+   {
+      size_t decompressed = ZSTD_decompressDCtx(reader->dctx, reader->buffer, reader->chunk_size, data, length);
+
+      if (ZSTD_isError(decompressed))
+      {
+         pgmoneta_log_error("Dedup: %s: %s", path, ZSTD_getErrorName(decompressed));
+         goto error;
+      }
+
+      length = decompressed;
+   }
+   else
+   {
+      if (length > (size_t)reader->chunk_size)
+      {
+         pgmoneta_log_error("Dedup: Chunk %s is too large", path);
+         goto error;
+      }
+
+      memcpy(reader->buffer, data, length);
+   }
+
+   if (chunk_name(encryption != ENCRYPTION_NONE, reader->buffer, length, &verify[0]) ||
+       strcmp(&verify[0], name) != 0)
+   {
+      pgmoneta_log_error("Dedup: Chunk %s is corrupted", path);
+      goto error;
+   }
+
+   *size = length;
+
+   free(path);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   free(path);
+
+   return 1;
+}
+
+static int
+writer_create(char* store, int chunk_size, struct chunk_writer** writer)
+{
+   int level;
+   struct chunk_writer* w = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *writer = NULL;
+
+   w = (struct chunk_writer*)malloc(sizeof(struct chunk_writer));
+   if (w == NULL)
+   {
+      goto error;
+   }
+
+   memset(w, 0, sizeof(struct chunk_writer));
+
+   w->store = store;
+   w->chunk_size = chunk_size;
+   w->encryption = config->encryption;
+
+   w->buffer = malloc(chunk_size);
+   if (w->buffer == NULL)
+   {
+      goto error;
+   }
+
+   if (config->compression_type != COMPRESSION_NONE)
+   {
+      level = config->compression_level;
+      if (level < 1)
+      {
+         level = 1;
+      }
+      else if (level > 19)
+      {
+         level = 19;
+      }
+
+      w->level = level;
+      w->zstd_buffer_size = ZSTD_compressBound(chunk_size);
+      w->zstd_buffer = malloc(w->zstd_buffer_size);
+      w->cctx = ZSTD_createCCtx();
+
+      if (w->zstd_buffer == NULL || w->cctx == NULL)
+      {
+         goto error;
+      }
+   }
+
+   if (w->encryption != ENCRYPTION_NONE)
+   {
+      w->cipher_buffer = malloc(MAX((size_t)chunk_size, w->zstd_buffer_size) + EVP_MAX_BLOCK_LENGTH);
+      if (w->cipher_buffer == NULL)
+      {
+         goto error;
+      }
+   }
+
+   *writer = w;
+
+   return 0;
+
+error:
+
+   writer_destroy(w);
+
+   return 1;
+}
+
+static void
+writer_destroy(struct chunk_writer* writer)
+{
+   if (writer != NULL)
+   {
+      if (writer->cctx != NULL)
+      {
+         ZSTD_freeCCtx(writer->cctx);
+      }
+      free(writer->buffer);
+      free(writer->zstd_buffer);
+      free(writer->cipher_buffer);
+      free(writer);
+   }
+}
+
+static int
+reader_create(char* store, int chunk_size, struct chunk_reader** reader)
+{
+   struct chunk_reader* r = NULL;
+
+   *reader = NULL;
+
+   r = (struct chunk_reader*)malloc(sizeof(struct chunk_reader));
+   if (r == NULL)
+   {
+      goto error;
+   }
+
+   memset(r, 0, sizeof(struct chunk_reader));
+
+   r->store = store;
+   r->chunk_size = chunk_size;
+
+   r->dctx = ZSTD_createDCtx();
+   if (r->dctx == NULL)
+   {
+      goto error;
+   }
+
+   *reader = r;
+
+   return 0;
+
+error:
+
+   reader_destroy(r);
+
+   return 1;
+}
+
+static void
+reader_destroy(struct chunk_reader* reader)
+{
+   if (reader != NULL)
+   {
+      if (reader->dctx != NULL)
+      {
+         ZSTD_freeDCtx(reader->dctx);
+      }
+      free(reader->buffer);
+      free(reader->file_buffer);
+      free(reader->cipher_buffer);
+      free(reader);
+   }
+}
+
+static int
+load_counts(char* path, struct art* counts)
+{
+   uint64_t count = 0;
+   char name[MISC_LENGTH];
+   char line[MISC_LENGTH];
+   FILE* file = NULL;
+
+   if (!pgmoneta_exists(path))
+   {
+      return 0;
+   }
+
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", path);
+      return 1;
+   }
+
+   while (fgets(&line[0], sizeof(line), file) != NULL)
+   {
+      memset(&name[0], 0, sizeof(name));
+
+      if (sscanf(&line[0], "%127s %" SCNu64, &name[0], &count) != 2)
+      {
+         continue;
+      }
+
+      if (pgmoneta_art_insert(counts, &name[0], count, ValueUInt64))
+      {
+         fclose(file);
+         return 1;
+      }
+   }
+
+   fclose(file);
+
+   return 0;
+}
+
+static int
+save_counts(char* path, struct art* counts)
+{
+   char* temporary = NULL;
+   FILE* file = NULL;
+   struct art_iterator* iter = NULL;
+
+   temporary = pgmoneta_append(temporary, path);
+   temporary = pgmoneta_append(temporary, ".tmp");
+
+   file = fopen(temporary, "w");
+   if (file == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", temporary);
+      goto error;
+   }
+
+   if (pgmoneta_art_iterator_create(counts, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_art_iterator_next(iter))
+   {
+      fprintf(file, "%s %" PRIu64 "\n", iter->key, (uint64_t)pgmoneta_value_data(iter->value));
+   }
+
+   pgmoneta_art_iterator_destroy(iter);
+   iter = NULL;
+
+   if (fflush(file) != 0 || ferror(file) || fsync(fileno(file)) != 0)
+   {
+      goto error;
+   }
+
+   fclose(file);
+   file = NULL;
+
+   if (rename(temporary, path) != 0)
+   {
+      pgmoneta_log_error("Dedup: Could not rename %s", temporary);
+      goto error;
+   }
+
+   free(temporary);
+
+   return 0;
+
+error:
+
+   pgmoneta_art_iterator_destroy(iter);
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   if (pgmoneta_exists(temporary))
+   {
+      unlink(temporary);
+   }
+
+   free(temporary);
+
+   return 1;
+}
+
+static bool
+is_eligible(char* path, char* name, int chunk_size)
+{
+   struct stat st;
+
+   if (pgmoneta_ends_with(name, "backup_manifest") ||
+       pgmoneta_ends_with(name, "backup_label") ||
+       pgmoneta_ends_with(name, DEDUP_RECIPE_SUFFIX))
+   {
+      return false;
+   }
+
+   if (pgmoneta_is_compressed(name) || pgmoneta_is_encrypted(name))
+   {
+      return false;
+   }
+
+   /* Small files would only add a chunk and a recipe */
+   if (stat(path, &st) != 0 || st.st_size < chunk_size)
+   {
+      return false;
+   }
+
+   return true;
+}
+
+static char*
+store_path(int server)
+{
+   char* d = NULL;
+
+   d = pgmoneta_get_server(server);
+   d = pgmoneta_append(d, DEDUP_CHUNKS);
+
+   return d;
+}
+
+static char*
+chunk_path(char* store, char* name)
+{
+   char* p = NULL;
+
+   p = pgmoneta_append(p, store);
+   p = pgmoneta_append(p, "/");
+   p = pgmoneta_append_char(p, name[0]);
+   p = pgmoneta_append_char(p, name[1]);
+   p = pgmoneta_append(p, "/");
+   p = pgmoneta_append(p, name);
+
+   return p;
+}
+
+static int
+chunk_name(bool keyed, unsigned char* data, size_t size, char* name)
+{
+   unsigned char md[EVP_MAX_MD_SIZE];
+   unsigned int length = 0;
+
+   memset(name, 0, CHUNK_NAME_LENGTH + 1);
+
+   /* The names of encrypted chunks are keyed, so they do not tell the content of the chunks */
+   if (keyed)
+   {
+      if (pgmoneta_object_hash(data, size, &md[0], &length))
+      {
+         return 1;
+      }
+   }
+   else if (!EVP_Digest(data, size, &md[0], &length, EVP_sha256(), NULL))
+   {
+      return 1;
+   }
+
+   for (unsigned int i = 0; i < length && (i * 2) < CHUNK_NAME_LENGTH; i++)
+   {
+      sprintf(name + (i * 2), "%02x", md[i]);
+   }
+
+   return 0;
+}
+
+static size_t
+chunk_header_size(int encryption)
+{
+   if (encryption == ENCRYPTION_NONE)
+   {
+      return CHUNK_HEADER_SIZE;
+   }
+
+   if (pgmoneta_is_gcm_mode(encryption))
+   {
+      return CHUNK_HEADER_SIZE + AES_OBJECT_IV_SIZE + AES_GCM_TAG_SIZE;
+   }
+
+   return CHUNK_HEADER_SIZE + AES_OBJECT_IV_SIZE;
+}
@@ -30,7 +30,9 @@
 #include <pgmoneta.h>
 #include <backup.h>
 #include <logging.h>
+#include <summary.h>
 #include <utils.h>
+#include <walindex.h>
 #include <workflow.h>
 
 /* system */
@@ -49,6 +51,16 @@
 static void
 delete_wal_older_than(char* srv_wal, char* base, int backup_index);
 
+/**
+ * Delete wal files older than the given srv_wal file using the index of the base directory
+ * @param index The index of the base directory
+ * @param srv_wal The oldest wal segment file we would like to keep
+ * @param base The base directory holding the wal segments
+ * @param backup_index The index of the oldest backup
+ */
+static void
+delete_indexed_wal_older_than(struct wal_index* index, char* srv_wal, char* base, int backup_index);
+
 int
 pgmoneta_delete(int srv, char* label)
 {
@@ -153,6 +165,12 @@ pgmoneta_delete_wal(int srv)
       free(d);
       d = NULL;
 
+      /* Summaries are only needed from the oldest backup on */
+      if (backup_index == -1 || srv_wal != NULL)
+      {
+         pgmoneta_summary_delete_older_than(srv, backup_index == -1 ? NULL : srv_wal);
+      }
+
       /* Also delete WAL under wal_shipping directory */
       wal_shipping = pgmoneta_get_server_wal_shipping_wal(srv);
       if (wal_shipping != NULL)
@@ -205,6 +223,14 @@ delete_wal_older_than(char* srv_wal, char* base, int backup_index)
    char** wal_files = NULL;
    char wal_address[MAX_PATH];
    bool delete;
+   struct wal_index* index = NULL;
+
+   if (!pgmoneta_wal_index_load(base, &index))
+   {
+      delete_indexed_wal_older_than(index, srv_wal, base, backup_index);
+      pgmoneta_wal_index_destroy(index);
+      return;
+   }
 
    if (pgmoneta_get_wal_files(base, &number_of_wal_files, &wal_files))
    {
@@ -270,3 +296,61 @@ error:
    }
    free(wal_files);
 }
+
+static void
+delete_indexed_wal_older_than(struct wal_index* index, char* srv_wal, char* base, int backup_index)
+{
+   int end = 0;
+   char* name = NULL;
+   char wal_address[MAX_PATH * 2];
+
+   if (backup_index == -1)
+   {
+      end = index->number_of_entries;
+   }
+   else if (srv_wal != NULL)
+   {
+      end = pgmoneta_wal_index_search(index, srv_wal);
+   }
+
+   for (int i = 0; i < end; i++)
+   {
+      // the segment being received is left alone
+      if (index->entries[i].partial)
+      {
+         continue;
+      }
+
+      name = pgmoneta_wal_index_file(index, i);
+      if (name == NULL)
+      {
+         continue;
+      }
+
+      snprintf(wal_address, sizeof(wal_address), "%s%s%s", base, pgmoneta_ends_with(base, "/") ? "" : "/", name);
+
+      pgmoneta_log_trace("WAL: Deleting %s", wal_address);
+      pgmoneta_delete_file(wal_address, NULL);
+
+      free(name);
+      name = NULL;
+   }
+
+   if (end > 0)
+   {
+      pgmoneta_wal_index_truncate(base, backup_index == -1 ? NULL : srv_wal);
+
+      // the segments left alone are recorded again after the truncation
+      for (int i = 0; i < end; i++)
+      {
+         if (index->entries[i].partial && (name = pgmoneta_wal_index_file(index, i)) != NULL)
+         {
+            snprintf(wal_address, sizeof(wal_address), "%s%s%s", base, pgmoneta_ends_with(base, "/") ? "" : "/", name);
+            pgmoneta_wal_index_add(wal_address);
+
+            free(name);
+            name = NULL;
+         }
+      }
+   }
+}
@@ -0,0 +1,757 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <dictionary.h>
+#include <logging.h>
+#include <utils.h>
+
+/* system */
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zdict.h>
+#include <zstd.h>
+#include <sys/stat.h>
+
+#define DICTIONARY_CACHE_SIZE 16
+
+/** @struct dictionary_entry
+ * A loaded dictionary, shared by all threads of the process
+ */
+struct dictionary_entry
+{
+   uint32_t id;         /**< The dictionary identifier */
+   int level;           /**< The compression level of a compression dictionary */
+   ZSTD_CDict* cdict;   /**< The compression dictionary, or NULL */
+   ZSTD_DDict* ddict;   /**< The decompression dictionary, or NULL */
+};
+
+static pthread_mutex_t dictionary_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dictionary_entry dictionary_cache[DICTIONARY_CACHE_SIZE];
+static int dictionary_cache_size = 0;
+static char dictionary_registered[MAX_PATH];
+
+static char* type_name(int type);
+static uint32_t newest(char* directory, int type, time_t* mtime);
+static char* find_directory(char* path);
+static char* find_file(char* path, uint32_t id);
+static int read_dictionary(char* file, void** buffer, size_t* size);
+static int sample_wal(char* directory, char* samples, size_t* sizes, size_t capacity, size_t* total, size_t* n);
+static int sample_data(char* directory, char* samples, size_t* sizes, size_t capacity, size_t* total, size_t* n);
+static int add_sample(char* file, size_t offset, size_t length, char* samples, size_t* sizes, size_t capacity, size_t* total, size_t* n);
+
+int
+pgmoneta_dictionary_train(int server, int type, char* directory)
+{
+   char* d = NULL;
+   char* samples = NULL;
+   size_t* sizes = NULL;
+   size_t capacity;
+   size_t total = 0;
+   size_t n = 0;
+   size_t size;
+   void* dictionary = NULL;
+   uint32_t id;
+   time_t mtime = 0;
+   char file[MAX_PATH];
+   char tmp[MAX_PATH + 4];
+   FILE* f = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   d = pgmoneta_get_server_dictionary(server);
+
+   if (newest(d, type, &mtime) != 0 && time(NULL) - mtime < DICTIONARY_MAX_AGE)
+   {
+      free(d);
+      return 0;
+   }
+
+   samples = (char*)malloc(DICTIONARY_SAMPLE_SIZE);
+   // WAL pages are the smallest samples
+   capacity = DICTIONARY_SAMPLE_SIZE / 512;
+   sizes = (size_t*)malloc(capacity * sizeof(size_t));
+   dictionary = malloc(DICTIONARY_SIZE);
+
+   if (samples == NULL || sizes == NULL || dictionary == NULL)
+   {
+      goto error;
+   }
+
+   if (type == DICTIONARY_TYPE_WAL)
+   {
+      if (sample_wal(directory, samples, sizes, capacity, &total, &n))
+      {
+         goto error;
+      }
+   }
+   else
+   {
+      if (sample_data(directory, samples, sizes, capacity, &total, &n))
+      {
+         goto error;
+      }
+   }
+
+   // zstd wants many samples and about a hundred times the dictionary size
+   if (n < 32 || total < 10 * DICTIONARY_SIZE)
+   {
+      pgmoneta_log_debug("Dictionary: Not enough %s samples for %s (%zu samples, %zu bytes)",
+                         type_name(type), config->common.servers[server].name, n, total);
+      goto done;
+   }
+
+   size = ZDICT_trainFromBuffer(dictionary, DICTIONARY_SIZE, samples, sizes, (unsigned)n);
+   if (ZDICT_isError(size))
+   {
+      pgmoneta_log_debug("Dictionary: Could not train %s dictionary for %s: %s",
+                         type_name(type), config->common.servers[server].name, ZDICT_getErrorName(size));
+      goto done;
+   }
+
+   id = ZDICT_getDictID(dictionary, size);
+
+   if (pgmoneta_mkdir(d))
+   {
+      pgmoneta_log_error("Dictionary: Could not create %s", d);
+      goto error;
+   }
+
+   memset(file, 0, sizeof(file));
+   snprintf(file, sizeof(file), "%s%s-%08x%s", d, type_name(type), id, DICTIONARY_SUFFIX);
+   memset(tmp, 0, sizeof(tmp));
+   snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+
+   // readers never see a partial dictionary
+   f = fopen(tmp, "wb");
+   if (f == NULL)
+   {
+      pgmoneta_log_error("Dictionary: Could not create %s: %s", tmp, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   if (fwrite(dictionary, 1, size, f) != size || fflush(f) || fsync(fileno(f)))
+   {
+      pgmoneta_log_error("Dictionary: Could not write %s", tmp);
+      goto error;
+   }
+
+   fclose(f);
+   f = NULL;
+
+   if (rename(tmp, file))
+   {
+      pgmoneta_log_error("Dictionary: Could not rename %s: %s", tmp, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   pgmoneta_permission(file, 6, 0, 0);
+
+   pgmoneta_log_info("Dictionary: Trained %s dictionary %08x for %s (%zu samples, %zu bytes)",
+                     type_name(type), id, config->common.servers[server].name, n, total);
+
+done:
+
+   free(d);
+   free(samples);
+   free(sizes);
+   free(dictionary);
+
+   return 0;
+
+error:
+
+   if (f != NULL)
+   {
+      fclose(f);
+      remove(tmp);
+   }
+
+   free(d);
+   free(samples);
+   free(sizes);
+   free(dictionary);
+
+   return 1;
+}
+
+uint32_t
+pgmoneta_dictionary_current(int server, int type)
+{
+   char* d = NULL;
+   time_t mtime = 0;
+   uint32_t id;
+
+   d = pgmoneta_get_server_dictionary(server);
+   id = newest(d, type, &mtime);
+   free(d);
+
+   return id;
+}
+
+int
+pgmoneta_dictionary_compress(char* path, int type, int level, ZSTD_CCtx* cctx, uint32_t* id)
+{
+   char* d = NULL;
+   char file[MAX_PATH + MISC_LENGTH];
+   time_t mtime = 0;
+   uint32_t current = 0;
+   void* buffer = NULL;
+   size_t size = 0;
+   ZSTD_CDict* cdict = NULL;
+
+   *id = 0;
+
+   ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+   ZSTD_CCtx_refCDict(cctx, NULL);
+
+   d = find_directory(path);
+   if (d == NULL)
+   {
+      return 0;
+   }
+
+   current = newest(d, type, &mtime);
+   if (current == 0)
+   {
+      free(d);
+      return 0;
+   }
+
+   pthread_mutex_lock(&dictionary_lock);
+
+   for (int i = 0; cdict == NULL && i < dictionary_cache_size; i++)
+   {
+      if (dictionary_cache[i].id == current && dictionary_cache[i].cdict != NULL && dictionary_cache[i].level == level)
+      {
+         cdict = dictionary_cache[i].cdict;
+      }
+   }
+
+   if (cdict == NULL)
+   {
+      memset(file, 0, sizeof(file));
+      snprintf(file, sizeof(file), "%s/%s-%08x%s", d, type_name(type), current, DICTIONARY_SUFFIX);
+
+      if (read_dictionary(file, &buffer, &size))
+      {
+         goto error;
+      }
+
+      if (dictionary_cache_size < DICTIONARY_CACHE_SIZE)
+      {
+         cdict = ZSTD_createCDict(buffer, size, level);
+         if (cdict == NULL)
+         {
+            goto error;
+         }
+
+         dictionary_cache[dictionary_cache_size].id = current;
+         dictionary_cache[dictionary_cache_size].level = level;
+         dictionary_cache[dictionary_cache_size].cdict = cdict;
+         dictionary_cache[dictionary_cache_size].ddict = NULL;
+         dictionary_cache_size++;
+      }
+      else if (ZSTD_isError(ZSTD_CCtx_loadDictionary(cctx, buffer, size)))
+      {
+         goto error;
+      }
+   }
+
+   pthread_mutex_unlock(&dictionary_lock);
+
+   if (cdict != NULL && ZSTD_isError(ZSTD_CCtx_refCDict(cctx, cdict)))
+   {
+      goto error_unlocked;
+   }
+
+   *id = current;
+
+   free(buffer);
+   free(d);
+
+   return 0;
+
+error:
+
+   pthread_mutex_unlock(&dictionary_lock);
+
+error_unlocked:
+
+   pgmoneta_log_error("Dictionary: Could not use dictionary %08x for %s", current, path);
+
+   free(buffer);
+   free(d);
+
+   return 1;
+}
+
+int
+pgmoneta_dictionary_decompress(char* path, uint32_t id, ZSTD_DCtx* dctx)
+{
+   char* file = NULL;
+   void* buffer = NULL;
+   size_t size = 0;
+   ZSTD_DDict* ddict = NULL;
+
+   ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+   ZSTD_DCtx_refDDict(dctx, NULL);
+
+   if (id == 0)
+   {
+      return 0;
+   }
+
+   pthread_mutex_lock(&dictionary_lock);
+
+   for (int i = 0; ddict == NULL && i < dictionary_cache_size; i++)
+   {
+      if (dictionary_cache[i].id == id && dictionary_cache[i].ddict != NULL)
+      {
+         ddict = dictionary_cache[i].ddict;
+      }
+   }
+
+   if (ddict == NULL)
+   {
+      file = find_file(path, id);
+      if (file == NULL)
+      {
+         pgmoneta_log_error("Dictionary: Dictionary %08x for %s not found", id, path);
+         goto error;
+      }
+
+      if (read_dictionary(file, &buffer, &size))
+      {
+         goto error;
+      }
+
+      if (dictionary_cache_size < DICTIONARY_CACHE_SIZE)
+      {
+         ddict = ZSTD_createDDict(buffer, size);
+         if (ddict == NULL)
+         {
+            goto error;
+         }
+
+         dictionary_cache[dictionary_cache_size].id = id;
+         dictionary_cache[dictionary_cache_size].level = 0;
+         dictionary_cache[dictionary_cache_size].cdict = NULL;
+         dictionary_cache[dictionary_cache_size].ddict = ddict;
+         dictionary_cache_size++;
+      }
+      else if (ZSTD_isError(ZSTD_DCtx_loadDictionary(dctx, buffer, size)))
+      {
+         goto error;
+      }
+   }
+
+   pthread_mutex_unlock(&dictionary_lock);
+
+   if (ddict != NULL && ZSTD_isError(ZSTD_DCtx_refDDict(dctx, ddict)))
+   {
+      pgmoneta_log_error("Dictionary: Could not use dictionary %08x for %s", id, path);
+      goto error_unlocked;
+   }
+
+   free(buffer);
+   free(file);
+
+   return 0;
+
+error:
+
+   pthread_mutex_unlock(&dictionary_lock);
+
+error_unlocked:
+
+   free(buffer);
+   free(file);
+
+   return 1;
+}
+
+void
+pgmoneta_dictionary_register(int server)
+{
+   char* d = NULL;
+
+   d = pgmoneta_get_server_dictionary(server);
+
+   pgmoneta_dictionary_directory(d);
+
+   free(d);
+}
+
+void
+pgmoneta_dictionary_directory(char* directory)
+{
+   memset(dictionary_registered, 0, sizeof(dictionary_registered));
+   snprintf(dictionary_registered, sizeof(dictionary_registered), "%s", directory);
+}
+
+static char*
+type_name(int type)
+{
+   return type == DICTIONARY_TYPE_WAL ? "wal" : "data";
+}
+
+static uint32_t
+newest(char* directory, int type, time_t* mtime)
+{
+   uint32_t id = 0;
+   unsigned int candidate;
+   char prefix[MISC_LENGTH];
+   char file[MAX_PATH + MISC_LENGTH];
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct stat st;
+
+   *mtime = 0;
+
+   dir = opendir(directory);
+   if (dir == NULL)
+   {
+      return 0;
+   }
+
+   memset(prefix, 0, sizeof(prefix));
+   snprintf(prefix, sizeof(prefix), "%s-", type_name(type));
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (!pgmoneta_starts_with(entry->d_name, prefix) || !pgmoneta_ends_with(entry->d_name, DICTIONARY_SUFFIX))
+      {
+         continue;
+      }
+
+      if (sscanf(entry->d_name + strlen(prefix), "%8x", &candidate) != 1)
+      {
+         continue;
+      }
+
+      memset(file, 0, sizeof(file));
+      snprintf(file, sizeof(file), "%s/%s", directory, entry->d_name);
+
+      if (stat(file, &st) == 0 && (id == 0 || st.st_mtime > *mtime))
+      {
+         id = (uint32_t)candidate;
+         *mtime = st.st_mtime;
+      }
+   }
+
+   closedir(dir);
+
+   return id;
+}
+
+static char*
+find_directory(char* path)
+{
+   char* d = NULL;
+   char* slash = NULL;
+   char* candidate = NULL;
+
+   d = pgmoneta_append(d, path);
+
+   // the dictionaries live next to the wal and backup directories of the server
+   while ((slash = strrchr(d, '/')) != NULL)
+   {
+      *slash = '\0';
+
+      candidate = pgmoneta_append(NULL, d);
+      candidate = pgmoneta_append(candidate, "/");
+      candidate = pgmoneta_append(candidate, DICTIONARY_DIRECTORY);
+
+      if (pgmoneta_is_directory(candidate))
+      {
+         free(d);
+         return candidate;
+      }
+
+      free(candidate);
+      candidate = NULL;
+   }
+
+   free(d);
+
+   if (strlen(dictionary_registered) > 0 && pgmoneta_is_directory(dictionary_registered))
+   {
+      return pgmoneta_append(NULL, dictionary_registered);
+   }
+
+   return NULL;
+}
+
+static char*
+find_file(char* path, uint32_t id)
+{
+   char* d = NULL;
+   char* file = NULL;
+
+   d = find_directory(path);
+   if (d == NULL)
+   {
+      return NULL;
+   }
+
+   for (int type = DICTIONARY_TYPE_WAL; type <= DICTIONARY_TYPE_DATA; type++)
+   {
+      file = pgmoneta_format_and_append(NULL, "%s/%s-%08x%s", d, type_name(type), id, DICTIONARY_SUFFIX);
+
+      if (pgmoneta_exists(file))
+      {
+         free(d);
+         return file;
+      }
+
+      free(file);
+      file = NULL;
+   }
+
+   free(d);
+
+   // an older dictionary may only be known to the registered server
+   if (strlen(dictionary_registered) > 0)
+   {
+      for (int type = DICTIONARY_TYPE_WAL; type <= DICTIONARY_TYPE_DATA; type++)
+      {
+         file = pgmoneta_format_and_append(NULL, "%s/%s-%08x%s", dictionary_registered, type_name(type), id, DICTIONARY_SUFFIX);
+
+         if (pgmoneta_exists(file))
+         {
+            return file;
+         }
+
+         free(file);
+         file = NULL;
+      }
+   }
+
+   return NULL;
+}
+
+static int
+read_dictionary(char* file, void** buffer, size_t* size)
+{
+   FILE* f = NULL;
+   struct stat st;
+   void* b = NULL;
+
+   *buffer = NULL;
+   *size = 0;
+
+   if (stat(file, &st) != 0 || st.st_size <= 0)
+   {
+      goto error;
+   }
+
+   b = malloc(st.st_size);
+   if (b == NULL)
+   {
+      goto error;
+   }
+
+   f = fopen(file, "rb");
+   if (f == NULL)
+   {
+      goto error;
+   }
+
+   if (fread(b, 1, st.st_size, f) != (size_t)st.st_size)
+   {
+      goto error;
+   }
+
+   fclose(f);
+
+   *buffer = b;
+   *size = (size_t)st.st_size;
+
+   return 0;
+
+error:
+
+   pgmoneta_log_error("Dictionary: Could not read %s", file);
+
+   if (f != NULL)
+   {
+      fclose(f);
+   }
+
+   free(b);
+
+   return 1;
+}
+
+static int
+sample_wal(char* directory, char* samples, size_t* sizes, size_t capacity, size_t* total, size_t* n)
+{
+   char file[MAX_PATH + MISC_LENGTH];
+   size_t length;
+   size_t start;
+   DIR* dir = NULL;
+   struct dirent* entry;
+
+   dir = opendir(directory);
+   if (dir == NULL)
+   {
+      return 1;
+   }
+
+   while ((entry = readdir(dir)) != NULL && *total < DICTIONARY_SAMPLE_SIZE)
+   {
+      if (entry->d_type != DT_REG || !pgmoneta_is_wal_file(entry->d_name))
+      {
+         continue;
+      }
+
+      memset(file, 0, sizeof(file));
+      snprintf(file, sizeof(file), "%s/%s", directory, entry->d_name);
+
+      // spread the samples over a few segments
+      length = MIN((size_t)(DICTIONARY_SAMPLE_SIZE / 4), DICTIONARY_SAMPLE_SIZE - *total);
+      start = *total;
+
+      if (add_sample(file, 0, length, samples, sizes, capacity, total, n) && *total == start)
+      {
+         continue;
+      }
+
+      // replace the sample of the whole chunk by one sample per page
+      (*n)--;
+      for (size_t offset = 0; offset < *total - start && *n < capacity; offset += DICTIONARY_SAMPLE_PAGE)
+      {
+         sizes[*n] = MIN((size_t)DICTIONARY_SAMPLE_PAGE, *total - start - offset);
+         (*n)++;
+      }
+   }
+
+   closedir(dir);
+
+   return 0;
+}
+
+static int
+sample_data(char* directory, char* samples, size_t* sizes, size_t capacity, size_t* total, size_t* n)
+{
+   char file[MAX_PATH + MISC_LENGTH];
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct stat st;
+
+   dir = opendir(directory);
+   if (dir == NULL)
+   {
+      return 1;
+   }
+
+   while ((entry = readdir(dir)) != NULL && *total < DICTIONARY_SAMPLE_SIZE)
+   {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      {
+         continue;
+      }
+
+      memset(file, 0, sizeof(file));
+      snprintf(file, sizeof(file), "%s/%s", directory, entry->d_name);
+
+      if (entry->d_type == DT_DIR)
+      {
+         sample_data(file, samples, sizes, capacity, total, n);
+      }
+      else if (entry->d_type == DT_REG)
+      {
+         if (pgmoneta_is_compressed(entry->d_name) || pgmoneta_is_encrypted(entry->d_name) ||
+             pgmoneta_ends_with(entry->d_name, "backup_manifest") ||
+             pgmoneta_ends_with(entry->d_name, "backup_label"))
+         {
+            continue;
+         }
+
+         if (stat(file, &st) != 0 || st.st_size == 0 || st.st_size > DICTIONARY_SMALL_FILE)
+         {
+            continue;
+         }
+
+         add_sample(file, 0, (size_t)st.st_size, samples, sizes, capacity, total, n);
+      }
+   }
+
+   closedir(dir);
+
+   return 0;
+}
+
+static int
+add_sample(char* file, size_t offset, size_t length, char* samples, size_t* sizes, size_t capacity, size_t* total, size_t* n)
+{
+   FILE* f = NULL;
+   size_t nread;
+
+   if (*n >= capacity || *total + length > DICTIONARY_SAMPLE_SIZE)
+   {
+      return 1;
+   }
+
+   f = fopen(file, "rb");
+   if (f == NULL)
+   {
+      return 1;
+   }
+
+   if (fseeko(f, (off_t)offset, SEEK_SET))
+   {
+      fclose(f);
+      return 1;
+   }
+
+   nread = fread(samples + *total, 1, length, f);
+   fclose(f);
+
+   if (nread == 0)
+   {
+      return 1;
+   }
+
+   sizes[*n] = nread;
+   *total += nread;
+   (*n)++;
+
+   return nread == length ? 0 : 1;
+}
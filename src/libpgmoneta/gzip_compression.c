@@ -28,13 +28,19 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <codec.h>
+#include <compression.h>
 #include <gzip_compression.h>
 #include <logging.h>
 #include <management.h>
 #include <utils.h>
+#include <wal.h>
+#include <walindex.h>
 
 /* system */
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,11 +52,48 @@
 #define NAME "gzip"
 #define BUFFER_LENGTH 8192
 
-static int gz_compress(char* from, int level, char* to);
-static int gz_decompress(char* from, char* to);
+/** @struct gzip_file
+ * Defines a file deflated in parallel
+ */
+struct gzip_file
+{
+   pthread_mutex_t lock;    /**< The lock of the output */
+   char from[MAX_PATH];     /**< The source file */
+   char to[MAX_PATH];       /**< The destination file */
+   int level;               /**< The compression level */
+   FILE* out;               /**< The destination */
+   size_t size;             /**< The size of the source file */
+   int number_of_chunks;    /**< The number of chunks */
+   int remaining;           /**< The number of chunks not done */
+   int next;                /**< The next chunk to write */
+   uLong crc;               /**< The CRC-32 of the chunks written */
+   char** data;             /**< The deflated chunks done but not written */
+   size_t* sizes;           /**< The deflated size of each chunk */
+   uLong* crcs;             /**< The CRC-32 of each chunk */
+   bool* done;              /**< Is the chunk done */
+   bool failed;             /**< Did a chunk fail */
+   bool abandoned;          /**< Is the file left to the caller */
+   pthread_cond_t finished; /**< Signaled when the last chunk of an abandoned file is done */
+   struct workers* workers; /**< The workers of the chunks */
+};
+
+/** @struct gzip_chunk
+ * Defines the worker input of a chunk
+ */
+struct gzip_chunk
+{
+   struct worker_common common; /**< The common base */
+   struct gzip_file* file;      /**< The file */
+   int chunk;                   /**< The chunk */
+};
 
 static void do_gz_compress(struct worker_common* wc);
 static void do_gz_decompress(struct worker_common* wc);
+static int gzip_parallel(char* from, char* to, int level, struct workers* workers);
+static void do_gzip_chunk(struct worker_common* wc);
+static void gzip_chunk_done(struct gzip_file* f, int chunk, char* data, size_t size, uLong crc, bool ok);
+static void gzip_file_finish(struct gzip_file* f);
+static void put_le32(unsigned char* p, uint32_t value);
 
 int
 pgmoneta_gzip_data(char* directory, struct workers* workers)
@@ -114,7 +157,11 @@ pgmoneta_gzip_data(char* directory, struct workers* workers)
             to = pgmoneta_append(to, entry->d_name);
             to = pgmoneta_append(to, ".gz");
 
-            if (!pgmoneta_create_worker_input(directory, from, to, level, workers, &wi))
+            if (workers != NULL && workers->outcome && !gzip_parallel(from, to, level, workers))
+            {
+               pgmoneta_log_trace("GZip: Compressing %s in parallel", from);
+            }
+            else if (!pgmoneta_create_worker_input(directory, from, to, level, workers, &wi))
             {
                if (workers != NULL)
                {
@@ -167,9 +214,10 @@ do_gz_compress(struct worker_common* wc)
 {
    struct worker_input* wi = (struct worker_input*)wc;
 
-   if (pgmoneta_exists(wi->from))
+   if (pgmoneta_exists(wi->from) &&
+       pgmoneta_compression_decide(wi->from, COMPRESSION_CLIENT_GZIP, &wi->level) != COMPRESSION_DECISION_STORE)
    {
-      if (gz_compress(wi->from, wi->level, wi->to))
+      if (pgmoneta_codec_file(COMPRESSION_CLIENT_GZIP, true, wi->level, wi->from, wi->to))
       {
          pgmoneta_log_error("Gzip: Could not compress %s", wi->from);
       }
@@ -271,7 +319,13 @@ pgmoneta_gzip_wal(char* directory)
 
          if (pgmoneta_exists(from))
          {
-            if (gz_compress(from, level, to))
+            // the zero-filled tail is restored by pgmoneta_wal_pad()
+            if (pgmoneta_is_wal_file(entry->d_name))
+            {
+               pgmoneta_wal_trim(from);
+            }
+
+            if (pgmoneta_codec_file(COMPRESSION_CLIENT_GZIP, true, level, from, to))
             {
                pgmoneta_log_error("Gzip: Could not compress %s/%s", directory, entry->d_name);
                break;
@@ -286,6 +340,7 @@ pgmoneta_gzip_wal(char* directory)
                pgmoneta_log_debug("%s doesn't exists", from);
             }
             pgmoneta_permission(to, 6, 0, 0);
+            pgmoneta_wal_index_add(to);
          }
 
          free(from);
@@ -418,7 +473,7 @@ pgmoneta_gzip_file(char* from, char* to)
       level = 9;
    }
 
-   if (gz_compress(from, level, to))
+   if (pgmoneta_codec_file(COMPRESSION_CLIENT_GZIP, true, level, from, to))
    {
       goto error;
    }
@@ -547,7 +602,7 @@ pgmoneta_gunzip_file(char* from, char* to)
 {
    if (pgmoneta_ends_with(from, ".gz"))
    {
-      if (gz_decompress(from, to))
+      if (pgmoneta_codec_file(COMPRESSION_CLIENT_GZIP, false, 0, from, to))
       {
          pgmoneta_log_error("Gzip: Could not decompress %s", from);
          goto error;
@@ -848,7 +903,7 @@ do_gz_decompress(struct worker_common* wc)
 
    if (pgmoneta_exists(wi->from))
    {
-      if (gz_decompress(wi->from, wi->to))
+      if (pgmoneta_codec_file(COMPRESSION_CLIENT_GZIP, false, 0, wi->from, wi->to))
       {
          pgmoneta_log_error("Gzip: Could not decompress %s", wi->from);
       }
@@ -862,136 +917,352 @@ do_gz_decompress(struct worker_common* wc)
 }
 
 static int
-gz_compress(char* from, int level, char* to)
+gzip_parallel(char* from, char* to, int level, struct workers* workers)
 {
-   char buf[BUFFER_LENGTH];
-   FILE* in = NULL;
-   char mode[4];
-   gzFile out = NULL;
-   size_t length;
+   struct gzip_file* f = NULL;
+   struct gzip_chunk* c = NULL;
+   unsigned char header[10] = {0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3};
+   size_t size;
 
-   in = fopen(from, "rb");
-   if (in == NULL)
+   size = pgmoneta_get_file_size(from);
+   if (size <= (size_t)GZIP_PARALLEL_CHUNKS * GZIP_CHUNK_SIZE)
    {
       goto error;
    }
 
-   memset(&mode[0], 0, sizeof(mode));
-   mode[0] = 'w';
-   mode[1] = 'b';
-   mode[2] = '0' + level;
+   if (pgmoneta_compression_decide(from, COMPRESSION_CLIENT_GZIP, &level) == COMPRESSION_DECISION_STORE)
+   {
+      return 0;
+   }
 
-   out = gzopen(to, mode);
-   if (out == NULL)
+   f = (struct gzip_file*)malloc(sizeof(struct gzip_file));
+   if (f == NULL)
    {
       goto error;
    }
 
-   do
+   memset(f, 0, sizeof(struct gzip_file));
+
+   pthread_mutex_init(&f->lock, NULL);
+   pthread_cond_init(&f->finished, NULL);
+   f->workers = workers;
+   snprintf(f->from, sizeof(f->from), "%s", from);
+   snprintf(f->to, sizeof(f->to), "%s", to);
+   f->level = level;
+   f->size = size;
+   f->number_of_chunks = (int)((size + GZIP_CHUNK_SIZE - 1) / GZIP_CHUNK_SIZE);
+   f->remaining = f->number_of_chunks;
+   f->crc = crc32(0L, Z_NULL, 0);
+
+   f->data = (char**)calloc(f->number_of_chunks, sizeof(char*));
+   f->sizes = (size_t*)calloc(f->number_of_chunks, sizeof(size_t));
+   f->crcs = (uLong*)calloc(f->number_of_chunks, sizeof(uLong));
+   f->done = (bool*)calloc(f->number_of_chunks, sizeof(bool));
+
+   if (f->data == NULL || f->sizes == NULL || f->crcs == NULL || f->done == NULL)
    {
-      length = fread(buf, 1, sizeof(buf), in);
+      goto error;
+   }
+
+   f->out = fopen(to, "wb");
+   if (f->out == NULL)
+   {
+      goto error;
+   }
+
+   // a single member; the chunks form one deflate stream
+   if (fwrite(&header[0], 1, sizeof(header), f->out) != sizeof(header))
+   {
+      goto error;
+   }
 
-      if (ferror(in))
+   for (int i = 0; i < f->number_of_chunks; i++)
+   {
+      c = (struct gzip_chunk*)malloc(sizeof(struct gzip_chunk));
+      if (c != NULL)
       {
-         goto error;
+         memset(c, 0, sizeof(struct gzip_chunk));
+         c->common.workers = workers;
+         c->file = f;
+         c->chunk = i;
       }
 
-      if (length > 0)
+      if (c == NULL || pgmoneta_workers_add(workers, do_gzip_chunk, (struct worker_common*)c))
       {
-         if (gzwrite(out, buf, (unsigned)length) != (int)length)
+         free(c);
+
+         // the chunks already queued are waited for, so the caller can process the file serially
+         pthread_mutex_lock(&f->lock);
+         f->failed = true;
+         f->abandoned = true;
+         f->remaining -= f->number_of_chunks - i;
+         while (f->remaining > 0)
          {
-            goto error;
+            pthread_cond_wait(&f->finished, &f->lock);
          }
+         pthread_mutex_unlock(&f->lock);
+
+         goto error;
+      }
+   }
+
+   return 0;
+
+error:
+
+   if (f != NULL)
+   {
+      if (f->out != NULL)
+      {
+         fclose(f->out);
+         pgmoneta_delete_file(to, NULL);
+      }
+      for (int i = 0; f->data != NULL && i < f->number_of_chunks; i++)
+      {
+         free(f->data[i]);
       }
+      pthread_mutex_destroy(&f->lock);
+      pthread_cond_destroy(&f->finished);
+      free(f->data);
+      free(f->sizes);
+      free(f->crcs);
+      free(f->done);
+      free(f);
    }
-   while (length > 0);
 
-   fclose(in);
-   in = NULL;
+   return 1;
+}
 
-   if (gzclose(out) != Z_OK)
+static void
+do_gzip_chunk(struct worker_common* wc)
+{
+   struct gzip_chunk* c = (struct gzip_chunk*)wc;
+   struct gzip_file* f = c->file;
+   z_stream z;
+   bool initialized = false;
+   bool last;
+   char* in = NULL;
+   char* out = NULL;
+   size_t offset;
+   size_t dictionary;
+   size_t in_size;
+   size_t out_size;
+   size_t pos = 0;
+   ssize_t r;
+   uLong crc;
+   int fd = -1;
+
+   offset = (size_t)c->chunk * GZIP_CHUNK_SIZE;
+   dictionary = offset < GZIP_DICTIONARY_SIZE ? offset : GZIP_DICTIONARY_SIZE;
+   in_size = f->size - offset < GZIP_CHUNK_SIZE ? f->size - offset : GZIP_CHUNK_SIZE;
+   last = c->chunk == f->number_of_chunks - 1;
+
+   // the end of the previous chunk is read along with the chunk
+   in = (char*)malloc(dictionary + in_size);
+   if (in == NULL)
    {
-      out = NULL;
       goto error;
    }
 
-   return 0;
+   fd = open(f->from, O_RDONLY);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   while (pos < dictionary + in_size)
+   {
+      r = pread(fd, in + pos, dictionary + in_size - pos, offset - dictionary + pos);
+      if (r <= 0)
+      {
+         goto error;
+      }
+      pos += r;
+   }
+
+   close(fd);
+   fd = -1;
+
+   memset(&z, 0, sizeof(z_stream));
+   if (deflateInit2(&z, f->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+   {
+      goto error;
+   }
+   initialized = true;
+
+   if (dictionary > 0 && deflateSetDictionary(&z, (Bytef*)in, (uInt)dictionary) != Z_OK)
+   {
+      goto error;
+   }
+
+   out_size = deflateBound(&z, (uLong)in_size) + 16;
+   out = (char*)malloc(out_size);
+   if (out == NULL)
+   {
+      goto error;
+   }
+
+   z.next_in = (Bytef*)(in + dictionary);
+   z.avail_in = (uInt)in_size;
+   z.next_out = (Bytef*)out;
+   z.avail_out = (uInt)out_size;
+
+   // all but the last chunk end on a byte boundary without the final block bit
+   if (deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH) != (last ? Z_STREAM_END : Z_OK) || z.avail_in != 0)
+   {
+      goto error;
+   }
+
+   crc = crc32(crc32(0L, Z_NULL, 0), (Bytef*)(in + dictionary), (uInt)in_size);
+
+   gzip_chunk_done(f, c->chunk, out, out_size - z.avail_out, crc, true);
+
+   deflateEnd(&z);
+   free(in);
+   free(c);
+
+   return;
 
 error:
 
-   if (in != NULL)
+   if (fd != -1)
    {
-      fclose(in);
+      close(fd);
    }
 
-   if (out != NULL)
+   if (initialized)
    {
-      gzclose(out);
+      deflateEnd(&z);
    }
 
-   return 1;
+   free(in);
+
+   gzip_chunk_done(f, c->chunk, out, 0, 0, false);
+
+   free(c);
 }
 
-static int
-gz_decompress(char* from, char* to)
+static void
+gzip_chunk_done(struct gzip_file* f, int chunk, char* data, size_t size, uLong crc, bool ok)
 {
-   char buf[BUFFER_LENGTH];
-   FILE* out = NULL;
-   char mode[3];
-   gzFile in = NULL;
    size_t length;
+   bool last;
+   bool abandoned;
 
-   memset(&mode[0], 0, sizeof(mode));
-   mode[0] = 'r';
-   mode[1] = 'b';
+   pthread_mutex_lock(&f->lock);
 
-   in = gzopen(from, mode);
-   if (in == NULL)
+   if (ok)
    {
-      goto error;
+      f->data[chunk] = data;
+      f->sizes[chunk] = size;
+      f->crcs[chunk] = crc;
+      f->done[chunk] = true;
    }
-
-   out = fopen(to, "wb");
-   if (out == NULL)
+   else
    {
-      goto error;
+      free(data);
+      f->failed = true;
    }
 
-   do
+   // chunks are written in order, as soon as the ones before them are written
+   while (!f->failed && f->next < f->number_of_chunks && f->done[f->next])
    {
-      length = (int)gzread(in, buf, (unsigned)BUFFER_LENGTH);
+      if (fwrite(f->data[f->next], 1, f->sizes[f->next], f->out) != f->sizes[f->next])
+      {
+         f->failed = true;
+      }
 
-      if (length > 0)
+      length = f->size - (size_t)f->next * GZIP_CHUNK_SIZE;
+      if (length > GZIP_CHUNK_SIZE)
       {
-         if (fwrite(buf, 1, length, out) != length)
-         {
-            goto error;
-         }
+         length = GZIP_CHUNK_SIZE;
       }
+      f->crc = crc32_combine(f->crc, f->crcs[f->next], (z_off_t)length);
+
+      free(f->data[f->next]);
+      f->data[f->next] = NULL;
+      f->next++;
    }
-   while (length > 0);
 
-   if (gzclose(in) != Z_OK)
+   f->remaining--;
+   last = f->remaining == 0;
+   abandoned = f->abandoned;
+
+   if (last && abandoned)
    {
-      in = NULL;
-      goto error;
+      pthread_cond_signal(&f->finished);
    }
 
-   fclose(out);
+   pthread_mutex_unlock(&f->lock);
 
-   return 0;
+   if (last && !abandoned)
+   {
+      gzip_file_finish(f);
+   }
+}
 
-error:
+static void
+gzip_file_finish(struct gzip_file* f)
+{
+   unsigned char trailer[8];
+
+   if (!f->failed)
+   {
+      put_le32(&trailer[0], (uint32_t)f->crc);
+      put_le32(&trailer[4], (uint32_t)(f->size & 0xFFFFFFFF));
+
+      if (fwrite(&trailer[0], 1, sizeof(trailer), f->out) != sizeof(trailer))
+      {
+         f->failed = true;
+      }
+   }
 
-   if (in != NULL)
+   if (fclose(f->out) != 0)
    {
-      gzclose(in);
+      f->failed = true;
    }
 
-   if (out != NULL)
+   if (f->failed)
    {
-      fclose(out);
+      // a chunk failed, so the file is compressed as a whole
+      pgmoneta_log_debug("GZip: Compressing %s serially", f->from);
+      f->failed = pgmoneta_codec_file(COMPRESSION_CLIENT_GZIP, true, f->level, f->from, f->to) != 0;
    }
 
-   return 1;
+   if (f->failed)
+   {
+      pgmoneta_log_error("GZip: Could not compress %s", f->from);
+      pgmoneta_delete_file(f->to, NULL);
+
+      if (f->workers != NULL)
+      {
+         f->workers->outcome = false;
+      }
+   }
+   else
+   {
+      pgmoneta_delete_file(f->from, NULL);
+   }
+
+   for (int i = 0; i < f->number_of_chunks; i++)
+   {
+      free(f->data[i]);
+   }
+
+   pthread_mutex_destroy(&f->lock);
+   pthread_cond_destroy(&f->finished);
+   free(f->data);
+   free(f->sizes);
+   free(f->crcs);
+   free(f->done);
+   free(f);
+}
+
+static void
+put_le32(unsigned char* p, uint32_t value)
+{
+   p[0] = value & 0xFF;
+   p[1] = (value >> 8) & 0xFF;
+   p[2] = (value >> 16) & 0xFF;
+   p[3] = (value >> 24) & 0xFF;
 }
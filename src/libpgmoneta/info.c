@@ -31,6 +31,8 @@
 #include <aes.h>
 #include <backup.h>
 #include <compression.h>
+#include <dedup.h>
+#include <dictionary.h>
 #include <info.h>
 #include <logging.h>
 #include <management.h>
@@ -617,6 +619,10 @@ pgmoneta_load_info(char* directory, char* label, struct backup** backup)
          {
             bck->encryption_elapsed_time = atof(&value[0]);
          }
+         else if (!strcmp(INFO_DICTIONARY, &key[0]))
+         {
+            bck->dictionary = (uint32_t)strtoul(&value[0], NULL, 16);
+         }
          else if (!strcmp(INFO_LINKING_ELAPSED, &key[0]))
          {
             bck->linking_elapsed_time = atof(&value[0]);
@@ -1381,6 +1387,7 @@ pgmoneta_save_info(char* directory, struct backup* backup)
    write_info(sfile, "%s=%u\n", INFO_START_TIMELINE, backup->start_timeline);
    write_info(sfile, "%s=%u\n", INFO_END_TIMELINE, backup->end_timeline);
    write_info(sfile, "%s=%s\n", INFO_PARENT, backup->parent_label);
+   write_info(sfile, "%s=%08x\n", INFO_DICTIONARY, backup->dictionary);
    write_info(sfile, "%s=%s\n", INFO_COMMENTS, backup->comments);
 
    memset(&buffer[0], 0, sizeof(buffer));
@@ -1420,7 +1427,10 @@ pgmoneta_rfile_create(int server, char* label, char* relative_dir, char* base_fi
    char* extracted_file_path = NULL;
    char* final_relative_path = NULL;
    char base_relative_path[MAX_PATH];
+   char recipe_relative_path[MAX_PATH + MISC_LENGTH];
+   char* backup_file_path = NULL;
    FILE* fp = NULL;
+   struct seekable_reader* reader = NULL;
 
    memset(base_relative_path, 0, MAX_PATH);
    if (pgmoneta_ends_with(relative_dir, "/"))
@@ -1432,15 +1442,60 @@ pgmoneta_rfile_create(int server, char* label, char* relative_dir, char* base_fi
       snprintf(base_relative_path, MAX_PATH, "%s/%s", relative_dir, base_file_name);
    }
 
-   // try both base and final relative path
+   // try both base and final relative path, and the recipe of a deduplicated backup
    if (pgmoneta_extract_backup_file(server, label, base_relative_path, NULL, &extracted_file_path))
    {
       free(extracted_file_path);
       extracted_file_path = NULL;
       file_final_name(base_relative_path, encryption, compression, &final_relative_path);
+
+      // a seekable compressed file is read in place, only the frames holding the needed blocks get decompressed
+      if (pgmoneta_seekable_supported(compression))
+      {
+         backup_file_path = pgmoneta_get_server_backup_identifier_data(server, label);
+         if (!pgmoneta_ends_with(backup_file_path, "/"))
+         {
+            backup_file_path = pgmoneta_append_char(backup_file_path, '/');
+         }
+         backup_file_path = pgmoneta_append(backup_file_path, final_relative_path);
+
+         if (pgmoneta_exists(backup_file_path) &&
+             !pgmoneta_seekable_open(backup_file_path, compression, encryption, &reader))
+         {
+            rf = (struct rfile*) malloc(sizeof(struct rfile));
+            if (rf == NULL)
+            {
+               pgmoneta_seekable_close(reader);
+               goto error;
+            }
+            memset(rf, 0, sizeof(struct rfile));
+
+            rf->reader = reader;
+            rf->filepath = backup_file_path;
+            *rfile = rf;
+
+            free(final_relative_path);
+            return 0;
+         }
+
+         free(backup_file_path);
+         backup_file_path = NULL;
+      }
+
       if (pgmoneta_extract_backup_file(server, label, final_relative_path, NULL, &extracted_file_path))
       {
-         goto error;
+         free(extracted_file_path);
+         extracted_file_path = NULL;
+         free(final_relative_path);
+         final_relative_path = NULL;
+
+         memset(recipe_relative_path, 0, sizeof(recipe_relative_path));
+         snprintf(recipe_relative_path, sizeof(recipe_relative_path), "%s%s", base_relative_path, DEDUP_RECIPE_SUFFIX);
+         file_final_name(recipe_relative_path, encryption, compression, &final_relative_path);
+         if (pgmoneta_extract_backup_file(server, label, final_relative_path, NULL, &extracted_file_path))
+         {
+            goto error;
+         }
       }
    }
    fp = fopen(extracted_file_path, "r");
@@ -1460,12 +1515,48 @@ pgmoneta_rfile_create(int server, char* label, char* relative_dir, char* base_fi
    return 0;
 
 error:
+   free(backup_file_path);
    free(extracted_file_path);
    free(final_relative_path);
    pgmoneta_rfile_destroy(rf);
    return 1;
 }
 
+int
+pgmoneta_rfile_read(struct rfile* rf, uint64_t offset, void* buffer, size_t size, size_t* nread)
+{
+   *nread = 0;
+
+   if (rf->reader != NULL)
+   {
+      return pgmoneta_seekable_read(rf->reader, offset, buffer, size, nread);
+   }
+
+   if (fseeko(rf->fp, (off_t)offset, SEEK_SET))
+   {
+      return 1;
+   }
+
+   *nread = fread(buffer, 1, size, rf->fp);
+   if (ferror(rf->fp))
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+uint64_t
+pgmoneta_rfile_size(struct rfile* rf)
+{
+   if (rf->reader != NULL)
+   {
+      return rf->reader->size;
+   }
+
+   return pgmoneta_get_file_size(rf->filepath);
+}
+
 void
 pgmoneta_rfile_destroy(struct rfile* rf)
 {
@@ -1477,7 +1568,12 @@ pgmoneta_rfile_destroy(struct rfile* rf)
    {
       fclose(rf->fp);
    }
-   if (rf->filepath != NULL)
+   if (rf->reader != NULL)
+   {
+      // the backup file itself, keep it
+      pgmoneta_seekable_close(rf->reader);
+   }
+   else if (rf->filepath != NULL)
    {
       // this is the extracted file, we should delete it
       pgmoneta_delete_file(rf->filepath, NULL);
@@ -1492,7 +1588,8 @@ int
 pgmoneta_incremental_rfile_initialize(int server, char* label, char* relative_dir, char* base_file_name, int encryption, int compression, struct rfile** rfile)
 {
    uint32_t magic = 0;
-   int nread = 0;
+   size_t nread = 0;
+   uint64_t offset = 0;
    struct rfile* rf = NULL;
    struct main_configuration* config;
    size_t relsegsz = 0;
@@ -1519,8 +1616,7 @@ pgmoneta_incremental_rfile_initialize(int server, char* label, char* relative_di
    }
 
    // read magic number from header
-   nread = fread(&magic, 1, sizeof(uint32_t), rf->fp);
-   if (nread != sizeof(uint32_t))
+   if (pgmoneta_rfile_read(rf, offset, &magic, sizeof(uint32_t), &nread) || nread != sizeof(uint32_t))
    {
       pgmoneta_log_error("rfile initialize: incomplete file header at %s, cannot read magic number", rf->filepath);
       goto error;
@@ -1532,9 +1628,10 @@ pgmoneta_incremental_rfile_initialize(int server, char* label, char* relative_di
       goto error;
    }
 
+   offset += sizeof(uint32_t);
+
    // read number of blocks
-   nread = fread(&rf->num_blocks, 1, sizeof(uint32_t), rf->fp);
-   if (nread != sizeof(uint32_t))
+   if (pgmoneta_rfile_read(rf, offset, &rf->num_blocks, sizeof(uint32_t), &nread) || nread != sizeof(uint32_t))
    {
       pgmoneta_log_error("rfile initialize: incomplete file header at %s%s, cannot read block count", relative_dir, base_file_name);
       goto error;
@@ -1545,9 +1642,10 @@ pgmoneta_incremental_rfile_initialize(int server, char* label, char* relative_di
       goto error;
    }
 
+   offset += sizeof(uint32_t);
+
    // read truncation block length
-   nread = fread(&rf->truncation_block_length, 1, sizeof(uint32_t), rf->fp);
-   if (nread != sizeof(uint32_t))
+   if (pgmoneta_rfile_read(rf, offset, &rf->truncation_block_length, sizeof(uint32_t), &nread) || nread != sizeof(uint32_t))
    {
       pgmoneta_log_error("rfile initialize: incomplete file header at %s%s, cannot read truncation block length", relative_dir, base_file_name);
       goto error;
@@ -1558,11 +1656,13 @@ pgmoneta_incremental_rfile_initialize(int server, char* label, char* relative_di
       goto error;
    }
 
+   offset += sizeof(uint32_t);
+
    if (rf->num_blocks > 0)
    {
       rf->relative_block_numbers = malloc(sizeof(uint32_t) * rf->num_blocks);
-      nread = fread(rf->relative_block_numbers, sizeof(uint32_t), rf->num_blocks, rf->fp);
-      if (nread != rf->num_blocks)
+      if (pgmoneta_rfile_read(rf, offset, rf->relative_block_numbers, sizeof(uint32_t) * rf->num_blocks, &nread) ||
+          nread != sizeof(uint32_t) * rf->num_blocks)
       {
          pgmoneta_log_error("rfile initialize: incomplete file header at %s, cannot read relative block numbers", rf->filepath);
          goto error;
@@ -1594,6 +1694,8 @@ pgmoneta_extract_backup_file(int server, char* label, char* relative_file_path,
 
    *target_file = NULL;
 
+   pgmoneta_dictionary_register(server);
+
    from = pgmoneta_get_server_backup_identifier_data(server, label);
 
    if (!pgmoneta_ends_with(from, "/"))
@@ -1667,6 +1769,27 @@ pgmoneta_extract_backup_file(int server, char* label, char* relative_file_path,
       to = new_to;
    }
 
+   if (pgmoneta_ends_with(to, DEDUP_RECIPE_SUFFIX))
+   {
+      char* new_to = NULL;
+
+      if (pgmoneta_strip_extension(to, &new_to))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_dedup_expand_file(server, to, new_to))
+      {
+         free(new_to);
+         goto error;
+      }
+
+      pgmoneta_delete_file(to, NULL);
+
+      free(to);
+      to = new_to;
+   }
+
    pgmoneta_log_trace("Extract: %s -> %s", from, to);
 
    *target_file = to;
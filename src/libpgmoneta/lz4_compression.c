@@ -30,11 +30,16 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <codec.h>
+#include <compression.h>
 #include <logging.h>
 #include <lz4.h>
 #include <lz4_compression.h>
 #include <management.h>
+#include <seekable.h>
 #include <utils.h>
+#include <wal.h>
+#include <walindex.h>
 
 /* system */
 #include <dirent.h>
@@ -47,9 +52,6 @@
 
 #define NAME "lz4"
 
-static int lz4_compress(char* from, char* to);
-static int lz4_decompress(char* from, char* to);
-
 static void do_lz4_compress(struct worker_common* wc);
 static void do_lz4_decompress(struct worker_common* wc);
 
@@ -151,9 +153,10 @@ do_lz4_compress(struct worker_common* wc)
 {
    struct worker_input* wi = (struct worker_input*)wc;
 
-   if (pgmoneta_exists(wi->from))
+   if (pgmoneta_exists(wi->from) &&
+       pgmoneta_compression_decide(wi->from, COMPRESSION_CLIENT_LZ4, &wi->level) != COMPRESSION_DECISION_STORE)
    {
-      if (lz4_compress(wi->from, wi->to))
+      if (pgmoneta_seekable_compress_file(wi->from, wi->to, COMPRESSION_CLIENT_LZ4, 0, false))
       {
          pgmoneta_log_error("LZ4: Could not compress %s", wi->from);
       }
@@ -204,17 +207,29 @@ pgmoneta_lz4c_wal(char* directory)
          to = pgmoneta_append(to, entry->d_name);
          to = pgmoneta_append(to, ".lz4");
 
-         lz4_compress(from, to);
+         // the zero-filled tail is restored by pgmoneta_wal_pad()
+         if (pgmoneta_is_wal_file(entry->d_name))
+         {
+            pgmoneta_wal_trim(from);
+         }
 
-         if (pgmoneta_exists(from))
+         if (pgmoneta_codec_file(COMPRESSION_CLIENT_LZ4, true, 0, from, to))
          {
-            pgmoneta_delete_file(from, NULL);
+            pgmoneta_log_error("LZ4: Could not compress %s/%s", directory, entry->d_name);
          }
          else
          {
-            pgmoneta_log_debug("%s doesn't exists", from);
+            if (pgmoneta_exists(from))
+            {
+               pgmoneta_delete_file(from, NULL);
+            }
+            else
+            {
+               pgmoneta_log_debug("%s doesn't exists", from);
+            }
+            pgmoneta_permission(to, 6, 0, 0);
+            pgmoneta_wal_index_add(to);
          }
-         pgmoneta_permission(to, 6, 0, 0);
 
          free(from);
          free(to);
@@ -369,7 +384,7 @@ do_lz4_decompress(struct worker_common* wc)
 
    if (pgmoneta_exists(wi->from))
    {
-      if (lz4_decompress(wi->from, wi->to))
+      if (pgmoneta_codec_file(COMPRESSION_CLIENT_LZ4, false, 0, wi->from, wi->to))
       {
          pgmoneta_log_error("LZ4: Could not decompress %s", wi->from);
       }
@@ -488,7 +503,7 @@ pgmoneta_lz4d_file(char* from, char* to)
 {
    if (pgmoneta_ends_with(from, ".lz4"))
    {
-      if (lz4_decompress(from, to))
+      if (pgmoneta_codec_file(COMPRESSION_CLIENT_LZ4, false, 0, from, to))
       {
          pgmoneta_log_error("LZ4: Could not decompress %s", from);
          goto error;
@@ -618,7 +633,7 @@ pgmoneta_lz4c_file(char* from, char* to)
 {
    if (pgmoneta_exists(from))
    {
-      if (lz4_compress(from, to))
+      if (pgmoneta_codec_file(COMPRESSION_CLIENT_LZ4, true, 0, from, to))
       {
          pgmoneta_log_error("LZ4: Could not compress %s", from);
       }
@@ -631,154 +646,6 @@ pgmoneta_lz4c_file(char* from, char* to)
    return 0;
 }
 
-static int
-lz4_compress(char* from, char* to)
-{
-   LZ4_stream_t* lz4Stream = NULL;
-   FILE* fin = NULL;
-   FILE* fout = NULL;
-   char buffIn[2][BLOCK_BYTES];
-   int buffInIndex = 0;
-   char buffOut[LZ4_COMPRESSBOUND(BLOCK_BYTES)];
-
-   lz4Stream = LZ4_createStream();
-   fin = fopen(from, "rb");
-
-   if (fin == NULL)
-   {
-      goto error;
-   }
-
-   fout = fopen(to, "wb");
-
-   if (fout == NULL)
-   {
-      goto error;
-   }
-
-   for (;;)
-   {
-      size_t read = fread(buffIn[buffInIndex], sizeof(char), BLOCK_BYTES, fin);
-      if (read == 0)
-      {
-         break;
-      }
-
-      int compression = LZ4_compress_fast_continue(lz4Stream, buffIn[buffInIndex], buffOut, read, sizeof(buffOut), 1);
-      if (compression <= 0)
-      {
-         break;
-      }
-
-      fwrite(&compression, sizeof(compression), 1, fout);
-      fwrite(buffOut, sizeof(char), (size_t)compression, fout);
-
-      buffInIndex = (buffInIndex + 1) % 2;
-   }
-
-   fclose(fout);
-   fclose(fin);
-   LZ4_freeStream(lz4Stream);
-
-   return 0;
-
-error:
-
-   if (fin != NULL)
-   {
-      fclose(fin);
-   }
-
-   if (fout != NULL)
-   {
-      fclose(fout);
-   }
-
-   return 1;
-}
-
-static int
-lz4_decompress(char* from, char* to)
-{
-   LZ4_streamDecode_t lz4StreamDecodeBody;
-   LZ4_streamDecode_t* lz4StreamDecode = NULL;
-   FILE* fin = NULL;
-   FILE* fout = NULL;
-   char buffIn[2][BLOCK_BYTES];
-   int buffInIndex = 0;
-   char buffOut[LZ4_COMPRESSBOUND(BLOCK_BYTES)];
-   size_t read = 0;
-
-   lz4StreamDecode = &lz4StreamDecodeBody;
-   fin = fopen(from, "rb");
-
-   if (fin == NULL)
-   {
-      goto error;
-   }
-
-   fout = fopen(to, "wb");
-
-   if (fout == NULL)
-   {
-      goto error;
-   }
-
-   LZ4_setStreamDecode(lz4StreamDecode, NULL, 0);
-
-   for (;;)
-   {
-      int compression = 0;
-
-      //If return value 1,read bytes == sizeof(int)
-      //If return value 0,read bytes  < sizeof(int)
-      read = fread(&compression, 1, sizeof(compression), fin);
-      if (read == 0)
-      {
-         break;
-      }
-      if (read < sizeof(compression))
-      {
-         pgmoneta_log_error("lz4_decompression from file compression bytes < sizeof(int)");
-         goto error;
-      }
-
-      read = fread(buffOut, sizeof(char), compression, fin);
-      if (read == 0)
-      {
-         break;
-      }
-
-      int decompression = LZ4_decompress_safe_continue(lz4StreamDecode, buffOut, buffIn[buffInIndex], compression, BLOCK_BYTES);
-      if (decompression <= 0)
-      {
-         break;
-      }
-
-      fwrite(buffIn[buffInIndex], sizeof(char), decompression, fout);
-
-      buffInIndex = (buffInIndex + 1) % 2;
-   }
-
-   fclose(fout);
-   fclose(fin);
-
-   return 0;
-
-error:
-   if (fin != NULL)
-   {
-      fclose(fin);
-   }
-
-   if (fout != NULL)
-   {
-      fclose(fout);
-   }
-
-   return 1;
-}
-
 int
 pgmoneta_lz4c_string(char* s, unsigned char** buffer, size_t* buffer_size)
 {
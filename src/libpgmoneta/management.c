@@ -38,11 +38,14 @@
 #include <zstandard_compression.h>
 
 /* system */
+#include <stdio.h>
 #include <unistd.h>
 
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 
+#define FILE_BLOCK_SIZE 65536
+
 static int read_uint8(char* prefix, SSL* ssl, int socket, uint8_t* i);
 static int read_string(char* prefix, SSL* ssl, int socket, char** str);
 static int write_uint8(char* prefix, SSL* ssl, int socket, uint8_t i);
@@ -160,6 +163,42 @@ error:
    return 1;
 }
 
+int
+pgmoneta_management_request_restore_wal(SSL* ssl, int socket, char* server, char* filename, char* destination, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   struct json* j = NULL;
+   struct json* request = NULL;
+
+   if (pgmoneta_management_create_header(MANAGEMENT_RESTORE_WAL, compression, encryption, output_format, &j))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_management_create_request(j, &request))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)server, ValueString);
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_FILENAME, (uintptr_t)filename, ValueString);
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_DESTINATION_FILE, (uintptr_t)destination, ValueString);
+
+   if (pgmoneta_management_write_json(ssl, socket, compression, encryption, j))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_destroy(j);
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(j);
+
+   return 1;
+}
+
 int
 pgmoneta_management_request_verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
@@ -1364,6 +1403,137 @@ error:
    return 1;
 }
 
+int
+pgmoneta_management_write_file(SSL* ssl, int socket, char* path)
+{
+   char buf4[4] = {0};
+   char* block = NULL;
+   size_t n;
+   FILE* file = NULL;
+
+   file = fopen(path, "rb");
+   if (file == NULL)
+   {
+      pgmoneta_log_error("pgmoneta_management_write_file: Could not open %s", path);
+      goto error;
+   }
+
+   block = (char*)malloc(FILE_BLOCK_SIZE);
+   if (block == NULL)
+   {
+      goto error;
+   }
+
+   // the file is sent as blocks prefixed by their size, and ends with an empty block
+   while ((n = fread(block, 1, FILE_BLOCK_SIZE, file)) > 0)
+   {
+      pgmoneta_write_uint32(&buf4, (uint32_t)n);
+      if (write_complete(ssl, socket, &buf4, sizeof(buf4)) || write_complete(ssl, socket, block, n))
+      {
+         pgmoneta_log_warn("pgmoneta_management_write_file: %p %d %s", ssl, socket, strerror(errno));
+         errno = 0;
+         goto error;
+      }
+   }
+
+   // a read error leaves the stream without its end, so the reader fails
+   if (ferror(file))
+   {
+      pgmoneta_log_error("pgmoneta_management_write_file: Could not read %s", path);
+      goto error;
+   }
+
+   pgmoneta_write_uint32(&buf4, 0);
+   if (write_complete(ssl, socket, &buf4, sizeof(buf4)))
+   {
+      goto error;
+   }
+
+   free(block);
+   fclose(file);
+
+   return 0;
+
+error:
+
+   free(block);
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   return 1;
+}
+
+int
+pgmoneta_management_read_file(SSL* ssl, int socket, char* path)
+{
+   char buf4[4] = {0};
+   char* block = NULL;
+   uint32_t size;
+   FILE* file = NULL;
+
+   file = fopen(path, "wb");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   block = (char*)malloc(FILE_BLOCK_SIZE);
+   if (block == NULL)
+   {
+      goto error;
+   }
+
+   while (true)
+   {
+      if (read_complete(ssl, socket, &buf4[0], sizeof(buf4)))
+      {
+         goto error;
+      }
+
+      size = pgmoneta_read_uint32(&buf4);
+      if (size == 0)
+      {
+         break;
+      }
+
+      if (size > FILE_BLOCK_SIZE || read_complete(ssl, socket, block, size) ||
+          fwrite(block, 1, size, file) != size)
+      {
+         goto error;
+      }
+   }
+
+   free(block);
+   block = NULL;
+
+   if (fflush(file) != 0 || fsync(fileno(file)) != 0)
+   {
+      goto error;
+   }
+
+   if (fclose(file) != 0)
+   {
+      file = NULL;
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   free(block);
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   return 1;
+}
+
 static int
 read_uint8(char* prefix, SSL* ssl, int socket, uint8_t* i)
 {
@@ -40,12 +40,6 @@
 #include <stdio.h>
 #include <string.h>
 
-#define MANIFEST_KEY_VERSION "PostgreSQL-Backup-Manifest-Version"
-#define MANIFEST_KEY_SYS_IDENTIFIER "System-Identifier"
-#define MANIFEST_KEY_FILES "Files"
-#define MANIFEST_KEY_WAL_RANGES "WAL-Ranges"
-#define MANIFEST_KEY_CHECKSUM "Manifest-Checksum"
-
 static void
 build_deque(struct deque* deque, struct csv_reader* reader, char** f);
 
@@ -155,39 +155,46 @@ pgmoneta_memory_stream_buffer_init(struct stream_buffer** buffer)
 }
 
 int
-pgmoneta_memory_stream_buffer_enlarge(struct stream_buffer* buffer, int bytes_needed)
+pgmoneta_memory_stream_buffer_enlarge(struct stream_buffer* buffer, size_t bytes_needed)
 {
+   size_t used = 0;
    size_t new_size = 0;
    void* new_buffer = NULL;
 
-   if (buffer->size + bytes_needed < buffer->size + DEFAULT_BUFFER_SIZE)
-   {
-      new_size = pgmoneta_get_aligned_size(buffer->size + DEFAULT_BUFFER_SIZE);
-   }
-   else
-   {
-      new_size = pgmoneta_get_aligned_size(buffer->size + bytes_needed);
-   }
-
-   if (buffer->size > new_size)
+   if (buffer->size - buffer->end >= bytes_needed)
    {
       return 0;
    }
 
-   new_buffer = aligned_alloc((size_t)ALIGNMENT_SIZE, new_size);
+   used = buffer->end - buffer->start;
 
-   if (new_buffer == NULL)
+   if (buffer->size - used >= bytes_needed)
    {
-      return 1;
+      // enough space once the consumed data is dropped
+      memmove(buffer->buffer, buffer->buffer + buffer->start, used);
    }
+   else
+   {
+      new_size = pgmoneta_get_aligned_size(MAX(used + bytes_needed, buffer->size + DEFAULT_BUFFER_SIZE));
 
-   memset(new_buffer, 0, new_size);
-   memcpy(new_buffer, buffer->buffer, buffer->size);
+      new_buffer = aligned_alloc((size_t)ALIGNMENT_SIZE, new_size);
 
-   free(buffer->buffer);
+      if (new_buffer == NULL)
+      {
+         return 1;
+      }
+
+      memcpy(new_buffer, buffer->buffer + buffer->start, used);
+
+      free(buffer->buffer);
+
+      buffer->size = new_size;
+      buffer->buffer = new_buffer;
+   }
 
-   buffer->size = new_size;
-   buffer->buffer = new_buffer;
+   buffer->cursor -= buffer->start;
+   buffer->end = used;
+   buffer->start = 0;
 
    return 0;
 }
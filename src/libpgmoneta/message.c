@@ -43,9 +43,13 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/ssl.h>
+#include <limits.h>
 #include <sys/time.h>
 #include <stdio.h>
 
+/* Free space kept for a read, big enough for one TCP packet */
+#define COPY_STREAM_READ_SIZE 1500
+
 static struct message* allocate_message(size_t size);
 
 static int read_message(int socket, bool block, int timeout, struct message** msg);
@@ -61,6 +65,7 @@ static int get_column_name(struct message* msg, int index, char** name);
 static unsigned char* decode_base64(char* base64_data, int* decoded_len);
 static char** get_paths(char* data, int* count);
 static void extract_file_name(char* path, char* file_name, char* file_path);
+static int reserve_copy_stream(struct stream_buffer* buffer, size_t message_end);
 
 int
 pgmoneta_read_block_message(SSL* ssl, int socket, struct message** msg)
@@ -1758,13 +1763,13 @@ pgmoneta_read_copy_stream(SSL* ssl, int socket, struct stream_buffer* buffer)
    config = (struct main_configuration*)shmem;
 
    /*
-    * if buffer is still too full,
-    * try enlarging it to be at least big enough for one TCP packet (I'm using 1500B here)
+    * if buffer is still too full, make room for at least one TCP packet,
+    * preferably by dropping the consumed data
     * we don't expect it to absolutely work
     */
-   if (buffer->size - buffer->end < 1500)
+   if (buffer->size - buffer->end < COPY_STREAM_READ_SIZE)
    {
-      if (pgmoneta_memory_stream_buffer_enlarge(buffer, 1500))
+      if (pgmoneta_memory_stream_buffer_enlarge(buffer, COPY_STREAM_READ_SIZE))
       {
          pgmoneta_log_error("Fail to enlarge stream buffer");
       }
@@ -1778,11 +1783,11 @@ pgmoneta_read_copy_stream(SSL* ssl, int socket, struct stream_buffer* buffer)
    {
       if (ssl != NULL)
       {
-         numbytes = SSL_read(ssl, buffer->buffer + buffer->end, buffer->size - buffer->end);
+         numbytes = SSL_read(ssl, buffer->buffer + buffer->end, (int)MIN(buffer->size - buffer->end, (size_t)INT_MAX));
       }
       else
       {
-         numbytes = read(socket, buffer->buffer + buffer->end, buffer->size - buffer->end);
+         numbytes = read(socket, buffer->buffer + buffer->end, MIN(buffer->size - buffer->end, (size_t)INT_MAX));
       }
 
       if (likely(numbytes > 0))
@@ -1917,6 +1922,17 @@ pgmoneta_consume_copy_stream(SSL* ssl, int socket, struct stream_buffer* buffer,
          }
       }
       length = pgmoneta_read_int32(buffer->buffer + buffer->cursor);
+      if (length < 4)
+      {
+         pgmoneta_log_error("Invalid copy stream message length %d", length);
+         status = MESSAGE_STATUS_ERROR;
+         goto error;
+      }
+      if (reserve_copy_stream(buffer, buffer->cursor + length))
+      {
+         status = MESSAGE_STATUS_ERROR;
+         goto error;
+      }
       // receive the whole message even if we are going to skip it
       while (buffer->cursor + length >= buffer->end)
       {
@@ -2000,7 +2016,7 @@ pgmoneta_consume_copy_stream_start(SSL* ssl, int socket, struct stream_buffer* b
       }
       message->kind = buffer->buffer[buffer->cursor];
       // try to get message length
-      while (buffer->cursor + 1 + 4 >= buffer->end)
+      while (buffer->cursor + 1 + 4 > buffer->end)
       {
          status = pgmoneta_read_copy_stream(ssl, socket, buffer);
          if (status == MESSAGE_STATUS_ZERO)
@@ -2028,8 +2044,19 @@ pgmoneta_consume_copy_stream_start(SSL* ssl, int socket, struct stream_buffer* b
             }
          }
       }
+      if (length < 4)
+      {
+         pgmoneta_log_error("Invalid copy stream message length %d", length);
+         status = MESSAGE_STATUS_ERROR;
+         goto error;
+      }
+      if (reserve_copy_stream(buffer, buffer->cursor + 1 + length))
+      {
+         status = MESSAGE_STATUS_ERROR;
+         goto error;
+      }
       // receive the whole message even if we are going to skip it
-      while (buffer->cursor + 1 + length >= buffer->end)
+      while (buffer->cursor + 1 + length > buffer->end)
       {
          status = pgmoneta_read_copy_stream(ssl, socket, buffer);
          if (status == MESSAGE_STATUS_ZERO)
@@ -2078,24 +2105,71 @@ error:
    return status;
 }
 
+int
+pgmoneta_consume_copy_stream_buffered(struct stream_buffer* buffer, struct message* message)
+{
+   int length;
+
+   while (buffer->cursor + 1 + 4 <= buffer->end)
+   {
+      message->kind = buffer->buffer[buffer->cursor];
+      length = pgmoneta_read_int32(buffer->buffer + buffer->cursor + 1);
+
+      if (length < 4)
+      {
+         pgmoneta_log_error("Invalid copy stream message length %d", length);
+         goto error;
+      }
+
+      if (buffer->cursor + 1 + length > buffer->end)
+      {
+         // the rest of the message is read into the same buffer
+         if (reserve_copy_stream(buffer, buffer->cursor + 1 + length))
+         {
+            goto error;
+         }
+         break;
+      }
+
+      if (message->kind != 'D' && message->kind != 'H' && message->kind != 'W' && message->kind != 'T' &&
+          message->kind != 'c' && message->kind != 'f' && message->kind != 'E' && message->kind != 'd' && message->kind != 'C')
+      {
+         // skip this message
+         buffer->cursor += (length + 1);
+         buffer->start = buffer->cursor;
+         continue;
+      }
+
+      if (message->kind != 'D' && message->kind != 'T')
+      {
+         message->data = buffer->buffer + (buffer->cursor + 1 + 4);
+         message->length = length - 4;
+      }
+      else
+      {
+         message->data = buffer->buffer + buffer->cursor;
+         message->length = length + 1;
+      }
+
+      return MESSAGE_STATUS_OK;
+   }
+
+   memset(message, 0, sizeof(struct message));
+   return MESSAGE_STATUS_ZERO;
+
+error:
+   memset(message, 0, sizeof(struct message));
+   return MESSAGE_STATUS_ERROR;
+}
+
 void
 pgmoneta_consume_copy_stream_end(struct stream_buffer* buffer, struct message* message)
 {
    int length = pgmoneta_read_int32(buffer->buffer + buffer->cursor + 1);
    buffer->cursor += (1 + length);
    buffer->start = buffer->cursor;
-   // left shift unconsumed data to reuse space
-   if (buffer->start < buffer->end)
-   {
-      if (buffer->start > 0)
-      {
-         memmove(buffer->buffer, buffer->buffer + buffer->start, buffer->end - buffer->start);
-         buffer->end -= buffer->start;
-         buffer->cursor -= buffer->start;
-         buffer->start = 0;
-      }
-   }
-   else
+   // unconsumed data is only compacted once the space is needed for a read
+   if (buffer->start >= buffer->end)
    {
       buffer->start = buffer->end = buffer->cursor = 0;
    }
@@ -2672,3 +2746,22 @@ error:
 
    return 1;
 }
+
+static int
+reserve_copy_stream(struct stream_buffer* buffer, size_t message_end)
+{
+   // make room for the whole message at once, plus a read for what follows,
+   // so a large message doesn't enlarge the buffer once per read
+   if (message_end < buffer->end)
+   {
+      return 0;
+   }
+
+   if (pgmoneta_memory_stream_buffer_enlarge(buffer, message_end - buffer->end + 1 + COPY_STREAM_READ_SIZE))
+   {
+      pgmoneta_log_error("Fail to enlarge stream buffer for a message of %zu bytes", message_end - buffer->cursor);
+      return 1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,709 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <aes.h>
+#include <codec.h>
+#include <compression.h>
+#include <deque.h>
+#include <dictionary.h>
+#include <logging.h>
+#include <pipeline.h>
+#include <security.h>
+#include <seekable.h>
+#include <utils.h>
+#include <workers.h>
+
+/* system */
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+
+/** @struct pipeline_output
+ * The destination of the compressed frames
+ */
+struct pipeline_output
+{
+   EVP_CIPHER_CTX* cipher;         /**< The cipher context, or NULL */
+   unsigned char* cipher_buffer;   /**< The cipher buffer */
+   size_t chunk_size;              /**< The largest chunk the cipher buffer can take */
+   EVP_MD_CTX* md;                 /**< The message digest context */
+   FILE* out;                      /**< The output file */
+};
+
+static void do_pipeline_file(struct worker_common* wc);
+static int pipeline_type(int compression, char** suffix);
+static int pipeline_file(char* from, char* to, int type, int level, bool encrypt, char** sha512);
+static int pipeline_write(void* data, size_t size, EVP_CIPHER_CTX* cipher, unsigned char* cipher_buffer,
+                          EVP_MD_CTX* md, FILE* out);
+static int pipeline_frames(void* data, void* buffer, size_t size);
+static char* checksum_key(char* root, char* path);
+
+bool
+pgmoneta_pipeline_supported(int compression, int encryption)
+{
+   // the GCM modes encrypt whole files in authenticated chunks across the workers
+   if (pgmoneta_is_gcm_mode(encryption))
+   {
+      return false;
+   }
+
+   if (pipeline_type(compression, NULL) != COMPRESSION_NONE)
+   {
+      return true;
+   }
+
+   if (compression == COMPRESSION_NONE && encryption != ENCRYPTION_NONE)
+   {
+      return true;
+   }
+
+   return false;
+}
+
+int
+pgmoneta_pipeline_data(char* root, char* directory, struct deque* checksums, struct workers* workers)
+{
+   bool compress = false;
+   bool encrypt = false;
+   char* suffix = NULL;
+   char* from = NULL;
+   char* to = NULL;
+   DIR* dir;
+   struct dirent* entry;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (!(dir = opendir(directory)))
+   {
+      goto error;
+   }
+
+   compress = pipeline_type(config->compression_type, &suffix) != COMPRESSION_NONE;
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type == DT_DIR)
+      {
+         char path[1024];
+
+         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+         {
+            continue;
+         }
+
+         snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+
+         if (pgmoneta_pipeline_data(root, path, checksums, workers))
+         {
+            goto error;
+         }
+      }
+      else if (entry->d_type == DT_REG)
+      {
+         if (pgmoneta_ends_with(entry->d_name, "backup_manifest") ||
+             pgmoneta_ends_with(entry->d_name, "backup_label"))
+         {
+            continue;
+         }
+
+         if (pgmoneta_is_compressed(entry->d_name) || pgmoneta_is_encrypted(entry->d_name))
+         {
+            continue;
+         }
+
+         encrypt = config->encryption != ENCRYPTION_NONE &&
+                   !pgmoneta_ends_with(entry->d_name, ".partial") &&
+                   !pgmoneta_ends_with(entry->d_name, ".history");
+
+         if (!compress && !encrypt)
+         {
+            continue;
+         }
+
+         from = pgmoneta_append(from, directory);
+         from = pgmoneta_append(from, "/");
+         from = pgmoneta_append(from, entry->d_name);
+
+         to = pgmoneta_append(to, from);
+         if (compress)
+         {
+            to = pgmoneta_append(to, suffix);
+         }
+         if (encrypt)
+         {
+            to = pgmoneta_append(to, ".aes");
+         }
+
+         if (pgmoneta_exists(from))
+         {
+            struct worker_input* wi = NULL;
+
+            if (!pgmoneta_create_worker_input(root, from, to, 0, workers, &wi))
+            {
+               wi->all = checksums;
+
+               if (workers != NULL)
+               {
+                  if (workers->outcome)
+                  {
+                     pgmoneta_workers_add(workers, do_pipeline_file, (struct worker_common*)wi);
+                  }
+                  else
+                  {
+                     free(wi);
+                  }
+               }
+               else
+               {
+                  do_pipeline_file((struct worker_common*)wi);
+               }
+            }
+         }
+
+         free(from);
+         free(to);
+
+         from = NULL;
+         to = NULL;
+      }
+   }
+
+   closedir(dir);
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   return 1;
+}
+
+int
+pgmoneta_pipeline_tablespaces(char* root, struct deque* checksums, struct workers* workers)
+{
+   DIR* dir;
+   struct dirent* entry;
+
+   if (!(dir = opendir(root)))
+   {
+      return 1;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type == DT_DIR)
+      {
+         char path[1024];
+
+         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || strcmp(entry->d_name, "data") == 0)
+         {
+            continue;
+         }
+
+         snprintf(path, sizeof(path), "%s/%s", root, entry->d_name);
+
+         if (pgmoneta_pipeline_data(root, path, checksums, workers))
+         {
+            closedir(dir);
+            return 1;
+         }
+      }
+   }
+
+   closedir(dir);
+   return 0;
+}
+
+static void
+do_pipeline_file(struct worker_common* wc)
+{
+   bool compress = false;
+   bool encrypt = false;
+   int type;
+   int level;
+   char* suffix = NULL;
+   char ending[MISC_LENGTH];
+   char* sha512 = NULL;
+   char* key = NULL;
+   struct worker_input* wi = (struct worker_input*)wc;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   type = pipeline_type(config->compression_type, &suffix);
+   encrypt = pgmoneta_ends_with(wi->to, ".aes");
+   snprintf(ending, sizeof(ending), "%s%s", suffix, encrypt ? ".aes" : "");
+   compress = type != COMPRESSION_NONE && pgmoneta_ends_with(wi->to, ending);
+   level = config->compression_level;
+
+   if (compress && pgmoneta_compression_decide(wi->from, type, &level) == COMPRESSION_DECISION_STORE)
+   {
+      compress = false;
+
+      if (!encrypt)
+      {
+         // the file is kept as is
+         if (pgmoneta_create_sha512_file(wi->from, &sha512))
+         {
+            pgmoneta_log_error("Pipeline: Could not calculate the checksum of %s", wi->from);
+
+            if (wi->common.workers != NULL)
+            {
+               wi->common.workers->outcome = false;
+            }
+
+            goto done;
+         }
+
+         if (wi->all != NULL)
+         {
+            key = checksum_key(wi->directory, wi->from);
+            pgmoneta_deque_add(wi->all, key, (uintptr_t)sha512, ValueString);
+         }
+
+         goto done;
+      }
+
+      // drop the compression suffix from the name, encryption still applies
+      memcpy(wi->to + strlen(wi->to) - strlen(suffix) - strlen(".aes"), ".aes", strlen(".aes") + 1);
+   }
+
+   if (pipeline_file(wi->from, wi->to, compress ? type : COMPRESSION_NONE, level, encrypt, &sha512))
+   {
+      pgmoneta_log_error("Pipeline: Could not process %s", wi->from);
+
+      if (pgmoneta_exists(wi->to))
+      {
+         pgmoneta_delete_file(wi->to, NULL);
+      }
+
+      if (wi->common.workers != NULL)
+      {
+         wi->common.workers->outcome = false;
+      }
+
+      goto done;
+   }
+
+   if (pgmoneta_exists(wi->from))
+   {
+      pgmoneta_delete_file(wi->from, NULL);
+   }
+   else
+   {
+      pgmoneta_log_debug("%s doesn't exists", wi->from);
+   }
+
+   if (wi->all != NULL)
+   {
+      key = checksum_key(wi->directory, wi->to);
+      pgmoneta_deque_add(wi->all, key, (uintptr_t)sha512, ValueString);
+   }
+
+done:
+
+   free(key);
+   free(sha512);
+   free(wi);
+}
+
+static int
+pipeline_type(int compression, char** suffix)
+{
+   int type = COMPRESSION_NONE;
+   char* s = "";
+
+   switch (compression)
+   {
+      case COMPRESSION_CLIENT_GZIP:
+      case COMPRESSION_SERVER_GZIP:
+         type = COMPRESSION_CLIENT_GZIP;
+         s = ".gz";
+         break;
+      case COMPRESSION_CLIENT_ZSTD:
+      case COMPRESSION_SERVER_ZSTD:
+         type = COMPRESSION_CLIENT_ZSTD;
+         s = ".zstd";
+         break;
+      case COMPRESSION_CLIENT_LZ4:
+      case COMPRESSION_SERVER_LZ4:
+         type = COMPRESSION_CLIENT_LZ4;
+         s = ".lz4";
+         break;
+      case COMPRESSION_CLIENT_BZIP2:
+         type = COMPRESSION_CLIENT_BZIP2;
+         s = ".bz2";
+         break;
+      default:
+         break;
+   }
+
+   if (suffix != NULL)
+   {
+      *suffix = s;
+   }
+
+   return type;
+}
+
+static int
+pipeline_file(char* from, char* to, int type, int level, bool encrypt, char** sha512)
+{
+   bool last = false;
+   size_t in_size = 0;
+   size_t bytes = 0;
+   void* in_buffer = NULL;
+   unsigned char* cipher_buffer = NULL;
+   unsigned char md_value[EVP_MAX_MD_SIZE];
+   unsigned int md_len = 0;
+   int cipher_len = 0;
+   char* hash = NULL;
+   FILE* in = NULL;
+   FILE* out = NULL;
+   EVP_CIPHER_CTX* cipher = NULL;
+   EVP_MD_CTX* md = NULL;
+   struct pipeline_output output;
+   uint32_t dictionary = 0;
+   struct seekable_writer* writer = NULL;
+   struct codec* codec = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *sha512 = NULL;
+
+   in_size = SEEKABLE_FRAME_SIZE;
+
+   in_buffer = malloc(in_size);
+   cipher_buffer = malloc(in_size + EVP_MAX_BLOCK_LENGTH);
+   hash = malloc(EVP_MAX_MD_SIZE * 2 + 1);
+
+   if (in_buffer == NULL || cipher_buffer == NULL || hash == NULL)
+   {
+      goto error;
+   }
+
+   if (encrypt)
+   {
+      if (pgmoneta_create_cipher_context(config->encryption, 1, &cipher))
+      {
+         goto error;
+      }
+   }
+
+   md = EVP_MD_CTX_new();
+   if (md == NULL || !EVP_DigestInit_ex(md, EVP_sha512(), NULL))
+   {
+      pgmoneta_log_error("Message digest initialization failed");
+      goto error;
+   }
+
+   in = fopen(from, "rb");
+   if (in == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", from);
+      goto error;
+   }
+
+   out = fopen(to, "wb");
+   if (out == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", to);
+      goto error;
+   }
+
+   output.cipher = cipher;
+   output.cipher_buffer = cipher_buffer;
+   output.chunk_size = in_size;
+   output.md = md;
+   output.out = out;
+
+   if (type == COMPRESSION_CLIENT_ZSTD)
+   {
+      /* Frames are compressed independently so restore can read any range of the file */
+      if (pgmoneta_seekable_writer_create(COMPRESSION_CLIENT_ZSTD, level,
+                                          pipeline_frames, &output, &writer))
+      {
+         goto error;
+      }
+
+      if (config->compression_dictionary && pgmoneta_get_file_size(from) <= DICTIONARY_SMALL_FILE &&
+          pgmoneta_seekable_writer_dictionary(writer, from, &dictionary))
+      {
+         goto error;
+      }
+   }
+   else if (type != COMPRESSION_NONE)
+   {
+      // the other formats are one stream, as written by their own workflows
+      if (pgmoneta_codec_get(type, true, &codec) ||
+          pgmoneta_codec_init(codec, level, from, pipeline_frames, &output))
+      {
+         goto error;
+      }
+   }
+
+   while (!last)
+   {
+      bytes = fread(in_buffer, 1, in_size, in);
+
+      if (ferror(in))
+      {
+         pgmoneta_log_error("fread: error reading from file: %s", from);
+         goto error;
+      }
+
+      last = bytes < in_size;
+
+      if (writer != NULL)
+      {
+         if (pgmoneta_seekable_writer_write(writer, in_buffer, bytes))
+         {
+            goto error;
+         }
+
+         if (last && pgmoneta_seekable_writer_finish(writer))
+         {
+            goto error;
+         }
+      }
+      else if (codec != NULL)
+      {
+         if (bytes > 0 && pgmoneta_codec_update(codec, in_buffer, bytes))
+         {
+            goto error;
+         }
+
+         if (last && pgmoneta_codec_finish(codec))
+         {
+            goto error;
+         }
+      }
+      else if (bytes > 0)
+      {
+         if (pipeline_write(in_buffer, bytes, cipher, cipher_buffer, md, out))
+         {
+            goto error;
+         }
+      }
+   }
+
+   if (cipher != NULL)
+   {
+      if (EVP_CipherFinal_ex(cipher, cipher_buffer, &cipher_len) == 0)
+      {
+         pgmoneta_log_error("EVP_CipherFinal_ex: failed to process final cipher block");
+         goto error;
+      }
+
+      if (cipher_len > 0)
+      {
+         if (pipeline_write(cipher_buffer, cipher_len, NULL, NULL, md, out))
+         {
+            goto error;
+         }
+      }
+   }
+
+   if (!EVP_DigestFinal_ex(md, md_value, &md_len))
+   {
+      pgmoneta_log_error("Message digest finalization failed");
+      goto error;
+   }
+
+   for (unsigned int i = 0; i < md_len; i++)
+   {
+      sprintf(&hash[i * 2], "%02x", md_value[i]);
+   }
+   hash[md_len * 2] = '\0';
+
+   if (fflush(out) != 0)
+   {
+      goto error;
+   }
+
+   *sha512 = hash;
+
+   fclose(in);
+   fclose(out);
+
+   pgmoneta_seekable_writer_destroy(writer);
+   if (cipher != NULL)
+   {
+      EVP_CIPHER_CTX_free(cipher);
+   }
+   EVP_MD_CTX_free(md);
+
+   free(in_buffer);
+   free(cipher_buffer);
+
+   return 0;
+
+error:
+
+   if (in != NULL)
+   {
+      fclose(in);
+   }
+
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+
+   pgmoneta_seekable_writer_destroy(writer);
+   if (cipher != NULL)
+   {
+      EVP_CIPHER_CTX_free(cipher);
+   }
+   if (md != NULL)
+   {
+      EVP_MD_CTX_free(md);
+   }
+
+   free(in_buffer);
+   free(cipher_buffer);
+   free(hash);
+
+   return 1;
+}
+
+static int
+pipeline_write(void* data, size_t size, EVP_CIPHER_CTX* cipher, unsigned char* cipher_buffer,
+               EVP_MD_CTX* md, FILE* out)
+{
+   int length = 0;
+
+   if (size == 0)
+   {
+      return 0;
+   }
+
+   if (cipher != NULL)
+   {
+      if (EVP_CipherUpdate(cipher, cipher_buffer, &length, data, (int)size) == 0)
+      {
+         pgmoneta_log_error("EVP_CipherUpdate: failed to process block");
+         return 1;
+      }
+
+      data = cipher_buffer;
+      size = (size_t)length;
+
+      if (size == 0)
+      {
+         return 0;
+      }
+   }
+
+   if (!EVP_DigestUpdate(md, data, size))
+   {
+      pgmoneta_log_error("Message digest update failed");
+      return 1;
+   }
+
+   if (fwrite(data, 1, size, out) != size)
+   {
+      pgmoneta_log_error("fwrite: failed to write %zu bytes", size);
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+pipeline_frames(void* data, void* buffer, size_t size)
+{
+   size_t n;
+   char* p = (char*)buffer;
+   struct pipeline_output* output = (struct pipeline_output*)data;
+
+   while (size > 0)
+   {
+      n = MIN(size, output->chunk_size);
+
+      if (pipeline_write(p, n, output->cipher, output->cipher_buffer, output->md, output->out))
+      {
+         return 1;
+      }
+
+      p += n;
+      size -= n;
+   }
+
+   return 0;
+}
+
+/**
+ * Build the key used by backup.sha512, which is the path relative to the
+ * backup root with a leading slash and no repeated slashes
+ */
+static char*
+checksum_key(char* root, char* path)
+{
+   char* key = NULL;
+   char* p = NULL;
+   size_t length = 0;
+
+   if (pgmoneta_starts_with(path, root))
+   {
+      p = path + strlen(root);
+   }
+   else
+   {
+      p = path;
+   }
+
+   key = malloc(strlen(p) + 2);
+   if (key == NULL)
+   {
+      return NULL;
+   }
+
+   key[length++] = '/';
+   for (; *p != '\0'; p++)
+   {
+      if (*p == '/' && key[length - 1] == '/')
+      {
+         continue;
+      }
+      key[length++] = *p;
+   }
+   key[length] = '\0';
+
+   return key;
+}
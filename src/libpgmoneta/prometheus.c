@@ -481,6 +481,18 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgmoneta_append(data, "  <h2>pgmoneta_server_failed_operation_count</h2>\n");
    data = pgmoneta_append(data, "  The count of failed client operations of a server\n");
    data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_server_backup_network_stalls</h2>\n");
+   data = pgmoneta_append(data, "  The number of times the backup writer of a server waited for the network\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_server_backup_disk_stalls</h2>\n");
+   data = pgmoneta_append(data, "  The number of times the backup receiver of a server waited for the disk\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_server_wal_target_lag</h2>\n");
+   data = pgmoneta_append(data, "  The bytes of received WAL queued for a WAL shipping or ssh target of a server\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_server_wal_target_stalls</h2>\n");
+   data = pgmoneta_append(data, "  The number of times the WAL receiver of a server waited for a WAL shipping or ssh target\n");
+   data = pgmoneta_append(data, "  <p>\n");
    data = pgmoneta_append(data, "  <h2>pgmoneta_server_last_operation_time</h2>\n");
    data = pgmoneta_append(data, "  The time of the latest client operation of a server \n");
    data = pgmoneta_append(data, "  <p>\n");
@@ -2200,6 +2212,84 @@ general_information(SSL* client_ssl, int client_fd)
    }
    data = pgmoneta_append(data, "\n");
 
+   data = pgmoneta_append(data, "#HELP pgmoneta_server_backup_network_stalls The number of times the backup writer of a server waited for the network\n");
+   data = pgmoneta_append(data, "#TYPE pgmoneta_server_backup_network_stalls counter\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      data = pgmoneta_append(data, "pgmoneta_server_backup_network_stalls{");
+
+      data = pgmoneta_append(data, "name=\"");
+      data = pgmoneta_append(data, config->common.servers[i].name);
+      data = pgmoneta_append(data, "\"} ");
+
+      data = pgmoneta_append_ulong(data, atomic_load(&config->common.servers[i].backup_network_stalls));
+
+      data = pgmoneta_append(data, "\n");
+   }
+   data = pgmoneta_append(data, "\n");
+
+   data = pgmoneta_append(data, "#HELP pgmoneta_server_backup_disk_stalls The number of times the backup receiver of a server waited for the disk\n");
+   data = pgmoneta_append(data, "#TYPE pgmoneta_server_backup_disk_stalls counter\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      data = pgmoneta_append(data, "pgmoneta_server_backup_disk_stalls{");
+
+      data = pgmoneta_append(data, "name=\"");
+      data = pgmoneta_append(data, config->common.servers[i].name);
+      data = pgmoneta_append(data, "\"} ");
+
+      data = pgmoneta_append_ulong(data, atomic_load(&config->common.servers[i].backup_disk_stalls));
+
+      data = pgmoneta_append(data, "\n");
+   }
+   data = pgmoneta_append(data, "\n");
+
+   data = pgmoneta_append(data, "#HELP pgmoneta_server_wal_target_lag The bytes of received WAL queued for a WAL shipping or ssh target of a server\n");
+   data = pgmoneta_append(data, "#TYPE pgmoneta_server_wal_target_lag gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      for (int j = 0; j < WAL_TARGETS; j++)
+      {
+         data = pgmoneta_append(data, "pgmoneta_server_wal_target_lag{");
+
+         data = pgmoneta_append(data, "name=\"");
+         data = pgmoneta_append(data, config->common.servers[i].name);
+         data = pgmoneta_append(data, "\", ");
+
+         data = pgmoneta_append(data, "target=\"");
+         data = pgmoneta_append(data, j == WAL_TARGET_SHIPPING ? "wal_shipping" : "ssh");
+         data = pgmoneta_append(data, "\"} ");
+
+         data = pgmoneta_append_ulong(data, atomic_load(&config->common.servers[i].wal_target_lag[j]));
+
+         data = pgmoneta_append(data, "\n");
+      }
+   }
+   data = pgmoneta_append(data, "\n");
+
+   data = pgmoneta_append(data, "#HELP pgmoneta_server_wal_target_stalls The number of times the WAL receiver of a server waited for a WAL shipping or ssh target\n");
+   data = pgmoneta_append(data, "#TYPE pgmoneta_server_wal_target_stalls counter\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      for (int j = 0; j < WAL_TARGETS; j++)
+      {
+         data = pgmoneta_append(data, "pgmoneta_server_wal_target_stalls{");
+
+         data = pgmoneta_append(data, "name=\"");
+         data = pgmoneta_append(data, config->common.servers[i].name);
+         data = pgmoneta_append(data, "\", ");
+
+         data = pgmoneta_append(data, "target=\"");
+         data = pgmoneta_append(data, j == WAL_TARGET_SHIPPING ? "wal_shipping" : "ssh");
+         data = pgmoneta_append(data, "\"} ");
+
+         data = pgmoneta_append_ulong(data, atomic_load(&config->common.servers[i].wal_target_stalls[j]));
+
+         data = pgmoneta_append(data, "\n");
+      }
+   }
+   data = pgmoneta_append(data, "\n");
+
    data = pgmoneta_append(data, "#HELP pgmoneta_server_last_operation_time The time of the latest client operation of a server\n");
    data = pgmoneta_append(data, "#TYPE pgmoneta_server_last_operation_time gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
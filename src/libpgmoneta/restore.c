@@ -28,6 +28,8 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <aes.h>
+#include <compression.h>
 #include <logging.h>
 #include <management.h>
 #include <manifest.h>
@@ -35,6 +37,8 @@
 #include <restore.h>
 #include <security.h>
 #include <utils.h>
+#include <wal.h>
+#include <walindex.h>
 #include <workers.h>
 #include <workflow.h>
 
@@ -42,11 +46,14 @@
 #include <assert.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #define NAME "restore"
 #define RESTORE_OK            0
@@ -56,6 +63,8 @@
 #define RESTORE_ERROR         4
 #define MAX_PATH_CONCAT (MAX_PATH * 2)
 #define TMP_SUFFIX ".tmp"
+#define CLAIM_SUFFIX ".claim"
+#define STALE_SECONDS 300
 
 struct build_backup_file_input
 {
@@ -258,6 +267,12 @@ construct_backup_label_chain(int server, char* newest_label, char* oldest_label,
 static int
 file_base_name(char* file, char** basename);
 
+static int restore_wal_files(char* waldir, char* filename, int count, int* number_of_files, char*** files);
+static int restore_wal_position(char** files, int number_of_files, char* filename);
+static int restore_wal_cleanup(char* directory, char* filename);
+static void restore_wal_prefetch(char* waldir, char* directory, char** files, int number_of_files, int start, struct workers* workers);
+static void do_restore_wal_prefetch(struct worker_common* wc);
+
 static int copy_tablespaces_restore(char* from, char* to, char* base,
                                     char* server, char* id,
                                     struct backup* backup,
@@ -1185,6 +1200,322 @@ error:
    return 1;
 }
 
+int
+pgmoneta_stage_wal_file(char* directory, char* from, char* name)
+{
+   char* stripped = NULL;
+   char* current = NULL;
+   char* next = NULL;
+   char prefix[MISC_LENGTH];
+   char target[MAX_PATH_CONCAT];
+
+   // the hidden name is unique to the process, so concurrent stagings of a file don't clash
+   snprintf(prefix, sizeof(prefix), ".%d.", getpid());
+
+   current = pgmoneta_append(current, directory);
+   current = pgmoneta_append(current, prefix);
+   current = pgmoneta_append(current, name);
+
+   if (pgmoneta_copy_file(from, current, NULL) || pgmoneta_get_file_size(current) != pgmoneta_get_file_size(from))
+   {
+      pgmoneta_log_error("Unable to stage %s", from);
+      goto error;
+   }
+
+   if (pgmoneta_is_encrypted(current))
+   {
+      if (pgmoneta_strip_extension(current, &next))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_decrypt_file(current, next))
+      {
+         goto error;
+      }
+
+      free(current);
+      current = next;
+      next = NULL;
+   }
+
+   if (pgmoneta_is_compressed(current))
+   {
+      if (pgmoneta_strip_extension(current, &next))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_decompress(current, next))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_exists(current))
+      {
+         pgmoneta_delete_file(current, NULL);
+      }
+
+      free(current);
+      current = next;
+      next = NULL;
+   }
+
+   if (pgmoneta_strip_wal_extensions(name, &stripped))
+   {
+      goto error;
+   }
+
+   // the hidden name is too long to be padded by the decompression
+   if (pgmoneta_is_wal_file(stripped) && pgmoneta_wal_pad(current))
+   {
+      goto error;
+   }
+
+   snprintf(target, sizeof(target), "%s%s", directory, stripped);
+
+   if (rename(current, target))
+   {
+      pgmoneta_log_error("Unable to rename %s to %s: %s", current, target, strerror(errno));
+      goto error;
+   }
+
+   free(stripped);
+   free(current);
+
+   return 0;
+
+error:
+   if (current != NULL && pgmoneta_exists(current))
+   {
+      pgmoneta_delete_file(current, NULL);
+   }
+   if (next != NULL && pgmoneta_exists(next))
+   {
+      pgmoneta_delete_file(next, NULL);
+   }
+   free(stripped);
+   free(current);
+   free(next);
+
+   return 1;
+}
+
+void
+pgmoneta_restore_wal(SSL* ssl, int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload)
+{
+   int ec = -1;
+   int position = -1;
+   int ahead = 0;
+   int number_of_wal_files = 0;
+   int number_of_workers = 0;
+   bool hit = false;
+   char* filename = NULL;
+   char* destination = NULL;
+   char* name = NULL;
+   char* waldir = NULL;
+   char* prefetch = NULL;
+   char* elapsed = NULL;
+   char** wal_files = NULL;
+   char from[MAX_PATH_CONCAT];
+   char staged[MAX_PATH_CONCAT];
+   struct timespec start_t;
+   struct timespec end_t;
+   double total_seconds = 0;
+   struct workers* workers = NULL;
+   struct json* req = NULL;
+   struct json* response = NULL;
+   struct main_configuration* config;
+
+   pgmoneta_start_logging();
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   req = (struct json*)pgmoneta_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+   filename = (char*)pgmoneta_json_get(req, MANAGEMENT_ARGUMENT_FILENAME);
+   destination = (char*)pgmoneta_json_get(req, MANAGEMENT_ARGUMENT_DESTINATION_FILE);
+
+   if (filename == NULL || strlen(filename) == 0 || strchr(filename, '/') != NULL ||
+       destination == NULL || strlen(destination) == 0)
+   {
+      ec = MANAGEMENT_ERROR_RESTORE_WAL_NOFILE;
+      goto error;
+   }
+
+   waldir = pgmoneta_get_server_wal(server);
+   prefetch = pgmoneta_get_server_wal_prefetch(server);
+
+   if (pgmoneta_mkdir(prefetch))
+   {
+      pgmoneta_log_error("Could not create directory: %s", prefetch);
+      goto error;
+   }
+
+   snprintf(staged, sizeof(staged), "%s%s", prefetch, filename);
+
+   // a prefetched segment is served without looking at the archive
+   hit = pgmoneta_exists(staged);
+
+   if (!hit)
+   {
+      if (pgmoneta_is_wal_file(filename))
+      {
+         if (restore_wal_files(waldir, filename, config->wal_prefetch + 1, &number_of_wal_files, &wal_files))
+         {
+            goto error;
+         }
+
+         position = restore_wal_position(wal_files, number_of_wal_files, filename);
+      }
+
+      if (position != -1)
+      {
+         name = wal_files[position];
+      }
+      else if (pgmoneta_ends_with(filename, ".history"))
+      {
+         name = filename;
+      }
+
+      snprintf(from, sizeof(from), "%s%s", waldir, name != NULL ? name : filename);
+
+      // PostgreSQL probes for files past the end of the archive
+      if (name == NULL || !pgmoneta_exists(from))
+      {
+         ec = MANAGEMENT_ERROR_RESTORE_WAL_NOFILE;
+         pgmoneta_log_debug("Restore WAL: No %s for %s", filename, config->common.servers[server].name);
+         goto error;
+      }
+
+      if (pgmoneta_stage_wal_file(prefetch, from, name))
+      {
+         goto error;
+      }
+   }
+
+   if (pgmoneta_management_create_response(payload, server, &response))
+   {
+      ec = MANAGEMENT_ERROR_ALLOCATION;
+      goto error;
+   }
+
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->common.servers[server].name, ValueString);
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_FILENAME, (uintptr_t)filename, ValueString);
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_DESTINATION_FILE, (uintptr_t)destination, ValueString);
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   if (pgmoneta_management_response_ok(NULL, client_fd, start_t, end_t, compression, encryption, payload))
+   {
+      ec = MANAGEMENT_ERROR_RESTORE_WAL_NETWORK;
+      pgmoneta_log_error("Restore WAL: Error sending response for %s", config->common.servers[server].name);
+      goto error;
+   }
+
+   // the client writes the file, so it can run on another host than pgmoneta
+   if (pgmoneta_management_write_file(NULL, client_fd, staged))
+   {
+      ec = MANAGEMENT_ERROR_RESTORE_WAL_NETWORK;
+      pgmoneta_log_error("Restore WAL: Error sending %s for %s", filename, config->common.servers[server].name);
+      goto error;
+   }
+
+   pgmoneta_delete_file(staged, NULL);
+
+   elapsed = pgmoneta_get_timestamp_string(start_t, end_t, &total_seconds);
+   pgmoneta_log_debug("Restore WAL: %s/%s (Elapsed: %s)", config->common.servers[server].name, filename, elapsed);
+
+   // recovery goes on with this segment while the next ones are fetched
+   pgmoneta_disconnect(client_fd);
+
+   if (config->wal_prefetch > 0 && pgmoneta_is_wal_file(filename))
+   {
+      ahead = restore_wal_cleanup(prefetch, filename);
+
+      // the archive is looked up again once half of the prefetched segments are used
+      if (hit && ahead > config->wal_prefetch / 2)
+      {
+         goto done;
+      }
+
+      if (wal_files == NULL)
+      {
+         if (restore_wal_files(waldir, filename, config->wal_prefetch + 1, &number_of_wal_files, &wal_files))
+         {
+            goto done;
+         }
+
+         position = restore_wal_position(wal_files, number_of_wal_files, filename);
+      }
+
+      if (position == -1)
+      {
+         goto done;
+      }
+
+      number_of_workers = pgmoneta_get_number_of_workers(server);
+      if (number_of_workers > 0)
+      {
+         pgmoneta_workers_initialize(number_of_workers, &workers);
+      }
+
+      restore_wal_prefetch(waldir, prefetch, wal_files, number_of_wal_files, position + 1, workers);
+
+      pgmoneta_workers_wait(workers);
+      pgmoneta_workers_destroy(workers);
+   }
+
+done:
+
+   for (int i = 0; i < number_of_wal_files; i++)
+   {
+      free(wal_files[i]);
+   }
+   free(wal_files);
+   free(waldir);
+   free(prefetch);
+   free(elapsed);
+
+   pgmoneta_json_destroy(payload);
+
+   pgmoneta_stop_logging();
+
+   exit(0);
+
+error:
+
+   pgmoneta_management_response_error(ssl, client_fd, config->common.servers[server].name,
+                                      ec != -1 ? ec : MANAGEMENT_ERROR_RESTORE_WAL_ERROR, NAME,
+                                      compression, encryption, payload);
+
+   for (int i = 0; i < number_of_wal_files; i++)
+   {
+      free(wal_files[i]);
+   }
+   free(wal_files);
+   free(waldir);
+   free(prefetch);
+   free(elapsed);
+
+   pgmoneta_json_destroy(payload);
+
+   pgmoneta_disconnect(client_fd);
+
+   pgmoneta_stop_logging();
+
+   exit(1);
+}
+
 static int
 combine_backups_recursive(uint32_t tsoid,
                           int server,
@@ -1545,7 +1876,7 @@ reconstruct_backup_file(int server,
       {
          full_file_found = true;
          // would be nice if we could check if stat fails
-         file_size = pgmoneta_get_file_size(rf->filepath);
+         file_size = pgmoneta_rfile_size(rf);
          nblocks = file_size / blocksz;
 
          // no need to check for blocks beyond truncation_block_length
@@ -1563,7 +1894,8 @@ reconstruct_backup_file(int server,
          // full_copy_possible only remains true when there are no modified blocks in later incremental files,
          // which means the file has probably never been modified since last full backup.
          // But it still could've gotten truncated, so check the file size.
-         if (full_copy_possible && file_size == block_length * blocksz)
+         // a seekable file isn't stored as is, so its blocks are copied one by one
+         if (full_copy_possible && rf->reader == NULL && file_size == block_length * blocksz)
          {
             copy_source = rf;
          }
@@ -1769,15 +2101,9 @@ is_full_file(struct rfile* rf)
 static int
 read_block(struct rfile* rf, off_t offset, uint32_t blocksz, uint8_t* buffer)
 {
-   int nread = 0;
-   if (fseek(rf->fp, offset, SEEK_SET))
-   {
-      pgmoneta_log_error("unable to locate file pointer to offset %llu in file %s", offset, rf->filepath);
-      goto error;
-   }
+   size_t nread = 0;
 
-   nread = fread(buffer, 1, blocksz, rf->fp);
-   if (nread != blocksz)
+   if (pgmoneta_rfile_read(rf, offset, buffer, blocksz, &nread) || nread != blocksz)
    {
       pgmoneta_log_error("unable to read block at offset %llu from file %s", offset, rf->filepath);
       goto error;
@@ -1797,6 +2123,7 @@ write_reconstructed_file_full(char* output_file_path,
 {
    FILE* wfp = NULL;
    uint8_t buffer[blocksz];
+   bool hole = false;
    struct rfile* s = NULL;
 
    wfp = fopen(output_file_path, "wb+");
@@ -1807,19 +2134,8 @@ write_reconstructed_file_full(char* output_file_path,
    }
    for (uint32_t i = 0; i < block_length; i++)
    {
-      memset(buffer, 0, blocksz);
       s = source_map[i];
-      if (s == NULL)
-      {
-         // zero fill the block since source doesn't exist
-         memset(buffer, 0, blocksz);
-         if (fwrite(buffer, 1, blocksz, wfp) != blocksz)
-         {
-            pgmoneta_log_error("reconstruct: fail to write to file %s", output_file_path);
-            goto error;
-         }
-      }
-      else
+      if (s != NULL)
       {
          // we might be able to use copy_file_range to have faster copy,
          // but for now let's stay in user space
@@ -1827,11 +2143,34 @@ write_reconstructed_file_full(char* output_file_path,
          {
             goto error;
          }
-         if (fwrite(buffer, 1, blocksz, wfp) != blocksz)
+      }
+
+      // leave a hole for a block that doesn't exist in any source or is all zero
+      if (s == NULL || pgmoneta_is_zero(buffer, blocksz))
+      {
+         if (fseeko(wfp, blocksz, SEEK_CUR))
          {
-            pgmoneta_log_error("reconstruct: fail to write to file %s", output_file_path);
+            pgmoneta_log_error("reconstruct: fail to seek in file %s", output_file_path);
             goto error;
          }
+         hole = true;
+         continue;
+      }
+
+      hole = false;
+      if (fwrite(buffer, 1, blocksz, wfp) != blocksz)
+      {
+         pgmoneta_log_error("reconstruct: fail to write to file %s", output_file_path);
+         goto error;
+      }
+   }
+   // a hole at the end doesn't extend the file by itself
+   if (hole)
+   {
+      if (fflush(wfp) || ftruncate(fileno(wfp), (off_t)block_length * blocksz))
+      {
+         pgmoneta_log_error("reconstruct: fail to extend file %s", output_file_path);
+         goto error;
       }
    }
    if (wfp != NULL)
@@ -3062,3 +3401,220 @@ error:
 
    return 1;
 }
+
+static int
+restore_wal_files(char* waldir, char* filename, int count, int* number_of_files, char*** files)
+{
+   int nof = 0;
+   char** array = NULL;
+   struct wal_index* index = NULL;
+
+   *number_of_files = 0;
+   *files = NULL;
+
+   // without an index the archive is listed
+   if (pgmoneta_wal_index_load(waldir, &index))
+   {
+      return pgmoneta_get_wal_range(waldir, filename, number_of_files, files);
+   }
+
+   array = (char**)malloc(sizeof(char*) * (count + 1));
+   if (array == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = pgmoneta_wal_index_search(index, filename); nof < count && i < index->number_of_entries; i++)
+   {
+      array[nof] = pgmoneta_wal_index_file(index, i);
+      if (array[nof] != NULL)
+      {
+         nof++;
+      }
+   }
+
+   pgmoneta_wal_index_destroy(index);
+
+   *number_of_files = nof;
+   *files = array;
+
+   return 0;
+
+error:
+   pgmoneta_wal_index_destroy(index);
+
+   return 1;
+}
+
+static int
+restore_wal_position(char** files, int number_of_files, char* filename)
+{
+   int position = -1;
+   char* basename = NULL;
+
+   // the range starts at the segment, after the history files
+   for (int i = 0; position == -1 && i < number_of_files; i++)
+   {
+      if (pgmoneta_strip_wal_extensions(files[i], &basename))
+      {
+         break;
+      }
+
+      if (!strcmp(basename, filename))
+      {
+         position = i;
+      }
+      else if (!pgmoneta_ends_with(basename, ".history"))
+      {
+         free(basename);
+         break;
+      }
+
+      free(basename);
+      basename = NULL;
+   }
+
+   return position;
+}
+
+static int
+restore_wal_cleanup(char* directory, char* filename)
+{
+   int ahead = 0;
+   char path[MAX_PATH_CONCAT];
+   struct stat st;
+   DIR* dir = NULL;
+   struct dirent* entry;
+   time_t now = time(NULL);
+
+   if (!(dir = opendir(directory)))
+   {
+      return 0;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type != DT_REG)
+      {
+         continue;
+      }
+
+      snprintf(path, sizeof(path), "%s%s", directory, entry->d_name);
+
+      if (entry->d_name[0] == '.')
+      {
+         // left behind by a process that didn't finish
+         if (!stat(path, &st) && now - st.st_mtime > STALE_SECONDS)
+         {
+            pgmoneta_delete_file(path, NULL);
+         }
+         else if (pgmoneta_ends_with(entry->d_name, CLAIM_SUFFIX) && strncmp(entry->d_name + 1, filename, strlen(filename)) > 0)
+         {
+            // being fetched
+            ahead++;
+         }
+      }
+      else if (pgmoneta_is_wal_file(entry->d_name))
+      {
+         if (strcmp(entry->d_name, filename) < 0)
+         {
+            // recovery is past the segment
+            pgmoneta_delete_file(path, NULL);
+         }
+         else if (strcmp(entry->d_name, filename) > 0)
+         {
+            ahead++;
+         }
+      }
+   }
+
+   closedir(dir);
+
+   return ahead;
+}
+
+static void
+restore_wal_prefetch(char* waldir, char* directory, char** files, int number_of_files, int start, struct workers* workers)
+{
+   int fd = -1;
+   int number = 0;
+   char* basename = NULL;
+   char from[MAX_PATH_CONCAT];
+   char staged[MAX_PATH_CONCAT];
+   char claim[MAX_PATH_CONCAT + MISC_LENGTH];
+   struct worker_input* wi = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   for (int i = start; number < config->wal_prefetch && i < number_of_files; i++)
+   {
+      if (pgmoneta_strip_wal_extensions(files[i], &basename))
+      {
+         break;
+      }
+
+      // the segment being received isn't replayed from the archive
+      if (!pgmoneta_is_wal_file(basename))
+      {
+         free(basename);
+         basename = NULL;
+         continue;
+      }
+
+      number++;
+
+      snprintf(staged, sizeof(staged), "%s%s", directory, basename);
+      snprintf(claim, sizeof(claim), "%s.%s%s", directory, files[i], CLAIM_SUFFIX);
+
+      free(basename);
+      basename = NULL;
+
+      if (pgmoneta_exists(staged))
+      {
+         continue;
+      }
+
+      // the segment may be fetched by an earlier request already
+      fd = open(claim, O_WRONLY | O_CREAT | O_EXCL, 0600);
+      if (fd == -1)
+      {
+         continue;
+      }
+      close(fd);
+
+      snprintf(from, sizeof(from), "%s%s", waldir, files[i]);
+
+      if (pgmoneta_create_worker_input(directory, from, files[i], 0, workers, &wi))
+      {
+         pgmoneta_delete_file(claim, NULL);
+         break;
+      }
+
+      if (workers != NULL)
+      {
+         pgmoneta_workers_add(workers, do_restore_wal_prefetch, (struct worker_common*)wi);
+      }
+      else
+      {
+         do_restore_wal_prefetch((struct worker_common*)wi);
+      }
+   }
+}
+
+static void
+do_restore_wal_prefetch(struct worker_common* wc)
+{
+   struct worker_input* wi = (struct worker_input*)wc;
+   char claim[MAX_PATH_CONCAT + MISC_LENGTH];
+
+   if (pgmoneta_stage_wal_file(wi->directory, wi->from, wi->to))
+   {
+      pgmoneta_log_debug("Restore WAL: Unable to prefetch %s", wi->from);
+   }
+
+   snprintf(claim, sizeof(claim), "%s.%s%s", wi->directory, wi->to, CLAIM_SUFFIX);
+   pgmoneta_delete_file(claim, NULL);
+
+   free(wi);
+}
@@ -0,0 +1,928 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <art.h>
+#include <info.h>
+#include <json.h>
+#include <logging.h>
+#include <manifest.h>
+#include <resume.h>
+#include <security.h>
+#include <utils.h>
+
+/* system */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define JOURNAL_START "START"
+#define JOURNAL_FILE  "FILE"
+
+static int load_journal(char* partial, uint32_t* timeline, char* startpos, size_t startpos_size, struct art** files);
+static int parse_entry(char* value, uint64_t* size, time_t* mtime, char* local, size_t local_size);
+static int splice_file(int server, char* prior, char* incremental, char* output);
+static int strip_backup_label(char* path);
+static int update_entry(struct json* entry, char* data, char* path);
+static char* journal_path(char* basedir);
+
+bool
+pgmoneta_resume_supported(int server)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->common.servers[server].version < 17 || !config->common.servers[server].summarize_wal)
+   {
+      return false;
+   }
+
+   /* Server side compressed archives are only extracted once they are complete */
+   if (config->compression_type == COMPRESSION_SERVER_GZIP ||
+       config->compression_type == COMPRESSION_SERVER_LZ4 ||
+       config->compression_type == COMPRESSION_SERVER_ZSTD)
+   {
+      return false;
+   }
+
+   return true;
+}
+
+int
+pgmoneta_resume_begin(char* basedir, uint32_t timeline, char* startpos)
+{
+   char* path = NULL;
+   FILE* journal = NULL;
+
+   path = journal_path(basedir);
+
+   journal = fopen(path, "w");
+   if (journal == NULL)
+   {
+      pgmoneta_log_error("Resume: Could not create %s (%s)", path, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   if (fprintf(journal, "%s\t%u\t%s\n", JOURNAL_START, timeline, startpos) < 0 || fflush(journal))
+   {
+      goto error;
+   }
+
+   fclose(journal);
+   free(path);
+
+   return 0;
+
+error:
+
+   if (journal != NULL)
+   {
+      fclose(journal);
+   }
+
+   free(path);
+
+   return 1;
+}
+
+void
+pgmoneta_resume_end(char* basedir)
+{
+   char* path = NULL;
+
+   path = journal_path(basedir);
+
+   if (pgmoneta_exists(path))
+   {
+      pgmoneta_delete_file(path, NULL);
+   }
+
+   free(path);
+}
+
+int
+pgmoneta_resume_journal_open(char* basedir, FILE** journal)
+{
+   char* path = NULL;
+
+   *journal = NULL;
+
+   path = journal_path(basedir);
+
+   if (pgmoneta_exists(path))
+   {
+      *journal = fopen(path, "a");
+      if (*journal == NULL)
+      {
+         pgmoneta_log_error("Resume: Could not open %s (%s)", path, strerror(errno));
+         errno = 0;
+         free(path);
+         return 1;
+      }
+   }
+
+   free(path);
+
+   return 0;
+}
+
+int
+pgmoneta_resume_journal_add(FILE* journal, char* path, char* local, uint64_t size, time_t mtime)
+{
+   if (journal == NULL)
+   {
+      return 0;
+   }
+
+   /* Entries are tab separated lines, and the manifest is written without escaping */
+   if (strpbrk(path, "\t\n\"\\") != NULL || strpbrk(local, "\t\n") != NULL)
+   {
+      return 0;
+   }
+
+   if (fprintf(journal, "%s\t%" PRIu64 "\t%lld\t%s\t%s\n", JOURNAL_FILE, size, (long long)mtime, path, local) < 0)
+   {
+      return 1;
+   }
+
+   /* The journal must not claim more than what is on disk */
+   return fflush(journal) ? 1 : 0;
+}
+
+int
+pgmoneta_resume_keep(int server, char* basedir)
+{
+   char* path = NULL;
+   char* partial = NULL;
+   char from[MAX_PATH];
+   char to[MAX_PATH];
+
+   path = journal_path(basedir);
+   if (!pgmoneta_exists(path))
+   {
+      goto error;
+   }
+
+   partial = pgmoneta_get_server_partial(server);
+
+   if (pgmoneta_exists(partial))
+   {
+      pgmoneta_delete_directory(partial);
+   }
+
+   snprintf(from, sizeof(from), "%s", basedir);
+   snprintf(to, sizeof(to), "%s", partial);
+
+   if (pgmoneta_ends_with(from, "/"))
+   {
+      from[strlen(from) - 1] = '\0';
+   }
+   if (pgmoneta_ends_with(to, "/"))
+   {
+      to[strlen(to) - 1] = '\0';
+   }
+
+   if (rename(from, to) != 0)
+   {
+      pgmoneta_log_warn("Resume: Could not keep %s as partial backup (%s)", from, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   pgmoneta_log_info("Resume: Kept the received files in %s", to);
+
+   free(path);
+   free(partial);
+
+   return 0;
+
+error:
+
+   free(path);
+   free(partial);
+
+   return 1;
+}
+
+bool
+pgmoneta_resume_available(int server)
+{
+   bool available = false;
+   char* partial = NULL;
+   char* path = NULL;
+
+   if (!pgmoneta_resume_supported(server))
+   {
+      return false;
+   }
+
+   partial = pgmoneta_get_server_partial(server);
+   path = journal_path(partial);
+
+   available = pgmoneta_exists(path);
+
+   free(path);
+   free(partial);
+
+   return available;
+}
+
+int
+pgmoneta_resume_write_manifest(int server, char* path)
+{
+   uint32_t timeline = 0;
+   char startpos[MISC_LENGTH];
+   char modified[MISC_LENGTH];
+   char file_path[MAX_PATH + MAX_PATH];
+   char local[MAX_PATH];
+   char* partial = NULL;
+   char* checksum = NULL;
+   bool first = true;
+   uint64_t size;
+   time_t mtime;
+   struct tm tm;
+   struct art* files = NULL;
+   struct art_iterator* iter = NULL;
+   FILE* file = NULL;
+
+   partial = pgmoneta_get_server_partial(server);
+
+   if (load_journal(partial, &timeline, startpos, sizeof(startpos), &files))
+   {
+      goto error;
+   }
+
+   file = fopen(path, "wb");
+   if (file == NULL)
+   {
+      pgmoneta_log_error("Resume: Could not create %s", path);
+      goto error;
+   }
+
+   if (pgmoneta_art_iterator_create(files, &iter))
+   {
+      goto error;
+   }
+
+   fprintf(file, "{ \"%s\": %d,\n", MANIFEST_KEY_VERSION, 1);
+   fprintf(file, "\"%s\": [\n", MANIFEST_KEY_FILES);
+
+   while (pgmoneta_art_iterator_next(iter))
+   {
+      if (parse_entry((char*)pgmoneta_value_data(iter->value), &size, &mtime, local, sizeof(local)))
+      {
+         continue;
+      }
+
+      /* Only files that are still complete on disk are offered to the server */
+      snprintf(file_path, sizeof(file_path), "%s%s", partial, local);
+      if (!pgmoneta_exists(file_path) || pgmoneta_get_file_size(file_path) != size)
+      {
+         continue;
+      }
+
+      gmtime_r(&mtime, &tm);
+      memset(modified, 0, sizeof(modified));
+      strftime(modified, sizeof(modified), "%Y-%m-%d %H:%M:%S GMT", &tm);
+
+      fprintf(file, "%s{ \"Path\": \"%s\", \"Size\": %" PRIu64 ", \"Last-Modified\": \"%s\" }",
+              first ? "" : ",\n", iter->key, size, modified);
+      first = false;
+   }
+
+   fprintf(file, "%s],\n", first ? "" : "\n");
+
+   fprintf(file, "\"%s\": [\n", MANIFEST_KEY_WAL_RANGES);
+   fprintf(file, "{ \"Timeline\": %u, \"Start-LSN\": \"%s\", \"End-LSN\": \"%s\" }\n", timeline, startpos, startpos);
+   fprintf(file, "],\n");
+
+   fflush(file);
+
+   if (pgmoneta_create_sha256_file(path, &checksum))
+   {
+      pgmoneta_log_error("Resume: Could not get manifest checksum of %s", path);
+      goto error;
+   }
+   fprintf(file, "\"%s\": \"%s\"}\n", MANIFEST_KEY_CHECKSUM, checksum);
+
+   if (fflush(file))
+   {
+      goto error;
+   }
+
+   fclose(file);
+   pgmoneta_art_iterator_destroy(iter);
+   pgmoneta_art_destroy(files);
+   free(checksum);
+   free(partial);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   pgmoneta_art_iterator_destroy(iter);
+   pgmoneta_art_destroy(files);
+   free(checksum);
+   free(partial);
+
+   return 1;
+}
+
+int
+pgmoneta_resume_splice(int server, char* basedir)
+{
+   uint32_t timeline = 0;
+   uint64_t spliced = 0;
+   char startpos[MISC_LENGTH];
+   char data[MAX_PATH];
+   char prior[MAX_PATH + MAX_PATH];
+   char incremental[MAX_PATH + MAX_PATH];
+   char output[MAX_PATH + MAX_PATH];
+   char manifest_path[MAX_PATH + MISC_LENGTH];
+   char target[MAX_PATH];
+   char* partial = NULL;
+   char* path = NULL;
+   char* base = NULL;
+   char* value = NULL;
+   char local[MAX_PATH];
+   uint64_t size;
+   time_t mtime;
+   struct art* files = NULL;
+   struct json* manifest = NULL;
+   struct json* manifest_files = NULL;
+   struct json* f = NULL;
+   struct json_iterator* iter = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   partial = pgmoneta_get_server_partial(server);
+
+   if (load_journal(partial, &timeline, startpos, sizeof(startpos), &files))
+   {
+      goto error;
+   }
+
+   snprintf(data, sizeof(data), "%s%sdata/", basedir, pgmoneta_ends_with(basedir, "/") ? "" : "/");
+   snprintf(manifest_path, sizeof(manifest_path), "%sbackup_manifest", data);
+
+   if (pgmoneta_json_read_file(manifest_path, &manifest))
+   {
+      pgmoneta_log_error("Resume: Could not read %s", manifest_path);
+      goto error;
+   }
+
+   manifest_files = (struct json*)pgmoneta_json_get(manifest, MANIFEST_FILES);
+   if (manifest_files == NULL || pgmoneta_json_iterator_create(manifest_files, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_json_iterator_next(iter))
+   {
+      f = (struct json*)pgmoneta_value_data(iter->value);
+      path = (char*)pgmoneta_json_get(f, "Path");
+
+      if (path == NULL)
+      {
+         continue;
+      }
+
+      if (!strcmp(path, "backup_label"))
+      {
+         /* The spliced backup is a full backup */
+         snprintf(output, sizeof(output), "%s%s", data, path);
+         if (strip_backup_label(output) || update_entry(f, data, path))
+         {
+            goto error;
+         }
+         continue;
+      }
+
+      base = strrchr(path, '/');
+      base = base != NULL ? base + 1 : path;
+
+      if (!pgmoneta_starts_with(base, INCREMENTAL_PREFIX))
+      {
+         continue;
+      }
+
+      memset(target, 0, sizeof(target));
+      snprintf(target, sizeof(target), "%.*s%s", (int)(base - path), path, base + INCREMENTAL_PREFIX_LENGTH);
+
+      value = (char*)pgmoneta_art_search(files, target);
+      if (value == NULL || parse_entry(value, &size, &mtime, local, sizeof(local)))
+      {
+         pgmoneta_log_error("Resume: %s is not in the partial backup", target);
+         goto error;
+      }
+
+      snprintf(prior, sizeof(prior), "%s%s", partial, local);
+      snprintf(incremental, sizeof(incremental), "%s%s", data, path);
+      snprintf(output, sizeof(output), "%s%s", data, target);
+
+      if (splice_file(server, prior, incremental, output))
+      {
+         pgmoneta_log_error("Resume: Could not combine %s", output);
+         goto error;
+      }
+
+      pgmoneta_delete_file(incremental, NULL);
+
+      if (update_entry(f, data, target))
+      {
+         goto error;
+      }
+
+      spliced++;
+   }
+
+   pgmoneta_json_iterator_destroy(iter);
+   iter = NULL;
+
+   if (pgmoneta_write_postgresql_manifest(manifest, manifest_path))
+   {
+      pgmoneta_log_error("Resume: Could not write %s", manifest_path);
+      goto error;
+   }
+
+   pgmoneta_log_info("Resume: %s reused %" PRIu64 " files of the partial backup from %s",
+                     config->common.servers[server].name, spliced, startpos);
+
+   pgmoneta_json_destroy(manifest);
+   pgmoneta_art_destroy(files);
+   free(partial);
+
+   return 0;
+
+error:
+
+   pgmoneta_json_iterator_destroy(iter);
+   pgmoneta_json_destroy(manifest);
+   pgmoneta_art_destroy(files);
+   free(partial);
+
+   return 1;
+}
+
+void
+pgmoneta_resume_delete(int server)
+{
+   char* partial = NULL;
+
+   partial = pgmoneta_get_server_partial(server);
+
+   if (pgmoneta_exists(partial))
+   {
+      pgmoneta_delete_directory(partial);
+   }
+
+   free(partial);
+}
+
+static int
+load_journal(char* partial, uint32_t* timeline, char* startpos, size_t startpos_size, struct art** files)
+{
+   char* path = NULL;
+   char line[MAX_PATH * 3];
+   char* saveptr = NULL;
+   char* kind = NULL;
+   char* size = NULL;
+   char* mtime = NULL;
+   char* file_path = NULL;
+   char* local = NULL;
+   char value[MAX_PATH + MISC_LENGTH];
+   bool started = false;
+   struct art* f = NULL;
+   FILE* journal = NULL;
+
+   *files = NULL;
+
+   path = journal_path(partial);
+
+   journal = fopen(path, "r");
+   if (journal == NULL)
+   {
+      pgmoneta_log_error("Resume: Could not open %s", path);
+      goto error;
+   }
+
+   if (pgmoneta_art_create(&f))
+   {
+      goto error;
+   }
+
+   while (fgets(line, sizeof(line), journal) != NULL)
+   {
+      /* A line without newline was cut short by the failure */
+      if (!pgmoneta_ends_with(line, "\n"))
+      {
+         break;
+      }
+      line[strlen(line) - 1] = '\0';
+
+      kind = strtok_r(line, "\t", &saveptr);
+      if (kind == NULL)
+      {
+         continue;
+      }
+
+      if (!strcmp(kind, JOURNAL_START))
+      {
+         char* t = strtok_r(NULL, "\t", &saveptr);
+         char* s = strtok_r(NULL, "\t", &saveptr);
+
+         if (t == NULL || s == NULL)
+         {
+            goto error;
+         }
+
+         *timeline = (uint32_t)strtoul(t, NULL, 10);
+         snprintf(startpos, startpos_size, "%s", s);
+         started = true;
+      }
+      else if (!strcmp(kind, JOURNAL_FILE))
+      {
+         size = strtok_r(NULL, "\t", &saveptr);
+         mtime = strtok_r(NULL, "\t", &saveptr);
+         file_path = strtok_r(NULL, "\t", &saveptr);
+         local = strtok_r(NULL, "\t", &saveptr);
+
+         if (size == NULL || mtime == NULL || file_path == NULL || local == NULL)
+         {
+            continue;
+         }
+
+         snprintf(value, sizeof(value), "%s\t%s\t%s", size, mtime, local);
+
+         if (pgmoneta_art_insert(f, file_path, (uintptr_t)value, ValueString))
+         {
+            goto error;
+         }
+      }
+   }
+
+   if (!started)
+   {
+      pgmoneta_log_error("Resume: %s has no start position", path);
+      goto error;
+   }
+
+   fclose(journal);
+   free(path);
+
+   *files = f;
+
+   return 0;
+
+error:
+
+   if (journal != NULL)
+   {
+      fclose(journal);
+   }
+   pgmoneta_art_destroy(f);
+   free(path);
+
+   return 1;
+}
+
+static int
+parse_entry(char* value, uint64_t* size, time_t* mtime, char* local, size_t local_size)
+{
+   char* p = NULL;
+   char* end = NULL;
+
+   *size = strtoull(value, &end, 10);
+   if (end == value || *end != '\t')
+   {
+      return 1;
+   }
+
+   p = end + 1;
+   *mtime = (time_t)strtoll(p, &end, 10);
+   if (end == p || *end != '\t')
+   {
+      return 1;
+   }
+
+   snprintf(local, local_size, "%s", end + 1);
+
+   return 0;
+}
+
+static int
+splice_file(int server, char* prior, char* incremental, char* output)
+{
+   uint32_t magic = 0;
+   uint32_t num_blocks = 0;
+   uint32_t truncation_block_length = 0;
+   uint32_t block_length = 0;
+   uint32_t* blocks = NULL;
+   int64_t* source = NULL;
+   size_t block_size;
+   size_t relseg_size;
+   size_t header_length;
+   size_t prior_blocks;
+   bool hole = false;
+   char* page = NULL;
+   FILE* in = NULL;
+   FILE* inc = NULL;
+   FILE* out = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   block_size = config->common.servers[server].block_size;
+   relseg_size = config->common.servers[server].relseg_size;
+
+   inc = fopen(incremental, "rb");
+   if (inc == NULL)
+   {
+      goto error;
+   }
+
+   if (fread(&magic, sizeof(uint32_t), 1, inc) != 1 || magic != INCREMENTAL_MAGIC ||
+       fread(&num_blocks, sizeof(uint32_t), 1, inc) != 1 || num_blocks > relseg_size ||
+       fread(&truncation_block_length, sizeof(uint32_t), 1, inc) != 1 || truncation_block_length > relseg_size)
+   {
+      pgmoneta_log_error("Resume: Invalid incremental file %s", incremental);
+      goto error;
+   }
+
+   if (num_blocks > 0)
+   {
+      blocks = (uint32_t*)malloc(num_blocks * sizeof(uint32_t));
+      if (blocks == NULL || fread(blocks, sizeof(uint32_t), num_blocks, inc) != num_blocks)
+      {
+         goto error;
+      }
+   }
+
+   header_length = sizeof(uint32_t) * (3 + num_blocks);
+   if (num_blocks > 0 && header_length % block_size != 0)
+   {
+      header_length += block_size - (header_length % block_size);
+   }
+
+   /* The file is as long as its truncation length, or its last changed block */
+   block_length = truncation_block_length;
+   for (uint32_t i = 0; i < num_blocks; i++)
+   {
+      if (blocks[i] >= relseg_size)
+      {
+         pgmoneta_log_error("Resume: Invalid block %u in %s", blocks[i], incremental);
+         goto error;
+      }
+      if (blocks[i] + 1 > block_length)
+      {
+         block_length = blocks[i] + 1;
+      }
+   }
+
+   source = (int64_t*)malloc((block_length + 1) * sizeof(int64_t));
+   page = (char*)malloc(block_size);
+   if (source == NULL || page == NULL)
+   {
+      goto error;
+   }
+
+   for (uint32_t i = 0; i < block_length; i++)
+   {
+      source[i] = -1;
+   }
+   for (uint32_t i = 0; i < num_blocks; i++)
+   {
+      source[blocks[i]] = (int64_t)i;
+   }
+
+   in = fopen(prior, "rb");
+   if (in == NULL)
+   {
+      pgmoneta_log_error("Resume: Could not open %s", prior);
+      goto error;
+   }
+   prior_blocks = pgmoneta_get_file_size(prior) / block_size;
+
+   out = fopen(output, "wb");
+   if (out == NULL)
+   {
+      goto error;
+   }
+
+   for (uint32_t i = 0; i < block_length; i++)
+   {
+      if (source[i] >= 0)
+      {
+         if (fseeko(inc, (off_t)(header_length + source[i] * block_size), SEEK_SET) ||
+             fread(page, 1, block_size, inc) != block_size)
+         {
+            goto error;
+         }
+      }
+      else if (i < prior_blocks)
+      {
+         if (fseeko(in, (off_t)i * block_size, SEEK_SET) ||
+             fread(page, 1, block_size, in) != block_size)
+         {
+            goto error;
+         }
+      }
+      else
+      {
+         memset(page, 0, block_size);
+      }
+
+      if (pgmoneta_is_zero(page, block_size))
+      {
+         if (fseeko(out, block_size, SEEK_CUR))
+         {
+            goto error;
+         }
+         hole = true;
+         continue;
+      }
+
+      hole = false;
+      if (fwrite(page, 1, block_size, out) != block_size)
+      {
+         goto error;
+      }
+   }
+
+   if (fflush(out))
+   {
+      goto error;
+   }
+
+   if (hole && ftruncate(fileno(out), (off_t)block_length * block_size))
+   {
+      goto error;
+   }
+
+   fclose(in);
+   fclose(inc);
+   fclose(out);
+   free(blocks);
+   free(source);
+   free(page);
+
+   return 0;
+
+error:
+
+   if (in != NULL)
+   {
+      fclose(in);
+   }
+   if (inc != NULL)
+   {
+      fclose(inc);
+   }
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+   free(blocks);
+   free(source);
+   free(page);
+
+   return 1;
+}
+
+static int
+strip_backup_label(char* path)
+{
+   char line[MAX_PATH];
+   char* content = NULL;
+   FILE* file = NULL;
+
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   while (fgets(line, sizeof(line), file) != NULL)
+   {
+      if (pgmoneta_starts_with(line, "INCREMENTAL FROM "))
+      {
+         continue;
+      }
+      content = pgmoneta_append(content, line);
+   }
+
+   fclose(file);
+
+   file = fopen(path, "w");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   if (content != NULL && fputs(content, file) == EOF)
+   {
+      goto error;
+   }
+
+   if (fflush(file))
+   {
+      goto error;
+   }
+
+   fclose(file);
+   free(content);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(content);
+
+   return 1;
+}
+
+static int
+update_entry(struct json* entry, char* data, char* path)
+{
+   char file_path[MAX_PATH + MAX_PATH];
+   char* new_path = NULL;
+   char* checksum = NULL;
+
+   snprintf(file_path, sizeof(file_path), "%s%s", data, path);
+
+   if (pgmoneta_create_sha512_file(file_path, &checksum))
+   {
+      pgmoneta_log_error("Resume: Could not calculate the checksum of %s", file_path);
+      return 1;
+   }
+
+   new_path = pgmoneta_append(NULL, path);
+
+   pgmoneta_json_put(entry, "Path", (uintptr_t)new_path, ValueString);
+   pgmoneta_json_put(entry, "Size", (uintptr_t)pgmoneta_get_file_size(file_path), ValueUInt64);
+   pgmoneta_json_put(entry, "Checksum-Algorithm", (uintptr_t)"SHA512", ValueString);
+   pgmoneta_json_put(entry, "Checksum", (uintptr_t)checksum, ValueString);
+
+   free(new_path);
+   free(checksum);
+
+   return 0;
+}
+
+static char*
+journal_path(char* basedir)
+{
+   char* path = NULL;
+
+   path = pgmoneta_append(path, basedir);
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append(path, "/");
+   }
+   path = pgmoneta_append(path, RESUME_JOURNAL);
+
+   return path;
+}
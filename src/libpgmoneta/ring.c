@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <logging.h>
+#include <ring.h>
+#include <utils.h>
+
+/* system */
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+static void* ring_writer_run(void* arg);
+static int ring_writer_publish(struct ring_writer* ring);
+static void ring_writer_clock(struct timespec* t);
+
+int
+pgmoneta_ring_writer_create(size_t slot_size, int number_of_slots, ring_sink sink, void* sink_data, struct ring_writer** ring)
+{
+   struct ring_writer* r = NULL;
+
+   *ring = NULL;
+
+   if (slot_size == 0 || number_of_slots < 2 || sink == NULL)
+   {
+      goto error;
+   }
+
+   r = (struct ring_writer*)malloc(sizeof(struct ring_writer));
+   if (r == NULL)
+   {
+      goto error;
+   }
+
+   memset(r, 0, sizeof(struct ring_writer));
+
+   r->number_of_slots = number_of_slots;
+   r->slot_size = pgmoneta_get_aligned_size(slot_size);
+   r->sink = sink;
+   r->sink_data = sink_data;
+
+   pthread_mutex_init(&r->lock, NULL);
+   pthread_cond_init(&r->not_empty, NULL);
+   pthread_cond_init(&r->not_full, NULL);
+
+   r->slots = (char**)calloc(number_of_slots, sizeof(char*));
+   r->lengths = (size_t*)calloc(number_of_slots, sizeof(size_t));
+   if (r->slots == NULL || r->lengths == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_slots; i++)
+   {
+      r->slots[i] = aligned_alloc((size_t)ALIGNMENT_SIZE, r->slot_size);
+      if (r->slots[i] == NULL)
+      {
+         goto error;
+      }
+   }
+
+   if (pthread_create(&r->thread, NULL, ring_writer_run, r))
+   {
+      pgmoneta_log_error("Ring: Could not start the writer thread");
+      goto error;
+   }
+   r->started = true;
+
+   *ring = r;
+
+   return 0;
+
+error:
+
+   pgmoneta_ring_writer_destroy(r);
+
+   return 1;
+}
+
+int
+pgmoneta_ring_writer_write(struct ring_writer* ring, void* data, size_t size)
+{
+   size_t chunk = 0;
+   char* d = (char*)data;
+   bool failed = false;
+   struct timespec start_t;
+   struct timespec end_t;
+
+   while (size > 0)
+   {
+      if (ring->offset == 0)
+      {
+         pthread_mutex_lock(&ring->lock);
+         if (ring->count == ring->number_of_slots && !ring->failed)
+         {
+            /* The writer is behind, so the disk is the bottleneck */
+            ring_writer_clock(&start_t);
+            while (ring->count == ring->number_of_slots && !ring->failed)
+            {
+               pthread_cond_wait(&ring->not_full, &ring->lock);
+            }
+            ring_writer_clock(&end_t);
+
+            ring->producer_stalls++;
+            ring->producer_wait += pgmoneta_compute_duration(start_t, end_t);
+         }
+         failed = ring->failed;
+         pthread_mutex_unlock(&ring->lock);
+
+         if (failed)
+         {
+            return 1;
+         }
+      }
+
+      chunk = MIN(size, ring->slot_size - ring->offset);
+      memcpy(ring->slots[ring->head] + ring->offset, d, chunk);
+
+      ring->offset += chunk;
+      d += chunk;
+      size -= chunk;
+
+      if (ring->offset == ring->slot_size)
+      {
+         if (ring_writer_publish(ring))
+         {
+            return 1;
+         }
+      }
+   }
+
+   return 0;
+}
+
+int
+pgmoneta_ring_writer_finish(struct ring_writer* ring)
+{
+   bool failed = false;
+
+   if (ring == NULL || !ring->started)
+   {
+      return 1;
+   }
+
+   if (ring->offset > 0)
+   {
+      ring_writer_publish(ring);
+   }
+
+   pthread_mutex_lock(&ring->lock);
+   ring->done = true;
+   pthread_cond_signal(&ring->not_empty);
+   pthread_mutex_unlock(&ring->lock);
+
+   pthread_join(ring->thread, NULL);
+   ring->started = false;
+
+   failed = ring->failed;
+
+   pgmoneta_log_debug("Ring: %" PRIu64 " bytes, network waits %" PRIu64 " (%.4fs), disk waits %" PRIu64 " (%.4fs)",
+                      ring->bytes, ring->consumer_stalls, ring->consumer_wait,
+                      ring->producer_stalls, ring->producer_wait);
+
+   return failed ? 1 : 0;
+}
+
+void
+pgmoneta_ring_writer_destroy(struct ring_writer* ring)
+{
+   if (ring == NULL)
+   {
+      return;
+   }
+
+   if (ring->started)
+   {
+      pthread_mutex_lock(&ring->lock);
+      ring->done = true;
+      ring->failed = true;
+      pthread_cond_signal(&ring->not_empty);
+      pthread_mutex_unlock(&ring->lock);
+
+      pthread_join(ring->thread, NULL);
+      ring->started = false;
+   }
+
+   if (ring->slots != NULL)
+   {
+      for (int i = 0; i < ring->number_of_slots; i++)
+      {
+         free(ring->slots[i]);
+      }
+   }
+
+   free(ring->slots);
+   free(ring->lengths);
+
+   pthread_cond_destroy(&ring->not_full);
+   pthread_cond_destroy(&ring->not_empty);
+   pthread_mutex_destroy(&ring->lock);
+
+   free(ring);
+}
+
+static void*
+ring_writer_run(void* arg)
+{
+   struct ring_writer* ring = (struct ring_writer*)arg;
+   int slot = 0;
+   size_t length = 0;
+   bool skip = false;
+   struct timespec start_t;
+   struct timespec end_t;
+
+   pthread_mutex_lock(&ring->lock);
+
+   while (true)
+   {
+      if (ring->count == 0 && !ring->done)
+      {
+         /* Nothing to write, so the network is the bottleneck */
+         ring_writer_clock(&start_t);
+         while (ring->count == 0 && !ring->done)
+         {
+            pthread_cond_wait(&ring->not_empty, &ring->lock);
+         }
+         ring_writer_clock(&end_t);
+
+         ring->consumer_stalls++;
+         ring->consumer_wait += pgmoneta_compute_duration(start_t, end_t);
+      }
+
+      if (ring->count == 0)
+      {
+         break;
+      }
+
+      slot = ring->tail;
+      length = ring->lengths[slot];
+      skip = ring->failed;
+
+      pthread_mutex_unlock(&ring->lock);
+
+      if (!skip && ring->sink(ring->sink_data, ring->slots[slot], length))
+      {
+         skip = true;
+      }
+
+      pthread_mutex_lock(&ring->lock);
+
+      if (skip)
+      {
+         ring->failed = true;
+      }
+      else
+      {
+         ring->bytes += length;
+      }
+
+      ring->tail = (ring->tail + 1) % ring->number_of_slots;
+      ring->count--;
+      pthread_cond_signal(&ring->not_full);
+   }
+
+   pthread_mutex_unlock(&ring->lock);
+
+   return NULL;
+}
+
+static int
+ring_writer_publish(struct ring_writer* ring)
+{
+   bool failed = false;
+
+   pthread_mutex_lock(&ring->lock);
+
+   ring->lengths[ring->head] = ring->offset;
+   ring->head = (ring->head + 1) % ring->number_of_slots;
+   ring->count++;
+   failed = ring->failed;
+
+   pthread_cond_signal(&ring->not_empty);
+   pthread_mutex_unlock(&ring->lock);
+
+   ring->offset = 0;
+
+   return failed ? 1 : 0;
+}
+
+static void
+ring_writer_clock(struct timespec* t)
+{
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, t);
+#endif
+}
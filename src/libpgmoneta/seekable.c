@@ -0,0 +1,956 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <aes.h>
+#include <dictionary.h>
+#include <logging.h>
+#include <lz4_compression.h>
+#include <seekable.h>
+#include <utils.h>
+
+/* system */
+#include <errno.h>
+#include <fcntl.h>
+#include <lz4.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zstd.h>
+#include <openssl/evp.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define AES_BLOCK 16
+
+static bool is_zstd(int compression);
+static bool is_lz4(int compression);
+static int compress_frame(struct seekable_writer* writer);
+static int add_frame(struct seekable_writer* writer, uint32_t compressed, uint32_t decompressed);
+static int file_output(void* data, void* buffer, size_t size);
+static int read_stored(struct seekable_reader* reader, uint64_t offset, void* buffer, size_t size);
+static int load_frame(struct seekable_reader* reader, uint32_t frame);
+static void put_uint32(unsigned char* p, uint32_t value);
+static uint32_t get_uint32(unsigned char* p);
+
+bool
+pgmoneta_seekable_supported(int compression)
+{
+   return is_zstd(compression) || is_lz4(compression);
+}
+
+int
+pgmoneta_seekable_writer_create(int compression, int level, seekable_output output, void* output_data, struct seekable_writer** writer)
+{
+   struct seekable_writer* w = NULL;
+
+   *writer = NULL;
+
+   if (!pgmoneta_seekable_supported(compression))
+   {
+      goto error;
+   }
+
+   w = (struct seekable_writer*)malloc(sizeof(struct seekable_writer));
+   if (w == NULL)
+   {
+      goto error;
+   }
+
+   memset(w, 0, sizeof(struct seekable_writer));
+
+   w->compression = compression;
+   w->level = level;
+   w->output = output;
+   w->output_data = output_data;
+
+   if (is_zstd(compression))
+   {
+      if (w->level < 1)
+      {
+         w->level = 1;
+      }
+      else if (w->level > 19)
+      {
+         w->level = 19;
+      }
+
+      w->context = ZSTD_createCCtx();
+      if (w->context == NULL)
+      {
+         goto error;
+      }
+
+      ZSTD_CCtx_setParameter((ZSTD_CCtx*)w->context, ZSTD_c_compressionLevel, w->level);
+      ZSTD_CCtx_setParameter((ZSTD_CCtx*)w->context, ZSTD_c_checksumFlag, 1);
+
+      w->out_capacity = ZSTD_compressBound(SEEKABLE_FRAME_SIZE);
+   }
+   else
+   {
+      w->context = LZ4_createStream();
+      if (w->context == NULL)
+      {
+         goto error;
+      }
+
+      /* Each block is preceded by its compressed size */
+      w->out_capacity = (SEEKABLE_FRAME_SIZE / (BLOCK_BYTES)) * (sizeof(int) + LZ4_COMPRESSBOUND(BLOCK_BYTES));
+   }
+
+   w->frame = (char*)malloc(SEEKABLE_FRAME_SIZE);
+   w->out = (char*)malloc(w->out_capacity);
+
+   if (w->frame == NULL || w->out == NULL)
+   {
+      goto error;
+   }
+
+   *writer = w;
+
+   return 0;
+
+error:
+
+   pgmoneta_seekable_writer_destroy(w);
+
+   return 1;
+}
+
+int
+pgmoneta_seekable_writer_write(struct seekable_writer* writer, void* data, size_t size)
+{
+   char* p = (char*)data;
+   size_t n = 0;
+
+   while (size > 0)
+   {
+      n = MIN(size, SEEKABLE_FRAME_SIZE - writer->frame_size);
+      memcpy(writer->frame + writer->frame_size, p, n);
+      writer->frame_size += n;
+      p += n;
+      size -= n;
+
+      if (writer->frame_size == SEEKABLE_FRAME_SIZE)
+      {
+         if (compress_frame(writer))
+         {
+            return 1;
+         }
+      }
+   }
+
+   return 0;
+}
+
+int
+pgmoneta_seekable_writer_finish(struct seekable_writer* writer)
+{
+   size_t table_size;
+   size_t offset = 0;
+   unsigned char* table = NULL;
+
+   if (writer->frame_size > 0)
+   {
+      if (compress_frame(writer))
+      {
+         goto error;
+      }
+   }
+
+   /* lz4 blocks end at a zero size, so readers stop in front of the table */
+   table_size = (is_lz4(writer->compression) ? sizeof(int) : 0) +
+                8 + (size_t)writer->number_of_frames * SEEKABLE_ENTRY_SIZE + SEEKABLE_FOOTER_SIZE;
+
+   table = (unsigned char*)malloc(table_size);
+   if (table == NULL)
+   {
+      goto error;
+   }
+
+   memset(table, 0, table_size);
+
+   if (is_lz4(writer->compression))
+   {
+      offset += sizeof(int);
+   }
+
+   put_uint32(table + offset, SEEKABLE_SKIPPABLE_MAGIC);
+   put_uint32(table + offset + 4, (uint32_t)(writer->number_of_frames * SEEKABLE_ENTRY_SIZE + SEEKABLE_FOOTER_SIZE));
+   offset += 8;
+
+   for (uint32_t i = 0; i < writer->number_of_frames; i++)
+   {
+      put_uint32(table + offset, writer->compressed[i]);
+      put_uint32(table + offset + 4, writer->decompressed[i]);
+      offset += SEEKABLE_ENTRY_SIZE;
+   }
+
+   put_uint32(table + offset, writer->number_of_frames);
+   table[offset + 4] = 0;
+   put_uint32(table + offset + 5, SEEKABLE_MAGIC);
+
+   if (writer->output(writer->output_data, table, table_size))
+   {
+      goto error;
+   }
+
+   free(table);
+
+   return 0;
+
+error:
+
+   free(table);
+
+   return 1;
+}
+
+int
+pgmoneta_seekable_writer_dictionary(struct seekable_writer* writer, char* path, uint32_t* id)
+{
+   *id = 0;
+
+   if (!is_zstd(writer->compression))
+   {
+      return 0;
+   }
+
+   return pgmoneta_dictionary_compress(path, DICTIONARY_TYPE_DATA, writer->level, (ZSTD_CCtx*)writer->context, id);
+}
+
+void
+pgmoneta_seekable_writer_destroy(struct seekable_writer* writer)
+{
+   if (writer == NULL)
+   {
+      return;
+   }
+
+   if (writer->context != NULL)
+   {
+      if (is_zstd(writer->compression))
+      {
+         ZSTD_freeCCtx((ZSTD_CCtx*)writer->context);
+      }
+      else
+      {
+         LZ4_freeStream((LZ4_stream_t*)writer->context);
+      }
+   }
+
+   free(writer->frame);
+   free(writer->out);
+   free(writer->compressed);
+   free(writer->decompressed);
+   free(writer);
+}
+
+int
+pgmoneta_seekable_compress_file(char* from, char* to, int compression, int level, bool dictionary)
+{
+   uint32_t id = 0;
+   size_t nread = 0;
+   char* buffer = NULL;
+   FILE* in = NULL;
+   FILE* out = NULL;
+   struct seekable_writer* writer = NULL;
+
+   buffer = (char*)malloc(SEEKABLE_FRAME_SIZE);
+   if (buffer == NULL)
+   {
+      goto error;
+   }
+
+   in = fopen(from, "rb");
+   if (in == NULL)
+   {
+      goto error;
+   }
+
+   out = fopen(to, "wb");
+   if (out == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_seekable_writer_create(compression, level, file_output, out, &writer))
+   {
+      goto error;
+   }
+
+   if (dictionary && pgmoneta_seekable_writer_dictionary(writer, from, &id))
+   {
+      goto error;
+   }
+
+   while ((nread = fread(buffer, 1, SEEKABLE_FRAME_SIZE, in)) > 0)
+   {
+      if (pgmoneta_seekable_writer_write(writer, buffer, nread))
+      {
+         goto error;
+      }
+   }
+
+   if (ferror(in))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_seekable_writer_finish(writer))
+   {
+      goto error;
+   }
+
+   if (fflush(out))
+   {
+      goto error;
+   }
+
+   pgmoneta_seekable_writer_destroy(writer);
+   fclose(in);
+   fclose(out);
+   free(buffer);
+
+   return 0;
+
+error:
+
+   pgmoneta_seekable_writer_destroy(writer);
+   if (in != NULL)
+   {
+      fclose(in);
+   }
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+   free(buffer);
+
+   return 1;
+}
+
+int
+pgmoneta_seekable_open(char* path, int compression, int encryption, struct seekable_reader** reader)
+{
+   unsigned char footer[SEEKABLE_FOOTER_SIZE];
+   unsigned char header[8];
+   unsigned char* entries = NULL;
+   uint64_t table_size;
+   uint64_t table_start;
+   uint64_t frames_end;
+   uint32_t compressed;
+   uint32_t decompressed;
+   size_t max_compressed = 0;
+   struct stat st;
+   struct seekable_reader* r = NULL;
+
+   *reader = NULL;
+
+   if (!pgmoneta_seekable_supported(compression))
+   {
+      goto error;
+   }
+
+   r = (struct seekable_reader*)malloc(sizeof(struct seekable_reader));
+   if (r == NULL)
+   {
+      goto error;
+   }
+
+   memset(r, 0, sizeof(struct seekable_reader));
+   r->fd = -1;
+   r->compression = compression;
+   r->encryption = encryption;
+   r->cached_frame = -1;
+
+   r->path = pgmoneta_append(NULL, path);
+
+   r->fd = open(path, O_RDONLY);
+   if (r->fd == -1 || fstat(r->fd, &st) != 0)
+   {
+      errno = 0;
+      goto error;
+   }
+
+   r->stored_size = (uint64_t)st.st_size;
+
+   if (pgmoneta_is_gcm_mode(encryption))
+   {
+      // the chunks are authenticated one by one, so the plaintext can be read at any offset
+      if (pgmoneta_gcm_plaintext_size(r->fd, &r->stored_size))
+      {
+         goto error;
+      }
+   }
+   else if (encryption != ENCRYPTION_NONE && !pgmoneta_is_counter_mode(encryption))
+   {
+      unsigned char last[AES_BLOCK];
+      unsigned char pad;
+
+      /* CBC pads the data to whole blocks, the last byte tells by how much */
+      if (r->stored_size < AES_BLOCK || r->stored_size % AES_BLOCK != 0)
+      {
+         goto error;
+      }
+
+      if (read_stored(r, r->stored_size - AES_BLOCK, last, AES_BLOCK))
+      {
+         goto error;
+      }
+
+      pad = last[AES_BLOCK - 1];
+      if (pad == 0 || pad > AES_BLOCK)
+      {
+         goto error;
+      }
+
+      r->stored_size -= pad;
+   }
+
+   if (r->stored_size < 8 + SEEKABLE_FOOTER_SIZE)
+   {
+      goto error;
+   }
+
+   if (read_stored(r, r->stored_size - SEEKABLE_FOOTER_SIZE, footer, SEEKABLE_FOOTER_SIZE))
+   {
+      goto error;
+   }
+
+   if (get_uint32(footer + 5) != SEEKABLE_MAGIC)
+   {
+      goto error;
+   }
+
+   r->number_of_frames = get_uint32(footer);
+   table_size = 8 + (uint64_t)r->number_of_frames * SEEKABLE_ENTRY_SIZE + SEEKABLE_FOOTER_SIZE;
+
+   if (table_size > r->stored_size)
+   {
+      goto error;
+   }
+
+   table_start = r->stored_size - table_size;
+
+   if (read_stored(r, table_start, header, sizeof(header)) ||
+       get_uint32(header) != SEEKABLE_SKIPPABLE_MAGIC ||
+       get_uint32(header + 4) != table_size - 8)
+   {
+      goto error;
+   }
+
+   r->compressed_offsets = (uint64_t*)malloc((r->number_of_frames + 1) * sizeof(uint64_t));
+   r->decompressed_offsets = (uint64_t*)malloc((r->number_of_frames + 1) * sizeof(uint64_t));
+   if (r->compressed_offsets == NULL || r->decompressed_offsets == NULL)
+   {
+      goto error;
+   }
+
+   if (r->number_of_frames > 0)
+   {
+      entries = (unsigned char*)malloc((size_t)r->number_of_frames * SEEKABLE_ENTRY_SIZE);
+      if (entries == NULL ||
+          read_stored(r, table_start + 8, entries, (size_t)r->number_of_frames * SEEKABLE_ENTRY_SIZE))
+      {
+         goto error;
+      }
+   }
+
+   r->compressed_offsets[0] = 0;
+   r->decompressed_offsets[0] = 0;
+
+   for (uint32_t i = 0; i < r->number_of_frames; i++)
+   {
+      compressed = get_uint32(entries + (size_t)i * SEEKABLE_ENTRY_SIZE);
+      decompressed = get_uint32(entries + (size_t)i * SEEKABLE_ENTRY_SIZE + 4);
+
+      if (decompressed > SEEKABLE_FRAME_SIZE)
+      {
+         goto error;
+      }
+
+      max_compressed = MAX(max_compressed, compressed);
+
+      r->compressed_offsets[i + 1] = r->compressed_offsets[i] + compressed;
+      r->decompressed_offsets[i + 1] = r->decompressed_offsets[i] + decompressed;
+   }
+
+   frames_end = table_start - (is_lz4(compression) ? sizeof(int) : 0);
+   if (r->compressed_offsets[r->number_of_frames] != frames_end)
+   {
+      goto error;
+   }
+
+   r->size = r->decompressed_offsets[r->number_of_frames];
+
+   r->frame = (char*)malloc(SEEKABLE_FRAME_SIZE);
+   r->input_capacity = MAX(max_compressed, 1);
+   r->input = (char*)malloc(r->input_capacity);
+   if (r->frame == NULL || r->input == NULL)
+   {
+      goto error;
+   }
+
+   if (is_zstd(compression))
+   {
+      r->context = ZSTD_createDCtx();
+      if (r->context == NULL)
+      {
+         goto error;
+      }
+   }
+
+   free(entries);
+
+   *reader = r;
+
+   return 0;
+
+error:
+
+   free(entries);
+   pgmoneta_seekable_close(r);
+
+   return 1;
+}
+
+int
+pgmoneta_seekable_read(struct seekable_reader* reader, uint64_t offset, void* buffer, size_t size, size_t* nread)
+{
+   char* p = (char*)buffer;
+   uint32_t low;
+   uint32_t high;
+   uint32_t frame;
+   uint64_t frame_offset;
+   size_t n;
+
+   *nread = 0;
+
+   while (size > 0 && offset < reader->size)
+   {
+      /* Find the last frame starting at or before the offset */
+      low = 0;
+      high = reader->number_of_frames - 1;
+      while (low < high)
+      {
+         uint32_t mid = low + (high - low + 1) / 2;
+
+         if (reader->decompressed_offsets[mid] <= offset)
+         {
+            low = mid;
+         }
+         else
+         {
+            high = mid - 1;
+         }
+      }
+      frame = low;
+
+      if (load_frame(reader, frame))
+      {
+         return 1;
+      }
+
+      frame_offset = offset - reader->decompressed_offsets[frame];
+      n = MIN(size, reader->decompressed_offsets[frame + 1] - offset);
+
+      memcpy(p, reader->frame + frame_offset, n);
+
+      p += n;
+      offset += n;
+      size -= n;
+      *nread += n;
+   }
+
+   return 0;
+}
+
+void
+pgmoneta_seekable_close(struct seekable_reader* reader)
+{
+   if (reader == NULL)
+   {
+      return;
+   }
+
+   if (reader->fd != -1)
+   {
+      close(reader->fd);
+   }
+
+   if (reader->context != NULL)
+   {
+      ZSTD_freeDCtx((ZSTD_DCtx*)reader->context);
+   }
+
+   free(reader->path);
+   free(reader->compressed_offsets);
+   free(reader->decompressed_offsets);
+   free(reader->frame);
+   free(reader->input);
+   free(reader);
+}
+
+static bool
+is_zstd(int compression)
+{
+   return compression == COMPRESSION_CLIENT_ZSTD || compression == COMPRESSION_SERVER_ZSTD;
+}
+
+static bool
+is_lz4(int compression)
+{
+   return compression == COMPRESSION_CLIENT_LZ4 || compression == COMPRESSION_SERVER_LZ4;
+}
+
+static int
+compress_frame(struct seekable_writer* writer)
+{
+   size_t compressed = 0;
+
+   if (is_zstd(writer->compression))
+   {
+      compressed = ZSTD_compress2((ZSTD_CCtx*)writer->context, writer->out, writer->out_capacity,
+                                  writer->frame, writer->frame_size);
+      if (ZSTD_isError(compressed))
+      {
+         pgmoneta_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(compressed));
+         return 1;
+      }
+   }
+   else
+   {
+      char block[2][BLOCK_BYTES];
+      int index = 0;
+      size_t offset = 0;
+      size_t n;
+      int c;
+
+      /* The first block of a frame doesn't refer to the previous frame */
+      LZ4_resetStream_fast((LZ4_stream_t*)writer->context);
+
+      /* Blocks only refer to the block before them, like the lz4 file format of pgmoneta */
+      while (offset < writer->frame_size)
+      {
+         n = MIN((size_t)(BLOCK_BYTES), writer->frame_size - offset);
+         memcpy(block[index], writer->frame + offset, n);
+
+         c = LZ4_compress_fast_continue((LZ4_stream_t*)writer->context, block[index],
+                                        writer->out + compressed + sizeof(int), (int)n,
+                                        LZ4_COMPRESSBOUND(BLOCK_BYTES), 1);
+         if (c <= 0)
+         {
+            pgmoneta_log_error("LZ4: Compression error");
+            return 1;
+         }
+
+         memcpy(writer->out + compressed, &c, sizeof(int));
+         compressed += sizeof(int) + (size_t)c;
+         offset += n;
+         index = (index + 1) % 2;
+      }
+   }
+
+   if (writer->output(writer->output_data, writer->out, compressed))
+   {
+      return 1;
+   }
+
+   if (add_frame(writer, (uint32_t)compressed, (uint32_t)writer->frame_size))
+   {
+      return 1;
+   }
+
+   writer->frame_size = 0;
+
+   return 0;
+}
+
+static int
+add_frame(struct seekable_writer* writer, uint32_t compressed, uint32_t decompressed)
+{
+   uint32_t* c = NULL;
+   uint32_t* d = NULL;
+   uint32_t capacity;
+
+   if (writer->number_of_frames == writer->capacity)
+   {
+      capacity = writer->capacity == 0 ? 64 : writer->capacity * 2;
+
+      c = (uint32_t*)realloc(writer->compressed, capacity * sizeof(uint32_t));
+      if (c == NULL)
+      {
+         return 1;
+      }
+      writer->compressed = c;
+
+      d = (uint32_t*)realloc(writer->decompressed, capacity * sizeof(uint32_t));
+      if (d == NULL)
+      {
+         return 1;
+      }
+      writer->decompressed = d;
+
+      writer->capacity = capacity;
+   }
+
+   writer->compressed[writer->number_of_frames] = compressed;
+   writer->decompressed[writer->number_of_frames] = decompressed;
+   writer->number_of_frames++;
+
+   return 0;
+}
+
+static int
+file_output(void* data, void* buffer, size_t size)
+{
+   FILE* out = (FILE*)data;
+
+   if (size > 0 && fwrite(buffer, 1, size, out) != size)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+read_stored(struct seekable_reader* reader, uint64_t offset, void* buffer, size_t size)
+{
+   uint64_t first_block;
+   uint64_t start;
+   uint64_t end;
+   uint64_t file_size;
+   size_t length;
+   size_t prefix;
+   ssize_t n;
+   size_t done = 0;
+   int out_length = 0;
+   unsigned char* cipher = NULL;
+   unsigned char* plain = NULL;
+   EVP_CIPHER_CTX* ctx = NULL;
+   struct stat st;
+
+   if (reader->encryption == ENCRYPTION_NONE)
+   {
+      while (done < size)
+      {
+         n = pread(reader->fd, (char*)buffer + done, size - done, (off_t)(offset + done));
+         if (n <= 0)
+         {
+            return 1;
+         }
+         done += (size_t)n;
+      }
+
+      return 0;
+   }
+
+   if (pgmoneta_is_gcm_mode(reader->encryption))
+   {
+      return pgmoneta_gcm_read(reader->fd, offset, buffer, size);
+   }
+
+   if (fstat(reader->fd, &st) != 0)
+   {
+      return 1;
+   }
+   file_size = (uint64_t)st.st_size;
+
+   /* Decrypt whole cipher blocks, CBC also needs the block in front as iv */
+   first_block = offset / AES_BLOCK;
+   start = first_block * AES_BLOCK;
+   prefix = (!pgmoneta_is_counter_mode(reader->encryption) && first_block > 0) ? AES_BLOCK : 0;
+   end = ((offset + size + AES_BLOCK - 1) / AES_BLOCK) * AES_BLOCK;
+   end = MIN(end, file_size);
+
+   if (end < offset + size)
+   {
+      return 1;
+   }
+
+   length = (size_t)(end - start);
+
+   cipher = (unsigned char*)malloc(length + prefix);
+   plain = (unsigned char*)malloc(length + AES_BLOCK);
+   if (cipher == NULL || plain == NULL)
+   {
+      goto error;
+   }
+
+   while (done < length + prefix)
+   {
+      n = pread(reader->fd, cipher + done, length + prefix - done, (off_t)(start - prefix + done));
+      if (n <= 0)
+      {
+         goto error;
+      }
+      done += (size_t)n;
+   }
+
+   if (pgmoneta_create_cipher_context_at(reader->encryption, first_block, prefix > 0 ? cipher : NULL, &ctx))
+   {
+      goto error;
+   }
+
+   if (EVP_DecryptUpdate(ctx, plain, &out_length, cipher + prefix, (int)length) != 1 ||
+       (size_t)out_length < offset - start + size)
+   {
+      goto error;
+   }
+
+   memcpy(buffer, plain + (offset - start), size);
+
+   EVP_CIPHER_CTX_free(ctx);
+   free(cipher);
+   free(plain);
+
+   return 0;
+
+error:
+
+   if (ctx != NULL)
+   {
+      EVP_CIPHER_CTX_free(ctx);
+   }
+   free(cipher);
+   free(plain);
+
+   return 1;
+}
+
+static int
+load_frame(struct seekable_reader* reader, uint32_t frame)
+{
+   size_t compressed;
+   size_t decompressed;
+
+   if (reader->cached_frame == (int64_t)frame)
+   {
+      return 0;
+   }
+
+   reader->cached_frame = -1;
+
+   compressed = (size_t)(reader->compressed_offsets[frame + 1] - reader->compressed_offsets[frame]);
+   decompressed = (size_t)(reader->decompressed_offsets[frame + 1] - reader->decompressed_offsets[frame]);
+
+   if (read_stored(reader, reader->compressed_offsets[frame], reader->input, compressed))
+   {
+      pgmoneta_log_error("Seekable: Could not read frame %u", frame);
+      return 1;
+   }
+
+   if (is_zstd(reader->compression))
+   {
+      size_t ret;
+      uint32_t id = ZSTD_getDictID_fromFrame(reader->input, compressed);
+
+      if (id != reader->dictionary)
+      {
+         if (pgmoneta_dictionary_decompress(reader->path, id, (ZSTD_DCtx*)reader->context))
+         {
+            return 1;
+         }
+         reader->dictionary = id;
+      }
+
+      ret = ZSTD_decompressDCtx((ZSTD_DCtx*)reader->context, reader->frame, SEEKABLE_FRAME_SIZE,
+                                reader->input, compressed);
+
+      if (ZSTD_isError(ret) || ret != decompressed)
+      {
+         pgmoneta_log_error("Seekable: Could not decompress frame %u", frame);
+         return 1;
+      }
+   }
+   else
+   {
+      LZ4_streamDecode_t decode;
+      size_t in = 0;
+      size_t out = 0;
+      int c;
+      int d;
+
+      LZ4_setStreamDecode(&decode, NULL, 0);
+
+      while (in < compressed)
+      {
+         if (compressed - in < sizeof(int))
+         {
+            return 1;
+         }
+
+         memcpy(&c, reader->input + in, sizeof(int));
+         in += sizeof(int);
+
+         if (c <= 0 || (size_t)c > compressed - in)
+         {
+            return 1;
+         }
+
+         d = LZ4_decompress_safe_continue(&decode, reader->input + in, reader->frame + out, c,
+                                          (int)(SEEKABLE_FRAME_SIZE - out));
+         if (d <= 0)
+         {
+            pgmoneta_log_error("Seekable: Could not decompress frame %u", frame);
+            return 1;
+         }
+
+         in += (size_t)c;
+         out += (size_t)d;
+      }
+
+      if (out != decompressed)
+      {
+         return 1;
+      }
+   }
+
+   reader->cached_frame = frame;
+
+   return 0;
+}
+
+static void
+put_uint32(unsigned char* p, uint32_t value)
+{
+   p[0] = (unsigned char)(value & 0xFF);
+   p[1] = (unsigned char)((value >> 8) & 0xFF);
+   p[2] = (unsigned char)((value >> 16) & 0xFF);
+   p[3] = (unsigned char)((value >> 24) & 0xFF);
+}
+
+static uint32_t
+get_uint32(unsigned char* p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
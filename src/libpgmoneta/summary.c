@@ -0,0 +1,1055 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <aes.h>
+#include <art.h>
+#include <brt.h>
+#include <compression.h>
+#include <deque.h>
+#include <logging.h>
+#include <summary.h>
+#include <utils.h>
+#include <walfile.h>
+#include <walfile/rm.h>
+#include <walfile/rm_database.h>
+#include <walfile/rm_storage.h>
+#include <walfile/rm_xact.h>
+#include <walfile/wal_reader.h>
+
+/* system */
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Resource manager identifiers, see the order of walfile/rmgr.h */
+#define SUMMARY_RM_XACT_ID  1
+#define SUMMARY_RM_SMGR_ID  2
+#define SUMMARY_RM_DBASE_ID 4
+
+/* The maximum aligned size of a page header */
+#define SUMMARY_PAGE_HEADER_SIZE 24
+
+#define SUMMARY_NAME_LENGTH 40
+
+/**
+ * A summary of one WAL segment
+ */
+struct summary_file
+{
+   uint32_t timeline;                  /**< The timeline */
+   uint64_t start_lsn;                 /**< The start LSN of the segment */
+   uint64_t end_lsn;                   /**< The end LSN of the segment */
+   char name[MISC_LENGTH];             /**< The file name */
+};
+
+static bool parse_wal_name(int server, char* name, uint32_t* timeline, uint64_t* segno);
+static bool parse_summary_name(char* name, struct summary_file* sf);
+static void summary_name(uint32_t timeline, uint64_t start_lsn, uint64_t end_lsn, char* name, size_t size);
+static int get_summary_files(int server, int* number_of_files, struct summary_file** files);
+static int summary_compare(const void* a, const void* b);
+static int read_segment(int server, char* wal_dir, char* file, struct walfile** wf);
+static int summarize_segment(int server, struct walfile* wf, block_ref_table* brt);
+static int summarize_smgr(int server, struct decoded_xlog_record* record, block_ref_table* brt);
+static int summarize_xact(struct decoded_xlog_record* record, block_ref_table* brt);
+static int summarize_dbase(int server, struct decoded_xlog_record* record, block_ref_table* brt);
+static int set_limit_block(block_ref_table* brt, oid spc, oid db, oid rel, enum fork_number forknum, block_number limit);
+static block_number visibilitymap_truncation_length(int server, block_number nheapblocks);
+static int merge_summary(block_ref_table* to, block_ref_table* from);
+static void reset_partial_record(void);
+
+bool
+pgmoneta_summary_is_local(int server)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   return config->wal_summary && !config->common.servers[server].summarize_wal;
+}
+
+int
+pgmoneta_summarize_wal(int server)
+{
+   char* wal_dir = NULL;
+   char* summary_dir = NULL;
+   int number_of_files = 0;
+   char** files = NULL;
+   char name[MISC_LENGTH];
+   char summary_path[MAX_PATH];
+   char tmp_path[MAX_PATH + MISC_LENGTH];
+   bool own = false;
+   bool have_last = false;
+   uint32_t timeline = 0;
+   uint64_t segno = 0;
+   uint32_t last_timeline = 0;
+   uint64_t last_segno = 0;
+   uint32_t prev_timeline = 0;
+   uint64_t prev_segno = 0;
+   uint64_t start_lsn = 0;
+   int summarized = 0;
+   struct walfile* wf = NULL;
+   block_ref_table* brt = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->common.servers[server].wal_size <= 0 || config->common.servers[server].version == 0)
+   {
+      pgmoneta_log_debug("Summary: WAL information not available for %s", config->common.servers[server].name);
+      goto error;
+   }
+
+   wal_dir = pgmoneta_get_server_wal(server);
+   summary_dir = pgmoneta_get_server_summary(server);
+
+   if (!pgmoneta_exists(summary_dir) && pgmoneta_mkdir(summary_dir))
+   {
+      pgmoneta_log_error("Summary: Could not create %s", summary_dir);
+      goto error;
+   }
+
+   if (pgmoneta_get_wal_files(wal_dir, &number_of_files, &files))
+   {
+      pgmoneta_log_error("Summary: Could not get WAL files for %s", config->common.servers[server].name);
+      goto error;
+   }
+
+   if (partial_record == NULL)
+   {
+      partial_record = (struct partial_xlog_record*)calloc(1, sizeof(struct partial_xlog_record));
+      if (partial_record == NULL)
+      {
+         goto error;
+      }
+      own = true;
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      if (!parse_wal_name(server, files[i], &timeline, &segno))
+      {
+         continue;
+      }
+
+      start_lsn = segno * config->common.servers[server].wal_size;
+      summary_name(timeline, start_lsn, start_lsn + config->common.servers[server].wal_size, name, sizeof(name));
+      snprintf(summary_path, sizeof(summary_path), "%s%s", summary_dir, name);
+
+      if (pgmoneta_exists(summary_path))
+      {
+         continue;
+      }
+
+      /* A record crossing into this segment is only complete when the previous segment was read first */
+      if (!have_last || last_timeline != timeline || last_segno + 1 != segno)
+      {
+         reset_partial_record();
+
+         if (i > 0 && parse_wal_name(server, files[i - 1], &prev_timeline, &prev_segno) &&
+             prev_timeline == timeline && prev_segno + 1 == segno)
+         {
+            if (read_segment(server, wal_dir, files[i - 1], &wf))
+            {
+               reset_partial_record();
+            }
+            pgmoneta_destroy_walfile(wf);
+            wf = NULL;
+         }
+      }
+
+      have_last = false;
+
+      if (read_segment(server, wal_dir, files[i], &wf))
+      {
+         pgmoneta_log_warn("Summary: Could not read WAL segment %s for %s", files[i], config->common.servers[server].name);
+         continue;
+      }
+
+      if (pgmoneta_brt_create_empty(&brt))
+      {
+         goto error;
+      }
+
+      if (summarize_segment(server, wf, brt))
+      {
+         pgmoneta_log_error("Summary: Could not summarize WAL segment %s for %s", files[i], config->common.servers[server].name);
+         goto error;
+      }
+
+      snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", summary_path);
+
+      if (pgmoneta_brt_write(brt, tmp_path))
+      {
+         pgmoneta_log_error("Summary: Could not write %s", tmp_path);
+         goto error;
+      }
+
+      if (rename(tmp_path, summary_path))
+      {
+         pgmoneta_log_error("Summary: Could not rename %s: %s", tmp_path, strerror(errno));
+         goto error;
+      }
+
+      pgmoneta_brt_destroy(brt);
+      brt = NULL;
+
+      pgmoneta_destroy_walfile(wf);
+      wf = NULL;
+
+      have_last = true;
+      last_timeline = timeline;
+      last_segno = segno;
+      summarized++;
+   }
+
+   if (summarized > 0)
+   {
+      pgmoneta_log_debug("Summary: %d WAL segments for %s", summarized, config->common.servers[server].name);
+   }
+
+   if (own)
+   {
+      reset_partial_record();
+      free(partial_record);
+      partial_record = NULL;
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+   free(wal_dir);
+   free(summary_dir);
+
+   return 0;
+
+error:
+
+   if (own)
+   {
+      reset_partial_record();
+      free(partial_record);
+      partial_record = NULL;
+   }
+
+   pgmoneta_brt_destroy(brt);
+   pgmoneta_destroy_walfile(wf);
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+   free(wal_dir);
+   free(summary_dir);
+
+   return 1;
+}
+
+bool
+pgmoneta_summary_exists(int server, uint32_t timeline, uint64_t lsn)
+{
+   bool exists = false;
+   uint64_t start_lsn;
+   char* summary_dir = NULL;
+   char name[MISC_LENGTH];
+   char path[MAX_PATH];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->common.servers[server].wal_size <= 0)
+   {
+      return false;
+   }
+
+   start_lsn = lsn - (lsn % config->common.servers[server].wal_size);
+   summary_name(timeline, start_lsn, start_lsn + config->common.servers[server].wal_size, name, sizeof(name));
+
+   summary_dir = pgmoneta_get_server_summary(server);
+   snprintf(path, sizeof(path), "%s%s", summary_dir, name);
+
+   exists = pgmoneta_exists(path);
+
+   free(summary_dir);
+
+   return exists;
+}
+
+int
+pgmoneta_summarize_range(int server, uint32_t timeline, uint64_t start_lsn, uint64_t end_lsn, block_ref_table** brt)
+{
+   int number_of_files = 0;
+   uint64_t expected;
+   char* summary_dir = NULL;
+   char path[MAX_PATH];
+   struct summary_file* files = NULL;
+   block_ref_table* combined = NULL;
+   block_ref_table* b = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *brt = NULL;
+
+   if (config->common.servers[server].wal_size <= 0 || end_lsn < start_lsn)
+   {
+      goto error;
+   }
+
+   summary_dir = pgmoneta_get_server_summary(server);
+
+   if (get_summary_files(server, &number_of_files, &files))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_brt_create_empty(&combined))
+   {
+      goto error;
+   }
+
+   expected = start_lsn - (start_lsn % config->common.servers[server].wal_size);
+
+   for (int i = 0; i < number_of_files && expected <= end_lsn; i++)
+   {
+      if (files[i].timeline != timeline || files[i].end_lsn <= expected)
+      {
+         continue;
+      }
+
+      if (files[i].start_lsn != expected)
+      {
+         break;
+      }
+
+      snprintf(path, sizeof(path), "%s%s", summary_dir, files[i].name);
+
+      if (pgmoneta_brt_read(path, &b))
+      {
+         pgmoneta_log_error("Summary: Could not read %s", path);
+         goto error;
+      }
+
+      if (merge_summary(combined, b))
+      {
+         goto error;
+      }
+
+      pgmoneta_brt_destroy(b);
+      b = NULL;
+
+      expected = files[i].end_lsn;
+   }
+
+   if (expected <= end_lsn)
+   {
+      pgmoneta_log_debug("Summary: No summary for %" PRIX64 " on timeline %u for %s",
+                         expected, timeline, config->common.servers[server].name);
+      goto error;
+   }
+
+   *brt = combined;
+
+   free(files);
+   free(summary_dir);
+
+   return 0;
+
+error:
+
+   pgmoneta_brt_destroy(b);
+   pgmoneta_brt_destroy(combined);
+   free(files);
+   free(summary_dir);
+
+   return 1;
+}
+
+int
+pgmoneta_summary_delete_older_than(int server, char* wal)
+{
+   int number_of_files = 0;
+   uint32_t timeline = 0;
+   uint64_t segno = 0;
+   uint64_t limit = 0;
+   char* summary_dir = NULL;
+   char path[MAX_PATH];
+   struct summary_file* files = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (wal != NULL)
+   {
+      if (!parse_wal_name(server, wal, &timeline, &segno))
+      {
+         return 0;
+      }
+      limit = segno * config->common.servers[server].wal_size;
+   }
+
+   summary_dir = pgmoneta_get_server_summary(server);
+
+   if (!pgmoneta_exists(summary_dir))
+   {
+      free(summary_dir);
+      return 0;
+   }
+
+   if (get_summary_files(server, &number_of_files, &files))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      if (wal == NULL || files[i].end_lsn <= limit)
+      {
+         snprintf(path, sizeof(path), "%s%s", summary_dir, files[i].name);
+
+         pgmoneta_log_trace("Summary: Deleting %s", path);
+         pgmoneta_delete_file(path, NULL);
+      }
+   }
+
+   free(files);
+   free(summary_dir);
+
+   return 0;
+
+error:
+
+   free(files);
+   free(summary_dir);
+
+   return 1;
+}
+
+static bool
+parse_wal_name(int server, char* name, uint32_t* timeline, uint64_t* segno)
+{
+   uint32_t tli = 0;
+   uint32_t log = 0;
+   uint32_t seg = 0;
+   uint64_t segments_per_id;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (name == NULL || strlen(name) < 24 || (name[24] != '\0' && name[24] != '.'))
+   {
+      return false;
+   }
+
+   for (int i = 0; i < 24; i++)
+   {
+      if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'A' && name[i] <= 'F')))
+      {
+         return false;
+      }
+   }
+
+   if (config->common.servers[server].wal_size <= 0 ||
+       sscanf(name, "%08X%08X%08X", &tli, &log, &seg) != 3)
+   {
+      return false;
+   }
+
+   segments_per_id = 0x100000000ULL / (uint64_t)config->common.servers[server].wal_size;
+
+   *timeline = tli;
+   *segno = (uint64_t)log * segments_per_id + seg;
+
+   return true;
+}
+
+static bool
+parse_summary_name(char* name, struct summary_file* sf)
+{
+   uint32_t start_hi = 0;
+   uint32_t start_lo = 0;
+   uint32_t end_hi = 0;
+   uint32_t end_lo = 0;
+
+   if (strlen(name) != SUMMARY_NAME_LENGTH + strlen(SUMMARY_SUFFIX) || !pgmoneta_ends_with(name, SUMMARY_SUFFIX))
+   {
+      return false;
+   }
+
+   if (sscanf(name, "%08X%08X%08X%08X%08X", &sf->timeline, &start_hi, &start_lo, &end_hi, &end_lo) != 5)
+   {
+      return false;
+   }
+
+   sf->start_lsn = ((uint64_t)start_hi << 32) | start_lo;
+   sf->end_lsn = ((uint64_t)end_hi << 32) | end_lo;
+   snprintf(sf->name, sizeof(sf->name), "%s", name);
+
+   return true;
+}
+
+static void
+summary_name(uint32_t timeline, uint64_t start_lsn, uint64_t end_lsn, char* name, size_t size)
+{
+   snprintf(name, size, "%08X%08X%08X%08X%08X%s", timeline,
+            (uint32_t)(start_lsn >> 32), (uint32_t)start_lsn,
+            (uint32_t)(end_lsn >> 32), (uint32_t)end_lsn,
+            SUMMARY_SUFFIX);
+}
+
+static int
+get_summary_files(int server, int* number_of_files, struct summary_file** files)
+{
+   int nof = 0;
+   int capacity = 0;
+   char* summary_dir = NULL;
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct summary_file sf;
+   struct summary_file* array = NULL;
+   struct summary_file* tmp = NULL;
+
+   *number_of_files = 0;
+   *files = NULL;
+
+   summary_dir = pgmoneta_get_server_summary(server);
+
+   if (!(dir = opendir(summary_dir)))
+   {
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type != DT_REG || !parse_summary_name(entry->d_name, &sf))
+      {
+         continue;
+      }
+
+      if (nof == capacity)
+      {
+         capacity = capacity == 0 ? 64 : capacity * 2;
+         tmp = (struct summary_file*)realloc(array, capacity * sizeof(struct summary_file));
+         if (tmp == NULL)
+         {
+            goto error;
+         }
+         array = tmp;
+      }
+
+      array[nof++] = sf;
+   }
+
+   closedir(dir);
+   dir = NULL;
+
+   if (nof > 0)
+   {
+      qsort(array, nof, sizeof(struct summary_file), summary_compare);
+   }
+
+   *number_of_files = nof;
+   *files = array;
+
+   free(summary_dir);
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   free(array);
+   free(summary_dir);
+
+   return 1;
+}
+
+static int
+summary_compare(const void* a, const void* b)
+{
+   const struct summary_file* sa = (const struct summary_file*)a;
+   const struct summary_file* sb = (const struct summary_file*)b;
+
+   if (sa->start_lsn != sb->start_lsn)
+   {
+      return sa->start_lsn < sb->start_lsn ? -1 : 1;
+   }
+
+   if (sa->timeline != sb->timeline)
+   {
+      return sa->timeline < sb->timeline ? -1 : 1;
+   }
+
+   return 0;
+}
+
+static int
+read_segment(int server, char* wal_dir, char* file, struct walfile** wf)
+{
+   int ret = 1;
+   bool temporary = false;
+   char* from = NULL;
+   char* path = NULL;
+   char* to = NULL;
+   char* name = NULL;
+   char* stripped = NULL;
+   char* ws = NULL;
+
+   *wf = NULL;
+
+   from = pgmoneta_append(from, wal_dir);
+   from = pgmoneta_append(from, file);
+
+   if (!pgmoneta_is_encrypted(from) && !pgmoneta_is_compressed(from))
+   {
+      path = pgmoneta_append(path, from);
+   }
+   else
+   {
+      /* The decrypt and decompress functions remove their input, so work on a copy */
+      temporary = true;
+
+      ws = pgmoneta_get_server_workspace(server);
+      ws = pgmoneta_append(ws, "summary/");
+
+      if (!pgmoneta_exists(ws) && pgmoneta_mkdir(ws))
+      {
+         goto done;
+      }
+
+      name = pgmoneta_append(name, file);
+      path = pgmoneta_append(path, ws);
+      path = pgmoneta_append(path, name);
+
+      if (pgmoneta_copy_file(from, path, NULL))
+      {
+         goto done;
+      }
+
+      if (pgmoneta_is_encrypted(name))
+      {
+         pgmoneta_strip_extension(name, &stripped);
+         to = pgmoneta_append(NULL, ws);
+         to = pgmoneta_append(to, stripped);
+
+         if (pgmoneta_decrypt_file(path, to))
+         {
+            goto done;
+         }
+
+         if (pgmoneta_exists(path))
+         {
+            pgmoneta_delete_file(path, NULL);
+         }
+
+         free(path);
+         free(name);
+         path = to;
+         name = stripped;
+         to = NULL;
+         stripped = NULL;
+      }
+
+      if (pgmoneta_is_compressed(name))
+      {
+         pgmoneta_strip_extension(name, &stripped);
+         to = pgmoneta_append(NULL, ws);
+         to = pgmoneta_append(to, stripped);
+
+         if (pgmoneta_decompress(path, to))
+         {
+            goto done;
+         }
+
+         if (pgmoneta_exists(path))
+         {
+            pgmoneta_delete_file(path, NULL);
+         }
+
+         free(path);
+         free(name);
+         path = to;
+         name = stripped;
+         to = NULL;
+         stripped = NULL;
+      }
+   }
+
+   if (pgmoneta_read_walfile(server, path, wf) == PGMONETA_WAL_SUCCESS)
+   {
+      ret = 0;
+   }
+   else
+   {
+      *wf = NULL;
+   }
+
+done:
+
+   if (temporary)
+   {
+      if (path != NULL && pgmoneta_exists(path))
+      {
+         pgmoneta_delete_file(path, NULL);
+      }
+      if (to != NULL && pgmoneta_exists(to))
+      {
+         pgmoneta_delete_file(to, NULL);
+      }
+   }
+
+   free(from);
+   free(path);
+   free(to);
+   free(name);
+   free(stripped);
+   free(ws);
+
+   return ret;
+}
+
+static int
+summarize_segment(int server, struct walfile* wf, block_ref_table* brt)
+{
+   struct deque_iterator* iter = NULL;
+   struct decoded_xlog_record* record = NULL;
+   struct decoded_bkp_block* block = NULL;
+
+   if (pgmoneta_deque_iterator_create(wf->records, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      record = (struct decoded_xlog_record*)iter->value->data;
+
+      if (record == NULL || record->partial)
+      {
+         continue;
+      }
+
+      /* Relation forks that are created, truncated or dropped get a limit block */
+      if (record->header.xl_rmid == SUMMARY_RM_SMGR_ID)
+      {
+         if (summarize_smgr(server, record, brt))
+         {
+            goto error;
+         }
+      }
+      else if (record->header.xl_rmid == SUMMARY_RM_XACT_ID)
+      {
+         if (summarize_xact(record, brt))
+         {
+            goto error;
+         }
+      }
+      else if (record->header.xl_rmid == SUMMARY_RM_DBASE_ID)
+      {
+         if (summarize_dbase(server, record, brt))
+         {
+            goto error;
+         }
+      }
+
+      /* The free space map isn't WAL-logged reliably, so it is always copied in full */
+      for (int block_id = 0; block_id <= record->max_block_id; block_id++)
+      {
+         block = &record->blocks[block_id];
+
+         if (!block->in_use || block->forknum == FSM_FORKNUM)
+         {
+            continue;
+         }
+
+         if (pgmoneta_brt_mark_block_modified(brt, &block->rlocator, block->forknum, block->blkno))
+         {
+            goto error;
+         }
+      }
+   }
+
+   pgmoneta_deque_iterator_destroy(iter);
+
+   return 0;
+
+error:
+
+   pgmoneta_deque_iterator_destroy(iter);
+
+   return 1;
+}
+
+static int
+summarize_smgr(int server, struct decoded_xlog_record* record, block_ref_table* brt)
+{
+   uint8_t info = XLOG_REC_GET_INFO(record) & ~XLR_INFO_MASK;
+
+   if (info == XLOG_SMGR_CREATE)
+   {
+      struct xl_smgr_create* xlrec = (struct xl_smgr_create*)XLOG_REC_GET_DATA(record);
+
+      return set_limit_block(brt, xlrec->rnode.spcNode, xlrec->rnode.dbNode, xlrec->rnode.relNode,
+                             xlrec->forkNum, 0);
+   }
+   else if (info == XLOG_SMGR_TRUNCATE)
+   {
+      struct xl_smgr_truncate* xlrec = (struct xl_smgr_truncate*)XLOG_REC_GET_DATA(record);
+
+      if ((xlrec->flags & SMGR_TRUNCATE_HEAP) != 0)
+      {
+         if (set_limit_block(brt, xlrec->rnode.spcNode, xlrec->rnode.dbNode, xlrec->rnode.relNode,
+                             MAIN_FORKNUM, xlrec->blkno))
+         {
+            return 1;
+         }
+      }
+
+      if ((xlrec->flags & SMGR_TRUNCATE_VM) != 0)
+      {
+         if (set_limit_block(brt, xlrec->rnode.spcNode, xlrec->rnode.dbNode, xlrec->rnode.relNode,
+                             VISIBILITYMAP_FORKNUM, visibilitymap_truncation_length(server, xlrec->blkno)))
+         {
+            return 1;
+         }
+      }
+   }
+
+   return 0;
+}
+
+static int
+summarize_xact(struct decoded_xlog_record* record, block_ref_table* brt)
+{
+   int nrels = 0;
+   struct rel_file_node* xnodes = NULL;
+
+   pgmoneta_wal_xact_dropped_relations(record, &nrels, &xnodes);
+
+   for (int i = 0; i < nrels; i++)
+   {
+      for (int forknum = MAIN_FORKNUM; forknum <= INIT_FORKNUM; forknum++)
+      {
+         if (set_limit_block(brt, xnodes[i].spcNode, xnodes[i].dbNode, xnodes[i].relNode,
+                             (enum fork_number)forknum, 0))
+         {
+            return 1;
+         }
+      }
+   }
+
+   return 0;
+}
+
+static int
+summarize_dbase(int server, struct decoded_xlog_record* record, block_ref_table* brt)
+{
+   uint8_t info = XLOG_REC_GET_INFO(record) & ~XLR_INFO_MASK;
+   char* rec = XLOG_REC_GET_DATA(record);
+   struct xl_dbase_drop_rec* drop = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* Relation number 0 stands for the whole database */
+   if (config->common.servers[server].version >= 17)
+   {
+      if (info == XLOG_DBASE_CREATE_FILE_COPY)
+      {
+         struct xl_dbase_create_file_copy_rec* xlrec = (struct xl_dbase_create_file_copy_rec*)rec;
+
+         return set_limit_block(brt, xlrec->tablespace_id, xlrec->db_id, 0, MAIN_FORKNUM, 0);
+      }
+      else if (info == XLOG_DBASE_CREATE_WAL_LOG)
+      {
+         struct xl_dbase_create_wal_log_rec* xlrec = (struct xl_dbase_create_wal_log_rec*)rec;
+
+         return set_limit_block(brt, xlrec->tablespace_id, xlrec->db_id, 0, MAIN_FORKNUM, 0);
+      }
+      else if (info == XLOG_DBASE_DROP_V17)
+      {
+         drop = (struct xl_dbase_drop_rec*)rec;
+      }
+   }
+   else
+   {
+      if (info == XLOG_DBASE_CREATE)
+      {
+         struct xl_dbase_create_rec* xlrec = (struct xl_dbase_create_rec*)rec;
+
+         return set_limit_block(brt, xlrec->tablespace_id, xlrec->db_id, 0, MAIN_FORKNUM, 0);
+      }
+      else if (info == XLOG_DBASE_DROP)
+      {
+         drop = (struct xl_dbase_drop_rec*)rec;
+      }
+   }
+
+   if (drop != NULL)
+   {
+      for (int i = 0; i < drop->ntablespaces; i++)
+      {
+         if (set_limit_block(brt, drop->tablespace_ids[i], drop->db_id, 0, MAIN_FORKNUM, 0))
+         {
+            return 1;
+         }
+      }
+   }
+
+   return 0;
+}
+
+static int
+set_limit_block(block_ref_table* brt, oid spc, oid db, oid rel, enum fork_number forknum, block_number limit)
+{
+   struct rel_file_locator rlocator;
+
+   memset(&rlocator, 0, sizeof(struct rel_file_locator));
+   rlocator.spcOid = spc;
+   rlocator.dbOid = db;
+   rlocator.relNumber = rel;
+
+   return pgmoneta_brt_set_limit_block(brt, &rlocator, forknum, limit);
+}
+
+static block_number
+visibilitymap_truncation_length(int server, block_number nheapblocks)
+{
+   uint64_t heapblocks_per_page;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* Each visibility map page holds two bits for each heap block */
+   heapblocks_per_page = (config->common.servers[server].block_size - SUMMARY_PAGE_HEADER_SIZE) * 4;
+
+   if (heapblocks_per_page == 0)
+   {
+      return 0;
+   }
+
+   return nheapblocks / heapblocks_per_page + (nheapblocks % heapblocks_per_page != 0 ? 1 : 0);
+}
+
+static int
+merge_summary(block_ref_table* to, block_ref_table* from)
+{
+   int n;
+   int ret;
+   uint64_t stop;
+   block_number* blocks = NULL;
+   block_ref_table_entry* entry = NULL;
+   struct art_iterator* iter = NULL;
+
+   blocks = (block_number*)malloc(BLOCKS_PER_CHUNK * sizeof(block_number));
+   if (blocks == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_iterator_create(from->table, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_art_iterator_next(iter))
+   {
+      entry = (block_ref_table_entry*)iter->value->data;
+
+      /* The limit applies to the blocks summarized so far, the blocks of this summary come after it */
+      if (entry->limit_block != InvalidBlockNumber)
+      {
+         if (pgmoneta_brt_set_limit_block(to, &entry->key.rlocator, entry->key.forknum, entry->limit_block))
+         {
+            goto error;
+         }
+      }
+
+      for (uint32_t chunkno = 0; chunkno < entry->nchunks; chunkno++)
+      {
+         n = 0;
+         stop = (uint64_t)(chunkno + 1) * BLOCKS_PER_CHUNK;
+         if (stop > InvalidBlockNumber)
+         {
+            stop = InvalidBlockNumber;
+         }
+
+         ret = pgmoneta_brt_entry_get_blocks(entry, chunkno * BLOCKS_PER_CHUNK, (block_number)stop,
+                                             blocks, BLOCKS_PER_CHUNK, &n);
+         if (ret != 0)
+         {
+            /* The whole chunk was modified */
+            n = ret;
+         }
+
+         for (int i = 0; i < n; i++)
+         {
+            if (pgmoneta_brt_mark_block_modified(to, &entry->key.rlocator, entry->key.forknum, blocks[i]))
+            {
+               goto error;
+            }
+         }
+      }
+   }
+
+   pgmoneta_art_iterator_destroy(iter);
+   free(blocks);
+
+   return 0;
+
+error:
+
+   pgmoneta_art_iterator_destroy(iter);
+   free(blocks);
+
+   return 1;
+}
+
+static void
+reset_partial_record(void)
+{
+   if (partial_record == NULL)
+   {
+      return;
+   }
+
+   free(partial_record->xlog_record);
+   free(partial_record->data_buffer);
+   memset(partial_record, 0, sizeof(struct partial_xlog_record));
+}
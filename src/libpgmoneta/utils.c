@@ -31,6 +31,7 @@
 #include <logging.h>
 #include <utils.h>
 #include <info.h>
+#include <walindex.h>
 
 /* system */
 #include <dirent.h>
@@ -1646,14 +1647,45 @@ pgmoneta_get_wal_files(char* base, int* number_of_files, char*** files)
    char** array = NULL;
    int nof = 0;
    int n;
-   DIR* dir;
+   DIR* dir = NULL;
    struct dirent* entry;
+   struct wal_index* index = NULL;
 
    *number_of_files = 0;
    *files = NULL;
 
    nof = 0;
 
+   // an indexed directory is listed in order without reading it
+   if (!pgmoneta_wal_index_load(base, &index))
+   {
+      array = (char**)malloc(sizeof(char*) * (index->number_of_entries + 1));
+      if (array == NULL)
+      {
+         goto error;
+      }
+
+      for (int i = 0; i < index->number_of_entries; i++)
+      {
+         if (!index->entries[i].partial)
+         {
+            array[nof] = pgmoneta_wal_index_name(index, i);
+            if (array[nof] == NULL)
+            {
+               goto error;
+            }
+            nof++;
+         }
+      }
+
+      pgmoneta_wal_index_destroy(index);
+
+      *number_of_files = nof;
+      *files = array;
+
+      return 0;
+   }
+
    if (!(dir = opendir(base)))
    {
       goto error;
@@ -1721,6 +1753,8 @@ pgmoneta_get_wal_files(char* base, int* number_of_files, char*** files)
 
 error:
 
+   pgmoneta_wal_index_destroy(index);
+
    if (dir != NULL)
    {
       closedir(dir);
@@ -1919,6 +1953,44 @@ get_permissions(char* from, int* permissions)
    return 0;
 }
 
+bool
+pgmoneta_is_zero(void* data, size_t size)
+{
+   unsigned char* p = (unsigned char*)data;
+   uint64_t words[8];
+   uint64_t acc;
+
+   /* OR eight words at a time so the compiler can vectorize the loop */
+   while (size >= sizeof(words))
+   {
+      memcpy(&words[0], p, sizeof(words));
+
+      acc = words[0] | words[1] | words[2] | words[3] |
+            words[4] | words[5] | words[6] | words[7];
+
+      if (acc != 0)
+      {
+         return false;
+      }
+
+      p += sizeof(words);
+      size -= sizeof(words);
+   }
+
+   while (size > 0)
+   {
+      if (*p != 0)
+      {
+         return false;
+      }
+
+      p++;
+      size--;
+   }
+
+   return true;
+}
+
 int
 pgmoneta_copy_file(char* from, char* to, struct workers* workers)
 {
@@ -1954,8 +2026,10 @@ do_copy_file(struct worker_common* wc)
    struct worker_input* fi = (struct worker_input*)wc;
    int fd_from = -1;
    int fd_to = -1;
-   char buffer[8192];
+   char buffer[SPARSE_BLOCK_SIZE];
    ssize_t nread = -1;
+   off_t offset = 0;
+   bool hole = false;
    int permissions = -1;
    char* dn = NULL;
    char* to = NULL;
@@ -1996,6 +2070,20 @@ do_copy_file(struct worker_common* wc)
       char* out = &buffer[0];
       ssize_t nwritten;
 
+      offset += nread;
+
+      if (nread == sizeof(buffer) && pgmoneta_is_zero(buffer, sizeof(buffer)))
+      {
+         if (lseek(fd_to, nread, SEEK_CUR) == -1)
+         {
+            goto error;
+         }
+         hole = true;
+         continue;
+      }
+
+      hole = false;
+
       do
       {
          nwritten = write(fd_to, out, nread);
@@ -2015,6 +2103,12 @@ do_copy_file(struct worker_common* wc)
 
    if (nread == 0)
    {
+      /* A hole at the end doesn't extend the file by itself */
+      if (hole && ftruncate(fd_to, offset))
+      {
+         goto error;
+      }
+
       fsync(fd_to);
 
       if (close(fd_to) < 0)
@@ -2447,79 +2541,180 @@ error:
 }
 
 int
-pgmoneta_copy_wal_files(char* from, char* to, char* start, struct workers* workers)
+pgmoneta_get_wal_range(char* directory, char* start, int* number_of_files, char*** files)
 {
-   int number_of_wal_files = 0;
-   char** wal_files = NULL;
+   int nof = 0;
+   int number_of_all = 0;
+   uint32_t timeline = 0;
+   uint32_t last = 0;
+   char** all = NULL;
+   char** array = NULL;
    char* basename = NULL;
-   char* ff = NULL;
-   char* tf = NULL;
+   char history[MISC_LENGTH];
+   char path[MAX_PATH * 2];
+   struct wal_index* index = NULL;
 
-   pgmoneta_get_files(from, &number_of_wal_files, &wal_files);
+   *number_of_files = 0;
+   *files = NULL;
 
-   for (int i = 0; i < number_of_wal_files; i++)
+   if (!pgmoneta_wal_index_load(directory, &index))
    {
-      if (pgmoneta_is_encrypted(wal_files[i]))
+      // room for the segments and the history files of the later timelines
+      if (start != NULL && sscanf(start, "%08X", &timeline) == 1 && index->number_of_entries > 0)
       {
-         if (pgmoneta_strip_extension(wal_files[i], &basename))
-         {
-            goto error;
-         }
+         last = index->entries[index->number_of_entries - 1].timeline;
       }
-      else
+
+      array = (char**)malloc(sizeof(char*) * (index->number_of_entries + (last > timeline ? last - timeline : 0) + 1));
+      if (array == NULL)
       {
-         basename = pgmoneta_append(basename, wal_files[i]);
+         goto error;
       }
 
-      if (pgmoneta_is_compressed(basename))
+      // the history files come first, recovery needs them to follow a timeline
+      for (uint32_t tli = timeline + 1; tli <= last; tli++)
       {
-         char* bn = basename;
-         basename = NULL;
-         if (pgmoneta_strip_extension(bn, &basename))
+         snprintf(history, sizeof(history), "%08X.history", tli);
+         snprintf(path, sizeof(path), "%s%s%s", directory, pgmoneta_ends_with(directory, "/") ? "" : "/", history);
+
+         if (pgmoneta_exists(path))
          {
-            goto error;
+            array[nof++] = pgmoneta_append(NULL, history);
          }
-         free(bn);
       }
 
-      if (strcmp(basename, start) >= 0)
+      for (int i = pgmoneta_wal_index_search(index, start); i < index->number_of_entries; i++)
       {
-         if (pgmoneta_ends_with(basename, ".partial"))
+         array[nof] = pgmoneta_wal_index_file(index, i);
+         if (array[nof] == NULL)
          {
-            ff = pgmoneta_append(ff, from);
-            if (!pgmoneta_ends_with(ff, "/"))
-            {
-               ff = pgmoneta_append(ff, "/");
-            }
-            ff = pgmoneta_append(ff, wal_files[i]);
+            pgmoneta_log_debug("%s segment %08X%08X%08X doesn't exists", directory,
+                               index->entries[i].timeline, index->entries[i].log, index->entries[i].seg);
+            continue;
+         }
+         nof++;
+      }
 
-            tf = pgmoneta_append(tf, to);
-            if (!pgmoneta_ends_with(tf, "/"))
+      pgmoneta_wal_index_destroy(index);
+      index = NULL;
+   }
+   else
+   {
+      if (pgmoneta_get_files(directory, &number_of_all, &all))
+      {
+         goto error;
+      }
+
+      array = (char**)malloc(sizeof(char*) * (number_of_all + 1));
+      if (array == NULL)
+      {
+         goto error;
+      }
+
+      // the history files first, then the segments in order
+      for (int pass = 0; pass < 2; pass++)
+      {
+         for (int i = 0; i < number_of_all; i++)
+         {
+            if (all[i] == NULL)
             {
-               tf = pgmoneta_append(tf, "/");
+               continue;
             }
-            tf = pgmoneta_append(tf, basename);
-         }
-         else
-         {
-            ff = pgmoneta_append(ff, from);
-            if (!pgmoneta_ends_with(ff, "/"))
+
+            if (pgmoneta_strip_wal_extensions(all[i], &basename))
             {
-               ff = pgmoneta_append(ff, "/");
+               goto error;
             }
-            ff = pgmoneta_append(ff, wal_files[i]);
 
-            tf = pgmoneta_append(tf, to);
-            if (!pgmoneta_ends_with(tf, "/"))
+            if (pgmoneta_ends_with(basename, ".history") == (pass == 0) &&
+                (start == NULL || strcmp(basename, start) >= 0))
             {
-               tf = pgmoneta_append(tf, "/");
+               array[nof++] = all[i];
+               all[i] = NULL;
             }
-            tf = pgmoneta_append(tf, wal_files[i]);
+
+            free(basename);
+            basename = NULL;
          }
+      }
+
+      for (int i = 0; i < number_of_all; i++)
+      {
+         free(all[i]);
+      }
+      free(all);
+   }
+
+   *number_of_files = nof;
+   *files = array;
+
+   return 0;
+
+error:
+   pgmoneta_wal_index_destroy(index);
+
+   for (int i = 0; i < number_of_all; i++)
+   {
+      free(all[i]);
+   }
+   free(all);
+
+   for (int i = 0; i < nof; i++)
+   {
+      free(array[i]);
+   }
+   free(array);
+   free(basename);
+
+   return 1;
+}
+
+int
+pgmoneta_copy_wal_files(char* from, char* to, char* start, struct workers* workers)
+{
+   int number_of_wal_files = 0;
+   char** wal_files = NULL;
+   char* basename = NULL;
+   char* ff = NULL;
+   char* tf = NULL;
+
+   if (pgmoneta_get_wal_range(from, start, &number_of_wal_files, &wal_files))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_wal_files; i++)
+   {
+      ff = pgmoneta_append(ff, from);
+      if (!pgmoneta_ends_with(ff, "/"))
+      {
+         ff = pgmoneta_append(ff, "/");
+      }
+      ff = pgmoneta_append(ff, wal_files[i]);
+
+      tf = pgmoneta_append(tf, to);
+      if (!pgmoneta_ends_with(tf, "/"))
+      {
+         tf = pgmoneta_append(tf, "/");
+      }
 
-         pgmoneta_copy_file(ff, tf, workers);
+      if (pgmoneta_strip_wal_extensions(wal_files[i], &basename))
+      {
+         goto error;
       }
 
+      // the segment being received is copied under its plain name
+      if (pgmoneta_ends_with(basename, ".partial"))
+      {
+         tf = pgmoneta_append(tf, basename);
+      }
+      else
+      {
+         tf = pgmoneta_append(tf, wal_files[i]);
+      }
+
+      pgmoneta_copy_file(ff, tf, workers);
+
       free(basename);
       free(ff);
       free(tf);
@@ -2544,6 +2739,50 @@ error:
       free(wal_files[i]);
    }
    free(wal_files);
+   free(basename);
+   free(ff);
+   free(tf);
+
+   return 1;
+}
+
+int
+pgmoneta_strip_wal_extensions(char* file, char** name)
+{
+   char* basename = NULL;
+
+   *name = NULL;
+
+   if (pgmoneta_is_encrypted(file))
+   {
+      if (pgmoneta_strip_extension(file, &basename))
+      {
+         goto error;
+      }
+   }
+   else
+   {
+      basename = pgmoneta_append(basename, file);
+   }
+
+   if (pgmoneta_is_compressed(basename))
+   {
+      char* bn = basename;
+      basename = NULL;
+      if (pgmoneta_strip_extension(bn, &basename))
+      {
+         free(bn);
+         goto error;
+      }
+      free(bn);
+   }
+
+   *name = basename;
+
+   return 0;
+
+error:
+   free(basename);
 
    return 1;
 }
@@ -2555,9 +2794,18 @@ pgmoneta_number_of_wal_files(char* directory, char* from, char* to)
    int number_of_wal_files = 0;
    char** wal_files = NULL;
    char* basename = NULL;
+   struct wal_index* index = NULL;
 
    result = 0;
 
+   if (!pgmoneta_wal_index_load(directory, &index))
+   {
+      result = (to == NULL ? index->number_of_entries : pgmoneta_wal_index_search(index, to)) -
+               pgmoneta_wal_index_search(index, from);
+      pgmoneta_wal_index_destroy(index);
+      return MAX(result, 0);
+   }
+
    pgmoneta_get_files(directory, &number_of_wal_files, &wal_files);
 
    for (int i = 0; i < number_of_wal_files; i++)
@@ -3099,6 +3347,61 @@ pgmoneta_get_server_wal(int server)
    return d;
 }
 
+char*
+pgmoneta_get_server_summary(int server)
+{
+   char* d = NULL;
+
+   d = get_server_basepath(server);
+   d = pgmoneta_append(d, "summary/");
+
+   return d;
+}
+
+char*
+pgmoneta_get_server_partial(int server)
+{
+   char* d = NULL;
+
+   d = get_server_basepath(server);
+   d = pgmoneta_append(d, "partial/");
+
+   return d;
+}
+
+char*
+pgmoneta_get_server_dictionary(int server)
+{
+   char* d = NULL;
+
+   d = get_server_basepath(server);
+   d = pgmoneta_append(d, "dictionary/");
+
+   return d;
+}
+
+char*
+pgmoneta_get_server_wal_pool(int server)
+{
+   char* d = NULL;
+
+   d = get_server_basepath(server);
+   d = pgmoneta_append(d, "wal_pool/");
+
+   return d;
+}
+
+char*
+pgmoneta_get_server_wal_prefetch(int server)
+{
+   char* d = NULL;
+
+   d = get_server_basepath(server);
+   d = pgmoneta_append(d, "wal_prefetch/");
+
+   return d;
+}
+
 char*
 pgmoneta_get_server_wal_shipping(int server)
 {
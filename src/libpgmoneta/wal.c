@@ -28,6 +28,10 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <aes.h>
+#include <async_io.h>
+#include <codec.h>
+#include <dictionary.h>
 #include <logging.h>
 #include <network.h>
 #include <security.h>
@@ -35,6 +39,9 @@
 #include <storage.h>
 #include <utils.h>
 #include <wal.h>
+#include <walfile.h>
+#include <walindex.h>
+#include <workers.h>
 
 /* system */
 #include <ctype.h>
@@ -42,88 +49,595 @@
 #include <err.h>
 #include <errno.h>
 #include <ev.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include <libssh/libssh.h>
 #include <libssh/sftp.h>
+#include <openssl/err.h>
 #include <openssl/ssl.h>
 
+/** @struct wal_archive_input
+ * Defines a completed segment handed to the archiver thread
+ */
+struct wal_archive_input
+{
+   struct worker_common common;   /**< The worker common */
+   int server;                    /**< The server */
+   char directory[MAX_PATH];      /**< The WAL directory */
+   char filename[MISC_LENGTH];    /**< The segment */
+   struct wal_pool* pool;         /**< The pool the segment is recycled into, or NULL */
+};
+
+/** @struct wal_pool
+ * Defines the preallocated segments of a WAL directory. A filler thread
+ * keeps WAL_POOL_SEGMENTS files of the segment size ready, so a segment
+ * switch is a rename instead of a zero-fill
+ */
+struct wal_pool
+{
+   char directory[MAX_PATH]; /**< The pool directory */
+   int segsize;              /**< The segment size */
+   int ready;                /**< The number of segments ready or being prepared */
+   int recycled;             /**< The number of recycled segments waiting to be zeroed */
+   uint64_t next;            /**< The sequence number of the next pool file */
+   bool running;             /**< Is the filler running */
+   bool failed;              /**< Has the filler failed */
+   bool started;             /**< Has the filler been started */
+   pthread_t thread;         /**< The filler thread */
+   pthread_mutex_t lock;     /**< The lock */
+   pthread_cond_t wake;      /**< Signaled when a segment is taken */
+};
+
+#define WAL_TARGET_OPEN  0
+#define WAL_TARGET_DATA  1
+#define WAL_TARGET_CLOSE 2
+
+/** @struct wal_target_op
+ * Defines an operation queued for a WAL target
+ */
+struct wal_target_op
+{
+   int type;                    /**< The operation */
+   char filename[MISC_LENGTH];  /**< The segment */
+   bool partial;                /**< Is the closed segment incomplete */
+   char* data;                  /**< The data */
+   size_t size;                 /**< The size of the data */
+   struct wal_target_op* next;  /**< The next operation */
+};
+
+/** @struct wal_target
+ * Defines a copy of the WAL stream, written by its own thread from a
+ * bounded queue so a slow target doesn't hold up the local segment
+ */
+struct wal_target
+{
+   int server;                  /**< The server */
+   int kind;                    /**< The target, one of the WAL_TARGET_* kinds */
+   int segsize;                 /**< The segment size */
+   char* root;                  /**< The WAL shipping directory */
+   struct async_io* io;         /**< The I/O context of the WAL shipping directory */
+   struct async_file* file;     /**< The segment in the WAL shipping directory */
+   sftp_file sftp;              /**< The segment on the SSH storage engine */
+   char filename[MISC_LENGTH];  /**< The open segment */
+   bool failed;                 /**< Did a write to the open segment fail */
+   pthread_t thread;            /**< The writer thread */
+   bool started;                /**< Is the writer thread started */
+   pthread_mutex_t lock;        /**< The lock */
+   pthread_cond_t not_empty;    /**< Signaled when an operation is queued */
+   pthread_cond_t not_full;     /**< Signaled when an operation is done */
+   struct wal_target_op* head;  /**< The next operation */
+   struct wal_target_op* tail;  /**< The last operation */
+   size_t queued;               /**< The number of bytes queued */
+   bool done;                   /**< No more operations will be queued */
+};
+
+/** @struct wal_flush_state
+ * Defines how far the received WAL has been flushed and reported
+ */
+struct wal_flush_state
+{
+   size_t received;        /**< The end of the received WAL */
+   size_t flushed;         /**< The end of the WAL on stable storage */
+   size_t reported;        /**< The flushed position last reported to the server */
+   struct timespec since;  /**< The time of the last flush */
+};
+
+#define WAL_STREAM_OK    0
+#define WAL_STREAM_ERROR 1
+#define WAL_STREAM_DONE  2
+
+#define WAL_RECEIVE_SIZE 65536
+#define WAL_RECEIVER_RETRY 60
+
+/** @struct wal_stream
+ * Defines the replication connection of a server and the segment it is writing
+ */
+struct wal_stream
+{
+   int server;                      /**< The server */
+   SSL* ssl;                        /**< The SSL structure */
+   int socket;                      /**< The socket */
+   char* directory;                 /**< The WAL directory */
+   char* wal_shipping;              /**< The WAL shipping directory */
+   char* pool_directory;            /**< The pool directory */
+   size_t segsize;                  /**< The segment size */
+   uint32_t timeline;               /**< The timeline being streamed */
+   uint32_t high32;                 /**< The high part of the start position */
+   uint32_t low32;                  /**< The low part of the start position */
+   size_t xlogptr;                  /**< The end of the written WAL */
+   size_t curr_xlogoff;             /**< The offset in the open segment */
+   char* filename;                  /**< The open segment */
+   struct async_io* io;             /**< The I/O context of the WAL directory */
+   struct async_file* wal_file;     /**< The open segment file */
+   struct wal_target* shipping;     /**< The WAL shipping copy */
+   struct wal_target* remote;       /**< The SSH storage engine copy */
+   struct wal_pool* pool;           /**< The preallocated segments */
+   struct workers* archiver;        /**< The archiver of completed segments */
+   struct stream_buffer* buffer;    /**< The receive buffer */
+   struct message* msg;             /**< The message being handled */
+   struct workflow* workflow;       /**< The storage workflow */
+   struct art* nodes;               /**< The workflow nodes */
+   struct wal_flush_state flush;    /**< The flush state */
+   struct ev_io watcher;            /**< The socket watcher of the receiver */
+};
+
+/** @struct wal_receiver
+ * Defines the streams multiplexed by a receiver process
+ */
+struct wal_receiver
+{
+   int number;                                      /**< The number of the receiver */
+   int number_of_streams;                           /**< The number of streams */
+   int servers[NUMBER_OF_SERVERS];                  /**< The servers of the receiver */
+   struct wal_stream* streams[NUMBER_OF_SERVERS];   /**< The streams, NULL once stopped */
+   struct wal_stream* connected[NUMBER_OF_SERVERS]; /**< The streams set up by the connect threads */
+   bool connecting[NUMBER_OF_SERVERS];              /**< Is a connect thread running */
+   bool done[NUMBER_OF_SERVERS];                    /**< Is the connect thread done */
+   pthread_t threads[NUMBER_OF_SERVERS];            /**< The connect threads */
+   pthread_mutex_t lock;                            /**< The lock of the connect results */
+   pthread_mutex_t protocol;                        /**< The lock of the blocking protocol exchanges */
+   struct ev_loop* loop;                            /**< The loop */
+   struct ev_async async;                           /**< Signaled when a connect thread is done */
+   time_t retry;                                    /**< The time of the last restart of the stopped streams */
+};
+
+/** @struct wal_connect
+ * Defines the stream a connect thread sets up
+ */
+struct wal_connect
+{
+   struct wal_receiver* receiver; /**< The receiver */
+   int index;                     /**< The index of the stream */
+};
+
 int mappings_size = 0;
 oid_mapping* oidMappings = NULL;
 bool enable_translation = false;
 
 static char* wal_file_name(uint32_t timeline, size_t segno, int segsize);
 static int wal_fetch_history(char* basedir, int timeline, SSL* ssl, int socket);
-static FILE* wal_open(char* root, char* filename, int segsize);
-static int wal_close(char* root, char* filename, bool partial, FILE* file);
-static int wal_prepare(FILE* file, int segsize);
+static struct async_file* wal_open(struct async_io* io, char* root, char* filename, int segsize, struct wal_pool* pool);
+static int wal_close(char* root, char* filename, bool partial, struct async_file* file);
+static int wal_prepare(struct async_file* file, int segsize);
 static int wal_send_status_report(SSL* ssl, int socket, int64_t received, int64_t flushed, int64_t applied);
+static int wal_flush(SSL* ssl, int socket, struct stream_buffer* buffer, struct async_file* file, bool force, struct wal_flush_state* state);
+static int wal_report(SSL* ssl, int socket, bool force, struct wal_flush_state* state);
+static bool wal_stream_idle(SSL* ssl, int socket, struct stream_buffer* buffer);
+static int wal_flush_remaining(struct async_file* file, struct wal_flush_state* state);
+static int wal_stream_flush_due(struct wal_stream* stream);
+static int wal_stream_wait(struct wal_stream* stream);
+static void wal_clock(struct timespec* t);
 static int wal_xlog_offset(size_t xlogptr, int segsize);
 static int wal_convert_xlogpos(char* xlogpos, int segsize, uint32_t* high32, uint32_t* low32);
 static int wal_find_streaming_start(char* basedir, int segsize, uint32_t* timeline, uint32_t* high32, uint32_t* low32);
 static int wal_read_replication_slot(SSL* ssl, int socket, char* slot, char* name, int segsize, uint32_t* high32, uint32_t* low32, uint32_t* timeline);
 static int wal_shipping_setup(int srv, char** wal_shipping);
 static void update_wal_lsn(int srv, size_t xlogptr);
+static int wal_read_long_header(int fd, struct xlog_long_page_header_data* header);
+static void wal_archive(struct workers* archiver, struct wal_pool* pool, int srv, char* root, char* filename);
+static void do_wal_archive(struct worker_common* wc);
+static int wal_archive_segment(int srv, char* directory, char* filename, struct wal_pool* pool);
+static int wal_pool_create(char* directory, int segsize, struct wal_pool** pool);
+static int wal_pool_take(struct wal_pool* pool, char* path);
+static int wal_pool_recycle(struct wal_pool* pool, char* path);
+static void wal_pool_destroy(struct wal_pool* pool);
+static void* wal_pool_run(void* arg);
+static int wal_pool_fill(struct wal_pool* pool, uint64_t sequence);
+static int wal_pool_allocate(int fd, off_t from, int segsize);
+static int wal_pool_clean(struct wal_pool* pool);
+static int wal_pool_zero(int fd, off_t from, off_t to);
+static int wal_target_create(int srv, int kind, char* root, int segsize, struct wal_target** target);
+static void wal_target_open(struct wal_target* target, char* filename);
+static void wal_target_write(struct wal_target* target, void* data, size_t size);
+static void wal_target_close(struct wal_target* target, char* filename, bool partial);
+static void wal_target_destroy(struct wal_target* target);
+static void wal_target_push(struct wal_target* target, int type, char* filename, bool partial, void* data, size_t size);
+static void* wal_target_run(void* arg);
+static void wal_target_apply(struct wal_target* target, struct wal_target_op* op);
+static int wal_stream_create(int srv, struct wal_stream** stream);
+static int wal_stream_start(struct wal_stream* stream);
+static int wal_stream_message(struct wal_stream* stream, struct message* msg);
+static int wal_stream_next_timeline(struct wal_stream* stream);
+static void wal_stream_destroy(struct wal_stream* stream, bool failed);
+static int wal_stream_receive(struct wal_stream* stream);
+static int wal_receiver_add(struct wal_receiver* receiver, int index);
+static void* wal_receiver_connect(void* arg);
+static void wal_receiver_assign(struct wal_receiver* receiver);
+static int wal_receiver_process(struct ev_loop* loop, struct wal_stream* stream);
+static void wal_receiver_remove(struct ev_loop* loop, struct wal_stream* stream, bool failed);
+static bool wal_receiver_active(struct wal_receiver* receiver);
+static void wal_receiver_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void wal_receiver_async_cb(struct ev_loop* loop, struct ev_async* watcher, int revents);
+static void wal_receiver_timer_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
+static void wal_receiver_flush_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
 
 void
 pgmoneta_wal(int srv, char** argv)
+{
+   int status;
+   int ret = WAL_STREAM_OK;
+   struct wal_stream* stream = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   pgmoneta_start_logging();
+   pgmoneta_memory_init();
+
+   pgmoneta_set_proc_title(1, argv, "wal", config->common.servers[srv].name);
+
+   if (wal_stream_create(srv, &stream))
+   {
+      goto error;
+   }
+
+   while (config->running && config->common.servers[srv].online)
+   {
+      if (wal_stream_start(stream))
+      {
+         goto error;
+      }
+
+      // start streaming current timeline's WAL segments
+      ret = WAL_STREAM_OK;
+      while (ret == WAL_STREAM_OK && config->running && config->common.servers[srv].online)
+      {
+         if (wal_stream_wait(stream))
+         {
+            goto error;
+         }
+
+         status = pgmoneta_consume_copy_stream_start(stream->ssl, stream->socket, stream->buffer, stream->msg, NULL);
+         if (status == 0)
+         {
+            break;
+         }
+         if (status != MESSAGE_STATUS_OK)
+         {
+            goto error;
+         }
+
+         ret = wal_stream_message(stream, stream->msg);
+         pgmoneta_consume_copy_stream_end(stream->buffer, stream->msg);
+      }
+
+      if (ret == WAL_STREAM_ERROR)
+      {
+         goto error;
+      }
+
+      if (!config->running)
+      {
+         break;
+      }
+
+      if (wal_stream_next_timeline(stream))
+      {
+         goto error;
+      }
+   }
+
+   wal_stream_destroy(stream, false);
+
+   pgmoneta_memory_destroy();
+   pgmoneta_stop_logging();
+
+   exit(0);
+
+error:
+   wal_stream_destroy(stream, true);
+
+   pgmoneta_memory_destroy();
+   pgmoneta_stop_logging();
+
+   exit(1);
+}
+
+void
+pgmoneta_wal_receiver(int receiver_number, char** argv)
+{
+   struct ev_loop* loop = NULL;
+   struct ev_timer timer;
+   struct ev_timer flush_timer;
+   struct wal_receiver receiver;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   memset(&receiver, 0, sizeof(struct wal_receiver));
+   receiver.number = receiver_number;
+   pthread_mutex_init(&receiver.lock, NULL);
+   pthread_mutex_init(&receiver.protocol, NULL);
+
+   pgmoneta_start_logging();
+   pgmoneta_memory_init();
+
+   pgmoneta_set_proc_title(1, argv, "wal", "receiver");
+
+   loop = ev_loop_new(pgmoneta_libev(config->libev));
+   if (loop == NULL)
+   {
+      pgmoneta_log_error("Could not create the WAL receiver loop");
+      goto error;
+   }
+
+   receiver.loop = loop;
+   ev_set_userdata(loop, &receiver);
+
+   ev_async_init(&receiver.async, wal_receiver_async_cb);
+   ev_async_start(loop, &receiver.async);
+
+   // the connections are set up by threads, so a slow server doesn't hold up the streams of the others
+   wal_receiver_assign(&receiver);
+
+   receiver.retry = time(NULL);
+
+   ev_timer_init(&timer, wal_receiver_timer_cb, 1.0, 1.0);
+   ev_timer_start(loop, &timer);
+
+   // group flushes are due on time, not only when the next message arrives
+   ev_timer_init(&flush_timer, wal_receiver_flush_cb, 0.0, MAX(config->wal_flush_delay, 1) / 1000.0);
+   if (config->wal_flush == WAL_FLUSH_GROUP)
+   {
+      ev_timer_again(loop, &flush_timer);
+   }
+
+   if (wal_receiver_active(&receiver))
+   {
+      ev_run(loop, 0);
+   }
+
+   ev_timer_stop(loop, &timer);
+   ev_timer_stop(loop, &flush_timer);
+   ev_async_stop(loop, &receiver.async);
+
+   for (int i = 0; i < receiver.number_of_streams; i++)
+   {
+      if (receiver.connecting[i])
+      {
+         pthread_join(receiver.threads[i], NULL);
+         receiver.connecting[i] = false;
+
+         if (receiver.connected[i] != NULL)
+         {
+            pgmoneta_socket_nonblocking(receiver.connected[i]->socket, false);
+            wal_stream_destroy(receiver.connected[i], false);
+            receiver.connected[i] = NULL;
+         }
+      }
+
+      if (receiver.streams[i] != NULL)
+      {
+         ev_io_stop(loop, &receiver.streams[i]->watcher);
+         pgmoneta_socket_nonblocking(receiver.streams[i]->socket, false);
+         wal_stream_destroy(receiver.streams[i], false);
+         receiver.streams[i] = NULL;
+      }
+   }
+
+   ev_loop_destroy(loop);
+
+   pthread_mutex_destroy(&receiver.lock);
+   pthread_mutex_destroy(&receiver.protocol);
+
+   pgmoneta_memory_destroy();
+   pgmoneta_stop_logging();
+
+   exit(0);
+
+error:
+   pthread_mutex_destroy(&receiver.lock);
+   pthread_mutex_destroy(&receiver.protocol);
+
+   pgmoneta_memory_destroy();
+   pgmoneta_stop_logging();
+
+   exit(1);
+}
+
+bool
+pgmoneta_wal_should_stream(int srv)
+{
+   int follow = -1;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   if (!config->common.servers[srv].online || config->common.servers[srv].wal_streaming)
+   {
+      return false;
+   }
+
+   if (strlen(config->common.servers[srv].follow) == 0)
+   {
+      for (int j = 0; follow == -1 && j < config->common.number_of_servers; j++)
+      {
+         if (!strcmp(config->common.servers[j].follow, config->common.servers[srv].name))
+         {
+            follow = j;
+         }
+      }
+
+      return follow == -1 || !config->common.servers[follow].wal_streaming;
+   }
+
+   for (int j = 0; j < config->common.number_of_servers; j++)
+   {
+      if (!strcmp(config->common.servers[srv].follow, config->common.servers[j].name) &&
+          !config->common.servers[j].wal_streaming)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+int
+pgmoneta_wal_receivers_assign(int* servers, int number_of_servers, bool* running, int number_of_receivers, int* started)
+{
+   int live = 0;
+   int count;
+   int slot = 0;
+   int pending[NUMBER_OF_SERVERS];
+   int number_of_pending = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   // the servers of a receiver that is gone are assigned again
+   for (int srv = 0; srv < config->common.number_of_servers; srv++)
+   {
+      int r = config->common.servers[srv].wal_receiver;
+
+      if (r >= 0 && (r >= NUMBER_OF_SERVERS || !running[r]))
+      {
+         config->common.servers[srv].wal_receiver = -1;
+      }
+   }
+
+   for (int r = 0; r < NUMBER_OF_SERVERS; r++)
+   {
+      if (running[r])
+      {
+         live++;
+      }
+   }
+
+   // a live receiver restarts its own servers
+   for (int i = 0; i < number_of_servers; i++)
+   {
+      if (config->common.servers[servers[i]].wal_receiver == -1)
+      {
+         pending[number_of_pending++] = servers[i];
+      }
+   }
+
+   count = MAX(MIN(number_of_receivers - live, number_of_pending), 0);
+
+   // the servers are spread over the new receivers round-robin
+   for (int k = 0; k < count; k++)
+   {
+      while (running[slot])
+      {
+         slot++;
+      }
+
+      for (int i = k; i < number_of_pending; i += count)
+      {
+         config->common.servers[pending[i]].wal_receiver = slot;
+      }
+
+      started[k] = slot;
+      slot++;
+   }
+
+   for (int i = 0; count == 0 && i < number_of_pending; i++)
+   {
+      int least = -1;
+      int least_servers = 0;
+
+      for (int r = 0; r < NUMBER_OF_SERVERS; r++)
+      {
+         int n = 0;
+
+         if (!running[r])
+         {
+            continue;
+         }
+
+         for (int j = 0; j < config->common.number_of_servers; j++)
+         {
+            if (config->common.servers[j].wal_receiver == r)
+            {
+               n++;
+            }
+         }
+
+         if (least == -1 || n < least_servers)
+         {
+            least = r;
+            least_servers = n;
+         }
+      }
+
+      if (least != -1)
+      {
+         config->common.servers[pending[i]].wal_receiver = least;
+      }
+   }
+
+   return count;
+}
+
+static int
+wal_stream_create(int srv, struct wal_stream** stream)
 {
    int usr;
    int auth;
-   SSL* ssl = NULL;
-   int socket = -1;
-   uint32_t high32 = 0;
-   uint32_t low32 = 0;
-   char* d = NULL;
-   char* wal_shipping = NULL;
-   uint32_t timeline = 0;
    uint32_t cur_timeline = 0;
-   int hdrlen = 1 + 8 + 8 + 8;
-   size_t bytes_left = 0;
+   int read_replication = 1;
    char* xlogpos = NULL;
-   char cmd[MISC_LENGTH];
    size_t xlogpos_size = 0;
-   size_t xlogptr = 0;
-   size_t segno;
-   size_t xlogoff;
-   size_t curr_xlogoff = 0;
-   size_t segsize;
-   int read_replication = 1;
-   char* filename = NULL;
-   signed char type;
-   int ret;
-   FILE* wal_file = NULL;
-   FILE* wal_shipping_file = NULL;
-   sftp_file sftp_wal_file = NULL;
    struct message* identify_system_msg = NULL;
    struct query_response* identify_system_response = NULL;
-   struct query_response* end_of_timeline_response = NULL;
-   struct message* start_replication_msg = NULL;
-   struct message* msg = (struct message*)malloc(sizeof (struct message));
-   struct main_configuration* config;
-   struct stream_buffer* buffer = NULL;
-   struct workflow* head = NULL;
    struct workflow* current = NULL;
-   struct art* nodes = NULL;
+   struct wal_stream* s = NULL;
+   struct main_configuration* config;
 
    config = (struct main_configuration*) shmem;
 
-   pgmoneta_start_logging();
-   pgmoneta_memory_init();
+   *stream = NULL;
 
-   pgmoneta_set_proc_title(1, argv, "wal", config->common.servers[srv].name);
+   s = (struct wal_stream*)malloc(sizeof(struct wal_stream));
+   if (s == NULL)
+   {
+      goto error;
+   }
 
-   if (msg == NULL)
+   memset(s, 0, sizeof(struct wal_stream));
+   s->server = srv;
+   s->socket = -1;
+   *stream = s;
+
+   s->msg = (struct message*)malloc(sizeof (struct message));
+   if (s->msg == NULL)
    {
       goto error;
    }
 
-   memset(msg, 0, sizeof(struct message));
+   memset(s->msg, 0, sizeof(struct message));
 
    if (!config->common.servers[srv].online)
    {
@@ -160,40 +674,59 @@ pgmoneta_wal(int srv, char** argv)
       pgmoneta_log_warn("Server %s has checksums disabled. Use initdb -k or pg_checksums to enable", config->common.servers[srv].name);
    }
 
-   segsize = config->common.servers[srv].wal_size;
-   d = pgmoneta_get_server_wal(srv);
-   pgmoneta_mkdir(d);
+   s->segsize = config->common.servers[srv].wal_size;
+   s->directory = pgmoneta_get_server_wal(srv);
+   pgmoneta_mkdir(s->directory);
+
+   // listing, retention and restore find the segments through the index
+   if (pgmoneta_wal_index_create(s->directory, s->segsize))
+   {
+      pgmoneta_log_warn("Unable to index the WAL of %s", config->common.servers[srv].name);
+   }
+
+   s->pool_directory = pgmoneta_get_server_wal_pool(srv);
+   if (wal_pool_create(s->pool_directory, s->segsize, &s->pool))
+   {
+      pgmoneta_log_warn("Unable to preallocate WAL segments for %s", config->common.servers[srv].name);
+      s->pool = NULL;
+   }
+
+   // the write buffers of the local segment
+   if (pgmoneta_async_io_create(ASYNC_IO_DEPTH, ASYNC_IO_BUFFER_SIZE, &s->io))
+   {
+      pgmoneta_log_error("Could not create WAL writer for %s", config->common.servers[srv].name);
+      goto error;
+   }
 
-   if (pgmoneta_art_create(&nodes))
+   if (pgmoneta_art_create(&s->nodes))
    {
       goto error;
    }
 
-   if (pgmoneta_art_insert(nodes, NODE_SERVER_ID, (uintptr_t)srv, ValueInt32))
+   if (pgmoneta_art_insert(s->nodes, NODE_SERVER_ID, (uintptr_t)srv, ValueInt32))
    {
       goto error;
    }
 
    if (config->storage_engine & STORAGE_ENGINE_SSH)
    {
-      head = pgmoneta_storage_create_ssh(WORKFLOW_TYPE_WAL_SHIPPING);
-      current = head;
+      s->workflow = pgmoneta_storage_create_ssh(WORKFLOW_TYPE_WAL_SHIPPING);
    }
 
-   current = head;
+   current = s->workflow;
    while (current != NULL)
    {
-      if (current->setup(current->name(), nodes))
+      if (current->setup(current->name(), s->nodes))
       {
          goto error;
       }
       current = current->next;
    }
 
-   current = head;
+   current = s->workflow;
    while (current != NULL)
    {
-      if (current->execute(current->name(), nodes))
+      if (current->execute(current->name(), s->nodes))
       {
          goto error;
       }
@@ -201,26 +734,50 @@ pgmoneta_wal(int srv, char** argv)
    }
 
    // Setup WAL shipping directory
-   if (wal_shipping_setup(srv, &wal_shipping))
+   if (wal_shipping_setup(srv, &s->wal_shipping))
    {
       pgmoneta_log_warn("Unable to create WAL shipping directory");
    }
 
-   auth = pgmoneta_server_authenticate(srv, "postgres", config->common.users[usr].username, config->common.users[usr].password, true, &ssl, &socket);
+   // the copies are written by their own threads, the stream only waits for the local segment
+   if (s->wal_shipping != NULL && wal_target_create(srv, WAL_TARGET_SHIPPING, s->wal_shipping, s->segsize, &s->shipping))
+   {
+      pgmoneta_log_warn("Unable to start the WAL shipping writer for %s", config->common.servers[srv].name);
+      s->shipping = NULL;
+   }
 
-   if (auth != AUTH_SUCCESS)
+   if ((config->storage_engine & STORAGE_ENGINE_SSH) && wal_target_create(srv, WAL_TARGET_SSH, NULL, s->segsize, &s->remote))
    {
-      pgmoneta_log_error("Authentication failed for user %s on %s", config->common.users[usr].username, config->common.servers[srv].name);
+      pgmoneta_log_error("Unable to start the remote ssh WAL writer for %s", config->common.servers[srv].name);
       goto error;
    }
 
-   pgmoneta_memory_stream_buffer_init(&buffer);
+   auth = pgmoneta_server_authenticate(srv, "postgres", config->common.users[usr].username, config->common.users[usr].password, true, &s->ssl, &s->socket);
 
-   config->common.servers[srv].wal_streaming = true;
-   pgmoneta_create_identify_system_message(&identify_system_msg);
-   if (pgmoneta_query_execute(ssl, socket, identify_system_msg, &identify_system_response))
+   if (auth != AUTH_SUCCESS)
    {
-      pgmoneta_log_error("Error occurred when executing IDENTIFY_SYSTEM");
+      pgmoneta_log_error("Authentication failed for user %s on %s", config->common.users[usr].username, config->common.servers[srv].name);
+      goto error;
+   }
+
+   pgmoneta_memory_stream_buffer_init(&s->buffer);
+
+   config->common.servers[srv].wal_streaming = true;
+
+   // Completed segments are compressed and encrypted off the receive path
+   if (config->compression_type != COMPRESSION_NONE || config->encryption != ENCRYPTION_NONE)
+   {
+      if (pgmoneta_workers_initialize(1, &s->archiver))
+      {
+         pgmoneta_log_warn("Unable to start the WAL archiver for %s", config->common.servers[srv].name);
+         s->archiver = NULL;
+      }
+   }
+
+   pgmoneta_create_identify_system_message(&identify_system_msg);
+   if (pgmoneta_query_execute(s->ssl, s->socket, identify_system_msg, &identify_system_response))
+   {
+      pgmoneta_log_error("Error occurred when executing IDENTIFY_SYSTEM");
       goto error;
    }
 
@@ -232,20 +789,20 @@ pgmoneta_wal(int srv, char** argv)
    cur_timeline = pgmoneta_atoi(pgmoneta_query_response_get_data(identify_system_response, 1));
    if (cur_timeline < 1)
    {
-      pgmoneta_log_error("identify system: timeline should at least be 1, getting %d", timeline);
+      pgmoneta_log_error("identify system: timeline should at least be 1, getting %d", cur_timeline);
       goto error;
    }
    config->common.servers[srv].cur_timeline = cur_timeline;
 
-   wal_find_streaming_start(d, segsize, &timeline, &high32, &low32);
-   if (timeline == 0)
+   wal_find_streaming_start(s->directory, s->segsize, &s->timeline, &s->high32, &s->low32);
+   if (s->timeline == 0)
    {
       read_replication = (config->common.servers[srv].version >= 15) ? 1 : 0;
 
       // query the replication slot to get the starting LSN and timeline ID
       if (read_replication)
       {
-         if (wal_read_replication_slot(ssl, socket, config->common.servers[srv].wal_slot, config->common.servers[srv].name, segsize, &high32, &low32, &timeline))
+         if (wal_read_replication_slot(s->ssl, s->socket, config->common.servers[srv].wal_slot, config->common.servers[srv].name, s->segsize, &s->high32, &s->low32, &s->timeline))
          {
             read_replication = 0;   // Fallback if not PostgreSQL 15+
          }
@@ -254,7 +811,7 @@ pgmoneta_wal(int srv, char** argv)
       // use current xlogpos as last resort
       if (!read_replication)
       {
-         timeline = cur_timeline;
+         s->timeline = cur_timeline;
          xlogpos_size = strlen(pgmoneta_query_response_get_data(identify_system_response, 2)) + 1;
          xlogpos = (char*)malloc(xlogpos_size);
 
@@ -264,1417 +821,3047 @@ pgmoneta_wal(int srv, char** argv)
          }
          memset(xlogpos, 0, xlogpos_size);
          memcpy(xlogpos, pgmoneta_query_response_get_data(identify_system_response, 2), xlogpos_size);
-         if (wal_convert_xlogpos(xlogpos, segsize, &high32, &low32))
+         if (wal_convert_xlogpos(xlogpos, s->segsize, &s->high32, &s->low32))
          {
             goto error;
          }
-         free(xlogpos);
-         xlogpos = NULL;
       }
    }
 
+   pgmoneta_free_message(identify_system_msg);
+   pgmoneta_free_query_response(identify_system_response);
+   free(xlogpos);
+
+   return 0;
+
+error:
+   pgmoneta_free_message(identify_system_msg);
    pgmoneta_free_query_response(identify_system_response);
-   identify_system_response = NULL;
+   free(xlogpos);
 
-   while (config->running && config->common.servers[srv].online)
+   return 1;
+}
+
+static int
+wal_stream_start(struct wal_stream* stream)
+{
+   int ret;
+   signed char type;
+   char cmd[MISC_LENGTH];
+   struct message* start_replication_msg = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   if (wal_fetch_history(stream->directory, stream->timeline, stream->ssl, stream->socket))
    {
-      if (wal_fetch_history(d, timeline, ssl, socket))
-      {
-         pgmoneta_log_error("Error occurred when fetching .history file");
-         goto error;
-      }
+      pgmoneta_log_error("Error occurred when fetching .history file");
+      goto error;
+   }
+
+   snprintf(cmd, sizeof(cmd), "%X/%X", stream->high32, stream->low32);
+
+   pgmoneta_create_start_replication_message(cmd, stream->timeline, config->common.servers[stream->server].wal_slot, &start_replication_msg);
+
+   ret = pgmoneta_write_message(stream->ssl, stream->socket, start_replication_msg);
+
+   if (ret != MESSAGE_STATUS_OK)
+   {
+      pgmoneta_log_error("Error during START_REPLICATION for server %s", config->common.servers[stream->server].name);
+      goto error;
+   }
 
-      snprintf(cmd, sizeof(cmd), "%X/%X", high32, low32);
+   // assign xlogpos at the beginning of the streaming to LSN
+   memset(config->common.servers[stream->server].current_wal_lsn, 0, MISC_LENGTH);
+   snprintf(config->common.servers[stream->server].current_wal_lsn, MISC_LENGTH, "%s", cmd);
 
-      pgmoneta_create_start_replication_message(cmd, timeline, config->common.servers[srv].wal_slot, &start_replication_msg);
+   stream->flush.received = ((size_t)stream->high32 << 32) | stream->low32;
+   stream->flush.flushed = stream->flush.received;
+   stream->flush.reported = stream->flush.received;
+   wal_clock(&stream->flush.since);
 
-      ret = pgmoneta_write_message(ssl, socket, start_replication_msg);
+   type = 0;
 
-      if (ret != MESSAGE_STATUS_OK)
+   // wait for the CopyBothResponse message
+   while (config->running && config->common.servers[stream->server].online && type != 'W')
+   {
+      ret = pgmoneta_consume_copy_stream_start(stream->ssl, stream->socket, stream->buffer, stream->msg, NULL);
+      if (ret != 1)
+      {
+         pgmoneta_log_error("Error occurred when starting stream replication");
+         goto error;
+      }
+      type = stream->msg->kind;
+      if (type == 'E')
       {
-         pgmoneta_log_error("Error during START_REPLICATION for server %s", config->common.servers[srv].name);
+         pgmoneta_log_error("Error occurred when starting stream replication");
+         pgmoneta_log_error_response_message(stream->msg);
          goto error;
       }
+      pgmoneta_consume_copy_stream_end(stream->buffer, stream->msg);
+   }
 
-      // assign xlogpos at the beginning of the streaming to LSN
-      memset(config->common.servers[srv].current_wal_lsn, 0, MISC_LENGTH);
-      snprintf(config->common.servers[srv].current_wal_lsn, MISC_LENGTH, "%s", cmd);
+   pgmoneta_free_message(start_replication_msg);
 
-      type = 0;
+   return 0;
 
-      // wait for the CopyBothResponse message
+error:
+   pgmoneta_free_message(start_replication_msg);
 
-      while (config->running && config->common.servers[srv].online && (msg == NULL || type != 'W'))
-      {
-         ret = pgmoneta_consume_copy_stream_start(ssl, socket, buffer, msg, NULL);
-         if (ret != 1)
-         {
-            pgmoneta_log_error("Error occurred when starting stream replication");
-            goto error;
-         }
-         type = msg->kind;
-         if (type == 'E')
-         {
-            pgmoneta_log_error("Error occurred when starting stream replication");
-            pgmoneta_log_error_response_message(msg);
-            goto error;
-         }
-         pgmoneta_consume_copy_stream_end(buffer, msg);
-      }
+   return 1;
+}
 
-      type = 0;
+static int
+wal_stream_message(struct wal_stream* stream, struct message* msg)
+{
+   int hdrlen = 1 + 8 + 8 + 8;
+   size_t bytes_left = 0;
+   size_t xlogoff;
+   size_t segno;
+   size_t segsize = stream->segsize;
+   signed char type;
+   struct main_configuration* config;
 
-      // start streaming current timeline's WAL segments
-      while (config->running && config->common.servers[srv].online)
-      {
-         ret = pgmoneta_consume_copy_stream_start(ssl, socket, buffer, msg, NULL);
-         if (ret == 0)
-         {
-            break;
-         }
-         if (ret != MESSAGE_STATUS_OK)
-         {
-            goto error;
-         }
+   config = (struct main_configuration*) shmem;
 
-         if (msg == NULL)
-         {
-            pgmoneta_log_error("wal: received NULL message");
-            goto error;
-         }
+   if (msg->kind == 'E' || msg->kind == 'f')
+   {
+      pgmoneta_log_copyfail_message(msg);
+      pgmoneta_log_error_response_message(msg);
+      goto error;
+   }
 
-         if (msg->kind == 'E' || msg->kind == 'f')
-         {
-            pgmoneta_log_copyfail_message(msg);
-            pgmoneta_log_error_response_message(msg);
-            goto error;
-         }
-         if (msg->kind == 'd')
+   if (msg->kind == 'd')
+   {
+      type = *((char*)msg->data);
+      switch (type)
+      {
+         case 'w':
          {
-            type = *((char*)msg->data);
-            switch (type)
+            // wal data
+            if (msg->length < hdrlen)
             {
-               case 'w':
+               pgmoneta_log_error("Incomplete CopyData payload");
+               goto error;
+            }
+            stream->xlogptr = pgmoneta_read_int64(msg->data + 1);
+            xlogoff = wal_xlog_offset(stream->xlogptr, segsize);
+
+            if (stream->wal_file == NULL)
+            {
+               if (xlogoff != 0)
+               {
+                  pgmoneta_log_error("Received WAL record of offset %d with no file open", xlogoff);
+                  goto error;
+               }
+               // new wal file
+               segno = stream->xlogptr / segsize;
+               stream->curr_xlogoff = 0;
+               free(stream->filename);
+               stream->filename = wal_file_name(stream->timeline, segno, segsize);
+               if ((stream->wal_file = wal_open(stream->io, stream->directory, stream->filename, segsize, stream->pool)) == NULL)
+               {
+                  pgmoneta_log_error("Could not create or open WAL segment file at %s", stream->directory);
+                  goto error;
+               }
+               memset(config->common.servers[stream->server].current_wal_filename, 0, MISC_LENGTH);
+               snprintf(config->common.servers[stream->server].current_wal_filename, MISC_LENGTH, "%s.partial", stream->filename);
+               wal_target_open(stream->shipping, stream->filename);
+               wal_target_open(stream->remote, stream->filename);
+            }
+            else if (stream->curr_xlogoff != xlogoff)
+            {
+               pgmoneta_log_error("Received WAL record offset %08x, expected %08x", xlogoff, stream->curr_xlogoff);
+               goto error;
+            }
+            bytes_left = msg->length - hdrlen;
+            size_t bytes_written = 0;
+            // write to the wal file
+            while (bytes_left > 0)
+            {
+               size_t bytes_to_write = 0;
+               if (xlogoff + bytes_left > segsize)
+               {
+                  // do not write across the segment boundary
+                  bytes_to_write = segsize - xlogoff;
+               }
+               else
+               {
+                  bytes_to_write = bytes_left;
+               }
+               if (pgmoneta_async_io_write(stream->wal_file, msg->data + hdrlen + bytes_written, bytes_to_write))
+               {
+                  pgmoneta_log_error("Could not write %d bytes to WAL file %s", bytes_to_write, stream->filename);
+                  goto error;
+               }
+               wal_target_write(stream->shipping, msg->data + hdrlen + bytes_written, bytes_to_write);
+               wal_target_write(stream->remote, msg->data + hdrlen + bytes_written, bytes_to_write);
+
+               bytes_written += bytes_to_write;
+               bytes_left -= bytes_to_write;
+               stream->xlogptr += bytes_written;
+               xlogoff += bytes_written;
+               stream->curr_xlogoff += bytes_written;
+
+               if (wal_xlog_offset(stream->xlogptr, segsize) == 0)
                {
-                  // wal data
-                  if (msg->length < hdrlen)
+                  // the end of WAL segment
+                  if (!wal_close(stream->directory, stream->filename, false, stream->wal_file))
                   {
-                     pgmoneta_log_error("Incomplete CopyData payload");
-                     goto error;
+                     // the segment is synced before it is renamed
+                     stream->flush.flushed = stream->xlogptr;
+                     wal_archive(stream->archiver, stream->pool, stream->server, stream->directory, stream->filename);
                   }
-                  xlogptr = pgmoneta_read_int64(msg->data + 1);
-                  xlogoff = wal_xlog_offset(xlogptr, segsize);
+                  wal_target_close(stream->shipping, stream->filename, false);
+                  wal_target_close(stream->remote, stream->filename, false);
 
-                  if (wal_file == NULL)
+                  stream->wal_file = NULL;
+                  free(stream->filename);
+                  stream->filename = NULL;
+
+                  xlogoff = 0;
+                  stream->curr_xlogoff = 0;
+
+                  if (bytes_left > 0)
                   {
-                     if (xlogoff != 0)
+                     /* Write the rest of the data for the next WAL segment */
+                     segno = stream->xlogptr / segsize;
+                     stream->curr_xlogoff = 0;
+                     stream->filename = wal_file_name(stream->timeline, segno, segsize);
+                     if ((stream->wal_file = wal_open(stream->io, stream->directory, stream->filename, segsize, stream->pool)) == NULL)
                      {
-                        pgmoneta_log_error("Received WAL record of offset %d with no file open", xlogoff);
+                        pgmoneta_log_error("Could not create or open WAL segment file at %s", stream->directory);
                         goto error;
                      }
-                     // new wal file
-                     segno = xlogptr / segsize;
-                     curr_xlogoff = 0;
-                     filename = wal_file_name(timeline, segno, segsize);
-                     if ((wal_file = wal_open(d, filename, segsize)) == NULL)
+                     memset(config->common.servers[stream->server].current_wal_filename, 0, MISC_LENGTH);
+                     snprintf(config->common.servers[stream->server].current_wal_filename, MISC_LENGTH, "%s.partial", stream->filename);
+                     wal_target_open(stream->shipping, stream->filename);
+                     wal_target_open(stream->remote, stream->filename);
+                     stream->curr_xlogoff += bytes_left;
+                     if (pgmoneta_async_io_write(stream->wal_file, msg->data + hdrlen + bytes_written, bytes_left))
                      {
-                        pgmoneta_log_error("Could not create or open WAL segment file at %s", d);
+                        pgmoneta_log_error("Could not write %zu bytes to WAL file %s", bytes_left, stream->filename);
                         goto error;
                      }
-                     memset(config->common.servers[srv].current_wal_filename, 0, MISC_LENGTH);
-                     snprintf(config->common.servers[srv].current_wal_filename, MISC_LENGTH, "%s.partial", filename);
-                     if ((wal_shipping_file = wal_open(wal_shipping, filename, segsize)) == NULL)
-                     {
-                        if (wal_shipping != NULL)
-                        {
-                           pgmoneta_log_warn("Could not create or open WAL segment file at %s", wal_shipping);
-                        }
-                     }
-                     if (config->storage_engine & STORAGE_ENGINE_SSH)
-                     {
-                        if (pgmoneta_sftp_wal_open(srv, filename, segsize, &sftp_wal_file) == 1)
-                        {
-                           pgmoneta_log_error("Could not create or open WAL segment file on remote ssh storage engine");
-                           goto error;
-                        }
-                     }
-                  }
-                  else if (curr_xlogoff != xlogoff)
-                  {
-                     pgmoneta_log_error("Received WAL record offset %08x, expected %08x", xlogoff, curr_xlogoff);
-                     goto error;
+                     wal_target_write(stream->shipping, msg->data + hdrlen + bytes_written, bytes_left);
+                     wal_target_write(stream->remote, msg->data + hdrlen + bytes_written, bytes_left);
+                     bytes_left = 0;
                   }
-                  bytes_left = msg->length - hdrlen;
-                  size_t bytes_written = 0;
-                  // write to the wal file
-                  while (bytes_left > 0)
-                  {
-                     size_t bytes_to_write = 0;
-                     if (xlogoff + bytes_left > segsize)
-                     {
-                        // do not write across the segment boundary
-                        bytes_to_write = segsize - xlogoff;
-                     }
-                     else
-                     {
-                        bytes_to_write = bytes_left;
-                     }
-                     if (bytes_to_write != fwrite(msg->data + hdrlen + bytes_written, 1, bytes_to_write, wal_file))
-                     {
-                        pgmoneta_log_error("Could not write %d bytes to WAL file %s", bytes_to_write, filename);
-                        goto error;
-                     }
-                     if (sftp_wal_file != NULL)
-                     {
-                        sftp_write(sftp_wal_file, msg->data + hdrlen + bytes_written, bytes_to_write);
-                     }
-
-                     if (wal_shipping_file != NULL)
-                     {
-                        fwrite(msg->data + hdrlen + bytes_written, 1, bytes_to_write, wal_shipping_file);
-                     }
+                  break;
+               }
+            }
+            // start the writes of the message, they complete while the next one is received
+            if (stream->wal_file != NULL)
+            {
+               pgmoneta_async_io_submit(stream->wal_file);
+            }
 
-                     bytes_written += bytes_to_write;
-                     bytes_left -= bytes_to_write;
-                     xlogptr += bytes_written;
-                     xlogoff += bytes_written;
-                     curr_xlogoff += bytes_written;
+            // update LSN after a message data is written to the segment
+            update_wal_lsn(stream->server, stream->xlogptr);
 
-                     if (wal_xlog_offset(xlogptr, segsize) == 0)
-                     {
-                        // the end of WAL segment
-                        fflush(wal_file);
-                        wal_close(d, filename, false, wal_file);
-                        if (sftp_wal_file != NULL)
-                        {
-                           pgmoneta_sftp_wal_close(srv, filename, false, &sftp_wal_file);
-                           sftp_wal_file = NULL;
-                        }
-
-                        wal_file = NULL;
-                        if (wal_shipping_file != NULL)
-                        {
-                           fflush(wal_shipping_file);
-                           wal_close(wal_shipping, filename, false, wal_shipping_file);
-                           wal_shipping_file = NULL;
-                        }
-                        free(filename);
-                        filename = NULL;
-
-                        xlogoff = 0;
-                        curr_xlogoff = 0;
-
-                        if (bytes_left > 0)
-                        {
-                           /* Write the rest of the data for the next WAL segment */
-                           segno = xlogptr / segsize;
-                           curr_xlogoff = 0;
-                           filename = wal_file_name(timeline, segno, segsize);
-                           if ((wal_file = wal_open(d, filename, segsize)) == NULL)
-                           {
-                              pgmoneta_log_error("Could not create or open WAL segment file at %s", d);
-                              goto error;
-                           }
-                           memset(config->common.servers[srv].current_wal_filename, 0, MISC_LENGTH);
-                           snprintf(config->common.servers[srv].current_wal_filename, MISC_LENGTH, "%s.partial", filename);
-                           if ((wal_shipping_file = wal_open(wal_shipping, filename, segsize)) == NULL)
-                           {
-                              if (wal_shipping != NULL)
-                              {
-                                 pgmoneta_log_warn("Could not create or open WAL segment file at %s", wal_shipping);
-                              }
-                           }
-                           if (config->storage_engine & STORAGE_ENGINE_SSH)
-                           {
-                              if (pgmoneta_sftp_wal_open(srv, filename, segsize, &sftp_wal_file) == 1)
-                              {
-                                 pgmoneta_log_error("Could not create or open WAL segment file on remote ssh storage engine");
-                                 goto error;
-                              }
-                           }
-                           curr_xlogoff += bytes_left;
-                           fwrite(msg->data + hdrlen + bytes_written, 1, bytes_left, wal_file);
-                           if (sftp_wal_file != NULL)
-                           {
-                              sftp_write(sftp_wal_file, msg->data + hdrlen + bytes_written, bytes_left);
-                           }
-                           if (wal_shipping_file != NULL)
-                           {
-                              fwrite(msg->data + hdrlen + bytes_written, 1, bytes_left, wal_shipping_file);
-                           }
-                           bytes_left = 0;
-                        }
-                        break;
-                     }
-                  }
-                  // update LSN after a message data is written to the segment
-                  update_wal_lsn(srv, xlogptr);
+            stream->flush.received = pgmoneta_read_int64(msg->data + 1) + (msg->length - hdrlen);
 
-                  wal_send_status_report(ssl, socket, xlogptr, xlogptr, 0);
-                  break;
-               }
-               case 'k':
-               {
-                  // keep alive request
-                  wal_send_status_report(ssl, socket, xlogptr, xlogptr, 0);
-                  break;
-               }
-               default:
-                  // shouldn't be here
-                  pgmoneta_log_error("Unrecognized CopyData type %c", type);
-                  goto error;
+            // only a flushed position is reported, so the server is told once per flush
+            if (wal_flush(stream->ssl, stream->socket, stream->buffer, stream->wal_file, false, &stream->flush))
+            {
+               goto error;
             }
+            wal_report(stream->ssl, stream->socket, false, &stream->flush);
+            break;
          }
-         else if (msg->kind == 'c')
+         case 'k':
          {
-            // handle CopyDone
-            pgmoneta_send_copy_done_message(ssl, socket);
-            if (wal_file != NULL)
+            // keep alive request, answered with everything received on stable storage
+            if (wal_flush(stream->ssl, stream->socket, stream->buffer, stream->wal_file, true, &stream->flush))
             {
-               // Next file would be at a new timeline, so we treat the current wal file completed
-               wal_close(d, filename, false, wal_file);
-               wal_file = NULL;
-               wal_close(wal_shipping, filename, false, wal_shipping_file);
-               wal_shipping_file = NULL;
-               if (sftp_wal_file != NULL)
-               {
-                  pgmoneta_sftp_wal_close(srv, filename, false, &sftp_wal_file);
-                  sftp_wal_file = NULL;
-               }
+               goto error;
             }
-            pgmoneta_consume_copy_stream_end(buffer, msg);
+            wal_report(stream->ssl, stream->socket, true, &stream->flush);
             break;
          }
-         pgmoneta_consume_copy_stream_end(buffer, msg);
-      }
-      // there should be a DataRow message followed by a CommandComplete messages,
-      // receive them and parse the next timeline and xlogpos from it
-      if (!config->running)
-      {
-         break;
-      }
-      pgmoneta_consume_data_row_messages(ssl, socket, buffer, &end_of_timeline_response);
-      if (end_of_timeline_response == NULL || end_of_timeline_response->number_of_columns < 2)
-      {
-         goto error;
-      }
-      timeline = pgmoneta_atoi(pgmoneta_query_response_get_data(end_of_timeline_response, 0));
-      xlogpos = pgmoneta_query_response_get_data(end_of_timeline_response, 1);
-      if (wal_convert_xlogpos(xlogpos, segsize, &high32, &low32))
-      {
-         goto error;
+         default:
+            // shouldn't be here
+            pgmoneta_log_error("Unrecognized CopyData type %c", type);
+            goto error;
       }
-      xlogpos = NULL;
-      // receive the last command complete message
-      msg->kind = '\0';
-      while (config->running && config->common.servers[srv].online && msg->kind != 'C')
+   }
+   else if (msg->kind == 'c')
+   {
+      // handle CopyDone
+      pgmoneta_send_copy_done_message(stream->ssl, stream->socket);
+      if (stream->wal_file != NULL)
       {
-         pgmoneta_consume_copy_stream_start(ssl, socket, buffer, msg, NULL);
-         pgmoneta_consume_copy_stream_end(buffer, msg);
+         // Next file would be at a new timeline, so we treat the current wal file completed
+         if (!wal_close(stream->directory, stream->filename, false, stream->wal_file))
+         {
+            stream->flush.flushed = stream->flush.received;
+            wal_archive(stream->archiver, stream->pool, stream->server, stream->directory, stream->filename);
+         }
+         stream->wal_file = NULL;
+         wal_target_close(stream->shipping, stream->filename, false);
+         wal_target_close(stream->remote, stream->filename, false);
       }
-
-      pgmoneta_free_query_response(end_of_timeline_response);
-      end_of_timeline_response = NULL;
-      pgmoneta_free_message(start_replication_msg);
-      start_replication_msg = NULL;
+      return WAL_STREAM_DONE;
    }
 
-   config->common.servers[srv].wal_streaming = false;
-   pgmoneta_close_ssl(ssl);
-   if (socket != -1)
+   return WAL_STREAM_OK;
+
+error:
+
+   return WAL_STREAM_ERROR;
+}
+
+static int
+wal_stream_next_timeline(struct wal_stream* stream)
+{
+   char* xlogpos = NULL;
+   struct query_response* end_of_timeline_response = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   // there should be a DataRow message followed by a CommandComplete messages,
+   // receive them and parse the next timeline and xlogpos from it
+   pgmoneta_consume_data_row_messages(stream->ssl, stream->socket, stream->buffer, &end_of_timeline_response);
+   if (end_of_timeline_response == NULL || end_of_timeline_response->number_of_columns < 2)
    {
-      pgmoneta_disconnect(socket);
+      goto error;
    }
-   if (wal_file != NULL)
+   stream->timeline = pgmoneta_atoi(pgmoneta_query_response_get_data(end_of_timeline_response, 0));
+   xlogpos = pgmoneta_query_response_get_data(end_of_timeline_response, 1);
+   if (wal_convert_xlogpos(xlogpos, stream->segsize, &stream->high32, &stream->low32))
    {
-      bool partial = (wal_xlog_offset(xlogptr, segsize) != 0);
-      wal_close(d, filename, partial, wal_file);
-      wal_close(wal_shipping, filename, partial, wal_shipping_file);
-      if (sftp_wal_file != NULL)
-      {
-         pgmoneta_sftp_wal_close(srv, filename, partial, &sftp_wal_file);
-         sftp_wal_file = NULL;
-      }
+      goto error;
    }
-
-   current = head;
-   while (current != NULL)
+   // receive the last command complete message
+   stream->msg->kind = '\0';
+   while (config->running && config->common.servers[stream->server].online && stream->msg->kind != 'C')
    {
-      current->teardown(current->name(), nodes);
-
-      current = current->next;
+      pgmoneta_consume_copy_stream_start(stream->ssl, stream->socket, stream->buffer, stream->msg, NULL);
+      pgmoneta_consume_copy_stream_end(stream->buffer, stream->msg);
    }
 
-   config->common.servers[srv].online = false;
+   pgmoneta_free_query_response(end_of_timeline_response);
 
-   pgmoneta_memory_destroy();
-   pgmoneta_stop_logging();
+   return 0;
 
-   pgmoneta_free_message(identify_system_msg);
-   pgmoneta_free_message(start_replication_msg);
-   if (msg != NULL)
-   {
-      msg->data = NULL;
-   }
-   pgmoneta_free_message(msg);
-   pgmoneta_free_query_response(identify_system_response);
+error:
    pgmoneta_free_query_response(end_of_timeline_response);
-   pgmoneta_memory_stream_buffer_free(buffer);
 
-   pgmoneta_art_destroy(nodes);
+   return 1;
+}
 
-   free(d);
-   free(wal_shipping);
-   free(filename);
-   free(xlogpos);
-   exit(0);
+static void
+wal_stream_destroy(struct wal_stream* stream, bool failed)
+{
+   bool partial;
+   struct workflow* current = NULL;
+   struct main_configuration* config;
 
-error:
-   config->common.servers[srv].online = false;
-   config->common.servers[srv].wal_streaming = false;
-   pgmoneta_close_ssl(ssl);
-   if (socket != -1)
+   config = (struct main_configuration*) shmem;
+
+   if (stream == NULL)
    {
-      pgmoneta_disconnect(socket);
+      return;
    }
 
-   if (wal_file != NULL)
+   config->common.servers[stream->server].online = false;
+   config->common.servers[stream->server].wal_streaming = false;
+   pgmoneta_close_ssl(stream->ssl);
+   if (stream->socket != -1)
    {
-      wal_close(d, filename, true, wal_file);
-      wal_close(wal_shipping, filename, true, wal_shipping_file);
+      pgmoneta_disconnect(stream->socket);
    }
-   if (sftp_wal_file != NULL)
+
+   if (stream->wal_file != NULL)
    {
-      pgmoneta_sftp_wal_close(srv, filename, true, &sftp_wal_file);
-      sftp_wal_file = NULL;
+      partial = failed || wal_xlog_offset(stream->xlogptr, stream->segsize) != 0;
+      if (!wal_close(stream->directory, stream->filename, partial, stream->wal_file) && !partial)
+      {
+         wal_archive(stream->archiver, stream->pool, stream->server, stream->directory, stream->filename);
+      }
+      if (!failed)
+      {
+         wal_target_close(stream->shipping, stream->filename, partial);
+         wal_target_close(stream->remote, stream->filename, partial);
+      }
    }
-   pgmoneta_free_message(identify_system_msg);
-   pgmoneta_free_message(start_replication_msg);
-   if (msg != NULL)
+   // otherwise the targets close their open segment as partial
+   wal_target_destroy(stream->shipping);
+   wal_target_destroy(stream->remote);
+
+   if (stream->archiver != NULL)
    {
-      msg->data = NULL;
+      pgmoneta_workers_wait(stream->archiver);
    }
-   pgmoneta_free_message(msg);
-   pgmoneta_free_query_response(identify_system_response);
-   pgmoneta_free_query_response(end_of_timeline_response);
-   pgmoneta_memory_stream_buffer_free(buffer);
+   pgmoneta_workers_destroy(stream->archiver);
+   wal_pool_destroy(stream->pool);
 
-   current = head;
+   current = stream->workflow;
    while (current != NULL)
    {
-      current->teardown(current->name(), nodes);
+      current->teardown(current->name(), stream->nodes);
 
       current = current->next;
    }
 
-   pgmoneta_memory_destroy();
-   pgmoneta_stop_logging();
+   if (stream->msg != NULL)
+   {
+      stream->msg->data = NULL;
+   }
+   pgmoneta_free_message(stream->msg);
+   pgmoneta_memory_stream_buffer_free(stream->buffer);
+   pgmoneta_async_io_destroy(stream->io);
 
-   pgmoneta_art_destroy(nodes);
+   pgmoneta_art_destroy(stream->nodes);
 
-   free(d);
-   free(wal_shipping);
-   free(filename);
-   free(xlogpos);
-   exit(1);
+   free(stream->directory);
+   free(stream->pool_directory);
+   free(stream->wal_shipping);
+   free(stream->filename);
+   free(stream);
 }
 
 static int
-wal_read_replication_slot(SSL* ssl, int socket, char* slot, char* name, int segsize, uint32_t* high32, uint32_t* low32, uint32_t* timeline)
+wal_stream_receive(struct wal_stream* stream)
 {
-   struct message* read_slot_msg = NULL;
-   struct query_response* read_slot_response = NULL;
-   char* lsn = NULL;
-   int status = 0;
-   uint32_t tli = 0;
-
-   *high32 = 0;
-   *low32 = 0;
-   *timeline = 0;
+   int numbytes;
+   int err;
+   struct stream_buffer* buffer = stream->buffer;
+   struct main_configuration* config;
 
-   pgmoneta_create_read_replication_slot_message(slot, &read_slot_msg);
-   status = pgmoneta_query_execute(ssl, socket, read_slot_msg, &read_slot_response);
+   config = (struct main_configuration*) shmem;
 
-   if (status != 0)
+   do
    {
-      pgmoneta_log_debug("Error occurred when executing READ_REPLICATION_SLOT for slot %s on server %s", slot, name);
-      goto error;
-   }
-
-   if (read_slot_response == NULL || read_slot_response->number_of_columns < 3)
-   {
-      pgmoneta_log_debug("Invalid response from READ_REPLICATION_SLOT for slot %s on server %s", slot, name);
-      goto error;
+      if (pgmoneta_memory_stream_buffer_enlarge(buffer, WAL_RECEIVE_SIZE))
+      {
+         pgmoneta_log_error("Fail to enlarge stream buffer");
+         goto error;
+      }
+
+      if (stream->ssl != NULL)
+      {
+         numbytes = SSL_read(stream->ssl, buffer->buffer + buffer->end, (int)MIN(buffer->size - buffer->end, (size_t)INT_MAX));
+
+         if (numbytes <= 0)
+         {
+            err = SSL_get_error(stream->ssl, numbytes);
+            ERR_clear_error();
+
+            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+            {
+               return 0;
+            }
+
+            pgmoneta_log_error("Could not read the WAL stream of %s: %d", config->common.servers[stream->server].name, err);
+            goto error;
+         }
+      }
+      else
+      {
+         numbytes = read(stream->socket, buffer->buffer + buffer->end, MIN(buffer->size - buffer->end, (size_t)INT_MAX));
+
+         if (numbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+         {
+            errno = 0;
+            return 0;
+         }
+
+         if (numbytes <= 0)
+         {
+            pgmoneta_log_error("Could not read the WAL stream of %s: %s", config->common.servers[stream->server].name, numbytes == 0 ? "connection closed" : strerror(errno));
+            goto error;
+         }
+      }
+
+      buffer->end += numbytes;
    }
+   // the records already decrypted don't make the socket readable again
+   while (stream->ssl != NULL && SSL_pending(stream->ssl) > 0);
 
-   tli = pgmoneta_atoi(pgmoneta_query_response_get_data(read_slot_response, 2));
-   if (tli < 1)
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+wal_receiver_add(struct wal_receiver* receiver, int index)
+{
+   struct wal_connect* connect = NULL;
+
+   if (receiver->connecting[index])
    {
-      pgmoneta_log_debug("wal_read_replication_slot: timeline is %d, expecting 1 for server %s", tli, name);
-      goto error;
+      return 0;
    }
 
-   lsn = pgmoneta_query_response_get_data(read_slot_response, 1);
-   if (wal_convert_xlogpos(lsn, segsize, high32, low32))
+   connect = (struct wal_connect*)malloc(sizeof(struct wal_connect));
+   if (connect == NULL)
    {
-      pgmoneta_log_debug("wal_read_replication_slot: failed to convert LSN from replication slot %s on server %s", slot, name);
       goto error;
    }
 
-   *timeline = tli;
+   connect->receiver = receiver;
+   connect->index = index;
 
-   pgmoneta_free_query_response(read_slot_response);
-   pgmoneta_free_message(read_slot_msg);
+   receiver->connecting[index] = true;
+
+   if (pthread_create(&receiver->threads[index], NULL, wal_receiver_connect, connect))
+   {
+      receiver->connecting[index] = false;
+      goto error;
+   }
 
    return 0;
 
 error:
-   pgmoneta_free_query_response(read_slot_response);
-   pgmoneta_free_message(read_slot_msg);
+   free(connect);
+
    return 1;
 }
 
-static void
-update_wal_lsn(int srv, size_t xlogptr)
+static void*
+wal_receiver_connect(void* arg)
 {
-   struct main_configuration* config = (struct main_configuration*) shmem;
-   uint32_t low32 = xlogptr & 0xffffffff;
-   uint32_t high32 = xlogptr >> 32 & 0xffffffff;
-   memset(config->common.servers[srv].current_wal_lsn, 0, MISC_LENGTH);
-   snprintf(config->common.servers[srv].current_wal_lsn, MISC_LENGTH, "%X/%X", high32, low32);
-}
+   struct wal_connect* connect = (struct wal_connect*)arg;
+   struct wal_receiver* receiver = connect->receiver;
+   int index = connect->index;
+   struct wal_stream* stream = NULL;
 
-int
-pgmoneta_get_timeline_history(int srv, uint32_t tli, struct timeline_history** history)
-{
-   struct timeline_history* h = NULL;
-   struct timeline_history* curh = NULL;
-   struct timeline_history* nexth = NULL;
-   char filename[MISC_LENGTH];
-   char* path = NULL;
-   char buffer[MAX_PATH];
-   int numfields = 0;
-   FILE* file = NULL;
+   free(connect);
 
-   if (tli == 1)
-   {
-      return 0;
-   }
+   // the blocking reads share the message buffer of the process
+   pthread_mutex_lock(&receiver->protocol);
 
-   snprintf(filename, sizeof(filename), "%08X.history", tli);
-   path = pgmoneta_get_server_wal(srv);
-   path = pgmoneta_append(path, filename);
-   file = fopen(path, "r");
-   if (file == NULL)
+   if (wal_stream_create(receiver->servers[index], &stream) ||
+       wal_stream_start(stream) ||
+       pgmoneta_socket_nonblocking(stream->socket, true))
    {
-      pgmoneta_log_error("Unable to open history file: %s", strerror(errno));
-      goto error;
+      wal_stream_destroy(stream, true);
+      stream = NULL;
    }
-   memset(buffer, 0, sizeof(buffer));
-   while (fgets(buffer, sizeof(buffer), file) != NULL)
+
+   pthread_mutex_unlock(&receiver->protocol);
+
+   pthread_mutex_lock(&receiver->lock);
+   receiver->connected[index] = stream;
+   receiver->done[index] = true;
+   pthread_mutex_unlock(&receiver->lock);
+
+   ev_async_send(receiver->loop, &receiver->async);
+
+   return NULL;
+}
+
+static void
+wal_receiver_assign(struct wal_receiver* receiver)
+{
+   bool known;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   // the main process assigns the servers, also to a receiver that is already running
+   for (int srv = 0; srv < config->common.number_of_servers; srv++)
    {
-      char* ptr = buffer;
-      // ignore empty spaces
-      while (*ptr != '\0' && isspace(*ptr))
+      if (config->common.servers[srv].wal_receiver != receiver->number)
       {
-         ptr++;
+         continue;
       }
-      // ignore empty lines and comments
-      if (*ptr == '\0' || *ptr == '#')
+
+      known = false;
+      for (int i = 0; !known && i < receiver->number_of_streams; i++)
       {
-         continue;
+         known = receiver->servers[i] == srv;
       }
-      nexth = (struct timeline_history*) malloc(sizeof(struct timeline_history));
 
-      if (nexth == NULL)
+      if (!known && receiver->number_of_streams < NUMBER_OF_SERVERS)
       {
-         goto error;
+         receiver->servers[receiver->number_of_streams] = srv;
+         wal_receiver_add(receiver, receiver->number_of_streams);
+         receiver->number_of_streams++;
       }
+   }
+}
 
-      memset(nexth, 0, sizeof(struct timeline_history));
-      if (h == NULL)
+static int
+wal_receiver_process(struct ev_loop* loop, struct wal_stream* stream)
+{
+   int status;
+   int ret = WAL_STREAM_OK;
+   struct wal_receiver* receiver = (struct wal_receiver*)ev_userdata(loop);
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   while (config->running && config->common.servers[stream->server].online)
+   {
+      status = pgmoneta_consume_copy_stream_buffered(stream->buffer, stream->msg);
+      if (status == MESSAGE_STATUS_ZERO)
       {
-         curh = nexth;
-         h = curh;
+         break;
       }
-      else
+      if (status != MESSAGE_STATUS_OK)
       {
-         curh->next = nexth;
-         curh = curh->next;
+         goto error;
       }
-      numfields = sscanf(ptr, "%u\t%X/%X", &curh->parent_tli, &curh->switchpos_hi, &curh->switchpos_lo);
-      if (numfields != 3)
+
+      ret = wal_stream_message(stream, stream->msg);
+      pgmoneta_consume_copy_stream_end(stream->buffer, stream->msg);
+
+      if (ret == WAL_STREAM_ERROR)
       {
-         pgmoneta_log_error("error parsing history file %s", filename);
          goto error;
       }
-      memset(buffer, 0, sizeof(buffer));
-   }
 
-   *history = h;
+      if (ret == WAL_STREAM_DONE)
+      {
+         // the switch to the next timeline is a short exchange, done blocking
+         pthread_mutex_lock(&receiver->protocol);
 
-   free(path);
-   if (file != NULL)
-   {
-      fclose(file);
+         if (pgmoneta_socket_nonblocking(stream->socket, false) ||
+             wal_stream_next_timeline(stream) ||
+             wal_stream_start(stream) ||
+             pgmoneta_socket_nonblocking(stream->socket, true))
+         {
+            pthread_mutex_unlock(&receiver->protocol);
+            goto error;
+         }
+
+         pthread_mutex_unlock(&receiver->protocol);
+      }
    }
+
    return 0;
 
 error:
-   free(path);
-   if (file != NULL)
-   {
-      fclose(file);
-   }
-   pgmoneta_free_timeline_history(h);
+   wal_receiver_remove(loop, stream, true);
+
    return 1;
 }
 
-void
-pgmoneta_free_timeline_history(struct timeline_history* history)
+static void
+wal_receiver_remove(struct ev_loop* loop, struct wal_stream* stream, bool failed)
 {
-   struct timeline_history* h = history;
-   while (h != NULL)
+   struct wal_receiver* receiver = (struct wal_receiver*)ev_userdata(loop);
+
+   ev_io_stop(loop, &stream->watcher);
+
+   for (int i = 0; i < receiver->number_of_streams; i++)
    {
-      struct timeline_history* next = h->next;
-      free(h);
-      h = next;
+      if (receiver->streams[i] == stream)
+      {
+         receiver->streams[i] = NULL;
+      }
    }
+
+   wal_stream_destroy(stream, failed);
 }
 
-static char*
-wal_file_name(uint32_t timeline, size_t segno, int segsize)
+static bool
+wal_receiver_active(struct wal_receiver* receiver)
 {
-   char hex[128];
-   char* f = NULL;
-
-   memset(&hex[0], 0, sizeof(hex));
-   int segments_per_id = 0x100000000ULL / segsize;
-   int seg_id = segno / segments_per_id;
-   int seg_offset = segno % segments_per_id;
+   for (int i = 0; i < receiver->number_of_streams; i++)
+   {
+      if (receiver->streams[i] != NULL || receiver->connecting[i])
+      {
+         return true;
+      }
+   }
 
-   snprintf(&hex[0], sizeof(hex), "%08X%08X%08X", timeline, seg_id, seg_offset);
-   f = pgmoneta_append(f, hex);
-   return f;
+   return false;
 }
 
-static int
-wal_fetch_history(char* basedir, int timeline, SSL* ssl, int socket)
+static void
+wal_receiver_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
 {
-   struct message* timeline_history_msg = NULL;
-   struct query_response* timeline_history_response = NULL;
-   FILE* history_file = NULL;
-   char* history_content = NULL;
-   char path[MAX_PATH];
+   struct wal_stream* stream = (struct wal_stream*)watcher->data;
 
-   if (basedir == NULL || strlen(basedir) == 0 || !pgmoneta_exists(basedir))
+   if (EV_ERROR & revents)
    {
-      pgmoneta_log_error("base directory for history file does not exist");
-      goto error;
+      pgmoneta_log_trace("wal_receiver_cb: got invalid event: %s", strerror(errno));
+      wal_receiver_remove(loop, stream, true);
+      return;
    }
 
-   memset(path, 0, sizeof(path));
-   if (pgmoneta_ends_with(basedir, "/"))
+   if (wal_stream_receive(stream))
    {
-      snprintf(path, sizeof(path), "%s%08x.history", basedir, timeline);
+      wal_receiver_remove(loop, stream, true);
+      return;
    }
 
-   // do nothing if the corresponding .history already exists, or current timeline is 1
-   if (timeline == 1 || pgmoneta_exists(path))
+   wal_receiver_process(loop, stream);
+}
+
+static void
+wal_receiver_async_cb(struct ev_loop* loop, struct ev_async* watcher __attribute__((unused)), int revents __attribute__((unused)))
+{
+   bool done;
+   struct wal_stream* stream = NULL;
+   struct wal_receiver* receiver = (struct wal_receiver*)ev_userdata(loop);
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   for (int i = 0; i < receiver->number_of_streams; i++)
    {
-      return 0;
+      pthread_mutex_lock(&receiver->lock);
+      done = receiver->done[i];
+      stream = receiver->connected[i];
+      receiver->done[i] = false;
+      receiver->connected[i] = NULL;
+      pthread_mutex_unlock(&receiver->lock);
+
+      if (!done)
+      {
+         continue;
+      }
+
+      pthread_join(receiver->threads[i], NULL);
+      receiver->connecting[i] = false;
+
+      if (stream != NULL)
+      {
+         receiver->streams[i] = stream;
+
+         ev_io_init(&stream->watcher, wal_receiver_cb, stream->socket, EV_READ);
+         stream->watcher.data = stream;
+         ev_io_start(loop, &stream->watcher);
+
+         // the server may already have sent WAL behind the CopyBothResponse
+         wal_receiver_process(loop, stream);
+      }
    }
 
-   pgmoneta_create_timeline_history_message(timeline, &timeline_history_msg);
-   if (pgmoneta_query_execute(ssl, socket, timeline_history_msg, &timeline_history_response))
+   if (!config->running || !wal_receiver_active(receiver))
    {
-      pgmoneta_log_error("Error occurred when executing TIMELINE_HISTORY %d", timeline);
-      goto error;
+      ev_break(loop, EVBREAK_ALL);
    }
+}
 
-   history_content = pgmoneta_query_response_get_data(timeline_history_response, 1);
+static void
+wal_receiver_timer_cb(struct ev_loop* loop, struct ev_timer* watcher __attribute__((unused)), int revents __attribute__((unused)))
+{
+   struct wal_receiver* receiver = (struct wal_receiver*)ev_userdata(loop);
+   struct main_configuration* config;
 
-   history_file = fopen(path, "wb");
-   if (history_file == NULL)
-   {
-      goto error;
-   }
-   fwrite(history_content, 1, strlen(history_content) + 1, history_file);
-   fflush(history_file);
+   config = (struct main_configuration*) shmem;
 
-   pgmoneta_free_message(timeline_history_msg);
-   pgmoneta_free_query_response(timeline_history_response);
-   if (history_file != NULL)
+   for (int i = 0; i < receiver->number_of_streams; i++)
    {
-      fclose(history_file);
+      if (receiver->streams[i] != NULL && !config->common.servers[receiver->streams[i]->server].online)
+      {
+         wal_receiver_remove(loop, receiver->streams[i], false);
+      }
    }
-   return 0;
 
-error:
-   pgmoneta_free_message(timeline_history_msg);
-   pgmoneta_free_query_response(timeline_history_response);
-   if (history_file != NULL)
+   if (config->running)
    {
-      fclose(history_file);
+      wal_receiver_assign(receiver);
    }
-   return 1;
-}
 
-static FILE*
-wal_open(char* root, char* filename, int segsize)
-{
-   if (root == NULL || strlen(root) == 0 || !pgmoneta_exists(root))
+   // the main process leaves the servers of a live receiver to it, so the stopped streams are restarted here
+   if (config->running && wal_receiver_active(receiver) && time(NULL) - receiver->retry >= WAL_RECEIVER_RETRY)
    {
-      return NULL;
-   }
-   char* path = NULL;
-   FILE* file = NULL;
-   path = pgmoneta_append(path, root);
-   if (!pgmoneta_ends_with(path, "/"))
-   {
-      path = pgmoneta_append(path, "/");
-   }
-
-   path = pgmoneta_append(path, filename);
-   path = pgmoneta_append(path, ".partial");
+      receiver->retry = time(NULL);
 
-   if (pgmoneta_exists(path))
-   {
-      // file alreay exists, check if it's padded already
-      size_t size = pgmoneta_get_file_size(path);
-      if (size == (size_t)segsize)
+      for (int i = 0; i < receiver->number_of_streams; i++)
       {
-         file = fopen(path, "r+b");
-         if (file == NULL)
+         if (receiver->streams[i] == NULL && !receiver->connecting[i] &&
+             config->common.servers[receiver->servers[i]].wal_receiver == receiver->number &&
+             pgmoneta_wal_should_stream(receiver->servers[i]))
          {
-            pgmoneta_log_error("WAL error: %s", strerror(errno));
-            errno = 0;
-            goto error;
+            wal_receiver_add(receiver, i);
          }
-         pgmoneta_permission(path, 6, 0, 0);
-
-         free(path);
-         return file;
       }
-      if (size != 0)
-      {
-         // corrupted file
-         pgmoneta_log_error("WAL file corrupted: %s", path);
-         goto error;
-      }
-   }
-
-   file = fopen(path, "wb");
-
-   if (file == NULL)
-   {
-      pgmoneta_log_error("WAL error: %s", strerror(errno));
-      errno = 0;
-      goto error;
    }
 
-   if (wal_prepare(file, segsize))
+   if (!config->running || !wal_receiver_active(receiver))
    {
-      goto error;
+      ev_break(loop, EVBREAK_ALL);
    }
+}
 
-   pgmoneta_permission(path, 6, 0, 0);
-
-   free(path);
-   return file;
+static void
+wal_receiver_flush_cb(struct ev_loop* loop, struct ev_timer* watcher __attribute__((unused)), int revents __attribute__((unused)))
+{
+   struct wal_receiver* receiver = (struct wal_receiver*)ev_userdata(loop);
 
-error:
-   if (file != NULL)
+   for (int i = 0; i < receiver->number_of_streams; i++)
    {
-      fclose(file);
+      if (receiver->streams[i] != NULL && wal_stream_flush_due(receiver->streams[i]))
+      {
+         wal_receiver_remove(loop, receiver->streams[i], true);
+      }
    }
-   free(path);
-   return NULL;
 }
 
 static int
-wal_close(char* root, char* filename, bool partial, FILE* file)
+wal_read_replication_slot(SSL* ssl, int socket, char* slot, char* name, int segsize, uint32_t* high32, uint32_t* low32, uint32_t* timeline)
 {
-   if (file == NULL || root == NULL || filename == NULL || strlen(root) == 0 || strlen(filename) == 0)
-   {
-      return 1;
-   }
-   char tmp_file_path[MAX_PATH] = {0};
-   char file_path[MAX_PATH] = {0};
+   struct message* read_slot_msg = NULL;
+   struct query_response* read_slot_response = NULL;
+   char* lsn = NULL;
+   int status = 0;
+   uint32_t tli = 0;
 
-   if (partial)
+   *high32 = 0;
+   *low32 = 0;
+   *timeline = 0;
+
+   pgmoneta_create_read_replication_slot_message(slot, &read_slot_msg);
+   status = pgmoneta_query_execute(ssl, socket, read_slot_msg, &read_slot_response);
+
+   if (status != 0)
    {
-      pgmoneta_log_info("Not renaming %s.partial, this segment is incomplete", filename);
-      fclose(file);
-      return 0;
+      pgmoneta_log_debug("Error occurred when executing READ_REPLICATION_SLOT for slot %s on server %s", slot, name);
+      goto error;
    }
 
-   if (pgmoneta_ends_with(root, "/"))
+   if (read_slot_response == NULL || read_slot_response->number_of_columns < 3)
    {
-      snprintf(tmp_file_path, sizeof(tmp_file_path), "%s%s.partial", root, filename);
-      snprintf(file_path, sizeof(file_path), "%s%s", root, filename);
+      pgmoneta_log_debug("Invalid response from READ_REPLICATION_SLOT for slot %s on server %s", slot, name);
+      goto error;
    }
-   else
+
+   tli = pgmoneta_atoi(pgmoneta_query_response_get_data(read_slot_response, 2));
+   if (tli < 1)
    {
-      snprintf(tmp_file_path, sizeof(tmp_file_path), "%s/%s.partial", root, filename);
-      snprintf(file_path, sizeof(file_path), "%s/%s", root, filename);
+      pgmoneta_log_debug("wal_read_replication_slot: timeline is %d, expecting 1 for server %s", tli, name);
+      goto error;
    }
-   if (rename(tmp_file_path, file_path) != 0)
+
+   lsn = pgmoneta_query_response_get_data(read_slot_response, 1);
+   if (wal_convert_xlogpos(lsn, segsize, high32, low32))
    {
-      pgmoneta_log_error("could not rename file %s to %s", tmp_file_path, file_path);
+      pgmoneta_log_debug("wal_read_replication_slot: failed to convert LSN from replication slot %s on server %s", slot, name);
       goto error;
    }
 
-   fclose(file);
+   *timeline = tli;
+
+   pgmoneta_free_query_response(read_slot_response);
+   pgmoneta_free_message(read_slot_msg);
 
    return 0;
 
 error:
-   fclose(file);
+   pgmoneta_free_query_response(read_slot_response);
+   pgmoneta_free_message(read_slot_msg);
    return 1;
 }
 
-static int
-wal_prepare(FILE* file, int segsize)
+static void
+update_wal_lsn(int srv, size_t xlogptr)
 {
-   char buffer[8192] = {0};
-   size_t written = 0;
+   struct main_configuration* config = (struct main_configuration*) shmem;
+   uint32_t low32 = xlogptr & 0xffffffff;
+   uint32_t high32 = xlogptr >> 32 & 0xffffffff;
+   memset(config->common.servers[srv].current_wal_lsn, 0, MISC_LENGTH);
+   snprintf(config->common.servers[srv].current_wal_lsn, MISC_LENGTH, "%X/%X", high32, low32);
+}
 
-   if (file == NULL)
+int
+pgmoneta_wal_trim(char* path)
+{
+   int fd = -1;
+   struct stat st;
+   struct xlog_long_page_header_data header;
+   struct xlog_page_header_data* page = NULL;
+   char* buffer = NULL;
+   size_t buffer_size;
+   size_t used = 0;
+   bool end = false;
+
+   fd = open(path, O_RDWR);
+   if (fd == -1)
    {
-      return 1;
+      goto error;
    }
 
-   while (written < (size_t)segsize)
+   if (fstat(fd, &st) || wal_read_long_header(fd, &header))
    {
-      written += fwrite(buffer, 1, sizeof(buffer), file);
+      goto error;
    }
 
-   fflush(file);
-   if (fseek(file, 0, SEEK_SET) != 0)
+   // only complete segments are trimmed, a short file is already trimmed
+   if ((size_t)st.st_size != header.xlp_seg_size)
    {
-      pgmoneta_log_error("WAL error: %s", strerror(errno));
-      errno = 0;
-      return 1;
+      close(fd);
+      return 0;
    }
-   return 0;
-}
-
-static int
-wal_send_status_report(SSL* ssl, int socket, int64_t received, int64_t flushed, int64_t applied)
-{
-   struct message* status_report_msg = NULL;
-   pgmoneta_create_standby_status_update_message(received, flushed, applied, &status_report_msg);
 
-   if (pgmoneta_write_message(ssl, socket, status_report_msg) != MESSAGE_STATUS_OK)
+   buffer_size = 64 * (size_t)header.xlp_xlog_blcksz;
+   buffer = malloc(buffer_size);
+   if (buffer == NULL)
    {
       goto error;
    }
-   pgmoneta_free_message(status_report_msg);
-   return 0;
 
-error:
-   pgmoneta_free_message(status_report_msg);
-   return 1;
-}
+   // a page is used when its header continues the segment, the zero fill
+   // of wal_prepare() has no magic and a stale page has the wrong address
+   while (!end && used < header.xlp_seg_size)
+   {
+      ssize_t r = pread(fd, buffer, buffer_size, used);
 
-static int
-wal_xlog_offset(size_t xlogptr, int segsize)
-{
-   // this function assumes that segsize is a power of 2
-   return xlogptr & (segsize - 1);
-}
+      if (r <= 0)
+      {
+         goto error;
+      }
 
-static int
-wal_convert_xlogpos(char* xlogpos, int segsize, uint32_t* high32, uint32_t* low32)
-{
-   char* ptr = NULL;
-   int num = 0;
-   if (xlogpos == NULL || !pgmoneta_contains(xlogpos, "/"))
+      for (size_t offset = 0; offset + header.xlp_xlog_blcksz <= (size_t)r; offset += header.xlp_xlog_blcksz)
+      {
+         page = (struct xlog_page_header_data*)(buffer + offset);
+
+         if (page->xlp_magic != header.std.xlp_magic ||
+             page->xlp_pageaddr != header.std.xlp_pageaddr + used)
+         {
+            end = true;
+            break;
+         }
+
+         used += header.xlp_xlog_blcksz;
+      }
+   }
+
+   if (used < header.xlp_seg_size)
    {
-      pgmoneta_log_error("WAL unable to convert xlogpos");
-      return 1;
+      if (ftruncate(fd, used))
+      {
+         goto error;
+      }
+      pgmoneta_log_trace("WAL: Trimmed %s to %zu bytes", path, used);
    }
-   ptr = strtok(xlogpos, "/");
-   sscanf(ptr, "%x", &num);
-   *high32 = num;
 
-   ptr = strtok(NULL, "/");
-   sscanf(ptr, "%x", &num);
-   // discard in-segment offset
-   *low32 = num & (~(segsize - 1));
+   free(buffer);
+   close(fd);
+
    return 0;
+
+error:
+   pgmoneta_log_debug("WAL: Could not trim %s", path);
+
+   free(buffer);
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   return 1;
 }
 
-// this function assumes basedir only contains wal segments and .history files
-static int
-wal_find_streaming_start(char* basedir, int segsize, uint32_t* timeline, uint32_t* high32, uint32_t* low32)
+int
+pgmoneta_wal_pad(char* path)
 {
-   char* segname = NULL;
-   char* pos = NULL;
-   DIR* dir;
-   struct dirent* entry;
-   bool high_is_partial = false;
-   bool is_partial = false;
-
-   dir = opendir(basedir);
+   int fd = -1;
+   struct stat st;
+   struct xlog_long_page_header_data header;
 
-   if (dir == NULL)
+   fd = open(path, O_RDWR);
+   if (fd == -1)
    {
-      pgmoneta_log_error("Could not open wal base directory %s", basedir);
       goto error;
    }
 
-   // read the wal directory, get the latest wal segment
-   while ((entry = readdir(dir)) != NULL)
+   if (fstat(fd, &st))
    {
-      // we only care about files
-      if (entry->d_type != DT_REG)
-      {
-         continue;
-      }
-      // ignore history files here
-      if (pgmoneta_ends_with(entry->d_name, ".history"))
-      {
-         continue;
-      }
-      // find the latest wal segments
-      // By latest we mean it has a larger xlogpos. If the xlogpos is the same(unlikely),
-      // the one that's not partial is more up-to-date
-      is_partial = pgmoneta_ends_with(entry->d_name, ".partial");
-      if (segname == NULL || strcmp(entry->d_name, segname) > 0 || (strcmp(entry->d_name, segname) == 0 && !is_partial))
-      {
-         segname = entry->d_name;
-         high_is_partial = is_partial;
-      }
+      goto error;
    }
-   if (segname == NULL)
+
+   // nothing to pad without a valid long page header
+   if (wal_read_long_header(fd, &header))
    {
-      *timeline = 0;
-      *high32 = 0;
-      *low32 = 0;
-      closedir(dir);
+      close(fd);
       return 0;
    }
 
-   // remove the suffix
-   pos = strtok(segname, ".");
-   sscanf(pos, "%08X%08X%08X", timeline, high32, low32);
-
-   // high32 is the segment id, low32 is the number of segments
-   int segments_per_id = 0x100000000ULL / segsize;
-   // if the latest wal segment is partial, we start with this one
-   // otherwise we start with the next one
-   if (!high_is_partial)
+   if ((size_t)st.st_size < header.xlp_seg_size)
    {
-      // handle possible overflow
-      if (*low32 == (uint32_t)segments_per_id)
-      {
-         *low32 = 0;
-         *high32 = *high32 + 1;
-      }
-      else
+      if (st.st_size % header.xlp_xlog_blcksz != 0 || ftruncate(fd, header.xlp_seg_size))
       {
-         *low32 = *low32 + 1;
+         goto error;
       }
+      pgmoneta_log_trace("WAL: Padded %s from %zu bytes", path, (size_t)st.st_size);
    }
-   *low32 *= segsize;
 
-   closedir(dir);
+   close(fd);
+
    return 0;
 
 error:
-   if (dir != NULL)
+   pgmoneta_log_debug("WAL: Could not pad %s", path);
+
+   if (fd != -1)
    {
-      closedir(dir);
+      close(fd);
    }
+
    return 1;
 }
 
-static int
+int
+pgmoneta_wal_pad_file(char* path)
+{
+   char* name = NULL;
+
+   name = strrchr(path, '/');
+   name = name != NULL ? name + 1 : path;
+
+   if (!pgmoneta_is_wal_file(name))
+   {
+      return 0;
+   }
+
+   return pgmoneta_wal_pad(path);
+}
+
+int
+pgmoneta_get_timeline_history(int srv, uint32_t tli, struct timeline_history** history)
+{
+   struct timeline_history* h = NULL;
+   struct timeline_history* curh = NULL;
+   struct timeline_history* nexth = NULL;
+   char filename[MISC_LENGTH];
+   char* path = NULL;
+   char buffer[MAX_PATH];
+   int numfields = 0;
+   FILE* file = NULL;
+
+   if (tli == 1)
+   {
+      return 0;
+   }
+
+   snprintf(filename, sizeof(filename), "%08X.history", tli);
+   path = pgmoneta_get_server_wal(srv);
+   path = pgmoneta_append(path, filename);
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      pgmoneta_log_error("Unable to open history file: %s", strerror(errno));
+      goto error;
+   }
+   memset(buffer, 0, sizeof(buffer));
+   while (fgets(buffer, sizeof(buffer), file) != NULL)
+   {
+      char* ptr = buffer;
+      // ignore empty spaces
+      while (*ptr != '\0' && isspace(*ptr))
+      {
+         ptr++;
+      }
+      // ignore empty lines and comments
+      if (*ptr == '\0' || *ptr == '#')
+      {
+         continue;
+      }
+      nexth = (struct timeline_history*) malloc(sizeof(struct timeline_history));
+
+      if (nexth == NULL)
+      {
+         goto error;
+      }
+
+      memset(nexth, 0, sizeof(struct timeline_history));
+      if (h == NULL)
+      {
+         curh = nexth;
+         h = curh;
+      }
+      else
+      {
+         curh->next = nexth;
+         curh = curh->next;
+      }
+      numfields = sscanf(ptr, "%u\t%X/%X", &curh->parent_tli, &curh->switchpos_hi, &curh->switchpos_lo);
+      if (numfields != 3)
+      {
+         pgmoneta_log_error("error parsing history file %s", filename);
+         goto error;
+      }
+      memset(buffer, 0, sizeof(buffer));
+   }
+
+   *history = h;
+
+   free(path);
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   return 0;
+
+error:
+   free(path);
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   pgmoneta_free_timeline_history(h);
+   return 1;
+}
+
+void
+pgmoneta_free_timeline_history(struct timeline_history* history)
+{
+   struct timeline_history* h = history;
+   while (h != NULL)
+   {
+      struct timeline_history* next = h->next;
+      free(h);
+      h = next;
+   }
+}
+
+static char*
+wal_file_name(uint32_t timeline, size_t segno, int segsize)
+{
+   char hex[128];
+   char* f = NULL;
+
+   memset(&hex[0], 0, sizeof(hex));
+   int segments_per_id = 0x100000000ULL / segsize;
+   int seg_id = segno / segments_per_id;
+   int seg_offset = segno % segments_per_id;
+
+   snprintf(&hex[0], sizeof(hex), "%08X%08X%08X", timeline, seg_id, seg_offset);
+   f = pgmoneta_append(f, hex);
+   return f;
+}
+
+static int
+wal_fetch_history(char* basedir, int timeline, SSL* ssl, int socket)
+{
+   struct message* timeline_history_msg = NULL;
+   struct query_response* timeline_history_response = NULL;
+   FILE* history_file = NULL;
+   char* history_content = NULL;
+   char path[MAX_PATH];
+
+   if (basedir == NULL || strlen(basedir) == 0 || !pgmoneta_exists(basedir))
+   {
+      pgmoneta_log_error("base directory for history file does not exist");
+      goto error;
+   }
+
+   memset(path, 0, sizeof(path));
+   if (pgmoneta_ends_with(basedir, "/"))
+   {
+      snprintf(path, sizeof(path), "%s%08x.history", basedir, timeline);
+   }
+
+   // do nothing if the corresponding .history already exists, or current timeline is 1
+   if (timeline == 1 || pgmoneta_exists(path))
+   {
+      return 0;
+   }
+
+   pgmoneta_create_timeline_history_message(timeline, &timeline_history_msg);
+   if (pgmoneta_query_execute(ssl, socket, timeline_history_msg, &timeline_history_response))
+   {
+      pgmoneta_log_error("Error occurred when executing TIMELINE_HISTORY %d", timeline);
+      goto error;
+   }
+
+   history_content = pgmoneta_query_response_get_data(timeline_history_response, 1);
+
+   history_file = fopen(path, "wb");
+   if (history_file == NULL)
+   {
+      goto error;
+   }
+   fwrite(history_content, 1, strlen(history_content) + 1, history_file);
+   fflush(history_file);
+
+   pgmoneta_free_message(timeline_history_msg);
+   pgmoneta_free_query_response(timeline_history_response);
+   if (history_file != NULL)
+   {
+      fclose(history_file);
+   }
+   return 0;
+
+error:
+   pgmoneta_free_message(timeline_history_msg);
+   pgmoneta_free_query_response(timeline_history_response);
+   if (history_file != NULL)
+   {
+      fclose(history_file);
+   }
+   return 1;
+}
+
+static struct async_file*
+wal_open(struct async_io* io, char* root, char* filename, int segsize, struct wal_pool* pool)
+{
+   if (root == NULL || strlen(root) == 0 || !pgmoneta_exists(root))
+   {
+      return NULL;
+   }
+   char* path = NULL;
+   struct async_file* file = NULL;
+   path = pgmoneta_append(path, root);
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append(path, "/");
+   }
+
+   path = pgmoneta_append(path, filename);
+   path = pgmoneta_append(path, ".partial");
+
+   if (pgmoneta_exists(path))
+   {
+      // file alreay exists, check if it's padded already
+      size_t size = pgmoneta_get_file_size(path);
+      if (size == (size_t)segsize)
+      {
+         if (pgmoneta_async_io_open(io, path, O_RDWR, 0600, NULL, NULL, &file))
+         {
+            pgmoneta_log_error("WAL error: %s", strerror(errno));
+            errno = 0;
+            goto error;
+         }
+         pgmoneta_permission(path, 6, 0, 0);
+         pgmoneta_wal_index_add(path);
+
+         free(path);
+         return file;
+      }
+      if (size != 0)
+      {
+         // corrupted file
+         pgmoneta_log_error("WAL file corrupted: %s", path);
+         goto error;
+      }
+   }
+
+   // a preallocated segment only has to be renamed
+   if (!wal_pool_take(pool, path))
+   {
+      if (pgmoneta_async_io_open(io, path, O_WRONLY, 0600, NULL, NULL, &file))
+      {
+         pgmoneta_log_error("WAL error: %s", strerror(errno));
+         errno = 0;
+         goto error;
+      }
+      pgmoneta_permission(path, 6, 0, 0);
+      pgmoneta_wal_index_add(path);
+
+      free(path);
+      return file;
+   }
+
+   if (pgmoneta_async_io_open(io, path, O_WRONLY | O_CREAT | O_TRUNC, 0600, NULL, NULL, &file))
+   {
+      pgmoneta_log_error("WAL error: %s", strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   if (wal_prepare(file, segsize))
+   {
+      goto error;
+   }
+
+   pgmoneta_permission(path, 6, 0, 0);
+   pgmoneta_wal_index_add(path);
+
+   free(path);
+   return file;
+
+error:
+   pgmoneta_async_io_close(file);
+   free(path);
+   return NULL;
+}
+
+static int
+wal_close(char* root, char* filename, bool partial, struct async_file* file)
+{
+   if (file == NULL || root == NULL || filename == NULL || strlen(root) == 0 || strlen(filename) == 0)
+   {
+      return 1;
+   }
+   char tmp_file_path[MAX_PATH] = {0};
+   char file_path[MAX_PATH] = {0};
+
+   // a completed segment is on stable storage before it is renamed
+   if (!partial && pgmoneta_async_io_fsync(file, true))
+   {
+      pgmoneta_log_error("could not flush WAL file %s", filename);
+      pgmoneta_async_io_close(file);
+      return 1;
+   }
+
+   // all writes of the segment have to land before it is renamed
+   if (pgmoneta_async_io_close(file))
+   {
+      pgmoneta_log_error("could not write WAL file %s", filename);
+      return 1;
+   }
+
+   if (partial)
+   {
+      pgmoneta_log_info("Not renaming %s.partial, this segment is incomplete", filename);
+      return 0;
+   }
+
+   if (pgmoneta_ends_with(root, "/"))
+   {
+      snprintf(tmp_file_path, sizeof(tmp_file_path), "%s%s.partial", root, filename);
+      snprintf(file_path, sizeof(file_path), "%s%s", root, filename);
+   }
+   else
+   {
+      snprintf(tmp_file_path, sizeof(tmp_file_path), "%s/%s.partial", root, filename);
+      snprintf(file_path, sizeof(file_path), "%s/%s", root, filename);
+   }
+   if (rename(tmp_file_path, file_path) != 0)
+   {
+      pgmoneta_log_error("could not rename file %s to %s", tmp_file_path, file_path);
+      goto error;
+   }
+
+   pgmoneta_wal_index_add(file_path);
+
+   return 0;
+
+error:
+   return 1;
+}
+
+static int
+wal_prepare(struct async_file* file, int segsize)
+{
+   char buffer[8192] = {0};
+   size_t written = 0;
+
+   if (file == NULL)
+   {
+      return 1;
+   }
+
+   while (written < (size_t)segsize)
+   {
+      if (pgmoneta_async_io_write(file, buffer, sizeof(buffer)))
+      {
+         pgmoneta_log_error("WAL error: Could not pad segment");
+         return 1;
+      }
+      written += sizeof(buffer);
+   }
+
+   // wait for the padding, the segment is written from the start again
+   if (pgmoneta_async_io_seek(file, 0))
+   {
+      pgmoneta_log_error("WAL error: Could not pad segment");
+      return 1;
+   }
+   return 0;
+}
+
+static int
+wal_send_status_report(SSL* ssl, int socket, int64_t received, int64_t flushed, int64_t applied)
+{
+   struct message* status_report_msg = NULL;
+   pgmoneta_create_standby_status_update_message(received, flushed, applied, &status_report_msg);
+
+   if (pgmoneta_write_message(ssl, socket, status_report_msg) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+   pgmoneta_free_message(status_report_msg);
+   return 0;
+
+error:
+   pgmoneta_free_message(status_report_msg);
+   return 1;
+}
+
+static int
+wal_flush(SSL* ssl, int socket, struct stream_buffer* buffer, struct async_file* file, bool force, struct wal_flush_state* state)
+{
+   struct timespec now;
+   double elapsed;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (file == NULL || state->received <= state->flushed)
+   {
+      return 0;
+   }
+
+   if (!force && config->wal_flush == WAL_FLUSH_GROUP)
+   {
+      wal_clock(&now);
+      elapsed = pgmoneta_compute_duration(state->since, now) * 1000.0;
+
+      // group commit, unless the server has nothing more for us right now
+      if (elapsed < config->wal_flush_delay &&
+          (config->wal_flush_size == 0 || state->received - state->flushed < (size_t)config->wal_flush_size) &&
+          !wal_stream_idle(ssl, socket, buffer))
+      {
+         return 0;
+      }
+   }
+
+   if (pgmoneta_async_io_fsync(file, true))
+   {
+      return 1;
+   }
+
+   state->flushed = state->received;
+   wal_clock(&state->since);
+
+   return 0;
+}
+
+static int
+wal_report(SSL* ssl, int socket, bool force, struct wal_flush_state* state)
+{
+   if (!force && state->flushed == state->reported)
+   {
+      return 0;
+   }
+
+   if (wal_send_status_report(ssl, socket, state->received, state->flushed, 0))
+   {
+      return 1;
+   }
+
+   state->reported = state->flushed;
+
+   return 0;
+}
+
+static bool
+wal_stream_idle(SSL* ssl, int socket, struct stream_buffer* buffer)
+{
+   struct pollfd pfd;
+
+   // the message being handled is still in the buffer, anything past it is pending
+   if (buffer->cursor < buffer->end &&
+       buffer->cursor + 1 + (size_t)pgmoneta_read_int32(buffer->buffer + buffer->cursor + 1) < buffer->end)
+   {
+      return false;
+   }
+
+   if (ssl != NULL && SSL_pending(ssl) > 0)
+   {
+      return false;
+   }
+
+   pfd.fd = socket;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   return poll(&pfd, 1, 0) == 0;
+}
+
+static int
+wal_flush_remaining(struct async_file* file, struct wal_flush_state* state)
+{
+   struct timespec now;
+   double elapsed;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->wal_flush != WAL_FLUSH_GROUP || file == NULL || state->received <= state->flushed)
+   {
+      return -1;
+   }
+
+   wal_clock(&now);
+   elapsed = pgmoneta_compute_duration(state->since, now) * 1000.0;
+
+   if (elapsed >= config->wal_flush_delay)
+   {
+      return 0;
+   }
+
+   return (int)(config->wal_flush_delay - elapsed) + 1;
+}
+
+static int
+wal_stream_flush_due(struct wal_stream* stream)
+{
+   if (wal_flush_remaining(stream->wal_file, &stream->flush) != 0)
+   {
+      return 0;
+   }
+
+   if (wal_flush(stream->ssl, stream->socket, stream->buffer, stream->wal_file, true, &stream->flush))
+   {
+      return 1;
+   }
+
+   return wal_report(stream->ssl, stream->socket, false, &stream->flush);
+}
+
+static int
+wal_stream_wait(struct wal_stream* stream)
+{
+   int timeout;
+   struct pollfd pfd;
+
+   // a group flush is due after the delay, also when no more WAL arrives to trigger it
+   timeout = wal_flush_remaining(stream->wal_file, &stream->flush);
+   if (timeout < 0 || stream->buffer->cursor < stream->buffer->end ||
+       (stream->ssl != NULL && SSL_pending(stream->ssl) > 0))
+   {
+      return 0;
+   }
+
+   pfd.fd = stream->socket;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   if (timeout > 0 && poll(&pfd, 1, timeout) != 0)
+   {
+      return 0;
+   }
+
+   return wal_stream_flush_due(stream);
+}
+
+static void
+wal_clock(struct timespec* t)
+{
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, t);
+#endif
+}
+
+static int
+wal_xlog_offset(size_t xlogptr, int segsize)
+{
+   // this function assumes that segsize is a power of 2
+   return xlogptr & (segsize - 1);
+}
+
+static int
+wal_convert_xlogpos(char* xlogpos, int segsize, uint32_t* high32, uint32_t* low32)
+{
+   char* ptr = NULL;
+   int num = 0;
+   if (xlogpos == NULL || !pgmoneta_contains(xlogpos, "/"))
+   {
+      pgmoneta_log_error("WAL unable to convert xlogpos");
+      return 1;
+   }
+   ptr = strtok(xlogpos, "/");
+   sscanf(ptr, "%x", &num);
+   *high32 = num;
+
+   ptr = strtok(NULL, "/");
+   sscanf(ptr, "%x", &num);
+   // discard in-segment offset
+   *low32 = num & (~(segsize - 1));
+   return 0;
+}
+
+// this function assumes basedir only contains wal segments and .history files
+static int
+wal_find_streaming_start(char* basedir, int segsize, uint32_t* timeline, uint32_t* high32, uint32_t* low32)
+{
+   char* segname = NULL;
+   char* pos = NULL;
+   DIR* dir;
+   struct dirent* entry;
+   bool high_is_partial = false;
+   bool is_partial = false;
+
+   dir = opendir(basedir);
+
+   if (dir == NULL)
+   {
+      pgmoneta_log_error("Could not open wal base directory %s", basedir);
+      goto error;
+   }
+
+   // read the wal directory, get the latest wal segment
+   while ((entry = readdir(dir)) != NULL)
+   {
+      // we only care about files
+      if (entry->d_type != DT_REG)
+      {
+         continue;
+      }
+      // ignore history files here
+      if (pgmoneta_ends_with(entry->d_name, ".history"))
+      {
+         continue;
+      }
+      // find the latest wal segments
+      // By latest we mean it has a larger xlogpos. If the xlogpos is the same(unlikely),
+      // the one that's not partial is more up-to-date
+      is_partial = pgmoneta_ends_with(entry->d_name, ".partial");
+      if (segname == NULL || strcmp(entry->d_name, segname) > 0 || (strcmp(entry->d_name, segname) == 0 && !is_partial))
+      {
+         segname = entry->d_name;
+         high_is_partial = is_partial;
+      }
+   }
+   if (segname == NULL)
+   {
+      *timeline = 0;
+      *high32 = 0;
+      *low32 = 0;
+      closedir(dir);
+      return 0;
+   }
+
+   // remove the suffix
+   pos = strtok(segname, ".");
+   sscanf(pos, "%08X%08X%08X", timeline, high32, low32);
+
+   // high32 is the segment id, low32 is the number of segments
+   int segments_per_id = 0x100000000ULL / segsize;
+   // if the latest wal segment is partial, we start with this one
+   // otherwise we start with the next one
+   if (!high_is_partial)
+   {
+      // handle possible overflow
+      if (*low32 == (uint32_t)segments_per_id)
+      {
+         *low32 = 0;
+         *high32 = *high32 + 1;
+      }
+      else
+      {
+         *low32 = *low32 + 1;
+      }
+   }
+   *low32 *= segsize;
+
+   closedir(dir);
+   return 0;
+
+error:
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+   return 1;
+}
+
+static int
 wal_shipping_setup(int srv, char** wal_shipping)
 {
-   char* ws = NULL;
-   ws = pgmoneta_get_server_wal_shipping_wal(srv);
-   if (ws != NULL)
+   char* ws = NULL;
+   ws = pgmoneta_get_server_wal_shipping_wal(srv);
+   if (ws != NULL)
+   {
+      if (pgmoneta_mkdir(ws))
+      {
+         *wal_shipping = NULL;
+         return 1;
+      }
+      *wal_shipping = ws;
+      return 0;
+   }
+   *wal_shipping = NULL;
+   return 0;
+}
+
+int
+pgmoneta_read_mappings_from_json(char* mappings_path)
+{
+   struct json* root = NULL;
+   struct json* section = NULL;
+   struct json_iterator* iter = NULL;
+   int total_entries = 0;
+   int index = 0;
+   char* oid_str;
+   int oid;
+   object_type current_type;
+   char* sections[] = {"tablespaces", "databases", "relations"};
+
+   if (pgmoneta_json_read_file(mappings_path, &root))
+   {
+      pgmoneta_log_error("Failed to read mappings file: %s", mappings_path);
+      goto error;
+   }
+
+   for (int i = 0; i < 3; i++)
+   {
+      section = (struct json*)pgmoneta_json_get(root, sections[i]);
+      if (section && section->type == JSONItem)
+      {
+         struct art* art_tree = (struct art*)section->elements;
+         total_entries += art_tree->size;
+      }
+   }
+
+   oidMappings = (oid_mapping*)malloc(total_entries * sizeof(oid_mapping));
+   if (!oidMappings)
+   {
+      pgmoneta_log_error("Memory allocation failed");
+      goto error;
+   }
+
+   for (int i = 0; i < 3; i++)
+   {
+      current_type = (object_type)i;
+      section = (struct json*)pgmoneta_json_get(root, sections[i]);
+      if (section && section->type == JSONItem)
+      {
+         pgmoneta_json_iterator_create(section, &iter);
+         while (pgmoneta_json_iterator_next(iter))
+         {
+            char* name = iter->key;
+            oid_str = (char*)iter->value->data;
+            oid = (int)strtol(oid_str, NULL, 10);
+
+            oidMappings[index].oid = oid;
+            oidMappings[index].type = current_type;
+            oidMappings[index].name = strdup(name);
+            index++;
+         }
+         pgmoneta_json_iterator_destroy(iter);
+      }
+   }
+
+   mappings_size = total_entries;
+   pgmoneta_json_destroy(root);
+   enable_translation = true;
+
+   return 0;
+
+error:
+   pgmoneta_json_destroy(root);
+   return 1;
+}
+
+int
+pgmoneta_read_mappings_from_server(int server_index)
+{
+   struct query_response* qr = NULL;
+   struct message* query_msg = NULL;
+   struct tuple* tuple = NULL;
+   char* name = NULL;
+   char* oid_str = NULL;
+   unsigned int oid;
+   int count;
+   struct walinfo_configuration* config = NULL;
+   int user_index = -1;
+   int auth;
+   SSL* ssl = NULL;
+   int socket = -1;
+   int len = 0;
+   char* section_names[] = {"tablespaces", "databases", "relations"};
+   object_type types[] = {OBJ_TABLESPACE, OBJ_DATABASE, OBJ_RELATION};
+   char* queries[] = {
+      "SELECT spcname, oid FROM pg_tablespace",
+      "SELECT datname, oid FROM pg_database",
+      "SELECT nspname || '.' || relname, c.oid FROM pg_class c JOIN pg_namespace n ON c.relnamespace = n.oid"
+   };
+
+   config = (struct walinfo_configuration*)shmem;
+   pgmoneta_memory_init();
+
+   for (int i = 0; i < config->common.number_of_users; i++)
+   {
+      if (strcmp(config->common.users[i].username, config->common.servers[server_index].username) == 0)
+      {
+         user_index = i;
+         break;
+      }
+   }
+
+   if (user_index == -1)
+   {
+      pgmoneta_log_error("User %s not found", config->common.servers[server_index].username);
+      goto error;
+   }
+
+   auth = pgmoneta_server_authenticate(server_index, "postgres", config->common.users[user_index].username, config->common.users[user_index].password, false, &ssl, &socket);
+
+   if (auth != AUTH_SUCCESS)
+   {
+      pgmoneta_log_error("Authentication failed for user %s on %s", config->common.users[user_index].username, config->common.servers[server_index].name);
+      goto error;
+   }
+
+   len = sizeof(queries) / sizeof(queries[0]);
+
+   for (int i = 0; i < len; i++)
+   {
+      query_msg = NULL;
+      if (pgmoneta_create_query_message((char*)queries[i], &query_msg) != MESSAGE_STATUS_OK)
+      {
+         pgmoneta_log_error("Failed to create query message");
+         goto error;
+      }
+
+      if (pgmoneta_query_execute(ssl, socket, query_msg, &qr) != 0 || qr == NULL)
+      {
+         pgmoneta_log_error("Failed to fetch %s", section_names[i]);
+         goto error;
+      }
+
+      if (qr->number_of_columns < 2)
+      {
+         pgmoneta_log_error("Invalid response for %s", section_names[i]);
+         qr = NULL;
+         continue;
+      }
+
+      count = 0;
+      tuple = qr->tuples;
+      while (tuple != NULL)
+      {
+         count++;
+         tuple = tuple->next;
+      }
+
+      oid_mapping* temp = realloc(oidMappings, (mappings_size + count) * sizeof(oid_mapping));
+      if (temp == NULL)
+      {
+         pgmoneta_log_error("Memory allocation failed");
+         goto error;
+      }
+      oidMappings = temp;
+
+      tuple = qr->tuples;
+      while (tuple != NULL)
+      {
+         name = tuple->data[0];
+         oid_str = tuple->data[1];
+         oid = (unsigned int)strtoul(oid_str, NULL, 10);
+
+         oidMappings[mappings_size].type = types[i];
+         oidMappings[mappings_size].oid = oid;
+         oidMappings[mappings_size].name = strdup(name);
+
+         if (oidMappings[mappings_size].name == NULL)
+         {
+            pgmoneta_log_error("Failed to duplicate name");
+            goto error;
+         }
+
+         mappings_size++;
+         tuple = tuple->next;
+      }
+
+      pgmoneta_free_query_response(qr);
+      pgmoneta_free_message(query_msg);
+      qr = NULL;
+   }
+
+   pgmoneta_close_ssl(ssl);
+   pgmoneta_disconnect(socket);
+   pgmoneta_memory_destroy();
+   enable_translation = true;
+
+   return 0;
+
+error:
+   pgmoneta_free_query_response(qr);
+   pgmoneta_free_message(query_msg);
+   pgmoneta_memory_destroy();
+   qr = NULL;
+
+   return 1;
+}
+
+int
+pgmoneta_get_database_name(int oid, char** name)
+{
+   char* temp_name = NULL;
+   int max_digits = 0;
+
+   if (enable_translation)
+   {
+      for (int i = 0; i < mappings_size; i++)
+      {
+         if (oidMappings[i].oid == oid && oidMappings[i].type == OBJ_DATABASE)
+         {
+            temp_name = strdup(oidMappings[i].name);
+            if (temp_name == NULL)
+            {
+               goto error;
+            }
+            break;
+         }
+      }
+   }
+
+   if (temp_name == NULL)
+   {
+      max_digits = snprintf(NULL, 0, "%d", oid) + 1;
+      temp_name = malloc(max_digits);
+
+      if (temp_name == NULL)
+      {
+         goto error;
+      }
+
+      snprintf(temp_name, max_digits, "%d", oid);
+   }
+
+   *name = temp_name;
+   temp_name = NULL;
+
+   return 0;
+
+error:
+   free(temp_name);
+   temp_name = NULL;
+   return 1;
+}
+
+int
+pgmoneta_get_tablespace_name(int oid, char** name)
+{
+   char* temp_name = NULL;
+   int max_digits = 0;
+
+   if (enable_translation)
+   {
+      for (int i = 0; i < mappings_size; i++)
+      {
+         if (oidMappings[i].oid == oid && oidMappings[i].type == OBJ_TABLESPACE)
+         {
+            temp_name = strdup(oidMappings[i].name);
+            if (temp_name == NULL)
+            {
+               goto error;
+            }
+            break;
+         }
+      }
+   }
+
+   if (temp_name == NULL)
+   {
+      max_digits = snprintf(NULL, 0, "%d", oid) + 1;
+      temp_name = malloc(max_digits);
+      if (temp_name == NULL)
+      {
+         goto error;
+      }
+
+      snprintf(temp_name, max_digits, "%d", oid);
+   }
+
+   *name = temp_name;
+   temp_name = NULL;
+
+   return 0;
+
+error:
+   free(temp_name);
+   temp_name = NULL;
+   return 1;
+}
+
+int
+pgmoneta_get_relation_name(int oid, char** name)
+{
+   char* temp_name = NULL;
+   int max_digits = 0;
+
+   if (enable_translation)
+   {
+      for (int i = 0; i < mappings_size; i++)
+      {
+         if (oidMappings[i].oid == oid && oidMappings[i].type == OBJ_RELATION)
+         {
+            temp_name = strdup(oidMappings[i].name);
+            if (temp_name == NULL)
+            {
+               goto error;
+            }
+            break;
+         }
+      }
+   }
+
+   if (temp_name == NULL)
+   {
+      max_digits = snprintf(NULL, 0, "%d", oid) + 1;
+      temp_name = malloc(max_digits);
+      if (temp_name == NULL)
+      {
+         goto error;
+      }
+
+      snprintf(temp_name, max_digits, "%d", oid);
+   }
+
+   *name = temp_name;
+   temp_name = NULL;
+
+   return 0;
+
+error:
+   free(temp_name);
+   temp_name = NULL;
+   return 1;
+}
+
+int
+pgmoneta_get_tablespace_oid(char* name, char** oid)
+{
+   char* temp_oid = NULL;
+   int max_digits = 0;
+
+   if (enable_translation)
+   {
+      for (int i = 0; i < mappings_size; i++)
+      {
+         if (oidMappings[i].type == OBJ_TABLESPACE && !strcmp(oidMappings[i].name, name))
+         {
+            max_digits = snprintf(NULL, 0, "%d", oidMappings[i].oid) + 1;
+            temp_oid = malloc(max_digits);
+            if (temp_oid == NULL)
+            {
+               goto error;
+            }
+            snprintf(temp_oid, max_digits, "%d", oidMappings[i].oid);
+            break;
+         }
+      }
+   }
+
+   if (temp_oid == NULL)
+   {
+      temp_oid = strdup(name);
+      if (temp_oid == NULL)
+      {
+         goto error;
+      }
+   }
+
+   *oid = temp_oid;
+   temp_oid = NULL;
+
+   return 0;
+
+error:
+   free(temp_oid);
+   temp_oid = NULL;
+   return 1;
+}
+
+int
+pgmoneta_get_database_oid(char* name, char** oid)
+{
+   char* temp_oid = NULL;
+   int max_digits = 0;
+
+   if (enable_translation)
    {
-      if (pgmoneta_mkdir(ws))
+      for (int i = 0; i < mappings_size; i++)
       {
-         *wal_shipping = NULL;
-         return 1;
+         if (oidMappings[i].type == OBJ_DATABASE && !strcmp(oidMappings[i].name, name))
+         {
+            max_digits = snprintf(NULL, 0, "%d", oidMappings[i].oid) + 1;
+            temp_oid = malloc(max_digits);
+            if (temp_oid == NULL)
+            {
+               goto error;
+            }
+            snprintf(temp_oid, max_digits, "%d", oidMappings[i].oid);
+            break;
+         }
       }
-      *wal_shipping = ws;
-      return 0;
    }
-   *wal_shipping = NULL;
+
+   if (temp_oid == NULL)
+   {
+      temp_oid = strdup(name);
+      if (temp_oid == NULL)
+      {
+         goto error;
+      }
+   }
+
+   *oid = temp_oid;
+   temp_oid = NULL;
+
    return 0;
+
+error:
+   free(temp_oid);
+   temp_oid = NULL;
+   return 1;
 }
 
 int
-pgmoneta_read_mappings_from_json(char* mappings_path)
+pgmoneta_get_relation_oid(char* name, char** oid)
 {
-   struct json* root = NULL;
-   struct json* section = NULL;
-   struct json_iterator* iter = NULL;
-   int total_entries = 0;
-   int index = 0;
-   char* oid_str;
-   int oid;
-   object_type current_type;
-   char* sections[] = {"tablespaces", "databases", "relations"};
+   char* temp_oid = NULL;
+   int max_digits = 0;
 
-   if (pgmoneta_json_read_file(mappings_path, &root))
+   if (enable_translation)
+   {
+      for (int i = 0; i < mappings_size; i++)
+      {
+         if (oidMappings[i].type == OBJ_RELATION && !strcmp(oidMappings[i].name, name))
+         {
+            max_digits = snprintf(NULL, 0, "%d", oidMappings[i].oid) + 1;
+            temp_oid = malloc(max_digits);
+            if (temp_oid == NULL)
+            {
+               goto error;
+            }
+            snprintf(temp_oid, max_digits, "%d", oidMappings[i].oid);
+            break;
+         }
+      }
+   }
+
+   if (temp_oid == NULL)
+   {
+      temp_oid = strdup(name);
+      if (temp_oid == NULL)
+      {
+         goto error;
+      }
+   }
+
+   *oid = temp_oid;
+   temp_oid = NULL;
+
+   return 0;
+
+error:
+   free(temp_oid);
+   temp_oid = NULL;
+   return 1;
+}
+
+static int
+wal_read_long_header(int fd, struct xlog_long_page_header_data* header)
+{
+   if (pread(fd, header, sizeof(struct xlog_long_page_header_data), 0) != sizeof(struct xlog_long_page_header_data))
+   {
+      return 1;
+   }
+
+   if (header->std.xlp_magic == 0 ||
+       header->xlp_xlog_blcksz < 1024 || header->xlp_xlog_blcksz > 65536 ||
+       (header->xlp_xlog_blcksz & (header->xlp_xlog_blcksz - 1)) != 0 ||
+       header->xlp_seg_size < header->xlp_xlog_blcksz ||
+       (header->xlp_seg_size & (header->xlp_seg_size - 1)) != 0)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static void
+wal_archive(struct workers* archiver, struct wal_pool* pool, int srv, char* root, char* filename)
+{
+   struct wal_archive_input* wai = NULL;
+
+   if (archiver == NULL || filename == NULL || !pgmoneta_is_wal_file(filename))
+   {
+      return;
+   }
+
+   wai = (struct wal_archive_input*)malloc(sizeof(struct wal_archive_input));
+   if (wai == NULL)
+   {
+      return;
+   }
+
+   memset(wai, 0, sizeof(struct wal_archive_input));
+
+   wai->common.workers = archiver;
+   wai->server = srv;
+   wai->pool = pool;
+   snprintf(wai->directory, sizeof(wai->directory), "%s", root);
+   snprintf(wai->filename, sizeof(wai->filename), "%s", filename);
+
+   // Left for the periodic sweep when it can't be queued
+   if (pgmoneta_workers_add(archiver, do_wal_archive, (struct worker_common*)wai))
+   {
+      free(wai);
+   }
+}
+
+static void
+do_wal_archive(struct worker_common* wc)
+{
+   bool active = false;
+   struct wal_archive_input* wai = (struct wal_archive_input*)wc;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   // Backups, retention and the periodic sweep own the repository while they run,
+   // the segment is picked up by the sweep instead
+   if (!atomic_compare_exchange_strong(&config->common.servers[wai->server].repository, &active, true))
+   {
+      pgmoneta_log_debug("WAL archiver: %s is left for the sweep", wai->filename);
+      free(wai);
+      return;
+   }
+
+   if (wal_archive_segment(wai->server, wai->directory, wai->filename, wai->pool))
+   {
+      pgmoneta_log_warn("WAL archiver: %s is left for the sweep", wai->filename);
+   }
+
+   atomic_store(&config->common.servers[wai->server].repository, false);
+
+   free(wai);
+}
+
+static int
+wal_archive_segment(int srv, char* directory, char* filename, struct wal_pool* pool)
+{
+   char from[MAX_PATH];
+   char to[MAX_PATH];
+   char* suffix = NULL;
+   int type = -1;
+   int level;
+   int ret;
+   uint32_t dictionary = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   level = config->compression_level;
+
+   switch (config->compression_type)
+   {
+      case COMPRESSION_CLIENT_GZIP:
+      case COMPRESSION_SERVER_GZIP:
+         type = COMPRESSION_CLIENT_GZIP;
+         suffix = ".gz";
+         level = MAX(1, MIN(level, 9));
+         break;
+      case COMPRESSION_CLIENT_ZSTD:
+      case COMPRESSION_SERVER_ZSTD:
+         type = COMPRESSION_CLIENT_ZSTD;
+         suffix = ".zstd";
+         break;
+      case COMPRESSION_CLIENT_LZ4:
+      case COMPRESSION_SERVER_LZ4:
+         type = COMPRESSION_CLIENT_LZ4;
+         suffix = ".lz4";
+         level = 0;
+         break;
+      case COMPRESSION_CLIENT_BZIP2:
+         type = COMPRESSION_CLIENT_BZIP2;
+         suffix = ".bz2";
+         level = MAX(1, MIN(level, 9));
+         break;
+      default:
+         suffix = "";
+         break;
+   }
+
+   snprintf(from, sizeof(from), "%s/%s", directory, filename);
+   snprintf(to, sizeof(to), "%s/%s%s", directory, filename, suffix);
+
+   if (!pgmoneta_exists(from))
+   {
+      // Already handled by the sweep
+      return 0;
+   }
+
+   if (type != -1)
+   {
+      // the zero-filled tail is restored by pgmoneta_wal_pad()
+      pgmoneta_wal_trim(from);
+
+      if (type == COMPRESSION_CLIENT_ZSTD && config->compression_dictionary)
+      {
+         pgmoneta_dictionary_train(srv, DICTIONARY_TYPE_WAL, directory);
+         ret = pgmoneta_codec_dictionary_file(DICTIONARY_TYPE_WAL, level, from, to, &dictionary);
+      }
+      else
+      {
+         ret = pgmoneta_codec_file(type, true, level, from, to);
+      }
+
+      if (ret)
+      {
+         pgmoneta_log_error("WAL archiver: Could not compress %s", from);
+         pgmoneta_delete_file(to, NULL);
+         goto error;
+      }
+
+      // the compressed segment is the archive copy, so its file can back a new segment
+      if (wal_pool_recycle(pool, from))
+      {
+         pgmoneta_delete_file(from, NULL);
+      }
+      pgmoneta_permission(to, 6, 0, 0);
+      pgmoneta_wal_index_add(to);
+
+      memcpy(from, to, sizeof(from));
+   }
+
+   if (config->encryption != ENCRYPTION_NONE)
+   {
+      snprintf(to, sizeof(to), "%s.aes", from);
+
+      if (pgmoneta_encrypt_file(from, to))
+      {
+         pgmoneta_log_error("WAL archiver: Could not encrypt %s", from);
+         goto error;
+      }
+
+      pgmoneta_permission(to, 6, 0, 0);
+      pgmoneta_wal_index_add(to);
+   }
+
+   pgmoneta_log_trace("WAL archiver: %s", to);
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+wal_pool_create(char* directory, int segsize, struct wal_pool** pool)
+{
+   DIR* dir = NULL;
+   struct dirent* entry;
+   char path[MAX_PATH * 2];
+   uint64_t sequence;
+   struct wal_pool* p = NULL;
+
+   *pool = NULL;
+
+   if (directory == NULL || segsize <= 0)
    {
-      pgmoneta_log_error("Failed to read mappings file: %s", mappings_path);
       goto error;
    }
 
-   for (int i = 0; i < 3; i++)
+   if (!pgmoneta_exists(directory) && pgmoneta_mkdir(directory))
    {
-      section = (struct json*)pgmoneta_json_get(root, sections[i]);
-      if (section && section->type == JSONItem)
+      goto error;
+   }
+
+   p = (struct wal_pool*)malloc(sizeof(struct wal_pool));
+   if (p == NULL)
+   {
+      goto error;
+   }
+
+   memset(p, 0, sizeof(struct wal_pool));
+
+   snprintf(p->directory, sizeof(p->directory), "%s", directory);
+   p->segsize = segsize;
+   p->running = true;
+
+   pthread_mutex_init(&p->lock, NULL);
+   pthread_cond_init(&p->wake, NULL);
+
+   // segments left by the previous run are used first
+   if (!(dir = opendir(directory)))
+   {
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type != DT_REG)
       {
-         struct art* art_tree = (struct art*)section->elements;
-         total_entries += art_tree->size;
+         continue;
+      }
+
+      snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+
+      if (!pgmoneta_ends_with(entry->d_name, ".tmp") &&
+          !pgmoneta_ends_with(entry->d_name, ".recycle") &&
+          sscanf(entry->d_name, "%" SCNx64, &sequence) == 1 &&
+          pgmoneta_get_file_size(path) == (size_t)segsize &&
+          p->ready < WAL_POOL_SEGMENTS)
+      {
+         p->ready++;
+         p->next = MAX(p->next, sequence + 1);
+      }
+      else
+      {
+         pgmoneta_delete_file(path, NULL);
       }
    }
 
-   oidMappings = (oid_mapping*)malloc(total_entries * sizeof(oid_mapping));
-   if (!oidMappings)
+   closedir(dir);
+   dir = NULL;
+
+   if (pthread_create(&p->thread, NULL, wal_pool_run, p))
+   {
+      pgmoneta_log_error("WAL pool: Could not start the filler thread");
+      goto error;
+   }
+   p->started = true;
+
+   *pool = p;
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   wal_pool_destroy(p);
+
+   return 1;
+}
+
+static int
+wal_pool_take(struct wal_pool* pool, char* path)
+{
+   DIR* dir = NULL;
+   struct dirent* entry;
+   char from[MAX_PATH * 2];
+   int ret = 1;
+
+   if (pool == NULL)
    {
-      pgmoneta_log_error("Memory allocation failed");
-      goto error;
+      return 1;
    }
 
-   for (int i = 0; i < 3; i++)
+   pthread_mutex_lock(&pool->lock);
+
+   if ((dir = opendir(pool->directory)))
    {
-      current_type = (object_type)i;
-      section = (struct json*)pgmoneta_json_get(root, sections[i]);
-      if (section && section->type == JSONItem)
+      while (ret != 0 && (entry = readdir(dir)) != NULL)
       {
-         pgmoneta_json_iterator_create(section, &iter);
-         while (pgmoneta_json_iterator_next(iter))
+         if (entry->d_type != DT_REG || pgmoneta_ends_with(entry->d_name, ".tmp") ||
+             pgmoneta_ends_with(entry->d_name, ".recycle"))
          {
-            char* name = iter->key;
-            oid_str = (char*)iter->value->data;
-            oid = (int)strtol(oid_str, NULL, 10);
+            continue;
+         }
 
-            oidMappings[index].oid = oid;
-            oidMappings[index].type = current_type;
-            oidMappings[index].name = strdup(name);
-            index++;
+         snprintf(from, sizeof(from), "%s/%s", pool->directory, entry->d_name);
+
+         if (rename(from, path) == 0)
+         {
+            pool->ready--;
+            ret = 0;
          }
-         pgmoneta_json_iterator_destroy(iter);
       }
+
+      closedir(dir);
    }
 
-   mappings_size = total_entries;
-   pgmoneta_json_destroy(root);
-   enable_translation = true;
+   pthread_cond_signal(&pool->wake);
+   pthread_mutex_unlock(&pool->lock);
 
-   return 0;
+   if (ret)
+   {
+      pgmoneta_log_debug("WAL pool: No preallocated segment for %s", path);
+   }
 
-error:
-   pgmoneta_json_destroy(root);
-   return 1;
+   return ret;
 }
 
-int
-pgmoneta_read_mappings_from_server(int server_index)
+static int
+wal_pool_recycle(struct wal_pool* pool, char* path)
 {
-   struct query_response* qr = NULL;
-   struct message* query_msg = NULL;
-   struct tuple* tuple = NULL;
-   char* name = NULL;
-   char* oid_str = NULL;
-   unsigned int oid;
-   int count;
-   struct walinfo_configuration* config = NULL;
-   int user_index = -1;
-   int auth;
-   SSL* ssl = NULL;
-   int socket = -1;
-   int len = 0;
-   char* section_names[] = {"tablespaces", "databases", "relations"};
-   object_type types[] = {OBJ_TABLESPACE, OBJ_DATABASE, OBJ_RELATION};
-   char* queries[] = {
-      "SELECT spcname, oid FROM pg_tablespace",
-      "SELECT datname, oid FROM pg_database",
-      "SELECT nspname || '.' || relname, c.oid FROM pg_class c JOIN pg_namespace n ON c.relnamespace = n.oid"
-   };
+   char to[MAX_PATH + MISC_LENGTH];
+   uint64_t sequence;
 
-   config = (struct walinfo_configuration*)shmem;
-   pgmoneta_memory_init();
+   if (pool == NULL)
+   {
+      return 1;
+   }
 
-   for (int i = 0; i < config->common.number_of_users; i++)
+   pthread_mutex_lock(&pool->lock);
+   if (pool->ready >= WAL_POOL_SEGMENTS)
    {
-      if (strcmp(config->common.users[i].username, config->common.servers[server_index].username) == 0)
-      {
-         user_index = i;
-         break;
-      }
+      pthread_mutex_unlock(&pool->lock);
+      return 1;
    }
+   pool->ready++;
+   sequence = pool->next++;
+   pthread_mutex_unlock(&pool->lock);
 
-   if (user_index == -1)
+   // the old content would be read as records of the new segment, so the filler zeroes it first
+   snprintf(to, sizeof(to), "%s/%016" PRIx64 ".recycle", pool->directory, sequence);
+
+   if (rename(path, to) != 0)
    {
-      pgmoneta_log_error("User %s not found", config->common.servers[server_index].username);
       goto error;
    }
 
-   auth = pgmoneta_server_authenticate(server_index, "postgres", config->common.users[user_index].username, config->common.users[user_index].password, false, &ssl, &socket);
+   pthread_mutex_lock(&pool->lock);
+   pool->recycled++;
+   pthread_cond_signal(&pool->wake);
+   pthread_mutex_unlock(&pool->lock);
 
-   if (auth != AUTH_SUCCESS)
+   return 0;
+
+error:
+
+   pthread_mutex_lock(&pool->lock);
+   pool->ready--;
+   pthread_cond_signal(&pool->wake);
+   pthread_mutex_unlock(&pool->lock);
+
+   errno = 0;
+
+   return 1;
+}
+
+static void
+wal_pool_destroy(struct wal_pool* pool)
+{
+   if (pool == NULL)
    {
-      pgmoneta_log_error("Authentication failed for user %s on %s", config->common.users[user_index].username, config->common.servers[server_index].name);
-      goto error;
+      return;
    }
 
-   len = sizeof(queries) / sizeof(queries[0]);
+   if (pool->started)
+   {
+      pthread_mutex_lock(&pool->lock);
+      pool->running = false;
+      pthread_cond_signal(&pool->wake);
+      pthread_mutex_unlock(&pool->lock);
 
-   for (int i = 0; i < len; i++)
+      pthread_join(pool->thread, NULL);
+   }
+
+   pthread_mutex_destroy(&pool->lock);
+   pthread_cond_destroy(&pool->wake);
+
+   free(pool);
+}
+
+static void*
+wal_pool_run(void* arg)
+{
+   uint64_t sequence;
+   struct wal_pool* pool = (struct wal_pool*)arg;
+
+   pthread_mutex_lock(&pool->lock);
+
+   while (pool->running)
    {
-      query_msg = NULL;
-      if (pgmoneta_create_query_message((char*)queries[i], &query_msg) != MESSAGE_STATUS_OK)
+      if (pool->recycled > 0)
       {
-         pgmoneta_log_error("Failed to create query message");
-         goto error;
-      }
+         pool->recycled--;
+         pthread_mutex_unlock(&pool->lock);
 
-      if (pgmoneta_query_execute(ssl, socket, query_msg, &qr) != 0 || qr == NULL)
-      {
-         pgmoneta_log_error("Failed to fetch %s", section_names[i]);
-         goto error;
-      }
+         if (wal_pool_clean(pool))
+         {
+            pthread_mutex_lock(&pool->lock);
+            pool->ready--;
+            continue;
+         }
 
-      if (qr->number_of_columns < 2)
-      {
-         pgmoneta_log_error("Invalid response for %s", section_names[i]);
-         qr = NULL;
+         pthread_mutex_lock(&pool->lock);
          continue;
       }
 
-      count = 0;
-      tuple = qr->tuples;
-      while (tuple != NULL)
+      if (pool->failed || pool->ready >= WAL_POOL_SEGMENTS)
       {
-         count++;
-         tuple = tuple->next;
+         pthread_cond_wait(&pool->wake, &pool->lock);
+         continue;
       }
 
-      oid_mapping* temp = realloc(oidMappings, (mappings_size + count) * sizeof(oid_mapping));
-      if (temp == NULL)
+      pool->ready++;
+      sequence = pool->next++;
+      pthread_mutex_unlock(&pool->lock);
+
+      if (wal_pool_fill(pool, sequence))
       {
-         pgmoneta_log_error("Memory allocation failed");
-         goto error;
+         pgmoneta_log_warn("WAL pool: Could not preallocate a segment in %s, segments are zero-filled", pool->directory);
+
+         pthread_mutex_lock(&pool->lock);
+         pool->ready--;
+         pool->failed = true;
+         continue;
       }
-      oidMappings = temp;
 
-      tuple = qr->tuples;
-      while (tuple != NULL)
-      {
-         name = tuple->data[0];
-         oid_str = tuple->data[1];
-         oid = (unsigned int)strtoul(oid_str, NULL, 10);
+      pthread_mutex_lock(&pool->lock);
+   }
 
-         oidMappings[mappings_size].type = types[i];
-         oidMappings[mappings_size].oid = oid;
-         oidMappings[mappings_size].name = strdup(name);
+   pthread_mutex_unlock(&pool->lock);
 
-         if (oidMappings[mappings_size].name == NULL)
-         {
-            pgmoneta_log_error("Failed to duplicate name");
-            goto error;
-         }
+   return NULL;
+}
 
-         mappings_size++;
-         tuple = tuple->next;
-      }
+static int
+wal_pool_fill(struct wal_pool* pool, uint64_t sequence)
+{
+   int fd = -1;
+   char tmp[MAX_PATH + MISC_LENGTH];
+   char path[MAX_PATH + MISC_LENGTH];
 
-      pgmoneta_free_query_response(qr);
-      pgmoneta_free_message(query_msg);
-      qr = NULL;
+   snprintf(tmp, sizeof(tmp), "%s/%016" PRIx64 ".tmp", pool->directory, sequence);
+   snprintf(path, sizeof(path), "%s/%016" PRIx64, pool->directory, sequence);
+
+   fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (fd == -1)
+   {
+      goto error;
    }
 
-   pgmoneta_close_ssl(ssl);
-   pgmoneta_disconnect(socket);
-   pgmoneta_memory_destroy();
-   enable_translation = true;
+   if (wal_pool_allocate(fd, 0, pool->segsize))
+   {
+      goto error;
+   }
+
+   close(fd);
+   fd = -1;
+
+   if (rename(tmp, path) != 0)
+   {
+      goto error;
+   }
 
    return 0;
 
 error:
-   pgmoneta_free_query_response(qr);
-   pgmoneta_free_message(query_msg);
-   pgmoneta_memory_destroy();
-   qr = NULL;
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   unlink(tmp);
+   errno = 0;
 
    return 1;
 }
 
-int
-pgmoneta_get_database_name(int oid, char** name)
+static int
+wal_pool_allocate(int fd, off_t from, int segsize)
 {
-   char* temp_name = NULL;
-   int max_digits = 0;
+   if (from >= segsize)
+   {
+      return 0;
+   }
 
-   if (enable_translation)
+   if (posix_fallocate(fd, from, segsize - from) == 0)
    {
-      for (int i = 0; i < mappings_size; i++)
-      {
-         if (oidMappings[i].oid == oid && oidMappings[i].type == OBJ_DATABASE)
-         {
-            temp_name = strdup(oidMappings[i].name);
-            if (temp_name == NULL)
-            {
-               goto error;
-            }
-            break;
-         }
-      }
+      return 0;
    }
 
-   if (temp_name == NULL)
+   // zero-fill where the file system can't preallocate
+   return wal_pool_zero(fd, from, segsize);
+}
+
+static int
+wal_pool_clean(struct wal_pool* pool)
+{
+   int fd = -1;
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct stat st;
+   char from[MAX_PATH * 2];
+   char to[MAX_PATH * 2];
+
+   memset(from, 0, sizeof(from));
+
+   if (!(dir = opendir(pool->directory)))
    {
-      max_digits = snprintf(NULL, 0, "%d", oid) + 1;
-      temp_name = malloc(max_digits);
+      goto error;
+   }
 
-      if (temp_name == NULL)
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type == DT_REG && pgmoneta_ends_with(entry->d_name, ".recycle"))
       {
-         goto error;
+         snprintf(from, sizeof(from), "%s/%s", pool->directory, entry->d_name);
+         break;
       }
+   }
 
-      snprintf(temp_name, max_digits, "%d", oid);
+   closedir(dir);
+   dir = NULL;
+
+   if (strlen(from) == 0)
+   {
+      goto error;
+   }
+
+   snprintf(to, sizeof(to), "%s", from);
+   to[strlen(to) - strlen(".recycle")] = '\0';
+
+   // the used part of a trimmed segment is zeroed, the rest is allocated again
+   fd = open(from, O_WRONLY);
+   if (fd == -1 || fstat(fd, &st) != 0 ||
+       wal_pool_zero(fd, 0, MIN(st.st_size, (off_t)pool->segsize)) ||
+       wal_pool_allocate(fd, st.st_size, pool->segsize))
+   {
+      goto error;
+   }
+
+   close(fd);
+   fd = -1;
+
+   if (rename(from, to) != 0)
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   if (strlen(from) > 0)
+   {
+      unlink(from);
+   }
+
+   errno = 0;
+
+   return 1;
+}
+
+static int
+wal_pool_zero(int fd, off_t from, off_t to)
+{
+   char buffer[8192] = {0};
+   ssize_t written;
+
+#if defined(HAVE_LINUX) && defined(FALLOC_FL_ZERO_RANGE)
+   // the blocks stay allocated, only their content is dropped
+   if (from < to && fallocate(fd, FALLOC_FL_ZERO_RANGE, from, to - from) == 0)
+   {
+      return 0;
+   }
+#endif
+
+   while (from < to)
+   {
+      written = pwrite(fd, buffer, MIN((off_t)sizeof(buffer), to - from), from);
+      if (written <= 0)
+      {
+         return 1;
+      }
+      from += written;
    }
 
-   *name = temp_name;
-   temp_name = NULL;
-
    return 0;
-
-error:
-   free(temp_name);
-   temp_name = NULL;
-   return 1;
 }
 
-int
-pgmoneta_get_tablespace_name(int oid, char** name)
+static int
+wal_target_create(int srv, int kind, char* root, int segsize, struct wal_target** target)
 {
-   char* temp_name = NULL;
-   int max_digits = 0;
+   struct wal_target* t = NULL;
 
-   if (enable_translation)
+   *target = NULL;
+
+   t = (struct wal_target*)malloc(sizeof(struct wal_target));
+   if (t == NULL)
    {
-      for (int i = 0; i < mappings_size; i++)
-      {
-         if (oidMappings[i].oid == oid && oidMappings[i].type == OBJ_TABLESPACE)
-         {
-            temp_name = strdup(oidMappings[i].name);
-            if (temp_name == NULL)
-            {
-               goto error;
-            }
-            break;
-         }
-      }
+      goto error;
    }
 
-   if (temp_name == NULL)
+   memset(t, 0, sizeof(struct wal_target));
+
+   t->server = srv;
+   t->kind = kind;
+   t->segsize = segsize;
+   t->root = root;
+
+   pthread_mutex_init(&t->lock, NULL);
+   pthread_cond_init(&t->not_empty, NULL);
+   pthread_cond_init(&t->not_full, NULL);
+
+   if (kind == WAL_TARGET_SHIPPING && pgmoneta_async_io_create(ASYNC_IO_DEPTH, ASYNC_IO_BUFFER_SIZE, &t->io))
    {
-      max_digits = snprintf(NULL, 0, "%d", oid) + 1;
-      temp_name = malloc(max_digits);
-      if (temp_name == NULL)
-      {
-         goto error;
-      }
+      goto error;
+   }
 
-      snprintf(temp_name, max_digits, "%d", oid);
+   if (pthread_create(&t->thread, NULL, wal_target_run, t))
+   {
+      pgmoneta_log_error("WAL target: Could not start the writer thread");
+      goto error;
    }
+   t->started = true;
 
-   *name = temp_name;
-   temp_name = NULL;
+   *target = t;
 
    return 0;
 
 error:
-   free(temp_name);
-   temp_name = NULL;
+
+   wal_target_destroy(t);
+
    return 1;
 }
 
-int
-pgmoneta_get_relation_name(int oid, char** name)
+static void
+wal_target_open(struct wal_target* target, char* filename)
 {
-   char* temp_name = NULL;
-   int max_digits = 0;
+   wal_target_push(target, WAL_TARGET_OPEN, filename, false, NULL, 0);
+}
 
-   if (enable_translation)
+static void
+wal_target_write(struct wal_target* target, void* data, size_t size)
+{
+   wal_target_push(target, WAL_TARGET_DATA, NULL, false, data, size);
+}
+
+static void
+wal_target_close(struct wal_target* target, char* filename, bool partial)
+{
+   wal_target_push(target, WAL_TARGET_CLOSE, filename, partial, NULL, 0);
+}
+
+static void
+wal_target_destroy(struct wal_target* target)
+{
+   struct wal_target_op* op = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (target == NULL)
    {
-      for (int i = 0; i < mappings_size; i++)
-      {
-         if (oidMappings[i].oid == oid && oidMappings[i].type == OBJ_RELATION)
-         {
-            temp_name = strdup(oidMappings[i].name);
-            if (temp_name == NULL)
-            {
-               goto error;
-            }
-            break;
-         }
-      }
+      return;
    }
 
-   if (temp_name == NULL)
+   // everything queued is still written
+   if (target->started)
    {
-      max_digits = snprintf(NULL, 0, "%d", oid) + 1;
-      temp_name = malloc(max_digits);
-      if (temp_name == NULL)
-      {
-         goto error;
-      }
+      pthread_mutex_lock(&target->lock);
+      target->done = true;
+      pthread_cond_signal(&target->not_empty);
+      pthread_mutex_unlock(&target->lock);
 
-      snprintf(temp_name, max_digits, "%d", oid);
+      pthread_join(target->thread, NULL);
    }
 
-   *name = temp_name;
-   temp_name = NULL;
+   if (target->file != NULL || target->sftp != NULL)
+   {
+      struct wal_target_op close_op;
 
-   return 0;
+      memset(&close_op, 0, sizeof(struct wal_target_op));
+      close_op.type = WAL_TARGET_CLOSE;
+      close_op.partial = true;
+      memcpy(close_op.filename, target->filename, sizeof(close_op.filename));
 
-error:
-   free(temp_name);
-   temp_name = NULL;
-   return 1;
+      wal_target_apply(target, &close_op);
+   }
+
+   while (target->head != NULL)
+   {
+      op = target->head;
+      target->head = op->next;
+      free(op->data);
+      free(op);
+   }
+
+   atomic_store(&config->common.servers[target->server].wal_target_lag[target->kind], 0);
+
+   pgmoneta_async_io_destroy(target->io);
+
+   pthread_mutex_destroy(&target->lock);
+   pthread_cond_destroy(&target->not_empty);
+   pthread_cond_destroy(&target->not_full);
+
+   free(target);
 }
 
-int
-pgmoneta_get_tablespace_oid(char* name, char** oid)
+static void
+wal_target_push(struct wal_target* target, int type, char* filename, bool partial, void* data, size_t size)
 {
-   char* temp_oid = NULL;
-   int max_digits = 0;
+   struct wal_target_op* op = NULL;
+   struct main_configuration* config;
 
-   if (enable_translation)
+   config = (struct main_configuration*)shmem;
+
+   if (target == NULL)
    {
-      for (int i = 0; i < mappings_size; i++)
+      return;
+   }
+
+   op = (struct wal_target_op*)malloc(sizeof(struct wal_target_op));
+   if (op == NULL)
+   {
+      goto error;
+   }
+
+   memset(op, 0, sizeof(struct wal_target_op));
+
+   op->type = type;
+   op->partial = partial;
+   if (filename != NULL)
+   {
+      snprintf(op->filename, sizeof(op->filename), "%s", filename);
+   }
+
+   if (size > 0)
+   {
+      op->data = (char*)malloc(size);
+      if (op->data == NULL)
       {
-         if (oidMappings[i].type == OBJ_TABLESPACE && !strcmp(oidMappings[i].name, name))
-         {
-            max_digits = snprintf(NULL, 0, "%d", oidMappings[i].oid) + 1;
-            temp_oid = malloc(max_digits);
-            if (temp_oid == NULL)
-            {
-               goto error;
-            }
-            snprintf(temp_oid, max_digits, "%d", oidMappings[i].oid);
-            break;
-         }
+         goto error;
       }
+      memcpy(op->data, data, size);
+      op->size = size;
    }
 
-   if (temp_oid == NULL)
+   pthread_mutex_lock(&target->lock);
+
+   if (target->queued > 0 && target->queued + size > WAL_TARGET_QUEUE_SIZE)
    {
-      temp_oid = strdup(name);
-      if (temp_oid == NULL)
+      // the target is a full queue behind, so the stream has to wait for it
+      atomic_fetch_add(&config->common.servers[target->server].wal_target_stalls[target->kind], 1);
+
+      while (target->queued > 0 && target->queued + size > WAL_TARGET_QUEUE_SIZE)
       {
-         goto error;
+         pthread_cond_wait(&target->not_full, &target->lock);
       }
    }
 
-   *oid = temp_oid;
-   temp_oid = NULL;
+   if (target->tail == NULL)
+   {
+      target->head = op;
+   }
+   else
+   {
+      target->tail->next = op;
+   }
+   target->tail = op;
+   target->queued += op->size;
 
-   return 0;
+   atomic_store(&config->common.servers[target->server].wal_target_lag[target->kind], target->queued);
+
+   pthread_cond_signal(&target->not_empty);
+   pthread_mutex_unlock(&target->lock);
+
+   return;
 
 error:
-   free(temp_oid);
-   temp_oid = NULL;
-   return 1;
+
+   pgmoneta_log_error("WAL target: Could not queue %zu bytes", size);
+
+   if (op != NULL)
+   {
+      free(op->data);
+   }
+   free(op);
 }
 
-int
-pgmoneta_get_database_oid(char* name, char** oid)
+static void*
+wal_target_run(void* arg)
 {
-   char* temp_oid = NULL;
-   int max_digits = 0;
+   struct wal_target_op* op = NULL;
+   struct wal_target* target = (struct wal_target*)arg;
+   struct main_configuration* config;
 
-   if (enable_translation)
+   config = (struct main_configuration*)shmem;
+
+   pthread_mutex_lock(&target->lock);
+
+   while (true)
    {
-      for (int i = 0; i < mappings_size; i++)
+      while (target->head == NULL && !target->done)
       {
-         if (oidMappings[i].type == OBJ_DATABASE && !strcmp(oidMappings[i].name, name))
-         {
-            max_digits = snprintf(NULL, 0, "%d", oidMappings[i].oid) + 1;
-            temp_oid = malloc(max_digits);
-            if (temp_oid == NULL)
-            {
-               goto error;
-            }
-            snprintf(temp_oid, max_digits, "%d", oidMappings[i].oid);
-            break;
-         }
+         pthread_cond_wait(&target->not_empty, &target->lock);
       }
-   }
 
-   if (temp_oid == NULL)
-   {
-      temp_oid = strdup(name);
-      if (temp_oid == NULL)
+      if (target->head == NULL)
       {
-         goto error;
+         break;
       }
-   }
 
-   *oid = temp_oid;
-   temp_oid = NULL;
+      op = target->head;
+      target->head = op->next;
+      if (target->head == NULL)
+      {
+         target->tail = NULL;
+      }
+      pthread_mutex_unlock(&target->lock);
 
-   return 0;
+      wal_target_apply(target, op);
 
-error:
-   free(temp_oid);
-   temp_oid = NULL;
-   return 1;
+      pthread_mutex_lock(&target->lock);
+      target->queued -= op->size;
+      atomic_store(&config->common.servers[target->server].wal_target_lag[target->kind], target->queued);
+      pthread_cond_signal(&target->not_full);
+
+      free(op->data);
+      free(op);
+   }
+
+   pthread_mutex_unlock(&target->lock);
+
+   return NULL;
 }
 
-int
-pgmoneta_get_relation_oid(char* name, char** oid)
+static void
+wal_target_apply(struct wal_target* target, struct wal_target_op* op)
 {
-   char* temp_oid = NULL;
-   int max_digits = 0;
-
-   if (enable_translation)
+   switch (op->type)
    {
-      for (int i = 0; i < mappings_size; i++)
-      {
-         if (oidMappings[i].type == OBJ_RELATION && !strcmp(oidMappings[i].name, name))
+      case WAL_TARGET_OPEN:
+         memcpy(target->filename, op->filename, sizeof(target->filename));
+         target->failed = false;
+         if (target->kind == WAL_TARGET_SHIPPING)
          {
-            max_digits = snprintf(NULL, 0, "%d", oidMappings[i].oid) + 1;
-            temp_oid = malloc(max_digits);
-            if (temp_oid == NULL)
+            if ((target->file = wal_open(target->io, target->root, op->filename, target->segsize, NULL)) == NULL)
             {
-               goto error;
+               pgmoneta_log_warn("Could not create or open WAL segment file at %s", target->root);
             }
-            snprintf(temp_oid, max_digits, "%d", oidMappings[i].oid);
+         }
+         else if (pgmoneta_sftp_wal_open(target->server, op->filename, target->segsize, &target->sftp))
+         {
+            pgmoneta_log_error("Could not create or open WAL segment file on remote ssh storage engine");
+            target->sftp = NULL;
+         }
+         break;
+      case WAL_TARGET_DATA:
+         // the rest of a segment with a hole in it is not written
+         if (target->failed)
+         {
             break;
          }
-      }
-   }
-
-   if (temp_oid == NULL)
-   {
-      temp_oid = strdup(name);
-      if (temp_oid == NULL)
-      {
-         goto error;
-      }
+         if (target->file != NULL &&
+             (pgmoneta_async_io_write(target->file, op->data, op->size) || pgmoneta_async_io_submit(target->file)))
+         {
+            pgmoneta_log_error("Could not write %zu bytes to WAL file %s at %s", op->size, target->filename, target->root);
+            target->failed = true;
+         }
+         if (target->sftp != NULL && sftp_write(target->sftp, op->data, op->size) != (ssize_t)op->size)
+         {
+            pgmoneta_log_error("Could not write %zu bytes to WAL file %s on remote ssh storage engine", op->size, target->filename);
+            target->failed = true;
+         }
+         break;
+      case WAL_TARGET_CLOSE:
+         // an incomplete copy keeps its .partial name, so it is never taken for the segment
+         if (target->failed && !op->partial)
+         {
+            pgmoneta_log_warn("WAL file %s was not completely written, keeping it as partial", op->filename);
+         }
+         if (target->file != NULL)
+         {
+            wal_close(target->root, op->filename, op->partial || target->failed, target->file);
+            target->file = NULL;
+         }
+         if (target->sftp != NULL)
+         {
+            pgmoneta_sftp_wal_close(target->server, op->filename, op->partial || target->failed, &target->sftp);
+            target->sftp = NULL;
+         }
+         memset(target->filename, 0, sizeof(target->filename));
+         target->failed = false;
+         break;
+      default:
+         break;
    }
-
-   *oid = temp_oid;
-   temp_oid = NULL;
-
-   return 0;
-
-error:
-   free(temp_oid);
-   temp_oid = NULL;
-   return 1;
 }
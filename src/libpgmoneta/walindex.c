@@ -0,0 +1,1095 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <logging.h>
+#include <utils.h>
+#include <walindex.h>
+
+/* system */
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define WAL_INDEX_MAGIC   "PGMWALIX"
+#define WAL_INDEX_VERSION 1
+
+/* superseded records are dropped once there are more of them than segments */
+#define WAL_INDEX_COMPACT 4096
+
+/** @struct wal_index_header
+ * Defines the header of an index file
+ */
+struct wal_index_header
+{
+   char magic[8];     /**< The magic */
+   uint32_t version;  /**< The version */
+   uint32_t segsize;  /**< The segment size */
+};
+
+/** @struct wal_index_record
+ * Defines a record with its position in the index file
+ */
+struct wal_index_record
+{
+   struct wal_index_entry entry;  /**< The record */
+   size_t sequence;               /**< The position in the file */
+};
+
+static int wal_index_initialize(char* directory, int segsize, bool force);
+static char* wal_index_path(char* directory);
+static int wal_index_open(char* path, int flags, int operation);
+static int wal_index_read(int fd, int* segsize, struct wal_index_entry** records, size_t* number_of_records);
+static int wal_index_build(struct wal_index_entry* records, size_t number_of_records, struct wal_index_entry** entries, size_t* number_of_entries);
+static int wal_index_scan(char* directory, struct wal_index_entry** entries, size_t* number_of_entries);
+static int wal_index_write(char* path, int segsize, struct wal_index_entry* entries, size_t number_of_entries);
+static int wal_index_append(char* directory, struct wal_index_entry* entry);
+static int wal_index_compact(char* directory);
+static int wal_index_key(char* filename, struct wal_index_entry* entry);
+static int wal_index_parse(char* filename, struct wal_index_entry* entry);
+static int wal_index_compare(const void* a, const void* b);
+static int wal_index_record_compare(const void* a, const void* b);
+static int wal_index_lower_bound(struct wal_index* index, struct wal_index_entry* key);
+static int wal_index_stage(struct wal_index_entry* entry);
+static char* wal_index_filename(struct wal_index_entry* entry, bool partial, int compression, bool encrypted);
+
+int
+pgmoneta_wal_index_create(char* directory, int segsize)
+{
+   return wal_index_initialize(directory, segsize, false);
+}
+
+int
+pgmoneta_wal_index_rebuild(char* directory, int segsize)
+{
+   return wal_index_initialize(directory, segsize, true);
+}
+
+int
+pgmoneta_wal_index_add(char* path)
+{
+   char* directory = NULL;
+   char* filename = NULL;
+   struct stat st;
+   struct wal_index_entry entry;
+
+   if (path == NULL)
+   {
+      return 1;
+   }
+
+   filename = strrchr(path, '/');
+   if (filename == NULL)
+   {
+      return 1;
+   }
+   filename++;
+
+   // only segments are indexed
+   if (wal_index_parse(filename, &entry))
+   {
+      return 0;
+   }
+
+   if (stat(path, &st))
+   {
+      goto error;
+   }
+
+   entry.type = WAL_INDEX_ADD;
+   entry.size = st.st_size;
+
+   directory = (char*)malloc(filename - path + 1);
+   if (directory == NULL)
+   {
+      goto error;
+   }
+   memset(directory, 0, filename - path + 1);
+   memcpy(directory, path, filename - path);
+
+   if (wal_index_append(directory, &entry))
+   {
+      goto error;
+   }
+
+   free(directory);
+
+   return 0;
+
+error:
+   pgmoneta_log_debug("WAL index: Could not record %s", path);
+
+   free(directory);
+
+   return 1;
+}
+
+int
+pgmoneta_wal_index_truncate(char* directory, char* filename)
+{
+   struct wal_index_entry entry;
+
+   memset(&entry, 0, sizeof(struct wal_index_entry));
+
+   if (filename == NULL)
+   {
+      entry.timeline = UINT32_MAX;
+      entry.log = UINT32_MAX;
+      entry.seg = UINT32_MAX;
+   }
+   else if (wal_index_key(filename, &entry))
+   {
+      return 1;
+   }
+
+   entry.type = WAL_INDEX_TRUNCATE;
+
+   return wal_index_append(directory, &entry);
+}
+
+int
+pgmoneta_wal_index_load(char* directory, struct wal_index** index)
+{
+   int fd = -1;
+   int segsize = 0;
+   char* path = NULL;
+   size_t number_of_records = 0;
+   size_t number_of_entries = 0;
+   struct wal_index_entry* records = NULL;
+   struct wal_index_entry* entries = NULL;
+   struct wal_index* i = NULL;
+
+   *index = NULL;
+
+   path = wal_index_path(directory);
+   if (path == NULL)
+   {
+      goto error;
+   }
+
+   fd = wal_index_open(path, O_RDONLY, LOCK_SH);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   if (wal_index_read(fd, &segsize, &records, &number_of_records))
+   {
+      goto error;
+   }
+
+   close(fd);
+   fd = -1;
+
+   if (wal_index_build(records, number_of_records, &entries, &number_of_entries))
+   {
+      goto error;
+   }
+
+   i = (struct wal_index*)malloc(sizeof(struct wal_index));
+   if (i == NULL)
+   {
+      goto error;
+   }
+
+   memset(i, 0, sizeof(struct wal_index));
+   snprintf(i->directory, sizeof(i->directory), "%s", directory);
+   i->segsize = segsize;
+   i->number_of_entries = (int)number_of_entries;
+   i->entries = entries;
+
+   if (number_of_records > WAL_INDEX_COMPACT && number_of_records > 2 * number_of_entries)
+   {
+      wal_index_compact(directory);
+   }
+
+   *index = i;
+
+   free(records);
+   free(path);
+
+   return 0;
+
+error:
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   free(records);
+   free(entries);
+   free(path);
+
+   return 1;
+}
+
+int
+pgmoneta_wal_index_search(struct wal_index* index, char* filename)
+{
+   struct wal_index_entry key;
+
+   if (filename == NULL || wal_index_key(filename, &key))
+   {
+      return 0;
+   }
+
+   return wal_index_lower_bound(index, &key);
+}
+
+int
+pgmoneta_wal_index_find(struct wal_index* index, uint32_t timeline, uint64_t lsn)
+{
+   uint64_t segno;
+   uint64_t segments_per_id;
+   struct wal_index_entry key;
+
+   if (index->segsize <= 0)
+   {
+      return 0;
+   }
+
+   segno = lsn / index->segsize;
+   segments_per_id = 0x100000000ULL / index->segsize;
+
+   memset(&key, 0, sizeof(struct wal_index_entry));
+   key.timeline = timeline;
+   key.log = (uint32_t)(segno / segments_per_id);
+   key.seg = (uint32_t)(segno % segments_per_id);
+
+   return wal_index_lower_bound(index, &key);
+}
+
+char*
+pgmoneta_wal_index_name(struct wal_index* index, int position)
+{
+   struct wal_index_entry* entry = &index->entries[position];
+
+   return wal_index_filename(entry, entry->partial, entry->compression, entry->encrypted);
+}
+
+char*
+pgmoneta_wal_index_file(struct wal_index* index, int position)
+{
+   int compressions[] = {COMPRESSION_NONE, COMPRESSION_CLIENT_GZIP, COMPRESSION_CLIENT_ZSTD, COMPRESSION_CLIENT_LZ4, COMPRESSION_CLIENT_BZIP2};
+   char path[MAX_PATH * 2];
+   char* name = NULL;
+   struct wal_index_entry* entry = &index->entries[position];
+
+   name = pgmoneta_wal_index_name(index, position);
+   if (name == NULL)
+   {
+      return NULL;
+   }
+
+   snprintf(path, sizeof(path), "%s/%s", index->directory, name);
+   if (pgmoneta_exists(path))
+   {
+      return name;
+   }
+
+   // the segment was compressed, encrypted or completed by someone not keeping the index
+   for (int p = 0; p < 2; p++)
+   {
+      for (int c = 0; c < (int)(sizeof(compressions) / sizeof(compressions[0])); c++)
+      {
+         for (int e = 0; e < 2; e++)
+         {
+            free(name);
+            name = wal_index_filename(entry, p == 0 ? entry->partial : !entry->partial, compressions[c], e == 1);
+            if (name == NULL)
+            {
+               return NULL;
+            }
+
+            snprintf(path, sizeof(path), "%s/%s", index->directory, name);
+            if (pgmoneta_exists(path))
+            {
+               return name;
+            }
+         }
+      }
+   }
+
+   free(name);
+
+   return NULL;
+}
+
+void
+pgmoneta_wal_index_destroy(struct wal_index* index)
+{
+   if (index != NULL)
+   {
+      free(index->entries);
+   }
+   free(index);
+}
+
+static int
+wal_index_initialize(char* directory, int segsize, bool force)
+{
+   int fd = -1;
+   int existing = 0;
+   char* path = NULL;
+   size_t number_of_records = 0;
+   size_t number_of_entries = 0;
+   struct wal_index_entry* records = NULL;
+   struct wal_index_entry* entries = NULL;
+
+   path = wal_index_path(directory);
+   if (path == NULL)
+   {
+      goto error;
+   }
+
+   // the lock keeps appends out until the new index is in place
+   fd = wal_index_open(path, O_RDWR | O_CREAT, LOCK_EX);
+   if (fd == -1)
+   {
+      pgmoneta_log_error("WAL index: Could not open %s: %s", path, strerror(errno));
+      goto error;
+   }
+
+   if (!force && !wal_index_read(fd, &existing, &records, &number_of_records) && existing == segsize)
+   {
+      goto done;
+   }
+
+   if (wal_index_scan(directory, &entries, &number_of_entries))
+   {
+      pgmoneta_log_error("WAL index: Could not read %s", directory);
+      goto error;
+   }
+
+   if (wal_index_write(path, segsize, entries, number_of_entries))
+   {
+      pgmoneta_log_error("WAL index: Could not write %s", path);
+      goto error;
+   }
+
+   pgmoneta_log_debug("WAL index: %s has %zu segments", directory, number_of_entries);
+
+done:
+   close(fd);
+
+   free(records);
+   free(entries);
+   free(path);
+
+   return 0;
+
+error:
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   free(records);
+   free(entries);
+   free(path);
+
+   return 1;
+}
+
+static char*
+wal_index_path(char* directory)
+{
+   char* path = NULL;
+   size_t length;
+
+   if (directory == NULL)
+   {
+      return NULL;
+   }
+
+   length = strlen(directory);
+   while (length > 1 && directory[length - 1] == '/')
+   {
+      length--;
+   }
+
+   if (length == 0)
+   {
+      return NULL;
+   }
+
+   path = (char*)malloc(length + strlen(".index") + 1);
+   if (path == NULL)
+   {
+      return NULL;
+   }
+
+   memcpy(path, directory, length);
+   memcpy(path + length, ".index", strlen(".index") + 1);
+
+   return path;
+}
+
+static int
+wal_index_open(char* path, int flags, int operation)
+{
+   int fd;
+   struct stat opened;
+   struct stat current;
+
+   while (true)
+   {
+      fd = open(path, flags, 0600);
+      if (fd == -1)
+      {
+         return -1;
+      }
+
+      if (flock(fd, operation))
+      {
+         close(fd);
+         return -1;
+      }
+
+      // the index may have been rewritten while we waited for the lock
+      if (!fstat(fd, &opened) && !stat(path, &current) &&
+          opened.st_dev == current.st_dev && opened.st_ino == current.st_ino)
+      {
+         return fd;
+      }
+
+      close(fd);
+   }
+}
+
+static int
+wal_index_read(int fd, int* segsize, struct wal_index_entry** records, size_t* number_of_records)
+{
+   ssize_t r;
+   size_t offset = 0;
+   size_t length;
+   struct stat st;
+   struct wal_index_header header;
+   struct wal_index_entry* rs = NULL;
+
+   *segsize = 0;
+   *records = NULL;
+   *number_of_records = 0;
+
+   if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct wal_index_header))
+   {
+      goto error;
+   }
+
+   if (pread(fd, &header, sizeof(struct wal_index_header), 0) != sizeof(struct wal_index_header) ||
+       memcmp(header.magic, WAL_INDEX_MAGIC, sizeof(header.magic)) ||
+       header.version != WAL_INDEX_VERSION)
+   {
+      goto error;
+   }
+
+   // a torn record at the end is ignored
+   *number_of_records = (st.st_size - sizeof(struct wal_index_header)) / sizeof(struct wal_index_entry);
+   length = *number_of_records * sizeof(struct wal_index_entry);
+
+   if (length > 0)
+   {
+      rs = (struct wal_index_entry*)malloc(length);
+      if (rs == NULL)
+      {
+         goto error;
+      }
+
+      while (offset < length)
+      {
+         r = pread(fd, (char*)rs + offset, length - offset, sizeof(struct wal_index_header) + offset);
+         if (r <= 0)
+         {
+            goto error;
+         }
+         offset += r;
+      }
+   }
+
+   *segsize = (int)header.segsize;
+   *records = rs;
+
+   return 0;
+
+error:
+   free(rs);
+
+   *number_of_records = 0;
+
+   return 1;
+}
+
+static int
+wal_index_build(struct wal_index_entry* records, size_t number_of_records, struct wal_index_entry** entries, size_t* number_of_entries)
+{
+   bool ordered = true;
+   bool truncated = false;
+   size_t n = 0;
+   struct wal_index_entry horizon;
+   struct wal_index_record* live = NULL;
+   struct wal_index_entry* result = NULL;
+
+   *entries = NULL;
+   *number_of_entries = 0;
+
+   if (number_of_records == 0)
+   {
+      return 0;
+   }
+
+   result = (struct wal_index_entry*)malloc(number_of_records * sizeof(struct wal_index_entry));
+   if (result == NULL)
+   {
+      goto error;
+   }
+
+   // segments are opened and closed in order, so a compacted index with new segments appended is ready to use
+   for (size_t i = 0; ordered && i < number_of_records; i++)
+   {
+      if (records[i].type != WAL_INDEX_ADD || (i > 0 && wal_index_compare(&records[i - 1], &records[i]) > 0))
+      {
+         ordered = false;
+      }
+   }
+
+   if (ordered)
+   {
+      for (size_t i = 0; i < number_of_records; i++)
+      {
+         if (n > 0 && wal_index_compare(&result[n - 1], &records[i]) == 0)
+         {
+            result[n - 1] = records[i];
+         }
+         else
+         {
+            result[n++] = records[i];
+         }
+      }
+      *entries = result;
+      *number_of_entries = n;
+      return 0;
+   }
+
+   live = (struct wal_index_record*)malloc(number_of_records * sizeof(struct wal_index_record));
+   if (live == NULL)
+   {
+      goto error;
+   }
+
+   // a segment is removed by any truncation recorded after it
+   memset(&horizon, 0, sizeof(struct wal_index_entry));
+   for (size_t i = number_of_records; i > 0; i--)
+   {
+      struct wal_index_entry* record = &records[i - 1];
+
+      if (record->type == WAL_INDEX_TRUNCATE)
+      {
+         if (!truncated || wal_index_compare(record, &horizon) > 0)
+         {
+            horizon = *record;
+            truncated = true;
+         }
+      }
+      else if (record->type == WAL_INDEX_ADD && (!truncated || wal_index_compare(record, &horizon) >= 0))
+      {
+         live[n].entry = *record;
+         live[n].sequence = i - 1;
+         n++;
+      }
+   }
+
+   qsort(live, n, sizeof(struct wal_index_record), wal_index_record_compare);
+
+   // the last record of a segment describes it
+   *number_of_entries = 0;
+   for (size_t i = 0; i < n; i++)
+   {
+      if (i + 1 < n && wal_index_compare(&live[i].entry, &live[i + 1].entry) == 0)
+      {
+         continue;
+      }
+      result[(*number_of_entries)++] = live[i].entry;
+   }
+
+   *entries = result;
+
+   free(live);
+
+   return 0;
+
+error:
+   free(live);
+   free(result);
+
+   *number_of_entries = 0;
+
+   return 1;
+}
+
+static int
+wal_index_scan(char* directory, struct wal_index_entry** entries, size_t* number_of_entries)
+{
+   size_t n = 0;
+   size_t size = 0;
+   size_t count = 0;
+   char path[MAX_PATH * 2];
+   DIR* dir = NULL;
+   struct dirent* de;
+   struct stat st;
+   struct wal_index_entry entry;
+   struct wal_index_entry* es = NULL;
+   struct wal_index_entry* tmp = NULL;
+
+   *entries = NULL;
+   *number_of_entries = 0;
+
+   if (!(dir = opendir(directory)))
+   {
+      goto error;
+   }
+
+   while ((de = readdir(dir)) != NULL)
+   {
+      if (wal_index_parse(de->d_name, &entry))
+      {
+         continue;
+      }
+
+      snprintf(path, sizeof(path), "%s/%s", directory, de->d_name);
+      if (stat(path, &st) || !S_ISREG(st.st_mode))
+      {
+         continue;
+      }
+
+      entry.type = WAL_INDEX_ADD;
+      entry.size = st.st_size;
+
+      if (n == size)
+      {
+         size = size == 0 ? 1024 : size * 2;
+         tmp = (struct wal_index_entry*)realloc(es, size * sizeof(struct wal_index_entry));
+         if (tmp == NULL)
+         {
+            goto error;
+         }
+         es = tmp;
+      }
+
+      es[n++] = entry;
+   }
+
+   closedir(dir);
+   dir = NULL;
+
+   qsort(es, n, sizeof(struct wal_index_entry), wal_index_compare);
+
+   // a segment caught between two names is indexed by the one furthest along
+   for (size_t i = 0; i < n; i++)
+   {
+      if (count > 0 && wal_index_compare(&es[count - 1], &es[i]) == 0)
+      {
+         if (wal_index_stage(&es[i]) > wal_index_stage(&es[count - 1]))
+         {
+            es[count - 1] = es[i];
+         }
+         continue;
+      }
+      es[count++] = es[i];
+   }
+
+   *entries = es;
+   *number_of_entries = count;
+
+   return 0;
+
+error:
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   free(es);
+
+   return 1;
+}
+
+static int
+wal_index_write(char* path, int segsize, struct wal_index_entry* entries, size_t number_of_entries)
+{
+   int fd = -1;
+   ssize_t w;
+   size_t offset = 0;
+   size_t length = number_of_entries * sizeof(struct wal_index_entry);
+   char tmp[MAX_PATH * 2];
+   struct wal_index_header header;
+
+   snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+   memset(&header, 0, sizeof(struct wal_index_header));
+   memcpy(header.magic, WAL_INDEX_MAGIC, sizeof(header.magic));
+   header.version = WAL_INDEX_VERSION;
+   header.segsize = (uint32_t)segsize;
+
+   fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   if (write(fd, &header, sizeof(struct wal_index_header)) != sizeof(struct wal_index_header))
+   {
+      goto error;
+   }
+
+   while (offset < length)
+   {
+      w = write(fd, (char*)entries + offset, length - offset);
+      if (w <= 0)
+      {
+         goto error;
+      }
+      offset += w;
+   }
+
+   if (fsync(fd))
+   {
+      goto error;
+   }
+
+   close(fd);
+   fd = -1;
+
+   if (rename(tmp, path))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   unlink(tmp);
+
+   return 1;
+}
+
+static int
+wal_index_append(char* directory, struct wal_index_entry* entry)
+{
+   int fd = -1;
+   char* path = NULL;
+
+   path = wal_index_path(directory);
+   if (path == NULL)
+   {
+      goto error;
+   }
+
+   fd = wal_index_open(path, O_WRONLY | O_APPEND, LOCK_EX);
+   if (fd == -1)
+   {
+      if (errno == ENOENT)
+      {
+         // the directory isn't indexed
+         errno = 0;
+         free(path);
+         return 0;
+      }
+      goto error;
+   }
+
+   if (write(fd, entry, sizeof(struct wal_index_entry)) != sizeof(struct wal_index_entry))
+   {
+      goto error;
+   }
+
+   close(fd);
+   free(path);
+
+   return 0;
+
+error:
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   free(path);
+
+   return 1;
+}
+
+static int
+wal_index_compact(char* directory)
+{
+   int fd = -1;
+   int segsize = 0;
+   char* path = NULL;
+   size_t number_of_records = 0;
+   size_t number_of_entries = 0;
+   struct wal_index_entry* records = NULL;
+   struct wal_index_entry* entries = NULL;
+
+   path = wal_index_path(directory);
+   if (path == NULL)
+   {
+      goto error;
+   }
+
+   fd = wal_index_open(path, O_RDWR, LOCK_EX);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   if (wal_index_read(fd, &segsize, &records, &number_of_records) ||
+       wal_index_build(records, number_of_records, &entries, &number_of_entries) ||
+       wal_index_write(path, segsize, entries, number_of_entries))
+   {
+      goto error;
+   }
+
+   pgmoneta_log_debug("WAL index: Compacted %s from %zu to %zu records", path, number_of_records, number_of_entries);
+
+   close(fd);
+
+   free(records);
+   free(entries);
+   free(path);
+
+   return 0;
+
+error:
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   free(records);
+   free(entries);
+   free(path);
+
+   return 1;
+}
+
+static int
+wal_index_key(char* filename, struct wal_index_entry* entry)
+{
+   memset(entry, 0, sizeof(struct wal_index_entry));
+
+   if (strlen(filename) < 24)
+   {
+      return 1;
+   }
+
+   for (int i = 0; i < 24; i++)
+   {
+      if (!isxdigit((unsigned char)filename[i]))
+      {
+         return 1;
+      }
+   }
+
+   if (sscanf(filename, "%08X%08X%08X", &entry->timeline, &entry->log, &entry->seg) != 3)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+wal_index_parse(char* filename, struct wal_index_entry* entry)
+{
+   char* suffix = NULL;
+
+   if (wal_index_key(filename, entry))
+   {
+      return 1;
+   }
+
+   suffix = filename + 24;
+
+   if (!strncmp(suffix, ".partial", strlen(".partial")))
+   {
+      entry->partial = 1;
+      suffix += strlen(".partial");
+   }
+
+   if (!strncmp(suffix, ".gz", strlen(".gz")))
+   {
+      entry->compression = COMPRESSION_CLIENT_GZIP;
+      suffix += strlen(".gz");
+   }
+   else if (!strncmp(suffix, ".zstd", strlen(".zstd")))
+   {
+      entry->compression = COMPRESSION_CLIENT_ZSTD;
+      suffix += strlen(".zstd");
+   }
+   else if (!strncmp(suffix, ".lz4", strlen(".lz4")))
+   {
+      entry->compression = COMPRESSION_CLIENT_LZ4;
+      suffix += strlen(".lz4");
+   }
+   else if (!strncmp(suffix, ".bz2", strlen(".bz2")))
+   {
+      entry->compression = COMPRESSION_CLIENT_BZIP2;
+      suffix += strlen(".bz2");
+   }
+
+   if (!strcmp(suffix, ".aes"))
+   {
+      entry->encrypted = 1;
+      suffix += strlen(".aes");
+   }
+
+   // anything else, like a .tmp file, isn't a segment
+   return strlen(suffix) == 0 ? 0 : 1;
+}
+
+static int
+wal_index_compare(const void* a, const void* b)
+{
+   const struct wal_index_entry* x = (const struct wal_index_entry*)a;
+   const struct wal_index_entry* y = (const struct wal_index_entry*)b;
+
+   if (x->timeline != y->timeline)
+   {
+      return x->timeline < y->timeline ? -1 : 1;
+   }
+
+   if (x->log != y->log)
+   {
+      return x->log < y->log ? -1 : 1;
+   }
+
+   if (x->seg != y->seg)
+   {
+      return x->seg < y->seg ? -1 : 1;
+   }
+
+   return 0;
+}
+
+static int
+wal_index_record_compare(const void* a, const void* b)
+{
+   const struct wal_index_record* x = (const struct wal_index_record*)a;
+   const struct wal_index_record* y = (const struct wal_index_record*)b;
+   int c;
+
+   c = wal_index_compare(&x->entry, &y->entry);
+   if (c != 0)
+   {
+      return c;
+   }
+
+   if (x->sequence != y->sequence)
+   {
+      return x->sequence < y->sequence ? -1 : 1;
+   }
+
+   return 0;
+}
+
+static int
+wal_index_lower_bound(struct wal_index* index, struct wal_index_entry* key)
+{
+   int low = 0;
+   int high = index->number_of_entries;
+   int middle;
+
+   while (low < high)
+   {
+      middle = low + (high - low) / 2;
+
+      if (wal_index_compare(&index->entries[middle], key) < 0)
+      {
+         low = middle + 1;
+      }
+      else
+      {
+         high = middle;
+      }
+   }
+
+   return low;
+}
+
+static int
+wal_index_stage(struct wal_index_entry* entry)
+{
+   return (entry->partial ? 0 : 4) + (entry->compression != COMPRESSION_NONE ? 2 : 0) + (entry->encrypted ? 1 : 0);
+}
+
+static char*
+wal_index_filename(struct wal_index_entry* entry, bool partial, int compression, bool encrypted)
+{
+   char* name = NULL;
+   char* suffix = NULL;
+
+   switch (compression)
+   {
+      case COMPRESSION_CLIENT_GZIP:
+         suffix = ".gz";
+         break;
+      case COMPRESSION_CLIENT_ZSTD:
+         suffix = ".zstd";
+         break;
+      case COMPRESSION_CLIENT_LZ4:
+         suffix = ".lz4";
+         break;
+      case COMPRESSION_CLIENT_BZIP2:
+         suffix = ".bz2";
+         break;
+      default:
+         suffix = "";
+         break;
+   }
+
+   name = (char*)malloc(MISC_LENGTH);
+   if (name == NULL)
+   {
+      return NULL;
+   }
+
+   snprintf(name, MISC_LENGTH, "%08X%08X%08X%s%s%s", entry->timeline, entry->log, entry->seg,
+            partial ? ".partial" : "", suffix, encrypted ? ".aes" : "");
+
+   return name;
+}
@@ -32,8 +32,10 @@
 #include <backup.h>
 #include <logging.h>
 #include <network.h>
+#include <resume.h>
 #include <security.h>
 #include <server.h>
+#include <summary.h>
 #include <tablespace.h>
 #include <utils.h>
 #include <workflow.h>
@@ -100,6 +102,11 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    char* tag = NULL;
    char* incremental = NULL;
    char* incremental_label = NULL;
+   bool local_incremental = false;
+   bool resume = false;
+   bool resume_started = false;
+   bool journaled = false;
+   bool receiving = false;
    char* manifest_path = NULL;
    char version[10];
    char minor_version[10];
@@ -161,6 +168,9 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
       goto error;
    }
 
+   /* Without summarize_wal on the server a full copy is taken, and the summary step keeps the changed blocks */
+   local_incremental = incremental != NULL && pgmoneta_summary_is_local(server);
+
    pgmoneta_memory_init();
 
    backup_max_rate = pgmoneta_get_backup_max_rate(server);
@@ -258,7 +268,30 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
 
    pgmoneta_memory_stream_buffer_init(&buffer);
 
-   if (incremental != NULL)
+   // a full backup continues from the files a failed one already received
+   resume = incremental == NULL && pgmoneta_resume_available(server);
+
+   if (resume)
+   {
+      pgmoneta_log_info("Backup: Resuming the partial backup of %s", config->common.servers[server].name);
+
+      manifest_path = pgmoneta_get_server_partial(server);
+      manifest_path = pgmoneta_append(manifest_path, "backup_manifest");
+      if (pgmoneta_resume_write_manifest(server, manifest_path))
+      {
+         pgmoneta_log_warn("Backup: Could not use the partial backup of %s", config->common.servers[server].name);
+         pgmoneta_resume_delete(server);
+         free(manifest_path);
+         manifest_path = NULL;
+         resume = false;
+      }
+      else
+      {
+         resume_started = true;
+      }
+   }
+
+   if ((incremental != NULL && !local_incremental) || resume)
    {
       // send UPLOAD_MANIFEST
       if (send_upload_manifest(ssl, socket))
@@ -266,8 +299,11 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
          pgmoneta_log_error("Fail to send UPLOAD_MANIFEST to server %s", config->common.servers[server].name);
          goto error;
       }
-      manifest_path = pgmoneta_append(NULL, incremental);
-      manifest_path = pgmoneta_append(manifest_path, "data/backup_manifest");
+      if (!resume)
+      {
+         manifest_path = pgmoneta_append(NULL, incremental);
+         manifest_path = pgmoneta_append(manifest_path, "data/backup_manifest");
+      }
       if (upload_manifest(ssl, socket, manifest_path))
       {
          pgmoneta_log_error("Fail to upload manifest to server %s", config->common.servers[server].name);
@@ -285,8 +321,8 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    tag = pgmoneta_append(tag, "pgmoneta_");
    tag = pgmoneta_append(tag, label);
 
-   pgmoneta_create_base_backup_message(config->common.servers[server].version, incremental != NULL, tag, true,
-                                       config->compression_type, config->compression_level,
+   pgmoneta_create_base_backup_message(config->common.servers[server].version, (incremental != NULL && !local_incremental) || resume,
+                                       tag, true, config->compression_type, config->compression_level,
                                        &basebackup_msg);
 
    status = pgmoneta_write_message(ssl, socket, basebackup_msg);
@@ -312,6 +348,11 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
 
    pgmoneta_mkdir(backup_base);
 
+   if (!resume && incremental == NULL && pgmoneta_resume_supported(server))
+   {
+      journaled = pgmoneta_resume_begin(backup_base, start_timeline, startpos) == 0;
+   }
+
    backup = (struct backup*)malloc(sizeof(struct backup));
    if (backup == NULL)
    {
@@ -322,7 +363,7 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
 
    if (config->common.servers[server].version < 15)
    {
-      if (pgmoneta_receive_archive_files(ssl, socket, buffer, backup_base, tablespaces, bucket, network_bucket))
+      if (pgmoneta_receive_archive_files(server, ssl, socket, buffer, backup_base, tablespaces, bucket, network_bucket))
       {
          pgmoneta_log_error("Backup: Could not backup %s", config->common.servers[server].name);
 
@@ -339,7 +380,8 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    }
    else
    {
-      if (pgmoneta_receive_archive_stream(ssl, socket, buffer, backup_base, tablespaces, bucket, network_bucket))
+      receiving = true;
+      if (pgmoneta_receive_archive_stream(server, ssl, socket, buffer, backup_base, tablespaces, bucket, network_bucket))
       {
          pgmoneta_log_error("Backup: Could not backup %s", config->common.servers[server].name);
 
@@ -365,6 +407,24 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    end_timeline = atoi(response->tuples[0].data[1]);
    pgmoneta_free_query_response(response);
    response = NULL;
+   receiving = false;
+
+   if (resume)
+   {
+      if (pgmoneta_resume_splice(server, backup_base))
+      {
+         pgmoneta_log_error("Backup: Could not combine %s with the partial backup", label);
+         goto error;
+      }
+      pgmoneta_resume_delete(server);
+      resume = false;
+   }
+
+   if (journaled)
+   {
+      pgmoneta_resume_end(backup_base);
+      journaled = false;
+   }
 
    // remove backup_label.old if it exists
    memset(old_label_path, 0, MAX_PATH);
@@ -410,7 +470,7 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
 
    backup_data = pgmoneta_get_server_backup_identifier_data(server, label);
 
-   if (!incremental)
+   if (!incremental || local_incremental)
    {
       size = pgmoneta_directory_size(backup_data);
       biggest_file_size = pgmoneta_biggest_file(backup_data);
@@ -517,9 +577,19 @@ error:
       backup_base = pgmoneta_get_server_backup_identifier(server, label);
    }
 
-   if (pgmoneta_exists(backup_base))
+   // the received files are kept as the partial backup for the next attempt
+   if (!journaled || !receiving || pgmoneta_resume_keep(server, backup_base))
+   {
+      if (pgmoneta_exists(backup_base))
+      {
+         pgmoneta_delete_directory(backup_base);
+      }
+   }
+
+   // the server didn't accept the partial backup, so the next attempt starts over
+   if (resume && resume_started && !receiving)
    {
-      pgmoneta_delete_directory(backup_base);
+      pgmoneta_resume_delete(server);
    }
 
    pgmoneta_close_ssl(ssl);
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <art.h>
+#include <dedup.h>
+#include <deque.h>
+#include <logging.h>
+#include <utils.h>
+#include <workers.h>
+#include <workflow.h>
+
+/* system */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+static char* dedup_name(void);
+static int dedup_store_execute(char*, struct art*);
+static int dedup_expand_execute(char*, struct art*);
+
+struct workflow*
+pgmoneta_create_dedup(bool store)
+{
+   struct workflow* wf = NULL;
+
+   wf = (struct workflow*)malloc(sizeof(struct workflow));
+
+   if (wf == NULL)
+   {
+      return NULL;
+   }
+
+   wf->name = &dedup_name;
+   wf->setup = &pgmoneta_common_setup;
+
+   if (store)
+   {
+      wf->execute = &dedup_store_execute;
+   }
+   else
+   {
+      wf->execute = &dedup_expand_execute;
+   }
+
+   wf->teardown = &pgmoneta_common_teardown;
+   wf->next = NULL;
+
+   return wf;
+}
+
+static char*
+dedup_name(void)
+{
+   return "Dedup";
+}
+
+static int
+dedup_store_execute(char* name __attribute__((unused)), struct art* nodes)
+{
+   int server = -1;
+   char* label = NULL;
+   struct timespec start_t;
+   struct timespec end_t;
+   double dedup_elapsed_time;
+   char* backup_base = NULL;
+   char* backup_data = NULL;
+   int hours;
+   int minutes;
+   double seconds;
+   char elapsed[128];
+   int number_of_workers = 0;
+   struct workers* workers = NULL;
+   struct deque* chunks = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef DEBUG
+   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
+   {
+      char* a = NULL;
+      a = pgmoneta_art_to_string(nodes, FORMAT_TEXT, NULL, 0);
+      pgmoneta_log_debug("(Tree)\n%s", a);
+      free(a);
+   }
+   assert(nodes != NULL);
+   assert(pgmoneta_art_contains_key(nodes, NODE_SERVER_ID));
+   assert(pgmoneta_art_contains_key(nodes, NODE_LABEL));
+#endif
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
+   label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
+
+   pgmoneta_log_debug("Dedup (store): %s/%s", config->common.servers[server].name, label);
+
+   backup_base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
+   backup_data = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_DATA);
+
+   if (pgmoneta_deque_create(true, &chunks))
+   {
+      goto error;
+   }
+
+   number_of_workers = pgmoneta_get_number_of_workers(server);
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_initialize(number_of_workers, &workers);
+   }
+
+   if (pgmoneta_dedup_data(server, backup_data, chunks, workers))
+   {
+      goto error;
+   }
+   if (pgmoneta_dedup_tablespaces(server, backup_base, chunks, workers))
+   {
+      goto error;
+   }
+
+   pgmoneta_workers_wait(workers);
+   if (workers != NULL && !workers->outcome)
+   {
+      goto error;
+   }
+   pgmoneta_workers_destroy(workers);
+   workers = NULL;
+   number_of_workers = 0;
+
+   if (pgmoneta_dedup_commit(server, backup_base, chunks))
+   {
+      goto error;
+   }
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   dedup_elapsed_time = pgmoneta_compute_duration(start_t, end_t);
+
+   hours = dedup_elapsed_time / 3600;
+   minutes = ((int)dedup_elapsed_time % 3600) / 60;
+   seconds = (int)dedup_elapsed_time % 60 + (dedup_elapsed_time - ((long)dedup_elapsed_time));
+
+   memset(&elapsed[0], 0, sizeof(elapsed));
+   sprintf(&elapsed[0], "%02i:%02i:%.4f", hours, minutes, seconds);
+
+   pgmoneta_log_debug("Dedup: %s/%s (Elapsed: %s)", config->common.servers[server].name, label, &elapsed[0]);
+
+   pgmoneta_deque_destroy(chunks);
+
+   return 0;
+
+error:
+
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_wait(workers);
+      pgmoneta_workers_destroy(workers);
+   }
+
+   /* The backup never references the chunks it added, so nothing else would remove them */
+   if (server != -1)
+   {
+      pgmoneta_dedup_abort(server, chunks);
+   }
+   pgmoneta_deque_destroy(chunks);
+
+   return 1;
+}
+
+static int
+dedup_expand_execute(char* name __attribute__((unused)), struct art* nodes)
+{
+   int server = -1;
+   char* label = NULL;
+   char* base = NULL;
+   char* identifier = NULL;
+   int number_of_workers = 0;
+   struct workers* workers = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef DEBUG
+   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
+   {
+      char* a = NULL;
+      a = pgmoneta_art_to_string(nodes, FORMAT_TEXT, NULL, 0);
+      pgmoneta_log_debug("(Tree)\n%s", a);
+      free(a);
+   }
+   assert(nodes != NULL);
+   assert(pgmoneta_art_contains_key(nodes, NODE_SERVER_ID));
+   assert(pgmoneta_art_contains_key(nodes, NODE_LABEL));
+#endif
+
+   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
+   label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
+
+   identifier = pgmoneta_get_server_backup_identifier(server, label);
+
+   /* Only backups taken with a chunk store have recipes */
+   if (!pgmoneta_dedup_is_deduplicated(identifier))
+   {
+      free(identifier);
+      return 0;
+   }
+
+   pgmoneta_log_debug("Dedup (expand): %s/%s", config->common.servers[server].name, label);
+
+   base = (char*)pgmoneta_art_search(nodes, NODE_TARGET_BASE);
+   if (base == NULL)
+   {
+      base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
+   }
+   if (base == NULL)
+   {
+      base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_DATA);
+   }
+
+   number_of_workers = pgmoneta_get_number_of_workers(server);
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_initialize(number_of_workers, &workers);
+   }
+
+   if (pgmoneta_dedup_expand_directory(server, base, workers))
+   {
+      goto error;
+   }
+
+   pgmoneta_workers_wait(workers);
+   if (workers != NULL && !workers->outcome)
+   {
+      goto error;
+   }
+   pgmoneta_workers_destroy(workers);
+
+   free(identifier);
+
+   return 0;
+
+error:
+
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_destroy(workers);
+   }
+   free(identifier);
+
+   return 1;
+}
@@ -31,6 +31,7 @@
 #include <pgmoneta.h>
 #include <art.h>
 #include <backup.h>
+#include <dedup.h>
 #include <link.h>
 #include <logging.h>
 #include <management.h>
@@ -327,6 +328,7 @@ delete_backup(int server, int index, struct backup* backup __attribute__((unused
          pgmoneta_workers_destroy(workers);
 
          /* Delete from */
+         pgmoneta_dedup_release(server, d);
          pgmoneta_delete_directory(d);
          free(d);
          d = NULL;
@@ -362,6 +364,7 @@ delete_backup(int server, int index, struct backup* backup __attribute__((unused
       else if (prev_index != -1)
       {
          /* Latest valid backup */
+         pgmoneta_dedup_release(server, d);
          pgmoneta_delete_directory(d);
       }
       else if (next_index != -1)
@@ -382,6 +385,7 @@ delete_backup(int server, int index, struct backup* backup __attribute__((unused
          pgmoneta_workers_destroy(workers);
 
          /* Delete from */
+         pgmoneta_dedup_release(server, d);
          pgmoneta_delete_directory(d);
          free(d);
          d = NULL;
@@ -416,12 +420,14 @@ delete_backup(int server, int index, struct backup* backup __attribute__((unused
       else
       {
          /* Only valid backup */
+         pgmoneta_dedup_release(server, d);
          pgmoneta_delete_directory(d);
       }
    }
    else
    {
       /* Just delete */
+      pgmoneta_dedup_release(server, d);
       pgmoneta_delete_directory(d);
    }
 
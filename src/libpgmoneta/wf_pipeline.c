@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <art.h>
+#include <deque.h>
+#include <dictionary.h>
+#include <info.h>
+#include <logging.h>
+#include <pipeline.h>
+#include <utils.h>
+#include <workers.h>
+#include <workflow.h>
+
+/* system */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+static char* pipeline_name(void);
+static int pipeline_execute(char*, struct art*);
+
+struct workflow*
+pgmoneta_create_pipeline(void)
+{
+   struct workflow* wf = NULL;
+
+   wf = (struct workflow*)malloc(sizeof(struct workflow));
+
+   if (wf == NULL)
+   {
+      return NULL;
+   }
+
+   wf->name = &pipeline_name;
+   wf->setup = &pgmoneta_common_setup;
+   wf->execute = &pipeline_execute;
+   wf->teardown = &pgmoneta_common_teardown;
+   wf->next = NULL;
+
+   return wf;
+}
+
+static char*
+pipeline_name(void)
+{
+   return "Pipeline";
+}
+
+static int
+pipeline_execute(char* name __attribute__((unused)), struct art* nodes)
+{
+   int server = -1;
+   char* label = NULL;
+   struct timespec start_t;
+   struct timespec end_t;
+   double pipeline_elapsed_time;
+   char* backup_base = NULL;
+   char* server_backup = NULL;
+   char* backup_data = NULL;
+   int hours;
+   int minutes;
+   double seconds;
+   char elapsed[128];
+   int number_of_workers = 0;
+   struct workers* workers = NULL;
+   struct deque* checksums = NULL;
+   struct deque_iterator* iter = NULL;
+   struct art* cache = NULL;
+   struct main_configuration* config;
+   struct backup* backup = NULL;
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef DEBUG
+   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
+   {
+      char* a = NULL;
+      a = pgmoneta_art_to_string(nodes, FORMAT_TEXT, NULL, 0);
+      pgmoneta_log_debug("(Tree)\n%s", a);
+      free(a);
+   }
+   assert(nodes != NULL);
+   assert(pgmoneta_art_contains_key(nodes, NODE_SERVER_ID));
+   assert(pgmoneta_art_contains_key(nodes, NODE_LABEL));
+#endif
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
+   label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
+
+   pgmoneta_log_debug("Pipeline (execute): %s/%s", config->common.servers[server].name, label);
+
+   backup_base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
+   server_backup = (char*)pgmoneta_art_search(nodes, NODE_SERVER_BACKUP);
+   backup_data = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_DATA);
+
+   if (pgmoneta_deque_create(true, &checksums))
+   {
+      goto error;
+   }
+
+   number_of_workers = pgmoneta_get_number_of_workers(server);
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_initialize(number_of_workers, &workers);
+   }
+
+   if (config->compression_dictionary && config->compression_type != COMPRESSION_NONE)
+   {
+      pgmoneta_dictionary_train(server, DICTIONARY_TYPE_DATA, backup_data);
+   }
+
+   if (pgmoneta_pipeline_data(backup_base, backup_data, checksums, workers))
+   {
+      goto error;
+   }
+   if (pgmoneta_pipeline_tablespaces(backup_base, checksums, workers))
+   {
+      goto error;
+   }
+
+   pgmoneta_workers_wait(workers);
+   if (workers != NULL && !workers->outcome)
+   {
+      goto error;
+   }
+   pgmoneta_workers_destroy(workers);
+   workers = NULL;
+   number_of_workers = 0;
+
+   /* Hand the checksums over to the SHA512 step so it doesn't read the files again */
+   if (pgmoneta_art_create(&cache))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_deque_iterator_create(checksums, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      if (pgmoneta_art_insert(cache, iter->tag, pgmoneta_value_data(iter->value), ValueString))
+      {
+         goto error;
+      }
+   }
+
+   pgmoneta_deque_iterator_destroy(iter);
+   iter = NULL;
+
+   if (pgmoneta_art_insert(nodes, NODE_CHECKSUMS, (uintptr_t)cache, ValueART))
+   {
+      goto error;
+   }
+   cache = NULL;
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   pipeline_elapsed_time = pgmoneta_compute_duration(start_t, end_t);
+
+   hours = pipeline_elapsed_time / 3600;
+   minutes = ((int)pipeline_elapsed_time % 3600) / 60;
+   seconds = (int)pipeline_elapsed_time % 60 + (pipeline_elapsed_time - ((long)pipeline_elapsed_time));
+
+   memset(&elapsed[0], 0, sizeof(elapsed));
+   sprintf(&elapsed[0], "%02i:%02i:%.4f", hours, minutes, seconds);
+
+   pgmoneta_log_debug("Pipeline: %s/%s (Elapsed: %s)", config->common.servers[server].name, label, &elapsed[0]);
+
+   if (pgmoneta_load_info(server_backup, label, &backup))
+   {
+      goto error;
+   }
+   if (config->compression_type == COMPRESSION_NONE)
+   {
+      backup->encryption_elapsed_time = pipeline_elapsed_time;
+   }
+   else
+   {
+      backup->compression_zstd_elapsed_time = pipeline_elapsed_time;
+   }
+   if (config->compression_dictionary && config->compression_type != COMPRESSION_NONE)
+   {
+      backup->dictionary = pgmoneta_dictionary_current(server, DICTIONARY_TYPE_DATA);
+   }
+   if (pgmoneta_save_info(server_backup, backup))
+   {
+      goto error;
+   }
+
+   pgmoneta_deque_destroy(checksums);
+   free(backup);
+
+   return 0;
+
+error:
+
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_destroy(workers);
+   }
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_deque_destroy(checksums);
+   pgmoneta_art_destroy(cache);
+   free(backup);
+
+   return 1;
+}
@@ -28,9 +28,12 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <aes.h>
+#include <compression.h>
 #include <logging.h>
 #include <restore.h>
 #include <utils.h>
+#include <workers.h>
 #include <workflow.h>
 
 /* system */
@@ -50,6 +53,8 @@ static int recovery_info_execute(char*, struct art*);
 
 static char* copy_wal_name(void);
 static int copy_wal_execute(char*, struct art*);
+static void do_copy_wal_stage(struct worker_common* wc);
+static int copy_wal_unpack(char* directory);
 
 static char*restore_excluded_files_name(void);
 static int restore_excluded_files_execute(char*, struct art*);
@@ -744,9 +749,13 @@ copy_wal_execute(char* name __attribute__((unused)), struct art* nodes)
    bool copy_wal = false;
    int server = 0;
    char* label = NULL;
+   char* from = NULL;
+   int number_of_wal_files = 0;
+   char** wal_files = NULL;
    struct backup* backup = NULL;
    int number_of_workers = 0;
    struct workers* workers = NULL;
+   struct worker_input* wi = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -765,17 +774,17 @@ copy_wal_execute(char* name __attribute__((unused)), struct art* nodes)
       return 0;
    }
 
+   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
+   label = (char*) pgmoneta_art_search(nodes, NODE_LABEL);
+   directory = (char*)pgmoneta_art_search(nodes, NODE_TARGET_ROOT);
+   backup = (struct backup*)pgmoneta_art_search(nodes, NODE_BACKUP);
+
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
       pgmoneta_workers_initialize(number_of_workers, &workers);
    }
 
-   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
-   label = (char*) pgmoneta_art_search(nodes, NODE_LABEL);
-   directory = (char*)pgmoneta_art_search(nodes, NODE_TARGET_ROOT);
-   backup = (struct backup*)pgmoneta_art_search(nodes, NODE_BACKUP);
-
    origwal = pgmoneta_get_server_backup_identifier_data_wal(server, label);
    waldir = pgmoneta_get_server_wal(server);
 
@@ -786,7 +795,51 @@ copy_wal_execute(char* name __attribute__((unused)), struct art* nodes)
    waltarget = pgmoneta_append(waltarget, label);
    waltarget = pgmoneta_append(waltarget, "/pg_wal/");
 
-   pgmoneta_copy_wal_files(waldir, waltarget, &backup->wal[0], workers);
+   if (pgmoneta_get_wal_range(waldir, &backup->wal[0], &number_of_wal_files, &wal_files))
+   {
+      pgmoneta_log_error("Unable to get the WAL of %s", config->common.servers[server].name);
+      goto error;
+   }
+
+   if (pgmoneta_mkdir(waltarget))
+   {
+      pgmoneta_log_error("Could not create directory: %s", waltarget);
+      goto error;
+   }
+
+   // the pool runs the segments in order, so the earliest are ready first
+   for (int i = 0; i < number_of_wal_files; i++)
+   {
+      from = pgmoneta_append(from, waldir);
+      if (!pgmoneta_ends_with(from, "/"))
+      {
+         from = pgmoneta_append(from, "/");
+      }
+      from = pgmoneta_append(from, wal_files[i]);
+
+      if (workers != NULL)
+      {
+         if (!workers->outcome)
+         {
+            break;
+         }
+
+         if (pgmoneta_create_worker_input(waltarget, from, wal_files[i], 0, workers, &wi))
+         {
+            goto error;
+         }
+
+         pgmoneta_workers_add(workers, do_copy_wal_stage, (struct worker_common*)wi);
+         wi = NULL;
+      }
+      else if (pgmoneta_stage_wal_file(waltarget, from, wal_files[i]))
+      {
+         goto error;
+      }
+
+      free(from);
+      from = NULL;
+   }
 
    pgmoneta_workers_wait(workers);
    if (workers != NULL && !workers->outcome)
@@ -794,7 +847,19 @@ copy_wal_execute(char* name __attribute__((unused)), struct art* nodes)
       goto error;
    }
    pgmoneta_workers_destroy(workers);
+   workers = NULL;
+
+   if (copy_wal_unpack(waltarget))
+   {
+      pgmoneta_log_error("Unable to prepare WAL in %s", waltarget);
+      goto error;
+   }
 
+   for (int i = 0; i < number_of_wal_files; i++)
+   {
+      free(wal_files[i]);
+   }
+   free(wal_files);
    free(origwal);
    free(waldir);
    free(waltarget);
@@ -803,14 +868,133 @@ copy_wal_execute(char* name __attribute__((unused)), struct art* nodes)
 error:
    if (number_of_workers > 0)
    {
+      pgmoneta_workers_wait(workers);
       pgmoneta_workers_destroy(workers);
    }
+   for (int i = 0; i < number_of_wal_files; i++)
+   {
+      free(wal_files[i]);
+   }
+   free(wal_files);
+   free(from);
    free(origwal);
    free(waldir);
    free(waltarget);
    return 1;
 }
 
+static void
+do_copy_wal_stage(struct worker_common* wc)
+{
+   struct worker_input* wi = (struct worker_input*)wc;
+
+   if (pgmoneta_stage_wal_file(wi->directory, wi->from, wi->to))
+   {
+      wi->common.workers->outcome = false;
+   }
+
+   free(wi);
+}
+
+static int
+copy_wal_unpack(char* directory)
+{
+   int number_of_files = 0;
+   char** files = NULL;
+   char* name = NULL;
+   char* stripped = NULL;
+   char* from = NULL;
+   char* to = NULL;
+
+   if (pgmoneta_get_files(directory, &number_of_files, &files))
+   {
+      goto error;
+   }
+
+   // PostgreSQL needs plain segments of the full size in pg_wal
+   for (int i = 0; i < number_of_files; i++)
+   {
+      name = pgmoneta_append(NULL, files[i]);
+      from = pgmoneta_append(NULL, directory);
+      from = pgmoneta_append(from, files[i]);
+
+      if (pgmoneta_is_encrypted(name))
+      {
+         if (pgmoneta_strip_extension(name, &stripped))
+         {
+            goto error;
+         }
+
+         to = pgmoneta_append(NULL, directory);
+         to = pgmoneta_append(to, stripped);
+
+         if (pgmoneta_decrypt_file(from, to))
+         {
+            goto error;
+         }
+
+         free(from);
+         free(name);
+         from = to;
+         name = stripped;
+         to = NULL;
+         stripped = NULL;
+      }
+
+      if (pgmoneta_is_compressed(name))
+      {
+         if (pgmoneta_strip_extension(name, &stripped))
+         {
+            goto error;
+         }
+
+         to = pgmoneta_append(NULL, directory);
+         to = pgmoneta_append(to, stripped);
+
+         if (pgmoneta_decompress(from, to))
+         {
+            goto error;
+         }
+
+         if (pgmoneta_exists(from))
+         {
+            pgmoneta_delete_file(from, NULL);
+         }
+
+         free(to);
+         free(stripped);
+         to = NULL;
+         stripped = NULL;
+      }
+
+      free(name);
+      free(from);
+      name = NULL;
+      from = NULL;
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+
+   return 0;
+
+error:
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+   free(name);
+   free(stripped);
+   free(from);
+   free(to);
+
+   return 1;
+}
+
 static char*
 restore_excluded_files_name(void)
 {
@@ -899,6 +1083,11 @@ restore_excluded_files_execute(char* name __attribute__((unused)), struct art* n
       case ENCRYPTION_AES_128_CTR:
          suffix = pgmoneta_append(suffix, ".aes");
          break;
+      case ENCRYPTION_AES_256_GCM:
+      case ENCRYPTION_AES_192_GCM:
+      case ENCRYPTION_AES_128_GCM:
+         suffix = pgmoneta_append(suffix, ".aes");
+         break;
       case ENCRYPTION_NONE:
          break;
       default:
@@ -925,7 +1114,25 @@ restore_excluded_files_execute(char* name __attribute__((unused)), struct art* n
 
       to_file = pgmoneta_append(to_file, to);
       to_file = pgmoneta_append(to_file, restore_last_files_names[i]);
-      to_file = pgmoneta_append(to_file, suffix);
+
+      if (!pgmoneta_exists(from_file) && backup->compression != COMPRESSION_NONE)
+      {
+         // compression_adaptive stored the file without compression
+         free(from_file);
+         from_file = NULL;
+
+         from_file = pgmoneta_append(from_file, from);
+         from_file = pgmoneta_append(from_file, restore_last_files_names[i]);
+         if (backup->encryption != ENCRYPTION_NONE)
+         {
+            from_file = pgmoneta_append(from_file, ".aes");
+            to_file = pgmoneta_append(to_file, ".aes");
+         }
+      }
+      else
+      {
+         to_file = pgmoneta_append(to_file, suffix);
+      }
 
       pgmoneta_log_trace("Excluded: %s -> %s", from_file, to_file);
 
@@ -1057,6 +1264,11 @@ restore_excluded_files_teardown(char* name __attribute__((unused)), struct art*
       case ENCRYPTION_AES_128_CTR:
          suffix = pgmoneta_append(suffix, ".aes");
          break;
+      case ENCRYPTION_AES_256_GCM:
+      case ENCRYPTION_AES_192_GCM:
+      case ENCRYPTION_AES_128_GCM:
+         suffix = pgmoneta_append(suffix, ".aes");
+         break;
       case ENCRYPTION_NONE:
          break;
       default:
@@ -1085,6 +1297,22 @@ restore_excluded_files_teardown(char* name __attribute__((unused)), struct art*
          pgmoneta_log_debug("%s doesn't exists", to_file);
       }
 
+      if (backup->compression != COMPRESSION_NONE && backup->encryption != ENCRYPTION_NONE)
+      {
+         // a file stored without compression by compression_adaptive
+         free(to_file);
+         to_file = NULL;
+
+         to_file = pgmoneta_append(to_file, to);
+         to_file = pgmoneta_append(to_file, restore_last_files_names[i]);
+         to_file = pgmoneta_append(to_file, ".aes");
+
+         if (pgmoneta_exists(to_file))
+         {
+            pgmoneta_delete_file(to_file, NULL);
+         }
+      }
+
       free(to_file);
       to_file = NULL;
    }
@@ -44,7 +44,7 @@
 static char* sha512_name(void);
 static int sha512_execute(char*, struct art*);
 
-static int write_backup_sha512(char* root, char* relative_path);
+static int write_backup_sha512(char* root, char* relative_path, struct art* checksums);
 
 static FILE* sha512_file = NULL;
 
@@ -78,6 +78,7 @@ sha512_execute(char* name __attribute__((unused)), struct art* nodes)
    char* root = NULL;
    char* d = NULL;
    char* sha512_path = NULL;
+   struct art* checksums = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -113,7 +114,9 @@ sha512_execute(char* name __attribute__((unused)), struct art* nodes)
 
    d = pgmoneta_get_server_backup_identifier_data(server, label);
 
-   if (write_backup_sha512(root, ""))
+   checksums = (struct art*)pgmoneta_art_search(nodes, NODE_CHECKSUMS);
+
+   if (write_backup_sha512(root, "", checksums))
    {
       goto error;
    }
@@ -143,7 +146,7 @@ error:
 }
 
 static int
-write_backup_sha512(char* root, char* relative_path)
+write_backup_sha512(char* root, char* relative_path, struct art* checksums)
 {
    char* dir_path = NULL;
    char* relative_file_path;
@@ -174,7 +177,7 @@ write_backup_sha512(char* root, char* relative_path)
 
          snprintf(relative_dir, sizeof(relative_dir), "%s/%s", relative_path, entry->d_name);
 
-         write_backup_sha512(root, relative_dir);
+         write_backup_sha512(root, relative_dir, checksums);
       }
       else if (strcmp(entry->d_name, "backup.sha512"))
       {
@@ -191,7 +194,15 @@ write_backup_sha512(char* root, char* relative_path)
          absolute_file_path = pgmoneta_append(absolute_file_path, "/");
          absolute_file_path = pgmoneta_append(absolute_file_path, relative_file_path);
 
-         pgmoneta_create_sha512_file(absolute_file_path, &sha512);
+         /* Regular files written by the pipeline already have their checksum */
+         if (entry->d_type == DT_REG && pgmoneta_art_contains_key(checksums, relative_file_path))
+         {
+            sha512 = pgmoneta_append(sha512, (char*)pgmoneta_art_search(checksums, relative_file_path));
+         }
+         else
+         {
+            pgmoneta_create_sha512_file(absolute_file_path, &sha512);
+         }
 
          buffer = pgmoneta_append(buffer, sha512);
          buffer = pgmoneta_append(buffer, " *.");
@@ -0,0 +1,1107 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <art.h>
+#include <brt.h>
+#include <info.h>
+#include <json.h>
+#include <logging.h>
+#include <manifest.h>
+#include <security.h>
+#include <summary.h>
+#include <utils.h>
+#include <workflow.h>
+#include <walfile/wal_reader.h>
+
+/* system */
+#include <assert.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Seconds to wait for the WAL segment holding the start of the backup */
+#define SUMMARY_WAIT 60
+
+#define DEFAULT_TABLESPACE_OID 1663
+#define GLOBAL_TABLESPACE_OID  1664
+
+/**
+ * The state of turning the relation files of a backup into incremental files
+ */
+struct summary_conversion
+{
+   int server;                   /**< The server */
+   char* data;                   /**< The data directory of the backup */
+   struct art* parent_files;     /**< The files of the parent backup */
+   block_ref_table* brt;         /**< The blocks modified since the parent backup */
+   struct art* converted;        /**< The manifest paths that changed, mapped to their new path */
+   uint64_t incremental_files;   /**< The number of incremental files */
+   uint64_t full_files;          /**< The number of relation files kept in full */
+};
+
+static char* summary_name(void);
+static int summary_execute(char*, struct art*);
+
+static int keep_full(char* backup_dir, struct backup* backup, struct art* nodes);
+static int load_parent_files(char* parent_data, struct art** files);
+static int convert_tablespaces(struct summary_conversion* c);
+static int convert_databases(struct summary_conversion* c, char* relative_dir, oid spc);
+static int convert_directory(struct summary_conversion* c, char* relative_dir, oid spc, oid db);
+static int convert_file(struct summary_conversion* c, char* relative_dir, char* name, oid spc, oid db,
+                        rel_file_number rel, enum fork_number forknum, uint32_t segno);
+static int write_incremental_file(int server, char* from, char* to, block_number* blocks, uint32_t nblocks,
+                                  uint32_t truncation_block_length);
+static bool parse_relation_name(char* name, rel_file_number* rel, enum fork_number* forknum, uint32_t* segno);
+static bool is_oid(char* name);
+static int block_compare(const void* a, const void* b);
+static int update_backup_label(struct summary_conversion* c, struct backup* parent);
+static int update_manifest(struct summary_conversion* c);
+
+struct workflow*
+pgmoneta_create_summary(void)
+{
+   struct workflow* wf = NULL;
+
+   wf = (struct workflow*)malloc(sizeof(struct workflow));
+
+   if (wf == NULL)
+   {
+      return NULL;
+   }
+
+   wf->name = &summary_name;
+   wf->setup = &pgmoneta_common_setup;
+   wf->execute = &summary_execute;
+   wf->teardown = &pgmoneta_common_teardown;
+   wf->next = NULL;
+
+   return wf;
+}
+
+static char*
+summary_name(void)
+{
+   return "Summary";
+}
+
+static int
+summary_execute(char* name __attribute__((unused)), struct art* nodes)
+{
+   int server = -1;
+   char* label = NULL;
+   char* incremental_label = NULL;
+   struct timespec start_t;
+   struct timespec end_t;
+   double summary_elapsed_time;
+   int hours;
+   int minutes;
+   double seconds;
+   char elapsed[128];
+   uint64_t start_lsn;
+   uint64_t parent_lsn;
+   char* backup_dir = NULL;
+   char* parent_data = NULL;
+   struct backup* backup = NULL;
+   struct backup* parent = NULL;
+   struct summary_conversion c;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef DEBUG
+   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
+   {
+      char* a = NULL;
+      a = pgmoneta_art_to_string(nodes, FORMAT_TEXT, NULL, 0);
+      pgmoneta_log_debug("(Tree)\n%s", a);
+      free(a);
+   }
+   assert(nodes != NULL);
+   assert(pgmoneta_art_contains_key(nodes, NODE_SERVER_ID));
+   assert(pgmoneta_art_contains_key(nodes, NODE_LABEL));
+   assert(pgmoneta_art_contains_key(nodes, NODE_BACKUP_DATA));
+#endif
+
+   memset(&c, 0, sizeof(struct summary_conversion));
+
+   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
+   label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
+   incremental_label = (char*)pgmoneta_art_search(nodes, NODE_INCREMENTAL_LABEL);
+
+   /* The server built the incremental backup itself */
+   if (incremental_label == NULL || !pgmoneta_summary_is_local(server))
+   {
+      return 0;
+   }
+
+   pgmoneta_log_debug("Summary (execute): %s/%s", config->common.servers[server].name, label);
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   backup_dir = pgmoneta_get_server_backup(server);
+
+   if (pgmoneta_load_info(backup_dir, label, &backup) || backup == NULL)
+   {
+      pgmoneta_log_error("Summary: Unable to get backup %s for %s", label, config->common.servers[server].name);
+      goto error;
+   }
+
+   if (pgmoneta_load_info(backup_dir, incremental_label, &parent) || parent == NULL)
+   {
+      pgmoneta_log_error("Summary: Unable to get backup %s for %s", incremental_label, config->common.servers[server].name);
+      goto error;
+   }
+
+   start_lsn = ((uint64_t)backup->start_lsn_hi32 << 32) | backup->start_lsn_lo32;
+   parent_lsn = ((uint64_t)parent->start_lsn_hi32 << 32) | parent->start_lsn_lo32;
+
+   if (parent->start_timeline != backup->start_timeline)
+   {
+      pgmoneta_log_warn("Summary: Timeline changed since %s, %s/%s is a full backup",
+                        parent->label, config->common.servers[server].name, label);
+      if (keep_full(backup_dir, backup, nodes))
+      {
+         goto error;
+      }
+      goto done;
+   }
+
+   /* The segment holding the start of the backup is archived once the backup has ended */
+   for (int i = 0; i < SUMMARY_WAIT; i++)
+   {
+      pgmoneta_summarize_wal(server);
+
+      if (pgmoneta_summary_exists(server, backup->start_timeline, start_lsn))
+      {
+         break;
+      }
+
+      sleep(1);
+   }
+
+   if (pgmoneta_summarize_range(server, backup->start_timeline, parent_lsn, start_lsn, &c.brt))
+   {
+      pgmoneta_log_warn("Summary: WAL from %X/%X to %X/%X is not summarized, %s/%s is a full backup",
+                        parent->start_lsn_hi32, parent->start_lsn_lo32,
+                        backup->start_lsn_hi32, backup->start_lsn_lo32,
+                        config->common.servers[server].name, label);
+      if (keep_full(backup_dir, backup, nodes))
+      {
+         goto error;
+      }
+      goto done;
+   }
+
+   parent_data = pgmoneta_get_server_backup_identifier_data(server, parent->label);
+
+   c.server = server;
+   c.data = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_DATA);
+
+   if (load_parent_files(parent_data, &c.parent_files))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_create(&c.converted))
+   {
+      goto error;
+   }
+
+   if (convert_directory(&c, "global/", GLOBAL_TABLESPACE_OID, 0))
+   {
+      goto error;
+   }
+
+   if (convert_databases(&c, "base/", DEFAULT_TABLESPACE_OID))
+   {
+      goto error;
+   }
+
+   if (convert_tablespaces(&c))
+   {
+      goto error;
+   }
+
+   if (update_backup_label(&c, parent))
+   {
+      goto error;
+   }
+
+   if (update_manifest(&c))
+   {
+      goto error;
+   }
+
+   pgmoneta_log_debug("Summary: %s/%s has %" PRIu64 " incremental and %" PRIu64 " full relation files",
+                      config->common.servers[server].name, label, c.incremental_files, c.full_files);
+
+done:
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   summary_elapsed_time = pgmoneta_compute_duration(start_t, end_t);
+   hours = (int)summary_elapsed_time / 3600;
+   minutes = ((int)summary_elapsed_time % 3600) / 60;
+   seconds = (int)summary_elapsed_time % 60 + (summary_elapsed_time - ((long)summary_elapsed_time));
+
+   memset(&elapsed[0], 0, sizeof(elapsed));
+   sprintf(&elapsed[0], "%02i:%02i:%.4f", hours, minutes, seconds);
+
+   pgmoneta_log_debug("Summary: %s/%s (Elapsed: %s)", config->common.servers[server].name, label, &elapsed[0]);
+
+   pgmoneta_brt_destroy(c.brt);
+   pgmoneta_art_destroy(c.parent_files);
+   pgmoneta_art_destroy(c.converted);
+   free(parent_data);
+   free(backup_dir);
+   free(backup);
+   free(parent);
+
+   return 0;
+
+error:
+
+   pgmoneta_brt_destroy(c.brt);
+   pgmoneta_art_destroy(c.parent_files);
+   pgmoneta_art_destroy(c.converted);
+   free(parent_data);
+   free(backup_dir);
+   free(backup);
+   free(parent);
+
+   return 1;
+}
+
+static int
+keep_full(char* backup_dir, struct backup* backup, struct art* nodes)
+{
+   backup->type = TYPE_FULL;
+   memset(backup->parent_label, 0, sizeof(backup->parent_label));
+
+   if (pgmoneta_save_info(backup_dir, backup))
+   {
+      return 1;
+   }
+
+   pgmoneta_art_delete(nodes, NODE_INCREMENTAL_BASE);
+   pgmoneta_art_delete(nodes, NODE_INCREMENTAL_LABEL);
+
+   return 0;
+}
+
+static int
+load_parent_files(char* parent_data, struct art** files)
+{
+   char* manifest = NULL;
+   char* path = NULL;
+   char* base = NULL;
+   char* key_path[1] = {"Files"};
+   char file_path[MAX_PATH];
+   struct art* f = NULL;
+   struct json_reader* reader = NULL;
+   struct json* entry = NULL;
+
+   *files = NULL;
+
+   manifest = pgmoneta_append(manifest, parent_data);
+   manifest = pgmoneta_append(manifest, "backup_manifest");
+
+   if (pgmoneta_art_create(&f))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_json_reader_init(manifest, &reader))
+   {
+      pgmoneta_log_error("Summary: Could not read %s", manifest);
+      goto error;
+   }
+
+   if (pgmoneta_json_locate(reader, key_path, 1))
+   {
+      pgmoneta_log_error("Summary: Could not locate files array in manifest %s", manifest);
+      goto error;
+   }
+
+   while (pgmoneta_json_next_array_item(reader, &entry))
+   {
+      path = (char*)pgmoneta_json_get(entry, "Path");
+
+      if (path != NULL)
+      {
+         /* A file of an incremental parent counts as present under its own name */
+         base = strrchr(path, '/');
+         base = base != NULL ? base + 1 : path;
+
+         memset(file_path, 0, sizeof(file_path));
+         if (pgmoneta_starts_with(base, INCREMENTAL_PREFIX))
+         {
+            snprintf(file_path, sizeof(file_path), "%.*s%s", (int)(base - path), path, base + INCREMENTAL_PREFIX_LENGTH);
+         }
+         else
+         {
+            snprintf(file_path, sizeof(file_path), "%s", path);
+         }
+
+         if (pgmoneta_art_insert(f, file_path, (uintptr_t)true, ValueBool))
+         {
+            goto error;
+         }
+      }
+
+      pgmoneta_json_destroy(entry);
+      entry = NULL;
+   }
+
+   pgmoneta_json_reader_close(reader);
+   free(manifest);
+
+   *files = f;
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(entry);
+   pgmoneta_json_reader_close(reader);
+   pgmoneta_art_destroy(f);
+   free(manifest);
+
+   return 1;
+}
+
+static int
+convert_tablespaces(struct summary_conversion* c)
+{
+   char* d = NULL;
+   char* relative_dir = NULL;
+   DIR* dir = NULL;
+   struct dirent* entry;
+   int number_of_directories = 0;
+   char** directories = NULL;
+
+   d = pgmoneta_append(d, c->data);
+   d = pgmoneta_append(d, "pg_tblspc/");
+
+   if (!(dir = opendir(d)))
+   {
+      free(d);
+      return 0;
+   }
+
+   /* The entries are links to the tablespace directories of the backup */
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (!is_oid(entry->d_name))
+      {
+         continue;
+      }
+
+      relative_dir = pgmoneta_append(NULL, "pg_tblspc/");
+      relative_dir = pgmoneta_append(relative_dir, entry->d_name);
+      relative_dir = pgmoneta_append(relative_dir, "/");
+
+      free(d);
+      d = pgmoneta_append(NULL, c->data);
+      d = pgmoneta_append(d, relative_dir);
+
+      if (pgmoneta_get_directories(d, &number_of_directories, &directories))
+      {
+         number_of_directories = 0;
+      }
+
+      for (int i = 0; i < number_of_directories; i++)
+      {
+         char* version_dir = NULL;
+
+         if (pgmoneta_starts_with(directories[i], "PG_"))
+         {
+            version_dir = pgmoneta_append(version_dir, relative_dir);
+            version_dir = pgmoneta_append(version_dir, directories[i]);
+            version_dir = pgmoneta_append(version_dir, "/");
+
+            if (convert_databases(c, version_dir, (oid)strtoul(entry->d_name, NULL, 10)))
+            {
+               free(version_dir);
+               goto error;
+            }
+         }
+
+         free(version_dir);
+      }
+
+      for (int i = 0; i < number_of_directories; i++)
+      {
+         free(directories[i]);
+      }
+      free(directories);
+      directories = NULL;
+      number_of_directories = 0;
+
+      free(relative_dir);
+      relative_dir = NULL;
+   }
+
+   closedir(dir);
+   free(d);
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < number_of_directories; i++)
+   {
+      free(directories[i]);
+   }
+   free(directories);
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   free(relative_dir);
+   free(d);
+
+   return 1;
+}
+
+static int
+convert_databases(struct summary_conversion* c, char* relative_dir, oid spc)
+{
+   char* d = NULL;
+   char* db_dir = NULL;
+   int number_of_directories = 0;
+   char** directories = NULL;
+
+   d = pgmoneta_append(d, c->data);
+   d = pgmoneta_append(d, relative_dir);
+
+   if (pgmoneta_get_directories(d, &number_of_directories, &directories))
+   {
+      free(d);
+      return 0;
+   }
+
+   for (int i = 0; i < number_of_directories; i++)
+   {
+      if (!is_oid(directories[i]))
+      {
+         continue;
+      }
+
+      db_dir = pgmoneta_append(NULL, relative_dir);
+      db_dir = pgmoneta_append(db_dir, directories[i]);
+      db_dir = pgmoneta_append(db_dir, "/");
+
+      if (convert_directory(c, db_dir, spc, (oid)strtoul(directories[i], NULL, 10)))
+      {
+         goto error;
+      }
+
+      free(db_dir);
+      db_dir = NULL;
+   }
+
+   for (int i = 0; i < number_of_directories; i++)
+   {
+      free(directories[i]);
+   }
+   free(directories);
+   free(d);
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < number_of_directories; i++)
+   {
+      free(directories[i]);
+   }
+   free(directories);
+   free(db_dir);
+   free(d);
+
+   return 1;
+}
+
+static int
+convert_directory(struct summary_conversion* c, char* relative_dir, oid spc, oid db)
+{
+   char* d = NULL;
+   int number_of_files = 0;
+   char** files = NULL;
+   rel_file_number rel;
+   enum fork_number forknum;
+   uint32_t segno;
+
+   d = pgmoneta_append(d, c->data);
+   d = pgmoneta_append(d, relative_dir);
+
+   if (pgmoneta_get_files(d, &number_of_files, &files))
+   {
+      free(d);
+      return 0;
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      if (!parse_relation_name(files[i], &rel, &forknum, &segno))
+      {
+         continue;
+      }
+
+      if (convert_file(c, relative_dir, files[i], spc, db, rel, forknum, segno))
+      {
+         goto error;
+      }
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+   free(d);
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+   free(d);
+
+   return 1;
+}
+
+static int
+convert_file(struct summary_conversion* c, char* relative_dir, char* name, oid spc, oid db,
+             rel_file_number rel, enum fork_number forknum, uint32_t segno)
+{
+   size_t block_size;
+   size_t relseg_size;
+   size_t size;
+   uint32_t file_blocks;
+   uint32_t truncation_block_length;
+   block_number start_blkno;
+   block_number limit_block = InvalidBlockNumber;
+   int nblocks = 0;
+   int ret;
+   char manifest_path[MAX_PATH];
+   char incremental_path[MAX_PATH];
+   char from[MAX_PATH + MAX_PATH];
+   char to[MAX_PATH + MAX_PATH];
+   block_number* blocks = NULL;
+   block_ref_table_entry* entry = NULL;
+   struct rel_file_locator rlocator;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   block_size = config->common.servers[c->server].block_size;
+   relseg_size = config->common.servers[c->server].relseg_size;
+
+   snprintf(manifest_path, sizeof(manifest_path), "%s%s", relative_dir, name);
+   snprintf(incremental_path, sizeof(incremental_path), "%s%s%s", relative_dir, INCREMENTAL_PREFIX, name);
+   snprintf(from, sizeof(from), "%s%s", c->data, manifest_path);
+   snprintf(to, sizeof(to), "%s%s", c->data, incremental_path);
+
+   size = pgmoneta_get_file_size(from);
+
+   /* The same rules as the server uses to choose between a full and an incremental file */
+   if (block_size == 0 || size % block_size != 0 || size / block_size > relseg_size)
+   {
+      goto full;
+   }
+
+   /* The free space map isn't WAL-logged reliably */
+   if (forknum == FSM_FORKNUM)
+   {
+      goto full;
+   }
+
+   if (!pgmoneta_art_contains_key(c->parent_files, manifest_path))
+   {
+      goto full;
+   }
+
+   /* The database was created or dropped since the parent backup */
+   memset(&rlocator, 0, sizeof(struct rel_file_locator));
+   rlocator.spcOid = spc;
+   rlocator.dbOid = db;
+   rlocator.relNumber = 0;
+
+   if (pgmoneta_brt_get_entry(c->brt, &rlocator, MAIN_FORKNUM, &limit_block) != NULL)
+   {
+      goto full;
+   }
+
+   rlocator.relNumber = rel;
+   limit_block = InvalidBlockNumber;
+   entry = pgmoneta_brt_get_entry(c->brt, &rlocator, forknum, &limit_block);
+
+   file_blocks = size / block_size;
+   start_blkno = segno * relseg_size;
+   truncation_block_length = file_blocks;
+
+   if (entry == NULL)
+   {
+      /* No change at all, but an empty file is smaller when kept in full */
+      if (size == 0)
+      {
+         goto full;
+      }
+   }
+   else
+   {
+      if (limit_block <= start_blkno)
+      {
+         goto full;
+      }
+
+      blocks = (block_number*)malloc(relseg_size * sizeof(block_number));
+      if (blocks == NULL)
+      {
+         goto error;
+      }
+
+      ret = pgmoneta_brt_entry_get_blocks(entry, start_blkno, start_blkno + file_blocks, blocks, relseg_size, &nblocks);
+      if (ret != 0)
+      {
+         /* The buffer is full */
+         nblocks = ret;
+      }
+
+      if (file_blocks > 0 && (double)nblocks / file_blocks > 0.9)
+      {
+         goto full;
+      }
+
+      for (int i = 0; i < nblocks; i++)
+      {
+         blocks[i] -= start_blkno;
+      }
+      qsort(blocks, nblocks, sizeof(block_number), block_compare);
+
+      /* The file must be at least as long as it was when the relation got its limit */
+      if (limit_block != InvalidBlockNumber && limit_block - start_blkno > truncation_block_length)
+      {
+         truncation_block_length = limit_block - start_blkno;
+         if (truncation_block_length > relseg_size)
+         {
+            truncation_block_length = relseg_size;
+         }
+      }
+   }
+
+   if (write_incremental_file(c->server, from, to, blocks, nblocks, truncation_block_length))
+   {
+      pgmoneta_log_error("Summary: Could not write %s", to);
+      goto error;
+   }
+
+   pgmoneta_delete_file(from, NULL);
+
+   if (pgmoneta_art_insert(c->converted, manifest_path, (uintptr_t)incremental_path, ValueString))
+   {
+      goto error;
+   }
+
+   c->incremental_files++;
+
+   free(blocks);
+
+   return 0;
+
+full:
+
+   c->full_files++;
+
+   free(blocks);
+
+   return 0;
+
+error:
+
+   free(blocks);
+
+   return 1;
+}
+
+static int
+write_incremental_file(int server, char* from, char* to, block_number* blocks, uint32_t nblocks,
+                       uint32_t truncation_block_length)
+{
+   uint32_t magic = INCREMENTAL_MAGIC;
+   size_t block_size;
+   size_t header_length;
+   char* page = NULL;
+   FILE* in = NULL;
+   FILE* out = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   block_size = config->common.servers[server].block_size;
+
+   page = (char*)calloc(1, block_size);
+   if (page == NULL)
+   {
+      goto error;
+   }
+
+   in = fopen(from, "rb");
+   if (in == NULL)
+   {
+      goto error;
+   }
+
+   out = fopen(to, "wb");
+   if (out == NULL)
+   {
+      goto error;
+   }
+
+   /* magic number, number of blocks, truncation block length and the relative block numbers */
+   if (fwrite(&magic, sizeof(uint32_t), 1, out) != 1 ||
+       fwrite(&nblocks, sizeof(uint32_t), 1, out) != 1 ||
+       fwrite(&truncation_block_length, sizeof(uint32_t), 1, out) != 1)
+   {
+      goto error;
+   }
+
+   if (nblocks > 0)
+   {
+      if (fwrite(blocks, sizeof(block_number), nblocks, out) != nblocks)
+      {
+         goto error;
+      }
+
+      /* The block data starts at a multiple of the block size */
+      header_length = sizeof(uint32_t) * (3 + nblocks);
+      if (header_length % block_size != 0)
+      {
+         if (fwrite(page, 1, block_size - (header_length % block_size), out) != block_size - (header_length % block_size))
+         {
+            goto error;
+         }
+      }
+   }
+
+   for (uint32_t i = 0; i < nblocks; i++)
+   {
+      if (fseeko(in, (off_t)blocks[i] * block_size, SEEK_SET) ||
+          fread(page, 1, block_size, in) != block_size ||
+          fwrite(page, 1, block_size, out) != block_size)
+      {
+         goto error;
+      }
+   }
+
+   if (fflush(out))
+   {
+      goto error;
+   }
+
+   fclose(in);
+   fclose(out);
+   free(page);
+
+   return 0;
+
+error:
+
+   if (in != NULL)
+   {
+      fclose(in);
+   }
+
+   if (out != NULL)
+   {
+      fclose(out);
+      pgmoneta_delete_file(to, NULL);
+   }
+
+   free(page);
+
+   return 1;
+}
+
+static bool
+parse_relation_name(char* name, rel_file_number* rel, enum fork_number* forknum, uint32_t* segno)
+{
+   char* p = name;
+   uint64_t value = 0;
+
+   if (*p < '0' || *p > '9')
+   {
+      return false;
+   }
+
+   while (*p >= '0' && *p <= '9')
+   {
+      value = value * 10 + (*p - '0');
+      if (value > UINT32_MAX)
+      {
+         return false;
+      }
+      p++;
+   }
+
+   *rel = (rel_file_number)value;
+   *forknum = MAIN_FORKNUM;
+   *segno = 0;
+
+   if (*p == '_')
+   {
+      p++;
+      if (!strncmp(p, "fsm", 3))
+      {
+         *forknum = FSM_FORKNUM;
+         p += 3;
+      }
+      else if (!strncmp(p, "vm", 2))
+      {
+         *forknum = VISIBILITYMAP_FORKNUM;
+         p += 2;
+      }
+      else if (!strncmp(p, "init", 4))
+      {
+         *forknum = INIT_FORKNUM;
+         p += 4;
+      }
+      else
+      {
+         return false;
+      }
+   }
+
+   if (*p == '.')
+   {
+      p++;
+      value = 0;
+
+      if (*p < '0' || *p > '9')
+      {
+         return false;
+      }
+
+      while (*p >= '0' && *p <= '9')
+      {
+         value = value * 10 + (*p - '0');
+         if (value > UINT32_MAX)
+         {
+            return false;
+         }
+         p++;
+      }
+
+      *segno = (uint32_t)value;
+   }
+
+   return *p == '\0';
+}
+
+static bool
+is_oid(char* name)
+{
+   if (name == NULL || *name == '\0')
+   {
+      return false;
+   }
+
+   for (char* p = name; *p != '\0'; p++)
+   {
+      if (*p < '0' || *p > '9')
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static int
+block_compare(const void* a, const void* b)
+{
+   block_number ba = *(const block_number*)a;
+   block_number bb = *(const block_number*)b;
+
+   if (ba < bb)
+   {
+      return -1;
+   }
+
+   return ba > bb ? 1 : 0;
+}
+
+static int
+update_backup_label(struct summary_conversion* c, struct backup* parent)
+{
+   char path[MAX_PATH];
+   FILE* file = NULL;
+
+   snprintf(path, sizeof(path), "%sbackup_label", c->data);
+
+   file = fopen(path, "a");
+   if (file == NULL)
+   {
+      pgmoneta_log_error("Summary: Could not open %s", path);
+      goto error;
+   }
+
+   /* The same lines as in the backup label of an incremental backup taken by the server */
+   if (fprintf(file, "INCREMENTAL FROM LSN: %X/%X\n", parent->start_lsn_hi32, parent->start_lsn_lo32) < 0 ||
+       fprintf(file, "INCREMENTAL FROM TLI: %u\n", parent->start_timeline) < 0)
+   {
+      pgmoneta_log_error("Summary: Could not write %s", path);
+      goto error;
+   }
+
+   fclose(file);
+
+   if (pgmoneta_art_insert(c->converted, "backup_label", (uintptr_t)"backup_label", ValueString))
+   {
+      return 1;
+   }
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   return 1;
+}
+
+static int
+update_manifest(struct summary_conversion* c)
+{
+   char* path = NULL;
+   char* new_path = NULL;
+   char* checksum = NULL;
+   char manifest_path[MAX_PATH];
+   char file_path[MAX_PATH + MAX_PATH];
+   struct json* manifest = NULL;
+   struct json* files = NULL;
+   struct json* f = NULL;
+   struct json_iterator* iter = NULL;
+
+   snprintf(manifest_path, sizeof(manifest_path), "%sbackup_manifest", c->data);
+
+   if (pgmoneta_json_read_file(manifest_path, &manifest))
+   {
+      pgmoneta_log_error("Summary: Could not read %s", manifest_path);
+      goto error;
+   }
+
+   files = (struct json*)pgmoneta_json_get(manifest, MANIFEST_FILES);
+   if (files == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_json_iterator_create(files, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_json_iterator_next(iter))
+   {
+      f = (struct json*)pgmoneta_value_data(iter->value);
+      path = (char*)pgmoneta_json_get(f, "Path");
+
+      if (path == NULL || !pgmoneta_art_contains_key(c->converted, path))
+      {
+         continue;
+      }
+
+      new_path = pgmoneta_append(NULL, (char*)pgmoneta_art_search(c->converted, path));
+      snprintf(file_path, sizeof(file_path), "%s%s", c->data, new_path);
+
+      if (pgmoneta_create_sha512_file(file_path, &checksum))
+      {
+         pgmoneta_log_error("Summary: Could not calculate the checksum of %s", file_path);
+         goto error;
+      }
+
+      pgmoneta_json_put(f, "Path", (uintptr_t)new_path, ValueString);
+      pgmoneta_json_put(f, "Size", (uintptr_t)pgmoneta_get_file_size(file_path), ValueUInt64);
+      pgmoneta_json_put(f, "Checksum-Algorithm", (uintptr_t)"SHA512", ValueString);
+      pgmoneta_json_put(f, "Checksum", (uintptr_t)checksum, ValueString);
+
+      free(new_path);
+      new_path = NULL;
+      free(checksum);
+      checksum = NULL;
+   }
+
+   pgmoneta_json_iterator_destroy(iter);
+   iter = NULL;
+
+   if (pgmoneta_write_postgresql_manifest(manifest, manifest_path))
+   {
+      pgmoneta_log_error("Summary: Could not write %s", manifest_path);
+      goto error;
+   }
+
+   pgmoneta_json_destroy(manifest);
+
+   return 0;
+
+error:
+
+   free(new_path);
+   free(checksum);
+   pgmoneta_json_iterator_destroy(iter);
+   pgmoneta_json_destroy(manifest);
+
+   return 1;
+}
@@ -28,6 +28,8 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <dictionary.h>
+#include <info.h>
 #include <logging.h>
 #include <utils.h>
 #include <zstandard_compression.h>
@@ -140,6 +142,11 @@ zstd_execute_compress(char* name __attribute__((unused)), struct art* nodes)
       server_backup = (char*)pgmoneta_art_search(nodes, NODE_SERVER_BACKUP);
       backup_data = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_DATA);
 
+      if (config->compression_dictionary)
+      {
+         pgmoneta_dictionary_train(server, DICTIONARY_TYPE_DATA, backup_data);
+      }
+
       pgmoneta_zstandardc_data(backup_data, workers);
       pgmoneta_zstandardc_tablespaces(backup_base, workers);
 
@@ -189,6 +196,10 @@ zstd_execute_compress(char* name __attribute__((unused)), struct art* nodes)
       goto error;
    }
    backup->compression_zstd_elapsed_time = compression_zstd_elapsed_time;
+   if (tarfile == NULL && config->compression_dictionary)
+   {
+      backup->dictionary = pgmoneta_dictionary_current(server, DICTIONARY_TYPE_DATA);
+   }
    if (pgmoneta_save_info(server_backup, backup))
    {
       goto error;
@@ -247,6 +258,8 @@ zstd_execute_uncompress(char* name __attribute__((unused)), struct art* nodes)
 
    pgmoneta_log_debug("ZSTD (decompress): %s/%s", config->common.servers[server].name, label);
 
+   pgmoneta_dictionary_register(server);
+
    base = (char*)pgmoneta_art_search(nodes, NODE_TARGET_BASE);
    if (base == NULL)
    {
@@ -32,6 +32,7 @@
 #include <hot_standby.h>
 #include <logging.h>
 #include <management.h>
+#include <pipeline.h>
 #include <storage.h>
 #include <utils.h>
 #include <workflow.h>
@@ -421,31 +422,46 @@ wf_backup(void)
    current->next = pgmoneta_create_hot_standby();
    current = current->next;
 
-   if (config->compression_type == COMPRESSION_CLIENT_GZIP || config->compression_type == COMPRESSION_SERVER_GZIP)
+   if (config->dedup_chunk_size > 0 &&
+       !(config->storage_engine & (STORAGE_ENGINE_SSH | STORAGE_ENGINE_S3 | STORAGE_ENGINE_AZURE)))
    {
-      current->next = pgmoneta_create_gzip(true);
-      current = current->next;
-   }
-   else if (config->compression_type == COMPRESSION_CLIENT_ZSTD || config->compression_type == COMPRESSION_SERVER_ZSTD)
-   {
-      current->next = pgmoneta_create_zstd(true);
+      current->next = pgmoneta_create_dedup(true);
       current = current->next;
    }
-   else if (config->compression_type == COMPRESSION_CLIENT_LZ4 || config->compression_type == COMPRESSION_SERVER_LZ4)
+
+   if (config->pipeline && pgmoneta_pipeline_supported(config->compression_type, config->encryption))
    {
-      current->next = pgmoneta_create_lz4(true);
+      current->next = pgmoneta_create_pipeline();
       current = current->next;
    }
-   else if (config->compression_type == COMPRESSION_CLIENT_BZIP2)
+   else
    {
-      current->next = pgmoneta_create_bzip2(true);
-      current = current->next;
-   }
+      if (config->compression_type == COMPRESSION_CLIENT_GZIP || config->compression_type == COMPRESSION_SERVER_GZIP)
+      {
+         current->next = pgmoneta_create_gzip(true);
+         current = current->next;
+      }
+      else if (config->compression_type == COMPRESSION_CLIENT_ZSTD || config->compression_type == COMPRESSION_SERVER_ZSTD)
+      {
+         current->next = pgmoneta_create_zstd(true);
+         current = current->next;
+      }
+      else if (config->compression_type == COMPRESSION_CLIENT_LZ4 || config->compression_type == COMPRESSION_SERVER_LZ4)
+      {
+         current->next = pgmoneta_create_lz4(true);
+         current = current->next;
+      }
+      else if (config->compression_type == COMPRESSION_CLIENT_BZIP2)
+      {
+         current->next = pgmoneta_create_bzip2(true);
+         current = current->next;
+      }
 
-   if (config->encryption != ENCRYPTION_NONE)
-   {
-      current->next = pgmoneta_encryption(true);
-      current = current->next;
+      if (config->encryption != ENCRYPTION_NONE)
+      {
+         current->next = pgmoneta_encryption(true);
+         current = current->next;
+      }
    }
 
 #ifdef DEBUG
@@ -537,6 +553,9 @@ wf_restore(struct backup* backup)
       current = current->next;
    }
 
+   current->next = pgmoneta_create_dedup(false);
+   current = current->next;
+
    current->next = pgmoneta_create_copy_wal();
    current = current->next;
 
@@ -715,6 +734,12 @@ wf_incremental_backup(void)
    head = pgmoneta_create_basebackup();
    current = head;
 
+   if (config->wal_summary)
+   {
+      current->next = pgmoneta_create_summary();
+      current = current->next;
+   }
+
    current->next = pgmoneta_create_manifest();
    current = current->next;
 
@@ -727,31 +752,39 @@ wf_incremental_backup(void)
    current->next = pgmoneta_create_hot_standby();
    current = current->next;
 
-   if (config->compression_type == COMPRESSION_CLIENT_GZIP || config->compression_type == COMPRESSION_SERVER_GZIP)
-   {
-      current->next = pgmoneta_create_gzip(true);
-      current = current->next;
-   }
-   else if (config->compression_type == COMPRESSION_CLIENT_ZSTD || config->compression_type == COMPRESSION_SERVER_ZSTD)
+   if (config->pipeline && pgmoneta_pipeline_supported(config->compression_type, config->encryption))
    {
-      current->next = pgmoneta_create_zstd(true);
+      current->next = pgmoneta_create_pipeline();
       current = current->next;
    }
-   else if (config->compression_type == COMPRESSION_CLIENT_LZ4 || config->compression_type == COMPRESSION_SERVER_LZ4)
-   {
-      current->next = pgmoneta_create_lz4(true);
-      current = current->next;
-   }
-   else if (config->compression_type == COMPRESSION_CLIENT_BZIP2)
+   else
    {
-      current->next = pgmoneta_create_bzip2(true);
-      current = current->next;
-   }
+      if (config->compression_type == COMPRESSION_CLIENT_GZIP || config->compression_type == COMPRESSION_SERVER_GZIP)
+      {
+         current->next = pgmoneta_create_gzip(true);
+         current = current->next;
+      }
+      else if (config->compression_type == COMPRESSION_CLIENT_ZSTD || config->compression_type == COMPRESSION_SERVER_ZSTD)
+      {
+         current->next = pgmoneta_create_zstd(true);
+         current = current->next;
+      }
+      else if (config->compression_type == COMPRESSION_CLIENT_LZ4 || config->compression_type == COMPRESSION_SERVER_LZ4)
+      {
+         current->next = pgmoneta_create_lz4(true);
+         current = current->next;
+      }
+      else if (config->compression_type == COMPRESSION_CLIENT_BZIP2)
+      {
+         current->next = pgmoneta_create_bzip2(true);
+         current = current->next;
+      }
 
-   if (config->encryption != ENCRYPTION_NONE)
-   {
-      current->next = pgmoneta_encryption(true);
-      current = current->next;
+      if (config->encryption != ENCRYPTION_NONE)
+      {
+         current->next = pgmoneta_encryption(true);
+         current = current->next;
+      }
    }
 
    current->next = pgmoneta_create_link();
@@ -835,6 +868,9 @@ wf_verify(struct backup* backup)
       current = current->next;
    }
 
+   current->next = pgmoneta_create_dedup(false);
+   current = current->next;
+
    current->next = pgmoneta_restore_excluded_files();
    current = current->next;
 
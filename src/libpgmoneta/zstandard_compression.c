@@ -28,9 +28,15 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <codec.h>
+#include <compression.h>
+#include <dictionary.h>
 #include <logging.h>
+#include <seekable.h>
 #include <management.h>
 #include <utils.h>
+#include <wal.h>
+#include <walindex.h>
 #include <zstandard_compression.h>
 
 /* system */
@@ -44,25 +50,17 @@
 #include <unistd.h>
 
 #define NAME "zstd"
-#define ZSTD_DEFAULT_NUMBER_OF_WORKERS 4
-
-static int zstd_compress(char* from, char* to, ZSTD_CCtx* cctx, size_t zin_size, void* zin, size_t zout_size, void* zout);
-static int zstd_decompress(char* from, char* to, ZSTD_DCtx* dctx, size_t zin_size, void* zin, size_t zout_size, void* zout);
 
 void
 pgmoneta_zstandardc_data(char* directory, struct workers* workers)
 {
-   size_t zin_size = -1;
-   void* zin = NULL;
-   size_t zout_size = -1;
-   void* zout = NULL;
-   ZSTD_CCtx* cctx = NULL;
    char* from = NULL;
    char* to = NULL;
    DIR* dir;
    struct dirent* entry;
    int level;
-   int ws;
+   int file_level;
+   bool dictionary;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -82,23 +80,6 @@ pgmoneta_zstandardc_data(char* directory, struct workers* workers)
       level = 19;
    }
 
-   ws = config->workers != 0 ? config->workers : ZSTD_DEFAULT_NUMBER_OF_WORKERS;
-
-   zin_size = ZSTD_CStreamInSize();
-   zin = malloc(zin_size);
-   zout_size = ZSTD_CStreamOutSize();
-   zout = malloc(zout_size);
-
-   cctx = ZSTD_createCCtx();
-   if (cctx == NULL)
-   {
-      goto error;
-   }
-
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, ws);
-
    while ((entry = readdir(dir)) != NULL)
    {
       if (entry->d_type == DT_DIR)
@@ -138,9 +119,14 @@ pgmoneta_zstandardc_data(char* directory, struct workers* workers)
             to = pgmoneta_append(to, entry->d_name);
             to = pgmoneta_append(to, ".zstd");
 
-            if (pgmoneta_exists(from))
+            file_level = level;
+
+            if (pgmoneta_exists(from) &&
+                pgmoneta_compression_decide(from, COMPRESSION_CLIENT_ZSTD, &file_level) != COMPRESSION_DECISION_STORE)
             {
-               if (zstd_compress(from, to, cctx, zin_size, zin, zout_size, zout))
+               dictionary = config->compression_dictionary && pgmoneta_get_file_size(from) <= DICTIONARY_SMALL_FILE;
+
+               if (pgmoneta_seekable_compress_file(from, to, COMPRESSION_CLIENT_ZSTD, file_level, dictionary))
                {
                   pgmoneta_log_error("ZSTD: Could not compress %s/%s", directory, entry->d_name);
                   break;
@@ -154,9 +140,6 @@ pgmoneta_zstandardc_data(char* directory, struct workers* workers)
                {
                   pgmoneta_log_debug("%s doesn't exists", from);
                }
-
-               memset(zin, 0, zin_size);
-               memset(zout, 0, zout_size);
             }
 
             free(from);
@@ -170,26 +153,6 @@ pgmoneta_zstandardc_data(char* directory, struct workers* workers)
 
    closedir(dir);
 
-   ZSTD_freeCCtx(cctx);
-
-   free(zin);
-   free(zout);
-
-   free(from);
-   free(to);
-
-   return;
-
-error:
-
-   if (cctx != NULL)
-   {
-      ZSTD_freeCCtx(cctx);
-   }
-
-   free(zin);
-   free(zout);
-
    free(from);
    free(to);
 }
@@ -226,19 +189,15 @@ pgmoneta_zstandardc_tablespaces(char* root, struct workers* workers)
 }
 
 void
-pgmoneta_zstandardc_wal(char* directory)
+pgmoneta_zstandardc_wal(int server, char* directory)
 {
-   size_t zin_size = -1;
-   void* zin = NULL;
-   size_t zout_size = -1;
-   void* zout = NULL;
-   ZSTD_CCtx* cctx = NULL;
    char* from = NULL;
    char* to = NULL;
    DIR* dir;
    struct dirent* entry;
    int level;
-   int workers;
+   int ret;
+   uint32_t dictionary = 0;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -248,32 +207,12 @@ pgmoneta_zstandardc_wal(char* directory)
       return;
    }
 
-   level = config->compression_level;
-   if (level < 1)
-   {
-      level = 1;
-   }
-   else if (level > 19)
-   {
-      level = 19;
-   }
-
-   workers = config->workers != 0 ? config->workers : ZSTD_DEFAULT_NUMBER_OF_WORKERS;
-
-   zin_size = ZSTD_CStreamInSize();
-   zin = malloc(zin_size);
-   zout_size = ZSTD_CStreamOutSize();
-   zout = malloc(zout_size);
-
-   cctx = ZSTD_createCCtx();
-   if (cctx == NULL)
+   if (config->compression_dictionary)
    {
-      goto error;
+      pgmoneta_dictionary_train(server, DICTIONARY_TYPE_WAL, directory);
    }
 
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, workers);
+   level = config->compression_level;
 
    while ((entry = readdir(dir)) != NULL)
    {
@@ -302,7 +241,23 @@ pgmoneta_zstandardc_wal(char* directory)
 
          if (pgmoneta_exists(from))
          {
-            if (zstd_compress(from, to, cctx, zin_size, zin, zout_size, zout))
+            // the zero-filled tail is restored by pgmoneta_wal_pad()
+            if (pgmoneta_is_wal_file(entry->d_name))
+            {
+               pgmoneta_wal_trim(from);
+            }
+
+            if (config->compression_dictionary && pgmoneta_is_wal_file(entry->d_name))
+            {
+               ret = pgmoneta_codec_dictionary_file(DICTIONARY_TYPE_WAL, level, from, to, &dictionary);
+               pgmoneta_log_trace("ZSTD: %s uses dictionary %08x", from, dictionary);
+            }
+            else
+            {
+               ret = pgmoneta_codec_file(COMPRESSION_CLIENT_ZSTD, true, level, from, to);
+            }
+
+            if (ret)
             {
                pgmoneta_log_error("ZSTD: Could not compress %s/%s", directory, entry->d_name);
                break;
@@ -317,9 +272,7 @@ pgmoneta_zstandardc_wal(char* directory)
                pgmoneta_log_debug("%s doesn't exists", from);
             }
             pgmoneta_permission(to, 6, 0, 0);
-
-            memset(zin, 0, zin_size);
-            memset(zout, 0, zout_size);
+            pgmoneta_wal_index_add(to);
          }
 
          free(from);
@@ -332,26 +285,6 @@ pgmoneta_zstandardc_wal(char* directory)
 
    closedir(dir);
 
-   ZSTD_freeCCtx(cctx);
-
-   free(zin);
-   free(zout);
-
-   free(from);
-   free(to);
-
-   return;
-
-error:
-
-   if (cctx != NULL)
-   {
-      ZSTD_freeCCtx(cctx);
-   }
-
-   free(zin);
-   free(zout);
-
    free(from);
    free(to);
 }
@@ -460,26 +393,9 @@ error:
 int
 pgmoneta_zstandardd_file(char* from, char* to)
 {
-   ZSTD_DCtx* dctx = NULL;
-   size_t zin_size = -1;
-   void* zin = NULL;
-   size_t zout_size = -1;
-   void* zout = NULL;
-
    if (pgmoneta_ends_with(from, ".zstd"))
    {
-      zin_size = ZSTD_DStreamInSize();
-      zin = malloc(zin_size);
-      zout_size = ZSTD_DStreamOutSize();
-      zout = malloc(zout_size);
-
-      dctx = ZSTD_createDCtx();
-      if (dctx == NULL)
-      {
-         goto error;
-      }
-
-      if (zstd_decompress(from, to, dctx, zin_size, zin, zout_size, zout))
+      if (pgmoneta_codec_file(COMPRESSION_CLIENT_ZSTD, false, 0, from, to))
       {
          pgmoneta_log_error("ZSTD: Could not decompress %s", from);
          goto error;
@@ -499,34 +415,16 @@ pgmoneta_zstandardd_file(char* from, char* to)
       goto error;
    }
 
-   ZSTD_freeDCtx(dctx);
-
-   free(zin);
-   free(zout);
-
    return 0;
 
 error:
 
-   if (dctx != NULL)
-   {
-      ZSTD_freeDCtx(dctx);
-   }
-
-   free(zin);
-   free(zout);
-
    return 1;
 }
 
 void
 pgmoneta_zstandardd_directory(char* directory, struct workers* workers)
 {
-   ZSTD_DCtx* dctx = NULL;
-   size_t zin_size = -1;
-   void* zin = NULL;
-   size_t zout_size = -1;
-   void* zout = NULL;
    char* from = NULL;
    char* to = NULL;
    char* name = NULL;
@@ -538,28 +436,6 @@ pgmoneta_zstandardd_directory(char* directory, struct workers* workers)
       return;
    }
 
-   zin_size = ZSTD_DStreamInSize();
-   zin = malloc(zin_size);
-
-   if (zin == NULL)
-   {
-      goto error;
-   }
-
-   zout_size = ZSTD_DStreamOutSize();
-   zout = malloc(zout_size);
-
-   if (zout == NULL)
-   {
-      goto error;
-   }
-
-   dctx = ZSTD_createDCtx();
-   if (dctx == NULL)
-   {
-      goto error;
-   }
-
    while ((entry = readdir(dir)) != NULL)
    {
       if (entry->d_type == DT_DIR || entry->d_type == DT_LNK)
@@ -607,7 +483,7 @@ pgmoneta_zstandardd_directory(char* directory, struct workers* workers)
             }
             to = pgmoneta_append(to, name);
 
-            if (zstd_decompress(from, to, dctx, zin_size, zin, zout_size, zout))
+            if (pgmoneta_codec_file(COMPRESSION_CLIENT_ZSTD, false, 0, from, to))
             {
                pgmoneta_log_error("ZSTD: Could not decompress %s/%s", directory, entry->d_name);
                break;
@@ -622,9 +498,6 @@ pgmoneta_zstandardd_directory(char* directory, struct workers* workers)
                pgmoneta_log_debug("%s doesn't exists", from);
             }
 
-            memset(zin, 0, zin_size);
-            memset(zout, 0, zout_size);
-
             free(name);
             free(from);
             free(to);
@@ -638,11 +511,6 @@ pgmoneta_zstandardd_directory(char* directory, struct workers* workers)
 
    closedir(dir);
 
-   ZSTD_freeDCtx(dctx);
-
-   free(zin);
-   free(zout);
-
    free(from);
    free(to);
    free(name);
@@ -651,13 +519,7 @@ pgmoneta_zstandardd_directory(char* directory, struct workers* workers)
 
 error:
 
-   if (dctx != NULL)
-   {
-      ZSTD_freeDCtx(dctx);
-   }
-
-   free(zin);
-   free(zout);
+   closedir(dir);
 
    free(name);
    free(from);
@@ -765,45 +627,11 @@ error:
 int
 pgmoneta_zstandardc_file(char* from, char* to)
 {
-   size_t zin_size = -1;
-   void* zin = NULL;
-   size_t zout_size = -1;
-   void* zout = NULL;
-   ZSTD_CCtx* cctx = NULL;
-   int level;
-   int workers;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   level = config->compression_level;
-   if (level < 1)
-   {
-      level = 1;
-   }
-   else if (level > 19)
-   {
-      level = 19;
-   }
-
-   workers = config->workers != 0 ? config->workers : ZSTD_DEFAULT_NUMBER_OF_WORKERS;
-
-   zin_size = ZSTD_CStreamInSize();
-   zin = malloc(zin_size);
-   zout_size = ZSTD_CStreamOutSize();
-   zout = malloc(zout_size);
-
-   cctx = ZSTD_createCCtx();
-   if (cctx == NULL)
-   {
-      goto error;
-   }
-
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, workers);
-
-   if (zstd_compress(from, to, cctx, zin_size, zin, zout_size, zout))
+   if (pgmoneta_codec_file(COMPRESSION_CLIENT_ZSTD, true, config->compression_level, from, to))
    {
       goto error;
    }
@@ -819,23 +647,10 @@ pgmoneta_zstandardc_file(char* from, char* to)
       }
    }
 
-   ZSTD_freeCCtx(cctx);
-
-   free(zin);
-   free(zout);
-
    return 0;
 
 error:
 
-   if (cctx != NULL)
-   {
-      ZSTD_freeCCtx(cctx);
-   }
-
-   free(zin);
-   free(zout);
-
    return 1;
 }
 
@@ -907,139 +722,3 @@ pgmoneta_zstdd_string(unsigned char* compressed_buffer, size_t compressed_size,
 
    return 0;
 }
-
-static int
-zstd_compress(char* from, char* to, ZSTD_CCtx* cctx, size_t zin_size, void* zin, size_t zout_size, void* zout)
-{
-   FILE* fin = NULL;
-   FILE* fout = NULL;
-   size_t toRead;
-
-   fin = fopen(from, "rb");
-
-   if (fin == NULL)
-   {
-      goto error;
-   }
-
-   fout = fopen(to, "wb");
-
-   if (fout == NULL)
-   {
-      goto error;
-   }
-
-   toRead = zin_size;
-   for (;;)
-   {
-      size_t read = fread(zin, sizeof(char), toRead, fin);
-      int lastChunk = (read < toRead);
-      ZSTD_EndDirective mode = lastChunk ? ZSTD_e_end : ZSTD_e_continue;
-      ZSTD_inBuffer input = {zin, read, 0};
-      int finished;
-      do
-      {
-         ZSTD_outBuffer output = {zout, zout_size, 0};
-         size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
-         if (ZSTD_isError(remaining))
-         {
-            pgmoneta_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(remaining));
-            goto error;
-         }
-         fwrite(zout, sizeof(char), output.pos, fout);
-         finished = lastChunk ? (remaining == 0) : (input.pos == input.size);
-      }
-      while (!finished);
-
-      if (lastChunk)
-      {
-         break;
-      }
-   }
-
-   fclose(fout);
-   fclose(fin);
-
-   return 0;
-
-error:
-
-   if (fout != NULL)
-   {
-      fclose(fout);
-   }
-
-   if (fin != NULL)
-   {
-      fclose(fin);
-   }
-
-   return 1;
-}
-
-static int
-zstd_decompress(char* from, char* to, ZSTD_DCtx* dctx, size_t zin_size, void* zin, size_t zout_size, void* zout)
-{
-   FILE* fin = NULL;
-   FILE* fout = NULL;
-   size_t toRead;
-   size_t read;
-   size_t lastRet = 0;
-
-   fin = fopen(from, "rb");
-
-   if (fin == NULL)
-   {
-      goto error;
-   }
-
-   fout = fopen(to, "wb");
-
-   if (fout == NULL)
-   {
-      goto error;
-   }
-
-   toRead = zin_size;
-   while ((read = fread(zin, sizeof(char), toRead, fin)))
-   {
-      ZSTD_inBuffer input = {zin, read, 0};
-      while (input.pos < input.size)
-      {
-         ZSTD_outBuffer output = {zout, zout_size, 0};
-         size_t ret = ZSTD_decompressStream(dctx, &output, &input);
-         if (ZSTD_isError(ret))
-         {
-            pgmoneta_log_error("ZSTD: Decompression error: %s", ZSTD_getErrorName(ret));
-            goto error;
-         }
-         fwrite(zout, sizeof(char), output.pos, fout);
-         lastRet = ret;
-      }
-   }
-
-   if (lastRet != 0)
-   {
-      pgmoneta_log_error("ZSTD: Incomplete or corrupted frame");
-      goto error;
-   }
-
-   fclose(fin);
-   fclose(fout);
-
-   return 0;
-
-error:
-
-   if (fin != NULL)
-   {
-      fclose(fin);
-   }
-
-   if (fout != NULL)
-   {
-      fclose(fout);
-   }
-
-   return 1;
-}
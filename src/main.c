@@ -52,6 +52,7 @@
 #include <server.h>
 #include <shmem.h>
 #include <status.h>
+#include <summary.h>
 #include <utils.h>
 #include <verify.h>
 #include <wal.h>
@@ -74,6 +75,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #include <openssl/crypto.h>
 #ifdef HAVE_SYSTEMD
@@ -98,6 +100,8 @@ static bool accept_fatal(int error);
 static bool reload_configuration(void);
 static void init_receivewals(void);
 static int init_receivewal(int server);
+static int wal_receivers(void);
+static void start_receivers(int* servers, int number_of_servers);
 static int init_replication_slots(void);
 static int init_replication_slot(int server);
 static int verify_replication_slot(char* slot_name, int srv, SSL* ssl, int socket);
@@ -124,6 +128,7 @@ static int metrics_fds_length = -1;
 static struct accept_io io_management[MAX_FDS];
 static int* management_fds = NULL;
 static int management_fds_length = -1;
+static pid_t receivers[NUMBER_OF_SERVERS];
 
 static void
 start_mgt(void)
@@ -653,8 +658,9 @@ main(int argc, char** argv)
    ev_periodic_init (&wal_streaming, wal_streaming_cb, 0., 60, 0);
    ev_periodic_start (main_loop, &wal_streaming);
 
-   /* Start WAL compression */
-   if (config->compression_type != COMPRESSION_NONE ||
+   /* Start WAL summarization and compression */
+   if (config->wal_summary ||
+       config->compression_type != COMPRESSION_NONE ||
        config->encryption != ENCRYPTION_NONE)
    {
       ev_periodic_init(&wal, wal_cb, 0., 60, 0);
@@ -1026,6 +1032,47 @@ accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
          goto error;
       }
    }
+   else if (id == MANAGEMENT_RESTORE_WAL)
+   {
+      server = (char*)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_SERVER);
+
+      srv = -1;
+      for (int i = 0; srv == -1 && i < config->common.number_of_servers; i++)
+      {
+         if (!strcmp(config->common.servers[i].name, server))
+         {
+            srv = i;
+         }
+      }
+
+      if (srv != -1)
+      {
+         pid = fork();
+         if (pid == -1)
+         {
+            pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_RESTORE_WAL_NOFORK, NAME, compression, encryption, payload);
+            pgmoneta_log_error("Restore WAL: No fork %s (%d)", server, MANAGEMENT_ERROR_RESTORE_WAL_NOFORK);
+            goto error;
+         }
+         else if (pid == 0)
+         {
+            struct json* pyl = NULL;
+
+            shutdown_ports();
+
+            pgmoneta_json_clone(payload, &pyl);
+
+            pgmoneta_set_proc_title(1, ai->argv, "restore-wal", config->common.servers[srv].name);
+            pgmoneta_restore_wal(NULL, client_fd, srv, compression, encryption, pyl);
+         }
+      }
+      else
+      {
+         pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_RESTORE_WAL_NOSERVER, NAME, compression, encryption, payload);
+         pgmoneta_log_error("Restore WAL: No server %s (%d)", server, MANAGEMENT_ERROR_RESTORE_WAL_NOSERVER);
+         goto error;
+      }
+   }
    else if (id == MANAGEMENT_VERIFY)
    {
       server = (char*)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_SERVER);
@@ -1935,7 +1982,8 @@ wal_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribute_
    {
       if (config->common.servers[i].online)
       {
-         /* Compression is always in a fork() */
+         /* Compression is always in a fork(), the WAL receiver handles segments as they are closed */
+         /* so this sweep only picks up the ones it had to leave behind */
          if (!fork())
          {
             bool active = false;
@@ -1949,13 +1997,19 @@ wal_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribute_
             {
                d = pgmoneta_get_server_wal(i);
 
+               /* Summarize before the segments are compressed */
+               if (config->wal_summary)
+               {
+                  pgmoneta_summarize_wal(i);
+               }
+
                if (config->compression_type == COMPRESSION_CLIENT_GZIP || config->compression_type == COMPRESSION_SERVER_GZIP)
                {
                   pgmoneta_gzip_wal(d);
                }
                else if (config->compression_type == COMPRESSION_CLIENT_ZSTD || config->compression_type == COMPRESSION_SERVER_ZSTD)
                {
-                  pgmoneta_zstandardc_wal(d);
+                  pgmoneta_zstandardc_wal(i, d);
                }
                else if (config->compression_type == COMPRESSION_CLIENT_LZ4 || config->compression_type == COMPRESSION_SERVER_LZ4)
                {
@@ -2095,7 +2149,8 @@ static void
 wal_streaming_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribute__((unused)), int revents)
 {
    bool start = false;
-   int follow;
+   int servers[NUMBER_OF_SERVERS];
+   int number_of_servers = 0;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -2120,47 +2175,18 @@ wal_streaming_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __
                                config->common.servers[i].valid, config->common.servers[i].wal_streaming,
                                config->common.servers[i].checksums, config->common.servers[i].summarize_wal);
 
-            if (strlen(config->common.servers[i].follow) == 0)
-            {
-               follow = -1;
-
-               for (int j = 0;
-                    follow == -1 && j < config->common.number_of_servers; j++)
-               {
-                  if (!strcmp(config->common.servers[j].follow, config->common.servers[i].name))
-                  {
-                     follow = j;
-                  }
-               }
-
-               if (follow == -1)
-               {
-                  start = true;
-               }
-               else if (!config->common.servers[follow].wal_streaming)
-               {
-                  start = true;
-               }
-            }
-            else
-            {
-               for (int j = 0; !start && j < config->common.number_of_servers;
-                    j++)
-               {
-                  if (!strcmp(config->common.servers[i].follow, config->common.servers[j].name) &&
-                      !config->common.servers[j].wal_streaming)
-                  {
-                     start = true;
-                  }
-               }
-            }
+            start = pgmoneta_wal_should_stream(i);
          }
          else
          {
             pgmoneta_log_debug("WAL streaming: Server %s is offline", config->common.servers[i].name);
          }
 
-         if (start)
+         if (start && wal_receivers() > 0)
+         {
+            servers[number_of_servers++] = i;
+         }
+         else if (start)
          {
             pid_t pid;
 
@@ -2178,6 +2204,8 @@ wal_streaming_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __
          }
       }
    }
+
+   start_receivers(servers, number_of_servers);
 }
 
 static bool
@@ -2288,10 +2316,33 @@ reload_configuration(void)
 static void
 init_receivewals(void)
 {
+   int servers[NUMBER_OF_SERVERS];
+   int number_of_servers = 0;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
+   if (wal_receivers() > 0)
+   {
+      for (int i = 0; i < config->common.number_of_servers; i++)
+      {
+         if (strlen(config->common.servers[i].follow) == 0)
+         {
+            if (config->common.servers[i].online)
+            {
+               servers[number_of_servers++] = i;
+            }
+            else
+            {
+               pgmoneta_log_debug("Server %s is offline", config->common.servers[i].name);
+            }
+         }
+      }
+
+      start_receivers(servers, number_of_servers);
+      return;
+   }
+
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
       if (init_receivewal(i))
@@ -2338,6 +2389,75 @@ init_receivewal(int server)
    return ret;
 }
 
+static int
+wal_receivers(void)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   // the ssh storage engine keeps a single session for each process
+   if (config->storage_engine & STORAGE_ENGINE_SSH)
+   {
+      return 0;
+   }
+
+   return config->wal_receivers;
+}
+
+static void
+start_receivers(int* servers, int number_of_servers)
+{
+   int count;
+   bool running[NUMBER_OF_SERVERS];
+   int started[NUMBER_OF_SERVERS];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   // libev reaps the children, so a receiver that is gone is either reaped or no longer a child
+   for (int r = 0; r < NUMBER_OF_SERVERS; r++)
+   {
+      if (receivers[r] > 0 && waitpid(receivers[r], NULL, WNOHANG) != 0)
+      {
+         receivers[r] = 0;
+      }
+
+      running[r] = receivers[r] > 0;
+   }
+
+   count = pgmoneta_wal_receivers_assign(servers, number_of_servers, running, wal_receivers(), started);
+
+   for (int k = 0; k < count; k++)
+   {
+      pid_t pid;
+
+      pid = fork();
+      if (pid == -1)
+      {
+         /* No process */
+         pgmoneta_log_error("WAL - Cannot create process");
+
+         for (int i = 0; i < config->common.number_of_servers; i++)
+         {
+            if (config->common.servers[i].wal_receiver == started[k])
+            {
+               config->common.servers[i].wal_receiver = -1;
+            }
+         }
+      }
+      else if (pid == 0)
+      {
+         shutdown_ports();
+         pgmoneta_wal_receiver(started[k], argv_ptr);
+      }
+      else
+      {
+         receivers[started[k]] = pid;
+      }
+   }
+}
+
 static int
 init_replication_slots(void)
 {
@@ -2422,7 +2542,8 @@ init_replication_slot(int server)
             goto server_done;
          }
 
-         if (config->common.servers[server].version >= 17 && !config->common.servers[server].summarize_wal)
+         if (config->common.servers[server].version >= 17 && !config->common.servers[server].summarize_wal &&
+             !config->wal_summary)
          {
             pgmoneta_log_fatal("PostgreSQL %d or higher requires summarize_wal for server %s",
                                config->common.servers[server].version, config->common.servers[server].name);
@@ -32,6 +32,8 @@
 #include "testcases/pgmoneta_test_2.h"
 #include "testcases/pgmoneta_test_3.h"
 #include "testcases/pgmoneta_test_4.h"
+#include "testcases/pgmoneta_test_5.h"
+#include "testcases/pgmoneta_test_6.h"
 
 int
 main(int argc, char* argv[])
@@ -48,6 +50,8 @@ main(int argc, char* argv[])
    Suite* s2;
    Suite* s3;
    Suite* s4;
+   Suite* s5;
+   Suite* s6;
    SRunner* sr;
 
    if (pgmoneta_tsclient_init(argv[1]))
@@ -59,11 +63,15 @@ main(int argc, char* argv[])
    s2 = pgmoneta_test2_suite();
    s3 = pgmoneta_test3_suite();
    s4 = pgmoneta_test4_suite();
+   s5 = pgmoneta_test5_suite();
+   s6 = pgmoneta_test6_suite();
 
    sr = srunner_create(s1);
    srunner_add_suite(sr, s2);
    srunner_add_suite(sr, s3);
    srunner_add_suite(sr, s4);
+   srunner_add_suite(sr, s5);
+   srunner_add_suite(sr, s6);
 
    // Run the tests in verbose mode
    srunner_run_all(sr, CK_VERBOSE);
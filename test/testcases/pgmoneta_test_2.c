@@ -27,10 +27,49 @@
  *
  */
 
+#include <pgmoneta.h>
+#include <achv.h>
+#include <dedup.h>
+#include <deque.h>
+#include <info.h>
+#include <json.h>
+#include <management.h>
+#include <restore.h>
+#include <resume.h>
+#include <shmem.h>
 #include <tsclient.h>
+#include <utils.h>
 
 #include "pgmoneta_test_2.h"
 
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utime.h>
+
+#define TAR_TRAIL         "/pgmoneta-testsuite/tar/"
+#define DEDUP_TRAIL       "/pgmoneta-testsuite/dedup/"
+#define RESUME_TRAIL      "/pgmoneta-testsuite/resume/"
+#define RESTORE_WAL_TRAIL "/pgmoneta-testsuite/restore_wal/"
+
+static int tar_directory(char* name, char* directory, size_t size);
+static size_t tar_entry(char* buffer, char* name, char type, char* data, size_t size, char* link);
+static size_t tar_pax(char* buffer, char* path);
+static int tar_extract(char* directory, char* data, size_t size);
+static bool tar_content(char* directory, char* name, char* data);
+static int dedup_backup(char* root, int* seeds, int number_of_seeds);
+static bool dedup_same(char* root, int* seeds, int number_of_seeds);
+static int dedup_stored(struct deque* chunks);
+static int resume_file(char* path, char* seeds, int number_of_blocks, size_t block_size);
+static bool resume_same(char* path, char* seeds, int number_of_blocks, size_t block_size);
+static int resume_incremental(char* path, uint32_t block, char seed, uint32_t truncation_block_length, size_t block_size);
+static bool resume_manifest_has(char* path, char* name);
+static int restore_wal_segment(char* directory, int segment);
+static bool restore_wal_request(int server, int segment, char* destination);
+static bool restore_wal_same(char* path, int segment);
+static int restore_wal_touch(char* path);
+
 // test backup
 START_TEST(test_pgmoneta_backup)
 {
@@ -55,6 +94,489 @@ START_TEST(test_pgmoneta_delete)
    ck_assert_msg(found, "success status not found");
 }
 END_TEST
+// test the tar demultiplexer with pax and GNU long names
+START_TEST(test_pgmoneta_tar_long_names)
+{
+   int found = 0;
+   size_t size = 0;
+   char directory[MAX_PATH];
+   char pax_name[MAX_PATH];
+   char gnu_name[MAX_PATH];
+   char gnu_data[MAX_PATH];
+   char* tar = NULL;
+
+   if (tar_directory("long_names", directory, sizeof(directory)))
+   {
+      goto done;
+   }
+
+   // both names are longer than the 100 bytes of the ustar name field
+   snprintf(pax_name, sizeof(pax_name), "base/%0150d/pax", 0);
+   snprintf(gnu_name, sizeof(gnu_name), "base/%0150d/gnu", 1);
+
+   tar = (char*)calloc(16, TAR_BLOCK_SIZE);
+   ck_assert_msg(tar != NULL, "no memory");
+
+   size += tar_pax(tar + size, pax_name);
+   size += tar_entry(tar + size, "pax-placeholder", '0', "pax data", 8, NULL);
+
+   snprintf(gnu_data, sizeof(gnu_data), "%s", gnu_name);
+   size += tar_entry(tar + size, "././@LongLink", 'L', gnu_data, strlen(gnu_data) + 1, NULL);
+   size += tar_entry(tar + size, "gnu-placeholder", '0', "gnu data", 8, NULL);
+
+   // the end-of-archive marker
+   size += 2 * TAR_BLOCK_SIZE;
+
+   ck_assert_msg(!tar_extract(directory, tar, size), "archive not extracted");
+   ck_assert_msg(tar_content(directory, pax_name, "pax data"), "pax long name not extracted");
+   ck_assert_msg(tar_content(directory, gnu_name, "gnu data"), "GNU long name not extracted");
+   ck_assert_msg(!tar_content(directory, "pax-placeholder", "pax data"), "pax name ignored");
+
+   found = 1;
+
+done:
+   free(tar);
+   pgmoneta_delete_directory(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+// test the chunk store from dedup to expand, and the release of the chunks
+START_TEST(test_pgmoneta_dedup_round_trip)
+{
+   int found = 0;
+   int chunk_size;
+   int first_seeds[] = {1, 2, 3};
+   int second_seeds[] = {1, 4, 5};
+   int failed_seeds[] = {6, 7};
+   char directory[MAX_PATH];
+   char first[MAX_PATH * 2];
+   char second[MAX_PATH * 2];
+   char failed[MAX_PATH * 2];
+   char path[MAX_PATH * 3];
+   struct deque* first_chunks = NULL;
+   struct deque* second_chunks = NULL;
+   struct deque* failed_chunks = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   chunk_size = config->dedup_chunk_size;
+   config->dedup_chunk_size = DEDUP_MIN_CHUNK_SIZE;
+
+   snprintf(directory, sizeof(directory), "%s%s", project_directory, DEDUP_TRAIL);
+   snprintf(first, sizeof(first), "%sfirst", directory);
+   snprintf(second, sizeof(second), "%ssecond", directory);
+   snprintf(failed, sizeof(failed), "%sfailed", directory);
+
+   if (pgmoneta_exists(directory))
+   {
+      pgmoneta_delete_directory(directory);
+   }
+
+   // the two backups share their first chunk
+   if (dedup_backup(first, first_seeds, 3) || dedup_backup(second, second_seeds, 3) ||
+       dedup_backup(failed, failed_seeds, 2))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(!pgmoneta_deque_create(true, &first_chunks) &&
+                 !pgmoneta_deque_create(true, &second_chunks) &&
+                 !pgmoneta_deque_create(true, &failed_chunks), "no memory");
+
+   snprintf(path, sizeof(path), "%s/data", first);
+   ck_assert_msg(!pgmoneta_dedup_data(0, path, first_chunks, NULL), "first backup not deduplicated");
+   ck_assert_msg(!pgmoneta_dedup_commit(0, first, first_chunks), "first backup not committed");
+
+   snprintf(path, sizeof(path), "%s/data/base/1", first);
+   ck_assert_msg(!pgmoneta_exists(path), "%s not replaced by a recipe", path);
+   snprintf(path, sizeof(path), "%s/data/base/1%s", first, DEDUP_RECIPE_SUFFIX);
+   ck_assert_msg(pgmoneta_exists(path), "%s missing", path);
+
+   snprintf(path, sizeof(path), "%s/data", second);
+   ck_assert_msg(!pgmoneta_dedup_data(0, path, second_chunks, NULL), "second backup not deduplicated");
+   ck_assert_msg(!pgmoneta_dedup_commit(0, second, second_chunks), "second backup not committed");
+   ck_assert_msg(pgmoneta_dedup_is_deduplicated(second), "second backup has no references");
+   ck_assert_msg(dedup_stored(second_chunks) == 3, "second backup stored %d chunks", dedup_stored(second_chunks));
+
+   // a failed backup only takes back the chunks it added
+   snprintf(path, sizeof(path), "%s/data", failed);
+   ck_assert_msg(!pgmoneta_dedup_data(0, path, failed_chunks, NULL), "failed backup not deduplicated");
+   ck_assert_msg(dedup_stored(failed_chunks) == 2, "failed backup stored %d chunks", dedup_stored(failed_chunks));
+   ck_assert_msg(!pgmoneta_dedup_abort(0, failed_chunks), "failed backup not aborted");
+   ck_assert_msg(dedup_stored(failed_chunks) == 0, "%d chunks of the failed backup left", dedup_stored(failed_chunks));
+
+   // the shared chunk stays with the second backup
+   ck_assert_msg(!pgmoneta_dedup_release(0, first), "first backup not released");
+   ck_assert_msg(dedup_stored(first_chunks) == 1, "%d chunks of the first backup left", dedup_stored(first_chunks));
+
+   snprintf(path, sizeof(path), "%s/data", second);
+   ck_assert_msg(!pgmoneta_dedup_expand_directory(0, path, NULL), "second backup not expanded");
+   ck_assert_msg(dedup_same(second, second_seeds, 3), "second backup differs from the original");
+   snprintf(path, sizeof(path), "%s/data/base/1%s", second, DEDUP_RECIPE_SUFFIX);
+   ck_assert_msg(!pgmoneta_exists(path), "%s left behind", path);
+
+   ck_assert_msg(!pgmoneta_dedup_release(0, second), "second backup not released");
+   ck_assert_msg(dedup_stored(second_chunks) == 0, "%d chunks of the second backup left", dedup_stored(second_chunks));
+
+   found = 1;
+
+done:
+   config->dedup_chunk_size = chunk_size;
+   pgmoneta_deque_destroy(first_chunks);
+   pgmoneta_deque_destroy(second_chunks);
+   pgmoneta_deque_destroy(failed_chunks);
+   pgmoneta_delete_directory(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+// test that the tar demultiplexer stays inside its directory
+START_TEST(test_pgmoneta_tar_reject_paths)
+{
+   int found = 0;
+   size_t size = 0;
+   char directory[MAX_PATH];
+   char outside[MAX_PATH];
+   char path[MAX_PATH * 2];
+   char* tar = NULL;
+
+   if (tar_directory("reject_paths", directory, sizeof(directory)) ||
+       tar_directory("reject_paths_outside", outside, sizeof(outside)))
+   {
+      goto done;
+   }
+
+   tar = (char*)calloc(16, TAR_BLOCK_SIZE);
+   ck_assert_msg(tar != NULL, "no memory");
+
+   // each archive is complete, so only the entry can fail it
+   size = tar_entry(tar, "../escaped", '0', "data", 4, NULL);
+   size += 2 * TAR_BLOCK_SIZE;
+   ck_assert_msg(tar_extract(directory, tar, size), "a parent path was accepted");
+
+   memset(tar, 0, 16 * TAR_BLOCK_SIZE);
+   size = tar_entry(tar, "/escaped", '0', "data", 4, NULL);
+   size += 2 * TAR_BLOCK_SIZE;
+   ck_assert_msg(tar_extract(directory, tar, size), "an absolute path was accepted");
+
+   memset(tar, 0, 16 * TAR_BLOCK_SIZE);
+   size = tar_entry(tar, "base/../../escaped", '0', "data", 4, NULL);
+   size += 2 * TAR_BLOCK_SIZE;
+   ck_assert_msg(tar_extract(directory, tar, size), "a path through the parent was accepted");
+
+   // a symlink entry, and an entry written through it
+   memset(tar, 0, 16 * TAR_BLOCK_SIZE);
+   size = tar_entry(tar, "link", '2', NULL, 0, outside);
+   size += tar_entry(tar + size, "link/escaped", '0', "data", 4, NULL);
+   size += 2 * TAR_BLOCK_SIZE;
+   ck_assert_msg(tar_extract(directory, tar, size), "an entry below a symlink was accepted");
+
+   snprintf(path, sizeof(path), "%s/escaped", outside);
+   ck_assert_msg(!pgmoneta_exists(path), "%s written through a symlink", path);
+
+   found = 1;
+
+done:
+   free(tar);
+   pgmoneta_delete_directory(directory);
+   pgmoneta_delete_directory(outside);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+// test that a partial backup is offered to the server and spliced with the incremental backup
+START_TEST(test_pgmoneta_resume_splice)
+{
+   int found = 0;
+   int version;
+   int compression_type;
+   bool summarize_wal;
+   size_t block_size;
+   size_t relseg_size;
+   char directory[MAX_PATH];
+   char failed[MAX_PATH * 2];
+   char incremental[MAX_PATH * 2];
+   char path[MAX_PATH * 3];
+   char label[MAX_PATH];
+   char* backup = NULL;
+   FILE* journal = NULL;
+   FILE* file = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   version = config->common.servers[0].version;
+   summarize_wal = config->common.servers[0].summarize_wal;
+   block_size = config->common.servers[0].block_size;
+   relseg_size = config->common.servers[0].relseg_size;
+   compression_type = config->compression_type;
+
+   config->common.servers[0].version = 17;
+   config->common.servers[0].summarize_wal = true;
+   config->common.servers[0].block_size = 8192;
+   config->common.servers[0].relseg_size = 131072;
+   config->compression_type = COMPRESSION_NONE;
+
+   snprintf(directory, sizeof(directory), "%s%s", project_directory, RESUME_TRAIL);
+   // the failed backup is kept by a rename, so it lives next to the partial backup
+   backup = pgmoneta_get_server_backup(0);
+   snprintf(failed, sizeof(failed), "%sresume-failed/", backup);
+   snprintf(incremental, sizeof(incremental), "%sincremental/", directory);
+
+   if (pgmoneta_exists(directory))
+   {
+      pgmoneta_delete_directory(directory);
+   }
+   if (pgmoneta_exists(failed))
+   {
+      pgmoneta_delete_directory(failed);
+   }
+   pgmoneta_resume_delete(0);
+
+   // the failed backup received two files, and a third one was cut short
+   snprintf(path, sizeof(path), "%sdata/base/1", failed);
+   if (pgmoneta_mkdir(path))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(!pgmoneta_resume_begin(failed, 1, "0/2000028"), "journal not started");
+   ck_assert_msg(!pgmoneta_resume_journal_open(failed, &journal) && journal != NULL, "journal not opened");
+
+   snprintf(path, sizeof(path), "%sdata/base/1/16384", failed);
+   ck_assert_msg(!resume_file(path, "ABC", 3, 8192), "%s not written", path);
+   ck_assert_msg(!pgmoneta_resume_journal_add(journal, "base/1/16384", "data/base/1/16384", 3 * 8192, time(NULL)),
+                 "base/1/16384 not journaled");
+
+   snprintf(path, sizeof(path), "%sdata/base/1/16385", failed);
+   ck_assert_msg(!resume_file(path, "E", 1, 8192), "%s not written", path);
+   ck_assert_msg(!pgmoneta_resume_journal_add(journal, "base/1/16385", "data/base/1/16385", 8192, time(NULL)),
+                 "base/1/16385 not journaled");
+
+   snprintf(path, sizeof(path), "%sdata/base/1/16386", failed);
+   ck_assert_msg(!resume_file(path, "F", 1, 8192), "%s not written", path);
+   ck_assert_msg(!pgmoneta_resume_journal_add(journal, "base/1/16386", "data/base/1/16386", 2 * 8192, time(NULL)),
+                 "base/1/16386 not journaled");
+
+   fclose(journal);
+   journal = NULL;
+
+   ck_assert_msg(!pgmoneta_resume_keep(0, failed), "failed backup not kept");
+   ck_assert_msg(!pgmoneta_exists(failed), "%s left behind", failed);
+   ck_assert_msg(pgmoneta_resume_available(0), "partial backup not available");
+
+   // only the files that are complete on disk are offered
+   if (pgmoneta_mkdir(directory))
+   {
+      goto done;
+   }
+   snprintf(path, sizeof(path), "%sbackup_manifest", directory);
+   ck_assert_msg(!pgmoneta_resume_write_manifest(0, path), "manifest not written");
+   ck_assert_msg(resume_manifest_has(path, "base/1/16384"), "base/1/16384 not offered");
+   ck_assert_msg(resume_manifest_has(path, "base/1/16385"), "base/1/16385 not offered");
+   ck_assert_msg(!resume_manifest_has(path, "base/1/16386"), "base/1/16386 offered");
+
+   // the server only sends the block that changed since the start position
+   snprintf(path, sizeof(path), "%sdata/base/1", incremental);
+   if (pgmoneta_mkdir(path))
+   {
+      goto done;
+   }
+
+   snprintf(path, sizeof(path), "%sdata/base/1/%s16384", incremental, INCREMENTAL_PREFIX);
+   ck_assert_msg(!resume_incremental(path, 1, 'D', 3, 8192), "%s not written", path);
+
+   snprintf(path, sizeof(path), "%sdata/backup_label", incremental);
+   file = fopen(path, "w");
+   ck_assert_msg(file != NULL, "%s not created", path);
+   fprintf(file, "START WAL LOCATION: 0/4000028 (file 000000010000000000000004)\n");
+   fprintf(file, "INCREMENTAL FROM LSN: 0/2000028\n");
+   fprintf(file, "INCREMENTAL FROM TLI: 1\n");
+   fclose(file);
+   file = NULL;
+
+   snprintf(path, sizeof(path), "%sdata/backup_manifest", incremental);
+   file = fopen(path, "w");
+   ck_assert_msg(file != NULL, "%s not created", path);
+   fprintf(file, "{ \"PostgreSQL-Backup-Manifest-Version\": 2,\n");
+   fprintf(file, "\"System-Identifier\": 7000000000000000000,\n");
+   fprintf(file, "\"Files\": [\n");
+   fprintf(file, "{ \"Path\": \"backup_label\", \"Size\": 0, \"Last-Modified\": \"2025-01-01 00:00:00 GMT\", "
+                 "\"Checksum-Algorithm\": \"CRC32C\", \"Checksum\": \"00000000\" },\n");
+   fprintf(file, "{ \"Path\": \"base/1/%s16384\", \"Size\": 0, \"Last-Modified\": \"2025-01-01 00:00:00 GMT\", "
+                 "\"Checksum-Algorithm\": \"CRC32C\", \"Checksum\": \"00000000\" }\n", INCREMENTAL_PREFIX);
+   fprintf(file, "],\n");
+   fprintf(file, "\"WAL-Ranges\": [\n");
+   fprintf(file, "{ \"Timeline\": 1, \"Start-LSN\": \"0/4000028\", \"End-LSN\": \"0/4000100\" }\n");
+   fprintf(file, "],\n");
+   fprintf(file, "\"Manifest-Checksum\": \"00\"}\n");
+   fclose(file);
+   file = NULL;
+
+   ck_assert_msg(!pgmoneta_resume_splice(0, incremental), "incremental backup not spliced");
+
+   snprintf(path, sizeof(path), "%sdata/base/1/16384", incremental);
+   ck_assert_msg(resume_same(path, "ADC", 3, 8192), "%s not combined from both backups", path);
+   snprintf(path, sizeof(path), "%sdata/base/1/%s16384", incremental, INCREMENTAL_PREFIX);
+   ck_assert_msg(!pgmoneta_exists(path), "%s left behind", path);
+
+   snprintf(path, sizeof(path), "%sdata/backup_manifest", incremental);
+   ck_assert_msg(resume_manifest_has(path, "base/1/16384"), "base/1/16384 not in the manifest");
+   ck_assert_msg(!resume_manifest_has(path, "base/1/" INCREMENTAL_PREFIX "16384"), "incremental file still in the manifest");
+
+   snprintf(path, sizeof(path), "%sdata/backup_label", incremental);
+   file = fopen(path, "r");
+   ck_assert_msg(file != NULL, "%s missing", path);
+   while (fgets(label, sizeof(label), file) != NULL)
+   {
+      ck_assert_msg(!pgmoneta_starts_with(label, "INCREMENTAL FROM "), "%s still incremental", path);
+   }
+   fclose(file);
+   file = NULL;
+
+   // a server that can't summarize WAL has nothing to resume
+   config->common.servers[0].version = 16;
+   ck_assert_msg(!pgmoneta_resume_available(0), "partial backup available without WAL summaries");
+
+   found = 1;
+
+done:
+   if (journal != NULL)
+   {
+      fclose(journal);
+   }
+   config->common.servers[0].version = version;
+   config->common.servers[0].summarize_wal = summarize_wal;
+   config->common.servers[0].block_size = block_size;
+   config->common.servers[0].relseg_size = relseg_size;
+   config->compression_type = compression_type;
+   pgmoneta_resume_delete(0);
+   if (backup != NULL && pgmoneta_exists(failed))
+   {
+      pgmoneta_delete_directory(failed);
+   }
+   pgmoneta_delete_directory(directory);
+   free(backup);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+// test that restore-wal serves prefetched segments, and leaves claimed segments alone
+START_TEST(test_pgmoneta_restore_wal_prefetch)
+{
+   int found = 0;
+   int server;
+   int number_of_servers;
+   int wal_prefetch;
+   char directory[MAX_PATH];
+   char destination[MAX_PATH * 2];
+   char path[MAX_PATH * 2];
+   char* waldir = NULL;
+   char* prefetch = NULL;
+   char* base = NULL;
+   struct utimbuf old;
+   struct server* saved = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   number_of_servers = config->common.number_of_servers;
+   wal_prefetch = config->wal_prefetch;
+   server = number_of_servers;
+
+   ck_assert_msg(server < NUMBER_OF_SERVERS, "no room for a server");
+
+   // a server of its own, so the archive holds only the segments of the test
+   saved = (struct server*)malloc(sizeof(struct server));
+   ck_assert_msg(saved != NULL, "no memory");
+   memcpy(saved, &config->common.servers[server], sizeof(struct server));
+
+   snprintf(config->common.servers[server].name, sizeof(config->common.servers[server].name), "restore_wal_test");
+   config->common.servers[server].workers = 2;
+   config->common.number_of_servers = number_of_servers + 1;
+   config->wal_prefetch = 2;
+
+   base = pgmoneta_get_server(server);
+   waldir = pgmoneta_get_server_wal(server);
+   prefetch = pgmoneta_get_server_wal_prefetch(server);
+
+   snprintf(directory, sizeof(directory), "%s%s", project_directory, RESTORE_WAL_TRAIL);
+   snprintf(destination, sizeof(destination), "%sRECOVERYXLOG", directory);
+
+   if (pgmoneta_exists(directory))
+   {
+      pgmoneta_delete_directory(directory);
+   }
+   if (pgmoneta_exists(base))
+   {
+      pgmoneta_delete_directory(base);
+   }
+
+   if (pgmoneta_mkdir(directory) || pgmoneta_mkdir(waldir) || pgmoneta_mkdir(prefetch))
+   {
+      goto done;
+   }
+
+   for (int segment = 1; segment <= 5; segment++)
+   {
+      ck_assert_msg(!restore_wal_segment(waldir, segment), "segment %d not archived", segment);
+   }
+
+   // another request is fetching the third segment, and a process left a file behind long ago
+   snprintf(path, sizeof(path), "%s.000000010000000000000003.claim", prefetch);
+   ck_assert_msg(!restore_wal_touch(path), "%s not created", path);
+   snprintf(path, sizeof(path), "%s.1.000000010000000000000001", prefetch);
+   ck_assert_msg(!restore_wal_touch(path), "%s not created", path);
+   old.actime = time(NULL) - 3600;
+   old.modtime = old.actime;
+   ck_assert_msg(!utime(path, &old), "%s not aged", path);
+
+   ck_assert_msg(restore_wal_request(server, 1, destination), "segment 1 not served");
+   ck_assert_msg(restore_wal_same(destination, 1), "segment 1 differs");
+   ck_assert_msg(!pgmoneta_exists(path), "%s not cleaned up", path);
+
+   snprintf(path, sizeof(path), "%s000000010000000000000001", prefetch);
+   ck_assert_msg(!pgmoneta_exists(path), "the served segment is still staged");
+   snprintf(path, sizeof(path), "%s000000010000000000000002", prefetch);
+   ck_assert_msg(restore_wal_same(path, 2), "segment 2 not prefetched");
+   snprintf(path, sizeof(path), "%s000000010000000000000003", prefetch);
+   ck_assert_msg(!pgmoneta_exists(path), "a claimed segment was prefetched");
+   snprintf(path, sizeof(path), "%s.000000010000000000000002.claim", prefetch);
+   ck_assert_msg(!pgmoneta_exists(path), "the claim of segment 2 left behind");
+
+   // the other request gave up, so the next prefetch takes the segment
+   snprintf(path, sizeof(path), "%s.000000010000000000000003.claim", prefetch);
+   pgmoneta_delete_file(path, NULL);
+
+   ck_assert_msg(restore_wal_request(server, 2, destination), "segment 2 not served");
+   ck_assert_msg(restore_wal_same(destination, 2), "segment 2 differs");
+
+   snprintf(path, sizeof(path), "%s000000010000000000000003", prefetch);
+   ck_assert_msg(restore_wal_same(path, 3), "segment 3 not prefetched");
+   snprintf(path, sizeof(path), "%s000000010000000000000004", prefetch);
+   ck_assert_msg(restore_wal_same(path, 4), "segment 4 not prefetched");
+
+   ck_assert_msg(restore_wal_request(server, 3, destination), "segment 3 not served");
+   ck_assert_msg(restore_wal_same(destination, 3), "segment 3 differs");
+
+   // the end of the archive is an error, and nothing is written
+   pgmoneta_delete_file(destination, NULL);
+   ck_assert_msg(!restore_wal_request(server, 9, destination), "a missing segment was served");
+   ck_assert_msg(!pgmoneta_exists(destination), "%s written for a missing segment", destination);
+
+   found = 1;
+
+done:
+   if (base != NULL && pgmoneta_exists(base))
+   {
+      pgmoneta_delete_directory(base);
+   }
+   config->common.number_of_servers = number_of_servers;
+   config->wal_prefetch = wal_prefetch;
+   memcpy(&config->common.servers[server], saved, sizeof(struct server));
+   pgmoneta_delete_directory(directory);
+   free(saved);
+   free(base);
+   free(waldir);
+   free(prefetch);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
 
 Suite*
 pgmoneta_test2_suite()
@@ -70,7 +592,543 @@ pgmoneta_test2_suite()
    tcase_add_test(tc_core, test_pgmoneta_backup);
    tcase_add_test(tc_core, test_pgmoneta_delete);
    tcase_add_test(tc_core, test_pgmoneta_restore);
+   tcase_add_test(tc_core, test_pgmoneta_tar_long_names);
+   tcase_add_test(tc_core, test_pgmoneta_tar_reject_paths);
+   tcase_add_test(tc_core, test_pgmoneta_dedup_round_trip);
+   tcase_add_test(tc_core, test_pgmoneta_resume_splice);
+   tcase_add_test(tc_core, test_pgmoneta_restore_wal_prefetch);
    suite_add_tcase(s, tc_core);
 
    return s;
-}
\ No newline at end of file
+}
+
+static int
+tar_directory(char* name, char* directory, size_t size)
+{
+   snprintf(directory, size, "%s%s%s", project_directory, TAR_TRAIL, name);
+
+   if (pgmoneta_exists(directory))
+   {
+      pgmoneta_delete_directory(directory);
+   }
+
+   return pgmoneta_mkdir(directory);
+}
+
+static size_t
+tar_entry(char* buffer, char* name, char type, char* data, size_t size, char* link)
+{
+   char* h = buffer;
+   unsigned int checksum = 0;
+
+   memset(h, 0, TAR_BLOCK_SIZE);
+
+   snprintf(h, 100, "%s", name);
+   snprintf(h + 100, 8, "%07o", 0644);
+   snprintf(h + 108, 8, "%07o", 0);
+   snprintf(h + 116, 8, "%07o", 0);
+   snprintf(h + 124, 12, "%011zo", size);
+   snprintf(h + 136, 12, "%011o", 0);
+   h[156] = type;
+   if (link != NULL)
+   {
+      snprintf(h + 157, 100, "%s", link);
+   }
+   memcpy(h + 257, "ustar", 6);
+   memcpy(h + 263, "00", 2);
+
+   // the checksum is calculated with its own field as spaces
+   memset(h + 148, ' ', 8);
+   for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+   {
+      checksum += (unsigned char)h[i];
+   }
+   snprintf(h + 148, 8, "%06o", checksum);
+
+   if (size > 0)
+   {
+      memcpy(h + TAR_BLOCK_SIZE, data, size);
+   }
+
+   return TAR_BLOCK_SIZE + ((size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE) * TAR_BLOCK_SIZE;
+}
+
+static size_t
+tar_pax(char* buffer, char* path)
+{
+   char record[MAX_PATH * 2];
+   size_t length;
+   size_t digits = 1;
+
+   // the length of a record counts its own digits
+   length = strlen(" path=\n") + strlen(path);
+   while (snprintf(NULL, 0, "%zu", length + digits) != (int)digits)
+   {
+      digits++;
+   }
+
+   snprintf(record, sizeof(record), "%zu path=%s\n", length + digits, path);
+
+   return tar_entry(buffer, "PaxHeaders/pax", 'x', record, strlen(record), NULL);
+}
+
+static int
+tar_extract(char* directory, char* data, size_t size)
+{
+   int ret = 1;
+   struct tar_stream* stream = NULL;
+
+   if (pgmoneta_tar_stream_create(directory, &stream))
+   {
+      return 1;
+   }
+
+   // the archive arrives in pieces that don't line up with the blocks
+   for (size_t offset = 0; offset < size; offset += 100)
+   {
+      if (pgmoneta_tar_stream_write(stream, data + offset, MIN(100, size - offset)))
+      {
+         goto done;
+      }
+   }
+
+   ret = pgmoneta_tar_stream_finish(stream);
+
+done:
+   pgmoneta_tar_stream_destroy(stream);
+
+   return ret;
+}
+
+static bool
+tar_content(char* directory, char* name, char* data)
+{
+   char path[MAX_PATH * 2];
+   char buffer[64];
+   size_t n;
+   FILE* file = NULL;
+
+   snprintf(path, sizeof(path), "%s/%s", directory, name);
+
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      return false;
+   }
+
+   memset(buffer, 0, sizeof(buffer));
+   n = fread(buffer, 1, sizeof(buffer) - 1, file);
+   fclose(file);
+
+   return n == strlen(data) && !strcmp(buffer, data);
+}
+
+static int
+dedup_backup(char* root, int* seeds, int number_of_seeds)
+{
+   char path[MAX_PATH * 3];
+   unsigned char chunk[DEDUP_MIN_CHUNK_SIZE];
+   FILE* file = NULL;
+
+   snprintf(path, sizeof(path), "%s/data/base", root);
+   if (pgmoneta_mkdir(path))
+   {
+      return 1;
+   }
+
+   snprintf(path, sizeof(path), "%s/data/base/1", root);
+   file = fopen(path, "w");
+   if (file == NULL)
+   {
+      return 1;
+   }
+
+   // each chunk is made from its seed, so equal seeds give equal chunks
+   for (int i = 0; i < number_of_seeds; i++)
+   {
+      for (size_t j = 0; j < sizeof(chunk); j++)
+      {
+         chunk[j] = (unsigned char)((j * 31 + seeds[i] * 131) ^ (j >> 8));
+      }
+
+      if (fwrite(chunk, 1, sizeof(chunk), file) != sizeof(chunk))
+      {
+         fclose(file);
+         return 1;
+      }
+   }
+
+   fclose(file);
+
+   return 0;
+}
+
+static bool
+dedup_same(char* root, int* seeds, int number_of_seeds)
+{
+   bool same = false;
+   char path[MAX_PATH * 3];
+   unsigned char chunk[DEDUP_MIN_CHUNK_SIZE];
+   FILE* file = NULL;
+
+   snprintf(path, sizeof(path), "%s/data/base/1", root);
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      return false;
+   }
+
+   for (int i = 0; i < number_of_seeds; i++)
+   {
+      if (fread(chunk, 1, sizeof(chunk), file) != sizeof(chunk))
+      {
+         goto done;
+      }
+
+      for (size_t j = 0; j < sizeof(chunk); j++)
+      {
+         if (chunk[j] != (unsigned char)((j * 31 + seeds[i] * 131) ^ (j >> 8)))
+         {
+            goto done;
+         }
+      }
+   }
+
+   same = fgetc(file) == EOF;
+
+done:
+   fclose(file);
+
+   return same;
+}
+
+static int
+dedup_stored(struct deque* chunks)
+{
+   int stored = 0;
+   char* server = NULL;
+   char path[MAX_PATH * 2];
+   struct deque_iterator* iter = NULL;
+
+   server = pgmoneta_get_server(0);
+
+   if (pgmoneta_deque_iterator_create(chunks, &iter))
+   {
+      free(server);
+      return -1;
+   }
+
+   // the chunks are stored below the first two characters of their name
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      snprintf(path, sizeof(path), "%s%s/%.2s/%s", server, DEDUP_CHUNKS, iter->tag, iter->tag);
+
+      if (pgmoneta_exists(path))
+      {
+         stored++;
+      }
+   }
+
+   pgmoneta_deque_iterator_destroy(iter);
+   free(server);
+
+   return stored;
+}
+
+static int
+resume_file(char* path, char* seeds, int number_of_blocks, size_t block_size)
+{
+   char* block = NULL;
+   FILE* file = NULL;
+
+   block = (char*)malloc(block_size);
+   file = fopen(path, "w");
+   if (block == NULL || file == NULL)
+   {
+      goto error;
+   }
+
+   // each block is filled with its seed
+   for (int i = 0; i < number_of_blocks; i++)
+   {
+      memset(block, seeds[i], block_size);
+      if (fwrite(block, 1, block_size, file) != block_size)
+      {
+         goto error;
+      }
+   }
+
+   fclose(file);
+   free(block);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(block);
+
+   return 1;
+}
+
+static bool
+resume_same(char* path, char* seeds, int number_of_blocks, size_t block_size)
+{
+   bool same = false;
+   char* block = NULL;
+   FILE* file = NULL;
+
+   block = (char*)malloc(block_size);
+   file = fopen(path, "r");
+   if (block == NULL || file == NULL)
+   {
+      goto done;
+   }
+
+   for (int i = 0; i < number_of_blocks; i++)
+   {
+      if (fread(block, 1, block_size, file) != block_size)
+      {
+         goto done;
+      }
+
+      for (size_t j = 0; j < block_size; j++)
+      {
+         if (block[j] != seeds[i])
+         {
+            goto done;
+         }
+      }
+   }
+
+   same = fgetc(file) == EOF;
+
+done:
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(block);
+
+   return same;
+}
+
+static int
+resume_incremental(char* path, uint32_t block, char seed, uint32_t truncation_block_length, size_t block_size)
+{
+   uint32_t header[4];
+   char* page = NULL;
+   FILE* file = NULL;
+
+   header[0] = INCREMENTAL_MAGIC;
+   header[1] = 1;
+   header[2] = truncation_block_length;
+   header[3] = block;
+
+   page = (char*)calloc(1, block_size);
+   file = fopen(path, "w");
+   if (page == NULL || file == NULL)
+   {
+      goto error;
+   }
+
+   // the header is padded to a whole block, followed by the changed block
+   memcpy(page, header, sizeof(header));
+   if (fwrite(page, 1, block_size, file) != block_size)
+   {
+      goto error;
+   }
+
+   memset(page, seed, block_size);
+   if (fwrite(page, 1, block_size, file) != block_size)
+   {
+      goto error;
+   }
+
+   fclose(file);
+   free(page);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(page);
+
+   return 1;
+}
+
+static bool
+resume_manifest_has(char* path, char* name)
+{
+   bool has = false;
+   char* p = NULL;
+   struct json* manifest = NULL;
+   struct json* files = NULL;
+   struct json_iterator* iter = NULL;
+
+   if (pgmoneta_json_read_file(path, &manifest))
+   {
+      return false;
+   }
+
+   files = (struct json*)pgmoneta_json_get(manifest, MANIFEST_FILES);
+   if (files == NULL || pgmoneta_json_iterator_create(files, &iter))
+   {
+      pgmoneta_json_destroy(manifest);
+      return false;
+   }
+
+   while (!has && pgmoneta_json_iterator_next(iter))
+   {
+      p = (char*)pgmoneta_json_get((struct json*)pgmoneta_value_data(iter->value), "Path");
+      has = p != NULL && !strcmp(p, name);
+   }
+
+   pgmoneta_json_iterator_destroy(iter);
+   pgmoneta_json_destroy(manifest);
+
+   return has;
+}
+
+static int
+restore_wal_segment(char* directory, int segment)
+{
+   char path[MAX_PATH * 2];
+   FILE* file = NULL;
+
+   snprintf(path, sizeof(path), "%s00000001%016X", directory, segment);
+
+   file = fopen(path, "w");
+   if (file == NULL)
+   {
+      return 1;
+   }
+
+   // too short for a page header, so the segment isn't padded when staged
+   fprintf(file, "segment %d", segment);
+   fclose(file);
+
+   return 0;
+}
+
+static bool
+restore_wal_request(int server, int segment, char* destination)
+{
+   bool status = false;
+   int fds[2] = {-1, -1};
+   pid_t pid;
+   uint8_t compression;
+   uint8_t encryption;
+   char filename[MISC_LENGTH];
+   struct json* payload = NULL;
+   struct json* read = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   snprintf(filename, sizeof(filename), "00000001%016X", segment);
+
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+   {
+      return false;
+   }
+
+   // the request is served in a process of its own, like the main process does
+   pid = fork();
+   if (pid == -1)
+   {
+      goto done;
+   }
+   else if (pid == 0)
+   {
+      close(fds[0]);
+
+      if (!pgmoneta_management_read_json(NULL, fds[1], &compression, &encryption, &payload))
+      {
+         pgmoneta_restore_wal(NULL, fds[1], server, compression, encryption, payload);
+      }
+
+      exit(1);
+   }
+
+   close(fds[1]);
+   fds[1] = -1;
+
+   if (!pgmoneta_management_request_restore_wal(NULL, fds[0], config->common.servers[server].name, filename, destination,
+                                                MANAGEMENT_COMPRESSION_NONE, MANAGEMENT_ENCRYPTION_NONE,
+                                                MANAGEMENT_OUTPUT_FORMAT_JSON) &&
+       !pgmoneta_management_read_json(NULL, fds[0], NULL, NULL, &read))
+   {
+      status = (bool)pgmoneta_json_get((struct json*)pgmoneta_json_get(read, MANAGEMENT_CATEGORY_OUTCOME),
+                                       MANAGEMENT_ARGUMENT_STATUS);
+
+      if (status && pgmoneta_management_read_file(NULL, fds[0], destination))
+      {
+         status = false;
+      }
+   }
+
+   close(fds[0]);
+   fds[0] = -1;
+
+   // the prefetch is done once the process is gone
+   waitpid(pid, NULL, 0);
+
+done:
+   for (int i = 0; i < 2; i++)
+   {
+      if (fds[i] != -1)
+      {
+         close(fds[i]);
+      }
+   }
+   pgmoneta_json_destroy(read);
+
+   return status;
+}
+
+static bool
+restore_wal_same(char* path, int segment)
+{
+   char expected[MISC_LENGTH];
+   char buffer[MISC_LENGTH];
+   size_t n;
+   FILE* file = NULL;
+
+   snprintf(expected, sizeof(expected), "segment %d", segment);
+
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      return false;
+   }
+
+   memset(buffer, 0, sizeof(buffer));
+   n = fread(buffer, 1, sizeof(buffer) - 1, file);
+   fclose(file);
+
+   return n == strlen(expected) && !strcmp(buffer, expected);
+}
+
+static int
+restore_wal_touch(char* path)
+{
+   FILE* file = NULL;
+
+   file = fopen(path, "w");
+   if (file == NULL)
+   {
+      return 1;
+   }
+
+   fclose(file);
+
+   return 0;
+}
@@ -30,11 +30,28 @@
 #include <art.h>
 #include <brt.h>
 #include <tsclient.h>
+#include <utils.h>
 #include <wal.h>
+#include <walfile.h>
 #include <walfile/wal_reader.h>
+#include <zstandard_compression.h>
 
 #include "pgmoneta_test_4.h"
 
+#include <sys/stat.h>
+
+#define WAL_PAD_TRAIL    "/pgmoneta-testsuite/walpad/"
+#define WAL_PAD_SEGSIZE  (16 * 1024 * 1024)
+#define WAL_PAD_BLCKSZ   8192
+#define WAL_PAD_PAGES    100
+
+static int wal_pad_directory(char* directory, size_t size);
+static int wal_pad_segment(char* path);
+static int wal_pad_archived(char* directory, char* path, size_t size);
+static int wal_pad_round_trip(char* directory, char* original, size_t* trimmed);
+static bool wal_pad_same(char* a, char* b);
+static size_t wal_pad_used(char* path);
+
 START_TEST(test_pgmoneta_write_multiple_chunks_multiple_representations)
 {
    int found = 0;
@@ -108,6 +125,119 @@ done:
    ck_assert_msg(found, "success status not found");
 }
 END_TEST
+START_TEST(test_pgmoneta_wal_trim_pad_zero_tail)
+{
+   int found = 0;
+   size_t trimmed = 0;
+   char directory[MAX_PATH];
+   char original[MAX_PATH * 2];
+
+   if (wal_pad_directory(directory, sizeof(directory)))
+   {
+      goto done;
+   }
+
+   snprintf(original, sizeof(original), "%s/000000010000000000000003", directory);
+   ck_assert_msg(!wal_pad_segment(original), "segment not written");
+
+   ck_assert_msg(!wal_pad_round_trip(directory, original, &trimmed), "segment not trimmed and padded");
+   ck_assert_msg(trimmed == WAL_PAD_PAGES * WAL_PAD_BLCKSZ, "trimmed to %zu bytes", trimmed);
+
+   found = 1;
+
+done:
+   pgmoneta_delete_directory(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_wal_trim_pad_switch)
+{
+   int found = 0;
+   size_t trimmed = 0;
+   size_t used = 0;
+   char directory[MAX_PATH];
+   char original[MAX_PATH * 2];
+
+   if (wal_pad_directory(directory, sizeof(directory)))
+   {
+      goto done;
+   }
+
+   // the backups of the earlier suites end with a WAL switch on the server
+   ck_assert_msg(!wal_pad_archived(directory, original, sizeof(original)), "no archived segment");
+
+   // the switch leaves the rest of the segment unused
+   used = wal_pad_used(original);
+   ck_assert_msg(used > 0 && used < WAL_PAD_SEGSIZE, "segment uses %zu bytes", used);
+
+   ck_assert_msg(!wal_pad_round_trip(directory, original, &trimmed), "segment not trimmed and padded");
+   ck_assert_msg(trimmed == used, "trimmed to %zu bytes, %zu used", trimmed, used);
+
+   found = 1;
+
+done:
+   pgmoneta_delete_directory(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+// test how the servers are spread over the WAL receivers
+START_TEST(test_pgmoneta_wal_receivers_assign)
+{
+   int found = 0;
+   int number_of_servers;
+   int saved[4];
+   int servers[] = {0, 1, 2, 3};
+   int started[NUMBER_OF_SERVERS];
+   bool running[NUMBER_OF_SERVERS];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   number_of_servers = config->common.number_of_servers;
+   for (int i = 0; i < 4; i++)
+   {
+      saved[i] = config->common.servers[i].wal_receiver;
+      config->common.servers[i].wal_receiver = -1;
+   }
+   config->common.number_of_servers = 4;
+   memset(running, 0, sizeof(running));
+
+   // two new receivers share the four servers
+   ck_assert_msg(pgmoneta_wal_receivers_assign(servers, 4, running, 2, started) == 2, "two receivers not started");
+   ck_assert_msg(started[0] == 0 && started[1] == 1, "receivers %d and %d started", started[0], started[1]);
+   ck_assert_msg(config->common.servers[0].wal_receiver == 0 && config->common.servers[1].wal_receiver == 1 &&
+                 config->common.servers[2].wal_receiver == 0 && config->common.servers[3].wal_receiver == 1,
+                 "servers not spread round-robin");
+
+   // a late server goes to the running receiver with the fewest servers
+   running[0] = true;
+   running[1] = true;
+   config->common.servers[1].wal_receiver = 0;
+   config->common.servers[3].wal_receiver = -1;
+   ck_assert_msg(pgmoneta_wal_receivers_assign(servers, 3, running, 2, started) == 0, "a receiver was started");
+   ck_assert_msg(config->common.servers[3].wal_receiver == -1, "a server that isn't streamed was assigned");
+   ck_assert_msg(pgmoneta_wal_receivers_assign(servers, 4, running, 2, started) == 0, "a receiver was started");
+   ck_assert_msg(config->common.servers[3].wal_receiver == 1, "server assigned to receiver %d",
+                 config->common.servers[3].wal_receiver);
+
+   // the servers of a receiver that is gone go to its replacement
+   running[1] = false;
+   ck_assert_msg(pgmoneta_wal_receivers_assign(servers, 4, running, 2, started) == 1, "no receiver started");
+   ck_assert_msg(started[0] == 1, "receiver %d started", started[0]);
+   ck_assert_msg(config->common.servers[3].wal_receiver == 1, "server assigned to receiver %d",
+                 config->common.servers[3].wal_receiver);
+   ck_assert_msg(config->common.servers[0].wal_receiver == 0 && config->common.servers[1].wal_receiver == 0 &&
+                 config->common.servers[2].wal_receiver == 0, "the servers of a live receiver moved");
+
+   found = 1;
+
+   config->common.number_of_servers = number_of_servers;
+   for (int i = 0; i < 4; i++)
+   {
+      config->common.servers[i].wal_receiver = saved[i];
+   }
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
 
 Suite*
 pgmoneta_test4_suite()
@@ -121,7 +251,235 @@ pgmoneta_test4_suite()
    tcase_set_timeout(tc_core, 60);
    tcase_add_test(tc_core, test_pgmoneta_write_multiple_chunks_multiple_representations);
    tcase_add_test(tc_core, test_pgmoneta_read_summary_get_blocks);
+   tcase_add_test(tc_core, test_pgmoneta_wal_trim_pad_zero_tail);
+   tcase_add_test(tc_core, test_pgmoneta_wal_trim_pad_switch);
+   tcase_add_test(tc_core, test_pgmoneta_wal_receivers_assign);
    suite_add_tcase(s, tc_core);
 
    return s;
-}
\ No newline at end of file
+}
+
+static int
+wal_pad_directory(char* directory, size_t size)
+{
+   snprintf(directory, size, "%s%s", project_directory, WAL_PAD_TRAIL);
+
+   if (pgmoneta_exists(directory))
+   {
+      pgmoneta_delete_directory(directory);
+   }
+
+   return pgmoneta_mkdir(directory);
+}
+
+static int
+wal_pad_segment(char* path)
+{
+   char page[WAL_PAD_BLCKSZ];
+   struct xlog_long_page_header_data* header = (struct xlog_long_page_header_data*)page;
+   FILE* file = NULL;
+
+   file = fopen(path, "w");
+   if (file == NULL)
+   {
+      return 1;
+   }
+
+   // the used pages continue the segment, the rest is the zero fill of a new segment
+   for (int i = 0; i < WAL_PAD_SEGSIZE / WAL_PAD_BLCKSZ; i++)
+   {
+      memset(page, 0, sizeof(page));
+
+      if (i < WAL_PAD_PAGES)
+      {
+         for (size_t j = SIZE_OF_XLOG_LONG_PHD; j < sizeof(page); j++)
+         {
+            page[j] = (char)(j * 7 + i);
+         }
+
+         header->std.xlp_magic = XLOG_PAGE_MAGIC;
+         header->std.xlp_tli = 1;
+         header->std.xlp_pageaddr = 3ULL * WAL_PAD_SEGSIZE + (uint64_t)i * WAL_PAD_BLCKSZ;
+
+         if (i == 0)
+         {
+            header->xlp_sysid = 7000000000000000000ULL;
+            header->xlp_seg_size = WAL_PAD_SEGSIZE;
+            header->xlp_xlog_blcksz = WAL_PAD_BLCKSZ;
+         }
+      }
+
+      if (fwrite(page, 1, sizeof(page), file) != sizeof(page))
+      {
+         fclose(file);
+         return 1;
+      }
+   }
+
+   fclose(file);
+
+   return 0;
+}
+
+static int
+wal_pad_archived(char* directory, char* path, size_t size)
+{
+   int ret = 1;
+   int number_of_files = 0;
+   char** files = NULL;
+   char* basename = NULL;
+   char* waldir = NULL;
+   char from[MAX_PATH * 2];
+   char to[MAX_PATH * 2];
+
+   waldir = pgmoneta_get_server_wal(0);
+
+   if (waldir == NULL || pgmoneta_get_wal_range(waldir, NULL, &number_of_files, &files))
+   {
+      goto done;
+   }
+
+   for (int i = 0; ret && i < number_of_files; i++)
+   {
+      if (pgmoneta_strip_wal_extensions(files[i], &basename))
+      {
+         goto done;
+      }
+
+      // a complete segment, as it is stored or compressed with zstd
+      if (pgmoneta_is_wal_file(basename) && strstr(files[i], ".partial") == NULL &&
+          (!strcmp(files[i], basename) || pgmoneta_ends_with(files[i], ".zstd")))
+      {
+         snprintf(from, sizeof(from), "%s%s", waldir, files[i]);
+         snprintf(to, sizeof(to), "%s%s", directory, files[i]);
+         snprintf(path, size, "%s%s", directory, basename);
+
+         if (pgmoneta_copy_file(from, to, NULL))
+         {
+            goto done;
+         }
+
+         // the decompression pads the segment back to its size
+         if (strcmp(to, path) && pgmoneta_zstandardd_file(to, path))
+         {
+            goto done;
+         }
+
+         ret = pgmoneta_get_file_size(path) == WAL_PAD_SEGSIZE ? 0 : 1;
+      }
+
+      free(basename);
+      basename = NULL;
+   }
+
+done:
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+   free(basename);
+   free(waldir);
+
+   return ret;
+}
+
+static int
+wal_pad_round_trip(char* directory, char* original, size_t* trimmed)
+{
+   char path[MAX_PATH * 2];
+
+   snprintf(path, sizeof(path), "%s/trimmed", directory);
+
+   if (pgmoneta_copy_file(original, path, NULL) || pgmoneta_wal_trim(path))
+   {
+      return 1;
+   }
+
+   *trimmed = pgmoneta_get_file_size(path);
+
+   if (pgmoneta_wal_pad(path) || !wal_pad_same(original, path))
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static bool
+wal_pad_same(char* a, char* b)
+{
+   bool same = false;
+   char x[WAL_PAD_BLCKSZ];
+   char y[WAL_PAD_BLCKSZ];
+   size_t n;
+   FILE* fa = NULL;
+   FILE* fb = NULL;
+
+   fa = fopen(a, "r");
+   fb = fopen(b, "r");
+   if (fa == NULL || fb == NULL)
+   {
+      goto done;
+   }
+
+   do
+   {
+      n = fread(x, 1, sizeof(x), fa);
+      if (fread(y, 1, sizeof(y), fb) != n || memcmp(x, y, n))
+      {
+         goto done;
+      }
+   }
+   while (n > 0);
+
+   same = true;
+
+done:
+   if (fa != NULL)
+   {
+      fclose(fa);
+   }
+   if (fb != NULL)
+   {
+      fclose(fb);
+   }
+
+   return same;
+}
+
+static size_t
+wal_pad_used(char* path)
+{
+   char page[WAL_PAD_BLCKSZ];
+   struct xlog_long_page_header_data first;
+   struct xlog_page_header_data* header = (struct xlog_page_header_data*)page;
+   size_t used = 0;
+   FILE* file = NULL;
+
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      return 0;
+   }
+
+   // the used pages are the ones that continue the addresses of the first page
+   while (fread(page, 1, sizeof(page), file) == sizeof(page))
+   {
+      if (used == 0)
+      {
+         memcpy(&first, page, sizeof(first));
+      }
+
+      if (header->xlp_magic != first.std.xlp_magic || header->xlp_pageaddr != first.std.xlp_pageaddr + used)
+      {
+         break;
+      }
+
+      used += sizeof(page);
+   }
+
+   fclose(file);
+
+   return used;
+}
@@ -0,0 +1,408 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <pgmoneta.h>
+#include <tsclient.h>
+#include <utils.h>
+#include <walindex.h>
+
+#include "pgmoneta_test_5.h"
+
+#include <sys/stat.h>
+
+#define WAL_INDEX_TRAIL    "/pgmoneta-testsuite/walindex/"
+#define WAL_INDEX_SEGSIZE  (16 * 1024 * 1024)
+#define WAL_INDEX_RECORDS  5000
+
+static int walindex_directory(char* name, char* directory, size_t size);
+static int walindex_touch(char* directory, char* filename);
+static void walindex_remove(char* directory);
+
+START_TEST(test_pgmoneta_wal_index_add)
+{
+   int found = 0;
+   char directory[MAX_PATH];
+   char path[MAX_PATH * 2];
+   char* name = NULL;
+   struct wal_index* index = NULL;
+
+   if (walindex_directory("add", directory, sizeof(directory)) ||
+       walindex_touch(directory, "000000010000000000000001") ||
+       walindex_touch(directory, "000000010000000000000002.zstd") ||
+       walindex_touch(directory, "000000010000000000000003.partial") ||
+       walindex_touch(directory, "000000010000000000000003.tmp"))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(!pgmoneta_wal_index_create(directory, WAL_INDEX_SEGSIZE), "index not created");
+   ck_assert_msg(!pgmoneta_wal_index_load(directory, &index), "index not loaded");
+   ck_assert_msg(index->number_of_entries == 3, "expected 3 segments, got %d", index->number_of_entries);
+   pgmoneta_wal_index_destroy(index);
+   index = NULL;
+
+   // the partial segment is completed and a new one is started
+   snprintf(path, sizeof(path), "%s/000000010000000000000003", directory);
+   if (walindex_touch(directory, "000000010000000000000003") ||
+       walindex_touch(directory, "000000010000000000000004.partial"))
+   {
+      goto done;
+   }
+   ck_assert_msg(!pgmoneta_wal_index_add(path), "segment not recorded");
+   snprintf(path, sizeof(path), "%s/000000010000000000000004.partial", directory);
+   ck_assert_msg(!pgmoneta_wal_index_add(path), "segment not recorded");
+   snprintf(path, sizeof(path), "%s/000000010000000000000004.tmp", directory);
+   ck_assert_msg(!pgmoneta_wal_index_add(path), "a file that isn't a segment isn't ignored");
+
+   ck_assert_msg(!pgmoneta_wal_index_load(directory, &index), "index not loaded");
+   ck_assert_msg(index->number_of_entries == 4, "expected 4 segments, got %d", index->number_of_entries);
+
+   name = pgmoneta_wal_index_name(index, 2);
+   ck_assert_msg(name != NULL && !strcmp(name, "000000010000000000000003"), "segment 3 is %s", name);
+   free(name);
+
+   name = pgmoneta_wal_index_name(index, 3);
+   ck_assert_msg(name != NULL && !strcmp(name, "000000010000000000000004.partial"), "segment 4 is %s", name);
+
+   found = 1;
+
+done:
+   free(name);
+   pgmoneta_wal_index_destroy(index);
+   walindex_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_wal_index_truncate)
+{
+   int found = 0;
+   char directory[MAX_PATH];
+   char* name = NULL;
+   struct wal_index* index = NULL;
+
+   if (walindex_directory("truncate", directory, sizeof(directory)))
+   {
+      goto done;
+   }
+
+   for (int i = 1; i <= 5; i++)
+   {
+      char filename[MISC_LENGTH];
+
+      snprintf(filename, sizeof(filename), "%08X%08X%08X", 1, 0, i);
+      if (walindex_touch(directory, filename))
+      {
+         goto done;
+      }
+   }
+
+   ck_assert_msg(!pgmoneta_wal_index_create(directory, WAL_INDEX_SEGSIZE), "index not created");
+
+   ck_assert_msg(!pgmoneta_wal_index_truncate(directory, "000000010000000000000003"), "index not truncated");
+   ck_assert_msg(!pgmoneta_wal_index_load(directory, &index), "index not loaded");
+   ck_assert_msg(index->number_of_entries == 3, "expected 3 segments, got %d", index->number_of_entries);
+
+   name = pgmoneta_wal_index_name(index, 0);
+   ck_assert_msg(name != NULL && !strcmp(name, "000000010000000000000003"), "first segment is %s", name);
+   free(name);
+   name = NULL;
+   pgmoneta_wal_index_destroy(index);
+   index = NULL;
+
+   ck_assert_msg(!pgmoneta_wal_index_truncate(directory, NULL), "index not truncated");
+   ck_assert_msg(!pgmoneta_wal_index_load(directory, &index), "index not loaded");
+   ck_assert_msg(index->number_of_entries == 0, "expected no segments, got %d", index->number_of_entries);
+
+   found = 1;
+
+done:
+   free(name);
+   pgmoneta_wal_index_destroy(index);
+   walindex_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_wal_index_compact)
+{
+   int found = 0;
+   size_t before;
+   size_t after;
+   char directory[MAX_PATH];
+   char path[MAX_PATH * 2];
+   char file[MAX_PATH * 2];
+   struct wal_index* index = NULL;
+
+   if (walindex_directory("compact", directory, sizeof(directory)) ||
+       walindex_touch(directory, "000000010000000000000001"))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(!pgmoneta_wal_index_create(directory, WAL_INDEX_SEGSIZE), "index not created");
+
+   // every close of the segment leaves a record behind
+   snprintf(file, sizeof(file), "%s/000000010000000000000001", directory);
+   for (int i = 0; i < WAL_INDEX_RECORDS; i++)
+   {
+      ck_assert_msg(!pgmoneta_wal_index_add(file), "segment not recorded");
+   }
+
+   snprintf(path, sizeof(path), "%s.index", directory);
+   before = pgmoneta_get_file_size(path);
+
+   ck_assert_msg(!pgmoneta_wal_index_load(directory, &index), "index not loaded");
+   ck_assert_msg(index->number_of_entries == 1, "expected 1 segment, got %d", index->number_of_entries);
+   pgmoneta_wal_index_destroy(index);
+   index = NULL;
+
+   after = pgmoneta_get_file_size(path);
+   ck_assert_msg(after > 0 && after < before, "index not compacted: %zu -> %zu bytes", before, after);
+
+   ck_assert_msg(!pgmoneta_wal_index_load(directory, &index), "index not loaded");
+   ck_assert_msg(index->number_of_entries == 1, "expected 1 segment, got %d", index->number_of_entries);
+
+   found = 1;
+
+done:
+   pgmoneta_wal_index_destroy(index);
+   walindex_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_wal_index_rebuild)
+{
+   int found = 0;
+   char directory[MAX_PATH];
+   char path[MAX_PATH * 2];
+   struct wal_index* index = NULL;
+
+   if (walindex_directory("rebuild", directory, sizeof(directory)) ||
+       walindex_touch(directory, "000000010000000000000001") ||
+       walindex_touch(directory, "000000010000000000000002"))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(!pgmoneta_wal_index_create(directory, WAL_INDEX_SEGSIZE), "index not created");
+
+   // the directory is changed by someone not keeping the index
+   snprintf(path, sizeof(path), "%s/000000010000000000000001", directory);
+   pgmoneta_delete_file(path, NULL);
+   if (walindex_touch(directory, "000000020000000000000003.gz.aes"))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(!pgmoneta_wal_index_create(directory, WAL_INDEX_SEGSIZE), "index not kept");
+   ck_assert_msg(!pgmoneta_wal_index_load(directory, &index), "index not loaded");
+   ck_assert_msg(index->number_of_entries == 2, "expected 2 segments, got %d", index->number_of_entries);
+   pgmoneta_wal_index_destroy(index);
+   index = NULL;
+
+   ck_assert_msg(!pgmoneta_wal_index_rebuild(directory, WAL_INDEX_SEGSIZE), "index not rebuilt");
+   ck_assert_msg(!pgmoneta_wal_index_load(directory, &index), "index not loaded");
+   ck_assert_msg(index->number_of_entries == 2, "expected 2 segments, got %d", index->number_of_entries);
+   ck_assert_msg(index->entries[0].seg == 2, "first segment is %u", index->entries[0].seg);
+   ck_assert_msg(index->entries[1].timeline == 2 && index->entries[1].compression == COMPRESSION_CLIENT_GZIP &&
+                 index->entries[1].encrypted, "second segment not recorded as it is on disk");
+
+   found = 1;
+
+done:
+   pgmoneta_wal_index_destroy(index);
+   walindex_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_wal_index_lookup)
+{
+   int found = 0;
+   int position;
+   char directory[MAX_PATH];
+   struct wal_index* index = NULL;
+
+   if (walindex_directory("lookup", directory, sizeof(directory)) ||
+       walindex_touch(directory, "000000010000000000000001") ||
+       walindex_touch(directory, "0000000100000000000000FF") ||
+       walindex_touch(directory, "000000010000000100000001") ||
+       walindex_touch(directory, "000000020000000100000002.partial"))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(!pgmoneta_wal_index_create(directory, WAL_INDEX_SEGSIZE), "index not created");
+   ck_assert_msg(!pgmoneta_wal_index_load(directory, &index), "index not loaded");
+   ck_assert_msg(index->segsize == WAL_INDEX_SEGSIZE, "segment size is %d", index->segsize);
+
+   // by name, suffixes are ignored
+   position = pgmoneta_wal_index_search(index, "0000000100000000000000FF.zstd");
+   ck_assert_msg(position == 1, "segment 0xFF at %d", position);
+
+   position = pgmoneta_wal_index_search(index, "000000010000000000000002");
+   ck_assert_msg(position == 1, "next segment after 2 at %d", position);
+
+   position = pgmoneta_wal_index_search(index, "000000030000000000000001");
+   ck_assert_msg(position == index->number_of_entries, "segment past the end at %d", position);
+
+   // by position, 256 segments of 16 MB for each log id
+   position = pgmoneta_wal_index_find(index, 1, 0x1000000ULL + 100);
+   ck_assert_msg(position == 0, "segment of 0/1000064 at %d", position);
+
+   position = pgmoneta_wal_index_find(index, 1, 0x101000000ULL);
+   ck_assert_msg(position == 2, "segment of 1/1000000 at %d", position);
+
+   position = pgmoneta_wal_index_find(index, 2, 0x102000000ULL + 8192);
+   ck_assert_msg(position == 3, "segment of 1/2002000 on timeline 2 at %d", position);
+   ck_assert_msg(index->entries[position].partial, "segment on timeline 2 is partial");
+
+   found = 1;
+
+done:
+   pgmoneta_wal_index_destroy(index);
+   walindex_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_wal_index_renamed)
+{
+   int found = 0;
+   char directory[MAX_PATH];
+   char from[MAX_PATH * 2];
+   char to[MAX_PATH * 2];
+   char* name = NULL;
+   struct wal_index* index = NULL;
+
+   if (walindex_directory("renamed", directory, sizeof(directory)) ||
+       walindex_touch(directory, "000000010000000000000001.partial") ||
+       walindex_touch(directory, "000000010000000000000002"))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(!pgmoneta_wal_index_create(directory, WAL_INDEX_SEGSIZE), "index not created");
+
+   // completed, compressed and encrypted without the index knowing
+   snprintf(from, sizeof(from), "%s/000000010000000000000001.partial", directory);
+   snprintf(to, sizeof(to), "%s/000000010000000000000001.zstd.aes", directory);
+   ck_assert_msg(!rename(from, to), "segment 1 not renamed");
+
+   snprintf(from, sizeof(from), "%s/000000010000000000000002", directory);
+   pgmoneta_delete_file(from, NULL);
+
+   ck_assert_msg(!pgmoneta_wal_index_load(directory, &index), "index not loaded");
+
+   name = pgmoneta_wal_index_name(index, 0);
+   ck_assert_msg(name != NULL && !strcmp(name, "000000010000000000000001.partial"), "recorded name is %s", name);
+   free(name);
+
+   name = pgmoneta_wal_index_file(index, 0);
+   ck_assert_msg(name != NULL && !strcmp(name, "000000010000000000000001.zstd.aes"), "file on disk is %s", name);
+   free(name);
+
+   name = pgmoneta_wal_index_file(index, 1);
+   ck_assert_msg(name == NULL, "removed segment found as %s", name);
+
+   found = 1;
+
+done:
+   free(name);
+   pgmoneta_wal_index_destroy(index);
+   walindex_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+
+Suite*
+pgmoneta_test5_suite()
+{
+   Suite* s;
+   TCase* tc_core;
+   s = suite_create("pgmoneta_test5");
+
+   tc_core = tcase_create("Core");
+
+   tcase_set_timeout(tc_core, 60);
+   tcase_add_test(tc_core, test_pgmoneta_wal_index_add);
+   tcase_add_test(tc_core, test_pgmoneta_wal_index_truncate);
+   tcase_add_test(tc_core, test_pgmoneta_wal_index_compact);
+   tcase_add_test(tc_core, test_pgmoneta_wal_index_rebuild);
+   tcase_add_test(tc_core, test_pgmoneta_wal_index_lookup);
+   tcase_add_test(tc_core, test_pgmoneta_wal_index_renamed);
+   suite_add_tcase(s, tc_core);
+
+   return s;
+}
+
+static int
+walindex_directory(char* name, char* directory, size_t size)
+{
+   snprintf(directory, size, "%s%s%s", project_directory, WAL_INDEX_TRAIL, name);
+
+   walindex_remove(directory);
+
+   return pgmoneta_mkdir(directory);
+}
+
+static int
+walindex_touch(char* directory, char* filename)
+{
+   char path[MAX_PATH * 2];
+   FILE* file = NULL;
+
+   snprintf(path, sizeof(path), "%s/%s", directory, filename);
+
+   file = fopen(path, "w");
+   if (file == NULL)
+   {
+      return 1;
+   }
+
+   fputs(filename, file);
+   fclose(file);
+
+   return 0;
+}
+
+static void
+walindex_remove(char* directory)
+{
+   char path[MAX_PATH * 2];
+
+   snprintf(path, sizeof(path), "%s.index", directory);
+
+   if (pgmoneta_exists(path))
+   {
+      pgmoneta_delete_file(path, NULL);
+   }
+
+   if (pgmoneta_exists(directory))
+   {
+      pgmoneta_delete_directory(directory);
+   }
+}
@@ -0,0 +1,825 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <pgmoneta.h>
+#include <aes.h>
+#include <bzip2_compression.h>
+#include <gzip_compression.h>
+#include <seekable.h>
+#include <shmem.h>
+#include <tsclient.h>
+#include <utils.h>
+#include <workers.h>
+
+#include "pgmoneta_test_6.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define GCM_TRAIL      "/pgmoneta-testsuite/gcm/"
+#define SEEKABLE_TRAIL "/pgmoneta-testsuite/seekable/"
+#define BZIP2_TRAIL    "/pgmoneta-testsuite/bzip2/"
+#define GZIP_TRAIL     "/pgmoneta-testsuite/gzip/"
+
+/* two full chunks and a short one */
+#define GCM_PLAINTEXT_SIZE (2 * AES_GCM_CHUNK_SIZE + AES_GCM_CHUNK_SIZE / 2)
+#define GCM_STORED_CHUNK   (AES_GCM_CHUNK_SIZE + AES_GCM_TAG_SIZE)
+
+/* three full frames and a short one */
+#define SEEKABLE_DATA_SIZE (3 * SEEKABLE_FRAME_SIZE + SEEKABLE_FRAME_SIZE / 2)
+
+/* large enough to be compressed and decompressed in parallel */
+#define PARALLEL_DATA_SIZE (6 * 1024 * 1024)
+
+static int gcm_encrypted(char* name, char* directory, size_t size, char* plain, char* encrypted, size_t length);
+static int gcm_write(char* path, size_t size);
+static bool gcm_verify(char* path, size_t size);
+static unsigned char gcm_byte(size_t offset);
+static int gcm_swap(char* path, off_t a, off_t b, size_t size);
+static void gcm_remove(char* directory);
+static bool seekable_ranges(char* directory, int compression);
+static int bzip2_compressed(char* name, char* directory, size_t size, char* plain, char* compressed, size_t length,
+                            struct workers** workers);
+static int bzip2_headers(char* path, uint64_t* offsets, int max);
+static int data_write(char* path, size_t size);
+static bool data_verify(char* path, size_t size);
+static unsigned char data_byte(size_t offset);
+
+START_TEST(test_pgmoneta_gcm_round_trip)
+{
+   int found = 0;
+   int fd = -1;
+   int encryption;
+   uint64_t size = 0;
+   unsigned char buffer[8192];
+   char directory[MAX_PATH];
+   char plain[MAX_PATH * 2];
+   char encrypted[MAX_PATH * 2];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   encryption = config->encryption;
+   config->encryption = ENCRYPTION_AES_256_GCM;
+
+   if (gcm_encrypted("round_trip", directory, sizeof(directory), plain, encrypted, sizeof(plain)))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(pgmoneta_is_gcm_file(encrypted), "%s isn't in the AES-GCM format", encrypted);
+   ck_assert_msg(pgmoneta_get_file_size(encrypted) == AES_GCM_HEADER_SIZE + GCM_PLAINTEXT_SIZE + 3 * AES_GCM_TAG_SIZE,
+                 "unexpected size of %s", encrypted);
+
+   // a range across the end of the first chunk
+   fd = open(encrypted, O_RDONLY);
+   ck_assert_msg(fd != -1, "could not open %s", encrypted);
+   ck_assert_msg(!pgmoneta_gcm_plaintext_size(fd, &size) && size == GCM_PLAINTEXT_SIZE,
+                 "plaintext size is %" PRIu64, size);
+   ck_assert_msg(!pgmoneta_gcm_read(fd, AES_GCM_CHUNK_SIZE - sizeof(buffer) / 2, buffer, sizeof(buffer)),
+                 "range not read");
+   for (size_t i = 0; i < sizeof(buffer); i++)
+   {
+      ck_assert_msg(buffer[i] == gcm_byte(AES_GCM_CHUNK_SIZE - sizeof(buffer) / 2 + i), "range differs at %zu", i);
+   }
+   close(fd);
+   fd = -1;
+
+   ck_assert_msg(!pgmoneta_decrypt_file(encrypted, plain), "%s not decrypted", encrypted);
+   ck_assert_msg(gcm_verify(plain, GCM_PLAINTEXT_SIZE), "%s differs from the original", plain);
+
+   found = 1;
+
+done:
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   config->encryption = encryption;
+   gcm_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_gcm_tamper_byte)
+{
+   int found = 0;
+   int fd = -1;
+   int encryption;
+   unsigned char b;
+   char directory[MAX_PATH];
+   char plain[MAX_PATH * 2];
+   char encrypted[MAX_PATH * 2];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   encryption = config->encryption;
+   config->encryption = ENCRYPTION_AES_256_GCM;
+
+   if (gcm_encrypted("tamper_byte", directory, sizeof(directory), plain, encrypted, sizeof(plain)))
+   {
+      goto done;
+   }
+
+   // flip a byte in the middle of the second chunk
+   fd = open(encrypted, O_RDWR);
+   ck_assert_msg(fd != -1, "could not open %s", encrypted);
+   ck_assert_msg(pread(fd, &b, 1, AES_GCM_HEADER_SIZE + GCM_STORED_CHUNK + 1000) == 1, "byte not read");
+   b ^= 0x01;
+   ck_assert_msg(pwrite(fd, &b, 1, AES_GCM_HEADER_SIZE + GCM_STORED_CHUNK + 1000) == 1, "byte not written");
+   close(fd);
+   fd = -1;
+
+   ck_assert_msg(pgmoneta_decrypt_file(encrypted, plain), "a changed byte was accepted");
+   ck_assert_msg(!pgmoneta_exists(plain), "plaintext left behind");
+   ck_assert_msg(pgmoneta_exists(encrypted), "encrypted file removed");
+
+   found = 1;
+
+done:
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   config->encryption = encryption;
+   gcm_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_gcm_tamper_truncate)
+{
+   int found = 0;
+   int encryption;
+   char directory[MAX_PATH];
+   char plain[MAX_PATH * 2];
+   char encrypted[MAX_PATH * 2];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   encryption = config->encryption;
+   config->encryption = ENCRYPTION_AES_256_GCM;
+
+   if (gcm_encrypted("tamper_truncate", directory, sizeof(directory), plain, encrypted, sizeof(plain)))
+   {
+      goto done;
+   }
+
+   // drop the last chunk, what is left is a valid file of two chunks
+   ck_assert_msg(!truncate(encrypted, AES_GCM_HEADER_SIZE + 2 * GCM_STORED_CHUNK), "%s not truncated", encrypted);
+
+   ck_assert_msg(pgmoneta_decrypt_file(encrypted, plain), "a file without its last chunk was accepted");
+   ck_assert_msg(!pgmoneta_exists(plain), "plaintext left behind");
+
+   // and cut into the new last chunk
+   ck_assert_msg(!truncate(encrypted, AES_GCM_HEADER_SIZE + GCM_STORED_CHUNK + 4096), "%s not truncated", encrypted);
+
+   ck_assert_msg(pgmoneta_decrypt_file(encrypted, plain), "a cut chunk was accepted");
+   ck_assert_msg(!pgmoneta_exists(plain), "plaintext left behind");
+
+   found = 1;
+
+done:
+   config->encryption = encryption;
+   gcm_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_gcm_tamper_reorder)
+{
+   int found = 0;
+   int encryption;
+   char directory[MAX_PATH];
+   char plain[MAX_PATH * 2];
+   char encrypted[MAX_PATH * 2];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   encryption = config->encryption;
+   config->encryption = ENCRYPTION_AES_256_GCM;
+
+   if (gcm_encrypted("tamper_reorder", directory, sizeof(directory), plain, encrypted, sizeof(plain)))
+   {
+      goto done;
+   }
+
+   // the two full chunks change places, each with its own tag
+   ck_assert_msg(!gcm_swap(encrypted, AES_GCM_HEADER_SIZE, AES_GCM_HEADER_SIZE + GCM_STORED_CHUNK, GCM_STORED_CHUNK),
+                 "chunks not swapped");
+
+   ck_assert_msg(pgmoneta_decrypt_file(encrypted, plain), "reordered chunks were accepted");
+   ck_assert_msg(!pgmoneta_exists(plain), "plaintext left behind");
+
+   found = 1;
+
+done:
+   config->encryption = encryption;
+   gcm_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_seekable_random_reads)
+{
+   int found = 0;
+   char directory[MAX_PATH];
+
+   snprintf(directory, sizeof(directory), "%s%s", project_directory, SEEKABLE_TRAIL);
+
+   gcm_remove(directory);
+
+   if (pgmoneta_mkdir(directory))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(seekable_ranges(directory, COMPRESSION_CLIENT_ZSTD), "zstd ranges differ");
+   ck_assert_msg(seekable_ranges(directory, COMPRESSION_CLIENT_LZ4), "lz4 ranges differ");
+
+   found = 1;
+
+done:
+   gcm_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_bzip2_parallel)
+{
+   int found = 0;
+   int level;
+   bool adaptive;
+   char directory[MAX_PATH];
+   char plain[MAX_PATH * 2];
+   char compressed[MAX_PATH * 2];
+   char stock[MAX_PATH * 2];
+   char command[MAX_PATH * 5];
+   struct workers* workers = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   level = config->compression_level;
+   adaptive = config->compression_adaptive;
+
+   if (bzip2_compressed("parallel", directory, sizeof(directory), plain, compressed, sizeof(plain), &workers))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(bzip2_headers(compressed, NULL, 0) > 2, "%s not compressed in parallel", plain);
+
+   // the streams are one file to the stock tools
+   snprintf(stock, sizeof(stock), "%s/stock", directory);
+   snprintf(command, sizeof(command), "bunzip2 -c '%s' > '%s'", compressed, stock);
+   ck_assert_msg(system(command) == 0, "bunzip2 could not read %s", compressed);
+   ck_assert_msg(data_verify(stock, PARALLEL_DATA_SIZE), "bunzip2 output differs from the original");
+   pgmoneta_delete_file(stock, NULL);
+
+   ck_assert_msg(!pgmoneta_bunzip2_data(directory, workers), "%s not decompressed", compressed);
+   pgmoneta_workers_wait(workers);
+   ck_assert_msg(workers->outcome, "parallel decompression failed");
+   ck_assert_msg(data_verify(plain, PARALLEL_DATA_SIZE), "%s differs from the original", plain);
+   ck_assert_msg(!pgmoneta_exists(compressed), "%s left behind", compressed);
+
+   found = 1;
+
+done:
+   pgmoneta_workers_destroy(workers);
+   config->compression_level = level;
+   config->compression_adaptive = adaptive;
+   gcm_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_bzip2_false_header)
+{
+   int found = 0;
+   int level;
+   int fd = -1;
+   bool adaptive;
+   uint64_t offsets[2];
+   unsigned char header[BZIP2_HEADER_SIZE] = {'B', 'Z', 'h', '1', 0x31, 0x41, 0x59, 0x26, 0x53, 0x59};
+   char directory[MAX_PATH];
+   char plain[MAX_PATH * 2];
+   char compressed[MAX_PATH * 2];
+   char command[MAX_PATH * 3];
+   struct workers* workers = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   level = config->compression_level;
+   adaptive = config->compression_adaptive;
+
+   if (bzip2_compressed("false_header", directory, sizeof(directory), plain, compressed, sizeof(plain), &workers))
+   {
+      goto done;
+   }
+
+   // a stream header in the middle of the first stream splits it in two
+   ck_assert_msg(bzip2_headers(compressed, offsets, 2) > 2, "%s not compressed in parallel", plain);
+   fd = open(compressed, O_WRONLY);
+   ck_assert_msg(fd != -1, "could not open %s", compressed);
+   ck_assert_msg(pwrite(fd, header, sizeof(header), (offsets[0] + offsets[1]) / 2) == sizeof(header),
+                 "header not written");
+   close(fd);
+   fd = -1;
+
+   snprintf(command, sizeof(command), "bunzip2 -t '%s' 2> /dev/null", compressed);
+   ck_assert_msg(system(command) != 0, "bunzip2 accepted %s", compressed);
+
+   // the chunks fail, and so does the serial fallback
+   ck_assert_msg(!pgmoneta_bunzip2_data(directory, workers), "%s not processed", compressed);
+   pgmoneta_workers_wait(workers);
+   ck_assert_msg(!workers->outcome, "a damaged stream was accepted");
+   ck_assert_msg(!pgmoneta_exists(plain), "%s left behind", plain);
+   ck_assert_msg(pgmoneta_exists(compressed), "%s removed", compressed);
+
+   found = 1;
+
+done:
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   pgmoneta_workers_destroy(workers);
+   config->compression_level = level;
+   config->compression_adaptive = adaptive;
+   gcm_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+START_TEST(test_pgmoneta_gzip_parallel)
+{
+   int found = 0;
+   int level;
+   bool adaptive;
+   char directory[MAX_PATH];
+   char plain[MAX_PATH * 2];
+   char compressed[MAX_PATH * 2];
+   char stock[MAX_PATH * 2];
+   char command[MAX_PATH * 5];
+   struct workers* workers = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   level = config->compression_level;
+   adaptive = config->compression_adaptive;
+   config->compression_level = 6;
+   config->compression_adaptive = false;
+
+   snprintf(directory, sizeof(directory), "%s%s", project_directory, GZIP_TRAIL);
+   snprintf(plain, sizeof(plain), "%sfile", directory);
+   snprintf(compressed, sizeof(compressed), "%sfile.gz", directory);
+   snprintf(stock, sizeof(stock), "%sstock", directory);
+
+   gcm_remove(directory);
+
+   if (pgmoneta_mkdir(directory) || data_write(plain, PARALLEL_DATA_SIZE) ||
+       pgmoneta_workers_initialize(4, &workers))
+   {
+      goto done;
+   }
+
+   ck_assert_msg(!pgmoneta_gzip_data(directory, workers), "%s not compressed", plain);
+   pgmoneta_workers_wait(workers);
+   ck_assert_msg(workers->outcome, "parallel compression failed");
+   ck_assert_msg(pgmoneta_exists(compressed) && !pgmoneta_exists(plain), "%s not replaced", plain);
+
+   // the chunks are one member with one checksum to the stock tools
+   snprintf(command, sizeof(command), "gunzip -t '%s'", compressed);
+   ck_assert_msg(system(command) == 0, "gunzip could not verify %s", compressed);
+   snprintf(command, sizeof(command), "gunzip -c '%s' > '%s'", compressed, stock);
+   ck_assert_msg(system(command) == 0, "gunzip could not read %s", compressed);
+   ck_assert_msg(data_verify(stock, PARALLEL_DATA_SIZE), "gunzip output differs from the original");
+   pgmoneta_delete_file(stock, NULL);
+
+   ck_assert_msg(!pgmoneta_gunzip_data(directory, workers), "%s not decompressed", compressed);
+   pgmoneta_workers_wait(workers);
+   ck_assert_msg(workers->outcome, "decompression failed");
+   ck_assert_msg(data_verify(plain, PARALLEL_DATA_SIZE), "%s differs from the original", plain);
+   ck_assert_msg(!pgmoneta_exists(compressed), "%s left behind", compressed);
+
+   found = 1;
+
+done:
+   pgmoneta_workers_destroy(workers);
+   config->compression_level = level;
+   config->compression_adaptive = adaptive;
+   gcm_remove(directory);
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+
+Suite*
+pgmoneta_test6_suite()
+{
+   Suite* s;
+   TCase* tc_core;
+   s = suite_create("pgmoneta_test6");
+
+   tc_core = tcase_create("Core");
+
+   tcase_set_timeout(tc_core, 60);
+   tcase_add_test(tc_core, test_pgmoneta_gcm_round_trip);
+   tcase_add_test(tc_core, test_pgmoneta_gcm_tamper_byte);
+   tcase_add_test(tc_core, test_pgmoneta_gcm_tamper_truncate);
+   tcase_add_test(tc_core, test_pgmoneta_gcm_tamper_reorder);
+   tcase_add_test(tc_core, test_pgmoneta_seekable_random_reads);
+   tcase_add_test(tc_core, test_pgmoneta_bzip2_parallel);
+   tcase_add_test(tc_core, test_pgmoneta_bzip2_false_header);
+   tcase_add_test(tc_core, test_pgmoneta_gzip_parallel);
+   suite_add_tcase(s, tc_core);
+
+   return s;
+}
+
+static int
+gcm_encrypted(char* name, char* directory, size_t size, char* plain, char* encrypted, size_t length)
+{
+   snprintf(directory, size, "%s%s%s", project_directory, GCM_TRAIL, name);
+   snprintf(plain, length, "%s/file", directory);
+   snprintf(encrypted, length, "%s/file.aes", directory);
+
+   gcm_remove(directory);
+
+   if (pgmoneta_mkdir(directory) || gcm_write(plain, GCM_PLAINTEXT_SIZE))
+   {
+      return 1;
+   }
+
+   // the plaintext is removed once it is encrypted
+   if (pgmoneta_encrypt_file(plain, encrypted) || pgmoneta_exists(plain))
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+gcm_write(char* path, size_t size)
+{
+   unsigned char buffer[8192];
+   FILE* file = NULL;
+
+   file = fopen(path, "w");
+   if (file == NULL)
+   {
+      return 1;
+   }
+
+   for (size_t offset = 0; offset < size; offset += sizeof(buffer))
+   {
+      size_t n = MIN(sizeof(buffer), size - offset);
+
+      for (size_t i = 0; i < n; i++)
+      {
+         buffer[i] = gcm_byte(offset + i);
+      }
+
+      if (fwrite(buffer, 1, n, file) != n)
+      {
+         fclose(file);
+         return 1;
+      }
+   }
+
+   fclose(file);
+
+   return 0;
+}
+
+static bool
+gcm_verify(char* path, size_t size)
+{
+   unsigned char buffer[8192];
+   size_t offset = 0;
+   size_t n;
+   FILE* file = NULL;
+
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      return false;
+   }
+
+   while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+   {
+      for (size_t i = 0; i < n; i++)
+      {
+         if (buffer[i] != gcm_byte(offset + i))
+         {
+            fclose(file);
+            return false;
+         }
+      }
+      offset += n;
+   }
+
+   fclose(file);
+
+   return offset == size;
+}
+
+static unsigned char
+gcm_byte(size_t offset)
+{
+   // differs between chunks, so a moved chunk is not the same plaintext
+   return (unsigned char)((offset * 31) ^ (offset / AES_GCM_CHUNK_SIZE + 1) * 97);
+}
+
+static int
+gcm_swap(char* path, off_t a, off_t b, size_t size)
+{
+   int fd = -1;
+   unsigned char* x = NULL;
+   unsigned char* y = NULL;
+
+   x = (unsigned char*)malloc(size);
+   y = (unsigned char*)malloc(size);
+   fd = open(path, O_RDWR);
+
+   if (x == NULL || y == NULL || fd == -1 ||
+       pread(fd, x, size, a) != (ssize_t)size ||
+       pread(fd, y, size, b) != (ssize_t)size ||
+       pwrite(fd, y, size, a) != (ssize_t)size ||
+       pwrite(fd, x, size, b) != (ssize_t)size)
+   {
+      goto error;
+   }
+
+   close(fd);
+   free(x);
+   free(y);
+
+   return 0;
+
+error:
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   free(x);
+   free(y);
+
+   return 1;
+}
+
+static void
+gcm_remove(char* directory)
+{
+   if (pgmoneta_exists(directory))
+   {
+      pgmoneta_delete_directory(directory);
+   }
+}
+
+static bool
+seekable_ranges(char* directory, int compression)
+{
+   bool same = false;
+   size_t nread = 0;
+   unsigned char buffer[8192];
+   char plain[MAX_PATH * 2];
+   char compressed[MAX_PATH * 2];
+   struct seekable_reader* reader = NULL;
+   /* offset and size of each read, out of order and across the frames */
+   uint64_t ranges[][2] = {
+      {SEEKABLE_FRAME_SIZE - 100, 200},
+      {0, 100},
+      {2 * SEEKABLE_FRAME_SIZE + 5000, sizeof(buffer)},
+      {SEEKABLE_FRAME_SIZE + 1, 1},
+      {3 * SEEKABLE_FRAME_SIZE - sizeof(buffer) / 2, sizeof(buffer)},
+   };
+
+   snprintf(plain, sizeof(plain), "%sfile", directory);
+   snprintf(compressed, sizeof(compressed), "%sfile.%d", directory, compression);
+
+   if (data_write(plain, SEEKABLE_DATA_SIZE) ||
+       pgmoneta_seekable_compress_file(plain, compressed, compression, 1, false) ||
+       pgmoneta_seekable_open(compressed, compression, ENCRYPTION_NONE, &reader))
+   {
+      goto done;
+   }
+
+   if (reader->number_of_frames != 4 || reader->size != SEEKABLE_DATA_SIZE)
+   {
+      goto done;
+   }
+
+   for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+   {
+      if (pgmoneta_seekable_read(reader, ranges[r][0], buffer, ranges[r][1], &nread) || nread != ranges[r][1])
+      {
+         goto done;
+      }
+
+      for (size_t i = 0; i < nread; i++)
+      {
+         if (buffer[i] != data_byte(ranges[r][0] + i))
+         {
+            goto done;
+         }
+      }
+   }
+
+   // a read past the end is short, and a read at the end is empty
+   if (pgmoneta_seekable_read(reader, SEEKABLE_DATA_SIZE - 10, buffer, sizeof(buffer), &nread) || nread != 10 ||
+       buffer[9] != data_byte(SEEKABLE_DATA_SIZE - 1))
+   {
+      goto done;
+   }
+
+   if (pgmoneta_seekable_read(reader, SEEKABLE_DATA_SIZE, buffer, sizeof(buffer), &nread) || nread != 0)
+   {
+      goto done;
+   }
+
+   same = true;
+
+done:
+   pgmoneta_seekable_close(reader);
+
+   return same;
+}
+
+static int
+bzip2_compressed(char* name, char* directory, size_t size, char* plain, char* compressed, size_t length,
+                 struct workers** workers)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   snprintf(directory, size, "%s%s%s", project_directory, BZIP2_TRAIL, name);
+   snprintf(plain, length, "%s/file", directory);
+   snprintf(compressed, length, "%s/file.bz2", directory);
+
+   gcm_remove(directory);
+
+   // one stream per 100kB block
+   config->compression_level = 1;
+   config->compression_adaptive = false;
+
+   if (pgmoneta_mkdir(directory) || data_write(plain, PARALLEL_DATA_SIZE) ||
+       pgmoneta_workers_initialize(4, workers))
+   {
+      return 1;
+   }
+
+   if (pgmoneta_bzip2_data(directory, *workers))
+   {
+      return 1;
+   }
+
+   pgmoneta_workers_wait(*workers);
+
+   if (!(*workers)->outcome || !pgmoneta_exists(compressed) || pgmoneta_exists(plain))
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+bzip2_headers(char* path, uint64_t* offsets, int max)
+{
+   int n = 0;
+   size_t size;
+   unsigned char* data = NULL;
+   FILE* file = NULL;
+
+   size = pgmoneta_get_file_size(path);
+   data = (unsigned char*)malloc(size);
+   file = fopen(path, "r");
+
+   if (data == NULL || file == NULL || fread(data, 1, size, file) != size)
+   {
+      n = -1;
+      goto done;
+   }
+
+   // "BZh", the block size and the magic of the first block
+   for (size_t i = 0; i + BZIP2_HEADER_SIZE <= size; i++)
+   {
+      if (data[i] == 'B' && data[i + 1] == 'Z' && data[i + 2] == 'h' && data[i + 3] >= '1' && data[i + 3] <= '9' &&
+          !memcmp(data + i + 4, "\x31\x41\x59\x26\x53\x59", 6))
+      {
+         if (n < max)
+         {
+            offsets[n] = i;
+         }
+         n++;
+      }
+   }
+
+done:
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(data);
+
+   return n;
+}
+
+static int
+data_write(char* path, size_t size)
+{
+   unsigned char buffer[8192];
+   FILE* file = NULL;
+
+   file = fopen(path, "w");
+   if (file == NULL)
+   {
+      return 1;
+   }
+
+   for (size_t offset = 0; offset < size; offset += sizeof(buffer))
+   {
+      size_t n = MIN(sizeof(buffer), size - offset);
+
+      for (size_t i = 0; i < n; i++)
+      {
+         buffer[i] = data_byte(offset + i);
+      }
+
+      if (fwrite(buffer, 1, n, file) != n)
+      {
+         fclose(file);
+         return 1;
+      }
+   }
+
+   fclose(file);
+
+   return 0;
+}
+
+static bool
+data_verify(char* path, size_t size)
+{
+   unsigned char buffer[8192];
+   size_t offset = 0;
+   size_t n;
+   FILE* file = NULL;
+
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      return false;
+   }
+
+   while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+   {
+      for (size_t i = 0; i < n; i++)
+      {
+         if (buffer[i] != data_byte(offset + i))
+         {
+            fclose(file);
+            return false;
+         }
+      }
+      offset += n;
+   }
+
+   fclose(file);
+
+   return offset == size;
+}
+
+static unsigned char
+data_byte(size_t offset)
+{
+   uint64_t x = (uint64_t)offset * 0x9E3779B97F4A7C15ULL;
+
+   // sixteen values with no pattern, so the data compresses to about half
+   x ^= x >> 29;
+   x *= 0xBF58476D1CE4E5B9ULL;
+   x ^= x >> 32;
+
+   return (unsigned char)('a' + (x & 0x0f));
+}